@@ -0,0 +1,461 @@
+#!/usr/bin/env python3
+"""
+Asset Conditioner
+Converts WAV files into the format the device plays without conversion, before
+they are uploaded.
+
+Each output file is:
+    - 44100 Hz, 16 bit, stereo PCM (resampled, TPDF dithered, mono doubled)
+    - laid out so the data chunk starts on a 512 byte SD sector (JUNK padding)
+    - tagged with a smpl loop (the whole file unless given, or the source's loop)
+    - tagged with its loudness in a bext v2 chunk: integrated loudness and
+      loudness range (EBU R128 / BS.1770-4), max true peak, max momentary and
+      short-term loudness
+
+Every file written is checked with loudframe_wavinfo, the firmware's WAV
+parser built for the host (see ../host/README.md).
+
+Usage:
+    python asset_conditioner.py [options] input.wav [input.wav ...]
+
+Examples:
+    # Condition into ./conditioned
+    python asset_conditioner.py loops/*.wav
+
+    # Loop from 1.5 s to the end, normalize to -16 LUFS (true peak kept under -1 dBTP)
+    python asset_conditioner.py --loop-start 1.5 --target-lufs -16 pad.wav
+
+    # As a library (file_manager.py --condition does this)
+    from asset_conditioner import condition_file
+    out = condition_file(Path('pad.wav'), Path('/tmp/out'))
+"""
+
+import argparse
+import logging
+import os
+import shutil
+import struct
+import subprocess
+import sys
+from dataclasses import dataclass
+from math import gcd
+from pathlib import Path
+from typing import Dict, Optional, Tuple
+
+import numpy as np
+
+logging.basicConfig(
+    level=logging.INFO,
+    format='%(asctime)s - %(levelname)s - %(message)s',
+    datefmt='%Y-%m-%d %H:%M:%S'
+)
+logger = logging.getLogger(__name__)
+
+# main/wav_header.h
+NATIVE_RATE = 44100
+NATIVE_BITS = 16
+NATIVE_CHANNELS = 2
+DATA_ALIGN = 512
+
+WAVE_FORMAT_PCM = 1
+WAVE_FORMAT_FLOAT = 3
+WAVE_FORMAT_EXTENSIBLE = 0xfffe
+
+BEXT_SIZE = 602                 # version 2, no coding history
+LOUDNESS_UNSET = 0x7fff
+
+ABSOLUTE_GATE = -70.0           # LUFS
+RELATIVE_GATE = -10.0           # LU, integrated loudness
+LRA_RELATIVE_GATE = -20.0       # LU, loudness range
+
+
+class ConditionError(Exception):
+    """A file that can't be read, or whose output failed the check."""
+
+
+@dataclass
+class Audio:
+    samples: np.ndarray         # frames x channels, float64, full scale 1.0
+    rate: int
+    loop: Optional[Tuple[int, int]] = None  # frames, end inclusive
+
+
+@dataclass
+class Loudness:
+    integrated: float           # LUFS
+    loudness_range: float       # LU
+    true_peak: float            # dBTP
+    max_momentary: float        # LUFS
+    max_short_term: float       # LUFS
+
+
+# ---------------------------------------------------------------- reading
+
+def read_wav(path: Path) -> Audio:
+    """Read PCM 8/16/24/32 bit, float 32/64 and extensible WAV files."""
+    data = path.read_bytes()
+    if len(data) < 12 or data[0:4] != b'RIFF' or data[8:12] != b'WAVE':
+        raise ConditionError(f"{path}: not a RIFF WAVE file")
+
+    fmt = None
+    pcm = None
+    loop = None
+    pos = 12
+    while pos + 8 <= len(data):
+        cid = data[pos:pos + 4]
+        size = struct.unpack_from('<I', data, pos + 4)[0]
+        body = data[pos + 8:pos + 8 + size]
+        if cid == b'fmt ':
+            fmt = body
+        elif cid == b'data':
+            pcm = body
+        elif cid == b'smpl' and len(body) >= 36 + 24:
+            if struct.unpack_from('<I', body, 28)[0] > 0:
+                start, end = struct.unpack_from('<II', body, 36 + 8)
+                loop = (start, end)
+        pos += 8 + size + (size & 1)
+
+    if fmt is None or len(fmt) < 16 or pcm is None:
+        raise ConditionError(f"{path}: no fmt or data chunk")
+
+    tag, channels, rate, _, block_align, bits = struct.unpack_from('<HHIIHH', fmt)
+    if tag == WAVE_FORMAT_EXTENSIBLE and len(fmt) >= 26:
+        tag = struct.unpack_from('<H', fmt, 24)[0]
+    if channels == 0 or block_align == 0:
+        raise ConditionError(f"{path}: bad fmt chunk")
+
+    width = block_align // channels
+    frames = len(pcm) // block_align
+    raw = np.frombuffer(pcm[:frames * block_align], dtype=np.uint8).reshape(frames, channels, width)
+
+    if tag == WAVE_FORMAT_FLOAT and width in (4, 8):
+        x = raw.copy().view('<f4' if width == 4 else '<f8').reshape(frames, channels).astype(np.float64)
+    elif tag == WAVE_FORMAT_PCM and width == 1:
+        x = (raw[:, :, 0].astype(np.float64) - 128.0) / 128.0
+    elif tag == WAVE_FORMAT_PCM and width in (2, 3, 4):
+        # left align into int32, so every width is full scale at 2^31
+        b = np.zeros((frames, channels, 4), dtype=np.uint8)
+        b[:, :, 4 - width:] = raw
+        x = b.view('<i4').reshape(frames, channels).astype(np.float64) / 2147483648.0
+    else:
+        raise ConditionError(f"{path}: format {tag}, {bits} bit is not supported")
+
+    return Audio(samples=x, rate=rate, loop=loop)
+
+
+# ---------------------------------------------------------------- converting
+
+def to_stereo(audio: Audio, name: str) -> None:
+    x = audio.samples
+    if x.shape[1] == 1:
+        audio.samples = np.repeat(x, 2, axis=1)
+    elif x.shape[1] > 2:
+        logger.warning(f"{name}: {x.shape[1]} channels, keeping the first two")
+        audio.samples = x[:, :2]
+
+
+def resample(audio: Audio) -> None:
+    if audio.rate == NATIVE_RATE:
+        return
+    from scipy.signal import resample_poly
+
+    g = gcd(NATIVE_RATE, audio.rate)
+    up, down = NATIVE_RATE // g, audio.rate // g
+    audio.samples = resample_poly(audio.samples, up, down, axis=0)
+    if audio.loop:
+        scale = NATIVE_RATE / audio.rate
+        audio.loop = (round(audio.loop[0] * scale), round((audio.loop[1] + 1) * scale) - 1)
+    audio.rate = NATIVE_RATE
+
+
+def quantize(x: np.ndarray, seed: int = 0) -> np.ndarray:
+    """Float to int16 with TPDF dither of one LSB peak."""
+    rng = np.random.default_rng(seed)
+    scaled = x * 32768.0
+    dither = rng.random(x.shape) - rng.random(x.shape)
+    return np.clip(np.round(scaled + dither), -32768, 32767).astype('<i2')
+
+
+# ---------------------------------------------------------------- loudness
+
+def _k_weighting(rate: int):
+    """BS.1770 pre-filter and RLB high pass, as biquads for any sample rate."""
+    # high shelf
+    f0, gain, q = 1681.974450955533, 3.999843853973347, 0.7071752369554196
+    k = np.tan(np.pi * f0 / rate)
+    vh = 10.0 ** (gain / 20.0)
+    vb = vh ** 0.4996667741545416
+    a0 = 1.0 + k / q + k * k
+    shelf_b = np.array([(vh + vb * k / q + k * k) / a0,
+                        2.0 * (k * k - vh) / a0,
+                        (vh - vb * k / q + k * k) / a0])
+    shelf_a = np.array([1.0, 2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0])
+
+    # high pass
+    f0, q = 38.13547087602444, 0.5003270373238773
+    k = np.tan(np.pi * f0 / rate)
+    a0 = 1.0 + k / q + k * k
+    hp_b = np.array([1.0, -2.0, 1.0])
+    hp_a = np.array([1.0, 2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0])
+    return (shelf_b, shelf_a), (hp_b, hp_a)
+
+
+def _block_loudness(power: np.ndarray, rate: int, length_s: float, step_s: float) -> np.ndarray:
+    """Loudness of each gated block; power is the channel sum of squares."""
+    n = int(round(length_s * rate))
+    step = int(round(step_s * rate))
+    if len(power) < n:
+        return np.array([])
+    csum = np.concatenate(([0.0], np.cumsum(power)))
+    starts = np.arange(0, len(power) - n + 1, step)
+    z = (csum[starts + n] - csum[starts]) / n
+    with np.errstate(divide='ignore'):
+        return -0.691 + 10.0 * np.log10(z)
+
+
+def _to_lufs(blocks: np.ndarray) -> float:
+    """Mean loudness of blocks, averaged in the power domain."""
+    return -0.691 + 10.0 * np.log10(np.mean(10.0 ** ((blocks + 0.691) / 10.0)))
+
+
+def measure(x: np.ndarray, rate: int) -> Loudness:
+    from scipy.signal import lfilter, resample_poly
+
+    (sb, sa), (hb, ha) = _k_weighting(rate)
+    k = lfilter(hb, ha, lfilter(sb, sa, x, axis=0), axis=0)
+    power = np.sum(k * k, axis=1)   # L and R weigh 1.0
+
+    momentary = _block_loudness(power, rate, 0.4, 0.1)
+    short_term = _block_loudness(power, rate, 3.0, 0.1)
+
+    integrated = float('-inf')
+    gated = momentary[momentary > ABSOLUTE_GATE]
+    if len(gated):
+        relative = _to_lufs(gated) + RELATIVE_GATE
+        gated = gated[gated > relative]
+        if len(gated):
+            integrated = _to_lufs(gated)
+
+    lra = 0.0
+    st = short_term[short_term > ABSOLUTE_GATE]
+    if len(st):
+        st = st[st > _to_lufs(st) + LRA_RELATIVE_GATE]
+        if len(st):
+            lra = float(np.percentile(st, 95) - np.percentile(st, 10))
+
+    # true peak: 4x oversampled, per BS.1770 Annex 2
+    peak = np.max(np.abs(resample_poly(x, 4, 1, axis=0))) if len(x) else 0.0
+    with np.errstate(divide='ignore'):
+        true_peak = 20.0 * np.log10(peak)
+
+    def top(v):
+        return float(np.max(v)) if len(v) else float('-inf')
+
+    return Loudness(integrated=integrated, loudness_range=lra, true_peak=true_peak,
+                    max_momentary=top(momentary), max_short_term=top(short_term))
+
+
+# ---------------------------------------------------------------- writing
+
+def _hundredths(v: float) -> int:
+    """bext stores loudness as int16 hundredths; unmeasurable is 0x7fff."""
+    if not np.isfinite(v):
+        return LOUDNESS_UNSET
+    return int(max(-32768, min(32766, round(v * 100))))
+
+
+def _chunk(cid: bytes, body: bytes) -> bytes:
+    return cid + struct.pack('<I', len(body)) + body + (b'\0' if len(body) & 1 else b'')
+
+
+def _smpl(rate: int, loop: Tuple[int, int]) -> bytes:
+    header = struct.pack('<IIIIIIIII',
+                         0, 0,                      # manufacturer, product
+                         round(1e9 / rate),         # sample period, ns
+                         60, 0,                     # unity note, pitch fraction
+                         0, 0,                      # SMPTE format, offset
+                         1, 0)                      # loops, sampler data
+    # forward loop, played forever
+    return header + struct.pack('<IIIIII', 0, 0, loop[0], loop[1], 0, 0)
+
+
+def _bext(name: str, loudness: Loudness) -> bytes:
+    b = bytearray(BEXT_SIZE)
+    desc = f"loudframe asset: {name}".encode('ascii', 'replace')[:256]
+    b[0:len(desc)] = desc
+    b[256:256 + 9] = b'loudframe'                          # originator
+    struct.pack_into('<H', b, 346, 2)                      # version
+    struct.pack_into('<hhhhh', b, 412,
+                     _hundredths(loudness.integrated),
+                     _hundredths(loudness.loudness_range),
+                     _hundredths(loudness.true_peak),
+                     _hundredths(loudness.max_momentary),
+                     _hundredths(loudness.max_short_term))
+    return bytes(b)
+
+
+def write_wav(path: Path, pcm: np.ndarray, loop: Tuple[int, int], bext: bytes) -> int:
+    """Write native PCM with the data on a DATA_ALIGN boundary. Returns its offset."""
+    block_align = NATIVE_CHANNELS * NATIVE_BITS // 8
+    fmt = struct.pack('<HHIIHH', WAVE_FORMAT_PCM, NATIVE_CHANNELS, NATIVE_RATE,
+                      NATIVE_RATE * block_align, block_align, NATIVE_BITS)
+    head = b'WAVE' + _chunk(b'fmt ', fmt) + _chunk(b'smpl', _smpl(NATIVE_RATE, loop)) + _chunk(b'bext', bext)
+
+    # RIFF header (8) + head + JUNK header (8) + pad + data header (8) = aligned
+    used = 8 + len(head) + 8 + 8
+    pad = -used % DATA_ALIGN
+    head += _chunk(b'JUNK', bytes(pad))
+    data_offset = 8 + len(head) + 8
+
+    body = pcm.tobytes()
+    with open(path, 'wb') as f:
+        f.write(b'RIFF' + struct.pack('<I', len(head) + 8 + len(body) + (len(body) & 1)))
+        f.write(head)
+        f.write(b'data' + struct.pack('<I', len(body)))
+        f.write(body)
+        if len(body) & 1:
+            f.write(b'\0')
+    return data_offset
+
+
+# ---------------------------------------------------------------- checking
+
+def find_wavinfo() -> Optional[str]:
+    """loudframe_wavinfo from $LOUDFRAME_WAVINFO, the PATH, or the README's build dir."""
+    env = os.environ.get('LOUDFRAME_WAVINFO')
+    if env:
+        return env
+    found = shutil.which('loudframe_wavinfo')
+    if found:
+        return found
+    repo = Path(__file__).resolve().parents[2]
+    default = repo / 'build' / 'loudframe_host' / 'loudframe_wavinfo'
+    return str(default) if default.exists() else None
+
+
+def verify(path: Path, wavinfo: str, expect: Dict[str, str]) -> None:
+    """Parse the output with the firmware's parser and compare to what was written."""
+    r = subprocess.run([wavinfo, '--native', str(path)], capture_output=True, text=True)
+    if r.returncode != 0:
+        raise ConditionError(f"{path}: loudframe_wavinfo rejected it: {r.stderr.strip()}")
+    fields = dict(line.split('=', 1) for line in r.stdout.splitlines() if '=' in line)
+    for key, value in expect.items():
+        if fields.get(key) != value:
+            raise ConditionError(f"{path}: firmware parser reads {key}={fields.get(key)}, wrote {value}")
+
+
+# ---------------------------------------------------------------- driver
+
+def condition_file(src: Path, out_dir: Path,
+                   loop_start: Optional[float] = None, loop_end: Optional[float] = None,
+                   target_lufs: Optional[float] = None, max_true_peak: float = -1.0,
+                   wavinfo: Optional[str] = None, skip_verify: bool = False) -> Path:
+    """
+    Condition one WAV file into out_dir, under the same name with a .wav suffix.
+
+    Args:
+        src: Input WAV
+        out_dir: Where to write it
+        loop_start, loop_end: Loop points in seconds (default: the source's loop, or all of it)
+        target_lufs: Normalize to this integrated loudness (default: leave the level alone)
+        max_true_peak: Normalization never pushes the true peak above this, dBTP
+        wavinfo: loudframe_wavinfo to check with (default: find_wavinfo())
+        skip_verify: Don't check the output
+
+    Returns:
+        The conditioned file
+    """
+    if not skip_verify:
+        wavinfo = wavinfo or find_wavinfo()
+        if not wavinfo:
+            raise ConditionError("loudframe_wavinfo not found: build play_sdcard_multi/host, "
+                                 "set LOUDFRAME_WAVINFO, or pass --skip-verify")
+
+    audio = read_wav(src)
+    to_stereo(audio, src.name)
+    resample(audio)
+    x = audio.samples
+    frames = len(x)
+    if frames == 0:
+        raise ConditionError(f"{src}: no audio")
+
+    loudness = measure(x, NATIVE_RATE)
+    if target_lufs is not None and np.isfinite(loudness.integrated):
+        gain_db = min(target_lufs - loudness.integrated, max_true_peak - loudness.true_peak)
+        x = x * 10.0 ** (gain_db / 20.0)
+        loudness = measure(x, NATIVE_RATE)
+        logger.info(f"{src.name}: gain {gain_db:+.2f} dB")
+
+    if loop_start is not None or loop_end is not None:
+        start = int(round((loop_start or 0.0) * NATIVE_RATE))
+        end = frames - 1 if loop_end is None else int(round(loop_end * NATIVE_RATE)) - 1
+    elif audio.loop:
+        start, end = audio.loop
+    else:
+        start, end = 0, frames - 1
+    start = max(0, min(start, frames - 1))
+    end = max(start, min(end, frames - 1))
+
+    out_dir.mkdir(parents=True, exist_ok=True)
+    dst = out_dir / (src.stem + '.wav')
+    if dst.resolve() == src.resolve():
+        raise ConditionError(f"{src}: output would overwrite the input")
+
+    pcm = quantize(x)
+    data_offset = write_wav(dst, pcm, (start, end), _bext(src.name, loudness))
+
+    logger.info(f"{src.name} -> {dst}: {frames / NATIVE_RATE:.2f} s, loop {start}-{end}, "
+                f"{loudness.integrated:.1f} LUFS, LRA {loudness.loudness_range:.1f} LU, "
+                f"{loudness.true_peak:.1f} dBTP, data at {data_offset}")
+
+    if not skip_verify:
+        expect = {'data_offset': str(data_offset), 'data_size': str(pcm.nbytes),
+                  'loop_start': str(start), 'loop_end': str(end)}
+        if np.isfinite(loudness.integrated):
+            expect['loudness_lufs'] = f"{_hundredths(loudness.integrated) / 100:.2f}"
+        verify(dst, wavinfo, expect)
+    return dst
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        prog='asset_conditioner',
+        description='Convert WAV files to the format the device plays natively',
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog=__doc__.split('Examples:')[1] if 'Examples:' in __doc__ else None
+    )
+    parser.add_argument('inputs', nargs='+', metavar='INPUT', help='WAV files to condition')
+    parser.add_argument('--output-dir', '-o', default='conditioned', metavar='DIR',
+                        help='Where to write them (default: ./conditioned)')
+    parser.add_argument('--loop-start', type=float, metavar='SEC',
+                        help='Loop start in seconds (default: the source loop, or 0)')
+    parser.add_argument('--loop-end', type=float, metavar='SEC',
+                        help='Loop end in seconds (default: the source loop, or the end)')
+    parser.add_argument('--target-lufs', type=float, metavar='LUFS',
+                        help='Normalize integrated loudness to this (default: no change)')
+    parser.add_argument('--max-true-peak', type=float, default=-1.0, metavar='DBTP',
+                        help='True peak ceiling when normalizing (default: -1.0)')
+    parser.add_argument('--wavinfo', metavar='PATH',
+                        help='loudframe_wavinfo to verify with (default: $LOUDFRAME_WAVINFO, PATH, build/loudframe_host)')
+    parser.add_argument('--skip-verify', action='store_true',
+                        help='Do not check the output with the firmware parser')
+    args = parser.parse_args()
+
+    failed = 0
+    for name in args.inputs:
+        try:
+            condition_file(Path(name), Path(args.output_dir),
+                           loop_start=args.loop_start, loop_end=args.loop_end,
+                           target_lufs=args.target_lufs, max_true_peak=args.max_true_peak,
+                           wavinfo=args.wavinfo, skip_verify=args.skip_verify)
+        except (ConditionError, OSError) as e:
+            logger.error(str(e))
+            failed += 1
+
+    if failed:
+        logger.error(f"{failed} of {len(args.inputs)} file(s) failed")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
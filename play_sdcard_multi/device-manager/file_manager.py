@@ -28,6 +28,9 @@ Examples:
     # Sync all files from a directory to all devices
     python file_manager.py --command sync --directory ./loops
     
+    # Convert WAVs to the device's native format before uploading (asset_conditioner.py)
+    python file_manager.py --command sync --directory ./loops --condition
+    
     # Delete a file from all devices
     python file_manager.py --command delete --file old_music.wav
 """
@@ -45,6 +48,7 @@ from pathlib import Path
 from typing import Dict, List, Optional, Any, Tuple
 from datetime import datetime
 import logging
+import tempfile
 
 # Configure logging
 logging.basicConfig(
@@ -59,7 +63,7 @@ class FileManager:
     """Manager for file operations on ESP32 devices."""
     
     def __init__(self, map_file: str = "device_map.json", timeout: int = 30, 
-                 concurrent_limit: int = 5):
+                 concurrent_limit: int = 5, condition: bool = False):
         """
         Initialize the file manager.
         
@@ -67,9 +71,11 @@ class FileManager:
             map_file: Path to device map JSON file
             timeout: Request timeout in seconds (longer for file uploads)
             concurrent_limit: Maximum concurrent connections (lower for file uploads)
+            condition: Run WAV files through asset_conditioner before uploading
         """
         self.map_file = Path(map_file)
         self.timeout = timeout
+        self.condition = condition
         self.concurrent_limit = concurrent_limit
         self.devices = []
         
@@ -490,11 +496,26 @@ class FileManager:
             logger.error(f"File not found: {file_path}")
             sys.exit(1)
         
-        file_size_mb = file_path.stat().st_size / (1024 * 1024)
         upload_name = target_filename if target_filename else file_path.name
-        logger.info(f"Uploading {file_path.name} as '{upload_name}' ({file_size_mb:.2f} MB) to {len(devices)} device(s)")
         
-        results = await self.process_devices_batch(devices, self.upload_file, file_path, skip_existing, target_filename)
+        with tempfile.TemporaryDirectory(prefix='loudframe_') as tmp_dir:
+            if self.condition and file_path.suffix.lower() == '.wav':
+                # Imported here so plain uploads don't need numpy and scipy
+                from asset_conditioner import condition_file, ConditionError
+                try:
+                    file_path = condition_file(file_path, Path(tmp_dir))
+                except ConditionError as e:
+                    logger.error(f"Conditioning failed: {e}")
+                    sys.exit(1)
+                # the conditioned copy has the same name, so the size check still finds it
+                target_filename = upload_name
+            elif self.condition:
+                logger.warning(f"{file_path.name}: only WAV files are conditioned, uploading as is")
+            
+            file_size_mb = file_path.stat().st_size / (1024 * 1024)
+            logger.info(f"Uploading {file_path.name} as '{upload_name}' ({file_size_mb:.2f} MB) to {len(devices)} device(s)")
+            
+            results = await self.process_devices_batch(devices, self.upload_file, file_path, skip_existing, target_filename)
         
         # Summary
         success_count = sum(1 for r in results if r['success'])
@@ -592,6 +613,9 @@ Examples:
     # Sync all audio files from a directory
     %(prog)s --command sync --directory ./loops
     
+    # Convert WAVs to 44.1 kHz 16 bit stereo, sector aligned, with loop and loudness tags
+    %(prog)s --command upload --file music.wav --condition
+    
     # Delete a file from all devices (requires ESP32 delete endpoint)
     %(prog)s --command delete --file old_music.wav
 
@@ -654,13 +678,18 @@ Commands:
                            metavar='NAME',
                            help='Custom filename for uploaded file (default: use original filename)')
     
+    file_group.add_argument('--condition', '-C',
+                           action='store_true',
+                           help='Convert WAV files with asset_conditioner.py before uploading')
+    
     args = parser.parse_args()
     
     # Create file manager
     manager = FileManager(
         map_file=args.map_file,
         timeout=args.timeout,
-        concurrent_limit=args.concurrent
+        concurrent_limit=args.concurrent,
+        condition=args.condition
     )
     
     # Load devices
@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+"""
+Flash Pack
+Packs a few short WAV loops into an image for the device's audio flash
+partition (partitions_audio.csv, main/flash_store.h), so an installation can
+play them without an SD card. Tracks play them as /flash/<name>.
+
+The image is written either with the IDF tools over USB, or over the network
+to POST /api/flash. Writing over the network replaces the whole image; loops
+playing from /flash must be stopped first.
+
+Usage:
+    python flash_pack.py [options] input.wav [input.wav ...]
+
+Examples:
+    # Pack into audio.bin, then flash it over USB
+    python flash_pack.py -o audio.bin loops/*.wav
+    parttool.py write_partition --partition-name audio --input audio.bin
+
+    # Condition to the native format first, -18 LUFS, and send to a device
+    python flash_pack.py --condition --target-lufs -18 --upload 192.168.1.100 loops/*.wav
+"""
+
+import argparse
+import json
+import logging
+import struct
+import sys
+import tempfile
+import urllib.error
+import urllib.request
+import zlib
+from pathlib import Path
+from typing import List, Optional
+
+logging.basicConfig(
+    level=logging.INFO,
+    format='%(asctime)s - %(levelname)s - %(message)s',
+    datefmt='%Y-%m-%d %H:%M:%S'
+)
+logger = logging.getLogger(__name__)
+
+# main/flash_store.h
+MAGIC = 0x3141464c
+VERSION = 1
+NAME_LEN = 56
+MAX_ENTRIES = 64
+HEADER = struct.Struct('<IHHII')
+ENTRY = struct.Struct(f'<{NAME_LEN}sII')
+
+# partitions_audio.csv
+PARTITION_SIZE = 0x270000
+PARTITION_OFFSET = 0x190000
+
+
+class PackError(Exception):
+    pass
+
+
+def pack(files: List[Path]) -> bytes:
+    """
+    Build the image: header, entry table, then each file 4 byte aligned.
+
+    Args:
+        files: The files, stored under their base names
+
+    Returns:
+        The image
+    """
+    if not files:
+        raise PackError("nothing to pack")
+    if len(files) > MAX_ENTRIES:
+        raise PackError(f"{len(files)} files, the image holds {MAX_ENTRIES}")
+
+    names = set()
+    entries = []
+    blobs = []
+    offset = HEADER.size + ENTRY.size * len(files)
+    for path in files:
+        name = path.name.encode('utf-8')
+        if len(name) >= NAME_LEN:
+            raise PackError(f"{path.name}: name longer than {NAME_LEN - 1} bytes")
+        if name in names:
+            raise PackError(f"{path.name}: packed twice")
+        names.add(name)
+        data = path.read_bytes()
+        offset = (offset + 3) & ~3
+        entries.append(ENTRY.pack(name, offset, len(data)))
+        blobs.append((offset, data))
+        offset += len(data)
+
+    body = bytearray(offset - HEADER.size)
+    table = b''.join(entries)
+    body[:len(table)] = table
+    for start, data in blobs:
+        body[start - HEADER.size:start - HEADER.size + len(data)] = data
+    header = HEADER.pack(MAGIC, VERSION, len(files), offset, zlib.crc32(body))
+    return header + bytes(body)
+
+
+def upload(host: str, image: bytes, timeout: float) -> None:
+    """POST the image to a device's /api/flash."""
+    url = f"http://{host}/api/flash"
+    request = urllib.request.Request(url, data=image, method='POST',
+                                     headers={'Content-Type': 'application/octet-stream'})
+    try:
+        with urllib.request.urlopen(request, timeout=timeout) as response:
+            body = response.read().decode('utf-8', 'replace')
+    except urllib.error.HTTPError as e:
+        raise PackError(f"{host}: HTTP {e.code} {e.read().decode('utf-8', 'replace').strip()}")
+    except urllib.error.URLError as e:
+        raise PackError(f"{host}: {e.reason}")
+    try:
+        result = json.loads(body)
+    except ValueError:
+        raise PackError(f"{host}: unexpected response {body.strip()!r}")
+    if not result.get('success'):
+        raise PackError(f"{host}: {result.get('error', body.strip())}")
+    logger.info(f"{host}: {result.get('count')} file(s) written")
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        prog='flash_pack',
+        description='Pack WAV loops into an image for the audio flash partition',
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog=__doc__.split('Examples:')[1] if 'Examples:' in __doc__ else None
+    )
+    parser.add_argument('inputs', nargs='+', metavar='INPUT', help='Files to pack')
+    parser.add_argument('--output', '-o', metavar='FILE',
+                        help='Write the image here (default: audio.bin unless uploading)')
+    parser.add_argument('--upload', '-u', metavar='HOST', action='append', default=[],
+                        help='Send the image to this device, may be repeated')
+    parser.add_argument('--partition-size', type=lambda s: int(s, 0), default=PARTITION_SIZE,
+                        metavar='BYTES', help=f'Size of the audio partition (default: {PARTITION_SIZE:#x})')
+    parser.add_argument('--condition', '-C', action='store_true',
+                        help='Run the files through asset_conditioner.py first')
+    parser.add_argument('--target-lufs', type=float, metavar='LUFS',
+                        help='With --condition, normalize to this integrated loudness')
+    parser.add_argument('--timeout', type=float, default=60.0, metavar='SEC',
+                        help='Upload timeout (default: 60)')
+    args = parser.parse_args()
+
+    files = [Path(name) for name in args.inputs]
+    try:
+        with tempfile.TemporaryDirectory(prefix='flash_pack_') as tmp:
+            if args.condition:
+                from asset_conditioner import ConditionError, condition_file
+                try:
+                    files = [condition_file(f, Path(tmp), target_lufs=args.target_lufs) for f in files]
+                except ConditionError as e:
+                    raise PackError(str(e))
+            image = pack(files)
+    except (PackError, OSError) as e:
+        logger.error(str(e))
+        sys.exit(1)
+
+    used = 100.0 * len(image) / args.partition_size
+    logger.info(f"{len(files)} file(s), {len(image)} bytes, {used:.0f}% of the partition")
+    if len(image) > args.partition_size:
+        logger.error(f"image is {len(image) - args.partition_size} bytes too big for the partition")
+        sys.exit(1)
+
+    output: Optional[str] = args.output or (None if args.upload else 'audio.bin')
+    if output:
+        Path(output).write_bytes(image)
+        logger.info(f"Wrote {output}; over USB: parttool.py write_partition --partition-name audio "
+                    f"--input {output}  (or esptool.py write_flash {PARTITION_OFFSET:#x} {output})")
+
+    failed = 0
+    for host in args.upload:
+        try:
+            upload(host, image, args.timeout)
+        except PackError as e:
+            logger.error(str(e))
+            failed += 1
+    if failed:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
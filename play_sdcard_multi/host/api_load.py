@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""Load test for the loudframe HTTP API.
+
+Runs a mix of read and control requests from several connections at once
+against a running loudframe_host (or a board), then prints requests/s,
+latency percentiles per endpoint, errors, and how much the heaps churned
+according to /metrics. Standard library only.
+
+    ./api_load.py --host 127.0.0.1 --port 8080 --clients 4 --duration 30
+"""
+
+import argparse
+import http.client
+import json
+import random
+import re
+import sys
+import threading
+import time
+
+# (weight, method, path, body); bodies are filled in per request
+MIX = [
+    (30, "GET", "/api/loops", None),
+    (15, "GET", "/api/status", None),
+    (10, "GET", "/api/files", None),
+    (10, "GET", "/metrics", None),
+    (5, "GET", "/api/perf/tasks", None),
+    (5, "GET", "/api/config/status", None),
+    (10, "POST", "/api/loop/volume", lambda r: {"track": r.randrange(3), "volume": r.randrange(101)}),
+    (5, "POST", "/api/loop/stop", lambda r: {"track": r.randrange(3)}),
+    (5, "POST", "/api/loop/start", lambda r: {"track": r.randrange(3)}),
+    (5, "POST", "/api/global/volume", lambda r: {"volume": r.randrange(40, 101)}),
+]
+
+READ_ONLY = [m for m in MIX if m[1] == "GET"]
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0.0
+    k = min(len(sorted_values) - 1, int(round(p / 100.0 * (len(sorted_values) - 1))))
+    return sorted_values[k]
+
+
+def scrape_metrics(host, port):
+    """Heap counters from /metrics, or {} when the endpoint isn't there."""
+    try:
+        conn = http.client.HTTPConnection(host, port, timeout=10)
+        conn.request("GET", "/metrics")
+        resp = conn.getresponse()
+        text = resp.read().decode("utf-8", "replace")
+        conn.close()
+    except OSError:
+        return {}
+    values = {}
+    for line in text.splitlines():
+        m = re.match(r'^(loudframe_heap_\w+)\{caps="(\w+)"\} (\S+)$', line)
+        if m:
+            values[(m.group(1), m.group(2))] = float(m.group(3))
+    return values
+
+
+class Client(threading.Thread):
+    def __init__(self, args, mix, seed, deadline, results, lock):
+        super().__init__(daemon=True)
+        self.args = args
+        self.mix = mix
+        self.rand = random.Random(seed)
+        self.deadline = deadline
+        self.results = results
+        self.lock = lock
+        self.conn = None
+
+    def connect(self):
+        self.conn = http.client.HTTPConnection(self.args.host, self.args.port, timeout=self.args.timeout)
+
+    def pick(self):
+        total = sum(m[0] for m in self.mix)
+        x = self.rand.uniform(0, total)
+        for weight, method, path, body in self.mix:
+            x -= weight
+            if x <= 0:
+                return method, path, body
+        return self.mix[-1][1:]
+
+    def run(self):
+        self.connect()
+        while time.monotonic() < self.deadline:
+            method, path, body = self.pick()
+            payload = json.dumps(body(self.rand)).encode() if body else None
+            headers = {"Content-Type": "application/json"} if payload else {}
+            start = time.monotonic()
+            status = 0
+            try:
+                self.conn.request(method, path, body=payload, headers=headers)
+                resp = self.conn.getresponse()
+                resp.read()
+                status = resp.status
+                if resp.getheader("Connection", "").lower() == "close":
+                    self.conn.close()
+                    self.connect()
+            except (OSError, http.client.HTTPException):
+                # The server closes the socket after a handler error
+                self.conn.close()
+                self.connect()
+            elapsed = time.monotonic() - start
+            with self.lock:
+                self.results.append((path, status, elapsed))
+            if self.args.pause_ms:
+                time.sleep(self.args.pause_ms / 1000.0)
+        self.conn.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--clients", type=int, default=4, help="concurrent connections (httpd allows 7)")
+    parser.add_argument("--duration", type=float, default=30.0, help="seconds")
+    parser.add_argument("--timeout", type=float, default=10.0, help="per request timeout, seconds")
+    parser.add_argument("--pause-ms", type=float, default=0.0, help="pause between requests per client")
+    parser.add_argument("--read-only", action="store_true", help="GET requests only, leave playback alone")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--max-p99-ms", type=float, help="exit 1 if the overall p99 is above this")
+    parser.add_argument("--json", help="write the results as JSON")
+    args = parser.parse_args()
+
+    mix = READ_ONLY if args.read_only else MIX
+    before = scrape_metrics(args.host, args.port)
+
+    results = []
+    lock = threading.Lock()
+    start = time.monotonic()
+    deadline = start + args.duration
+    clients = [Client(args, mix, args.seed + i, deadline, results, lock) for i in range(args.clients)]
+    for c in clients:
+        c.start()
+    for c in clients:
+        c.join()
+    wall = time.monotonic() - start
+
+    after = scrape_metrics(args.host, args.port)
+
+    by_path = {}
+    for path, status, elapsed in results:
+        by_path.setdefault(path, []).append((status, elapsed))
+
+    report = {"duration_s": wall, "clients": args.clients, "requests": len(results), "endpoints": {}, "heap": {}}
+    errors = sum(1 for _, status, _ in results if status == 0 or status >= 400)
+    all_ms = sorted(e * 1000 for _, _, e in results)
+    print("requests       %d in %.1f s, %.1f req/s, %d errors" % (len(results), wall, len(results) / wall, errors))
+    print("latency        p50 %.1f ms, p99 %.1f ms, max %.1f ms" %
+          (percentile(all_ms, 50), percentile(all_ms, 99), all_ms[-1] if all_ms else 0))
+    print("  %-22s %7s %7s %9s %9s %9s" % ("endpoint", "count", "errors", "p50 ms", "p99 ms", "max ms"))
+    for path in sorted(by_path):
+        rows = by_path[path]
+        ms = sorted(e * 1000 for _, e in rows)
+        errs = sum(1 for s, _ in rows if s == 0 or s >= 400)
+        print("  %-22s %7d %7d %9.1f %9.1f %9.1f" %
+              (path, len(rows), errs, percentile(ms, 50), percentile(ms, 99), ms[-1]))
+        report["endpoints"][path] = {"count": len(rows), "errors": errs, "p50_ms": percentile(ms, 50),
+                                     "p99_ms": percentile(ms, 99), "max_ms": ms[-1]}
+
+    # Heap churn as the device saw it, when it exports the counters
+    for caps in ("internal", "spiram"):
+        key = ("loudframe_heap_free_bytes", caps)
+        if key in before and key in after:
+            low = after.get(("loudframe_heap_minimum_free_bytes", caps))
+            print("heap %-9s free %d -> %d bytes (%+d)%s" %
+                  (caps, before[key], after[key], after[key] - before[key],
+                   ", lowest %d" % low if low is not None else ""))
+            report["heap"][caps] = {"free_before": before[key], "free_after": after[key], "lowest": low}
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2)
+
+    if args.max_p99_ms is not None and percentile(all_ms, 99) > args.max_p99_ms:
+        return 1
+    return 1 if errors else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
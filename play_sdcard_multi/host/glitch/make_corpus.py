@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""Writes the glitch benchmark corpus.
+
+Reference assets for pcm_continuity: 16 bit stereo WAVs at 44.1 kHz, the
+format play_sdcard_multi mixes. None of them is periodic, so every frame of
+a source can be told apart from every other and a dropped or repeated frame
+has only one explanation. Lengths are odd on purpose, so loop points of
+different tracks never line up. Output is the same on every run.
+
+    ./make_corpus.py DIR
+"""
+
+import argparse
+import math
+import os
+import random
+import struct
+import sys
+import wave
+
+RATE = 44100
+
+# name: (seconds, generator)
+CORPUS = {}
+
+
+def asset(name, seconds):
+    def register(fn):
+        CORPUS[name] = (seconds, fn)
+        return fn
+    return register
+
+
+def noise(rand, n, pole):
+    """White noise through a one pole low pass, so it sounds like a pad."""
+    y = 0.0
+    out = []
+    for _ in range(n):
+        y = pole * y + (1 - pole) * rand.uniform(-1, 1)
+        out.append(y)
+    peak = max(abs(v) for v in out)
+    return [v / peak for v in out]
+
+
+@asset("noise_a.wav", 5.13)
+def noise_a(n):
+    rand = random.Random(1)
+    left = noise(rand, n, 0.6)
+    right = noise(rand, n, 0.6)
+    return left, right, 0.25
+
+
+@asset("chirp_b.wav", 3.71)
+def chirp_b(n):
+    # Log sweep 80 Hz to 5 kHz, the right channel a quarter cycle behind
+    f0, f1 = 80.0, 5000.0
+    k = math.log(f1 / f0) / n
+    left, right = [], []
+    for i in range(n):
+        phase = 2 * math.pi * f0 / RATE * (math.exp(k * i) - 1) / k
+        left.append(math.sin(phase))
+        right.append(math.sin(phase - math.pi / 2))
+    return left, right, 0.2
+
+
+@asset("notes_c.wav", 6.29)
+def notes_c(n):
+    # Plucked notes at random pitches and times, panned
+    rand = random.Random(3)
+    left = [0.0] * n
+    right = [0.0] * n
+    t = 0
+    while t < n:
+        freq = 110.0 * 2 ** (rand.randrange(36) / 12.0)
+        pan = rand.uniform(0.2, 0.8)
+        length = min(n - t, int(RATE * rand.uniform(0.3, 1.2)))
+        for i in range(length):
+            env = math.exp(-4.0 * i / length)
+            ph = 2 * math.pi * freq * i / RATE
+            v = env * (math.sin(ph) + 0.3 * math.sin(2 * ph) + 0.1 * math.sin(3 * ph))
+            left[t + i] += v * (1 - pan)
+            right[t + i] += v * pan
+        t += int(RATE * rand.uniform(0.08, 0.4))
+    # A little noise keeps the quiet stretches unique
+    for i in range(n):
+        left[i] += rand.uniform(-0.01, 0.01)
+        right[i] += rand.uniform(-0.01, 0.01)
+    peak = max(max(abs(v) for v in left), max(abs(v) for v in right))
+    return [v / peak for v in left], [v / peak for v in right], 0.3
+
+
+@asset("quiet_d.wav", 4.37)
+def quiet_d(n):
+    # Low level, for gain changes near the bottom of the volume range
+    rand = random.Random(4)
+    left = noise(rand, n, 0.9)
+    right = noise(rand, n, 0.9)
+    return left, right, 0.05
+
+
+def write(path, left, right, level):
+    frames = bytearray()
+    for l, r in zip(left, right):
+        frames += struct.pack("<hh", int(round(l * level * 32767)), int(round(r * level * 32767)))
+    with wave.open(path, "wb") as w:
+        w.setnchannels(2)
+        w.setsampwidth(2)
+        w.setframerate(RATE)
+        w.writeframes(bytes(frames))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dir")
+    parser.add_argument("--force", action="store_true", help="rewrite files that are already there")
+    args = parser.parse_args()
+    os.makedirs(args.dir, exist_ok=True)
+    for name, (seconds, fn) in CORPUS.items():
+        path = os.path.join(args.dir, name)
+        if os.path.exists(path) and not args.force:
+            continue
+        left, right, level = fn(int(seconds * RATE))
+        write(path, left, right, level)
+        print("%-14s %.2f s" % (name, seconds))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
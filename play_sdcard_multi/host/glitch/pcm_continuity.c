@@ -0,0 +1,1564 @@
+// pcm_continuity: checks a captured output stream against the sources it
+// was mixed from
+//
+// The capture is the I2S tap of loudframe_host (--tap), the --out file of
+// player32_sim, or a line-in recording of a board at the same sample rate.
+// The expected stream is every source looped, each at its own gain, summed.
+// Where a source sits in the output and at what gain is not known up front,
+// so the analyser follows it:
+//
+// - Block by block it refits the gains of the sources it is tracking
+//   (least squares over both channels) and checks the residual. A good fit
+//   moves every tracked source on by one block.
+// - When the fit breaks, the first bad frame is found with the old model,
+//   and from there each source is located again by cross-correlation over
+//   the whole (looped) source. The exact frame of the change is where the
+//   old model stops explaining the output better than the new one.
+// - A change is then classified per source: a jump forward (dropped
+//   frames), back (duplicated frames), a dropout that resumes in place
+//   (gap, the source is late from then on) or further on (the gap replaced
+//   audio), a restart, a stop, or a gain step.
+// - Inside matched stretches, residual samples above --click-db are clicks.
+//
+// With --automation the gain steps, starts, stops and seeks that a scenario
+// caused are expected; anything else, and anything scheduled but not seen, counts
+// as a glitch. The automation clock and the capture clock may differ by a
+// constant; the offset is estimated from the events themselves.
+
+#include <complex.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_SOURCES         8
+#define MIN_ADVANCE         32          // frames a cursor moves when nothing fits
+#define REFINE_WINDOW       64          // frames searched either side for the exact change
+#define SMOOTH              16          // frames averaged when looking for the first bad frame
+#define ACTIVE_GAIN         3.16e-4     // -70 dB; below this a source is not playing
+#define MIN_CORR            0.5         // normalized correlation that counts as found
+#define EXPECTED_PREFERENCE 0.95        // take the expected position if its peak is this close
+#define MERGE_MS            50.0        // gain steps and clicks closer than this are one event
+#define SEARCH_WINDOW       4096        // frames either side of a likely position searched first
+#define POLISH              2           // frames either side of a correlation peak tried by least squares
+#define RIVALS              4           // correlation peaks per source tried by least squares
+#define RIVAL_SPACING       8           // frames between two peaks for them to count as two
+#define SEEK_FRAMES         2           // how far from the asked for frame a seek may land
+
+// Audio
+
+typedef struct {
+    char *path;
+    const char *name;
+    uint32_t rate;
+    int channels;
+    int64_t frames;
+    float *ch[2];                       // mono sources have ch[1] == ch[0]
+} audio_t;
+
+static void put_err(const char *path, const char *what) {
+    fprintf(stderr, "%s: %s\n", path, what);
+}
+
+static uint32_t get_le(const uint8_t *p, int bytes) {
+    uint32_t v = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+// 16 bit PCM WAV, mono or stereo, plain or WAVE_FORMAT_EXTENSIBLE
+static bool read_wav(const char *path, audio_t *a) {
+    memset(a, 0, sizeof(*a));
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        put_err(path, "can't open");
+        return false;
+    }
+    uint8_t h[40];
+    bool ok = false;
+    int bits = 0;
+    if (fread(h, 1, 12, f) != 12 || memcmp(h, "RIFF", 4) != 0 || memcmp(h + 8, "WAVE", 4) != 0) {
+        put_err(path, "not a WAV file");
+        goto cleanup;
+    }
+    for (;;) {
+        if (fread(h, 1, 8, f) != 8) {
+            put_err(path, "no data chunk");
+            goto cleanup;
+        }
+        uint32_t size = get_le(h + 4, 4);
+        if (memcmp(h, "fmt ", 4) == 0) {
+            uint32_t n = size < sizeof(h) ? size : sizeof(h);
+            if (size < 16 || fread(h, 1, n, f) != n) {
+                put_err(path, "bad fmt chunk");
+                goto cleanup;
+            }
+            uint32_t format = get_le(h, 2);
+            a->channels = get_le(h + 2, 2);
+            a->rate = get_le(h + 4, 4);
+            bits = get_le(h + 14, 2);
+            if (format == 0xfffe && n >= 26) {
+                format = get_le(h + 24, 2);
+            }
+            if (format != 1 || bits != 16 || a->channels < 1 || a->channels > 2) {
+                put_err(path, "only 16 bit PCM mono or stereo is supported");
+                goto cleanup;
+            }
+            fseek(f, size - n + (size & 1), SEEK_CUR);
+        } else if (memcmp(h, "data", 4) == 0) {
+            break;
+        } else {
+            fseek(f, size + (size & 1), SEEK_CUR);
+        }
+    }
+    if (bits == 0) {
+        put_err(path, "data before fmt");
+        goto cleanup;
+    }
+
+    // The size field is unreliable in streamed captures, read to EOF
+    size_t cap = 1 << 20, n = 0;
+    int16_t *pcm = malloc(cap * sizeof(int16_t));
+    for (;;) {
+        if (n == cap) {
+            cap *= 2;
+            pcm = realloc(pcm, cap * sizeof(int16_t));
+        }
+        size_t got = fread(pcm + n, sizeof(int16_t), cap - n, f);
+        n += got;
+        if (got == 0) {
+            break;
+        }
+    }
+    a->frames = (int64_t)(n / a->channels);
+    a->ch[0] = malloc((a->frames + 1) * sizeof(float));
+    a->ch[1] = a->channels == 2 ? malloc((a->frames + 1) * sizeof(float)) : a->ch[0];
+    for (int64_t i = 0; i < a->frames; i++) {
+        a->ch[0][i] = pcm[i * a->channels];
+        if (a->channels == 2) {
+            a->ch[1][i] = pcm[i * 2 + 1];
+        }
+    }
+    free(pcm);
+    a->path = strdup(path);
+    const char *slash = strrchr(a->path, '/');
+    a->name = slash ? slash + 1 : a->path;
+    ok = a->frames > 0;
+    if (!ok) {
+        put_err(path, "no audio");
+    }
+cleanup:
+    fclose(f);
+    return ok;
+}
+
+// FFT, iterative radix 2
+
+static void fft(double complex *x, size_t n, bool inverse) {
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            double complex t = x[i];
+            x[i] = x[j];
+            x[j] = t;
+        }
+    }
+    for (size_t len = 2; len <= n; len <<= 1) {
+        double angle = 2 * M_PI / len * (inverse ? 1 : -1);
+        double complex wl = cos(angle) + I * sin(angle);
+        for (size_t i = 0; i < n; i += len) {
+            double complex w = 1;
+            for (size_t k = 0; k < len / 2; k++) {
+                double complex u = x[i + k];
+                double complex v = x[i + k + len / 2] * w;
+                x[i + k] = u + v;
+                x[i + k + len / 2] = u - v;
+                w *= wl;
+            }
+        }
+    }
+    if (inverse) {
+        for (size_t i = 0; i < n; i++) {
+            x[i] /= n;
+        }
+    }
+}
+
+static size_t next_pow2(size_t n) {
+    size_t p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+// Sources and the voices that follow them through the output
+
+typedef struct {
+    audio_t audio;
+    size_t fft_n;
+    double complex *spec;               // FFT of the mono source, looped by one block
+    double *energy;                     // prefix sums of mono^2 over the same
+} source_t;
+
+typedef struct {
+    bool active;
+    int64_t pos;                        // source frame at the cursor, 0 <= pos < frames
+    double gain;
+    bool started;                       // has played at all
+    bool pending;                       // dropped out, not yet known why
+    int64_t pending_at;                 // output frame
+    int64_t pending_pos;
+    int64_t run_start;                  // output frame the current run started at
+    int64_t unrolled;                   // source frames played in the current run
+    int64_t te_last;                    // timing error, frames, positive is late
+    int64_t te_worst;
+} voice_t;
+
+typedef struct {
+    bool active[MAX_SOURCES];
+    int64_t pos[MAX_SOURCES];
+    double gain[MAX_SOURCES];
+} model_t;
+
+typedef enum {
+    EV_START,
+    EV_STOP,
+    EV_GAIN,
+    EV_DROP,
+    EV_DUP,
+    EV_GAP_LATE,
+    EV_GAP_SKIP,
+    EV_JUMP,
+    EV_CLICK,
+    EV_UNMATCHED,
+    EV_MISSED,
+    EV_SEEK,                            // automation only, heard as a jump, drop, duplicate or start
+} ev_kind_t;
+
+static const char *s_kind_names[] = {
+    "start", "stop", "gain", "drop", "duplicate", "gap", "gap_skip", "jump", "click", "unmatched", "missed",
+    "seek",
+};
+
+typedef struct {
+    ev_kind_t kind;
+    int64_t at;                         // output frame
+    int src;                            // -1 for none
+    int64_t frames;                     // dropped, duplicated, gap or unmatched length; jump distance
+    int64_t src_pos;
+    double db_from, db_to;
+    double step;                        // size of the jump in the output at the change, full scale
+    bool loop_point;
+    bool initial;                       // first start of a source
+    bool expected;                      // matched to automation
+    double auto_err_ms;
+} event_t;
+
+typedef struct {
+    double at_ms;
+    int src;
+    ev_kind_t kind;                     // EV_START, EV_STOP, EV_GAIN or EV_SEEK
+    double db;
+    int64_t pos;                        // seek: the source frame it plays on from
+    bool matched;
+} auto_t;
+
+typedef struct {
+    int block;
+    double click_db;
+    double silence_db;
+    double fit_db;
+    double tolerance_ms;
+    const char *automation;
+    const char *json;
+    long max_glitches;
+} options_t;
+
+typedef struct {
+    options_t opt;
+    audio_t out;
+    source_t src[MAX_SOURCES];
+    int n_src;
+    voice_t voice[MAX_SOURCES];
+    event_t *ev;
+    size_t n_ev, cap_ev;
+    auto_t *autos;
+    size_t n_autos;
+    int64_t first_audio;
+    int64_t matched_frames;
+    int64_t audible_frames;
+    int64_t last_change;
+    double auto_offset_ms;
+    double auto_jitter_ms;
+    size_t auto_matched;
+} analysis_t;
+
+static double frames_ms(const analysis_t *a, int64_t frames) {
+    return frames * 1000.0 / a->out.rate;
+}
+
+static event_t *add_event(analysis_t *a, ev_kind_t kind, int64_t at, int src) {
+    if (a->n_ev == a->cap_ev) {
+        a->cap_ev = a->cap_ev ? a->cap_ev * 2 : 64;
+        a->ev = realloc(a->ev, a->cap_ev * sizeof(event_t));
+    }
+    event_t *e = &a->ev[a->n_ev++];
+    memset(e, 0, sizeof(*e));
+    e->kind = kind;
+    e->at = at;
+    e->src = src;
+    return e;
+}
+
+static void source_prepare(source_t *s, int block) {
+    int64_t L = s->audio.frames;
+    s->fft_n = next_pow2((size_t)(L + block));
+    s->spec = calloc(s->fft_n, sizeof(double complex));
+    s->energy = malloc((L + block + 1) * sizeof(double));
+    s->energy[0] = 0;
+    for (int64_t i = 0; i < L + block; i++) {
+        int64_t k = i % L;
+        double m = 0.5 * (s->audio.ch[0][k] + s->audio.ch[1][k]);
+        s->spec[i] = m;
+        s->energy[i + 1] = s->energy[i] + m * m;
+    }
+    fft(s->spec, s->fft_n, false);
+}
+
+static inline float src_at(const source_t *s, int ch, int64_t pos) {
+    int64_t L = s->audio.frames;
+    pos %= L;
+    if (pos < 0) {
+        pos += L;
+    }
+    return s->audio.ch[ch][pos];
+}
+
+// Model output at frame n, for a model whose positions are given at frame c
+static inline float model_at(const analysis_t *a, const model_t *m, int ch, int64_t c, int64_t n) {
+    double v = 0;
+    for (int i = 0; i < a->n_src; i++) {
+        if (m->active[i]) {
+            v += m->gain[i] * src_at(&a->src[i], ch, m->pos[i] + (n - c));
+        }
+    }
+    return (float)v;
+}
+
+static double frame_err(const analysis_t *a, const model_t *m, int64_t c, int64_t n) {
+    double e = 0;
+    for (int ch = 0; ch < 2; ch++) {
+        double d = a->out.ch[ch][n] - model_at(a, m, ch, c, n);
+        e += d * d;
+    }
+    return e;
+}
+
+static double block_energy(const analysis_t *a, int64_t c, int len) {
+    double e = 0;
+    for (int64_t n = c; n < c + len; n++) {
+        e += (double)a->out.ch[0][n] * a->out.ch[0][n] + (double)a->out.ch[1][n] * a->out.ch[1][n];
+    }
+    return e;
+}
+
+// Least squares gains for the active sources of m over [c, c + len);
+// returns residual energy over block energy
+static double fit_gains(const analysis_t *a, model_t *m, int64_t c, int len) {
+    int idx[MAX_SOURCES], k = 0;
+    for (int i = 0; i < a->n_src; i++) {
+        if (m->active[i]) {
+            idx[k++] = i;
+        }
+    }
+    double energy = block_energy(a, c, len);
+    if (energy <= 0) {
+        return 0;
+    }
+    if (k == 0) {
+        return 1;
+    }
+    double G[MAX_SOURCES][MAX_SOURCES + 1] = {{0}};
+    for (int64_t n = c; n < c + len; n++) {
+        for (int ch = 0; ch < 2; ch++) {
+            float s[MAX_SOURCES];
+            for (int i = 0; i < k; i++) {
+                s[i] = src_at(&a->src[idx[i]], ch, m->pos[idx[i]] + (n - c));
+            }
+            float o = a->out.ch[ch][n];
+            for (int i = 0; i < k; i++) {
+                for (int j = i; j < k; j++) {
+                    G[i][j] += (double)s[i] * s[j];
+                }
+                G[i][k] += (double)s[i] * o;
+            }
+        }
+    }
+    for (int i = 0; i < k; i++) {
+        for (int j = 0; j < i; j++) {
+            G[i][j] = G[j][i];
+        }
+    }
+    // Gaussian elimination with partial pivoting
+    for (int col = 0; col < k; col++) {
+        int piv = col;
+        for (int r = col + 1; r < k; r++) {
+            if (fabs(G[r][col]) > fabs(G[piv][col])) {
+                piv = r;
+            }
+        }
+        if (fabs(G[piv][col]) < 1e-9) {
+            return 1;
+        }
+        if (piv != col) {
+            for (int j = 0; j <= k; j++) {
+                double t = G[col][j];
+                G[col][j] = G[piv][j];
+                G[piv][j] = t;
+            }
+        }
+        for (int r = 0; r < k; r++) {
+            if (r != col) {
+                double f = G[r][col] / G[col][col];
+                for (int j = col; j <= k; j++) {
+                    G[r][j] -= f * G[col][j];
+                }
+            }
+        }
+    }
+    for (int i = 0; i < k; i++) {
+        m->gain[idx[i]] = G[i][k] / G[i][i];
+    }
+    double res = 0;
+    for (int64_t n = c; n < c + len; n++) {
+        res += frame_err(a, m, c, n);
+    }
+    return res / energy;
+}
+
+// Keeps the n best peaks in rho/at, no two within RIVAL_SPACING
+static void note_rival(double *rho, int64_t *at, int n, double r, int64_t k) {
+    int slot = -1;
+    for (int j = 0; j < n; j++) {
+        if (at[j] >= 0 && llabs(at[j] - k) < RIVAL_SPACING) {
+            slot = j;
+            break;
+        }
+    }
+    if (slot < 0) {
+        slot = 0;
+        for (int j = 1; j < n; j++) {
+            if (rho[j] < rho[slot]) {
+                slot = j;
+            }
+        }
+    }
+    if (r > rho[slot]) {
+        rho[slot] = r;
+        at[slot] = k;
+    }
+}
+
+// Normalized correlation of source i against x (len frames of mono) at
+// every position in [lo, lo + span) of the looped source. Returns the peak
+// and its position; prefer, when in range and about as good, wins. With
+// rivals, the RIVALS best separate peaks go there too (-1 where unused).
+static double search(const analysis_t *a, int i, const double *x, double xe, int len, int64_t lo, int64_t span,
+                     int64_t prefer, int64_t *pos, int64_t *rivals) {
+    const source_t *s = &a->src[i];
+    int64_t L = s->audio.frames;
+    bool global = span >= L;
+    size_t n = global ? s->fft_n : next_pow2((size_t)(span + len));
+    double complex *cx = calloc(n, sizeof(double complex));
+    for (int k = 0; k < len; k++) {
+        cx[k] = x[k];
+    }
+    fft(cx, n, false);
+    double *energy = s->energy;
+    if (global) {
+        lo = 0;
+        span = L;
+        for (size_t f = 0; f < n; f++) {
+            cx[f] = conj(cx[f]) * s->spec[f];
+        }
+    } else {
+        lo = ((lo % L) + L) % L;
+        double complex *seg = calloc(n, sizeof(double complex));
+        energy = malloc((span + len + 1) * sizeof(double));
+        energy[0] = 0;
+        for (int64_t k = 0; k < span + len; k++) {
+            int64_t p = (lo + k) % L;
+            double m = 0.5 * (s->audio.ch[0][p] + s->audio.ch[1][p]);
+            seg[k] = m;
+            energy[k + 1] = energy[k] + m * m;
+        }
+        fft(seg, n, false);
+        for (size_t f = 0; f < n; f++) {
+            cx[f] = conj(cx[f]) * seg[f];
+        }
+        free(seg);
+    }
+    fft(cx, n, true);
+
+    double peak = 0;
+    int64_t peak_k = 0;
+    double at_prefer = -1;
+    double rival_rho[RIVALS];
+    int64_t rival_k[RIVALS];
+    for (int j = 0; j < RIVALS; j++) {
+        rival_rho[j] = 0;
+        rival_k[j] = -1;
+    }
+    int64_t prefer_k = prefer < 0 ? -1 : (((prefer - lo) % L) + L) % L;
+    for (int64_t k = 0; k < span; k++) {
+        double e = energy[k + len] - energy[k];
+        if (e <= 0) {
+            continue;
+        }
+        double rho = fabs(creal(cx[k])) / sqrt(e * xe);
+        if (rho > peak) {
+            peak = rho;
+            peak_k = k;
+        }
+        if (rivals && rho >= MIN_CORR) {
+            note_rival(rival_rho, rival_k, RIVALS, rho, k);
+        }
+        if (k == prefer_k) {
+            at_prefer = rho;
+        }
+    }
+    if (at_prefer >= EXPECTED_PREFERENCE * peak) {
+        peak_k = prefer_k;
+    }
+    if (!global) {
+        free(energy);
+    }
+    free(cx);
+    *pos = (lo + peak_k) % L;
+    if (rivals) {
+        for (int j = 0; j < RIVALS; j++) {
+            rivals[j] = rival_k[j] < 0 ? -1 : (lo + rival_k[j]) % L;
+        }
+    }
+    return peak;
+}
+
+// Where source i may be at frame c: carrying on, resuming after a dropout
+// in place or further on, or starting from the top. -1 positions are unused.
+static int candidates(const analysis_t *a, const model_t *expect, int i, int64_t c, int64_t *pos) {
+    const voice_t *v = &a->voice[i];
+    int n = 0;
+    if (expect->active[i]) {
+        pos[n++] = expect->pos[i];
+    }
+    if (v->pending) {
+        pos[n++] = v->pending_pos;
+        pos[n++] = v->pending_pos + (c - v->pending_at);
+    }
+    pos[n++] = 0;
+    return n;
+}
+
+// Best position for source i against x, near its candidates or anywhere
+static double locate_one(const analysis_t *a, const model_t *expect, int i, const double *x, double xe, int len,
+                         int64_t c, bool global, int64_t *pos) {
+    int64_t cand[4];
+    int n = candidates(a, expect, i, c, cand);
+    if (global) {
+        return search(a, i, x, xe, len, 0, a->src[i].audio.frames, expect->active[i] ? cand[0] : -1, pos, NULL);
+    }
+    // Only carrying on is preferred; a nearby peak beats the other guesses
+    double best = 0;
+    for (int k = 0; k < n; k++) {
+        int64_t p;
+        int64_t prefer = k == 0 && expect->active[i] ? cand[k] : -1;
+        double rho = search(a, i, x, xe, len, cand[k] - SEARCH_WINDOW, 2 * SEARCH_WINDOW + 1, prefer, &p, NULL);
+        if (rho > best) {
+            best = rho;
+            *pos = p;
+        }
+    }
+    return best;
+}
+
+// Mono of the output over [c, c + len) minus the sources in m other than skip
+static double mono_residual(const analysis_t *a, const model_t *m, int skip, int64_t c, int len, double *x) {
+    model_t others = *m;
+    if (skip >= 0) {
+        others.active[skip] = false;
+    }
+    double xe = 0;
+    for (int n = 0; n < len; n++) {
+        x[n] = 0.5 * ((a->out.ch[0][c + n] - model_at(a, &others, 0, c, c + n)) +
+                      (a->out.ch[1][c + n] - model_at(a, &others, 1, c, c + n)));
+        xe += x[n] * x[n];
+    }
+    return xe;
+}
+
+// Finds the sources in [c, c + len). Greedy first: the best correlating
+// source is taken out of the output and the rest searched again, until
+// nothing correlates, since a quiet source can sit under the fit tolerance. With
+// several sources at similar levels the first picks can be wrong, so each
+// is then searched again against the output minus all the others.
+// Unless global, only positions near where a source could plausibly be
+// are searched, which is most changes and far cheaper.
+static double relocate(const analysis_t *a, const model_t *expect, model_t *m, int64_t c, int len, bool global) {
+    memset(m, 0, sizeof(*m));
+    double *x = malloc(len * sizeof(double));
+    double fit_tol = pow(10, a->opt.fit_db / 10);
+    double ratio = 1;
+    for (int iter = 0; iter < a->n_src; iter++) {
+        double xe = mono_residual(a, m, -1, c, len, x);
+        if (xe <= 0) {
+            break;
+        }
+        int best = -1;
+        int64_t best_pos = 0;
+        double best_rho = MIN_CORR;
+        for (int i = 0; i < a->n_src; i++) {
+            if (m->active[i]) {
+                continue;
+            }
+            int64_t p;
+            double rho = locate_one(a, expect, i, x, xe, len, c, global, &p);
+            if (rho > best_rho) {
+                best_rho = rho;
+                best = i;
+                best_pos = p;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        m->active[best] = true;
+        m->pos[best] = best_pos;
+        ratio = fit_gains(a, m, c, len);
+    }
+    for (int pass = 0; pass < 2 && ratio >= fit_tol; pass++) {
+        for (int i = 0; i < a->n_src; i++) {
+            if (!m->active[i]) {
+                continue;
+            }
+            double xe = mono_residual(a, m, i, c, len, x);
+            model_t near = *expect;
+            near.active[i] = true;
+            near.pos[i] = m->pos[i];
+            int64_t p;
+            if (xe > 0 && locate_one(a, &near, i, x, xe, len, c, global, &p) > MIN_CORR) {
+                m->pos[i] = p;
+            }
+        }
+        ratio = fit_gains(a, m, c, len);
+    }
+    // Sources too quiet to correlate, a track at volume 0 say, carry on
+    // where they were as long as the fit still gives them a gain
+    for (int i = 0; i < a->n_src; i++) {
+        if (expect->active[i] && !m->active[i]) {
+            model_t t = *m;
+            t.active[i] = true;
+            t.pos[i] = expect->pos[i];
+            double r = fit_gains(a, &t, c, len);
+            if (r <= ratio && fabs(t.gain[i]) >= ACTIVE_GAIN) {
+                *m = t;
+                ratio = r;
+            }
+        }
+    }
+    // Correlation can't tell near-periodic material (a slow sweep, a held
+    // note) from itself a period later, and its peaks are a few frames wide.
+    // The position is the one the least squares fit likes best among the
+    // strongest nearby peaks and their neighbours.
+    for (int i = 0; ratio >= fit_tol && i < a->n_src; i++) {
+        if (!m->active[i]) {
+            continue;
+        }
+        int64_t L = a->src[i].audio.frames, found = m->pos[i];
+        int64_t tries[RIVALS + 1];
+        tries[0] = found;
+        double xe = mono_residual(a, m, i, c, len, x);
+        int64_t p;
+        if (xe <= 0 || search(a, i, x, xe, len, found - SEARCH_WINDOW, 2 * SEARCH_WINDOW + 1, -1, &p, tries + 1) <= 0) {
+            tries[1] = -1;
+        }
+        for (int k = 0; k <= RIVALS; k++) {
+            if (tries[k] < 0 || (k > 0 && tries[k] == found)) {
+                continue;
+            }
+            for (int d = -POLISH; d <= POLISH; d++) {
+                model_t t = *m;
+                t.pos[i] = ((tries[k] + d) % L + L) % L;
+                double r = fit_gains(a, &t, c, len);
+                if (r < ratio) {
+                    ratio = r;
+                    *m = t;
+                }
+            }
+        }
+    }
+    // A source fitted at no gain isn't there
+    for (int i = 0; i < a->n_src; i++) {
+        if (m->active[i] && fabs(m->gain[i]) < ACTIVE_GAIN) {
+            m->active[i] = false;
+        }
+    }
+    free(x);
+    return ratio;
+}
+
+// First frame in [c, c + len) the model stops explaining, len if none
+static int first_bad(const analysis_t *a, const model_t *m, int64_t c, int len) {
+    double mean = block_energy(a, c, len) / len;
+    double tol = pow(10, a->opt.fit_db / 10);
+    double floor = 2 * 16.0;            // a few LSB of rounding per channel
+    double window = 0;
+    double e[SMOOTH] = {0};
+    for (int n = 0; n < len; n++) {
+        double v = frame_err(a, m, c, c + n);
+        window += v - e[n % SMOOTH];
+        e[n % SMOOTH] = v;
+        if (n >= SMOOTH - 1 && window / SMOOTH > tol * mean + floor) {
+            // Back to the first frame in the window that was bad on its own
+            for (int k = n - SMOOTH + 1; k <= n; k++) {
+                if (e[k % SMOOTH] > tol * mean + floor) {
+                    return k;
+                }
+            }
+            return n - SMOOTH + 1;
+        }
+    }
+    return len;
+}
+
+// The frame around c where the output switches from m0 to m1, both given at c
+static int64_t refine_change(const analysis_t *a, const model_t *m0, const model_t *m1, int64_t c) {
+    int64_t lo = c - REFINE_WINDOW < 0 ? 0 : c - REFINE_WINDOW;
+    int64_t hi = c + REFINE_WINDOW > a->out.frames ? a->out.frames : c + REFINE_WINDOW;
+    double total1 = 0;
+    for (int64_t n = lo; n < hi; n++) {
+        total1 += frame_err(a, m1, c, n);
+    }
+    double cost0 = 0, cost1 = total1, best = total1;
+    int64_t best_b = lo;
+    for (int64_t b = lo; b < hi; b++) {
+        cost0 += frame_err(a, m0, c, b);
+        cost1 -= frame_err(a, m1, c, b);
+        if (cost0 + cost1 < best) {
+            best = cost0 + cost1;
+            best_b = b + 1;
+        }
+    }
+    return best_b;
+}
+
+static int64_t wrap_delta(int64_t d, int64_t L) {
+    d %= L;
+    if (d < 0) {
+        d += L;
+    }
+    return d >= L / 2 ? d - L : d;
+}
+
+static bool near_loop_point(int64_t pos, int64_t L, int block) {
+    int64_t p = ((pos % L) + L) % L;
+    return p < block || L - p < block;
+}
+
+static double gain_db(double g) {
+    return 20 * log10(fabs(g) > 1e-9 ? fabs(g) : 1e-9);
+}
+
+static void timing_update(voice_t *v, int64_t at) {
+    v->te_last = (at - v->run_start) - v->unrolled;
+    if (llabs(v->te_last) > llabs(v->te_worst)) {
+        v->te_worst = v->te_last;
+    }
+}
+
+static void start_run(voice_t *v, int64_t at, int64_t pos, double gain) {
+    v->active = true;
+    v->started = true;
+    v->pending = false;
+    v->pos = pos;
+    v->gain = gain;
+    v->run_start = at;
+    v->unrolled = 0;
+}
+
+// Applies a model change at output frame b. m1 gives positions at frame c.
+static void apply_change(analysis_t *a, const model_t *m0, const model_t *m1, int64_t c, int64_t b) {
+    int block = a->opt.block;
+    double step = 0;
+    if (b > 0 && b < a->out.frames) {
+        for (int ch = 0; ch < 2; ch++) {
+            double d = fabs(a->out.ch[ch][b] - model_at(a, m0, ch, c, b));
+            step = d > step ? d : step;
+        }
+    }
+    step /= 32768.0;
+    for (int i = 0; i < a->n_src; i++) {
+        voice_t *v = &a->voice[i];
+        int64_t L = a->src[i].audio.frames;
+        int64_t old_pos = m0->pos[i] + (b - c);
+        int64_t new_pos = ((m1->pos[i] + (b - c)) % L + L) % L;
+        bool was = m0->active[i], now = m1->active[i];
+        if (was && now) {
+            int64_t d = wrap_delta(new_pos - old_pos, L);
+            if (new_pos < 2 * block && d < -2 * block) {
+                // Back to the top from mid-file, without a gap: a restart
+                event_t *stop = add_event(a, EV_STOP, b, i);
+                stop->src_pos = ((old_pos % L) + L) % L;
+                event_t *e = add_event(a, EV_START, b, i);
+                e->src_pos = new_pos;
+                e->db_to = gain_db(m1->gain[i]);
+                e->step = step;
+                start_run(v, b, new_pos, m1->gain[i]);
+            } else if (d != 0) {
+                event_t *e = add_event(a, d > 0 ? EV_DROP : EV_DUP, b, i);
+                e->frames = llabs(d);
+                e->src_pos = new_pos;
+                e->step = step;
+                // Either end of the jump at the loop point: the tail or the head went
+                e->loop_point = near_loop_point(old_pos, L, block) || near_loop_point(new_pos, L, block);
+                v->unrolled += d;
+                timing_update(v, b);
+            }
+            if (fabs(gain_db(m1->gain[i]) - gain_db(m0->gain[i])) > 0.3) {
+                event_t *e = add_event(a, EV_GAIN, b, i);
+                e->db_from = gain_db(m0->gain[i]);
+                e->db_to = gain_db(m1->gain[i]);
+                e->step = step;
+            }
+        } else if (was && !now) {
+            v->active = false;
+            v->pending = true;
+            v->pending_at = b;
+            v->pending_pos = ((old_pos % L) + L) % L;
+            timing_update(v, b);
+        } else if (!was && now) {
+            if (v->pending) {
+                int64_t gap = b - v->pending_at;
+                int64_t d = wrap_delta(new_pos - v->pending_pos, L);
+                bool at_loop = near_loop_point(v->pending_pos, L, block);
+                if (llabs(d) <= 2) {
+                    event_t *e = add_event(a, EV_GAP_LATE, v->pending_at, i);
+                    e->frames = gap;
+                    e->src_pos = new_pos;
+                    e->step = step;
+                    e->loop_point = at_loop;
+                    v->active = true;
+                    v->pending = false;
+                    timing_update(v, b);
+                } else if (llabs(d - gap) <= 2) {
+                    event_t *e = add_event(a, EV_GAP_SKIP, v->pending_at, i);
+                    e->frames = gap;
+                    e->src_pos = new_pos;
+                    e->step = step;
+                    e->loop_point = at_loop;
+                    v->active = true;
+                    v->pending = false;
+                    v->unrolled += d;
+                    timing_update(v, b);
+                } else if (new_pos < 2 * block) {
+                    // Stopped mid-file and started again from the top
+                    event_t *stop = add_event(a, EV_STOP, v->pending_at, i);
+                    stop->src_pos = v->pending_pos;
+                    event_t *e = add_event(a, EV_START, b, i);
+                    e->src_pos = new_pos;
+                    e->db_to = gain_db(m1->gain[i]);
+                    start_run(v, b, new_pos, m1->gain[i]);
+                } else {
+                    event_t *e = add_event(a, EV_JUMP, v->pending_at, i);
+                    e->frames = d;
+                    e->src_pos = new_pos;
+                    e->step = step;
+                    start_run(v, b, new_pos, m1->gain[i]);
+                }
+            } else {
+                event_t *e = add_event(a, EV_START, b, i);
+                e->src_pos = new_pos;
+                e->db_to = gain_db(m1->gain[i]);
+                e->initial = !v->started;
+                start_run(v, b, new_pos, m1->gain[i]);
+            }
+        }
+        v->gain = m1->gain[i];
+    }
+    a->last_change = b;
+}
+
+static void shift_model(const analysis_t *a, model_t *m, int64_t frames) {
+    for (int i = 0; i < a->n_src; i++) {
+        int64_t L = a->src[i].audio.frames;
+        m->pos[i] = (((m->pos[i] + frames) % L) + L) % L;
+    }
+}
+
+static void advance(analysis_t *a, model_t *m, int64_t frames) {
+    for (int i = 0; i < a->n_src; i++) {
+        if (m->active[i]) {
+            int64_t L = a->src[i].audio.frames;
+            m->pos[i] = (m->pos[i] + frames) % L;
+            a->voice[i].unrolled += frames;
+        }
+    }
+}
+
+static void add_unmatched(analysis_t *a, int64_t at, int64_t frames) {
+    if (a->n_ev > 0) {
+        event_t *last = &a->ev[a->n_ev - 1];
+        if (last->kind == EV_UNMATCHED && last->at + last->frames == at) {
+            last->frames += frames;
+            return;
+        }
+    }
+    add_event(a, EV_UNMATCHED, at, -1)->frames = frames;
+}
+
+static double residual_peak(const analysis_t *a, const model_t *m, int64_t c, int len) {
+    double peak = 0;
+    for (int64_t n = c; n < c + len; n++) {
+        for (int ch = 0; ch < 2; ch++) {
+            double d = fabs(a->out.ch[ch][n] - model_at(a, m, ch, c, n));
+            peak = d > peak ? d : peak;
+        }
+    }
+    return peak;
+}
+
+static void check_clicks(analysis_t *a, const model_t *m, int64_t c, int len) {
+    double thr = 32768.0 * pow(10, a->opt.click_db / 20);
+    int64_t merge = (int64_t)(MERGE_MS * a->out.rate / 1000);
+    for (int64_t n = c; n < c + len; n++) {
+        double peak = 0;
+        for (int ch = 0; ch < 2; ch++) {
+            double d = fabs(a->out.ch[ch][n] - model_at(a, m, ch, c, n));
+            peak = d > peak ? d : peak;
+        }
+        if (peak < thr) {
+            continue;
+        }
+        if (a->n_ev > 0) {
+            event_t *last = &a->ev[a->n_ev - 1];
+            if (last->kind == EV_CLICK && n - last->at < merge) {
+                last->step = peak / 32768.0 > last->step ? peak / 32768.0 : last->step;
+                continue;
+            }
+        }
+        add_event(a, EV_CLICK, n, -1)->step = peak / 32768.0;
+    }
+}
+
+static void analyse(analysis_t *a) {
+    int B = a->opt.block;
+    double fit_tol = pow(10, a->opt.fit_db / 10);
+    double silence = pow(32768.0 * pow(10, a->opt.silence_db / 20), 2) * 2;
+    double click_thr = 32768.0 * pow(10, a->opt.click_db / 20);
+    model_t m = {0};
+    a->first_audio = -1;
+    a->last_change = -1;
+    int64_t c = 0;
+    while (c + B <= a->out.frames) {
+        double energy = block_energy(a, c, B) / B;
+        bool silent = energy < silence;
+        if (silent) {
+            if (a->first_audio >= 0) {
+                a->audible_frames += B;
+            }
+            bool any = false;
+            for (int i = 0; i < a->n_src; i++) {
+                any |= m.active[i];
+            }
+            if (any) {
+                model_t none = {0};
+                int64_t b = refine_change(a, &m, &none, c);
+                apply_change(a, &m, &none, c, b);
+                m = none;
+            }
+            a->matched_frames += a->first_audio >= 0 ? B : 0;
+            c += B;
+            continue;
+        }
+        if (a->first_audio < 0) {
+            a->first_audio = c + first_bad(a, &(model_t){0}, c, B);
+        }
+
+        model_t fit = m;
+        double ratio = fit_gains(a, &fit, c, B);
+        bool same_set = true;
+        for (int i = 0; i < a->n_src; i++) {
+            if (fit.active[i] && fabs(fit.gain[i]) < ACTIVE_GAIN) {
+                fit.active[i] = false;
+                same_set = false;
+            }
+        }
+        if (ratio < fit_tol) {
+            bool gain_moved = !same_set;
+            for (int i = 0; i < a->n_src; i++) {
+                if (fit.active[i] && fabs(gain_db(fit.gain[i]) - gain_db(m.gain[i])) > 0.3) {
+                    gain_moved = true;
+                }
+            }
+            if (gain_moved && c != a->last_change) {
+                int64_t b = refine_change(a, &m, &fit, c);
+                apply_change(a, &m, &fit, c, b);
+            } else if (c != a->last_change && residual_peak(a, &fit, c, B) >= click_thr) {
+                // Could be a click, or a quiet source starting under the fit tolerance
+                model_t found;
+                if (relocate(a, &fit, &found, c, B, false) < ratio / 10) {
+                    int64_t b = refine_change(a, &m, &found, c);
+                    apply_change(a, &m, &found, c, b);
+                    m = found;
+                    a->last_change = c;
+                    continue;
+                }
+            }
+            m = fit;
+            check_clicks(a, &m, c, B);
+            a->matched_frames += B;
+            a->audible_frames += B;
+            advance(a, &m, B);
+            c += B;
+            continue;
+        }
+
+        // Something changed in this block: keep what the old model explains
+        int f = first_bad(a, &m, c, B);
+        if (f >= MIN_ADVANCE) {
+            check_clicks(a, &m, c, f);
+            a->matched_frames += f;
+            a->audible_frames += f;
+            advance(a, &m, f);
+            c += f;
+            continue;
+        }
+        if (c == a->last_change) {
+            // Changed here already and still can't follow it. If the model
+            // holds again right after, this was a short burst: a click.
+            if (c + MIN_ADVANCE + B <= a->out.frames && first_bad(a, &m, c + MIN_ADVANCE, B) == B) {
+                check_clicks(a, &m, c, MIN_ADVANCE);
+                a->matched_frames += MIN_ADVANCE;
+                a->audible_frames += MIN_ADVANCE;
+                advance(a, &m, MIN_ADVANCE);
+                c += MIN_ADVANCE;
+                continue;
+            }
+            add_unmatched(a, c, MIN_ADVANCE);
+            a->audible_frames += MIN_ADVANCE;
+            advance(a, &m, MIN_ADVANCE);
+            c += MIN_ADVANCE;
+            continue;
+        }
+        // Search from just past the break so the block holds only the new
+        // state, then bring the positions back to c
+        int64_t skip = c + f + SMOOTH + B <= a->out.frames ? f + SMOOTH : 0;
+        model_t expect = m, found;
+        shift_model(a, &expect, skip);
+        ratio = relocate(a, &expect, &found, c + skip, B, false);
+        if (ratio >= fit_tol) {
+            ratio = relocate(a, &expect, &found, c + skip, B, true);
+        }
+        shift_model(a, &found, -skip);
+        if (ratio >= fit_tol) {
+            // Nothing explains it; skip a whole block, the search is expensive
+            add_unmatched(a, c, B);
+            a->audible_frames += B;
+            advance(a, &m, B);
+            c += B;
+            continue;
+        }
+        int64_t b = refine_change(a, &m, &found, c);
+        apply_change(a, &m, &found, c, b);
+        m = found;
+        a->last_change = c;
+    }
+    // Dropouts that never came back are stops
+    for (int i = 0; i < a->n_src; i++) {
+        voice_t *v = &a->voice[i];
+        if (v->pending && a->out.frames - v->pending_at > 2 * B) {
+            add_event(a, EV_STOP, v->pending_at, i)->src_pos = v->pending_pos;
+        }
+        if (v->active) {
+            timing_update(v, c);
+        }
+    }
+}
+
+// Events come out of the tracking loop roughly in order; gaps are recorded
+// at their start when they end, so sort, then merge gain ramps and jumps
+// that were found in more than one step
+static int cmp_event(const void *x, const void *y) {
+    const event_t *a = x, *b = y;
+    return a->at < b->at ? -1 : a->at > b->at ? 1 : a->src - b->src;
+}
+
+static void tidy_events(analysis_t *a) {
+    qsort(a->ev, a->n_ev, sizeof(event_t), cmp_event);
+    int64_t merge = (int64_t)(MERGE_MS * a->out.rate / 1000);
+    size_t w = 0;
+    for (size_t r = 0; r < a->n_ev; r++) {
+        event_t *e = &a->ev[r];
+        bool merged = false;
+        for (size_t k = w; k-- > 0 && e->at - a->ev[k].at < merge;) {
+            event_t *p = &a->ev[k];
+            if (p->src != e->src) {
+                continue;
+            }
+            if (p->kind == EV_GAIN && e->kind == EV_GAIN) {
+                p->db_to = e->db_to;
+                merged = true;
+                break;
+            }
+            // A jump found in two steps is one jump
+            if ((p->kind == EV_DROP || p->kind == EV_DUP) && (e->kind == EV_DROP || e->kind == EV_DUP)) {
+                int64_t net = (p->kind == EV_DROP ? p->frames : -p->frames) +
+                              (e->kind == EV_DROP ? e->frames : -e->frames);
+                p->kind = net >= 0 ? EV_DROP : EV_DUP;
+                p->frames = llabs(net);
+                p->src_pos = e->src_pos;
+                p->loop_point |= e->loop_point;
+                merged = true;
+                break;
+            }
+        }
+        if (!merged) {
+            a->ev[w++] = *e;
+        }
+    }
+    a->n_ev = w;
+    w = 0;
+    for (size_t r = 0; r < a->n_ev; r++) {
+        if ((a->ev[r].kind == EV_DROP || a->ev[r].kind == EV_DUP) && a->ev[r].frames == 0) {
+            continue;
+        }
+        a->ev[w++] = a->ev[r];
+    }
+    a->n_ev = w;
+}
+
+// Automation
+
+static bool read_automation(analysis_t *a, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        put_err(path, "can't open");
+        return false;
+    }
+    char line[256];
+    int lineno = 0;
+    size_t cap = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        double t, db = 0;
+        int src;
+        char what[16];
+        int n = sscanf(line, "%lf %d %15s %lf", &t, &src, what, &db);
+        if (n <= 0) {
+            continue;
+        }
+        auto_t at = { .at_ms = t, .src = src, .db = db, .pos = (int64_t)db };
+        if (n >= 3 && strcmp(what, "start") == 0) {
+            at.kind = EV_START;
+        } else if (n >= 3 && strcmp(what, "stop") == 0) {
+            at.kind = EV_STOP;
+        } else if (n == 4 && strcmp(what, "gain") == 0) {
+            at.kind = EV_GAIN;
+        } else if (n == 4 && strcmp(what, "seek") == 0 && db >= 0) {
+            at.kind = EV_SEEK;
+        } else {
+            fprintf(stderr, "%s:%d: want \"MS SOURCE start|stop|gain DB|seek FRAME\"\n", path, lineno);
+            fclose(f);
+            return false;
+        }
+        if (src < 0 || src >= a->n_src) {
+            fprintf(stderr, "%s:%d: no source %d\n", path, lineno, src);
+            fclose(f);
+            return false;
+        }
+        if (a->n_autos == cap) {
+            cap = cap ? cap * 2 : 16;
+            a->autos = realloc(a->autos, cap * sizeof(auto_t));
+        }
+        a->autos[a->n_autos++] = at;
+    }
+    fclose(f);
+    return true;
+}
+
+static bool auto_fits(const auto_t *s, const event_t *e) {
+    if (e->src != s->src || e->expected) {
+        return false;
+    }
+    if (s->kind == EV_SEEK) {
+        // Playing on from the frame asked for, however it got there
+        bool moved = e->kind == EV_JUMP || e->kind == EV_DROP || e->kind == EV_DUP || e->kind == EV_START;
+        return moved && llabs(e->src_pos - s->pos) <= SEEK_FRAMES;
+    }
+    if (e->kind != s->kind) {
+        return false;
+    }
+    return s->kind != EV_GAIN || fabs(e->db_to - s->db) <= 1.0;
+}
+
+static size_t match_automation(analysis_t *a, double offset_ms, bool commit) {
+    size_t matched = 0;
+    bool used[a->n_ev > 0 ? a->n_ev : 1];
+    memset(used, 0, sizeof(used));
+    for (size_t i = 0; i < a->n_autos; i++) {
+        auto_t *s = &a->autos[i];
+        double want = s->at_ms + offset_ms;
+        size_t best = SIZE_MAX;
+        double best_err = a->opt.tolerance_ms;
+        for (size_t k = 0; k < a->n_ev; k++) {
+            if (used[k] || !auto_fits(s, &a->ev[k])) {
+                continue;
+            }
+            double err = fabs(frames_ms(a, a->ev[k].at) - want);
+            if (err <= best_err) {
+                best_err = err;
+                best = k;
+            }
+        }
+        if (best == SIZE_MAX) {
+            continue;
+        }
+        used[best] = true;
+        matched++;
+        if (commit) {
+            s->matched = true;
+            a->ev[best].expected = true;
+            a->ev[best].auto_err_ms = frames_ms(a, a->ev[best].at) - want;
+        }
+    }
+    return matched;
+}
+
+// The offset between the two clocks is whichever candidate lines up the
+// most events; ties go to the smaller total error
+static void apply_automation(analysis_t *a) {
+    double best_offset = 0;
+    size_t best_count = match_automation(a, 0, false);
+    for (size_t i = 0; i < a->n_autos; i++) {
+        for (size_t k = 0; k < a->n_ev; k++) {
+            if (!auto_fits(&a->autos[i], &a->ev[k])) {
+                continue;
+            }
+            double offset = frames_ms(a, a->ev[k].at) - a->autos[i].at_ms;
+            size_t count = match_automation(a, offset, false);
+            if (count > best_count) {
+                best_count = count;
+                best_offset = offset;
+            }
+        }
+    }
+    // Centre the offset on the matched events
+    match_automation(a, best_offset, true);
+    double sum = 0;
+    size_t n = 0;
+    for (size_t k = 0; k < a->n_ev; k++) {
+        if (a->ev[k].expected) {
+            sum += a->ev[k].auto_err_ms;
+            n++;
+        }
+    }
+    if (n > 0) {
+        for (size_t k = 0; k < a->n_ev; k++) {
+            a->ev[k].expected = false;
+        }
+        for (size_t i = 0; i < a->n_autos; i++) {
+            a->autos[i].matched = false;
+        }
+        best_offset += sum / n;
+        match_automation(a, best_offset, true);
+    }
+    a->auto_offset_ms = best_offset;
+    a->auto_matched = 0;
+    a->auto_jitter_ms = 0;
+    for (size_t k = 0; k < a->n_ev; k++) {
+        if (a->ev[k].expected) {
+            a->auto_matched++;
+            if (fabs(a->ev[k].auto_err_ms) > a->auto_jitter_ms) {
+                a->auto_jitter_ms = fabs(a->ev[k].auto_err_ms);
+            }
+        }
+    }
+    for (size_t i = 0; i < a->n_autos; i++) {
+        if (!a->autos[i].matched) {
+            event_t *e = add_event(a, EV_MISSED, (int64_t)((a->autos[i].at_ms + best_offset) * a->out.rate / 1000),
+                                   a->autos[i].src);
+            e->db_to = a->autos[i].db;
+            e->src_pos = a->autos[i].pos;
+            e->frames = a->autos[i].kind;
+        }
+    }
+    qsort(a->ev, a->n_ev, sizeof(event_t), cmp_event);
+}
+
+static bool is_glitch(const analysis_t *a, const event_t *e) {
+    switch (e->kind) {
+        case EV_START:
+            return a->opt.automation && !e->expected && !e->initial;
+        case EV_STOP:
+        case EV_GAIN:
+            return a->opt.automation && !e->expected;
+        default:
+            // Only a seek makes a jump expected
+            return !e->expected;
+    }
+}
+
+// Report
+
+static void describe(const analysis_t *a, const event_t *e, char *buf, size_t len) {
+    const char *where = e->loop_point ? " at the loop point" : "";
+    switch (e->kind) {
+        case EV_START:
+            snprintf(buf, len, "%s at frame %lld, %.1f dB", e->initial ? "first start" : "start", (long long)e->src_pos,
+                     e->db_to);
+            break;
+        case EV_STOP:
+            snprintf(buf, len, "stop at frame %lld", (long long)e->src_pos);
+            break;
+        case EV_GAIN:
+            snprintf(buf, len, "gain %.1f -> %.1f dB", e->db_from, e->db_to);
+            break;
+        case EV_DROP:
+            snprintf(buf, len, "dropped %lld frames (%.1f ms)%s", (long long)e->frames, frames_ms(a, e->frames), where);
+            break;
+        case EV_DUP:
+            snprintf(buf, len, "repeated %lld frames (%.1f ms)%s", (long long)e->frames, frames_ms(a, e->frames), where);
+            break;
+        case EV_GAP_LATE:
+            snprintf(buf, len, "gap of %lld frames (%.1f ms)%s, resumed in place", (long long)e->frames,
+                     frames_ms(a, e->frames), where);
+            break;
+        case EV_GAP_SKIP:
+            snprintf(buf, len, "gap of %lld frames (%.1f ms)%s, audio under it lost", (long long)e->frames,
+                     frames_ms(a, e->frames), where);
+            break;
+        case EV_JUMP:
+            snprintf(buf, len, "jumped %lld frames after a dropout", (long long)e->frames);
+            break;
+        case EV_CLICK:
+            snprintf(buf, len, "click, %.1f dBFS off the expected signal", gain_db(e->step));
+            break;
+        case EV_UNMATCHED:
+            snprintf(buf, len, "%lld frames (%.1f ms) match no source", (long long)e->frames, frames_ms(a, e->frames));
+            break;
+        case EV_MISSED:
+            if (e->frames == EV_SEEK) {
+                snprintf(buf, len, "scheduled seek to frame %lld not heard", (long long)e->src_pos);
+            } else {
+                snprintf(buf, len, "scheduled %s%s not heard", s_kind_names[e->frames],
+                         e->frames == EV_GAIN ? " change" : "");
+            }
+            break;
+        case EV_SEEK:
+            break;
+    }
+}
+
+static size_t count_glitches(const analysis_t *a) {
+    size_t n = 0;
+    for (size_t k = 0; k < a->n_ev; k++) {
+        n += is_glitch(a, &a->ev[k]);
+    }
+    return n;
+}
+
+static void print_report(const analysis_t *a) {
+    printf("output         %s, %.3f s at %u Hz", a->out.name, frames_ms(a, a->out.frames) / 1000, a->out.rate);
+    if (a->first_audio >= 0) {
+        printf(", first audio at %.1f ms\n", frames_ms(a, a->first_audio));
+    } else {
+        printf(", silent\n");
+    }
+    for (int i = 0; i < a->n_src; i++) {
+        const voice_t *v = &a->voice[i];
+        printf("source %d       %s, %.3f s, timing error %+.1f ms (worst %+.1f ms)\n", i, a->src[i].audio.name,
+               frames_ms(a, a->src[i].audio.frames) / 1000, frames_ms(a, v->te_last), frames_ms(a, v->te_worst));
+    }
+    printf("matched        %.2f %% of audible frames\n",
+           a->audible_frames ? 100.0 * a->matched_frames / a->audible_frames : 100.0);
+    if (a->opt.automation) {
+        printf("automation     %zu of %zu events heard, clock offset %.1f ms, worst timing error %.1f ms\n",
+               a->auto_matched, a->n_autos, a->auto_offset_ms, a->auto_jitter_ms);
+    }
+    printf("glitches       %zu\n", count_glitches(a));
+    for (size_t k = 0; k < a->n_ev; k++) {
+        const event_t *e = &a->ev[k];
+        char what[160];
+        describe(a, e, what, sizeof(what));
+        const char *name = e->src >= 0 ? a->src[e->src].audio.name : "-";
+        char tail[48] = "";
+        if (e->expected) {
+            snprintf(tail, sizeof(tail), ", expected (%+.1f ms)", e->auto_err_ms);
+        }
+        printf("  %c %10.1f ms  %-16s %s%s\n", is_glitch(a, e) ? '!' : ' ', frames_ms(a, e->at), name, what, tail);
+    }
+}
+
+static void json_str(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', f);
+        }
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static bool write_json(const analysis_t *a, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        put_err(path, "can't write");
+        return false;
+    }
+    fprintf(f, "{\n  \"output\": ");
+    json_str(f, a->out.path);
+    fprintf(f, ",\n  \"rate\": %u,\n  \"duration_s\": %.3f,\n  \"first_audio_ms\": %.1f,\n", a->out.rate,
+            frames_ms(a, a->out.frames) / 1000, a->first_audio >= 0 ? frames_ms(a, a->first_audio) : -1.0);
+    fprintf(f, "  \"matched_pct\": %.3f,\n  \"glitches\": %zu,\n",
+            a->audible_frames ? 100.0 * a->matched_frames / a->audible_frames : 100.0, count_glitches(a));
+    if (a->opt.automation) {
+        fprintf(f, "  \"automation\": {\"scheduled\": %zu, \"heard\": %zu, \"offset_ms\": %.1f, \"worst_error_ms\": %.1f},\n",
+                a->n_autos, a->auto_matched, a->auto_offset_ms, a->auto_jitter_ms);
+    }
+    fprintf(f, "  \"sources\": [\n");
+    for (int i = 0; i < a->n_src; i++) {
+        fprintf(f, "    {\"name\": ");
+        json_str(f, a->src[i].audio.name);
+        fprintf(f, ", \"timing_error_ms\": %.1f, \"worst_timing_error_ms\": %.1f}%s\n",
+                frames_ms(a, a->voice[i].te_last), frames_ms(a, a->voice[i].te_worst), i + 1 < a->n_src ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"events\": [\n");
+    for (size_t k = 0; k < a->n_ev; k++) {
+        const event_t *e = &a->ev[k];
+        fprintf(f, "    {\"at_ms\": %.1f, \"kind\": \"%s\", \"source\": %d, \"glitch\": %s, \"frames\": %lld, "
+                "\"source_frame\": %lld, \"loop_point\": %s, \"step_dbfs\": %.1f",
+                frames_ms(a, e->at), s_kind_names[e->kind], e->src, is_glitch(a, e) ? "true" : "false",
+                (long long)(e->kind == EV_MISSED ? 0 : e->frames), (long long)e->src_pos,
+                e->loop_point ? "true" : "false", e->step > 0 ? gain_db(e->step) : -120.0);
+        if (e->kind == EV_GAIN) {
+            fprintf(f, ", \"db_from\": %.2f, \"db_to\": %.2f", e->db_from, e->db_to);
+        }
+        if (e->expected) {
+            fprintf(f, ", \"automation_error_ms\": %.1f", e->auto_err_ms);
+        }
+        fprintf(f, "}%s\n", k + 1 < a->n_ev ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+static void usage(FILE *out) {
+    fprintf(out,
+        "usage: pcm_continuity [options] OUTPUT.wav SOURCE.wav [SOURCE.wav ...]\n"
+        "\n"
+        "Follows each SOURCE (looped) through OUTPUT and reports where the output\n"
+        "stops being a continuous mix of them. All files are 16 bit PCM at one rate.\n"
+        "\n"
+        "  --automation FILE     expected changes, one per line: MS SOURCE start|stop|gain DB|seek FRAME\n"
+        "                        (SOURCE is the index in the argument list, from 0);\n"
+        "                        unexpected starts, stops, gain changes and jumps then count as glitches\n"
+        "  --tolerance-ms N      how far an automation event may be heard from its time (default 300)\n"
+        "  --click-db N          residual peak that counts as a click, dBFS (default -40)\n"
+        "  --silence-db N        blocks quieter than this are silence, dBFS (default -70)\n"
+        "  --fit-db N            residual that still counts as a match, dB below the signal (default -40;\n"
+        "                        around -20 for a line-in recording)\n"
+        "  --block N             analysis block in frames (default 1024)\n"
+        "  --json FILE           write the results as JSON\n"
+        "  --max-glitches N      exit 1 if there were more than N glitches\n");
+}
+
+int main(int argc, char **argv) {
+    static const struct option longopts[] = {
+        { "automation",   required_argument, 0, 'a' },
+        { "tolerance-ms", required_argument, 0, 't' },
+        { "click-db",     required_argument, 0, 'c' },
+        { "silence-db",   required_argument, 0, 's' },
+        { "fit-db",       required_argument, 0, 'f' },
+        { "block",        required_argument, 0, 'b' },
+        { "json",         required_argument, 0, 'j' },
+        { "max-glitches", required_argument, 0, 'm' },
+        { "help",         no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+    analysis_t a = {
+        .opt = {
+            .block = 1024,
+            .click_db = -40,
+            .silence_db = -70,
+            .fit_db = -40,
+            .tolerance_ms = 300,
+            .max_glitches = -1,
+        },
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "h", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'a': a.opt.automation = optarg; break;
+            case 't': a.opt.tolerance_ms = atof(optarg); break;
+            case 'c': a.opt.click_db = atof(optarg); break;
+            case 's': a.opt.silence_db = atof(optarg); break;
+            case 'f': a.opt.fit_db = atof(optarg); break;
+            case 'b': a.opt.block = atoi(optarg); break;
+            case 'j': a.opt.json = optarg; break;
+            case 'm': a.opt.max_glitches = atol(optarg); break;
+            case 'h': usage(stdout); return 0;
+            default: usage(stderr); return 2;
+        }
+    }
+    if (argc - optind < 2 || argc - optind - 1 > MAX_SOURCES || a.opt.block < 2 * REFINE_WINDOW) {
+        usage(stderr);
+        return 2;
+    }
+    if (!read_wav(argv[optind], &a.out)) {
+        return 2;
+    }
+    for (int i = optind + 1; i < argc; i++) {
+        source_t *s = &a.src[a.n_src++];
+        if (!read_wav(argv[i], &s->audio)) {
+            return 2;
+        }
+        if (s->audio.rate != a.out.rate) {
+            fprintf(stderr, "%s: %u Hz, the output is %u Hz\n", argv[i], s->audio.rate, a.out.rate);
+            return 2;
+        }
+        if (s->audio.frames < a.opt.block) {
+            fprintf(stderr, "%s: shorter than one block\n", argv[i]);
+            return 2;
+        }
+        source_prepare(s, a.opt.block);
+    }
+    if (a.opt.automation && !read_automation(&a, a.opt.automation)) {
+        return 2;
+    }
+
+    analyse(&a);
+    tidy_events(&a);
+    if (a.opt.automation) {
+        apply_automation(&a);
+    }
+    print_report(&a);
+    if (a.opt.json && !write_json(&a, a.opt.json)) {
+        return 2;
+    }
+    size_t glitches = count_glitches(&a);
+    return a.opt.max_glitches >= 0 && glitches > (size_t)a.opt.max_glitches ? 1 : 0;
+}
@@ -0,0 +1,252 @@
+#!/usr/bin/env python3
+"""Glitch benchmark: scripted scenarios against loudframe_host.
+
+For each scenario this writes the corpus and a loop_config.json into a
+fresh SD directory, runs loudframe_host with its I2S tap on, sends the
+scenario's API requests at their times, and hands the tap, the sources and
+the automation those requests should have caused to pcm_continuity. The
+result per scenario is the analyser's glitch count against the scenario's
+budget. Standard library only.
+
+    ./run_bench.py --bin build/loudframe_host scenarios/*.json
+"""
+
+import argparse
+import glob
+import http.client
+import json
+import math
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+MAX_TRACKS = 3
+
+
+def volume_db(percent):
+    """The mapping AUDIO_ACTION_SET_VOLUME uses in play_sdcard.c."""
+    percent = max(0, min(100, percent))
+    return -60.0 if percent == 0 else 20 * math.log10(percent / 100.0)
+
+
+def post(port, path, body, timeout=10):
+    conn = http.client.HTTPConnection("127.0.0.1", port, timeout=timeout)
+    try:
+        conn.request("POST", path, body=json.dumps(body), headers={"Content-Type": "application/json"})
+        resp = conn.getresponse()
+        resp.read()
+        return resp.status
+    except (OSError, http.client.HTTPException):
+        return 0
+    finally:
+        conn.close()
+
+
+def wait_for_api(port, timeout_s):
+    deadline = time.monotonic() + timeout_s
+    while time.monotonic() < deadline:
+        try:
+            conn = http.client.HTTPConnection("127.0.0.1", port, timeout=1)
+            conn.request("GET", "/api/loops")
+            resp = conn.getresponse()
+            resp.read()
+            conn.close()
+            if resp.status == 200:
+                return True
+        except (OSError, http.client.HTTPException):
+            pass
+        time.sleep(0.05)
+    return False
+
+
+class Tracks:
+    """What the scenario has asked loudframe to play, to derive the automation.
+
+    pcm_continuity follows source files, not tracks, so each event names the
+    file the track is playing. A scenario never plays one file on two tracks.
+    """
+
+    def __init__(self, scenario, sources):
+        self.sources = sources
+        self.file = []
+        self.playing = []
+        self.db = []
+        for loop in scenario["loops"]:
+            self.file.append(loop["file"])
+            self.playing.append(loop.get("playing", True))
+            self.db.append(volume_db(loop.get("volume", 100)))
+        self.events = []
+
+    def emit(self, at_ms, track, what, db=None):
+        src = self.sources.index(self.file[track])
+        line = "%.1f %d %s" % (at_ms, src, what)
+        if db is not None:
+            line += " %.2f" % db
+        self.events.append(line)
+
+    def apply(self, at_ms, path, body):
+        track = body.get("track", 0)
+        if path == "/api/loop/volume":
+            db = volume_db(body["volume"])
+            if self.playing[track] and abs(db - self.db[track]) > 0.3:
+                self.emit(at_ms, track, "gain", db)
+            self.db[track] = db
+        elif path == "/api/loop/stop":
+            if self.playing[track]:
+                self.emit(at_ms, track, "stop")
+            self.playing[track] = False
+        elif path in ("/api/loop/start", "/api/loop/file"):
+            # Both restart the track from the top, stopping it first
+            if self.playing[track]:
+                self.emit(at_ms, track, "stop")
+            if "filename" in body:
+                self.file[track] = body["filename"]
+            self.emit(at_ms, track, "start")
+            self.playing[track] = True
+        elif path == "/api/loop/seek":
+            # Plays on from that frame of the same file, starting the track if
+            # it was stopped. The corpus is at the output rate, so samples are frames.
+            self.emit(at_ms, track, "seek %d" % body["sample"])
+            self.playing[track] = True
+        # /api/global/volume is the codec's volume, it never reaches the PCM
+
+
+def loop_config(scenario):
+    return {
+        "global_volume": scenario.get("global_volume", 75),
+        "loops": [
+            {
+                "track": i,
+                "is_playing": loop.get("playing", True),
+                "file_path": "/sdcard/" + loop["file"],
+                "volume": loop.get("volume", 100),
+            }
+            for i, loop in enumerate(scenario["loops"])
+        ],
+    }
+
+
+def run_scenario(args, path, corpus, work):
+    with open(path) as f:
+        scenario = json.load(f)
+    name = os.path.splitext(os.path.basename(path))[0]
+    if len(scenario["loops"]) > MAX_TRACKS:
+        raise SystemExit("%s: loudframe has %d tracks" % (path, MAX_TRACKS))
+
+    # Every file the scenario plays, in a fixed order, is a source
+    sources = []
+    for loop in scenario["loops"]:
+        sources.append(loop["file"])
+    for action in scenario.get("actions", []):
+        fn = action.get("body", {}).get("filename")
+        if fn:
+            sources.append(fn)
+    sources = list(dict.fromkeys(sources))
+
+    # Start clean, a stale loop_config.json would change the run
+    shutil.rmtree(os.path.join(work, name), ignore_errors=True)
+    sd = os.path.join(work, name, "sdcard")
+    os.makedirs(sd)
+    for fn in sources:
+        shutil.copy(os.path.join(corpus, fn), sd)
+    with open(os.path.join(sd, "loop_config.json"), "w") as f:
+        json.dump(loop_config(scenario), f)
+
+    out_dir = os.path.join(work, name)
+    tap = os.path.join(out_dir, "tap.wav")
+    cmd = [os.path.join(args.bin, "loudframe_host"), "--port", str(args.port), "--sd", sd, "--tap", tap,
+           "--duration", str(scenario["duration_s"]), "--log-level", "w"]
+    with open(os.path.join(out_dir, "host.log"), "w") as log:
+        host = subprocess.Popen(cmd, stdout=log, stderr=subprocess.STDOUT)
+        t0 = time.monotonic()
+        if not wait_for_api(args.port, 10):
+            host.kill()
+            raise SystemExit("%s: loudframe_host didn't come up, see %s" % (name, log.name))
+
+        load = None
+        if scenario.get("load"):
+            load_args = [sys.executable, os.path.join(HERE, "..", "api_load.py"), "--port", str(args.port),
+                         "--duration", str(scenario["duration_s"])]
+            load_args += [str(a) for a in scenario["load"]]
+            load = subprocess.Popen(load_args, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+        # Times in the automation are from process start; pcm_continuity
+        # works out the offset to the tap itself
+        tracks = Tracks(scenario, sources)
+        failed_requests = 0
+        for action in sorted(scenario.get("actions", []), key=lambda a: a["at_s"]):
+            delay = t0 + action["at_s"] - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+            sent_ms = (time.monotonic() - t0) * 1000
+            if post(args.port, action["post"], action.get("body", {})) != 200:
+                failed_requests += 1
+            tracks.apply(sent_ms, action["post"], action.get("body", {}))
+        host.wait()
+        if load:
+            load.wait()
+
+    automation = os.path.join(out_dir, "automation.txt")
+    with open(automation, "w") as f:
+        f.write("# ms source start|stop|gain dB|seek frame, sources: %s\n" % " ".join(sources))
+        f.write("".join(line + "\n" for line in tracks.events))
+
+    result_json = os.path.join(out_dir, "continuity.json")
+    analyser = [os.path.join(args.bin, "pcm_continuity"), "--automation", automation, "--json", result_json, tap]
+    analyser += [os.path.join(sd, fn) for fn in sources]
+    with open(os.path.join(out_dir, "continuity.txt"), "w") as report:
+        subprocess.run(analyser, stdout=report, stderr=subprocess.STDOUT)
+    with open(result_json) as f:
+        result = json.load(f)
+
+    result["scenario"] = name
+    result["budget"] = scenario.get("max_glitches", 0)
+    result["failed_requests"] = failed_requests
+    result["report"] = os.path.join(out_dir, "continuity.txt")
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("scenarios", nargs="*", help="scenario files (default: scenarios/*.json)")
+    parser.add_argument("--bin", default="build/loudframe_host",
+                        help="build directory with loudframe_host and pcm_continuity")
+    parser.add_argument("--corpus", help="corpus directory (default: generated in the work directory)")
+    parser.add_argument("--work", help="keep taps and reports here (default: a temp directory)")
+    parser.add_argument("--port", type=int, default=18080)
+    parser.add_argument("--json", help="write every scenario's results as JSON")
+    args = parser.parse_args()
+
+    scenarios = args.scenarios or sorted(glob.glob(os.path.join(HERE, "scenarios", "*.json")))
+    work = args.work or tempfile.mkdtemp(prefix="loudframe_glitch.")
+    corpus = args.corpus or os.path.join(work, "corpus")
+    subprocess.run([sys.executable, os.path.join(HERE, "make_corpus.py"), corpus], check=True,
+                   stdout=subprocess.DEVNULL)
+
+    results = []
+    print("%-20s %8s %8s %10s %10s %12s  %s" %
+          ("scenario", "glitches", "budget", "matched %", "offset ms", "worst te ms", "result"))
+    for path in scenarios:
+        r = run_scenario(args, path, corpus, work)
+        results.append(r)
+        worst = max((abs(s["worst_timing_error_ms"]) for s in r["sources"]), default=0.0)
+        ok = r["glitches"] <= r["budget"] and r["failed_requests"] == 0
+        auto = r.get("automation", {})
+        print("%-20s %8d %8d %10.2f %10.1f %12.1f  %s" %
+              (r["scenario"], r["glitches"], r["budget"], r["matched_pct"], auto.get("offset_ms", 0.0), worst,
+               "ok" if ok else "FAIL, see " + r["report"]))
+        r["ok"] = ok
+    print("work directory %s" % work)
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(results, f, indent=2)
+    return 0 if all(r["ok"] for r in results) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,26 @@
+#ifndef HOST_AUDIO_COMMON_H
+#define HOST_AUDIO_COMMON_H
+
+#define ELEMENT_SUB_TYPE_OFFSET     16
+
+typedef enum {
+    AUDIO_ELEMENT_TYPE_UNKNOW   = 0x01 << ELEMENT_SUB_TYPE_OFFSET,
+    AUDIO_ELEMENT_TYPE_ELEMENT  = 0x01 << (ELEMENT_SUB_TYPE_OFFSET + 1),
+    AUDIO_ELEMENT_TYPE_PLAYER   = 0x01 << (ELEMENT_SUB_TYPE_OFFSET + 2),
+    AUDIO_ELEMENT_TYPE_SERVICE  = 0x01 << (ELEMENT_SUB_TYPE_OFFSET + 3),
+    AUDIO_ELEMENT_TYPE_PERIPH   = 0x01 << (ELEMENT_SUB_TYPE_OFFSET + 4),
+} audio_element_type_t;
+
+typedef enum {
+    AUDIO_STREAM_NONE = 0,
+    AUDIO_STREAM_READER,
+    AUDIO_STREAM_WRITER
+} audio_stream_type_t;
+
+typedef enum {
+    AUDIO_CODEC_TYPE_NONE = 0,
+    AUDIO_CODEC_TYPE_DECODER,
+    AUDIO_CODEC_TYPE_ENCODER
+} audio_codec_type_t;
+
+#endif // HOST_AUDIO_COMMON_H
@@ -0,0 +1,151 @@
+// ADF audio elements for the host build, see host_adf.c
+//
+// Element handles are the fakes from host_adf.c. Only what loudframe calls
+// is declared.
+
+#ifndef HOST_AUDIO_ELEMENT_H
+#define HOST_AUDIO_ELEMENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "audio_common.h"
+#include "audio_event_iface.h"
+#include "ringbuf.h"
+
+typedef enum {
+    AEL_STATE_NONE          = 0,
+    AEL_STATE_INIT          = 1,
+    AEL_STATE_INITIALIZING  = 2,
+    AEL_STATE_RUNNING       = 3,
+    AEL_STATE_PAUSED        = 4,
+    AEL_STATE_STOPPED       = 5,
+    AEL_STATE_FINISHED      = 6,
+    AEL_STATE_ERROR         = 7
+} audio_element_state_t;
+
+typedef enum {
+    AEL_MSG_CMD_NONE                = 0,
+    AEL_MSG_CMD_FINISH              = 2,
+    AEL_MSG_CMD_STOP                = 3,
+    AEL_MSG_CMD_PAUSE               = 4,
+    AEL_MSG_CMD_RESUME              = 5,
+    AEL_MSG_CMD_DESTROY             = 6,
+    AEL_MSG_CMD_REPORT_STATUS       = 8,
+    AEL_MSG_CMD_REPORT_MUSIC_INFO   = 9,
+    AEL_MSG_CMD_REPORT_CODEC_FMT    = 10,
+    AEL_MSG_CMD_REPORT_POSITION     = 11,
+} audio_element_msg_cmd_t;
+
+typedef enum {
+    AEL_STATUS_NONE             = 0,
+    AEL_STATUS_ERROR_OPEN       = 1,
+    AEL_STATUS_ERROR_INPUT      = 2,
+    AEL_STATUS_ERROR_PROCESS    = 3,
+    AEL_STATUS_ERROR_OUTPUT     = 4,
+    AEL_STATUS_ERROR_CLOSE      = 5,
+    AEL_STATUS_ERROR_TIMEOUT    = 6,
+    AEL_STATUS_ERROR_UNKNOWN    = 7,
+    AEL_STATUS_INPUT_DONE       = 8,
+    AEL_STATUS_INPUT_BUFFERING  = 9,
+    AEL_STATUS_OUTPUT_DONE      = 10,
+    AEL_STATUS_OUTPUT_BUFFERING = 11,
+    AEL_STATUS_STATE_RUNNING    = 12,
+    AEL_STATUS_STATE_PAUSED     = 13,
+    AEL_STATUS_STATE_STOPPED    = 14,
+    AEL_STATUS_STATE_FINISHED   = 15,
+    AEL_STATUS_MOUNTED          = 16,
+    AEL_STATUS_UNMOUNTED        = 17,
+} audio_element_status_t;
+
+typedef enum {
+    ESP_CODEC_TYPE_UNKNOW = 0,
+    ESP_CODEC_TYPE_RAW,
+    ESP_CODEC_TYPE_WAV,
+    ESP_CODEC_TYPE_MP3,
+    ESP_CODEC_TYPE_AAC,
+    ESP_CODEC_TYPE_M4A,
+    ESP_CODEC_TYPE_FLAC,
+} esp_codec_type_t;
+
+typedef struct {
+    int sample_rates;
+    int channels;
+    int bits;
+    int bps;
+    int64_t byte_pos;
+    int64_t total_bytes;
+    int duration;
+    char *uri;
+    esp_codec_type_t codec_fmt;
+} audio_element_info_t;
+
+typedef enum {
+    AEL_IO_OK           = ESP_OK,
+    AEL_IO_FAIL         = ESP_FAIL,
+    AEL_IO_DONE         = -2,
+    AEL_IO_ABORT        = -3,
+    AEL_IO_TIMEOUT      = -4,
+    AEL_PROCESS_FAIL    = -5,
+} audio_element_err_t;
+
+typedef struct audio_element *audio_element_handle_t;
+
+typedef esp_err_t (*event_cb_func)(audio_element_handle_t el, audio_event_iface_msg_t *event, void *ctx);
+
+// Returns the bytes taken, or an audio_element_err_t
+typedef audio_element_err_t (*stream_func)(audio_element_handle_t self, char *buffer, int len,
+                                           TickType_t ticks_to_wait, void *context);
+
+typedef esp_err_t (*el_io_func)(audio_element_handle_t self);
+// Returns the bytes produced, or an audio_element_err_t
+typedef audio_element_err_t (*process_func)(audio_element_handle_t self, char *el_buffer, int el_buf_len);
+
+// An element built from callbacks, as in the ADF; the host runs open,
+// process, close and destroy, with read and write as the input and output
+typedef struct {
+    el_io_func open;
+    process_func process;
+    el_io_func close;
+    el_io_func destroy;
+    stream_func read;
+    stream_func write;
+    int buffer_len;
+    int task_stack;
+    int task_prio;
+    int task_core;
+    int out_rb_size;
+    void *data;
+    const char *tag;
+} audio_element_cfg_t;
+
+#define DEFAULT_AUDIO_ELEMENT_CONFIG() {                \
+        .buffer_len = (1024 * 4),                       \
+        .task_stack = (4 * 1024),                       \
+        .task_prio = (5),                               \
+        .task_core = (0),                               \
+    }
+
+audio_element_handle_t audio_element_init(audio_element_cfg_t *config);
+void *audio_element_getdata(audio_element_handle_t el);
+esp_err_t audio_element_setdata(audio_element_handle_t el, void *data);
+audio_element_err_t audio_element_input(audio_element_handle_t el, char *buffer, int wanted_size);
+audio_element_err_t audio_element_output(audio_element_handle_t el, char *buffer, int write_size);
+esp_err_t audio_element_update_byte_pos(audio_element_handle_t el, int pos);
+audio_element_state_t audio_element_get_state(audio_element_handle_t el);
+esp_err_t audio_element_getinfo(audio_element_handle_t el, audio_element_info_t *info);
+esp_err_t audio_element_setinfo(audio_element_handle_t el, audio_element_info_t *info);
+esp_err_t audio_element_set_uri(audio_element_handle_t el, const char *uri);
+char *audio_element_get_uri(audio_element_handle_t el);
+const char *audio_element_get_tag(audio_element_handle_t el);
+esp_err_t audio_element_deinit(audio_element_handle_t el);
+ringbuf_handle_t audio_element_get_input_ringbuf(audio_element_handle_t el);
+ringbuf_handle_t audio_element_get_output_ringbuf(audio_element_handle_t el);
+esp_err_t audio_element_set_input_ringbuf(audio_element_handle_t el, ringbuf_handle_t rb);
+esp_err_t audio_element_set_output_ringbuf(audio_element_handle_t el, ringbuf_handle_t rb);
+esp_err_t audio_element_set_event_callback(audio_element_handle_t el, event_cb_func cb, void *ctx);
+esp_err_t audio_element_set_read_cb(audio_element_handle_t el, stream_func fn, void *context);
+esp_err_t audio_element_set_write_cb(audio_element_handle_t el, stream_func fn, void *context);
+
+#endif // HOST_AUDIO_ELEMENT_H
@@ -0,0 +1,33 @@
+#ifndef HOST_AUDIO_PIPELINE_H
+#define HOST_AUDIO_PIPELINE_H
+
+#include "audio_element.h"
+
+typedef struct audio_pipeline *audio_pipeline_handle_t;
+
+typedef struct {
+    int rb_size;
+} audio_pipeline_cfg_t;
+
+#define DEFAULT_PIPELINE_RINGBUF_SIZE   (8 * 1024)
+
+#define DEFAULT_AUDIO_PIPELINE_CONFIG() {           \
+        .rb_size = DEFAULT_PIPELINE_RINGBUF_SIZE,   \
+    }
+
+audio_pipeline_handle_t audio_pipeline_init(audio_pipeline_cfg_t *config);
+esp_err_t audio_pipeline_deinit(audio_pipeline_handle_t pipeline);
+esp_err_t audio_pipeline_register(audio_pipeline_handle_t pipeline, audio_element_handle_t el, const char *name);
+esp_err_t audio_pipeline_unregister(audio_pipeline_handle_t pipeline, audio_element_handle_t el);
+esp_err_t audio_pipeline_unregister_more(audio_pipeline_handle_t pipeline, audio_element_handle_t element_1, ...);
+esp_err_t audio_pipeline_link(audio_pipeline_handle_t pipeline, const char *link_tag[], int link_num);
+esp_err_t audio_pipeline_run(audio_pipeline_handle_t pipeline);
+esp_err_t audio_pipeline_stop(audio_pipeline_handle_t pipeline);
+esp_err_t audio_pipeline_wait_for_stop(audio_pipeline_handle_t pipeline);
+esp_err_t audio_pipeline_terminate(audio_pipeline_handle_t pipeline);
+esp_err_t audio_pipeline_reset_ringbuffer(audio_pipeline_handle_t pipeline);
+esp_err_t audio_pipeline_reset_elements(audio_pipeline_handle_t pipeline);
+esp_err_t audio_pipeline_set_listener(audio_pipeline_handle_t pipeline, audio_event_iface_handle_t evt);
+esp_err_t audio_pipeline_remove_listener(audio_pipeline_handle_t pipeline);
+
+#endif // HOST_AUDIO_PIPELINE_H
@@ -0,0 +1,43 @@
+// audio_board for the host build: a codec that remembers its volume
+
+#ifndef HOST_BOARD_H
+#define HOST_BOARD_H
+
+#include "esp_err.h"
+#include "esp_peripherals.h"
+#include "periph_sdcard.h"
+
+typedef enum {
+    AUDIO_HAL_CODEC_MODE_ENCODE = 1,
+    AUDIO_HAL_CODEC_MODE_DECODE,
+    AUDIO_HAL_CODEC_MODE_BOTH,
+    AUDIO_HAL_CODEC_MODE_LINE_IN,
+} audio_hal_codec_mode_t;
+
+typedef enum {
+    AUDIO_HAL_CTRL_STOP = 0,
+    AUDIO_HAL_CTRL_START = 1,
+} audio_hal_ctrl_t;
+
+typedef struct audio_hal *audio_hal_handle_t;
+
+struct audio_board_handle {
+    audio_hal_handle_t audio_hal;
+    audio_hal_handle_t adc_hal;
+};
+
+typedef struct audio_board_handle *audio_board_handle_t;
+
+audio_board_handle_t audio_board_init(void);
+esp_err_t audio_board_sdcard_init(esp_periph_set_handle_t set, periph_sdcard_mode_t mode);
+esp_err_t audio_board_key_init(esp_periph_set_handle_t set);
+esp_err_t audio_hal_set_volume(audio_hal_handle_t audio_hal, int volume);
+esp_err_t audio_hal_get_volume(audio_hal_handle_t audio_hal, int *volume);
+esp_err_t audio_hal_ctrl_codec(audio_hal_handle_t audio_hal, audio_hal_codec_mode_t mode, audio_hal_ctrl_t audio_hal_ctrl);
+
+int get_input_play_id(void);
+int get_input_rec_id(void);
+int get_input_volup_id(void);
+int get_input_voldown_id(void);
+
+#endif // HOST_BOARD_H
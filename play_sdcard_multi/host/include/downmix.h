@@ -0,0 +1,83 @@
+// ADF downmix for the host build. Gains and the non-blocking inputs behave
+// as in esp-adf-libs; the transition between gain[0] and gain[1] is not
+// modelled, SWITCH_ON mixes at gain[1].
+
+#ifndef HOST_DOWNMIX_H
+#define HOST_DOWNMIX_H
+
+#include "audio_element.h"
+
+typedef enum {
+    ESP_DOWNMIX_OUTPUT_TYPE_ONE_CHANNEL = 1,
+    ESP_DOWNMIX_OUTPUT_TYPE_TWO_CHANNEL = 2,
+} esp_downmix_output_type_t;
+
+typedef enum {
+    ESP_DOWNMIX_WORK_MODE_BYPASS = 0,
+    ESP_DOWNMIX_WORK_MODE_SWITCH_ON,
+    ESP_DOWNMIX_WORK_MODE_SWITCH_OFF,
+} esp_downmix_work_mode_t;
+
+typedef enum {
+    ESP_DOWNMIX_OUT_CTX_LEFT_RIGHT = 0,
+    ESP_DOWNMIX_OUT_CTX_ONLY_LEFT,
+    ESP_DOWNMIX_OUT_CTX_ONLY_RIGHT,
+    ESP_DOWNMIX_OUT_CTX_NORMAL,
+} esp_downmix_out_ctx_type_t;
+
+typedef struct {
+    int samplerate;
+    int channel;
+    int bits_num;
+    float gain[2];
+    int transit_time;
+} esp_downmix_input_info_t;
+
+typedef struct {
+    esp_downmix_input_info_t *source_info;
+    int source_num;
+    esp_downmix_out_ctx_type_t out_ctx;
+    esp_downmix_work_mode_t mode;
+    esp_downmix_output_type_t output_type;
+} esp_downmix_info_t;
+
+typedef struct {
+    esp_downmix_info_t downmix_info;
+    int max_sample;
+    int out_rb_size;
+    int task_stack;
+    int task_core;
+    int task_prio;
+    bool stack_in_ext;
+} downmix_cfg_t;
+
+#define DM_BUF_SIZE                 (256)
+#define DOWNMIX_TASK_STACK          (8 * 1024)
+#define DOWNMIX_TASK_CORE           (0)
+#define DOWNMIX_TASK_PRIO           (5)
+#define DOWNMIX_RINGBUFFER_SIZE     (8 * 1024)
+
+#define DEFAULT_DOWNMIX_CONFIG() {                                  \
+        .downmix_info = {                                           \
+            .source_info = NULL,                                    \
+            .source_num = 2,                                        \
+            .out_ctx = ESP_DOWNMIX_OUT_CTX_LEFT_RIGHT,              \
+            .mode = ESP_DOWNMIX_WORK_MODE_BYPASS,                   \
+            .output_type = ESP_DOWNMIX_OUTPUT_TYPE_TWO_CHANNEL,     \
+        },                                                          \
+        .max_sample = DM_BUF_SIZE,                                  \
+        .out_rb_size = DOWNMIX_RINGBUFFER_SIZE,                     \
+        .task_stack = DOWNMIX_TASK_STACK,                           \
+        .task_core = DOWNMIX_TASK_CORE,                             \
+        .task_prio = DOWNMIX_TASK_PRIO,                             \
+        .stack_in_ext = true,                                       \
+    }
+
+audio_element_handle_t downmix_init(downmix_cfg_t *config);
+esp_err_t downmix_set_gain_info(audio_element_handle_t self, float *gain, int index);
+esp_err_t downmix_set_work_mode(audio_element_handle_t self, esp_downmix_work_mode_t mode);
+esp_err_t downmix_set_input_rb(audio_element_handle_t self, ringbuf_handle_t rb, int index);
+esp_err_t downmix_set_input_rb_timeout(audio_element_handle_t self, int ticks_to_wait, int index);
+esp_err_t source_info_init(audio_element_handle_t self, esp_downmix_input_info_t *info);
+
+#endif // HOST_DOWNMIX_H
@@ -0,0 +1,7 @@
+#ifndef HOST_EQUALIZER_H
+#define HOST_EQUALIZER_H
+
+// Included by loudframe, nothing in it is used
+#include "audio_element.h"
+
+#endif // HOST_EQUALIZER_H
@@ -0,0 +1,7 @@
+#ifndef HOST_ESP_AUDIO_H
+#define HOST_ESP_AUDIO_H
+
+// Included by loudframe, nothing in it is used
+#include "audio_element.h"
+
+#endif // HOST_ESP_AUDIO_H
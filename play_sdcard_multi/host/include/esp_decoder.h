@@ -0,0 +1,41 @@
+// esp_decoder for the host build. Only WAV is decoded, which is what the
+// cards are loaded with; anything else fails like a corrupt file would.
+
+#ifndef HOST_ESP_DECODER_H
+#define HOST_ESP_DECODER_H
+
+#include "audio_element.h"
+
+typedef struct {
+    esp_codec_type_t decoder_type;
+} audio_decoder_t;
+
+typedef struct {
+    int out_rb_size;
+    int task_stack;
+    int task_core;
+    int task_prio;
+    bool stack_in_ext;
+} esp_decoder_cfg_t;
+
+#define ESP_DECODER_TASK_STACK_SIZE     (4 * 1024)
+#define ESP_DECODER_TASK_CORE           (0)
+#define ESP_DECODER_TASK_PRIO           (5)
+#define ESP_DECODER_RINGBUFFER_SIZE     (8 * 1024)
+
+#define DEFAULT_ESP_DECODER_CONFIG() {                  \
+        .out_rb_size = ESP_DECODER_RINGBUFFER_SIZE,     \
+        .task_stack = ESP_DECODER_TASK_STACK_SIZE,      \
+        .task_core = ESP_DECODER_TASK_CORE,             \
+        .task_prio = ESP_DECODER_TASK_PRIO,             \
+        .stack_in_ext = true,                           \
+    }
+
+#define DEFAULT_ESP_WAV_DECODER_CONFIG()    { .decoder_type = ESP_CODEC_TYPE_WAV }
+#define DEFAULT_ESP_MP3_DECODER_CONFIG()    { .decoder_type = ESP_CODEC_TYPE_MP3 }
+#define DEFAULT_ESP_AAC_DECODER_CONFIG()    { .decoder_type = ESP_CODEC_TYPE_AAC }
+#define DEFAULT_ESP_M4A_DECODER_CONFIG()    { .decoder_type = ESP_CODEC_TYPE_M4A }
+
+audio_element_handle_t esp_decoder_init(esp_decoder_cfg_t *config, audio_decoder_t *decoder_list, int list_size);
+
+#endif // HOST_ESP_DECODER_H
@@ -0,0 +1,39 @@
+// esp_peripherals for the host build: there are no buttons, the set
+// exists so app_main can wire up its listener and then wait forever
+
+#ifndef HOST_ESP_PERIPHERALS_H
+#define HOST_ESP_PERIPHERALS_H
+
+#include "audio_common.h"
+#include "audio_event_iface.h"
+
+typedef enum {
+    PERIPH_ID_BUTTON    = AUDIO_ELEMENT_TYPE_PERIPH + 1,
+    PERIPH_ID_TOUCH     = AUDIO_ELEMENT_TYPE_PERIPH + 2,
+    PERIPH_ID_SDCARD    = AUDIO_ELEMENT_TYPE_PERIPH + 3,
+    PERIPH_ID_WIFI      = AUDIO_ELEMENT_TYPE_PERIPH + 4,
+    PERIPH_ID_ADC_BTN   = AUDIO_ELEMENT_TYPE_PERIPH + 13,
+} esp_periph_id_t;
+
+typedef struct {
+    int task_stack;
+    int task_prio;
+    int task_core;
+    bool extern_stack;
+} esp_periph_config_t;
+
+typedef struct esp_periph_sets *esp_periph_set_handle_t;
+
+#define DEFAULT_ESP_PERIPH_SET_CONFIG() {   \
+        .task_stack = 4096,                 \
+        .task_prio = 5,                     \
+        .task_core = 0,                     \
+        .extern_stack = false,              \
+    }
+
+esp_periph_set_handle_t esp_periph_set_init(esp_periph_config_t *config);
+audio_event_iface_handle_t esp_periph_set_get_event_iface(esp_periph_set_handle_t periph_set_handle);
+esp_err_t esp_periph_set_stop_all(esp_periph_set_handle_t periph_set_handle);
+esp_err_t esp_periph_set_destroy(esp_periph_set_handle_t periph_set_handle);
+
+#endif // HOST_ESP_PERIPHERALS_H
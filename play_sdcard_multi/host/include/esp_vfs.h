@@ -0,0 +1,31 @@
+#ifndef HOST_ESP_VFS_H
+#define HOST_ESP_VFS_H
+
+// The part of esp_vfs_t a read-only file system needs. host_vfs.c sends
+// fopen() and stat() under a registered prefix to these, see host_vfs.c.
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "esp_err.h"
+
+#define ESP_VFS_FLAG_DEFAULT        0
+#define ESP_VFS_PATH_MAX            15
+
+typedef struct {
+    int flags;
+    ssize_t (*write)(int fd, const void *data, size_t size);
+    off_t (*lseek)(int fd, off_t size, int mode);
+    ssize_t (*read)(int fd, void *dst, size_t size);
+    ssize_t (*pread)(int fd, void *dst, size_t size, off_t offset);
+    int (*open)(const char *path, int flags, int mode);
+    int (*close)(int fd);
+    int (*fstat)(int fd, struct stat *st);
+    int (*stat)(const char *path, struct stat *st);
+    int (*unlink)(const char *path);
+} esp_vfs_t;
+
+esp_err_t esp_vfs_register(const char *base_path, const esp_vfs_t *vfs, void *ctx);
+
+#endif // HOST_ESP_VFS_H
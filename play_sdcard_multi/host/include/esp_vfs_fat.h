@@ -0,0 +1,7 @@
+#ifndef HOST_ESP_VFS_FAT_H
+#define HOST_ESP_VFS_FAT_H
+
+// The card is a host directory, see host_vfs.h
+#include "esp_err.h"
+
+#endif // HOST_ESP_VFS_FAT_H
@@ -0,0 +1,36 @@
+#ifndef HOST_FATFS_STREAM_H
+#define HOST_FATFS_STREAM_H
+
+#include "audio_element.h"
+
+typedef struct {
+    audio_stream_type_t type;
+    int buf_sz;
+    int out_rb_size;
+    int task_stack;
+    int task_core;
+    int task_prio;
+    bool ext_stack;
+    bool write_header;
+} fatfs_stream_cfg_t;
+
+#define FATFS_STREAM_BUF_SIZE           (2048)
+#define FATFS_STREAM_TASK_STACK         (3072)
+#define FATFS_STREAM_TASK_CORE          (0)
+#define FATFS_STREAM_TASK_PRIO          (4)
+#define FATFS_STREAM_RINGBUFFER_SIZE    (8 * 1024)
+
+#define FATFS_STREAM_CFG_DEFAULT() {                    \
+        .type = AUDIO_STREAM_NONE,                      \
+        .buf_sz = FATFS_STREAM_BUF_SIZE,                \
+        .out_rb_size = FATFS_STREAM_RINGBUFFER_SIZE,    \
+        .task_stack = FATFS_STREAM_TASK_STACK,          \
+        .task_core = FATFS_STREAM_TASK_CORE,            \
+        .task_prio = FATFS_STREAM_TASK_PRIO,            \
+        .ext_stack = false,                             \
+        .write_header = true,                           \
+    }
+
+audio_element_handle_t fatfs_stream_init(fatfs_stream_cfg_t *config);
+
+#endif // HOST_FATFS_STREAM_H
@@ -0,0 +1,7 @@
+#ifndef HOST_FILTER_RESAMPLE_H
+#define HOST_FILTER_RESAMPLE_H
+
+// Included by loudframe, nothing in it is used
+#include "audio_element.h"
+
+#endif // HOST_FILTER_RESAMPLE_H
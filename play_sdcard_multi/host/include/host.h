@@ -0,0 +1,176 @@
+// Host build of the play_sdcard_multi control plane, see host/README.md
+//
+// What host_main.c and the tools around it can see of the stand-ins: their
+// knobs and their counters. The loudframe sources never include this.
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+/** Microseconds since start, the same clock as esp_timer_get_time() */
+int64_t host_time_us(void);
+/**
+ * @brief Switches to the virtual clock, before any task is created
+ *
+ * Time then stands still while any task runs and jumps to the next timeout
+ * when all of them are blocked. The caller counts as a task.
+ */
+void host_clock_set_virtual(void);
+bool host_clock_is_virtual(void);
+/** Sleeps until host_time_us() reaches deadline_us, on either clock */
+void host_sleep_until(int64_t deadline_us);
+
+// Simulated heaps, sized like the board's after boot
+
+typedef enum {
+    HOST_HEAP_INTERNAL = 0,     // DRAM, also the DMA capable memory
+    HOST_HEAP_SPIRAM,
+    HOST_HEAP_COUNT
+} host_heap_id_t;
+
+typedef struct {
+    size_t total;
+    size_t free;
+    size_t min_free;            // low water mark since start
+    size_t largest;             // largest free block
+    uint32_t blocks;            // live allocations
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t alloc_bytes;       // all bytes ever allocated, for churn
+    uint32_t failed;            // allocations that did not fit
+} host_heap_stats_t;
+
+/** Sets the heap sizes, before anything allocates */
+void host_heap_configure(size_t internal_bytes, size_t spiram_bytes);
+void host_heap_get_stats(host_heap_id_t heap, host_heap_stats_t *stats);
+
+// The SD card is a host directory
+
+typedef struct {
+    uint32_t open_files;
+    uint32_t open_dirs;
+    uint32_t max_open_files;
+    uint64_t opens;
+    uint64_t removes;
+    uint64_t bus_ops;               // with a simulated bus, reads and writes on it
+    uint64_t bus_busy_us;
+    uint64_t bus_wait_us;           // queued behind other accesses
+} host_vfs_stats_t;
+
+/** Serves /sdcard from dir */
+void host_vfs_set_root(const char *dir);
+/** The directory serving /sdcard; without set_root, a new temp one with test tones */
+const char *host_vfs_get_root(void);
+/** Removes the temp directory if get_root made one; a set_root one is left alone */
+void host_vfs_finish(void);
+void host_vfs_get_stats(host_vfs_stats_t *stats);
+/** Card reads and writes share a bus of kbps KB/s, 0 for the host's speed */
+void host_vfs_set_bus_kbps(uint32_t kbps);
+
+// The audio partition is a host file
+
+typedef struct {
+    bool present;
+    uint32_t size;
+    uint64_t maps;
+    uint32_t live_maps;
+    uint64_t mapped_bytes;      // by the live maps
+    uint64_t bytes_written;
+    uint64_t sectors_erased;
+    uint64_t unerased_writes;   // bytes that tried to set bits a NOR write can't
+} host_flash_stats_t;
+
+/** Serves the "audio" partition from path, created erased if it is new */
+bool host_flash_set_image(const char *path);
+void host_flash_get_stats(host_flash_stats_t *stats);
+
+// esp_http_server
+
+typedef struct {
+    uint64_t connections;
+    uint32_t refused;           // over max_open_sockets
+    uint32_t open;
+    uint32_t max_open;
+    uint64_t requests;
+    uint64_t status_4xx;
+    uint64_t status_5xx;
+    uint64_t closed_by_handler; // handler returned an error
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+} host_httpd_stats_t;
+
+/** Port to listen on whatever httpd_config_t asks for, 0 to take it as is */
+void host_httpd_set_port(uint16_t port);
+void host_httpd_get_stats(host_httpd_stats_t *stats);
+
+// ADF
+
+#define HOST_I2S_MAX_EVENTS     64
+
+typedef struct {
+    uint32_t sample_rate;
+    uint64_t frames_played;
+    uint64_t frames_silent;
+    uint32_t underruns;
+    uint32_t n_events;
+    struct {
+        int64_t at_us;
+        uint32_t frames;
+    } events[HOST_I2S_MAX_EVENTS];
+} host_i2s_stats_t;
+
+/** Writes everything the I2S element plays, silence included, as a WAV file */
+void host_adf_set_tap(const char *path);
+void host_adf_get_i2s_stats(host_i2s_stats_t *stats);
+/** Finishes the tap file */
+void host_adf_finish(void);
+void host_adf_report(FILE *out);
+
+// Logging
+
+/** Drops everything above level, whatever the per tag levels say */
+void host_log_set_max_level(esp_log_level_t level);
+
+// Soak driver, see host_soak.c
+
+typedef struct {
+    uint16_t port;              // where the API listens
+    int64_t sample_us;          // how often the heaps and descriptors are sampled
+    const char *report_path;    // JSON written by host_soak_finish, or NULL
+} host_soak_config_t;
+
+typedef struct {
+    double max_leak_kb_per_day; // growth of either heap's use that fails the soak
+    long max_underruns;         // -1 for no limit
+    double real_seconds;        // for the report
+} host_soak_limits_t;
+
+/** Starts the soak task, with the virtual clock already running */
+void host_soak_start(const host_soak_config_t *config);
+/**
+ * @brief Takes a last sample, prints the verdict and writes the report
+ *
+ * @return false if the soak leaked, glitched or had failed requests
+ */
+bool host_soak_finish(FILE *out, const host_soak_limits_t *limits);
+
+// Benchmarks, see host_bench.c
+
+/**
+ * @brief Runs the named benchmark and prints its table
+ *
+ * @return the exit status: 0, or 2 for an unknown name or a setup failure
+ */
+int host_bench_run(const char *name, FILE *out);
+
+/** Prints every counter above */
+void host_report(FILE *out);
+
+#endif // HOST_H
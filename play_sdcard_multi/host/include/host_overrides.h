@@ -0,0 +1,69 @@
+// Force included into every loudframe source in the host build
+//
+// Sends the C library calls that matter on the board through the host
+// stand-ins: allocations are charged to the simulated heaps, paths under
+// /sdcard land in the directory standing in for the card, and a socket
+// read counts as waiting on the virtual clock. The system headers come
+// first so the macros don't touch their declarations.
+
+#ifndef HOST_OVERRIDES_H
+#define HOST_OVERRIDES_H
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void *host_malloc(size_t size);
+void *host_calloc(size_t n, size_t size);
+void *host_realloc(void *ptr, size_t size);
+void host_free(void *ptr);
+char *host_strdup(const char *s);
+
+#define malloc(size)        host_malloc(size)
+#define calloc(n, size)     host_calloc(n, size)
+#define realloc(ptr, size)  host_realloc(ptr, size)
+#define free(ptr)           host_free(ptr)
+#define strdup(s)           host_strdup(s)
+
+FILE *host_fopen(const char *path, const char *mode);
+int host_fclose(FILE *f);
+int host_stat(const char *path, struct stat *st);
+DIR *host_opendir(const char *path);
+int host_closedir(DIR *dir);
+int host_remove(const char *path);
+int host_unlink(const char *path);
+int host_rename(const char *from, const char *to);
+
+#define fopen(path, mode)   host_fopen(path, mode)
+#define fclose(f)           host_fclose(f)
+#define stat(path, st)      host_stat(path, st)
+#define opendir(path)       host_opendir(path)
+#define closedir(dir)       host_closedir(dir)
+#define remove(path)        host_remove(path)
+#define unlink(path)        host_unlink(path)
+#define rename(from, to)    host_rename(from, to)
+
+ssize_t host_recv(int fd, void *buf, size_t len, int flags);
+
+#define recv(fd, buf, len, flags)   host_recv(fd, buf, len, flags)
+
+// newlib has it, glibc only from 2.38
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+static inline size_t host_strlcpy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#define strlcpy(dst, src, size) host_strlcpy(dst, src, size)
+#endif
+
+#endif // HOST_OVERRIDES_H
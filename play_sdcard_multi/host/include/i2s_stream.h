@@ -0,0 +1,41 @@
+#ifndef HOST_I2S_STREAM_H
+#define HOST_I2S_STREAM_H
+
+#include "audio_element.h"
+
+typedef struct {
+    audio_stream_type_t type;
+    int i2s_port;
+    bool use_alc;
+    int volume;
+    int out_rb_size;
+    int task_stack;
+    int task_core;
+    int task_prio;
+    bool stack_in_ext;
+    int buffer_len;
+} i2s_stream_cfg_t;
+
+#define I2S_STREAM_TASK_STACK           (3584)
+#define I2S_STREAM_BUF_SIZE             (2048)
+#define I2S_STREAM_TASK_PRIO            (23)
+#define I2S_STREAM_TASK_CORE            (0)
+#define I2S_STREAM_RINGBUFFER_SIZE      (8 * 1024)
+
+#define I2S_STREAM_CFG_DEFAULT() {                      \
+        .type = AUDIO_STREAM_WRITER,                    \
+        .i2s_port = 0,                                  \
+        .use_alc = false,                               \
+        .volume = 0,                                    \
+        .out_rb_size = I2S_STREAM_RINGBUFFER_SIZE,      \
+        .task_stack = I2S_STREAM_TASK_STACK,            \
+        .task_core = I2S_STREAM_TASK_CORE,              \
+        .task_prio = I2S_STREAM_TASK_PRIO,              \
+        .stack_in_ext = false,                          \
+        .buffer_len = I2S_STREAM_BUF_SIZE,              \
+    }
+
+audio_element_handle_t i2s_stream_init(i2s_stream_cfg_t *config);
+esp_err_t i2s_stream_set_clk(audio_element_handle_t i2s_stream, int rate, int bits, int ch);
+
+#endif // HOST_I2S_STREAM_H
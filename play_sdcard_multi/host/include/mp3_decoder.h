@@ -0,0 +1,7 @@
+#ifndef HOST_MP3_DECODER_H
+#define HOST_MP3_DECODER_H
+
+// Included by loudframe, nothing in it is used
+#include "audio_element.h"
+
+#endif // HOST_MP3_DECODER_H
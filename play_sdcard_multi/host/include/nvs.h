@@ -0,0 +1,6 @@
+#ifndef HOST_NVS_H
+#define HOST_NVS_H
+
+#include "nvs_flash.h"
+
+#endif // HOST_NVS_H
@@ -0,0 +1,12 @@
+#ifndef HOST_PERIPH_ADC_BUTTON_H
+#define HOST_PERIPH_ADC_BUTTON_H
+
+typedef enum {
+    PERIPH_ADC_BUTTON_IDLE = 0,
+    PERIPH_ADC_BUTTON_PRESSED,
+    PERIPH_ADC_BUTTON_RELEASE,
+    PERIPH_ADC_BUTTON_LONG_PRESSED,
+    PERIPH_ADC_BUTTON_LONG_RELEASE,
+} periph_adc_button_event_id_t;
+
+#endif // HOST_PERIPH_ADC_BUTTON_H
@@ -0,0 +1,12 @@
+#ifndef HOST_PERIPH_BUTTON_H
+#define HOST_PERIPH_BUTTON_H
+
+typedef enum {
+    PERIPH_BUTTON_UNCHANGE = 0,
+    PERIPH_BUTTON_PRESSED,
+    PERIPH_BUTTON_RELEASE,
+    PERIPH_BUTTON_LONG_PRESSED,
+    PERIPH_BUTTON_LONG_RELEASE,
+} periph_button_event_id_t;
+
+#endif // HOST_PERIPH_BUTTON_H
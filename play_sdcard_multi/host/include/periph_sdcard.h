@@ -0,0 +1,10 @@
+#ifndef HOST_PERIPH_SDCARD_H
+#define HOST_PERIPH_SDCARD_H
+
+typedef enum {
+    SD_MODE_SPI = 0,
+    SD_MODE_1_LINE = 1,
+    SD_MODE_4_LINE = 4,
+} periph_sdcard_mode_t;
+
+#endif // HOST_PERIPH_SDCARD_H
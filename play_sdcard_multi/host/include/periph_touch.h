@@ -0,0 +1,12 @@
+#ifndef HOST_PERIPH_TOUCH_H
+#define HOST_PERIPH_TOUCH_H
+
+typedef enum {
+    PERIPH_TOUCH_UNCHANGE = 0,
+    PERIPH_TOUCH_TAP,
+    PERIPH_TOUCH_RELEASE,
+    PERIPH_TOUCH_LONG_TAP,
+    PERIPH_TOUCH_LONG_RELEASE,
+} periph_touch_event_id_t;
+
+#endif // HOST_PERIPH_TOUCH_H
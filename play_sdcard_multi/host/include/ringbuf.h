@@ -0,0 +1,29 @@
+// ADF ring buffer for the host build, see host_adf.c
+
+#ifndef HOST_RINGBUF_H
+#define HOST_RINGBUF_H
+
+#include "freertos/FreeRTOS.h"
+
+#define RB_OK           (ESP_OK)
+#define RB_FAIL         (ESP_FAIL)
+#define RB_DONE         (-2)
+#define RB_ABORT        (-3)
+#define RB_TIMEOUT      (-4)
+
+typedef struct ringbuf *ringbuf_handle_t;
+
+ringbuf_handle_t rb_create(int block_size, int n_blocks);
+esp_err_t rb_destroy(ringbuf_handle_t rb);
+esp_err_t rb_abort(ringbuf_handle_t rb);
+esp_err_t rb_reset(ringbuf_handle_t rb);
+esp_err_t rb_reset_is_done_write(ringbuf_handle_t rb);
+int rb_bytes_available(ringbuf_handle_t rb);
+int rb_bytes_filled(ringbuf_handle_t rb);
+int rb_get_size(ringbuf_handle_t rb);
+int rb_read(ringbuf_handle_t rb, char *buf, int len, TickType_t ticks_to_wait);
+int rb_write(ringbuf_handle_t rb, char *buf, int len, TickType_t ticks_to_wait);
+esp_err_t rb_done_write(ringbuf_handle_t rb);
+esp_err_t rb_unblock_reader(ringbuf_handle_t rb);
+
+#endif // HOST_RINGBUF_H
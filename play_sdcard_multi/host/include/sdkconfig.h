@@ -0,0 +1,16 @@
+// The handful of sdkconfig values the control plane reads, as set by
+// sdkconfig.defaults
+
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+
+#define CONFIG_FREERTOS_HZ                          250
+#define CONFIG_FREERTOS_NUMBER_OF_CORES             2
+#define CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS     1
+#define CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID    1
+#define CONFIG_SPIRAM                               1
+#define CONFIG_SPIRAM_MALLOC_ALWAYSINTERNAL         8192
+#define CONFIG_LOG_DEFAULT_LEVEL                    3
+#define CONFIG_LOG_MAXIMUM_LEVEL                    5
+
+#endif // HOST_SDKCONFIG_H
@@ -0,0 +1,24 @@
+#ifndef HOST_WAV_DECODER_H
+#define HOST_WAV_DECODER_H
+
+#include "audio_element.h"
+
+typedef struct {
+    int out_rb_size;
+    int task_stack;
+    int task_core;
+    int task_prio;
+    bool stack_in_ext;
+} wav_decoder_cfg_t;
+
+#define DEFAULT_WAV_DECODER_CONFIG() {                  \
+        .out_rb_size = 8 * 1024,                        \
+        .task_stack = 4 * 1024,                         \
+        .task_core = 0,                                 \
+        .task_prio = 5,                                 \
+        .stack_in_ext = true,                           \
+    }
+
+audio_element_handle_t wav_decoder_init(wav_decoder_cfg_t *config);
+
+#endif // HOST_WAV_DECODER_H
@@ -0,0 +1,1964 @@
+// ESP-ADF on the host: ring buffers, event interfaces, pipelines and the
+// elements play_sdcard_multi builds (decoder, raw writer, downmix, I2S
+// writer, the fatfs reader, and elements from audio_element_init() such as
+// track_reader.c)
+//
+// The control flow follows esp-adf closely, since that is what the
+// control task and the HTTP handlers race against:
+//
+// - audio_pipeline_link() creates a ring buffer between neighbours only,
+//   so the last element of a track has no output buffer.
+// - Each element with a task gets it on the first run and loses it on
+//   terminate. raw_stream has no task and is RUNNING as soon as it runs.
+// - An element that hits the end of its input marks its output done and
+//   reports AEL_STATUS_STATE_FINISHED; reader and decoder both do, so a
+//   track finishing reports twice.
+// - Stopping an element aborts its buffers, including a decoder output
+//   shared with downmix, which then reads nothing from it.
+// - A write callback replaces the output buffer, so the pipeline no longer
+//   resets or aborts it. Only the decoder calls one.
+// - Status reports go to a 5 deep queue without waiting; if the listener
+//   is slow they are dropped, and counted here.
+//
+// fatfs_stream opens what follows "/sdcard" in its URI, as the ADF's does,
+// so a URI meant for another VFS reads the card directly or fails here too.
+//
+// Decoding is WAV only. Downmix mixes at gain[1] without the transition.
+// The I2S writer plays in real time through the same 6 x 240 frame DMA
+// model as the player32 simulator, and counts underruns the same way.
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_element.h"
+#include "audio_event_iface.h"
+#include "audio_pipeline.h"
+#include "downmix.h"
+#include "esp_decoder.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "fatfs_stream.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "i2s_stream.h"
+#include "raw_stream.h"
+#include "ringbuf.h"
+#include "wav_decoder.h"
+#include "host.h"
+#include "host_internal.h"
+
+static const char *TAG = "HOST_ADF";
+
+FILE *host_fopen(const char *path, const char *mode);
+int host_fclose(FILE *f);
+
+// audio_malloc: PSRAM when there is any
+static void *adf_calloc(size_t n, size_t size) {
+    void *p = heap_caps_calloc(n, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return p ? p : heap_caps_calloc(n, size, MALLOC_CAP_DEFAULT);
+}
+
+// Instrumentation
+
+typedef enum {
+    API_PIPELINE_RUN = 0,
+    API_PIPELINE_STOP,
+    API_PIPELINE_WAIT_FOR_STOP,
+    API_PIPELINE_TERMINATE,
+    API_PIPELINE_RESET,
+    API_ELEMENT_SET_URI,
+    API_DOWNMIX_SET_GAIN,
+    API_RB_READ_WAIT,
+    API_RB_WRITE_WAIT,
+    API_COUNT
+} api_id_t;
+
+static const char *s_api_names[API_COUNT] = {
+    "pipeline_run", "pipeline_stop", "pipeline_wait_for_stop", "pipeline_terminate",
+    "pipeline_reset", "element_set_uri", "downmix_set_gain", "rb_read (blocked)", "rb_write (blocked)",
+};
+
+typedef struct {
+    uint64_t calls;
+    uint64_t total_us;
+    uint64_t max_us;
+} api_stat_t;
+
+static pthread_mutex_t s_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static api_stat_t s_api[API_COUNT];
+static uint64_t s_events_sent = 0;
+static uint64_t s_events_dropped = 0;
+static uint64_t s_rb_aborts = 0;
+static uint64_t s_rb_timeouts = 0;
+static uint64_t s_downmix_short_reads = 0;
+
+static void api_done(api_id_t api, int64_t start_us) {
+    uint64_t us = host_time_us() - start_us;
+    pthread_mutex_lock(&s_stats_lock);
+    s_api[api].calls++;
+    s_api[api].total_us += us;
+    if (us > s_api[api].max_us) {
+        s_api[api].max_us = us;
+    }
+    pthread_mutex_unlock(&s_stats_lock);
+}
+
+static void count(uint64_t *counter) {
+    pthread_mutex_lock(&s_stats_lock);
+    (*counter)++;
+    pthread_mutex_unlock(&s_stats_lock);
+}
+
+// Ring buffers
+
+struct ringbuf {
+    pthread_mutex_t lock;
+    pthread_cond_t can_read;
+    pthread_cond_t can_write;
+    char *buf;
+    int size;
+    int read_pos;
+    int fill;
+    bool abort_read;
+    bool abort_write;
+    bool done_write;
+    bool unblock_reader;
+};
+
+ringbuf_handle_t rb_create(int block_size, int n_blocks) {
+    if (block_size < 2 || n_blocks < 1) {
+        return NULL;
+    }
+    struct ringbuf *rb = adf_calloc(1, sizeof(*rb));
+    if (rb == NULL) {
+        return NULL;
+    }
+    rb->size = block_size * n_blocks;
+    rb->buf = adf_calloc(1, rb->size);
+    if (rb->buf == NULL) {
+        heap_caps_free(rb);
+        return NULL;
+    }
+    pthread_mutex_init(&rb->lock, NULL);
+    host_cond_init(&rb->can_read);
+    host_cond_init(&rb->can_write);
+    return rb;
+}
+
+esp_err_t rb_destroy(ringbuf_handle_t rb) {
+    if (rb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_cond_destroy(&rb->can_read);
+    pthread_cond_destroy(&rb->can_write);
+    pthread_mutex_destroy(&rb->lock);
+    heap_caps_free(rb->buf);
+    heap_caps_free(rb);
+    return ESP_OK;
+}
+
+esp_err_t rb_abort(ringbuf_handle_t rb) {
+    if (rb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&rb->lock);
+    rb->abort_read = true;
+    rb->abort_write = true;
+    host_cond_broadcast(&rb->can_read);
+    host_cond_broadcast(&rb->can_write);
+    pthread_mutex_unlock(&rb->lock);
+    return ESP_OK;
+}
+
+esp_err_t rb_reset(ringbuf_handle_t rb) {
+    if (rb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&rb->lock);
+    rb->read_pos = 0;
+    rb->fill = 0;
+    rb->abort_read = false;
+    rb->abort_write = false;
+    rb->done_write = false;
+    rb->unblock_reader = false;
+    host_cond_broadcast(&rb->can_write);
+    pthread_mutex_unlock(&rb->lock);
+    return ESP_OK;
+}
+
+esp_err_t rb_reset_is_done_write(ringbuf_handle_t rb) {
+    if (rb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&rb->lock);
+    rb->done_write = false;
+    pthread_mutex_unlock(&rb->lock);
+    return ESP_OK;
+}
+
+int rb_bytes_available(ringbuf_handle_t rb) {
+    if (rb == NULL) {
+        return ESP_FAIL;
+    }
+    pthread_mutex_lock(&rb->lock);
+    int n = rb->size - rb->fill;
+    pthread_mutex_unlock(&rb->lock);
+    return n;
+}
+
+int rb_bytes_filled(ringbuf_handle_t rb) {
+    if (rb == NULL) {
+        return ESP_FAIL;
+    }
+    pthread_mutex_lock(&rb->lock);
+    int n = rb->fill;
+    pthread_mutex_unlock(&rb->lock);
+    return n;
+}
+
+int rb_get_size(ringbuf_handle_t rb) {
+    return rb ? rb->size : ESP_FAIL;
+}
+
+// Same results as the ADF: whatever was moved, or when nothing was, why not
+int rb_read(ringbuf_handle_t rb, char *buf, int len, TickType_t ticks_to_wait) {
+    if (rb == NULL) {
+        return RB_FAIL;
+    }
+    int64_t deadline = host_deadline(ticks_to_wait);
+    int64_t waited_from = 0;
+    int done = 0;
+    int ret = RB_OK;
+    pthread_mutex_lock(&rb->lock);
+    while (done < len) {
+        if (rb->fill > 0) {
+            int n = len - done < rb->fill ? len - done : rb->fill;
+            int first = rb->size - rb->read_pos < n ? rb->size - rb->read_pos : n;
+            memcpy(buf + done, rb->buf + rb->read_pos, first);
+            memcpy(buf + done + first, rb->buf, n - first);
+            rb->read_pos = (rb->read_pos + n) % rb->size;
+            rb->fill -= n;
+            done += n;
+            host_cond_broadcast(&rb->can_write);
+            continue;
+        }
+        if (rb->done_write) {
+            ret = RB_DONE;
+            break;
+        }
+        if (rb->abort_read) {
+            ret = RB_ABORT;
+            break;
+        }
+        if (rb->unblock_reader) {
+            rb->unblock_reader = false;
+            break;
+        }
+        if (ticks_to_wait == 0) {
+            ret = RB_TIMEOUT;
+            break;
+        }
+        if (waited_from == 0) {
+            waited_from = host_time_us();
+        }
+        if (!host_cond_wait(&rb->can_read, &rb->lock, deadline) && rb->fill == 0) {
+            ret = RB_TIMEOUT;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&rb->lock);
+    if (waited_from) {
+        api_done(API_RB_READ_WAIT, waited_from);
+    }
+    if (done == 0) {
+        if (ret == RB_ABORT) {
+            count(&s_rb_aborts);
+        } else if (ret == RB_TIMEOUT && ticks_to_wait != 0) {
+            count(&s_rb_timeouts);
+        }
+    }
+    return done > 0 ? done : ret;
+}
+
+int rb_write(ringbuf_handle_t rb, char *buf, int len, TickType_t ticks_to_wait) {
+    if (rb == NULL) {
+        return RB_FAIL;
+    }
+    int64_t deadline = host_deadline(ticks_to_wait);
+    int64_t waited_from = 0;
+    int done = 0;
+    int ret = RB_OK;
+    pthread_mutex_lock(&rb->lock);
+    while (done < len) {
+        if (rb->abort_write) {
+            ret = RB_ABORT;
+            break;
+        }
+        if (rb->done_write) {
+            ret = RB_DONE;
+            break;
+        }
+        int space = rb->size - rb->fill;
+        if (space > 0) {
+            int n = len - done < space ? len - done : space;
+            int write_pos = (rb->read_pos + rb->fill) % rb->size;
+            int first = rb->size - write_pos < n ? rb->size - write_pos : n;
+            memcpy(rb->buf + write_pos, buf + done, first);
+            memcpy(rb->buf, buf + done + first, n - first);
+            rb->fill += n;
+            done += n;
+            host_cond_broadcast(&rb->can_read);
+            continue;
+        }
+        if (ticks_to_wait == 0) {
+            ret = RB_TIMEOUT;
+            break;
+        }
+        if (waited_from == 0) {
+            waited_from = host_time_us();
+        }
+        if (!host_cond_wait(&rb->can_write, &rb->lock, deadline) && rb->fill == rb->size) {
+            ret = RB_TIMEOUT;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&rb->lock);
+    if (waited_from) {
+        api_done(API_RB_WRITE_WAIT, waited_from);
+    }
+    if (done == 0 && ret == RB_ABORT) {
+        count(&s_rb_aborts);
+    }
+    return done > 0 ? done : ret;
+}
+
+esp_err_t rb_done_write(ringbuf_handle_t rb) {
+    if (rb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&rb->lock);
+    rb->done_write = true;
+    host_cond_broadcast(&rb->can_read);
+    pthread_mutex_unlock(&rb->lock);
+    return ESP_OK;
+}
+
+esp_err_t rb_unblock_reader(ringbuf_handle_t rb) {
+    if (rb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&rb->lock);
+    rb->unblock_reader = true;
+    host_cond_broadcast(&rb->can_read);
+    pthread_mutex_unlock(&rb->lock);
+    return ESP_OK;
+}
+
+// Event interfaces
+//
+// An interface posts to its own queue; a listener reads the queues of every
+// interface that has it as listener, like the ADF's queue sets.
+
+#define MAX_EVENT_SOURCES   16
+
+struct audio_event_iface {
+    QueueHandle_t internal;
+    QueueHandle_t external;
+    audio_event_iface_handle_t listener;
+    pthread_mutex_t lock;
+    pthread_cond_t posted;
+    audio_event_iface_handle_t sources[MAX_EVENT_SOURCES];
+    int n_sources;
+    int next_source;
+};
+
+audio_event_iface_handle_t audio_event_iface_init(audio_event_iface_cfg_t *config) {
+    struct audio_event_iface *evt = adf_calloc(1, sizeof(*evt));
+    if (evt == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&evt->lock, NULL);
+    host_cond_init(&evt->posted);
+    if (config->internal_queue_size) {
+        evt->internal = xQueueCreate(config->internal_queue_size, sizeof(audio_event_iface_msg_t));
+    }
+    if (config->external_queue_size) {
+        evt->external = xQueueCreate(config->external_queue_size, sizeof(audio_event_iface_msg_t));
+    }
+    return evt;
+}
+
+esp_err_t audio_event_iface_set_listener(audio_event_iface_handle_t evt, audio_event_iface_handle_t listener) {
+    if (evt == NULL || listener == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&listener->lock);
+    bool known = false;
+    for (int i = 0; i < listener->n_sources; i++) {
+        known |= listener->sources[i] == evt;
+    }
+    if (!known && listener->n_sources < MAX_EVENT_SOURCES) {
+        listener->sources[listener->n_sources++] = evt;
+    }
+    pthread_mutex_unlock(&listener->lock);
+    pthread_mutex_lock(&evt->lock);
+    evt->listener = listener;
+    pthread_mutex_unlock(&evt->lock);
+    return ESP_OK;
+}
+
+esp_err_t audio_event_iface_remove_listener(audio_event_iface_handle_t listen, audio_event_iface_handle_t evt) {
+    if (evt == NULL || listen == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&listen->lock);
+    for (int i = 0; i < listen->n_sources; i++) {
+        if (listen->sources[i] == evt) {
+            listen->sources[i] = listen->sources[--listen->n_sources];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&listen->lock);
+    pthread_mutex_lock(&evt->lock);
+    if (evt->listener == listen) {
+        evt->listener = NULL;
+    }
+    pthread_mutex_unlock(&evt->lock);
+    return ESP_OK;
+}
+
+esp_err_t audio_event_iface_destroy(audio_event_iface_handle_t evt) {
+    if (evt == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (evt->listener) {
+        audio_event_iface_remove_listener(evt->listener, evt);
+    }
+    if (evt->internal) {
+        vQueueDelete(evt->internal);
+    }
+    if (evt->external) {
+        vQueueDelete(evt->external);
+    }
+    pthread_cond_destroy(&evt->posted);
+    pthread_mutex_destroy(&evt->lock);
+    heap_caps_free(evt);
+    return ESP_OK;
+}
+
+esp_err_t audio_event_iface_sendout(audio_event_iface_handle_t evt, audio_event_iface_msg_t *msg) {
+    if (evt == NULL || evt->external == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&evt->lock);
+    audio_event_iface_handle_t listener = evt->listener;
+    pthread_mutex_unlock(&evt->lock);
+    if (xQueueSend(evt->external, msg, 0) != pdPASS) {
+        // Nobody listening is fine; a listener too slow to keep up is not
+        if (listener) {
+            count(&s_events_dropped);
+        }
+        return ESP_FAIL;
+    }
+    count(&s_events_sent);
+    if (listener) {
+        pthread_mutex_lock(&listener->lock);
+        host_cond_broadcast(&listener->posted);
+        pthread_mutex_unlock(&listener->lock);
+    }
+    return ESP_OK;
+}
+
+esp_err_t audio_event_iface_listen(audio_event_iface_handle_t evt, audio_event_iface_msg_t *msg, TickType_t wait_time) {
+    if (evt == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int64_t deadline = host_deadline(wait_time);
+    esp_err_t err = ESP_FAIL;
+    bool last_look = wait_time == 0;
+    pthread_mutex_lock(&evt->lock);
+    for (;;) {
+        if (evt->internal && xQueueReceive(evt->internal, msg, 0) == pdPASS) {
+            err = ESP_OK;
+            break;
+        }
+        // Round robin, so one chatty element can't hide the others
+        bool got = false;
+        for (int i = 0; i < evt->n_sources && !got; i++) {
+            audio_event_iface_handle_t src = evt->sources[(evt->next_source + i) % evt->n_sources];
+            if (src->external && xQueueReceive(src->external, msg, 0) == pdPASS) {
+                evt->next_source = (evt->next_source + i + 1) % evt->n_sources;
+                got = true;
+            }
+        }
+        if (got) {
+            err = ESP_OK;
+            break;
+        }
+        if (last_look) {
+            break;
+        }
+        // One more look after a timeout, then give up
+        last_look = !host_cond_wait(&evt->posted, &evt->lock, deadline);
+    }
+    pthread_mutex_unlock(&evt->lock);
+    return err;
+}
+
+// Elements
+
+typedef enum {
+    EL_FATFS,
+    EL_DECODER,
+    EL_RAW,
+    EL_DOWNMIX,
+    EL_I2S,
+    EL_CUSTOM,
+} el_kind_t;
+
+typedef enum {
+    CMD_NONE = 0,
+    CMD_RESUME,
+    CMD_STOP,
+    CMD_DESTROY,
+} el_cmd_t;
+
+typedef enum {
+    PROC_OK,
+    PROC_DONE,
+    PROC_ABORT,
+    PROC_ERROR,
+} proc_result_t;
+
+#define DOWNMIX_MAX_SOURCES     8
+#define DECODER_CHUNK           2048
+
+struct audio_element {
+    el_kind_t kind;
+    char tag[configMAX_TASK_NAME_LEN];
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    audio_element_state_t state;
+    audio_element_info_t info;
+    char *uri;
+    ringbuf_handle_t in;
+    ringbuf_handle_t out;
+    stream_func read_cb;        // replaces in, as in the ADF
+    void *read_ctx;
+    stream_func write_cb;       // replaces out, as in the ADF
+    void *write_ctx;
+    int out_rb_size;
+    int task_stack;
+    int task_core;
+    int task_prio;
+    bool task_alive;
+    el_cmd_t cmd;
+    bool stopped;               // the ADF's STOPPED_BIT
+    audio_event_iface_handle_t iface;
+    event_cb_func cb;
+    void *cb_ctx;
+
+    char *buf;
+    int buf_sz;
+    FILE *file;                 // fatfs
+    audio_element_cfg_t fn;     // custom: the callbacks and data
+    bool header_done;           // decoder
+    bool wav_only;              // decoder
+    esp_downmix_work_mode_t dm_mode;
+    int dm_sources;
+    int dm_max_sample;
+    ringbuf_handle_t dm_in[DOWNMIX_MAX_SOURCES];
+    int dm_timeout[DOWNMIX_MAX_SOURCES];
+    esp_downmix_input_info_t dm_info[DOWNMIX_MAX_SOURCES];
+};
+
+static audio_element_handle_t element_create(el_kind_t kind, const char *tag, int out_rb_size, int task_stack,
+                                             int task_core, int task_prio, int buf_sz) {
+    struct audio_element *el = adf_calloc(1, sizeof(*el));
+    if (el == NULL) {
+        return NULL;
+    }
+    el->kind = kind;
+    snprintf(el->tag, sizeof(el->tag), "%s", tag);
+    pthread_mutex_init(&el->lock, NULL);
+    host_cond_init(&el->changed);
+    el->state = AEL_STATE_INIT;
+    el->out_rb_size = out_rb_size;
+    el->task_stack = task_stack;
+    el->task_core = task_core;
+    el->task_prio = task_prio;
+    el->stopped = true;
+    audio_event_iface_cfg_t evt_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
+    el->iface = audio_event_iface_init(&evt_cfg);
+    el->info.sample_rates = 44100;
+    el->info.channels = 2;
+    el->info.bits = 16;
+    if (buf_sz > 0) {
+        el->buf_sz = buf_sz;
+        el->buf = adf_calloc(1, buf_sz);
+    }
+    if (el->iface == NULL || (buf_sz > 0 && el->buf == NULL)) {
+        audio_element_deinit(el);
+        return NULL;
+    }
+    return el;
+}
+
+static void report(audio_element_handle_t el, int cmd, int data) {
+    audio_event_iface_msg_t msg = {
+        .cmd = cmd,
+        .data = (void *)(intptr_t)data,
+        .source = el,
+        .source_type = AUDIO_ELEMENT_TYPE_ELEMENT,
+    };
+    if (el->cb) {
+        el->cb(el, &msg, el->cb_ctx);
+    } else {
+        audio_event_iface_sendout(el->iface, &msg);
+    }
+}
+
+static void set_state(audio_element_handle_t el, audio_element_state_t state, bool stopped) {
+    pthread_mutex_lock(&el->lock);
+    el->state = state;
+    if (stopped) {
+        el->stopped = true;
+        host_cond_broadcast(&el->changed);
+    }
+    pthread_mutex_unlock(&el->lock);
+}
+
+static el_cmd_t take_cmd(audio_element_handle_t el, bool wait) {
+    pthread_mutex_lock(&el->lock);
+    while (wait && el->cmd == CMD_NONE) {
+        host_cond_wait(&el->changed, &el->lock, -1);
+    }
+    el_cmd_t cmd = el->cmd;
+    el->cmd = CMD_NONE;
+    pthread_mutex_unlock(&el->lock);
+    return cmd;
+}
+
+static void send_cmd(audio_element_handle_t el, el_cmd_t cmd) {
+    pthread_mutex_lock(&el->lock);
+    el->cmd = cmd;
+    host_cond_broadcast(&el->changed);
+    pthread_mutex_unlock(&el->lock);
+}
+
+static void abort_ringbufs(audio_element_handle_t el) {
+    rb_abort(el->in);
+    rb_abort(el->out);
+    for (int i = 0; i < el->dm_sources; i++) {
+        rb_abort(el->dm_in[i]);
+    }
+}
+
+// fatfs_stream reader
+
+static proc_result_t fatfs_open(audio_element_handle_t el) {
+    pthread_mutex_lock(&el->lock);
+    char *uri = el->uri ? strdup(el->uri) : NULL;
+    pthread_mutex_unlock(&el->lock);
+    if (uri == NULL) {
+        ESP_LOGE(TAG, "[%s] no uri set", el->tag);
+        return PROC_ERROR;
+    }
+    // The ADF opens from "/sdcard" on, whatever comes before it
+    char *path = strstr(uri, "/sdcard");
+    if (path == NULL) {
+        ESP_LOGE(TAG, "[%s] Error, need file path to open: %s", el->tag, uri);
+        free(uri);
+        return PROC_ERROR;
+    }
+    el->file = host_fopen(path, "rb");
+    free(uri);
+    if (el->file == NULL) {
+        return PROC_ERROR;
+    }
+    fseek(el->file, 0, SEEK_END);
+    int64_t total = ftell(el->file);
+    pthread_mutex_lock(&el->lock);
+    el->info.total_bytes = total;
+    if (el->info.byte_pos > 0 && el->info.byte_pos < total) {
+        fseek(el->file, el->info.byte_pos, SEEK_SET);
+    } else {
+        fseek(el->file, 0, SEEK_SET);
+        el->info.byte_pos = 0;
+    }
+    pthread_mutex_unlock(&el->lock);
+    return PROC_OK;
+}
+
+static proc_result_t fatfs_process(audio_element_handle_t el) {
+    size_t n = fread(el->buf, 1, el->buf_sz, el->file);
+    if (n == 0) {
+        return ferror(el->file) ? PROC_ERROR : PROC_DONE;
+    }
+    int w = rb_write(el->out, el->buf, (int)n, portMAX_DELAY);
+    if (w == RB_ABORT) {
+        return PROC_ABORT;
+    }
+    if (w < 0) {
+        return w == RB_DONE ? PROC_DONE : PROC_ERROR;
+    }
+    pthread_mutex_lock(&el->lock);
+    el->info.byte_pos += w;
+    pthread_mutex_unlock(&el->lock);
+    return PROC_OK;
+}
+
+static void fatfs_close(audio_element_handle_t el) {
+    if (el->file) {
+        host_fclose(el->file);
+        el->file = NULL;
+    }
+    // Like the ADF: the position only survives a pause
+    pthread_mutex_lock(&el->lock);
+    if (el->state != AEL_STATE_PAUSED) {
+        el->info.byte_pos = 0;
+    }
+    pthread_mutex_unlock(&el->lock);
+}
+
+// Elements from audio_element_init()
+
+static proc_result_t custom_open(audio_element_handle_t el) {
+    if (el->fn.open && el->fn.open(el) != ESP_OK) {
+        return PROC_ERROR;
+    }
+    return PROC_OK;
+}
+
+static proc_result_t custom_process(audio_element_handle_t el) {
+    int r = el->fn.process(el, el->buf, el->buf_sz);
+    if (r > 0) {
+        return PROC_OK;
+    }
+    // As the ADF's element task takes the process result
+    switch (r) {
+        case AEL_IO_OK:
+        case AEL_IO_DONE:       return PROC_DONE;
+        case AEL_IO_ABORT:      return PROC_ABORT;
+        case AEL_IO_TIMEOUT:    return PROC_OK;
+        default:                return PROC_ERROR;
+    }
+}
+
+static void custom_close(audio_element_handle_t el) {
+    if (el->fn.close) {
+        el->fn.close(el);
+    }
+}
+
+// Decoder, WAV only
+
+static int read_exact(audio_element_handle_t el, char *buf, int len) {
+    int done = 0;
+    while (done < len) {
+        int n = rb_read(el->in, buf + done, len - done, portMAX_DELAY);
+        if (n <= 0) {
+            return n == 0 ? RB_FAIL : n;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static uint32_t get_le(const uint8_t *p, int bytes) {
+    uint32_t v = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static proc_result_t rb_result(int r) {
+    if (r == RB_ABORT) {
+        return PROC_ABORT;
+    }
+    return r == RB_DONE ? PROC_DONE : PROC_ERROR;
+}
+
+static proc_result_t decoder_parse_header(audio_element_handle_t el) {
+    uint8_t h[16];
+    int r = read_exact(el, (char *)h, 12);
+    if (r < 0) {
+        return rb_result(r);
+    }
+    if (memcmp(h, "RIFF", 4) != 0 || memcmp(h + 8, "WAVE", 4) != 0) {
+        ESP_LOGE(TAG, "[%s] not a WAV file, the host build only decodes WAV", el->tag);
+        return PROC_ERROR;
+    }
+    for (;;) {
+        if ((r = read_exact(el, (char *)h, 8)) < 0) {
+            return rb_result(r);
+        }
+        uint32_t size = get_le(h + 4, 4);
+        if (memcmp(h, "data", 4) == 0) {
+            break;
+        }
+        uint32_t skip = size + (size & 1);
+        if (memcmp(h, "fmt ", 4) == 0 && size >= 16) {
+            if ((r = read_exact(el, (char *)h, 16)) < 0) {
+                return rb_result(r);
+            }
+            pthread_mutex_lock(&el->lock);
+            el->info.channels = get_le(h + 2, 2);
+            el->info.sample_rates = get_le(h + 4, 4);
+            el->info.bits = get_le(h + 14, 2);
+            el->info.codec_fmt = ESP_CODEC_TYPE_WAV;
+            pthread_mutex_unlock(&el->lock);
+            skip -= 16;
+        }
+        while (skip > 0) {
+            int n = skip < (uint32_t)el->buf_sz ? (int)skip : el->buf_sz;
+            if ((r = read_exact(el, el->buf, n)) < 0) {
+                return rb_result(r);
+            }
+            skip -= n;
+        }
+    }
+    report(el, AEL_MSG_CMD_REPORT_MUSIC_INFO, 0);
+    return PROC_OK;
+}
+
+static proc_result_t decoder_open(audio_element_handle_t el) {
+    el->header_done = false;
+    return PROC_OK;
+}
+
+static proc_result_t decoder_process(audio_element_handle_t el) {
+    if (!el->header_done) {
+        proc_result_t r = decoder_parse_header(el);
+        if (r != PROC_OK) {
+            return r;
+        }
+        el->header_done = true;
+    }
+    int n = rb_read(el->in, el->buf, el->buf_sz, portMAX_DELAY);
+    if (n <= 0) {
+        return n == 0 ? PROC_OK : rb_result(n);
+    }
+    int w = el->write_cb ? el->write_cb(el, el->buf, n, portMAX_DELAY, el->write_ctx)
+                         : rb_write(el->out, el->buf, n, portMAX_DELAY);
+    return w < 0 ? rb_result(w) : PROC_OK;
+}
+
+// Downmix
+
+static proc_result_t downmix_process(audio_element_handle_t el) {
+    int frames = el->dm_max_sample;
+    int32_t *acc = (int32_t *)el->buf;
+    int16_t *in = (int16_t *)(el->buf + frames * 2 * sizeof(int32_t));
+    memset(acc, 0, frames * 2 * sizeof(int32_t));
+
+    pthread_mutex_lock(&el->lock);
+    int sources = el->dm_sources;
+    esp_downmix_work_mode_t mode = el->dm_mode;
+    ringbuf_handle_t rbs[DOWNMIX_MAX_SOURCES];
+    int timeouts[DOWNMIX_MAX_SOURCES];
+    int channels[DOWNMIX_MAX_SOURCES];
+    float gains[DOWNMIX_MAX_SOURCES];
+    for (int i = 0; i < sources; i++) {
+        rbs[i] = el->dm_in[i];
+        timeouts[i] = el->dm_timeout[i];
+        channels[i] = el->dm_info[i].channel == 1 ? 1 : 2;
+        float db = mode == ESP_DOWNMIX_WORK_MODE_SWITCH_OFF ? el->dm_info[i].gain[0] : el->dm_info[i].gain[1];
+        gains[i] = powf(10.0f, db / 20.0f);
+    }
+    pthread_mutex_unlock(&el->lock);
+    if (mode == ESP_DOWNMIX_WORK_MODE_BYPASS) {
+        // Bypass passes the first input through
+        sources = sources > 0 ? 1 : 0;
+        gains[0] = 1.0f;
+    }
+
+    for (int i = 0; i < sources; i++) {
+        int want = frames * channels[i] * 2;
+        int got = rbs[i] ? rb_read(rbs[i], (char *)in, want, timeouts[i]) : 0;
+        if (got < 0) {
+            got = 0;
+        }
+        if (got < want) {
+            // Short inputs are mixed as silence, nothing waits for them
+            memset((char *)in + got, 0, want - got);
+            if (rbs[i] && got > 0) {
+                count(&s_downmix_short_reads);
+            }
+        }
+        for (int f = 0; f < frames; f++) {
+            int16_t l = in[f * channels[i]];
+            int16_t r = channels[i] == 2 ? in[f * 2 + 1] : l;
+            acc[f * 2] += (int32_t)lrintf(l * gains[i]);
+            acc[f * 2 + 1] += (int32_t)lrintf(r * gains[i]);
+        }
+    }
+    int16_t *out = in;
+    for (int s = 0; s < frames * 2; s++) {
+        int32_t v = acc[s];
+        out[s] = v > 32767 ? 32767 : v < -32768 ? -32768 : (int16_t)v;
+    }
+    int w = rb_write(el->out, (char *)out, frames * 4, portMAX_DELAY);
+    return w < 0 ? rb_result(w) : PROC_OK;
+}
+
+// I2S writer: the DMA drains at the sample rate from the first write
+
+#define DMA_DESC_NUM        6
+#define DMA_FRAME_NUM       240
+#define DMA_FRAMES          (DMA_DESC_NUM * DMA_FRAME_NUM)
+#define FRAME_BYTES         4
+
+static pthread_mutex_t s_i2s_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t s_i2s_rate = 44100;
+static FILE *s_tap = NULL;
+static char s_tap_path[512];
+static uint32_t s_dma_fill = 0;
+static bool s_i2s_started = false;
+static int64_t s_i2s_start_us = 0;
+static uint64_t s_i2s_consumed = 0;
+static bool s_i2s_starved = false;
+static host_i2s_stats_t s_i2s_stats;
+static int16_t s_dma[DMA_FRAMES * 2];
+static uint32_t s_dma_read = 0;
+static uint8_t s_partial[FRAME_BYTES];
+static size_t s_partial_len = 0;
+
+static int64_t time_of_frame(uint64_t frame) {
+    return s_i2s_start_us + (int64_t)((frame * 1000000 + s_i2s_rate - 1) / s_i2s_rate);
+}
+
+static void tap_frames(const int16_t *frames, uint32_t n) {
+    if (s_tap) {
+        fwrite(frames, FRAME_BYTES, n, s_tap);
+    }
+}
+
+// Advances the DMA to now, with s_i2s_lock held
+static void i2s_consume(int64_t now_us) {
+    if (!s_i2s_started) {
+        return;
+    }
+    uint64_t due = (uint64_t)(now_us - s_i2s_start_us) * s_i2s_rate / 1000000;
+    uint64_t n = due - s_i2s_consumed;
+    if (due <= s_i2s_consumed) {
+        return;
+    }
+    s_i2s_consumed = due;
+
+    uint32_t from_dma = n < s_dma_fill ? (uint32_t)n : s_dma_fill;
+    for (uint32_t left = from_dma; left; ) {
+        uint32_t chunk = DMA_FRAMES - s_dma_read < left ? DMA_FRAMES - s_dma_read : left;
+        tap_frames(&s_dma[s_dma_read * 2], chunk);
+        s_dma_read = (s_dma_read + chunk) % DMA_FRAMES;
+        left -= chunk;
+    }
+    s_dma_fill -= from_dma;
+    s_i2s_stats.frames_played += n;
+
+    uint64_t silent = n - from_dma;
+    if (silent) {
+        static const int16_t zeros[DMA_FRAME_NUM * 2];
+        for (uint64_t left = silent; left; ) {
+            uint32_t chunk = left > DMA_FRAME_NUM ? DMA_FRAME_NUM : (uint32_t)left;
+            tap_frames(zeros, chunk);
+            left -= chunk;
+        }
+        s_i2s_stats.frames_silent += silent;
+        if (!s_i2s_starved) {
+            s_i2s_starved = true;
+            s_i2s_stats.underruns++;
+            if (s_i2s_stats.n_events < HOST_I2S_MAX_EVENTS) {
+                s_i2s_stats.events[s_i2s_stats.n_events].at_us = time_of_frame(due - silent);
+                s_i2s_stats.events[s_i2s_stats.n_events].frames = 0;
+                s_i2s_stats.n_events++;
+            }
+            ESP_LOGW(TAG, "i2s underrun from %.3f ms", time_of_frame(due - silent) / 1000.0);
+        }
+        if (s_i2s_stats.n_events > 0 && s_i2s_stats.underruns == s_i2s_stats.n_events) {
+            s_i2s_stats.events[s_i2s_stats.n_events - 1].frames += (uint32_t)silent;
+        }
+    } else if (s_dma_fill > 0) {
+        s_i2s_starved = false;
+    }
+}
+
+static void i2s_wait_locked(int64_t until_us) {
+    pthread_mutex_unlock(&s_i2s_lock);
+    host_sleep_until(until_us);
+    pthread_mutex_lock(&s_i2s_lock);
+}
+
+static void i2s_queue_frames(const uint8_t *src, uint32_t frames) {
+    while (frames) {
+        i2s_consume(host_time_us());
+        if (s_dma_fill == DMA_FRAMES) {
+            // Full: wait for the descriptor being played to come free. On
+            // the virtual clock every wait costs a clock step, so wait
+            // until the whole write fits instead; the DMA drains the same.
+            uint32_t want = DMA_FRAME_NUM;
+            if (host_clock_is_virtual()) {
+                want = frames < DMA_FRAMES ? frames : DMA_FRAMES;
+            }
+            i2s_wait_locked(time_of_frame(s_i2s_consumed + want));
+            continue;
+        }
+        uint32_t pos = (s_dma_read + s_dma_fill) % DMA_FRAMES;
+        uint32_t chunk = DMA_FRAMES - pos;
+        if (chunk > DMA_FRAMES - s_dma_fill) {
+            chunk = DMA_FRAMES - s_dma_fill;
+        }
+        if (chunk > frames) {
+            chunk = frames;
+        }
+        memcpy(&s_dma[pos * 2], src, chunk * FRAME_BYTES);
+        s_dma_fill += chunk;
+        src += chunk * FRAME_BYTES;
+        frames -= chunk;
+    }
+}
+
+static void i2s_play(const uint8_t *src, size_t len) {
+    pthread_mutex_lock(&s_i2s_lock);
+    if (!s_i2s_started) {
+        s_i2s_started = true;
+        s_i2s_start_us = host_time_us();
+        s_i2s_consumed = 0;
+        s_i2s_starved = false;
+    }
+    while (s_partial_len > 0 && len > 0) {
+        s_partial[s_partial_len++] = *src++;
+        len--;
+        if (s_partial_len == FRAME_BYTES) {
+            i2s_queue_frames(s_partial, 1);
+            s_partial_len = 0;
+        }
+    }
+    i2s_queue_frames(src, (uint32_t)(len / FRAME_BYTES));
+    size_t rest = len % FRAME_BYTES;
+    memcpy(s_partial, src + len - rest, rest);
+    s_partial_len = rest;
+    pthread_mutex_unlock(&s_i2s_lock);
+}
+
+static proc_result_t i2s_process(audio_element_handle_t el) {
+    int n = el->read_cb ? el->read_cb(el, el->buf, el->buf_sz, portMAX_DELAY, el->read_ctx)
+                        : rb_read(el->in, el->buf, el->buf_sz, portMAX_DELAY);
+    if (n <= 0) {
+        return n == 0 ? PROC_OK : rb_result(n);
+    }
+    i2s_play((const uint8_t *)el->buf, n);
+    return PROC_OK;
+}
+
+static void i2s_close(audio_element_handle_t el) {
+    // The DMA is cleared on stop; the clock restarts with the next write
+    pthread_mutex_lock(&s_i2s_lock);
+    i2s_consume(host_time_us());
+    s_i2s_started = false;
+    s_dma_fill = 0;
+    s_partial_len = 0;
+    pthread_mutex_unlock(&s_i2s_lock);
+}
+
+static void put_le(uint8_t *p, uint32_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+void host_adf_set_tap(const char *path) {
+    pthread_mutex_lock(&s_i2s_lock);
+    snprintf(s_tap_path, sizeof(s_tap_path), "%s", path);
+    s_tap = fopen(path, "wb");
+    if (s_tap == NULL) {
+        ESP_LOGE(TAG, "can't open tap %s", path);
+    } else {
+        // Header is rewritten with the real sizes in host_adf_finish
+        uint8_t header[44] = {0};
+        fwrite(header, 1, sizeof(header), s_tap);
+    }
+    pthread_mutex_unlock(&s_i2s_lock);
+}
+
+void host_adf_finish(void) {
+    pthread_mutex_lock(&s_i2s_lock);
+    i2s_consume(host_time_us());
+    if (s_tap) {
+        uint32_t data_bytes = (uint32_t)(s_i2s_stats.frames_played * FRAME_BYTES);
+        uint8_t h[44];
+        memcpy(h, "RIFF", 4);
+        put_le(h + 4, 36 + data_bytes, 4);
+        memcpy(h + 8, "WAVEfmt ", 8);
+        put_le(h + 16, 16, 4);
+        put_le(h + 20, 1, 2);
+        put_le(h + 22, 2, 2);
+        put_le(h + 24, s_i2s_rate, 4);
+        put_le(h + 28, s_i2s_rate * FRAME_BYTES, 4);
+        put_le(h + 32, FRAME_BYTES, 2);
+        put_le(h + 34, 16, 2);
+        memcpy(h + 36, "data", 4);
+        put_le(h + 40, data_bytes, 4);
+        fseek(s_tap, 0, SEEK_SET);
+        fwrite(h, 1, sizeof(h), s_tap);
+        fclose(s_tap);
+        s_tap = NULL;
+    }
+    // Nothing plays after this, so no more underruns either
+    s_i2s_started = false;
+    pthread_mutex_unlock(&s_i2s_lock);
+}
+
+void host_adf_get_i2s_stats(host_i2s_stats_t *stats) {
+    pthread_mutex_lock(&s_i2s_lock);
+    i2s_consume(host_time_us());
+    *stats = s_i2s_stats;
+    stats->sample_rate = s_i2s_rate;
+    pthread_mutex_unlock(&s_i2s_lock);
+}
+
+// Element task
+
+static proc_result_t el_open(audio_element_handle_t el) {
+    switch (el->kind) {
+        case EL_FATFS:      return fatfs_open(el);
+        case EL_DECODER:    return decoder_open(el);
+        case EL_CUSTOM:     return custom_open(el);
+        default:            return PROC_OK;
+    }
+}
+
+static proc_result_t el_process(audio_element_handle_t el) {
+    switch (el->kind) {
+        case EL_FATFS:      return fatfs_process(el);
+        case EL_DECODER:    return decoder_process(el);
+        case EL_DOWNMIX:    return downmix_process(el);
+        case EL_I2S:        return i2s_process(el);
+        case EL_CUSTOM:     return custom_process(el);
+        default:            return PROC_DONE;
+    }
+}
+
+static void el_close(audio_element_handle_t el) {
+    switch (el->kind) {
+        case EL_FATFS:      fatfs_close(el); break;
+        case EL_I2S:        i2s_close(el); break;
+        case EL_CUSTOM:     custom_close(el); break;
+        default:            break;
+    }
+}
+
+// Runs from a resume to whatever ends it. Returns a command that arrived
+// and still has to be handled by the idle loop.
+static el_cmd_t element_run_once(audio_element_handle_t el) {
+    set_state(el, AEL_STATE_RUNNING, false);
+    report(el, AEL_MSG_CMD_REPORT_STATUS, AEL_STATUS_STATE_RUNNING);
+
+    if (el_open(el) != PROC_OK) {
+        ESP_LOGE(TAG, "[%s] AEL_STATUS_ERROR_OPEN", el->tag);
+        set_state(el, AEL_STATE_ERROR, true);
+        report(el, AEL_MSG_CMD_REPORT_STATUS, AEL_STATUS_ERROR_OPEN);
+        return CMD_NONE;
+    }
+    for (;;) {
+        el_cmd_t cmd = take_cmd(el, false);
+        if (cmd == CMD_STOP || cmd == CMD_DESTROY) {
+            el_close(el);
+            set_state(el, AEL_STATE_STOPPED, true);
+            report(el, AEL_MSG_CMD_REPORT_STATUS, AEL_STATUS_STATE_STOPPED);
+            return cmd == CMD_DESTROY ? cmd : CMD_NONE;
+        }
+        switch (el_process(el)) {
+            case PROC_OK:
+                break;
+            case PROC_ABORT: {
+                // Someone is stopping us, the command is on its way
+                el_cmd_t next = take_cmd(el, true);
+                el_close(el);
+                set_state(el, AEL_STATE_STOPPED, true);
+                report(el, AEL_MSG_CMD_REPORT_STATUS, AEL_STATUS_STATE_STOPPED);
+                return next == CMD_DESTROY ? next : CMD_NONE;
+            }
+            case PROC_DONE:
+                rb_done_write(el->out);
+                el_close(el);
+                set_state(el, AEL_STATE_FINISHED, true);
+                report(el, AEL_MSG_CMD_REPORT_STATUS, AEL_STATUS_STATE_FINISHED);
+                return CMD_NONE;
+            case PROC_ERROR:
+                el_close(el);
+                set_state(el, AEL_STATE_ERROR, true);
+                report(el, AEL_MSG_CMD_REPORT_STATUS, AEL_STATUS_ERROR_PROCESS);
+                return CMD_NONE;
+        }
+    }
+}
+
+static void element_task(void *arg) {
+    audio_element_handle_t el = arg;
+    for (;;) {
+        el_cmd_t cmd = take_cmd(el, true);
+        if (cmd == CMD_RESUME) {
+            cmd = element_run_once(el);
+        } else if (cmd == CMD_STOP) {
+            // Idle, or the stop overtook a resume still in the command slot.
+            // The ADF's on_cmd_stop sets STOPPED_BIT either way, so
+            // wait_for_stop must not hang here.
+            pthread_mutex_lock(&el->lock);
+            if (el->state != AEL_STATE_FINISHED) {
+                el->state = AEL_STATE_STOPPED;
+            }
+            el->stopped = true;
+            host_cond_broadcast(&el->changed);
+            pthread_mutex_unlock(&el->lock);
+        }
+        if (cmd == CMD_DESTROY) {
+            break;
+        }
+    }
+    pthread_mutex_lock(&el->lock);
+    el->task_alive = false;
+    el->stopped = true;
+    host_cond_broadcast(&el->changed);
+    pthread_mutex_unlock(&el->lock);
+    vTaskDelete(NULL);
+}
+
+static bool has_task(audio_element_handle_t el) {
+    return el->kind != EL_RAW;
+}
+
+static esp_err_t element_run(audio_element_handle_t el) {
+    if (!has_task(el)) {
+        return ESP_OK;
+    }
+    pthread_mutex_lock(&el->lock);
+    bool alive = el->task_alive;
+    el->task_alive = true;
+    pthread_mutex_unlock(&el->lock);
+    if (alive) {
+        return ESP_OK;
+    }
+    if (xTaskCreatePinnedToCore(element_task, el->tag, el->task_stack, el, el->task_prio, NULL,
+                                el->task_core) != pdPASS) {
+        ESP_LOGE(TAG, "[%s] Error create element task", el->tag);
+        pthread_mutex_lock(&el->lock);
+        el->task_alive = false;
+        pthread_mutex_unlock(&el->lock);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t element_resume(audio_element_handle_t el) {
+    pthread_mutex_lock(&el->lock);
+    audio_element_state_t state = el->state;
+    if (!has_task(el)) {
+        el->state = AEL_STATE_RUNNING;
+        pthread_mutex_unlock(&el->lock);
+        return ESP_OK;
+    }
+    if (state == AEL_STATE_RUNNING) {
+        pthread_mutex_unlock(&el->lock);
+        return ESP_OK;
+    }
+    if (state == AEL_STATE_ERROR) {
+        pthread_mutex_unlock(&el->lock);
+        ESP_LOGE(TAG, "[%s] RESUME: Element error, state:%d", el->tag, state);
+        return ESP_FAIL;
+    }
+    if (state == AEL_STATE_FINISHED) {
+        pthread_mutex_unlock(&el->lock);
+        ESP_LOGI(TAG, "[%s] RESUME: Element has finished, state:%d", el->tag, state);
+        report(el, AEL_MSG_CMD_REPORT_STATUS, AEL_STATUS_STATE_FINISHED);
+        return ESP_OK;
+    }
+    el->stopped = false;
+    el->cmd = CMD_RESUME;
+    host_cond_broadcast(&el->changed);
+    pthread_mutex_unlock(&el->lock);
+    return ESP_OK;
+}
+
+static esp_err_t element_stop(audio_element_handle_t el) {
+    pthread_mutex_lock(&el->lock);
+    bool active = el->task_alive && !el->stopped;
+    pthread_mutex_unlock(&el->lock);
+    if (!active) {
+        return ESP_OK;
+    }
+    send_cmd(el, CMD_STOP);
+    abort_ringbufs(el);
+    return ESP_OK;
+}
+
+static esp_err_t element_wait_for_stop(audio_element_handle_t el) {
+    pthread_mutex_lock(&el->lock);
+    while (el->task_alive && !el->stopped) {
+        host_cond_wait(&el->changed, &el->lock, -1);
+    }
+    pthread_mutex_unlock(&el->lock);
+    return ESP_OK;
+}
+
+static esp_err_t element_terminate(audio_element_handle_t el) {
+    pthread_mutex_lock(&el->lock);
+    bool alive = el->task_alive;
+    pthread_mutex_unlock(&el->lock);
+    if (!alive) {
+        return ESP_OK;
+    }
+    abort_ringbufs(el);
+    send_cmd(el, CMD_DESTROY);
+    pthread_mutex_lock(&el->lock);
+    while (el->task_alive) {
+        host_cond_wait(&el->changed, &el->lock, -1);
+    }
+    pthread_mutex_unlock(&el->lock);
+    return ESP_OK;
+}
+
+audio_element_state_t audio_element_get_state(audio_element_handle_t el) {
+    if (el == NULL) {
+        return AEL_STATE_NONE;
+    }
+    pthread_mutex_lock(&el->lock);
+    audio_element_state_t state = el->state;
+    pthread_mutex_unlock(&el->lock);
+    return state;
+}
+
+esp_err_t audio_element_getinfo(audio_element_handle_t el, audio_element_info_t *info) {
+    if (el == NULL || info == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&el->lock);
+    *info = el->info;
+    info->uri = el->uri;
+    pthread_mutex_unlock(&el->lock);
+    return ESP_OK;
+}
+
+esp_err_t audio_element_setinfo(audio_element_handle_t el, audio_element_info_t *info) {
+    if (el == NULL || info == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&el->lock);
+    char *uri = el->uri;
+    el->info = *info;
+    el->info.uri = NULL;
+    el->uri = uri;
+    pthread_mutex_unlock(&el->lock);
+    return ESP_OK;
+}
+
+esp_err_t audio_element_set_uri(audio_element_handle_t el, const char *uri) {
+    if (el == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int64_t start = host_time_us();
+    char *copy = NULL;
+    if (uri) {
+        size_t len = strlen(uri) + 1;
+        copy = adf_calloc(1, len);
+        if (copy == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        memcpy(copy, uri, len);
+    }
+    pthread_mutex_lock(&el->lock);
+    char *old = el->uri;
+    el->uri = copy;
+    pthread_mutex_unlock(&el->lock);
+    // Freed here as the ADF does, even if someone still holds the getinfo pointer
+    heap_caps_free(old);
+    api_done(API_ELEMENT_SET_URI, start);
+    return ESP_OK;
+}
+
+char *audio_element_get_uri(audio_element_handle_t el) {
+    if (el == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&el->lock);
+    char *uri = el->uri;
+    pthread_mutex_unlock(&el->lock);
+    return uri;
+}
+
+const char *audio_element_get_tag(audio_element_handle_t el) {
+    return el ? el->tag : NULL;
+}
+
+ringbuf_handle_t audio_element_get_input_ringbuf(audio_element_handle_t el) {
+    if (el == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&el->lock);
+    ringbuf_handle_t rb = el->in;
+    pthread_mutex_unlock(&el->lock);
+    return rb;
+}
+
+ringbuf_handle_t audio_element_get_output_ringbuf(audio_element_handle_t el) {
+    if (el == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&el->lock);
+    ringbuf_handle_t rb = el->out;
+    pthread_mutex_unlock(&el->lock);
+    return rb;
+}
+
+esp_err_t audio_element_set_input_ringbuf(audio_element_handle_t el, ringbuf_handle_t rb) {
+    if (el == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&el->lock);
+    el->in = rb;
+    el->read_cb = NULL;
+    pthread_mutex_unlock(&el->lock);
+    return ESP_OK;
+}
+
+esp_err_t audio_element_set_output_ringbuf(audio_element_handle_t el, ringbuf_handle_t rb) {
+    if (el == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&el->lock);
+    el->out = rb;
+    el->write_cb = NULL;
+    pthread_mutex_unlock(&el->lock);
+    return ESP_OK;
+}
+
+esp_err_t audio_element_set_read_cb(audio_element_handle_t el, stream_func fn, void *context) {
+    if (el == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&el->lock);
+    el->read_cb = fn;
+    el->read_ctx = context;
+    el->in = NULL;
+    pthread_mutex_unlock(&el->lock);
+    return ESP_OK;
+}
+
+esp_err_t audio_element_set_write_cb(audio_element_handle_t el, stream_func fn, void *context) {
+    if (el == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&el->lock);
+    el->write_cb = fn;
+    el->write_ctx = context;
+    el->out = NULL;
+    pthread_mutex_unlock(&el->lock);
+    return ESP_OK;
+}
+
+esp_err_t audio_element_set_event_callback(audio_element_handle_t el, event_cb_func cb, void *ctx) {
+    if (el == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    el->cb = cb;
+    el->cb_ctx = ctx;
+    return ESP_OK;
+}
+
+esp_err_t audio_element_deinit(audio_element_handle_t el) {
+    if (el == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    element_terminate(el);
+    if (el->kind == EL_CUSTOM && el->fn.destroy) {
+        el->fn.destroy(el);
+    }
+    if (el->iface) {
+        audio_event_iface_destroy(el->iface);
+    }
+    pthread_cond_destroy(&el->changed);
+    pthread_mutex_destroy(&el->lock);
+    heap_caps_free(el->uri);
+    heap_caps_free(el->buf);
+    heap_caps_free(el);
+    return ESP_OK;
+}
+
+void *audio_element_getdata(audio_element_handle_t el) {
+    return el ? el->fn.data : NULL;
+}
+
+esp_err_t audio_element_setdata(audio_element_handle_t el, void *data) {
+    if (el == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    el->fn.data = data;
+    return ESP_OK;
+}
+
+audio_element_err_t audio_element_input(audio_element_handle_t el, char *buffer, int wanted_size) {
+    // The element's own task is the only reader, so no lock for the callback
+    if (el->read_cb) {
+        return el->read_cb(el, buffer, wanted_size, portMAX_DELAY, el->read_ctx);
+    }
+    return rb_read(el->in, buffer, wanted_size, portMAX_DELAY);
+}
+
+audio_element_err_t audio_element_output(audio_element_handle_t el, char *buffer, int write_size) {
+    if (el->write_cb) {
+        return el->write_cb(el, buffer, write_size, portMAX_DELAY, el->write_ctx);
+    }
+    return rb_write(el->out, buffer, write_size, portMAX_DELAY);
+}
+
+esp_err_t audio_element_update_byte_pos(audio_element_handle_t el, int pos) {
+    if (el == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&el->lock);
+    el->info.byte_pos += pos;
+    pthread_mutex_unlock(&el->lock);
+    return ESP_OK;
+}
+
+// Element constructors
+
+audio_element_handle_t audio_element_init(audio_element_cfg_t *config) {
+    if (config->process == NULL) {
+        ESP_LOGE(TAG, "the host build only runs elements with a process callback");
+        return NULL;
+    }
+    audio_element_handle_t el = element_create(EL_CUSTOM, config->tag ? config->tag : "unknown",
+                                               config->out_rb_size, config->task_stack, config->task_core,
+                                               config->task_prio, config->buffer_len);
+    if (el) {
+        el->fn = *config;
+        el->read_cb = config->read;
+        el->write_cb = config->write;
+    }
+    return el;
+}
+
+audio_element_handle_t fatfs_stream_init(fatfs_stream_cfg_t *config) {
+    if (config->type != AUDIO_STREAM_READER) {
+        ESP_LOGE(TAG, "the host build only has the fatfs reader");
+        return NULL;
+    }
+    return element_create(EL_FATFS, "file", config->out_rb_size, config->task_stack, config->task_core,
+                          config->task_prio, config->buf_sz);
+}
+
+audio_element_handle_t esp_decoder_init(esp_decoder_cfg_t *config, audio_decoder_t *decoder_list, int list_size) {
+    audio_element_handle_t el = element_create(EL_DECODER, "decoder", config->out_rb_size, config->task_stack,
+                                               config->task_core, config->task_prio, DECODER_CHUNK);
+    if (el) {
+        el->wav_only = false;
+    }
+    return el;
+}
+
+audio_element_handle_t wav_decoder_init(wav_decoder_cfg_t *config) {
+    audio_element_handle_t el = element_create(EL_DECODER, "wav", config->out_rb_size, config->task_stack,
+                                               config->task_core, config->task_prio, DECODER_CHUNK);
+    if (el) {
+        el->wav_only = true;
+    }
+    return el;
+}
+
+audio_element_handle_t raw_stream_init(raw_stream_cfg_t *config) {
+    return element_create(EL_RAW, "raw", config->out_rb_size, 0, 0, 0, 0);
+}
+
+int raw_stream_read(audio_element_handle_t el, char *buffer, int buf_size) {
+    return rb_read(audio_element_get_input_ringbuf(el), buffer, buf_size, portMAX_DELAY);
+}
+
+int raw_stream_write(audio_element_handle_t el, char *buffer, int buf_size) {
+    return rb_write(audio_element_get_output_ringbuf(el), buffer, buf_size, portMAX_DELAY);
+}
+
+audio_element_handle_t i2s_stream_init(i2s_stream_cfg_t *config) {
+    if (config->type != AUDIO_STREAM_WRITER) {
+        ESP_LOGE(TAG, "the host build only has the i2s writer");
+        return NULL;
+    }
+    return element_create(EL_I2S, "iis", config->out_rb_size, config->task_stack, config->task_core,
+                          config->task_prio, config->buffer_len);
+}
+
+esp_err_t i2s_stream_set_clk(audio_element_handle_t el, int rate, int bits, int ch) {
+    if (bits != 16 || ch != 2) {
+        ESP_LOGW(TAG, "i2s %d bit %d channel is played as 16 bit stereo", bits, ch);
+    }
+    pthread_mutex_lock(&s_i2s_lock);
+    i2s_consume(host_time_us());
+    if (s_i2s_started && (uint32_t)rate != s_i2s_rate) {
+        // New clock, the frame count starts over from here
+        s_i2s_start_us = host_time_us();
+        s_i2s_consumed = 0;
+    }
+    s_i2s_rate = rate;
+    pthread_mutex_unlock(&s_i2s_lock);
+    pthread_mutex_lock(&el->lock);
+    el->info.sample_rates = rate;
+    el->info.bits = bits;
+    el->info.channels = ch;
+    pthread_mutex_unlock(&el->lock);
+    return ESP_OK;
+}
+
+audio_element_handle_t downmix_init(downmix_cfg_t *config) {
+    int sources = config->downmix_info.source_num;
+    if (sources < 1 || sources > DOWNMIX_MAX_SOURCES) {
+        return NULL;
+    }
+    int frames = config->max_sample;
+    // Mix accumulator plus one input block of up to stereo frames
+    int buf_sz = frames * 2 * sizeof(int32_t) + frames * 2 * sizeof(int16_t);
+    audio_element_handle_t el = element_create(EL_DOWNMIX, "downmix", config->out_rb_size, config->task_stack,
+                                               config->task_core, config->task_prio, buf_sz);
+    if (el == NULL) {
+        return NULL;
+    }
+    el->dm_sources = sources;
+    el->dm_mode = config->downmix_info.mode;
+    el->dm_max_sample = frames;
+    for (int i = 0; i < sources; i++) {
+        el->dm_timeout[i] = portMAX_DELAY;
+        el->dm_info[i].channel = 2;
+        el->dm_info[i].bits_num = 16;
+        el->dm_info[i].samplerate = 44100;
+    }
+    return el;
+}
+
+esp_err_t downmix_set_gain_info(audio_element_handle_t self, float *gain, int index) {
+    if (self == NULL || index < 0 || index >= self->dm_sources) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int64_t start = host_time_us();
+    pthread_mutex_lock(&self->lock);
+    self->dm_info[index].gain[0] = gain[0];
+    self->dm_info[index].gain[1] = gain[1];
+    pthread_mutex_unlock(&self->lock);
+    api_done(API_DOWNMIX_SET_GAIN, start);
+    return ESP_OK;
+}
+
+esp_err_t downmix_set_work_mode(audio_element_handle_t self, esp_downmix_work_mode_t mode) {
+    if (self == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&self->lock);
+    self->dm_mode = mode;
+    pthread_mutex_unlock(&self->lock);
+    return ESP_OK;
+}
+
+esp_err_t downmix_set_input_rb(audio_element_handle_t self, ringbuf_handle_t rb, int index) {
+    if (self == NULL || index < 0 || index >= self->dm_sources) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&self->lock);
+    self->dm_in[index] = rb;
+    pthread_mutex_unlock(&self->lock);
+    return ESP_OK;
+}
+
+esp_err_t downmix_set_input_rb_timeout(audio_element_handle_t self, int ticks_to_wait, int index) {
+    if (self == NULL || index < 0 || index >= self->dm_sources) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&self->lock);
+    self->dm_timeout[index] = ticks_to_wait;
+    pthread_mutex_unlock(&self->lock);
+    return ESP_OK;
+}
+
+esp_err_t source_info_init(audio_element_handle_t self, esp_downmix_input_info_t *info) {
+    if (self == NULL || info == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&self->lock);
+    memcpy(self->dm_info, info, self->dm_sources * sizeof(*info));
+    pthread_mutex_unlock(&self->lock);
+    return ESP_OK;
+}
+
+// Pipelines
+
+#define PIPELINE_MAX_ELEMENTS   8
+
+typedef struct {
+    audio_element_handle_t el;
+    bool linked;
+} pipeline_item_t;
+
+struct audio_pipeline {
+    pthread_mutex_t lock;
+    int rb_size;
+    audio_element_state_t state;
+    pipeline_item_t items[PIPELINE_MAX_ELEMENTS];
+    int n_items;
+    ringbuf_handle_t rbs[PIPELINE_MAX_ELEMENTS];    // the ones link made
+    int n_rbs;
+    audio_event_iface_handle_t listener;
+};
+
+audio_pipeline_handle_t audio_pipeline_init(audio_pipeline_cfg_t *config) {
+    struct audio_pipeline *p = adf_calloc(1, sizeof(*p));
+    if (p == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    p->rb_size = config->rb_size;
+    p->state = AEL_STATE_INIT;
+    return p;
+}
+
+esp_err_t audio_pipeline_register(audio_pipeline_handle_t pipeline, audio_element_handle_t el, const char *name) {
+    if (pipeline == NULL || el == NULL || pipeline->n_items == PIPELINE_MAX_ELEMENTS) {
+        return ESP_FAIL;
+    }
+    // The tag is also what the element task will be called
+    if (name) {
+        snprintf(el->tag, sizeof(el->tag), "%s", name);
+    }
+    pipeline->items[pipeline->n_items++] = (pipeline_item_t){ .el = el };
+    return ESP_OK;
+}
+
+esp_err_t audio_pipeline_unregister(audio_pipeline_handle_t pipeline, audio_element_handle_t el) {
+    for (int i = 0; i < pipeline->n_items; i++) {
+        if (pipeline->items[i].el == el) {
+            memmove(&pipeline->items[i], &pipeline->items[i + 1], (pipeline->n_items - i - 1) * sizeof(pipeline_item_t));
+            pipeline->n_items--;
+            return ESP_OK;
+        }
+    }
+    return ESP_FAIL;
+}
+
+esp_err_t audio_pipeline_unregister_more(audio_pipeline_handle_t pipeline, audio_element_handle_t element_1, ...) {
+    va_list ap;
+    va_start(ap, element_1);
+    for (audio_element_handle_t el = element_1; el; el = va_arg(ap, audio_element_handle_t)) {
+        audio_pipeline_unregister(pipeline, el);
+    }
+    va_end(ap);
+    return ESP_OK;
+}
+
+static audio_element_handle_t find_by_tag(audio_pipeline_handle_t pipeline, const char *tag, int *index) {
+    for (int i = 0; i < pipeline->n_items; i++) {
+        if (strcmp(pipeline->items[i].el->tag, tag) == 0) {
+            *index = i;
+            return pipeline->items[i].el;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t audio_pipeline_link(audio_pipeline_handle_t pipeline, const char *link_tag[], int link_num) {
+    audio_element_handle_t prev = NULL;
+    for (int i = 0; i < link_num; i++) {
+        int index;
+        audio_element_handle_t el = find_by_tag(pipeline, link_tag[i], &index);
+        if (el == NULL) {
+            ESP_LOGE(TAG, "There is 1 link_tag invalid: %s", link_tag[i]);
+            return ESP_FAIL;
+        }
+        pipeline->items[index].linked = true;
+        if (prev) {
+            int size = prev->out_rb_size > 0 ? prev->out_rb_size : pipeline->rb_size;
+            ringbuf_handle_t rb = rb_create(size, 1);
+            if (rb == NULL) {
+                return ESP_ERR_NO_MEM;
+            }
+            pipeline->rbs[pipeline->n_rbs++] = rb;
+            audio_element_set_output_ringbuf(prev, rb);
+            audio_element_set_input_ringbuf(el, rb);
+        }
+        prev = el;
+    }
+    return ESP_OK;
+}
+
+#define FOR_EACH_LINKED(pipeline, el)                                           \
+    for (int _i = 0; _i < (pipeline)->n_items; _i++)                            \
+        for (audio_element_handle_t el = (pipeline)->items[_i].el; el && (pipeline)->items[_i].linked; el = NULL)
+
+esp_err_t audio_pipeline_run(audio_pipeline_handle_t pipeline) {
+    int64_t start = host_time_us();
+    pthread_mutex_lock(&pipeline->lock);
+    if (pipeline->state != AEL_STATE_INIT) {
+        pthread_mutex_unlock(&pipeline->lock);
+        ESP_LOGW(TAG, "Pipeline already started, state:%d", pipeline->state);
+        return ESP_OK;
+    }
+    esp_err_t err = ESP_OK;
+    FOR_EACH_LINKED(pipeline, el) {
+        if (element_run(el) != ESP_OK) {
+            err = ESP_FAIL;
+        }
+    }
+    FOR_EACH_LINKED(pipeline, el) {
+        element_resume(el);
+    }
+    pipeline->state = AEL_STATE_RUNNING;
+    pthread_mutex_unlock(&pipeline->lock);
+    api_done(API_PIPELINE_RUN, start);
+    return err;
+}
+
+esp_err_t audio_pipeline_stop(audio_pipeline_handle_t pipeline) {
+    int64_t start = host_time_us();
+    pthread_mutex_lock(&pipeline->lock);
+    if (pipeline->state != AEL_STATE_RUNNING) {
+        pthread_mutex_unlock(&pipeline->lock);
+        ESP_LOGW(TAG, "Without stop, st:%d", pipeline->state);
+        return ESP_FAIL;
+    }
+    FOR_EACH_LINKED(pipeline, el) {
+        element_stop(el);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    api_done(API_PIPELINE_STOP, start);
+    return ESP_OK;
+}
+
+esp_err_t audio_pipeline_wait_for_stop(audio_pipeline_handle_t pipeline) {
+    int64_t start = host_time_us();
+    pthread_mutex_lock(&pipeline->lock);
+    if (pipeline->state != AEL_STATE_RUNNING) {
+        pthread_mutex_unlock(&pipeline->lock);
+        return ESP_FAIL;
+    }
+    FOR_EACH_LINKED(pipeline, el) {
+        element_wait_for_stop(el);
+    }
+    pipeline->state = AEL_STATE_INIT;
+    pthread_mutex_unlock(&pipeline->lock);
+    api_done(API_PIPELINE_WAIT_FOR_STOP, start);
+    return ESP_OK;
+}
+
+esp_err_t audio_pipeline_terminate(audio_pipeline_handle_t pipeline) {
+    int64_t start = host_time_us();
+    pthread_mutex_lock(&pipeline->lock);
+    FOR_EACH_LINKED(pipeline, el) {
+        element_terminate(el);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    api_done(API_PIPELINE_TERMINATE, start);
+    return ESP_OK;
+}
+
+esp_err_t audio_pipeline_reset_ringbuffer(audio_pipeline_handle_t pipeline) {
+    int64_t start = host_time_us();
+    pthread_mutex_lock(&pipeline->lock);
+    FOR_EACH_LINKED(pipeline, el) {
+        rb_reset(audio_element_get_input_ringbuf(el));
+        rb_reset(audio_element_get_output_ringbuf(el));
+        for (int i = 0; i < el->dm_sources; i++) {
+            rb_reset(el->dm_in[i]);
+        }
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    api_done(API_PIPELINE_RESET, start);
+    return ESP_OK;
+}
+
+esp_err_t audio_pipeline_reset_elements(audio_pipeline_handle_t pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+    FOR_EACH_LINKED(pipeline, el) {
+        set_state(el, AEL_STATE_INIT, false);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return ESP_OK;
+}
+
+esp_err_t audio_pipeline_set_listener(audio_pipeline_handle_t pipeline, audio_event_iface_handle_t evt) {
+    pthread_mutex_lock(&pipeline->lock);
+    FOR_EACH_LINKED(pipeline, el) {
+        audio_event_iface_set_listener(el->iface, evt);
+    }
+    pipeline->listener = evt;
+    pthread_mutex_unlock(&pipeline->lock);
+    return ESP_OK;
+}
+
+esp_err_t audio_pipeline_remove_listener(audio_pipeline_handle_t pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+    if (pipeline->listener) {
+        FOR_EACH_LINKED(pipeline, el) {
+            audio_event_iface_remove_listener(pipeline->listener, el->iface);
+        }
+        pipeline->listener = NULL;
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return ESP_OK;
+}
+
+esp_err_t audio_pipeline_deinit(audio_pipeline_handle_t pipeline) {
+    if (pipeline == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    audio_pipeline_terminate(pipeline);
+    for (int i = 0; i < pipeline->n_items; i++) {
+        audio_element_handle_t el = pipeline->items[i].el;
+        if (pipeline->items[i].linked) {
+            audio_element_set_input_ringbuf(el, NULL);
+            audio_element_set_output_ringbuf(el, NULL);
+        }
+    }
+    for (int i = 0; i < pipeline->n_rbs; i++) {
+        rb_destroy(pipeline->rbs[i]);
+    }
+    // Whatever is still registered goes with the pipeline
+    while (pipeline->n_items > 0) {
+        audio_element_handle_t el = pipeline->items[0].el;
+        audio_pipeline_unregister(pipeline, el);
+        audio_element_deinit(el);
+    }
+    pthread_mutex_destroy(&pipeline->lock);
+    heap_caps_free(pipeline);
+    return ESP_OK;
+}
+
+void host_adf_report(FILE *out) {
+    host_i2s_stats_t i2s;
+    host_adf_get_i2s_stats(&i2s);
+    fprintf(out, "i2s frames     %llu played, %llu silent at %u Hz\n", (unsigned long long)i2s.frames_played,
+            (unsigned long long)i2s.frames_silent, i2s.sample_rate);
+    fprintf(out, "i2s underruns  %u\n", i2s.underruns);
+    for (uint32_t i = 0; i < i2s.n_events; i++) {
+        fprintf(out, "  underrun at %10.3f ms, %u frames silent\n", i2s.events[i].at_us / 1000.0,
+                i2s.events[i].frames);
+    }
+    if (i2s.underruns > i2s.n_events) {
+        fprintf(out, "  ... %u more\n", i2s.underruns - i2s.n_events);
+    }
+
+    pthread_mutex_lock(&s_stats_lock);
+    fprintf(out, "adf events     %llu sent, %llu dropped on a full queue\n",
+            (unsigned long long)s_events_sent, (unsigned long long)s_events_dropped);
+    fprintf(out, "adf ringbufs   %llu aborted reads/writes, %llu timeouts, %llu short downmix reads\n",
+            (unsigned long long)s_rb_aborts, (unsigned long long)s_rb_timeouts,
+            (unsigned long long)s_downmix_short_reads);
+    for (int i = 0; i < API_COUNT; i++) {
+        if (s_api[i].calls == 0) {
+            continue;
+        }
+        fprintf(out, "  %-24s %8llu calls, mean %8.1f us, max %8llu us\n", s_api_names[i],
+                (unsigned long long)s_api[i].calls, (double)s_api[i].total_us / s_api[i].calls,
+                (unsigned long long)s_api[i].max_us);
+    }
+    pthread_mutex_unlock(&s_stats_lock);
+}
@@ -0,0 +1,280 @@
+// --bench: the master bus DSP timed on the host
+//
+// Runs a kernel over seconds of generated stereo the way the bus does, in
+// I2S sized blocks, and reports thread CPU time as a share of the audio's
+// real time. Host CPU, not the board's: the ratios between lengths and
+// methods carry over, the absolute numbers don't. "status" times the
+// writers behind the polled endpoints instead, per request.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cJSON.h"
+#include "convolver.h"
+#include "http_server.h"
+#include "metrics.h"
+#include "spectrum.h"
+#include "host.h"
+
+#define BENCH_RATE      44100
+#define BENCH_SECONDS   10
+#define BENCH_BLOCK     512         // frames, what the host I2S reads at a time
+
+static double thread_cpu_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t s_seed = 1;
+
+static float noise(void) {
+    s_seed = s_seed * 1664525u + 1013904223u;
+    return (int32_t)s_seed / 2147483648.0f;
+}
+
+// What the convolver should give, CONVOLVER_BLOCK frames earlier
+static void direct_fir(const int16_t *in, int16_t *out, uint32_t frames, const float *taps, int n_taps) {
+    for (uint32_t f = 0; f < frames; f++) {
+        for (int ch = 0; ch < 2; ch++) {
+            float acc = 0;
+            int k_max = f < (uint32_t)n_taps ? (int)f + 1 : n_taps;
+            for (int k = 0; k < k_max; k++) {
+                acc += taps[k] * in[2 * (f - k) + ch];
+            }
+            long v = lrintf(acc);
+            out[2 * f + ch] = v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+        }
+    }
+}
+
+static int bench_convolver(FILE *out) {
+    static const int lengths[] = { 256, 512, 1024, 2048 };
+    uint32_t frames = BENCH_RATE * BENCH_SECONDS;
+    int16_t *signal = malloc(frames * 4);
+    int16_t *conv = malloc(frames * 4);
+    int16_t *direct = malloc(frames * 4);
+    float *taps = malloc(CONVOLVER_MAX_TAPS * sizeof(float));
+    if (!signal || !conv || !direct || !taps) {
+        return 2;
+    }
+    // -12 dBFS noise
+    for (uint32_t i = 0; i < frames * 2; i++) {
+        signal[i] = (int16_t)(noise() * 8192);
+    }
+
+    fprintf(out, "convolver, %d s of stereo at %d Hz in %d frame blocks, portable FFT\n", BENCH_SECONDS,
+            BENCH_RATE, BENCH_BLOCK);
+    fprintf(out, "taps  partitions  partitioned  worst block  direct form  max error\n");
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        int n_taps = lengths[l];
+        // A decaying response, scaled so nothing can clip
+        float sum = 0;
+        for (int k = 0; k < n_taps; k++) {
+            taps[k] = noise() * expf(-4.0f * k / n_taps);
+            sum += fabsf(taps[k]);
+        }
+        for (int k = 0; k < n_taps; k++) {
+            taps[k] *= 0.5f / sum;
+        }
+
+        convolver_t *c = convolver_create(taps, n_taps);
+        if (!c) {
+            fprintf(out, "%4d  can't create\n", n_taps);
+            return 2;
+        }
+        memcpy(conv, signal, frames * 4);
+        double worst = 0;
+        double start = thread_cpu_s();
+        for (uint32_t f = 0; f < frames; f += BENCH_BLOCK) {
+            uint32_t n = frames - f < BENCH_BLOCK ? frames - f : BENCH_BLOCK;
+            double block_start = thread_cpu_s();
+            convolver_run(c, conv + 2 * f, n);
+            double block = thread_cpu_s() - block_start;
+            if (block > worst) {
+                worst = block;
+            }
+        }
+        double partitioned = thread_cpu_s() - start;
+        int partitions = (n_taps + CONVOLVER_BLOCK - 1) / CONVOLVER_BLOCK;
+        convolver_destroy(c);
+
+        start = thread_cpu_s();
+        direct_fir(signal, direct, frames, taps, n_taps);
+        double direct_s = thread_cpu_s() - start;
+
+        int max_error = 0;
+        for (uint32_t i = 0; i + 2 * CONVOLVER_BLOCK < frames * 2; i++) {
+            int e = abs(conv[i + 2 * CONVOLVER_BLOCK] - direct[i]);
+            if (e > max_error) {
+                max_error = e;
+            }
+        }
+        fprintf(out, "%4d  %10d  %9.2f %%  %8.0f us  %9.2f %%  %5d LSB\n", n_taps, partitions,
+                100.0 * partitioned / BENCH_SECONDS, worst * 1e6, 100.0 * direct_s / BENCH_SECONDS, max_error);
+    }
+    free(signal);
+    free(conv);
+    free(direct);
+    free(taps);
+    return 0;
+}
+
+// A sine on both channels, at amplitude (1.0 is full scale)
+static void sine(int16_t *pcm, uint32_t frames, double hz, double amplitude) {
+    for (uint32_t f = 0; f < frames; f++) {
+        int16_t v = (int16_t)lrint(32767.0 * amplitude * sin(2.0 * M_PI * hz * f / BENCH_RATE));
+        pcm[2 * f] = v;
+        pcm[2 * f + 1] = v;
+    }
+}
+
+static int bench_spectrum(FILE *out) {
+    uint32_t frames = BENCH_RATE * BENCH_SECONDS;
+    uint32_t blocks = frames / SPECTRUM_FFT_SIZE;
+    int16_t *signal = malloc(frames * 4);
+    spectrum_t *result = malloc(sizeof(spectrum_t));
+    spectrum_analyser_t *a = spectrum_analyser_create();
+    if (!signal || !result || !a) {
+        return 2;
+    }
+    for (uint32_t i = 0; i < frames * 2; i++) {
+        signal[i] = (int16_t)(noise() * 8192);
+    }
+
+    fprintf(out, "spectrum, %d s of stereo at %d Hz in %d frame blocks, portable FFT\n", BENCH_SECONDS,
+            BENCH_RATE, SPECTRUM_FFT_SIZE);
+    // Every block, where the board takes SPECTRUM_BLOCKS of them an update
+    double worst = 0;
+    double start = thread_cpu_s();
+    for (uint32_t b = 0; b < blocks; b++) {
+        double block_start = thread_cpu_s();
+        spectrum_analyser_add(a, signal + 2 * b * SPECTRUM_FFT_SIZE);
+        double block = thread_cpu_s() - block_start;
+        if (block > worst) {
+            worst = block;
+        }
+    }
+    double per_block = (thread_cpu_s() - start) / blocks;
+    start = thread_cpu_s();
+    spectrum_analyser_result(a, result);
+    double per_result = thread_cpu_s() - start;
+    double updates = 1000.0 / SPECTRUM_UPDATE_MS;
+    double running = updates * (SPECTRUM_BLOCKS * per_block + per_result);
+
+    // What the bus pays with no one asking
+    start = thread_cpu_s();
+    for (uint32_t f = 0; f < frames; f += BENCH_BLOCK) {
+        spectrum_tap(signal + 2 * f, frames - f < BENCH_BLOCK ? frames - f : BENCH_BLOCK);
+    }
+    double idle_tap = (thread_cpu_s() - start) / (frames / BENCH_BLOCK);
+
+    fprintf(out, "block          %6.1f us, worst %.0f us\n", per_block * 1e6, worst * 1e6);
+    fprintf(out, "result         %6.1f us\n", per_result * 1e6);
+    fprintf(out, "running        %6.3f %% of one core, %d blocks and %.0f results a second\n", 100.0 * running,
+            (int)(SPECTRUM_BLOCKS * updates), updates);
+    fprintf(out, "idle tap       %6.1f ns a %d frame read\n", idle_tap * 1e9, BENCH_BLOCK);
+
+    // Levels: a sine in the middle of bin 12 reads its level there, and
+    // one anywhere in a band reads it in the band
+    int bin = 12;
+    double bin_hz = spectrum_bin_hz(bin);
+    sine(signal, SPECTRUM_FFT_SIZE * SPECTRUM_BLOCKS, bin_hz, 0.1);
+    for (int b = 0; b < SPECTRUM_BLOCKS; b++) {
+        spectrum_analyser_add(a, signal + 2 * b * SPECTRUM_FFT_SIZE);
+    }
+    spectrum_analyser_result(a, result);
+    fprintf(out, "-20 dBFS sine  %.1f Hz reads %.2f dBFS in bin %d", bin_hz, result->bins_db[bin], bin);
+    int band = 6;
+    sine(signal, SPECTRUM_FFT_SIZE * SPECTRUM_BLOCKS, spectrum_band_hz(band), 0.1);
+    for (int b = 0; b < SPECTRUM_BLOCKS; b++) {
+        spectrum_analyser_add(a, signal + 2 * b * SPECTRUM_FFT_SIZE);
+    }
+    spectrum_analyser_result(a, result);
+    fprintf(out, ", %u Hz reads %.2f dBFS in its band\n", spectrum_band_hz(band), result->bands_db[band]);
+
+    spectrum_analyser_destroy(a);
+    free(result);
+    free(signal);
+    return 0;
+}
+
+#define STATUS_RENDERS  20000
+
+static esp_err_t count_bytes(void *ctx, const char *buf, size_t len) {
+    *(size_t *)ctx += len;
+    return ESP_OK;
+}
+
+// One /api/loops document built and printed, as the handler does, split
+// into its steps. Returns the printed size.
+static size_t loops_render(bool formatted, double *build_s, double *print_s, double *free_s) {
+    double t0 = thread_cpu_s();
+    cJSON *doc = http_server_loops_json();
+    double t1 = thread_cpu_s();
+    char *text = formatted ? cJSON_Print(doc) : cJSON_PrintUnformatted(doc);
+    double t2 = thread_cpu_s();
+    size_t len = text ? strlen(text) : 0;
+    free(text);
+    cJSON_Delete(doc);
+    double t3 = thread_cpu_s();
+    *build_s += t1 - t0;
+    *print_s += t2 - t1;
+    *free_s += t3 - t2;
+    return len;
+}
+
+static int bench_status(FILE *out) {
+    // Every track playing a file; there is no pipeline here, so no playheads
+    static loop_manager_t manager = { .global_volume_percent = 75 };
+    for (int i = 0; i < MAX_TRACKS; i++) {
+        manager.loops[i].is_playing = true;
+        snprintf(manager.loops[i].file_path, sizeof(manager.loops[i].file_path), "/sdcard/track%d.wav", i);
+        manager.loops[i].volume_percent = 80;
+        manager.loops[i].track_index = i;
+    }
+    http_server_set_loop_manager(&manager);
+
+    fprintf(out, "status writers, %d renders each, %d tracks playing\n", STATUS_RENDERS, MAX_TRACKS);
+    fprintf(out, "writer                 us/request  build us  print us   free us     bytes\n");
+    for (int formatted = 1; formatted >= 0; formatted--) {
+        double build = 0, print = 0, release = 0;
+        size_t len = 0;
+        for (int i = 0; i < STATUS_RENDERS; i++) {
+            len = loops_render(formatted, &build, &print, &release);
+        }
+        fprintf(out, "%-22s %10.2f %9.2f %9.2f %9.2f %9zu\n",
+                formatted ? "/api/loops" : "/api/loops unformatted",
+                1e6 * (build + print + release) / STATUS_RENDERS, 1e6 * build / STATUS_RENDERS,
+                1e6 * print / STATUS_RENDERS, 1e6 * release / STATUS_RENDERS, len);
+    }
+
+    // The Prometheus text, streamed to a sink that only counts
+    size_t len = 0;
+    double start = thread_cpu_s();
+    for (int i = 0; i < STATUS_RENDERS; i++) {
+        len = 0;
+        metrics_render(count_bytes, &len);
+    }
+    double metrics_s = thread_cpu_s() - start;
+    fprintf(out, "%-22s %10.2f %9s %9s %9s %9zu\n", "/metrics", 1e6 * metrics_s / STATUS_RENDERS, "-", "-", "-",
+            len);
+    return 0;
+}
+
+int host_bench_run(const char *name, FILE *out) {
+    if (strcmp(name, "convolver") == 0) {
+        return bench_convolver(out);
+    }
+    if (strcmp(name, "spectrum") == 0) {
+        return bench_spectrum(out);
+    }
+    if (strcmp(name, "status") == 0) {
+        return bench_status(out);
+    }
+    fprintf(stderr, "unknown benchmark %s, there is: convolver, spectrum, status\n", name);
+    return 2;
+}
@@ -0,0 +1,432 @@
+// The board around the audio path: codec, peripheral set, WiFi, sockets and NVS
+//
+// None of it does anything the control plane could notice going wrong. The
+// codec remembers its volume, the peripheral set only has an event
+// interface for app_main to listen on, and the WiFi manager keeps its
+// network list in memory and is always connected to the loopback address.
+// esp_restart() ends the run with the host report.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "audio_event_iface.h"
+#include "board.h"
+#include "esp_event.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_netif.h"
+#include "esp_peripherals.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "nvs_flash.h"
+#include "wifi_manager.h"
+#include "host.h"
+#include "host_internal.h"
+
+static const char *TAG = "HOST_BOARD";
+
+#define HOST_SSID       "host"
+#define HOST_IP         { 127, 0, 0, 1 }
+
+static const uint8_t s_mac[6] = { 0x02, 0x00, 0x00, 0x4c, 0x46, 0x01 };
+
+// Codec
+
+struct audio_hal {
+    int volume;
+    bool running;
+};
+
+static struct audio_hal s_codec = { .volume = 50 };
+static struct audio_board_handle s_board = { .audio_hal = &s_codec };
+
+audio_board_handle_t audio_board_init(void) {
+    return &s_board;
+}
+
+esp_err_t audio_board_sdcard_init(esp_periph_set_handle_t set, periph_sdcard_mode_t mode) {
+    ESP_LOGI(TAG, "SD card mounted from %s", host_vfs_get_root());
+    return ESP_OK;
+}
+
+esp_err_t audio_board_key_init(esp_periph_set_handle_t set) {
+    return ESP_OK;
+}
+
+esp_err_t audio_hal_set_volume(audio_hal_handle_t audio_hal, int volume) {
+    if (audio_hal == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    audio_hal->volume = volume < 0 ? 0 : volume > 100 ? 100 : volume;
+    return ESP_OK;
+}
+
+esp_err_t audio_hal_get_volume(audio_hal_handle_t audio_hal, int *volume) {
+    if (audio_hal == NULL || volume == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *volume = audio_hal->volume;
+    return ESP_OK;
+}
+
+esp_err_t audio_hal_ctrl_codec(audio_hal_handle_t audio_hal, audio_hal_codec_mode_t mode, audio_hal_ctrl_t audio_hal_ctrl) {
+    if (audio_hal == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    audio_hal->running = audio_hal_ctrl == AUDIO_HAL_CTRL_START;
+    return ESP_OK;
+}
+
+// The LyraT's key ids, nothing ever sends them here
+int get_input_play_id(void) { return 1; }
+int get_input_rec_id(void) { return 2; }
+int get_input_volup_id(void) { return 3; }
+int get_input_voldown_id(void) { return 4; }
+
+// Peripheral set
+
+struct esp_periph_sets {
+    audio_event_iface_handle_t iface;
+};
+
+esp_periph_set_handle_t esp_periph_set_init(esp_periph_config_t *config) {
+    struct esp_periph_sets *set = heap_caps_calloc(1, sizeof(*set), MALLOC_CAP_DEFAULT);
+    if (set == NULL) {
+        return NULL;
+    }
+    audio_event_iface_cfg_t evt_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
+    set->iface = audio_event_iface_init(&evt_cfg);
+    if (set->iface == NULL) {
+        heap_caps_free(set);
+        return NULL;
+    }
+    return set;
+}
+
+audio_event_iface_handle_t esp_periph_set_get_event_iface(esp_periph_set_handle_t periph_set_handle) {
+    return periph_set_handle ? periph_set_handle->iface : NULL;
+}
+
+esp_err_t esp_periph_set_stop_all(esp_periph_set_handle_t periph_set_handle) {
+    return ESP_OK;
+}
+
+esp_err_t esp_periph_set_destroy(esp_periph_set_handle_t periph_set_handle) {
+    if (periph_set_handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    audio_event_iface_destroy(periph_set_handle->iface);
+    heap_caps_free(periph_set_handle);
+    return ESP_OK;
+}
+
+// WiFi manager, in memory
+
+static pthread_mutex_t s_wifi_lock = PTHREAD_MUTEX_INITIALIZER;
+static wifiman_config_t s_wifi;
+
+esp_err_t wifi_manager_init(void) {
+    ESP_LOGI(TAG, "WiFi is the loopback interface, connected to \"%s\"", HOST_SSID);
+    return ESP_OK;
+}
+
+esp_err_t wifi_manager_deinit(void) {
+    return ESP_OK;
+}
+
+wifiman_state_t wifi_manager_get_state(void) {
+    return WIFIMAN_STATE_CONNECTED;
+}
+
+bool wifi_manager_is_connected(void) {
+    return true;
+}
+
+static int find_network_locked(const char *ssid) {
+    for (int i = 0; i < s_wifi.network_count; i++) {
+        if (strcmp(s_wifi.networks[i].ssid, ssid) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+esp_err_t wifi_manager_add_network(const char *ssid, const char *password) {
+    if (ssid == NULL || strlen(ssid) == 0 || strlen(ssid) > 32 || (password && strlen(password) > 64)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ESP_OK;
+    pthread_mutex_lock(&s_wifi_lock);
+    int i = find_network_locked(ssid);
+    if (i < 0) {
+        if (s_wifi.network_count == WIFI_MAX_NETWORKS) {
+            err = ESP_ERR_NO_MEM;
+            goto cleanup;
+        }
+        i = s_wifi.network_count++;
+    }
+    wifiman_network_entry_t *n = &s_wifi.networks[i];
+    memset(n, 0, sizeof(*n));
+    snprintf(n->ssid, sizeof(n->ssid), "%s", ssid);
+    snprintf(n->password, sizeof(n->password), "%s", password ? password : "");
+    n->available = strcmp(ssid, HOST_SSID) == 0;
+cleanup:
+    pthread_mutex_unlock(&s_wifi_lock);
+    return err;
+}
+
+esp_err_t wifi_manager_remove_network(const char *ssid) {
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    pthread_mutex_lock(&s_wifi_lock);
+    int i = find_network_locked(ssid);
+    if (i >= 0) {
+        memmove(&s_wifi.networks[i], &s_wifi.networks[i + 1],
+                (s_wifi.network_count - i - 1) * sizeof(wifiman_network_entry_t));
+        s_wifi.network_count--;
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&s_wifi_lock);
+    return err;
+}
+
+esp_err_t wifi_manager_get_stored_networks(wifiman_network_entry_t *networks, size_t max_networks, size_t *count) {
+    if (networks == NULL || count == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_wifi_lock);
+    size_t n = s_wifi.network_count < max_networks ? s_wifi.network_count : max_networks;
+    memcpy(networks, s_wifi.networks, n * sizeof(*networks));
+    *count = n;
+    pthread_mutex_unlock(&s_wifi_lock);
+    return ESP_OK;
+}
+
+esp_err_t wifi_manager_clear_auth_failure(const char *ssid) {
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    pthread_mutex_lock(&s_wifi_lock);
+    int i = find_network_locked(ssid);
+    if (i >= 0) {
+        s_wifi.networks[i].auth_fail_count = 0;
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&s_wifi_lock);
+    return err;
+}
+
+esp_err_t wifi_manager_clear_all_auth_failures(void) {
+    pthread_mutex_lock(&s_wifi_lock);
+    for (int i = 0; i < s_wifi.network_count; i++) {
+        s_wifi.networks[i].auth_fail_count = 0;
+    }
+    pthread_mutex_unlock(&s_wifi_lock);
+    return ESP_OK;
+}
+
+esp_err_t wifi_manager_get_connected_ssid(char *ssid, size_t len) {
+    if (ssid == NULL || len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    snprintf(ssid, len, "%s", HOST_SSID);
+    return ESP_OK;
+}
+
+esp_err_t wifi_manager_clear_all_networks(void) {
+    pthread_mutex_lock(&s_wifi_lock);
+    memset(&s_wifi, 0, sizeof(s_wifi));
+    pthread_mutex_unlock(&s_wifi_lock);
+    return ESP_OK;
+}
+
+esp_err_t wifi_manager_save_credentials(const char *ssid, const char *password) {
+    return wifi_manager_add_network(ssid, password);
+}
+
+esp_err_t wifi_manager_read_credentials(wifiman_config_t *config) {
+    if (config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_wifi_lock);
+    *config = s_wifi;
+    pthread_mutex_unlock(&s_wifi_lock);
+    return config->network_count ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t wifi_manager_clear_credentials(void) {
+    return wifi_manager_clear_all_networks();
+}
+
+esp_err_t wifi_manager_get_ip_string(char *ip_str, size_t len) {
+    if (ip_str == NULL || len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    static const uint8_t ip[4] = HOST_IP;
+    snprintf(ip_str, len, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+    return ESP_OK;
+}
+
+esp_err_t wifi_manager_reconnect(void) {
+    return ESP_OK;
+}
+
+// esp_wifi, esp_netif, esp_event, NVS
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info) {
+    memset(ap_info, 0, sizeof(*ap_info));
+    snprintf((char *)ap_info->ssid, sizeof(ap_info->ssid), "%s", HOST_SSID);
+    memcpy(ap_info->bssid, s_mac, sizeof(s_mac));
+    ap_info->primary = 6;
+    ap_info->rssi = -55;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_mac(wifi_interface_t ifx, uint8_t mac[6]) {
+    memcpy(mac, s_mac, sizeof(s_mac));
+    return ESP_OK;
+}
+
+esp_err_t esp_efuse_mac_get_default(uint8_t *mac) {
+    memcpy(mac, s_mac, sizeof(s_mac));
+    return ESP_OK;
+}
+
+esp_err_t esp_read_mac(uint8_t *mac, int type) {
+    return esp_efuse_mac_get_default(mac);
+}
+
+struct host_netif {
+    esp_netif_ip_info_t ip_info;
+};
+
+static esp_netif_t s_sta_netif;
+
+esp_err_t esp_netif_init(void) {
+    static const uint8_t ip[4] = HOST_IP;
+    memcpy(&s_sta_netif.ip_info.ip.addr, ip, 4);
+    memcpy(&s_sta_netif.ip_info.gw.addr, ip, 4);
+    s_sta_netif.ip_info.netmask.addr = 0x000000ff;
+    return ESP_OK;
+}
+
+esp_netif_t *esp_netif_create_default_wifi_sta(void) {
+    return &s_sta_netif;
+}
+
+void esp_netif_destroy_default_wifi(void *netif) {
+}
+
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *if_key) {
+    if (strcmp(if_key, "WIFI_STA_DEF") != 0) {
+        return NULL;
+    }
+    if (s_sta_netif.ip_info.ip.addr == 0) {
+        esp_netif_init();
+    }
+    return &s_sta_netif;
+}
+
+esp_err_t esp_netif_get_ip_info(esp_netif_t *netif, esp_netif_ip_info_t *ip_info) {
+    if (netif == NULL || ip_info == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *ip_info = netif->ip_info;
+    return ESP_OK;
+}
+
+esp_err_t esp_event_loop_create_default(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t base, int32_t id, esp_event_handler_t handler,
+                                              void *arg, esp_event_handler_instance_t *instance) {
+    // Nothing ever happens to the network, so nothing is ever delivered
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    return ESP_OK;
+}
+
+// Sockets the firmware reads itself (osc_server). A task waiting in recv()
+// is blocked as far as the virtual clock goes, as it would be in lwIP.
+
+ssize_t host_recv(int fd, void *buf, size_t len, int flags) {
+    host_task_set_blocked(true);
+    ssize_t n = recv(fd, buf, len, flags);
+    host_task_set_blocked(false);
+    return n;
+}
+
+// System
+
+void esp_restart(void) {
+    ESP_LOGW(TAG, "esp_restart(), ending the run");
+    host_adf_finish();
+    host_report(stdout);
+    fflush(NULL);
+    exit(0);
+}
+
+esp_reset_reason_t esp_reset_reason(void) {
+    return ESP_RST_POWERON;
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK:                        return "ESP_OK";
+        case ESP_FAIL:                      return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:                return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:           return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE:         return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:          return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:             return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED:         return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT:               return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_RESPONSE:      return "ESP_ERR_INVALID_RESPONSE";
+        case ESP_ERR_INVALID_CRC:           return "ESP_ERR_INVALID_CRC";
+        case ESP_ERR_INVALID_VERSION:       return "ESP_ERR_INVALID_VERSION";
+        case ESP_ERR_NOT_FINISHED:          return "ESP_ERR_NOT_FINISHED";
+        case ESP_ERR_NVS_NOT_INITIALIZED:   return "ESP_ERR_NVS_NOT_INITIALIZED";
+        case ESP_ERR_NVS_NOT_FOUND:         return "ESP_ERR_NVS_NOT_FOUND";
+        case ESP_ERR_NVS_NO_FREE_PAGES:     return "ESP_ERR_NVS_NO_FREE_PAGES";
+        case ESP_ERR_NVS_NEW_VERSION_FOUND: return "ESP_ERR_NVS_NEW_VERSION_FOUND";
+        case ESP_ERR_WIFI_NOT_INIT:         return "ESP_ERR_WIFI_NOT_INIT";
+        case ESP_ERR_WIFI_NOT_STARTED:      return "ESP_ERR_WIFI_NOT_STARTED";
+        case ESP_ERR_WIFI_CONN:             return "ESP_ERR_WIFI_CONN";
+        case ESP_ERR_WIFI_NOT_CONNECT:      return "ESP_ERR_WIFI_NOT_CONNECT";
+        default:                            return "UNKNOWN ERROR";
+    }
+}
+
+void host_report(FILE *out) {
+    fprintf(out, "\n---- host report at %.3f s ----\n", host_time_us() / 1e6);
+    host_rtos_report(out);
+    host_heap_report(out);
+    host_vfs_stats_t vfs;
+    host_vfs_get_stats(&vfs);
+    fprintf(out, "sd card        %u files open (max %u), %u dirs open, %llu opens, %llu removes\n",
+            vfs.open_files, vfs.max_open_files, vfs.open_dirs, (unsigned long long)vfs.opens,
+            (unsigned long long)vfs.removes);
+    if (vfs.bus_ops > 0) {
+        fprintf(out, "sd bus         %llu accesses, %.1f s busy, %.1f s queued\n",
+                (unsigned long long)vfs.bus_ops, vfs.bus_busy_us / 1e6, vfs.bus_wait_us / 1e6);
+    }
+    host_flash_stats_t flash;
+    host_flash_get_stats(&flash);
+    if (flash.present) {
+        fprintf(out, "flash          %u KB partition, %u maps live (%llu KB), %llu maps, %llu KB written, "
+                "%llu sectors erased, %llu unerased writes\n",
+                flash.size / 1024, flash.live_maps, (unsigned long long)flash.mapped_bytes / 1024,
+                (unsigned long long)flash.maps, (unsigned long long)flash.bytes_written / 1024,
+                (unsigned long long)flash.sectors_erased, (unsigned long long)flash.unerased_writes);
+    }
+    host_httpd_report(out);
+    host_adf_report(out);
+}
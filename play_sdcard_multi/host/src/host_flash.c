@@ -0,0 +1,196 @@
+// The audio partition as a host file
+//
+// --flash-image FILE stands in for the "audio" data partition at the size
+// partitions_audio.csv gives it. A new file is created erased (all 0xff),
+// a shorter one is padded out with erased bytes as if it had been flashed
+// into the partition, so an image from flash_pack.py plays directly. Without the option there is no partition, like the
+// default partition table.
+//
+// The file is mapped once, shared, and esp_partition_mmap() hands out
+// pointers into that mapping, so writes through esp_partition_write() show
+// up in it like they do in the flash cache. Writes behave like NOR: they
+// can only clear bits, and erases go by whole 4 KB sectors.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "host.h"
+
+static const char *TAG = "HOST_FLASH";
+
+#define AUDIO_LABEL         "audio"
+#define AUDIO_SUBTYPE       0x40
+#define AUDIO_ADDRESS       0x190000
+#define AUDIO_SIZE          0x270000
+#define SECTOR_SIZE         4096
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static esp_partition_t s_part;
+static bool s_present;
+static int s_fd = -1;
+static uint8_t *s_base;
+static host_flash_stats_t s_stats;
+
+bool host_flash_set_image(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "%s: %s", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    size_t size = st.st_size;
+    if (size < AUDIO_SIZE) {
+        uint8_t erased[SECTOR_SIZE];
+        memset(erased, 0xff, sizeof(erased));
+        for (size_t pos = size; pos < AUDIO_SIZE; ) {
+            size_t n = AUDIO_SIZE - pos < sizeof(erased) ? AUDIO_SIZE - pos : sizeof(erased);
+            if (pwrite(fd, erased, n, pos) != (ssize_t)n) {
+                ESP_LOGE(TAG, "%s: %s", path, strerror(errno));
+                close(fd);
+                return false;
+            }
+            pos += n;
+        }
+        ESP_LOGI(TAG, "%s padded from %zu to %u bytes", path, size, AUDIO_SIZE);
+        size = AUDIO_SIZE;
+    }
+    size -= size % SECTOR_SIZE;
+    if (size == 0) {
+        ESP_LOGE(TAG, "%s is smaller than a sector", path);
+        close(fd);
+        return false;
+    }
+
+    void *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        ESP_LOGE(TAG, "mmap %s: %s", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    s_fd = fd;
+    s_base = base;
+    s_part = (esp_partition_t){
+        .type = ESP_PARTITION_TYPE_DATA,
+        .subtype = AUDIO_SUBTYPE,
+        .address = AUDIO_ADDRESS,
+        .size = size,
+        .erase_size = SECTOR_SIZE,
+        .label = AUDIO_LABEL,
+    };
+    s_present = true;
+    return true;
+}
+
+void host_flash_get_stats(host_flash_stats_t *stats) {
+    pthread_mutex_lock(&s_lock);
+    *stats = s_stats;
+    stats->present = s_present;
+    stats->size = s_part.size;
+    pthread_mutex_unlock(&s_lock);
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label) {
+    if (!s_present || type != s_part.type || subtype != s_part.subtype ||
+        (label && strcmp(label, s_part.label) != 0)) {
+        return NULL;
+    }
+    return &s_part;
+}
+
+static bool in_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    return partition == &s_part && offset <= s_part.size && size <= s_part.size - offset;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+    if (!in_range(partition, src_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, s_base + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size) {
+    if (!in_range(partition, dst_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const uint8_t *in = src;
+    uint8_t buf[SECTOR_SIZE];
+    bool first_unerased = false;
+    pthread_mutex_lock(&s_lock);
+    esp_err_t err = ESP_OK;
+    for (size_t done = 0; done < size && err == ESP_OK; ) {
+        size_t n = size - done < sizeof(buf) ? size - done : sizeof(buf);
+        for (size_t i = 0; i < n; i++) {
+            uint8_t old = s_base[dst_offset + done + i];
+            if ((in[done + i] & ~old) && s_stats.unerased_writes++ == 0) {
+                first_unerased = true;
+            }
+            buf[i] = old & in[done + i];
+        }
+        if (pwrite(s_fd, buf, n, dst_offset + done) != (ssize_t)n) {
+            err = ESP_FAIL;
+        }
+        done += n;
+    }
+    s_stats.bytes_written += size;
+    pthread_mutex_unlock(&s_lock);
+    if (first_unerased) {
+        // the real chip would have left the old ones
+        ESP_LOGW(TAG, "Write sets bits that were never erased, near 0x%zx", dst_offset);
+    }
+    return err;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    if (offset % SECTOR_SIZE || size % SECTOR_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!in_range(partition, offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    uint8_t erased[SECTOR_SIZE];
+    memset(erased, 0xff, sizeof(erased));
+    pthread_mutex_lock(&s_lock);
+    esp_err_t err = ESP_OK;
+    for (size_t done = 0; done < size && err == ESP_OK; done += SECTOR_SIZE) {
+        if (pwrite(s_fd, erased, SECTOR_SIZE, offset + done) != SECTOR_SIZE) {
+            err = ESP_FAIL;
+        }
+        s_stats.sectors_erased++;
+    }
+    pthread_mutex_unlock(&s_lock);
+    return err;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void **out_ptr,
+                             esp_partition_mmap_handle_t *out_handle) {
+    if (!in_range(partition, offset, size)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_lock);
+    s_stats.maps++;
+    s_stats.live_maps++;
+    s_stats.mapped_bytes += size;
+    *out_handle = (esp_partition_mmap_handle_t)size;
+    pthread_mutex_unlock(&s_lock);
+    *out_ptr = s_base + offset;
+    return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) {
+    pthread_mutex_lock(&s_lock);
+    s_stats.live_maps--;
+    s_stats.mapped_bytes -= handle;
+    pthread_mutex_unlock(&s_lock);
+}
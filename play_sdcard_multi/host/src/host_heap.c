@@ -0,0 +1,421 @@
+// Simulated internal RAM and PSRAM
+//
+// The bytes come from the C library, so the sanitizers still see every
+// access. What is simulated is the bookkeeping: each heap is an address
+// space of its board size with a first fit free list, 8 byte alignment and
+// a block header per allocation, like multi_heap. That is enough for
+// fragmentation, the largest free block and the low water mark to move the
+// way they do on the ESP32, and for allocations to fail when they would.
+//
+// Routing follows the IDF with CONFIG_SPIRAM_USE_MALLOC: malloc() takes
+// internal RAM up to CONFIG_SPIRAM_MALLOC_ALWAYSINTERNAL bytes and PSRAM
+// above it, falling back to the other when one is full.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "host.h"
+#include "host_internal.h"
+#include "sdkconfig.h"
+
+#define BLOCK_ALIGN         8
+#define BLOCK_OVERHEAD      8
+#define PTR_BUCKETS         4096
+
+typedef struct free_block {
+    size_t off;
+    size_t len;
+    struct free_block *next;
+} free_block_t;
+
+typedef struct {
+    const char *name;
+    size_t total;
+    size_t free;
+    free_block_t *free_list;    // address ordered
+    host_heap_stats_t stats;
+} sim_heap_t;
+
+typedef struct ptr_entry {
+    void *ptr;
+    size_t off;
+    size_t len;                 // what the heap gave, overhead included
+    size_t size;                // what was asked for
+    host_heap_id_t heap;
+    struct ptr_entry *next;
+} ptr_entry_t;
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool s_initialized = false;
+static size_t s_sizes[HOST_HEAP_COUNT] = {
+    [HOST_HEAP_INTERNAL] = 180 * 1024,      // about what is left after WiFi and BT
+    [HOST_HEAP_SPIRAM]   = 4 * 1024 * 1024,
+};
+static sim_heap_t s_heaps[HOST_HEAP_COUNT];
+static ptr_entry_t *s_ptrs[PTR_BUCKETS];
+
+static void heap_init_locked(void) {
+    static const char *names[HOST_HEAP_COUNT] = { "internal", "spiram" };
+    for (int h = 0; h < HOST_HEAP_COUNT; h++) {
+        sim_heap_t *heap = &s_heaps[h];
+        heap->name = names[h];
+        heap->total = s_sizes[h];
+        heap->free = s_sizes[h];
+        heap->free_list = calloc(1, sizeof(free_block_t));
+        heap->free_list->len = s_sizes[h];
+        memset(&heap->stats, 0, sizeof(heap->stats));
+        heap->stats.min_free = s_sizes[h];
+    }
+    s_initialized = true;
+}
+
+static void ensure_init(void) {
+    if (!s_initialized) {
+        heap_init_locked();
+    }
+}
+
+void host_heap_configure(size_t internal_bytes, size_t spiram_bytes) {
+    pthread_mutex_lock(&s_lock);
+    if (s_initialized) {
+        fprintf(stderr, "host_heap_configure: heaps already in use, ignored\n");
+    } else {
+        if (internal_bytes) {
+            s_sizes[HOST_HEAP_INTERNAL] = internal_bytes;
+        }
+        if (spiram_bytes) {
+            s_sizes[HOST_HEAP_SPIRAM] = spiram_bytes;
+        }
+        heap_init_locked();
+    }
+    pthread_mutex_unlock(&s_lock);
+}
+
+static size_t bucket_of(const void *ptr) {
+    return ((uintptr_t)ptr >> 4) % PTR_BUCKETS;
+}
+
+static size_t largest_block(const sim_heap_t *heap) {
+    size_t largest = 0;
+    for (const free_block_t *b = heap->free_list; b; b = b->next) {
+        if (b->len > largest) {
+            largest = b->len;
+        }
+    }
+    return largest;
+}
+
+// Carves len bytes out of the first free block that holds them
+static bool heap_take(sim_heap_t *heap, size_t len, size_t *off) {
+    for (free_block_t **p = &heap->free_list; *p; p = &(*p)->next) {
+        free_block_t *b = *p;
+        if (b->len < len) {
+            continue;
+        }
+        *off = b->off;
+        b->off += len;
+        b->len -= len;
+        if (b->len == 0) {
+            *p = b->next;
+            free(b);
+        }
+        heap->free -= len;
+        if (heap->free < heap->stats.min_free) {
+            heap->stats.min_free = heap->free;
+        }
+        return true;
+    }
+    return false;
+}
+
+static void heap_give(sim_heap_t *heap, size_t off, size_t len) {
+    free_block_t **p = &heap->free_list;
+    free_block_t *prev = NULL;
+    while (*p && (*p)->off < off) {
+        prev = *p;
+        p = &(*p)->next;
+    }
+    free_block_t *next = *p;
+    heap->free += len;
+
+    if (prev && prev->off + prev->len == off) {
+        prev->len += len;
+        if (next && prev->off + prev->len == next->off) {
+            prev->len += next->len;
+            prev->next = next->next;
+            free(next);
+        }
+        return;
+    }
+    if (next && off + len == next->off) {
+        next->off = off;
+        next->len += len;
+        return;
+    }
+    free_block_t *b = malloc(sizeof(*b));
+    b->off = off;
+    b->len = len;
+    b->next = next;
+    *p = b;
+}
+
+static void *alloc_in_locked(host_heap_id_t h, size_t size) {
+    sim_heap_t *heap = &s_heaps[h];
+    size_t len = ((size + BLOCK_ALIGN - 1) & ~(size_t)(BLOCK_ALIGN - 1)) + BLOCK_OVERHEAD;
+    size_t off;
+    if (!heap_take(heap, len, &off)) {
+        return NULL;
+    }
+    void *ptr = malloc(size ? size : 1);
+    ptr_entry_t *e = malloc(sizeof(*e));
+    if (ptr == NULL || e == NULL) {
+        free(ptr);
+        free(e);
+        heap_give(heap, off, len);
+        return NULL;
+    }
+    *e = (ptr_entry_t){ .ptr = ptr, .off = off, .len = len, .size = size, .heap = h };
+    size_t b = bucket_of(ptr);
+    e->next = s_ptrs[b];
+    s_ptrs[b] = e;
+    heap->stats.blocks++;
+    heap->stats.allocs++;
+    heap->stats.alloc_bytes += size;
+    return ptr;
+}
+
+// The heaps a request may use, in the order the IDF tries them
+static int heaps_for_caps(uint32_t caps, size_t size, host_heap_id_t order[HOST_HEAP_COUNT]) {
+    if (caps & MALLOC_CAP_SPIRAM) {
+        order[0] = HOST_HEAP_SPIRAM;
+        return 1;
+    }
+    if (caps & (MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA | MALLOC_CAP_EXEC)) {
+        order[0] = HOST_HEAP_INTERNAL;
+        return 1;
+    }
+    if (size <= CONFIG_SPIRAM_MALLOC_ALWAYSINTERNAL) {
+        order[0] = HOST_HEAP_INTERNAL;
+        order[1] = HOST_HEAP_SPIRAM;
+    } else {
+        order[0] = HOST_HEAP_SPIRAM;
+        order[1] = HOST_HEAP_INTERNAL;
+    }
+    return 2;
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps) {
+    host_heap_id_t order[HOST_HEAP_COUNT];
+    int n = heaps_for_caps(caps, size, order);
+    void *ptr = NULL;
+    pthread_mutex_lock(&s_lock);
+    ensure_init();
+    for (int i = 0; i < n && ptr == NULL; i++) {
+        ptr = alloc_in_locked(order[i], size);
+    }
+    if (ptr == NULL) {
+        s_heaps[order[0]].stats.failed++;
+    }
+    pthread_mutex_unlock(&s_lock);
+    return ptr;
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+    if (size && n > SIZE_MAX / size) {
+        return NULL;
+    }
+    void *ptr = heap_caps_malloc(n * size, caps);
+    if (ptr) {
+        memset(ptr, 0, n * size);
+    }
+    return ptr;
+}
+
+// Unlinks ptr's entry, NULL when the heaps never handed it out
+static ptr_entry_t *take_entry_locked(void *ptr) {
+    for (ptr_entry_t **p = &s_ptrs[bucket_of(ptr)]; *p; p = &(*p)->next) {
+        if ((*p)->ptr == ptr) {
+            ptr_entry_t *e = *p;
+            *p = e->next;
+            return e;
+        }
+    }
+    return NULL;
+}
+
+void heap_caps_free(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&s_lock);
+    ptr_entry_t *e = take_entry_locked(ptr);
+    if (e) {
+        sim_heap_t *heap = &s_heaps[e->heap];
+        heap_give(heap, e->off, e->len);
+        heap->stats.blocks--;
+        heap->stats.frees++;
+    }
+    pthread_mutex_unlock(&s_lock);
+    // Memory from the C library directly, e.g. cJSON before its hooks are
+    // set, or strings the host libc made, still gets freed
+    free(ptr);
+    free(e);
+}
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps) {
+    if (ptr == NULL) {
+        return heap_caps_malloc(size, caps);
+    }
+    if (size == 0) {
+        heap_caps_free(ptr);
+        return NULL;
+    }
+    size_t old_size = 0;
+    pthread_mutex_lock(&s_lock);
+    for (ptr_entry_t *e = s_ptrs[bucket_of(ptr)]; e; e = e->next) {
+        if (e->ptr == ptr) {
+            old_size = e->size;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+
+    void *grown = heap_caps_malloc(size, caps);
+    if (grown == NULL) {
+        return NULL;
+    }
+    memcpy(grown, ptr, old_size < size ? old_size : size);
+    heap_caps_free(ptr);
+    return grown;
+}
+
+void *host_malloc(size_t size) {
+    return heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
+}
+
+void *host_calloc(size_t n, size_t size) {
+    return heap_caps_calloc(n, size, MALLOC_CAP_DEFAULT);
+}
+
+void *host_realloc(void *ptr, size_t size) {
+    return heap_caps_realloc(ptr, size, MALLOC_CAP_DEFAULT);
+}
+
+void host_free(void *ptr) {
+    heap_caps_free(ptr);
+}
+
+char *host_strdup(const char *s) {
+    size_t len = strlen(s) + 1;
+    char *copy = host_malloc(len);
+    if (copy) {
+        memcpy(copy, s, len);
+    }
+    return copy;
+}
+
+// Queries add up every heap the caps could allocate from, as the IDF does
+
+static int heaps_matching(uint32_t caps, host_heap_id_t out[HOST_HEAP_COUNT]) {
+    if (caps & MALLOC_CAP_SPIRAM) {
+        out[0] = HOST_HEAP_SPIRAM;
+        return 1;
+    }
+    if (caps & (MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA | MALLOC_CAP_EXEC)) {
+        out[0] = HOST_HEAP_INTERNAL;
+        return 1;
+    }
+    out[0] = HOST_HEAP_INTERNAL;
+    out[1] = HOST_HEAP_SPIRAM;
+    return 2;
+}
+
+void heap_caps_get_info(multi_heap_info_t *info, uint32_t caps) {
+    host_heap_id_t heaps[HOST_HEAP_COUNT];
+    int n = heaps_matching(caps, heaps);
+    memset(info, 0, sizeof(*info));
+    pthread_mutex_lock(&s_lock);
+    ensure_init();
+    for (int i = 0; i < n; i++) {
+        sim_heap_t *heap = &s_heaps[heaps[i]];
+        size_t free_blocks = 0;
+        for (free_block_t *b = heap->free_list; b; b = b->next) {
+            free_blocks++;
+        }
+        size_t largest = largest_block(heap);
+        info->total_free_bytes += heap->free;
+        info->total_allocated_bytes += heap->total - heap->free;
+        info->minimum_free_bytes += heap->stats.min_free;
+        info->allocated_blocks += heap->stats.blocks;
+        info->free_blocks += free_blocks;
+        info->total_blocks += heap->stats.blocks + free_blocks;
+        if (largest > info->largest_free_block) {
+            info->largest_free_block = largest;
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, caps);
+    return info.total_free_bytes;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, caps);
+    return info.largest_free_block;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, caps);
+    return info.minimum_free_bytes;
+}
+
+size_t heap_caps_get_total_size(uint32_t caps) {
+    host_heap_id_t heaps[HOST_HEAP_COUNT];
+    int n = heaps_matching(caps, heaps);
+    size_t total = 0;
+    pthread_mutex_lock(&s_lock);
+    ensure_init();
+    for (int i = 0; i < n; i++) {
+        total += s_heaps[heaps[i]].total;
+    }
+    pthread_mutex_unlock(&s_lock);
+    return total;
+}
+
+size_t esp_get_free_heap_size(void) {
+    return heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+}
+
+size_t esp_get_minimum_free_heap_size(void) {
+    return heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+}
+
+void host_heap_get_stats(host_heap_id_t h, host_heap_stats_t *stats) {
+    pthread_mutex_lock(&s_lock);
+    ensure_init();
+    *stats = s_heaps[h].stats;
+    stats->total = s_heaps[h].total;
+    stats->free = s_heaps[h].free;
+    stats->largest = largest_block(&s_heaps[h]);
+    pthread_mutex_unlock(&s_lock);
+}
+
+void host_heap_report(FILE *out) {
+    for (int h = 0; h < HOST_HEAP_COUNT; h++) {
+        host_heap_stats_t st;
+        host_heap_get_stats(h, &st);
+        fprintf(out, "heap %-9s %zu of %zu KB free, lowest %zu KB, largest block %zu KB\n",
+                s_heaps[h].name, st.free / 1024, st.total / 1024, st.min_free / 1024, st.largest / 1024);
+        fprintf(out, "               %u live blocks, %llu allocs, %llu frees, %.1f MB churn, %u failed\n",
+                st.blocks, (unsigned long long)st.allocs, (unsigned long long)st.frees,
+                st.alloc_bytes / 1e6, st.failed);
+    }
+}
@@ -0,0 +1,762 @@
+// esp_http_server on host sockets
+//
+// Follows the IDF server where the handlers can tell the difference: one
+// "httpd" task does everything, URIs match exactly, a handler returning
+// anything but ESP_OK gets its socket closed, unread request bodies are
+// drained, connections stay open between requests, and no more than
+// max_open_sockets clients are served at once. Request headers over
+// CONFIG_HTTPD_MAX_REQ_HDR_LEN (512) get a 431 as on the board.
+//
+// The session state and the server's tables are charged to internal RAM,
+// the same allocations the IDF makes.
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "esp_http_server.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "host_internal.h"
+
+static const char *TAG = "httpd";
+
+#define MAX_REQ_HDR_LEN     512
+#define MAX_REQ_LINE_LEN    (HTTPD_MAX_URI_LEN + 32)
+#define RECV_BUF_LEN        (MAX_REQ_LINE_LEN + MAX_REQ_HDR_LEN + 4)
+#define MAX_REQ_HEADERS     24
+#define DRAIN_CHUNK         512
+
+typedef struct {
+    int fd;
+    char buf[RECV_BUF_LEN];
+    size_t len;
+} session_t;
+
+typedef struct {
+    const char *name;
+    const char *value;
+} header_t;
+
+typedef struct {
+    struct server *server;
+    session_t *session;
+    // Request
+    char hdr_buf[MAX_REQ_HDR_LEN + 1];
+    header_t headers[MAX_REQ_HEADERS];
+    int n_headers;
+    size_t body_left;
+    bool keep_alive;
+    // Response
+    const char *status;
+    const char *type;
+    header_t *resp_hdrs;
+    int n_resp_hdrs;
+    bool headers_sent;
+    bool chunked;
+    bool send_failed;
+} req_aux_t;
+
+typedef struct server {
+    httpd_config_t config;
+    httpd_uri_t *handlers;
+    pthread_mutex_t handlers_lock;
+    session_t *sessions;
+    int listen_fd;
+    int stop_pipe[2];
+    SemaphoreHandle_t stopped;
+    httpd_req_t req;
+    req_aux_t aux;
+} server_t;
+
+static uint16_t s_port_override = 0;
+static pthread_mutex_t s_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static host_httpd_stats_t s_stats;
+
+#define STAT_ADD(field, n) do {                 \
+        pthread_mutex_lock(&s_stats_lock);      \
+        s_stats.field += (n);                   \
+        pthread_mutex_unlock(&s_stats_lock);    \
+    } while (0)
+
+void host_httpd_set_port(uint16_t port) {
+    s_port_override = port;
+}
+
+void host_httpd_get_stats(host_httpd_stats_t *stats) {
+    pthread_mutex_lock(&s_stats_lock);
+    *stats = s_stats;
+    pthread_mutex_unlock(&s_stats_lock);
+}
+
+void host_httpd_report(FILE *out) {
+    host_httpd_stats_t st;
+    host_httpd_get_stats(&st);
+    fprintf(out, "httpd          %llu connections (%u refused, most at once %u), %llu requests\n",
+            (unsigned long long)st.connections, st.refused, st.max_open, (unsigned long long)st.requests);
+    fprintf(out, "               %llu 4xx, %llu 5xx, %llu closed by handler error, %.1f KB in, %.1f KB out\n",
+            (unsigned long long)st.status_4xx, (unsigned long long)st.status_5xx,
+            (unsigned long long)st.closed_by_handler, st.bytes_in / 1024.0, st.bytes_out / 1024.0);
+}
+
+// Sending
+
+static esp_err_t send_all(req_aux_t *aux, const char *buf, size_t len) {
+    if (aux->send_failed) {
+        return ESP_ERR_HTTPD_RESP_SEND;
+    }
+    while (len > 0) {
+        host_task_set_blocked(true);
+        ssize_t n = send(aux->session->fd, buf, len, MSG_NOSIGNAL);
+        host_task_set_blocked(false);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            aux->send_failed = true;
+            return ESP_ERR_HTTPD_RESP_SEND;
+        }
+        STAT_ADD(bytes_out, n);
+        buf += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+static void count_status(const char *status) {
+    int code = atoi(status);
+    if (code >= 500) {
+        STAT_ADD(status_5xx, 1);
+    } else if (code >= 400) {
+        STAT_ADD(status_4xx, 1);
+    }
+}
+
+static esp_err_t send_headers(req_aux_t *aux, long content_len) {
+    char head[1024];
+    int n = snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Type: %s\r\n", aux->status, aux->type);
+    if (content_len >= 0) {
+        n += snprintf(head + n, sizeof(head) - n, "Content-Length: %ld\r\n", content_len);
+    } else {
+        n += snprintf(head + n, sizeof(head) - n, "Transfer-Encoding: chunked\r\n");
+    }
+    for (int i = 0; i < aux->n_resp_hdrs && n < (int)sizeof(head); i++) {
+        n += snprintf(head + n, sizeof(head) - n, "%s: %s\r\n", aux->resp_hdrs[i].name, aux->resp_hdrs[i].value);
+    }
+    if (n >= (int)sizeof(head) - 2) {
+        return ESP_ERR_HTTPD_RESP_HDR;
+    }
+    n += snprintf(head + n, sizeof(head) - n, "\r\n");
+    aux->headers_sent = true;
+    count_status(aux->status);
+    return send_all(aux, head, n);
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status) {
+    req_aux_t *aux = r->aux;
+    aux->status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type) {
+    req_aux_t *aux = r->aux;
+    aux->type = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value) {
+    req_aux_t *aux = r->aux;
+    // Kept by pointer like the IDF, so they must outlive the send
+    if (aux->n_resp_hdrs >= aux->server->config.max_resp_headers) {
+        return ESP_ERR_HTTPD_RESP_HDR;
+    }
+    aux->resp_hdrs[aux->n_resp_hdrs].name = field;
+    aux->resp_hdrs[aux->n_resp_hdrs].value = value;
+    aux->n_resp_hdrs++;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len) {
+    req_aux_t *aux = r->aux;
+    if (buf_len == HTTPD_RESP_USE_STRLEN) {
+        buf_len = buf ? strlen(buf) : 0;
+    }
+    esp_err_t err = send_headers(aux, buf_len);
+    if (err == ESP_OK && buf_len > 0) {
+        err = send_all(aux, buf, buf_len);
+    }
+    return err;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len) {
+    req_aux_t *aux = r->aux;
+    if (buf_len == HTTPD_RESP_USE_STRLEN) {
+        buf_len = buf ? strlen(buf) : 0;
+    }
+    esp_err_t err = ESP_OK;
+    if (!aux->headers_sent) {
+        aux->chunked = true;
+        err = send_headers(aux, -1);
+    }
+    char size[16];
+    int n = snprintf(size, sizeof(size), "%zx\r\n", (size_t)buf_len);
+    if (err == ESP_OK) {
+        err = send_all(aux, size, n);
+    }
+    if (err == ESP_OK && buf_len > 0) {
+        err = send_all(aux, buf, buf_len);
+    }
+    if (err == ESP_OK) {
+        err = send_all(aux, "\r\n", 2);
+    }
+    if (buf_len == 0) {
+        aux->chunked = false;
+    }
+    return err;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *r, httpd_err_code_t error, const char *msg) {
+    static const struct {
+        const char *status;
+        const char *msg;
+    } errors[HTTPD_ERR_CODE_MAX] = {
+        [HTTPD_500_INTERNAL_SERVER_ERROR]     = { "500 Internal Server Error", "Server has encountered an unexpected error" },
+        [HTTPD_501_METHOD_NOT_IMPLEMENTED]    = { "501 Method Not Implemented", "Server does not support this method" },
+        [HTTPD_505_VERSION_NOT_SUPPORTED]     = { "505 Version Not Supported", "HTTP version not supported by server" },
+        [HTTPD_400_BAD_REQUEST]               = { "400 Bad Request", "Bad request syntax" },
+        [HTTPD_401_UNAUTHORIZED]              = { "401 Unauthorized", "No permission -- see authorization schemes" },
+        [HTTPD_403_FORBIDDEN]                 = { "403 Forbidden", "Request forbidden -- authorization will not help" },
+        [HTTPD_404_NOT_FOUND]                 = { "404 Not Found", "Nothing matches the given URI" },
+        [HTTPD_405_METHOD_NOT_ALLOWED]        = { "405 Method Not Allowed", "Specified method is invalid for this resource" },
+        [HTTPD_408_REQ_TIMEOUT]               = { "408 Request Timeout", "Server closed this connection" },
+        [HTTPD_411_LENGTH_REQUIRED]           = { "411 Length Required", "Chunked encoding not supported" },
+        [HTTPD_414_URI_TOO_LONG]              = { "414 URI Too Long", "URI is too long" },
+        [HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE]  = { "431 Request Header Fields Too Large", "Header fields are too long" },
+    };
+    if (error < 0 || error >= HTTPD_ERR_CODE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    httpd_resp_set_status(r, errors[error].status);
+    httpd_resp_set_type(r, HTTPD_TYPE_TEXT);
+    return httpd_resp_send(r, msg ? msg : errors[error].msg, HTTPD_RESP_USE_STRLEN);
+}
+
+// Receiving
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len) {
+    req_aux_t *aux = r->aux;
+    session_t *s = aux->session;
+    if (buf_len > aux->body_left) {
+        buf_len = aux->body_left;
+    }
+    if (buf_len == 0) {
+        return 0;
+    }
+    // Whatever came in with the headers goes first
+    if (s->len > 0) {
+        size_t n = buf_len < s->len ? buf_len : s->len;
+        memcpy(buf, s->buf, n);
+        memmove(s->buf, s->buf + n, s->len - n);
+        s->len -= n;
+        aux->body_left -= n;
+        return (int)n;
+    }
+    host_task_set_blocked(true);
+    ssize_t n = recv(s->fd, buf, buf_len, 0);
+    host_task_set_blocked(false);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return HTTPD_SOCK_ERR_TIMEOUT;
+        }
+        return HTTPD_SOCK_ERR_FAIL;
+    }
+    STAT_ADD(bytes_in, n);
+    aux->body_left -= n;
+    return (int)n;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field) {
+    req_aux_t *aux = r->aux;
+    for (int i = 0; i < aux->n_headers; i++) {
+        if (strcasecmp(aux->headers[i].name, field) == 0) {
+            return strlen(aux->headers[i].value);
+        }
+    }
+    return 0;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size) {
+    req_aux_t *aux = r->aux;
+    for (int i = 0; i < aux->n_headers; i++) {
+        if (strcasecmp(aux->headers[i].name, field) == 0) {
+            size_t len = strlen(aux->headers[i].value);
+            snprintf(val, val_size, "%s", aux->headers[i].value);
+            return len < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+size_t httpd_req_get_url_query_len(httpd_req_t *r) {
+    const char *q = strchr(r->uri, '?');
+    return q ? strlen(q + 1) : 0;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len) {
+    const char *q = strchr(r->uri, '?');
+    if (q == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    snprintf(buf, buf_len, "%s", q + 1);
+    return strlen(q + 1) < buf_len ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+// Like the IDF, values come back as they were sent, still URL encoded
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size) {
+    size_t key_len = strlen(key);
+    const char *p = qry;
+    while (p && *p) {
+        const char *end = strchr(p, '&');
+        size_t pair_len = end ? (size_t)(end - p) : strlen(p);
+        if (pair_len > key_len && strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+            const char *v = p + key_len + 1;
+            size_t v_len = pair_len - key_len - 1;
+            if (val_size == 0) {
+                return ESP_ERR_HTTPD_RESULT_TRUNC;
+            }
+            size_t n = v_len < val_size - 1 ? v_len : val_size - 1;
+            memcpy(val, v, n);
+            val[n] = '\0';
+            return v_len < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+        }
+        p = end ? end + 1 : NULL;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+// Handlers
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler) {
+    server_t *server = handle;
+    esp_err_t err = ESP_ERR_HTTPD_HANDLERS_FULL;
+    pthread_mutex_lock(&server->handlers_lock);
+    for (int i = 0; i < server->config.max_uri_handlers; i++) {
+        httpd_uri_t *h = &server->handlers[i];
+        if (h->uri && strcmp(h->uri, uri_handler->uri) == 0 && h->method == uri_handler->method) {
+            err = ESP_ERR_HTTPD_HANDLER_EXISTS;
+            break;
+        }
+        if (h->uri == NULL) {
+            *h = *uri_handler;
+            err = ESP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&server->handlers_lock);
+    if (err == ESP_ERR_HTTPD_HANDLERS_FULL) {
+        ESP_LOGW(TAG, "no slots left for registering handler");
+    }
+    return err;
+}
+
+esp_err_t httpd_unregister_uri_handler(httpd_handle_t handle, const char *uri, httpd_method_t method) {
+    server_t *server = handle;
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    pthread_mutex_lock(&server->handlers_lock);
+    for (int i = 0; i < server->config.max_uri_handlers; i++) {
+        httpd_uri_t *h = &server->handlers[i];
+        if (h->uri && strcmp(h->uri, uri) == 0 && h->method == method) {
+            // Keep the table packed so a free slot ends the search
+            memmove(h, h + 1, (server->config.max_uri_handlers - i - 1) * sizeof(*h));
+            memset(&server->handlers[server->config.max_uri_handlers - 1], 0, sizeof(*h));
+            err = ESP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&server->handlers_lock);
+    return err;
+}
+
+static bool uri_matches(const server_t *server, const char *reference, const char *uri, size_t len) {
+    if (server->config.uri_match_fn) {
+        return server->config.uri_match_fn(reference, uri, len);
+    }
+    return strlen(reference) == len && strncmp(reference, uri, len) == 0;
+}
+
+// Finds the handler, or says which error to send
+static bool find_handler(server_t *server, const char *uri, int method, httpd_uri_t *out, httpd_err_code_t *err) {
+    size_t len = strcspn(uri, "?");
+    bool uri_known = false;
+    pthread_mutex_lock(&server->handlers_lock);
+    for (int i = 0; i < server->config.max_uri_handlers && server->handlers[i].uri; i++) {
+        const httpd_uri_t *h = &server->handlers[i];
+        if (uri_matches(server, h->uri, uri, len)) {
+            if (h->method == method || h->method == HTTP_ANY) {
+                *out = *h;
+                pthread_mutex_unlock(&server->handlers_lock);
+                return true;
+            }
+            uri_known = true;
+        }
+    }
+    pthread_mutex_unlock(&server->handlers_lock);
+    *err = uri_known ? HTTPD_405_METHOD_NOT_ALLOWED : HTTPD_404_NOT_FOUND;
+    return false;
+}
+
+// Requests
+
+static int parse_method(const char *m, size_t len) {
+    static const struct {
+        const char *name;
+        int method;
+    } methods[] = {
+        { "GET", HTTP_GET }, { "POST", HTTP_POST }, { "PUT", HTTP_PUT }, { "DELETE", HTTP_DELETE },
+        { "HEAD", HTTP_HEAD }, { "OPTIONS", HTTP_OPTIONS }, { "PATCH", HTTP_PATCH },
+    };
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        if (strlen(methods[i].name) == len && strncmp(methods[i].name, m, len) == 0) {
+            return methods[i].method;
+        }
+    }
+    return -2;
+}
+
+static void reset_req(server_t *server, session_t *session) {
+    req_aux_t *aux = &server->aux;
+    header_t *resp_hdrs = aux->resp_hdrs;
+    memset(&server->req, 0, sizeof(server->req));
+    memset(aux, 0, sizeof(*aux));
+    aux->resp_hdrs = resp_hdrs;
+    aux->server = server;
+    aux->session = session;
+    aux->status = HTTPD_200;
+    aux->type = HTTPD_TYPE_TEXT;
+    aux->keep_alive = true;
+    server->req.handle = server;
+    server->req.aux = aux;
+}
+
+// Reads the rest of the body the handler left, so the next request starts clean
+static bool drain_body(server_t *server) {
+    char scratch[DRAIN_CHUNK];
+    while (server->aux.body_left > 0) {
+        int n = httpd_req_recv(&server->req, scratch, sizeof(scratch));
+        if (n <= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Handles one request whose headers end at hdr_end in the session buffer.
+// Returns false when the session should be closed.
+static bool handle_request(server_t *server, session_t *s, size_t hdr_end) {
+    reset_req(server, s);
+    req_aux_t *aux = &server->aux;
+    httpd_req_t *req = &server->req;
+    STAT_ADD(requests, 1);
+
+    char *line_end = strstr(s->buf, "\r\n");
+    size_t line_len = line_end - s->buf;
+    size_t hdr_len = hdr_end - (line_len + 2);
+    char *sp1 = memchr(s->buf, ' ', line_len);
+    char *sp2 = sp1 ? memchr(sp1 + 1, ' ', line_end - sp1 - 1) : NULL;
+    bool ok = true;
+    httpd_err_code_t err = HTTPD_400_BAD_REQUEST;
+
+    if (sp1 == NULL || sp2 == NULL) {
+        ok = false;
+    } else if ((size_t)(sp2 - sp1 - 1) > HTTPD_MAX_URI_LEN) {
+        err = HTTPD_414_URI_TOO_LONG;
+        ok = false;
+    } else if (hdr_len > MAX_REQ_HDR_LEN) {
+        err = HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE;
+        ok = false;
+    }
+    if (ok) {
+        req->method = parse_method(s->buf, sp1 - s->buf);
+        memcpy((char *)req->uri, sp1 + 1, sp2 - sp1 - 1);
+        if (strncmp(sp2 + 1, "HTTP/1.0", 8) == 0) {
+            aux->keep_alive = false;
+        } else if (strncmp(sp2 + 1, "HTTP/1.1", 8) != 0) {
+            err = HTTPD_505_VERSION_NOT_SUPPORTED;
+            ok = false;
+        }
+    }
+    if (ok) {
+        // Headers, split in place in a copy the handler can query
+        memcpy(aux->hdr_buf, line_end + 2, hdr_len);
+        aux->hdr_buf[hdr_len] = '\0';
+        char *save = NULL;
+        for (char *h = strtok_r(aux->hdr_buf, "\r\n", &save); h; h = strtok_r(NULL, "\r\n", &save)) {
+            char *colon = strchr(h, ':');
+            if (colon == NULL || aux->n_headers == MAX_REQ_HEADERS) {
+                continue;
+            }
+            *colon = '\0';
+            char *v = colon + 1;
+            while (*v == ' ' || *v == '\t') {
+                v++;
+            }
+            aux->headers[aux->n_headers].name = h;
+            aux->headers[aux->n_headers].value = v;
+            aux->n_headers++;
+        }
+        char value[64];
+        if (httpd_req_get_hdr_value_str(req, "Content-Length", value, sizeof(value)) == ESP_OK) {
+            req->content_len = strtoul(value, NULL, 10);
+        } else if (httpd_req_get_hdr_value_str(req, "Transfer-Encoding", value, sizeof(value)) == ESP_OK) {
+            err = HTTPD_411_LENGTH_REQUIRED;
+            ok = false;
+        }
+        if (httpd_req_get_hdr_value_str(req, "Connection", value, sizeof(value)) == ESP_OK) {
+            aux->keep_alive = strcasecmp(value, "close") != 0;
+        }
+        aux->body_left = req->content_len;
+    }
+
+    // Body bytes that came in with the headers stay at the front
+    memmove(s->buf, s->buf + hdr_end, s->len - hdr_end);
+    s->len -= hdr_end;
+
+    httpd_uri_t handler;
+    if (ok && req->method >= -1 && find_handler(server, req->uri, req->method, &handler, &err)) {
+        req->user_ctx = handler.user_ctx;
+        ESP_LOGD(TAG, "%s %s", "request", req->uri);
+        if (handler.handler(req) != ESP_OK) {
+            ESP_LOGW(TAG, "uri handler execution failed for %s", req->uri);
+            STAT_ADD(closed_by_handler, 1);
+            return false;
+        }
+    } else {
+        if (ok && req->method < -1) {
+            err = HTTPD_501_METHOD_NOT_IMPLEMENTED;
+        }
+        httpd_resp_send_err(req, err, NULL);
+        // The IDF closes the session after an error it sends itself
+        return false;
+    }
+    if (aux->send_failed || !drain_body(server)) {
+        return false;
+    }
+    return aux->keep_alive;
+}
+
+// Reads what the client sent and serves every complete request in it
+static bool session_readable(server_t *server, session_t *s) {
+    if (s->len == sizeof(s->buf)) {
+        return false;
+    }
+    ssize_t n = recv(s->fd, s->buf + s->len, sizeof(s->buf) - 1 - s->len, 0);
+    if (n <= 0) {
+        return false;
+    }
+    STAT_ADD(bytes_in, n);
+    s->len += n;
+    s->buf[s->len] = '\0';
+
+    for (;;) {
+        char *end = strstr(s->buf, "\r\n\r\n");
+        if (end == NULL) {
+            if (s->len >= sizeof(s->buf) - 1) {
+                // Never got to the end of the headers
+                reset_req(server, s);
+                httpd_resp_send_err(&server->req, strstr(s->buf, "\r\n") ? HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE
+                                                                       : HTTPD_414_URI_TOO_LONG, NULL);
+                return false;
+            }
+            return true;
+        }
+        if (!handle_request(server, s, end + 4 - s->buf)) {
+            return false;
+        }
+        s->buf[s->len] = '\0';
+    }
+}
+
+static void close_session(session_t *s) {
+    close(s->fd);
+    s->fd = -1;
+    s->len = 0;
+    pthread_mutex_lock(&s_stats_lock);
+    s_stats.open--;
+    pthread_mutex_unlock(&s_stats_lock);
+}
+
+static void accept_client(server_t *server) {
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    STAT_ADD(connections, 1);
+    session_t *free_slot = NULL;
+    for (int i = 0; i < server->config.max_open_sockets; i++) {
+        if (server->sessions[i].fd < 0) {
+            free_slot = &server->sessions[i];
+            break;
+        }
+    }
+    if (free_slot == NULL) {
+        // What a browser opening a seventh connection sees on the board
+        ESP_LOGW(TAG, "error in accept, no free session slot");
+        close(fd);
+        STAT_ADD(refused, 1);
+        return;
+    }
+    struct timeval tv = { .tv_sec = server->config.recv_wait_timeout };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    tv.tv_sec = server->config.send_wait_timeout;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    free_slot->fd = fd;
+    free_slot->len = 0;
+
+    pthread_mutex_lock(&s_stats_lock);
+    s_stats.open++;
+    if (s_stats.open > s_stats.max_open) {
+        s_stats.max_open = s_stats.open;
+    }
+    pthread_mutex_unlock(&s_stats_lock);
+}
+
+static void httpd_server_task(void *arg) {
+    server_t *server = arg;
+    int max = server->config.max_open_sockets;
+    struct pollfd *fds = calloc(max + 2, sizeof(*fds));
+
+    for (;;) {
+        int n = 0;
+        fds[n++] = (struct pollfd){ .fd = server->stop_pipe[0], .events = POLLIN };
+        fds[n++] = (struct pollfd){ .fd = server->listen_fd, .events = POLLIN };
+        for (int i = 0; i < max; i++) {
+            fds[n++] = (struct pollfd){ .fd = server->sessions[i].fd, .events = POLLIN };
+        }
+        host_task_set_blocked(true);
+        int ready = poll(fds, n, -1);
+        host_task_set_blocked(false);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ESP_LOGE(TAG, "poll: %s", strerror(errno));
+            break;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+        for (int i = 0; i < max; i++) {
+            session_t *s = &server->sessions[i];
+            if (s->fd >= 0 && fds[2 + i].revents && !session_readable(server, s)) {
+                close_session(s);
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            accept_client(server);
+        }
+    }
+
+    for (int i = 0; i < max; i++) {
+        if (server->sessions[i].fd >= 0) {
+            close_session(&server->sessions[i]);
+        }
+    }
+    free(fds);
+    xSemaphoreGive(server->stopped);
+    vTaskDelete(NULL);
+}
+
+static void free_server(server_t *server) {
+    if (server->listen_fd >= 0) {
+        close(server->listen_fd);
+    }
+    if (server->stop_pipe[0] >= 0) {
+        close(server->stop_pipe[0]);
+        close(server->stop_pipe[1]);
+    }
+    if (server->stopped) {
+        vSemaphoreDelete(server->stopped);
+    }
+    pthread_mutex_destroy(&server->handlers_lock);
+    heap_caps_free(server->handlers);
+    heap_caps_free(server->sessions);
+    heap_caps_free(server->aux.resp_hdrs);
+    heap_caps_free(server);
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config) {
+    esp_err_t err = ESP_OK;
+    const uint32_t caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    server_t *server = heap_caps_calloc(1, sizeof(*server), caps);
+    if (server == NULL) {
+        return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+    server->config = *config;
+    server->listen_fd = -1;
+    server->stop_pipe[0] = server->stop_pipe[1] = -1;
+    pthread_mutex_init(&server->handlers_lock, NULL);
+    server->handlers = heap_caps_calloc(config->max_uri_handlers, sizeof(httpd_uri_t), caps);
+    server->sessions = heap_caps_calloc(config->max_open_sockets, sizeof(session_t), caps);
+    server->aux.resp_hdrs = heap_caps_calloc(config->max_resp_headers, sizeof(header_t), caps);
+    server->stopped = xSemaphoreCreateBinary();
+    if (server->handlers == NULL || server->sessions == NULL || server->aux.resp_hdrs == NULL ||
+        server->stopped == NULL) {
+        err = ESP_ERR_HTTPD_ALLOC_MEM;
+        goto cleanup;
+    }
+    for (int i = 0; i < config->max_open_sockets; i++) {
+        server->sessions[i].fd = -1;
+    }
+
+    uint16_t port = s_port_override ? s_port_override : config->server_port;
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    if (server->listen_fd < 0 || bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(server->listen_fd, config->backlog_conn) != 0 || pipe(server->stop_pipe) != 0) {
+        ESP_LOGE(TAG, "can't listen on port %u: %s", port, strerror(errno));
+        err = ESP_ERR_HTTPD_TASK;
+        goto cleanup;
+    }
+    if (xTaskCreatePinnedToCore(httpd_server_task, "httpd", config->stack_size, server,
+                                config->task_priority, NULL, config->core_id) != pdPASS) {
+        err = ESP_ERR_HTTPD_TASK;
+        goto cleanup;
+    }
+    ESP_LOGI(TAG, "listening on http://127.0.0.1:%u", port);
+    *handle = server;
+    return ESP_OK;
+
+cleanup:
+    free_server(server);
+    return err;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle) {
+    server_t *server = handle;
+    if (server == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ssize_t rc = write(server->stop_pipe[1], "x", 1);
+    (void)rc;
+    xSemaphoreTake(server->stopped, portMAX_DELAY);
+    free_server(server);
+    return ESP_OK;
+}
@@ -0,0 +1,44 @@
+// Shared between the host stand-ins, not part of any IDF or ADF API
+
+#ifndef HOST_INTERNAL_H
+#define HOST_INTERNAL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "host.h"
+
+// Every blocking wait in the stand-ins goes through these, so the task
+// state seen by uxTaskGetSystemState() is right and there is one place
+// that decides what time it is
+
+/** Initializes a condition variable on the host clock */
+void host_cond_init(pthread_cond_t *cond);
+/**
+ * @brief Waits on cond until signalled or deadline_us (host_time_us)
+ *
+ * @param deadline_us -1 to wait forever
+ * @return false on timeout
+ */
+bool host_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, int64_t deadline_us);
+/**
+ * @brief Wakes the waiters on cond, with their mutex held
+ *
+ * Use these instead of pthread_cond_broadcast and pthread_cond_signal on
+ * anything host_cond_wait waits on, the virtual clock needs to see the wake.
+ */
+void host_cond_broadcast(pthread_cond_t *cond);
+void host_cond_signal(pthread_cond_t *cond);
+/** Deadline for a FreeRTOS timeout: -1 for portMAX_DELAY */
+int64_t host_deadline(TickType_t ticks);
+
+/** Marks the calling task blocked in something the clock can't see, such as poll() */
+void host_task_set_blocked(bool blocked);
+
+void host_rtos_report(FILE *out);
+void host_httpd_report(FILE *out);
+void host_heap_report(FILE *out);
+
+#endif // HOST_INTERNAL_H
@@ -0,0 +1,100 @@
+// esp_log on the host
+//
+// Per tag levels, "*" as the default, and a replaceable vprintf like the
+// IDF's, so log_buffer.c hooks in exactly as it does on the board.
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "host.h"
+
+#define MAX_TAG_LEVELS  32
+#define MAX_TAG_LEN     32
+
+typedef struct {
+    char tag[MAX_TAG_LEN];
+    esp_log_level_t level;
+} tag_level_t;
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static tag_level_t s_tags[MAX_TAG_LEVELS];
+static int s_n_tags = 0;
+static esp_log_level_t s_default = (esp_log_level_t)CONFIG_LOG_DEFAULT_LEVEL;
+static esp_log_level_t s_max = ESP_LOG_VERBOSE;
+
+static int default_vprintf(const char *fmt, va_list ap) {
+    return vfprintf(stderr, fmt, ap);
+}
+
+static vprintf_like_t s_vprintf = default_vprintf;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    pthread_mutex_lock(&s_lock);
+    if (strcmp(tag, "*") == 0) {
+        // Like the IDF, the default wins over everything set so far
+        s_default = level;
+        s_n_tags = 0;
+        goto done;
+    }
+    for (int i = 0; i < s_n_tags; i++) {
+        if (strcmp(s_tags[i].tag, tag) == 0) {
+            s_tags[i].level = level;
+            goto done;
+        }
+    }
+    if (s_n_tags < MAX_TAG_LEVELS) {
+        snprintf(s_tags[s_n_tags].tag, MAX_TAG_LEN, "%s", tag);
+        s_tags[s_n_tags].level = level;
+        s_n_tags++;
+    }
+done:
+    pthread_mutex_unlock(&s_lock);
+}
+
+esp_log_level_t esp_log_level_get(const char *tag) {
+    esp_log_level_t level = s_default;
+    pthread_mutex_lock(&s_lock);
+    for (int i = 0; i < s_n_tags; i++) {
+        if (strcmp(s_tags[i].tag, tag) == 0) {
+            level = s_tags[i].level;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+    return level;
+}
+
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func) {
+    pthread_mutex_lock(&s_lock);
+    vprintf_like_t previous = s_vprintf;
+    s_vprintf = func;
+    pthread_mutex_unlock(&s_lock);
+    return previous;
+}
+
+void host_log_set_max_level(esp_log_level_t level) {
+    pthread_mutex_lock(&s_lock);
+    s_max = level;
+    pthread_mutex_unlock(&s_lock);
+}
+
+uint32_t esp_log_timestamp(void) {
+    return (uint32_t)(host_time_us() / 1000);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    pthread_mutex_lock(&s_lock);
+    esp_log_level_t max = s_max;
+    vprintf_like_t out = s_vprintf;
+    pthread_mutex_unlock(&s_lock);
+    if (level > max || level > esp_log_level_get(tag)) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, format);
+    out(format, ap);
+    va_end(ap);
+}
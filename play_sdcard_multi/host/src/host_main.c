@@ -0,0 +1,319 @@
+// loudframe_host: the play_sdcard_multi control plane on Linux
+//
+// Starts app_main() in a "main" task the way the IDF does and lets it run:
+// the audio control task, the HTTP API on a local port, the SD card in a
+// host directory. Runs until --duration is up or SIGINT, then prints what
+// the stand-ins counted. Exit status is 1 when --max-underruns was exceeded,
+// so a load test can fail on glitches as well as on HTTP errors.
+//
+// --soak runs the same thing on the virtual clock with the soak driver
+// generating traffic, and fails on leaks as well.
+//
+// --bench NAME doesn't start the app; it times one of the kernels and
+// exits.
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "host.h"
+
+static const char *TAG = "loudframe_host";
+
+#define MAIN_TASK_STACK     4096    // CONFIG_ESP_MAIN_TASK_STACK_SIZE
+#define MAIN_TASK_PRIO      1
+
+void app_main(void);
+
+typedef struct {
+    uint16_t port;
+    const char *sd_root;
+    uint32_t sd_kbps;
+    const char *flash_image;
+    const char *tap;
+    double duration_s;          // 0 to run until SIGINT, -1 for the default
+    long max_underruns;         // -1 for no limit
+    bool virtual_clock;
+    bool soak;
+    const char *soak_report;
+    double soak_sample_s;
+    double max_leak_kb_day;
+    const char *bench;
+    esp_log_level_t log_level;
+    size_t internal_kb;
+    size_t spiram_kb;
+} host_options_t;
+
+static volatile sig_atomic_t s_interrupted = 0;
+
+static void usage(FILE *out) {
+    fprintf(out,
+        "usage: loudframe_host [options]\n"
+        "\n"
+        "  --port N              HTTP port on 127.0.0.1 (default 8080)\n"
+        "  --sd DIR              host directory standing in for /sdcard\n"
+        "                        (default: a new temp directory with three test tones)\n"
+        "  --sd-kbps N           card reads and writes share a bus of N KB/s (default: disk speed)\n"
+        "  --flash-image FILE    host file standing in for the audio flash partition,\n"
+        "                        created erased if it doesn't exist (default: no partition)\n"
+        "  --duration T          how long to run, in seconds or with s, m, h or d\n"
+        "                        (default: until Ctrl-C)\n"
+        "  --tap FILE.wav        write everything the I2S element played, silence included\n"
+        "  --max-underruns N     exit 1 if there were more than N underruns\n"
+        "  --log-level e|w|i|d   most verbose level printed (default i)\n"
+        "  --internal-kb N       internal heap size (default 180)\n"
+        "  --spiram-kb N         PSRAM heap size (default 4096)\n"
+        "  --virtual-clock       time only passes when every task waits, as fast as the host can go\n"
+        "  --soak                virtual clock plus built-in API traffic, fails on leaks\n"
+        "                        (default duration 7d)\n"
+        "  --soak-report FILE    write the soak samples and verdict as JSON\n"
+        "  --soak-sample T       how often the soak samples heaps and descriptors (default 1h)\n"
+        "  --max-leak-kb-day N   heap growth that fails the soak (default 16)\n"
+        "  --bench NAME          time a kernel on the host and exit: convolver, spectrum, status\n");
+}
+
+static bool parse_level(const char *s, esp_log_level_t *level) {
+    switch (s[0]) {
+        case 'e': *level = ESP_LOG_ERROR; return true;
+        case 'w': *level = ESP_LOG_WARN; return true;
+        case 'i': *level = ESP_LOG_INFO; return true;
+        case 'd': *level = ESP_LOG_DEBUG; return true;
+        case 'v': *level = ESP_LOG_VERBOSE; return true;
+        default: return false;
+    }
+}
+
+// Seconds, or a number with an s, m, h or d suffix
+static bool parse_duration(const char *s, double *seconds) {
+    char *end;
+    double v = strtod(s, &end);
+    double unit = 1;
+    switch (*end) {
+        case '\0': case 's': break;
+        case 'm': unit = 60; break;
+        case 'h': unit = 3600; break;
+        case 'd': unit = 86400; break;
+        default: return false;
+    }
+    if (*end && end[1]) {
+        return false;
+    }
+    *seconds = v * unit;
+    return end != s && v >= 0;
+}
+
+static bool parse_args(int argc, char **argv, host_options_t *opt) {
+    static const struct option longopts[] = {
+        { "port",          required_argument, 0, 'p' },
+        { "sd",            required_argument, 0, 's' },
+        { "sd-kbps",       required_argument, 0, 'B' },
+        { "flash-image",   required_argument, 0, 'F' },
+        { "duration",      required_argument, 0, 't' },
+        { "tap",           required_argument, 0, 'o' },
+        { "max-underruns", required_argument, 0, 'u' },
+        { "log-level",     required_argument, 0, 'L' },
+        { "internal-kb",   required_argument, 0, 'I' },
+        { "spiram-kb",     required_argument, 0, 'P' },
+        { "virtual-clock", no_argument,       0, 'V' },
+        { "soak",          no_argument,       0, 'S' },
+        { "soak-report",   required_argument, 0, 'R' },
+        { "soak-sample",   required_argument, 0, 'T' },
+        { "max-leak-kb-day", required_argument, 0, 'K' },
+        { "bench",         required_argument, 0, 'b' },
+        { "help",          no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "h", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'p':
+                opt->port = (uint16_t)atoi(optarg);
+                break;
+            case 's':
+                opt->sd_root = optarg;
+                break;
+            case 'B':
+                opt->sd_kbps = strtoul(optarg, NULL, 0);
+                break;
+            case 'F':
+                opt->flash_image = optarg;
+                break;
+            case 't':
+                if (!parse_duration(optarg, &opt->duration_s)) {
+                    fprintf(stderr, "bad duration: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'o':
+                opt->tap = optarg;
+                break;
+            case 'u':
+                opt->max_underruns = atol(optarg);
+                break;
+            case 'L':
+                if (!parse_level(optarg, &opt->log_level)) {
+                    fprintf(stderr, "bad log level: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'I':
+                opt->internal_kb = strtoul(optarg, NULL, 0);
+                break;
+            case 'P':
+                opt->spiram_kb = strtoul(optarg, NULL, 0);
+                break;
+            case 'V':
+                opt->virtual_clock = true;
+                break;
+            case 'S':
+                opt->soak = true;
+                opt->virtual_clock = true;
+                break;
+            case 'R':
+                opt->soak_report = optarg;
+                break;
+            case 'T':
+                if (!parse_duration(optarg, &opt->soak_sample_s) || opt->soak_sample_s <= 0) {
+                    fprintf(stderr, "bad sample period: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'K':
+                opt->max_leak_kb_day = atof(optarg);
+                break;
+            case 'b':
+                opt->bench = optarg;
+                break;
+            case 'h':
+                usage(stdout);
+                exit(0);
+            default:
+                usage(stderr);
+                return false;
+        }
+    }
+    if (optind != argc) {
+        usage(stderr);
+        return false;
+    }
+    return true;
+}
+
+static void main_task(void *arg) {
+    app_main();
+    // app_main only returns on a fatal setup error
+    ESP_LOGE(TAG, "app_main returned");
+    vTaskDelete(NULL);
+}
+
+static void on_sigint(int sig) {
+    s_interrupted = 1;
+}
+
+int main(int argc, char **argv) {
+    host_options_t opt = {
+        .port = 8080,
+        .duration_s = -1,
+        .max_underruns = -1,
+        .log_level = ESP_LOG_INFO,
+        .internal_kb = 180,
+        .spiram_kb = 4096,
+        .soak_sample_s = 3600,
+        .max_leak_kb_day = 16,
+    };
+    if (!parse_args(argc, argv, &opt)) {
+        return 2;
+    }
+    if (opt.duration_s < 0) {
+        opt.duration_s = opt.soak ? 7 * 86400 : 0;
+    }
+
+    host_heap_configure(opt.internal_kb * 1024, opt.spiram_kb * 1024);
+    host_log_set_max_level(opt.log_level);
+    if (opt.bench) {
+        return host_bench_run(opt.bench, stdout);
+    }
+    host_httpd_set_port(opt.port);
+    if (opt.sd_root) {
+        host_vfs_set_root(opt.sd_root);
+    }
+    printf("sd card        %s\n", host_vfs_get_root());
+    if (opt.sd_kbps) {
+        host_vfs_set_bus_kbps(opt.sd_kbps);
+        printf("sd bus         %u KB/s\n", opt.sd_kbps);
+    }
+    if (opt.flash_image) {
+        if (!host_flash_set_image(opt.flash_image)) {
+            host_vfs_finish();
+            return 2;
+        }
+        printf("flash          %s\n", opt.flash_image);
+    }
+    printf("http           http://127.0.0.1:%u/\n", opt.port);
+    fflush(stdout);
+    if (opt.tap) {
+        host_adf_set_tap(opt.tap);
+    }
+
+    struct sigaction sa = { .sa_handler = on_sigint };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    struct timespec real_start;
+    clock_gettime(CLOCK_MONOTONIC, &real_start);
+    if (opt.virtual_clock) {
+        // From here this thread counts as a task, it must only wait in host_sleep_until
+        host_clock_set_virtual();
+    }
+
+    xTaskCreatePinnedToCore(main_task, "main", MAIN_TASK_STACK, NULL, MAIN_TASK_PRIO, NULL, 0);
+    if (opt.soak) {
+        host_soak_config_t soak = {
+            .port = opt.port,
+            .sample_us = (int64_t)(opt.soak_sample_s * 1e6),
+            .report_path = opt.soak_report,
+        };
+        host_soak_start(&soak);
+    }
+
+    int64_t end_us = opt.duration_s > 0 ? host_time_us() + (int64_t)(opt.duration_s * 1e6) : -1;
+    while (!s_interrupted && (end_us < 0 || host_time_us() < end_us)) {
+        if (opt.virtual_clock) {
+            // Every wake is a clock step, and a virtual second is short
+            host_sleep_until(host_time_us() + 1000 * 1000);
+        } else {
+            usleep(50 * 1000);
+        }
+    }
+
+    // The tasks keep running while the report is taken; they are not
+    // stopped first, so leaks show up as they would at any moment on the board
+    host_adf_finish();
+    host_report(stdout);
+    fflush(stdout);
+
+    host_i2s_stats_t i2s;
+    host_adf_get_i2s_stats(&i2s);
+    bool failed = opt.max_underruns >= 0 && i2s.underruns > (uint64_t)opt.max_underruns;
+    if (opt.soak) {
+        struct timespec real_end;
+        clock_gettime(CLOCK_MONOTONIC, &real_end);
+        host_soak_limits_t limits = {
+            .max_leak_kb_per_day = opt.max_leak_kb_day,
+            .max_underruns = opt.max_underruns,
+            .real_seconds = (real_end.tv_sec - real_start.tv_sec) + (real_end.tv_nsec - real_start.tv_nsec) / 1e9,
+        };
+        failed = !host_soak_finish(stdout, &limits) || failed;
+        fflush(stdout);
+    }
+    host_vfs_finish();
+    _exit(failed ? 1 : 0);
+}
@@ -0,0 +1,877 @@
+// FreeRTOS on pthreads
+//
+// Every task is a thread and they all really run at once, which is the
+// point: the handlers, the audio control task and the ADF element tasks
+// race for the same state the way they do on two cores. Priorities and
+// affinity are kept for the task list but not enforced. Stacks are charged
+// to the simulated heaps, the threads themselves run on big host stacks.
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "host_internal.h"
+
+static const char *TAG = "HOST_RTOS";
+
+#define HOST_THREAD_STACK       (512 * 1024)
+#define TCB_BYTES               352     // sizeof(StaticTask_t) on the ESP32
+
+struct host_task {
+    char name[configMAX_TASK_NAME_LEN];
+    TaskFunction_t fn;
+    void *arg;
+    UBaseType_t priority;
+    BaseType_t core;
+    uint32_t stack_size;
+    void *stack;                // charged to the heap, never touched
+    void *tcb;
+    UBaseType_t number;
+    pthread_t thread;
+    clockid_t cpu_clock;
+    bool has_cpu_clock;
+    atomic_int state;           // eTaskState, read by uxTaskGetSystemState() from any thread
+    struct host_task *next;
+};
+
+static pthread_mutex_t s_tasks_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct host_task *s_tasks = NULL;
+static UBaseType_t s_task_count = 0;
+static UBaseType_t s_next_number = 1;
+static uint64_t s_tasks_created = 0;
+static uint64_t s_tasks_deleted = 0;
+static uint32_t s_tasks_failed = 0;
+static __thread struct host_task *t_self = NULL;
+
+static struct host_task s_idle[portNUM_PROCESSORS];
+
+// Clock
+//
+// Real time unless host_clock_set_virtual() was called. The virtual clock
+// only moves when every task is blocked: it then jumps to the earliest
+// deadline anybody waits for. A run goes as fast as the host gets through
+// the work, and the audio path still sees the DMA drain at the sample rate.
+//
+// For that the clock has to know who is running. Tasks count from creation,
+// host_cond_wait() and host_task_set_blocked() take them out, and
+// host_cond_broadcast() puts the waiters it wakes back in before they run,
+// so there is no window in which everything looks blocked but isn't.
+
+typedef struct clock_waiter {
+    pthread_cond_t *cond;
+    pthread_mutex_t *mutex;
+    int64_t deadline_us;        // -1 for none
+    bool clocked;
+    bool woken;
+    bool kick;                  // woken by the clock, cond not broadcast yet
+    struct clock_waiter *next;
+} clock_waiter_t;
+
+static bool s_virtual = false;
+static _Atomic int64_t s_virtual_us = 0;
+static pthread_mutex_t s_clock_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_clock_idle;         // the clock thread waits on this
+static int s_clock_running = 0;             // clocked threads not blocked
+static clock_waiter_t *s_clock_waiters = NULL;
+static uint64_t s_clock_jumps = 0;
+static uint32_t s_clock_stalls = 0;
+static __thread bool t_clocked = false;
+
+static int64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t s_epoch_us = 0;
+static pthread_once_t s_epoch_once = PTHREAD_ONCE_INIT;
+
+static void init_epoch(void) {
+    s_epoch_us = monotonic_us();
+}
+
+static int64_t real_time_us(void) {
+    pthread_once(&s_epoch_once, init_epoch);
+    return monotonic_us() - s_epoch_us;
+}
+
+int64_t host_time_us(void) {
+    if (s_virtual) {
+        return atomic_load_explicit(&s_virtual_us, memory_order_acquire);
+    }
+    return real_time_us();
+}
+
+int64_t esp_timer_get_time(void) {
+    return host_time_us();
+}
+
+void host_cond_init(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// With s_clock_lock held
+static void clock_block_locked(void) {
+    if (--s_clock_running == 0) {
+        pthread_cond_signal(&s_clock_idle);
+    }
+}
+
+static void *clock_thread(void *arg) {
+    pthread_mutex_lock(&s_clock_lock);
+    for (;;) {
+        while (s_clock_running > 0) {
+            pthread_cond_wait(&s_clock_idle, &s_clock_lock);
+        }
+        int64_t next = INT64_MAX;
+        for (clock_waiter_t *w = s_clock_waiters; w; w = w->next) {
+            if (!w->woken && w->deadline_us >= 0 && w->deadline_us < next) {
+                next = w->deadline_us;
+            }
+        }
+        if (next == INT64_MAX) {
+            // Every task waits for another one: only something outside,
+            // such as an HTTP client, can get this going again
+            if (s_clock_stalls++ == 0) {
+                ESP_LOGW(TAG, "Virtual clock stalled at %.3f s, no task has a timeout",
+                         atomic_load(&s_virtual_us) / 1e6);
+            }
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 10 * 1000 * 1000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&s_clock_idle, &s_clock_lock, &ts);
+            continue;
+        }
+        if (next > atomic_load(&s_virtual_us)) {
+            atomic_store_explicit(&s_virtual_us, next, memory_order_release);
+            s_clock_jumps++;
+        }
+        for (clock_waiter_t *w = s_clock_waiters; w; w = w->next) {
+            if (!w->woken && w->deadline_us >= 0 && w->deadline_us <= next) {
+                w->woken = true;
+                w->kick = true;
+                if (w->clocked) {
+                    s_clock_running++;
+                }
+            }
+        }
+        // A waiter that registered but hasn't reached pthread_cond_wait yet
+        // still holds its mutex, and would miss a broadcast now. Getting
+        // the mutex proves it is waiting. A registered waiter's mutex can't
+        // go away, and trylock can't deadlock against mutex -> s_clock_lock.
+        for (;;) {
+            bool pending = false;
+            for (clock_waiter_t *w = s_clock_waiters; w; w = w->next) {
+                if (!w->kick) {
+                    continue;
+                }
+                if (pthread_mutex_trylock(w->mutex) == 0) {
+                    w->kick = false;
+                    pthread_cond_broadcast(w->cond);
+                    pthread_mutex_unlock(w->mutex);
+                } else {
+                    pending = true;
+                }
+            }
+            if (!pending) {
+                break;
+            }
+            pthread_mutex_unlock(&s_clock_lock);
+            sched_yield();
+            pthread_mutex_lock(&s_clock_lock);
+        }
+    }
+    return NULL;
+}
+
+void host_clock_set_virtual(void) {
+    pthread_cond_init(&s_clock_idle, NULL);
+    pthread_once(&s_epoch_once, init_epoch);
+    s_virtual = true;
+    // The caller counts as running until it blocks
+    t_clocked = true;
+    s_clock_running = 1;
+    pthread_t thread;
+    pthread_create(&thread, NULL, clock_thread, NULL);
+    pthread_detach(thread);
+}
+
+bool host_clock_is_virtual(void) {
+    return s_virtual;
+}
+
+static void set_task_state(eTaskState state) {
+    if (t_self) {
+        atomic_store_explicit(&t_self->state, state, memory_order_relaxed);
+    }
+}
+
+void host_task_set_blocked(bool blocked) {
+    set_task_state(blocked ? eBlocked : eRunning);
+    if (s_virtual && t_clocked) {
+        pthread_mutex_lock(&s_clock_lock);
+        if (blocked) {
+            clock_block_locked();
+        } else {
+            s_clock_running++;
+        }
+        pthread_mutex_unlock(&s_clock_lock);
+    }
+}
+
+static void abs_monotonic(int64_t abs_us, struct timespec *ts) {
+    ts->tv_sec = abs_us / 1000000;
+    ts->tv_nsec = (abs_us % 1000000) * 1000;
+}
+
+static bool virtual_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, int64_t deadline_us) {
+    clock_waiter_t w = {
+        .cond = cond,
+        .mutex = mutex,
+        .deadline_us = deadline_us,
+        .clocked = t_clocked,
+    };
+    pthread_mutex_lock(&s_clock_lock);
+    w.next = s_clock_waiters;
+    s_clock_waiters = &w;
+    if (w.clocked) {
+        clock_block_locked();
+    }
+    pthread_mutex_unlock(&s_clock_lock);
+
+    for (;;) {
+        // host_cond_broadcast() callers hold mutex and the clock thread
+        // waits until it can take it, so no wake comes before this wait
+        pthread_cond_wait(cond, mutex);
+        pthread_mutex_lock(&s_clock_lock);
+        bool woken = w.woken;
+        if (woken && !w.kick) {
+            clock_waiter_t **p = &s_clock_waiters;
+            while (*p != &w) {
+                p = &(*p)->next;
+            }
+            *p = w.next;
+        }
+        pthread_mutex_unlock(&s_clock_lock);
+        if (woken && !w.kick) {
+            break;
+        }
+    }
+    return deadline_us < 0 || host_time_us() < deadline_us;
+}
+
+bool host_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, int64_t deadline_us) {
+    set_task_state(eBlocked);
+    bool signalled;
+    if (s_virtual) {
+        signalled = virtual_cond_wait(cond, mutex, deadline_us);
+    } else if (deadline_us < 0) {
+        signalled = pthread_cond_wait(cond, mutex) == 0;
+    } else {
+        struct timespec ts;
+        abs_monotonic(s_epoch_us + deadline_us, &ts);
+        signalled = pthread_cond_timedwait(cond, mutex, &ts) != ETIMEDOUT;
+    }
+    set_task_state(eRunning);
+    return signalled;
+}
+
+void host_cond_broadcast(pthread_cond_t *cond) {
+    if (s_virtual) {
+        pthread_mutex_lock(&s_clock_lock);
+        for (clock_waiter_t *w = s_clock_waiters; w; w = w->next) {
+            if (w->cond == cond && !w->woken) {
+                w->woken = true;
+                if (w->clocked) {
+                    s_clock_running++;
+                }
+            }
+        }
+        pthread_mutex_unlock(&s_clock_lock);
+    }
+    pthread_cond_broadcast(cond);
+}
+
+void host_cond_signal(pthread_cond_t *cond) {
+    if (s_virtual) {
+        // Which waiter pthread picks is unknown, so all of them run
+        host_cond_broadcast(cond);
+        return;
+    }
+    pthread_cond_signal(cond);
+}
+
+int64_t host_deadline(TickType_t ticks) {
+    if (ticks == portMAX_DELAY) {
+        return -1;
+    }
+    return host_time_us() + (int64_t)ticks * (1000000 / configTICK_RATE_HZ);
+}
+
+// Nothing ever signals this, sleeps are timed waits on it
+static pthread_mutex_t s_sleep_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_sleep_cond;
+static pthread_once_t s_sleep_once = PTHREAD_ONCE_INIT;
+
+static void init_sleep_cond(void) {
+    host_cond_init(&s_sleep_cond);
+}
+
+void host_sleep_until(int64_t deadline_us) {
+    pthread_once(&s_sleep_once, init_sleep_cond);
+    pthread_mutex_lock(&s_sleep_mutex);
+    while (host_time_us() < deadline_us) {
+        host_cond_wait(&s_sleep_cond, &s_sleep_mutex, deadline_us);
+    }
+    pthread_mutex_unlock(&s_sleep_mutex);
+}
+
+// Critical sections
+
+void spinlock_initialize(portMUX_TYPE *mux) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&mux->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void host_critical_enter(portMUX_TYPE *mux) {
+    pthread_mutex_lock(&mux->mutex);
+}
+
+void host_critical_exit(portMUX_TYPE *mux) {
+    pthread_mutex_unlock(&mux->mutex);
+}
+
+// Tasks
+
+static void unregister_task(struct host_task *task) {
+    pthread_mutex_lock(&s_tasks_lock);
+    for (struct host_task **p = &s_tasks; *p; p = &(*p)->next) {
+        if (*p == task) {
+            *p = task->next;
+            s_task_count--;
+            s_tasks_deleted++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_tasks_lock);
+    heap_caps_free(task->stack);
+    heap_caps_free(task->tcb);
+    free(task);
+}
+
+static void *task_trampoline(void *arg) {
+    struct host_task *task = arg;
+    t_self = task;
+    t_clocked = s_virtual;
+    atomic_store_explicit(&task->state, eRunning, memory_order_relaxed);
+    task->fn(task->arg);
+    // A FreeRTOS task must not return, the port would abort here
+    ESP_LOGE(TAG, "Task %s returned from its function", task->name);
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *created, BaseType_t core) {
+    struct host_task *task = calloc(1, sizeof(*task));
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    // Stack and TCB come out of internal RAM like they do with xTaskCreate
+    task->stack = heap_caps_malloc(stack_depth, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    task->tcb = heap_caps_malloc(TCB_BYTES, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (task->stack == NULL || task->tcb == NULL) {
+        ESP_LOGE(TAG, "No memory for a %lu byte stack for task %s", (unsigned long)stack_depth, name);
+        heap_caps_free(task->stack);
+        heap_caps_free(task->tcb);
+        free(task);
+        pthread_mutex_lock(&s_tasks_lock);
+        s_tasks_failed++;
+        pthread_mutex_unlock(&s_tasks_lock);
+        return pdFAIL;
+    }
+    snprintf(task->name, sizeof(task->name), "%s", name ? name : "");
+    task->fn = fn;
+    task->arg = arg;
+    task->priority = priority;
+    task->core = core;
+    task->stack_size = stack_depth;
+    atomic_store_explicit(&task->state, eReady, memory_order_relaxed);
+
+    pthread_mutex_lock(&s_tasks_lock);
+    task->number = s_next_number++;
+    task->next = s_tasks;
+    s_tasks = task;
+    s_task_count++;
+    s_tasks_created++;
+
+    if (s_virtual) {
+        // Running from now on, or the clock could move before it starts
+        pthread_mutex_lock(&s_clock_lock);
+        s_clock_running++;
+        pthread_mutex_unlock(&s_clock_lock);
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, HOST_THREAD_STACK);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&task->thread, &attr, task_trampoline, task);
+    pthread_attr_destroy(&attr);
+    if (rc == 0) {
+        task->has_cpu_clock = pthread_getcpuclockid(task->thread, &task->cpu_clock) == 0;
+    }
+    pthread_mutex_unlock(&s_tasks_lock);
+
+    if (rc != 0) {
+        ESP_LOGE(TAG, "pthread_create for %s: %s", name, strerror(rc));
+        if (s_virtual) {
+            pthread_mutex_lock(&s_clock_lock);
+            clock_block_locked();
+            pthread_mutex_unlock(&s_clock_lock);
+        }
+        unregister_task(task);
+        return pdFAIL;
+    }
+    if (created) {
+        *created = task;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task == NULL || task == t_self) {
+        struct host_task *self = t_self;
+        if (self == NULL) {
+            // Not a task, the host main thread
+            pthread_exit(NULL);
+        }
+        t_self = NULL;
+        if (t_clocked) {
+            pthread_mutex_lock(&s_clock_lock);
+            clock_block_locked();
+            pthread_mutex_unlock(&s_clock_lock);
+            t_clocked = false;
+        }
+        unregister_task(self);
+        pthread_exit(NULL);
+    }
+    // Nothing in loudframe deletes another task, and threads can't be
+    // killed cleanly anyway
+    ESP_LOGE(TAG, "vTaskDelete of another task (%s) is not supported", task->name);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    if (ticks == 0) {
+        sched_yield();
+        return;
+    }
+    host_sleep_until(host_deadline(ticks));
+}
+
+BaseType_t xTaskDelayUntil(TickType_t *previous_wake, TickType_t increment) {
+    TickType_t now = xTaskGetTickCount();
+    TickType_t wake = *previous_wake + increment;
+    *previous_wake = wake;
+    if ((int32_t)(wake - now) <= 0) {
+        return pdFALSE;
+    }
+    host_sleep_until((int64_t)wake * (1000000 / configTICK_RATE_HZ));
+    return pdTRUE;
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t increment) {
+    xTaskDelayUntil(previous_wake, increment);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(host_time_us() / (1000000 / configTICK_RATE_HZ));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return t_self;
+}
+
+const char *pcTaskGetName(TaskHandle_t task) {
+    if (task == NULL) {
+        task = t_self;
+    }
+    return task ? task->name : "main";
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void) {
+    pthread_mutex_lock(&s_tasks_lock);
+    UBaseType_t n = s_task_count + portNUM_PROCESSORS;
+    pthread_mutex_unlock(&s_tasks_lock);
+    return n;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    // Host stacks say nothing about the board's, report the whole stack
+    if (task == NULL) {
+        task = t_self;
+    }
+    return task ? task->stack_size : 0;
+}
+
+void taskYIELD(void) {
+    sched_yield();
+}
+
+BaseType_t xPortGetCoreID(void) {
+    if (t_self && t_self->core != tskNO_AFFINITY) {
+        return t_self->core;
+    }
+    return 0;
+}
+
+static uint64_t task_cpu_us(const struct host_task *task) {
+    struct timespec ts;
+    if (!task->has_cpu_clock || clock_gettime(task->cpu_clock, &ts) != 0) {
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Run time counters are CPU microseconds per thread. Unpinned tasks count
+// against core 0; each IDLE task gets whatever its core did not use.
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *tasks, UBaseType_t max, uint32_t *total_run_time) {
+    uint64_t now = (uint64_t)host_time_us();
+    uint64_t busy[portNUM_PROCESSORS] = {0};
+
+    pthread_mutex_lock(&s_tasks_lock);
+    if (s_task_count + portNUM_PROCESSORS > max) {
+        pthread_mutex_unlock(&s_tasks_lock);
+        return 0;
+    }
+    UBaseType_t n = 0;
+    for (struct host_task *t = s_tasks; t; t = t->next) {
+        uint64_t cpu = task_cpu_us(t);
+        int core = (t->core >= 0 && t->core < portNUM_PROCESSORS) ? t->core : 0;
+        busy[core] += cpu;
+        tasks[n++] = (TaskStatus_t){
+            .xHandle = t,
+            .pcTaskName = t->name,
+            .xTaskNumber = t->number,
+            .eCurrentState = (eTaskState)atomic_load_explicit(&t->state, memory_order_relaxed),
+            .uxCurrentPriority = t->priority,
+            .uxBasePriority = t->priority,
+            .ulRunTimeCounter = (uint32_t)cpu,
+            .usStackHighWaterMark = t->stack_size,
+            .xCoreID = t->core,
+        };
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        struct host_task *idle = &s_idle[core];
+        if (idle->name[0] == '\0') {
+            snprintf(idle->name, sizeof(idle->name), "IDLE%d", core);
+            idle->stack_size = 1536;
+            idle->core = core;
+        }
+        uint64_t idle_us = now > busy[core] ? now - busy[core] : 0;
+        tasks[n++] = (TaskStatus_t){
+            .xHandle = idle,
+            .pcTaskName = idle->name,
+            .xTaskNumber = 1000 + core,
+            .eCurrentState = eReady,
+            .ulRunTimeCounter = (uint32_t)idle_us,
+            .usStackHighWaterMark = idle->stack_size,
+            .xCoreID = core,
+        };
+    }
+    pthread_mutex_unlock(&s_tasks_lock);
+
+    if (total_run_time) {
+        *total_run_time = (uint32_t)now;
+    }
+    return n;
+}
+
+void host_rtos_report(FILE *out) {
+    if (s_virtual) {
+        double virtual_s = host_time_us() / 1e6;
+        double real_s = real_time_us() / 1e6;
+        pthread_mutex_lock(&s_clock_lock);
+        fprintf(out, "clock          virtual, %.1f s in %.1f s real (%.0fx), %llu jumps, %u stalls\n",
+                virtual_s, real_s, real_s > 0 ? virtual_s / real_s : 0.0,
+                (unsigned long long)s_clock_jumps, (unsigned)s_clock_stalls);
+        pthread_mutex_unlock(&s_clock_lock);
+    }
+    pthread_mutex_lock(&s_tasks_lock);
+    fprintf(out, "tasks          %u running, %llu created, %llu deleted, %u failed\n",
+            (unsigned)s_task_count, (unsigned long long)s_tasks_created,
+            (unsigned long long)s_tasks_deleted, (unsigned)s_tasks_failed);
+    for (struct host_task *t = s_tasks; t; t = t->next) {
+        fprintf(out, "  %-16s prio %2u core %2d stack %5u cpu %8.3f s\n", t->name, (unsigned)t->priority,
+                t->core == tskNO_AFFINITY ? -1 : (int)t->core, (unsigned)t->stack_size, task_cpu_us(t) / 1e6);
+    }
+    pthread_mutex_unlock(&s_tasks_lock);
+}
+
+// Queues
+
+struct host_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t *items;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    // One allocation like xQueueGenericCreate, from internal RAM
+    struct host_queue *q = heap_caps_calloc(1, sizeof(*q) + (size_t)length * item_size,
+                                            MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (q == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&q->mutex, NULL);
+    host_cond_init(&q->not_empty);
+    host_cond_init(&q->not_full);
+    q->length = length;
+    q->item_size = item_size;
+    q->items = (uint8_t *)(q + 1);
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t q) {
+    if (q == NULL) {
+        return;
+    }
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+    pthread_mutex_destroy(&q->mutex);
+    heap_caps_free(q);
+}
+
+static BaseType_t queue_send(QueueHandle_t q, const void *item, TickType_t ticks, bool front) {
+    int64_t deadline = host_deadline(ticks);
+    pthread_mutex_lock(&q->mutex);
+    while (q->count == q->length) {
+        if (ticks == 0 || !host_cond_wait(&q->not_full, &q->mutex, deadline)) {
+            if (q->count == q->length) {
+                pthread_mutex_unlock(&q->mutex);
+                return errQUEUE_FULL;
+            }
+        }
+    }
+    UBaseType_t slot;
+    if (front) {
+        q->head = (q->head + q->length - 1) % q->length;
+        slot = q->head;
+    } else {
+        slot = (q->head + q->count) % q->length;
+    }
+    memcpy(q->items + (size_t)slot * q->item_size, item, q->item_size);
+    q->count++;
+    host_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks) {
+    return queue_send(q, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t q, const void *item, TickType_t ticks) {
+    return queue_send(q, item, ticks, true);
+}
+
+static BaseType_t queue_receive(QueueHandle_t q, void *item, TickType_t ticks, bool peek) {
+    int64_t deadline = host_deadline(ticks);
+    pthread_mutex_lock(&q->mutex);
+    while (q->count == 0) {
+        if (ticks == 0 || !host_cond_wait(&q->not_empty, &q->mutex, deadline)) {
+            if (q->count == 0) {
+                pthread_mutex_unlock(&q->mutex);
+                return errQUEUE_EMPTY;
+            }
+        }
+    }
+    memcpy(item, q->items + (size_t)q->head * q->item_size, q->item_size);
+    if (!peek) {
+        q->head = (q->head + 1) % q->length;
+        q->count--;
+        host_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks) {
+    return queue_receive(q, item, ticks, false);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t q, void *item, TickType_t ticks) {
+    return queue_receive(q, item, ticks, true);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+    pthread_mutex_lock(&q->mutex);
+    UBaseType_t n = q->count;
+    pthread_mutex_unlock(&q->mutex);
+    return n;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q) {
+    pthread_mutex_lock(&q->mutex);
+    UBaseType_t n = q->length - q->count;
+    pthread_mutex_unlock(&q->mutex);
+    return n;
+}
+
+BaseType_t xQueueReset(QueueHandle_t q) {
+    pthread_mutex_lock(&q->mutex);
+    q->head = 0;
+    q->count = 0;
+    host_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->mutex);
+    return pdPASS;
+}
+
+// Semaphores and mutexes
+
+typedef enum {
+    SEM_BINARY,
+    SEM_COUNTING,
+    SEM_MUTEX,
+    SEM_RECURSIVE,
+} sem_kind_t;
+
+struct host_sem {
+    pthread_mutex_t mutex;
+    pthread_cond_t available;
+    sem_kind_t kind;
+    UBaseType_t count;
+    UBaseType_t max;
+    struct host_task *owner;
+    pthread_t owner_thread;
+    UBaseType_t depth;
+};
+
+static SemaphoreHandle_t sem_create(sem_kind_t kind, UBaseType_t max, UBaseType_t initial) {
+    struct host_sem *s = heap_caps_calloc(1, sizeof(*s), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (s == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&s->mutex, NULL);
+    host_cond_init(&s->available);
+    s->kind = kind;
+    s->max = max;
+    s->count = initial;
+    return s;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return sem_create(SEM_BINARY, 1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    return sem_create(SEM_MUTEX, 1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void) {
+    return sem_create(SEM_RECURSIVE, 1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) {
+    return sem_create(SEM_COUNTING, max, initial);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks) {
+    int64_t deadline = host_deadline(ticks);
+    pthread_mutex_lock(&s->mutex);
+    if (s->kind == SEM_RECURSIVE && s->depth > 0 && pthread_equal(s->owner_thread, pthread_self())) {
+        s->depth++;
+        pthread_mutex_unlock(&s->mutex);
+        return pdTRUE;
+    }
+    while (s->count == 0) {
+        if (ticks == 0 || !host_cond_wait(&s->available, &s->mutex, deadline)) {
+            if (s->count == 0) {
+                pthread_mutex_unlock(&s->mutex);
+                return pdFALSE;
+            }
+        }
+    }
+    s->count--;
+    if (s->kind == SEM_MUTEX || s->kind == SEM_RECURSIVE) {
+        s->owner = t_self;
+        s->owner_thread = pthread_self();
+        s->depth = 1;
+    }
+    pthread_mutex_unlock(&s->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s) {
+    pthread_mutex_lock(&s->mutex);
+    if (s->kind == SEM_MUTEX || s->kind == SEM_RECURSIVE) {
+        if (s->depth == 0 || !pthread_equal(s->owner_thread, pthread_self())) {
+            // FreeRTOS refuses a give from a task that doesn't hold the mutex
+            pthread_mutex_unlock(&s->mutex);
+            ESP_LOGE(TAG, "Mutex given by %s, which does not hold it", pcTaskGetName(NULL));
+            return pdFALSE;
+        }
+        if (--s->depth > 0) {
+            pthread_mutex_unlock(&s->mutex);
+            return pdTRUE;
+        }
+        s->owner = NULL;
+    }
+    if (s->count >= s->max) {
+        pthread_mutex_unlock(&s->mutex);
+        return pdFALSE;
+    }
+    s->count++;
+    host_cond_signal(&s->available);
+    pthread_mutex_unlock(&s->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t s, TickType_t ticks) {
+    return xSemaphoreTake(s, ticks);
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t s) {
+    return xSemaphoreGive(s);
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t s) {
+    pthread_mutex_lock(&s->mutex);
+    UBaseType_t n = s->count;
+    pthread_mutex_unlock(&s->mutex);
+    return n;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t s) {
+    if (s == NULL) {
+        return;
+    }
+    pthread_cond_destroy(&s->available);
+    pthread_mutex_destroy(&s->mutex);
+    heap_caps_free(s);
+}
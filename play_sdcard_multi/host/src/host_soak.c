@@ -0,0 +1,586 @@
+// Soak driver: days of use in minutes, on the virtual clock
+//
+// A "soak" task that uses the API the way a wall of dashboards and an
+// operator would: polls the read endpoints, stops, starts and re-files
+// tracks, changes volumes, uploads and deletes files and saves the config.
+// Playback loops the whole time. Every sample period it writes down the
+// heaps, the open files and descriptors and the I2S counters, and at the
+// end it turns the samples into a verdict: anything that only ever grows is
+// a leak.
+//
+// The requests go over loopback to the host httpd like any client's. The
+// driver holds the clock while it waits for an answer, so a request takes
+// no virtual time unless the handler itself waits for something timed.
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "host_internal.h"
+
+static const char *TAG = "HOST_SOAK";
+
+#define SOAK_TASK_STACK     4096
+#define SOAK_TASK_PRIO      2
+#define SOAK_TRACKS         3
+
+// How often each kind of traffic comes, in virtual time
+#define POLL_PERIOD_US      (2 * 1000000LL)
+#define CONTROL_PERIOD_US   (20 * 1000000LL)
+#define UPLOAD_PERIOD_US    (3600 * 1000000LL)
+#define SAVE_PERIOD_US      (6 * 3600 * 1000000LL)
+
+#define MAX_SAMPLES         4096
+#define MAX_POOL            32
+#define UPLOAD_SECONDS      2
+#define UPLOAD_RATE         44100
+// The driver gives up holding the clock after this much real time
+#define HOLD_MS             2
+
+typedef struct {
+    int64_t at_us;
+    host_heap_stats_t heap[HOST_HEAP_COUNT];
+    uint32_t open_files;
+    uint32_t open_dirs;
+    int fds;
+    uint32_t underruns;
+    uint64_t requests;
+    uint64_t errors;
+} soak_sample_t;
+
+typedef struct {
+    host_soak_config_t config;
+    TaskHandle_t task;
+    pthread_mutex_t lock;
+    soak_sample_t *samples;
+    int n_samples;
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t by_kind[5];
+    int64_t worst_request_us;
+    char pool[MAX_POOL][64];
+    int pool_len;
+    char track_file[SOAK_TRACKS][64];
+    uint32_t rand;
+    uint8_t *upload;
+    size_t upload_len;
+} soak_t;
+
+enum { KIND_POLL, KIND_CONTROL, KIND_UPLOAD, KIND_DELETE, KIND_SAVE };
+static const char *const KIND_NAMES[] = { "poll", "control", "upload", "delete", "save" };
+
+static soak_t s_soak = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint32_t next_rand(void) {
+    s_soak.rand = s_soak.rand * 1103515245u + 12345u;
+    return s_soak.rand >> 8;
+}
+
+// Open descriptors of the whole process, minus the one used to count them
+static int count_fds(void) {
+    DIR *dir = opendir("/proc/self/fd");
+    if (dir == NULL) {
+        return -1;
+    }
+    int n = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] != '.') {
+            n++;
+        }
+    }
+    closedir(dir);
+    return n - 1;
+}
+
+static void take_sample(soak_sample_t *s) {
+    s->at_us = host_time_us();
+    for (int h = 0; h < HOST_HEAP_COUNT; h++) {
+        host_heap_get_stats((host_heap_id_t)h, &s->heap[h]);
+    }
+    host_vfs_stats_t vfs;
+    host_vfs_get_stats(&vfs);
+    s->open_files = vfs.open_files;
+    s->open_dirs = vfs.open_dirs;
+    s->fds = count_fds();
+    host_i2s_stats_t i2s;
+    host_adf_get_i2s_stats(&i2s);
+    s->underruns = i2s.underruns;
+    pthread_mutex_lock(&s_soak.lock);
+    s->requests = s_soak.requests;
+    s->errors = s_soak.errors;
+    pthread_mutex_unlock(&s_soak.lock);
+}
+
+static void record_sample(void) {
+    soak_sample_t s;
+    take_sample(&s);
+    pthread_mutex_lock(&s_soak.lock);
+    if (s_soak.n_samples < MAX_SAMPLES) {
+        s_soak.samples[s_soak.n_samples++] = s;
+    } else {
+        // Keep the first and thin out the rest, the trend survives
+        for (int i = 1; i < MAX_SAMPLES / 2; i++) {
+            s_soak.samples[i] = s_soak.samples[2 * i];
+        }
+        s_soak.n_samples = MAX_SAMPLES / 2;
+        s_soak.samples[s_soak.n_samples++] = s;
+    }
+    pthread_mutex_unlock(&s_soak.lock);
+
+    const host_heap_stats_t *in = &s.heap[HOST_HEAP_INTERNAL];
+    ESP_LOGI(TAG, "%7.2f h: internal %u free, lowest %u, largest %u, %u blocks; %d fds, %u files, %u underruns",
+             s.at_us / 3.6e9, (unsigned)in->free, (unsigned)in->min_free, (unsigned)in->largest,
+             (unsigned)in->blocks, s.fds, (unsigned)s.open_files, (unsigned)s.underruns);
+}
+
+// HTTP over loopback
+
+// Waits for fd like poll(), holding the clock for the first HOLD_MS
+static int wait_fd(int fd, short events) {
+    struct pollfd p = { .fd = fd, .events = events };
+    int ready = poll(&p, 1, HOLD_MS);
+    if (ready != 0) {
+        return ready;
+    }
+    // The handler is waiting for time to pass, let it
+    host_task_set_blocked(true);
+    ready = poll(&p, 1, -1);
+    host_task_set_blocked(false);
+    return ready;
+}
+
+static bool send_all(int fd, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    while (len > 0) {
+        if (wait_fd(fd, POLLOUT) < 0) {
+            return false;
+        }
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/** Returns the HTTP status, or -1 if there was no proper answer */
+static int request(int kind, const char *method, const char *path, const char *type,
+                   const void *body, size_t len) {
+    int64_t start = host_time_us();
+    int status = -1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        goto done;
+    }
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(s_soak.config.port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        goto done;
+    }
+    char head[512];
+    int n = snprintf(head, sizeof(head),
+                     "%s %s HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n"
+                     "Content-Type: %s\r\nContent-Length: %zu\r\n\r\n",
+                     method, path, type ? type : "application/json", len);
+    if (!send_all(fd, head, n) || (len > 0 && !send_all(fd, body, len))) {
+        goto done;
+    }
+    // The status line is all that matters, the rest is read and dropped
+    char buf[256];
+    char scratch[2048];
+    size_t got = 0;
+    for (;;) {
+        if (wait_fd(fd, POLLIN) < 0) {
+            goto done;
+        }
+        bool keep = got < sizeof(buf) - 1;
+        ssize_t r = recv(fd, keep ? buf + got : scratch, keep ? sizeof(buf) - 1 - got : sizeof(scratch),
+                         MSG_DONTWAIT);
+        if (r < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                continue;
+            }
+            goto done;
+        }
+        if (r == 0) {
+            break;
+        }
+        if (keep) {
+            got += r;
+        }
+    }
+    buf[got] = '\0';
+    if (sscanf(buf, "HTTP/1.%*d %d", &status) != 1) {
+        status = -1;
+    }
+
+done:
+    if (fd >= 0) {
+        close(fd);
+    }
+    int64_t took = host_time_us() - start;
+    pthread_mutex_lock(&s_soak.lock);
+    s_soak.requests++;
+    s_soak.by_kind[kind]++;
+    if (status < 200 || status >= 300) {
+        s_soak.errors++;
+    }
+    if (took > s_soak.worst_request_us) {
+        s_soak.worst_request_us = took;
+    }
+    pthread_mutex_unlock(&s_soak.lock);
+    if (status < 200 || status >= 300) {
+        ESP_LOGW(TAG, "%s %s: %d", method, path, status);
+    }
+    return status;
+}
+
+static int post_json(int kind, const char *path, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+static int post_json(int kind, const char *path, const char *fmt, ...) {
+    char body[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(body, sizeof(body), fmt, ap);
+    va_end(ap);
+    return request(kind, "POST", path, NULL, body, n);
+}
+
+// Traffic
+
+static void poll_once(void) {
+    static const char *const PATHS[] = {
+        "/api/loops", "/api/status", "/api/files", "/metrics", "/api/perf/heap",
+        "/api/perf/tasks", "/api/recorder", "/api/config/status", "/api/wifi/status", "/api/logs",
+        "/api/spectrum",
+    };
+    static unsigned next = 0;
+    request(KIND_POLL, "GET", PATHS[next++ % (sizeof(PATHS) / sizeof(PATHS[0]))], NULL, NULL, 0);
+}
+
+static void control_once(void) {
+    static unsigned step = 0;
+    int track = (int)(next_rand() % SOAK_TRACKS);
+    switch (step++ % 4) {
+        case 0:
+            post_json(KIND_CONTROL, "/api/loop/volume", "{\"track\":%d,\"volume\":%u}", track,
+                      (unsigned)(20 + next_rand() % 81));
+            break;
+        case 1:
+            post_json(KIND_CONTROL, "/api/loop/stop", "{\"track\":%d}", track);
+            break;
+        case 2:
+            post_json(KIND_CONTROL, "/api/loop/start", "{\"track\":%d}", track);
+            break;
+        case 3: {
+            if (s_soak.pool_len == 0) {
+                break;
+            }
+            const char *file = s_soak.pool[next_rand() % s_soak.pool_len];
+            if (post_json(KIND_CONTROL, "/api/loop/file", "{\"track\":%d,\"filename\":\"%s\"}", track, file) == 200) {
+                snprintf(s_soak.track_file[track], sizeof(s_soak.track_file[track]), "%s", file);
+            }
+            break;
+        }
+    }
+}
+
+static bool in_use(const char *file) {
+    for (int t = 0; t < SOAK_TRACKS; t++) {
+        if (strcmp(s_soak.track_file[t], file) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void pool_remove(const char *file) {
+    for (int i = 0; i < s_soak.pool_len; i++) {
+        if (strcmp(s_soak.pool[i], file) == 0) {
+            s_soak.pool[i][0] = '\0';
+            memmove(s_soak.pool[i], s_soak.pool[i + 1], (size_t)(s_soak.pool_len - i - 1) * sizeof(s_soak.pool[0]));
+            s_soak.pool_len--;
+            return;
+        }
+    }
+}
+
+// Two upload names take turns. The new one goes on a track, the old one
+// is deleted unless a track still plays it.
+static void upload_once(void) {
+    static unsigned count = 0;
+    char name[32];
+    char path[64];
+    snprintf(name, sizeof(name), "soak_%c.wav", 'a' + count % 2);
+    snprintf(path, sizeof(path), "/api/upload?filename=%s", name);
+    count++;
+    if (request(KIND_UPLOAD, "POST", path, "application/octet-stream", s_soak.upload, s_soak.upload_len) != 200) {
+        return;
+    }
+    if (s_soak.pool_len < MAX_POOL && !in_use(name)) {
+        pool_remove(name);
+        snprintf(s_soak.pool[s_soak.pool_len++], sizeof(s_soak.pool[0]), "%s", name);
+    }
+    int track = (int)(count % SOAK_TRACKS);
+    if (post_json(KIND_CONTROL, "/api/loop/file", "{\"track\":%d,\"filename\":\"%s\"}", track, name) == 200) {
+        snprintf(s_soak.track_file[track], sizeof(s_soak.track_file[track]), "%s", name);
+    }
+
+    char old[32];
+    snprintf(old, sizeof(old), "soak_%c.wav", 'a' + count % 2);
+    if (count > 1 && !in_use(old)) {
+        pool_remove(old);
+        char body[64];
+        int n = snprintf(body, sizeof(body), "{\"filename\":\"%s\"}", old);
+        request(KIND_DELETE, "DELETE", "/api/file/delete", NULL, body, n);
+    }
+}
+
+static void make_upload(void) {
+    uint32_t frames = UPLOAD_SECONDS * UPLOAD_RATE;
+    uint32_t data = frames * 4;
+    s_soak.upload_len = 44 + data;
+    s_soak.upload = malloc(s_soak.upload_len);
+    uint8_t *h = s_soak.upload;
+    uint32_t fields[] = { 36 + data, 16, 1 | (2 << 16), UPLOAD_RATE, UPLOAD_RATE * 4, 4 | (16 << 16), data };
+    memcpy(h, "RIFF", 4);
+    memcpy(h + 4, &fields[0], 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    memcpy(h + 16, &fields[1], 4 * 5);
+    memcpy(h + 36, "data", 4);
+    memcpy(h + 40, &fields[6], 4);
+    int16_t *pcm = (int16_t *)(h + 44);
+    for (uint32_t i = 0; i < frames; i++) {
+        int16_t v = (int16_t)(6000 * sin(2 * M_PI * 330.0 * i / UPLOAD_RATE));
+        pcm[2 * i] = v;
+        pcm[2 * i + 1] = v;
+    }
+}
+
+// What is on the card when the soak starts is what the file switches use
+static void fill_pool(void) {
+    DIR *dir = opendir(host_vfs_get_root());
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL && s_soak.pool_len < MAX_POOL) {
+        const char *dot = strrchr(de->d_name, '.');
+        if (dot && (strcasecmp(dot, ".wav") == 0 || strcasecmp(dot, ".mp3") == 0) &&
+            strlen(de->d_name) < sizeof(s_soak.pool[0])) {
+            snprintf(s_soak.pool[s_soak.pool_len++], sizeof(s_soak.pool[0]), "%.63s", de->d_name);
+        }
+    }
+    closedir(dir);
+}
+
+static void soak_task(void *arg) {
+    fill_pool();
+    make_upload();
+
+    // Let app_main get the audio going and the server up
+    vTaskDelay(pdMS_TO_TICKS(3000));
+    record_sample();
+
+    int64_t now = host_time_us();
+    int64_t next[5] = {
+        now + POLL_PERIOD_US,
+        now + CONTROL_PERIOD_US,
+        now + UPLOAD_PERIOD_US / 2,
+        now + SAVE_PERIOD_US,
+        now + s_soak.config.sample_us,
+    };
+    for (;;) {
+        int which = 0;
+        for (int i = 1; i < 5; i++) {
+            if (next[i] < next[which]) {
+                which = i;
+            }
+        }
+        host_sleep_until(next[which]);
+        switch (which) {
+            case 0:
+                poll_once();
+                next[0] += POLL_PERIOD_US;
+                break;
+            case 1:
+                control_once();
+                next[1] += CONTROL_PERIOD_US;
+                break;
+            case 2:
+                upload_once();
+                next[2] += UPLOAD_PERIOD_US;
+                break;
+            case 3:
+                request(KIND_SAVE, "POST", "/api/config/save", NULL, "{}", 2);
+                next[3] += SAVE_PERIOD_US;
+                break;
+            case 4:
+                record_sample();
+                next[4] += s_soak.config.sample_us;
+                break;
+        }
+    }
+}
+
+void host_soak_start(const host_soak_config_t *config) {
+    s_soak.config = *config;
+    s_soak.rand = 1;
+    s_soak.samples = calloc(MAX_SAMPLES, sizeof(soak_sample_t));
+    xTaskCreatePinnedToCore(soak_task, "soak", SOAK_TASK_STACK, NULL, SOAK_TASK_PRIO, &s_soak.task, 0);
+}
+
+// Verdict
+
+// Least squares slope of y over the samples from first on, per day
+static double slope_per_day(int first, double (*y)(const soak_sample_t *)) {
+    int n = s_soak.n_samples - first;
+    if (n < 3) {
+        return 0;
+    }
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int i = first; i < s_soak.n_samples; i++) {
+        double x = s_soak.samples[i].at_us / 86400e6;
+        double v = y(&s_soak.samples[i]);
+        sx += x;
+        sy += v;
+        sxx += x * x;
+        sxy += x * v;
+    }
+    double d = n * sxx - sx * sx;
+    return d > 0 ? (n * sxy - sx * sy) / d : 0;
+}
+
+static double used_internal(const soak_sample_t *s) {
+    return (double)(s->heap[HOST_HEAP_INTERNAL].total - s->heap[HOST_HEAP_INTERNAL].free);
+}
+
+static double used_spiram(const soak_sample_t *s) {
+    return (double)(s->heap[HOST_HEAP_SPIRAM].total - s->heap[HOST_HEAP_SPIRAM].free);
+}
+
+static double fragmentation(const host_heap_stats_t *h) {
+    return h->free > 0 ? 1.0 - (double)h->largest / h->free : 0;
+}
+
+bool host_soak_finish(FILE *out, const host_soak_limits_t *limits) {
+    record_sample();
+
+    pthread_mutex_lock(&s_soak.lock);
+    // The first sample is the start, the second has every buffer the
+    // traffic needs allocated once; growth is measured from there
+    int warm = s_soak.n_samples > 2 ? 1 : 0;
+    const soak_sample_t *w = &s_soak.samples[warm];
+    const soak_sample_t *last = &s_soak.samples[s_soak.n_samples - 1];
+    double hours = (last->at_us - s_soak.samples[0].at_us) / 3.6e9;
+    double leak[HOST_HEAP_COUNT] = {
+        slope_per_day(warm, used_internal),
+        slope_per_day(warm, used_spiram),
+    };
+    double worst_frag[HOST_HEAP_COUNT] = {0};
+    for (int i = warm; i < s_soak.n_samples; i++) {
+        for (int h = 0; h < HOST_HEAP_COUNT; h++) {
+            double f = fragmentation(&s_soak.samples[i].heap[h]);
+            if (f > worst_frag[h]) {
+                worst_frag[h] = f;
+            }
+        }
+    }
+    int fd_growth = last->fds - w->fds;
+    int file_growth = (int)last->open_files - (int)w->open_files;
+    int dir_growth = (int)last->open_dirs - (int)w->open_dirs;
+    uint32_t underruns = last->underruns - w->underruns;
+
+    bool leaking = leak[HOST_HEAP_INTERNAL] / 1024 > limits->max_leak_kb_per_day ||
+                   leak[HOST_HEAP_SPIRAM] / 1024 > limits->max_leak_kb_per_day;
+    bool fd_leak = fd_growth > 0 || file_growth > 0 || dir_growth > 0;
+    bool glitched = limits->max_underruns >= 0 && underruns > (uint32_t)limits->max_underruns;
+    bool failed = leaking || fd_leak || glitched || s_soak.errors > 0;
+
+    static const char *const HEAP_NAMES[] = { "internal", "spiram" };
+    fprintf(out, "\n---- soak, %.1f h of virtual time, %d samples ----\n", hours, s_soak.n_samples);
+    for (int h = 0; h < HOST_HEAP_COUNT; h++) {
+        const host_heap_stats_t *a = &w->heap[h];
+        const host_heap_stats_t *b = &last->heap[h];
+        fprintf(out, "%-14s %u -> %u free, lowest %u, %u -> %u blocks, leak %+.1f KB/day\n",
+                HEAP_NAMES[h], (unsigned)a->free, (unsigned)b->free, (unsigned)b->min_free,
+                (unsigned)a->blocks, (unsigned)b->blocks, leak[h] / 1024);
+        fprintf(out, "               fragmentation %.1f %% now, worst %.1f %%, largest block %u\n",
+                100 * fragmentation(b), 100 * worst_frag[h], (unsigned)b->largest);
+    }
+    fprintf(out, "descriptors    %d -> %d, sd files %u -> %u, dirs %u -> %u\n", w->fds, last->fds,
+            (unsigned)w->open_files, (unsigned)last->open_files, (unsigned)w->open_dirs, (unsigned)last->open_dirs);
+    fprintf(out, "underruns      %u\n", (unsigned)underruns);
+    fprintf(out, "requests       %llu, %llu errors, slowest %.1f ms virtual\n",
+            (unsigned long long)s_soak.requests, (unsigned long long)s_soak.errors, s_soak.worst_request_us / 1000.0);
+    fprintf(out, "               ");
+    for (int k = 0; k < 5; k++) {
+        fprintf(out, "%s%s %llu", k ? ", " : "", KIND_NAMES[k], (unsigned long long)s_soak.by_kind[k]);
+    }
+    fprintf(out, "\nverdict        %s%s%s%s%s\n", failed ? "FAIL" : "pass", leaking ? ", heap leak" : "",
+            fd_leak ? ", descriptor leak" : "", glitched ? ", underruns" : "",
+            s_soak.errors ? ", request errors" : "");
+
+    if (s_soak.config.report_path) {
+        FILE *f = fopen(s_soak.config.report_path, "w");
+        if (f == NULL) {
+            ESP_LOGE(TAG, "can't write %s", s_soak.config.report_path);
+            failed = true;
+        } else {
+            fprintf(f, "{\n  \"virtual_hours\": %.3f,\n  \"real_seconds\": %.1f,\n", hours,
+                    limits->real_seconds);
+            fprintf(f, "  \"passed\": %s,\n  \"heap_leak\": %s,\n  \"descriptor_leak\": %s,\n",
+                    failed ? "false" : "true", leaking ? "true" : "false", fd_leak ? "true" : "false");
+            fprintf(f, "  \"underruns\": %u,\n  \"requests\": %llu,\n  \"request_errors\": %llu,\n",
+                    (unsigned)underruns, (unsigned long long)s_soak.requests, (unsigned long long)s_soak.errors);
+            fprintf(f, "  \"slowest_request_ms\": %.1f,\n  \"heaps\": {\n", s_soak.worst_request_us / 1000.0);
+            for (int h = 0; h < HOST_HEAP_COUNT; h++) {
+                const host_heap_stats_t *b = &last->heap[h];
+                fprintf(f, "    \"%s\": {\"total\": %u, \"free\": %u, \"lowest_free\": %u, \"largest_block\": %u, "
+                        "\"blocks\": %u, \"leak_kb_per_day\": %.2f, \"fragmentation\": %.4f, "
+                        "\"worst_fragmentation\": %.4f}%s\n",
+                        HEAP_NAMES[h], (unsigned)b->total, (unsigned)b->free, (unsigned)b->min_free,
+                        (unsigned)b->largest, (unsigned)b->blocks, leak[h] / 1024, fragmentation(b),
+                        worst_frag[h], h + 1 < HOST_HEAP_COUNT ? "," : "");
+            }
+            fprintf(f, "  },\n  \"samples\": [\n");
+            for (int i = 0; i < s_soak.n_samples; i++) {
+                const soak_sample_t *s = &s_soak.samples[i];
+                fprintf(f, "    {\"hours\": %.3f, \"internal_free\": %u, \"internal_largest\": %u, "
+                        "\"internal_blocks\": %u, \"spiram_free\": %u, \"spiram_largest\": %u, "
+                        "\"spiram_blocks\": %u, \"fds\": %d, \"open_files\": %u, \"underruns\": %u, "
+                        "\"requests\": %llu}%s\n",
+                        s->at_us / 3.6e9, (unsigned)s->heap[0].free, (unsigned)s->heap[0].largest,
+                        (unsigned)s->heap[0].blocks, (unsigned)s->heap[1].free, (unsigned)s->heap[1].largest,
+                        (unsigned)s->heap[1].blocks, s->fds, (unsigned)s->open_files, (unsigned)s->underruns,
+                        (unsigned long long)s->requests, i + 1 < s_soak.n_samples ? "," : "");
+            }
+            fprintf(f, "  ]\n}\n");
+            fclose(f);
+        }
+    }
+    pthread_mutex_unlock(&s_soak.lock);
+    return !failed;
+}
@@ -0,0 +1,434 @@
+// /sdcard as a host directory
+//
+// The FAT mount becomes a prefix swap: "/sdcard/x" opens "<root>/x". Open
+// files and directories are counted, since the FAT driver on the board only
+// allows CONFIG_FATFS_MAX_FILES... and a leak there is what runs out first.
+// Without --sd the card is a fresh temporary directory holding three short
+// test tones under the names the default config expects.
+//
+// File systems registered with esp_vfs_register() get their prefix instead:
+// fopen() wraps their open/read/lseek/close in a stdio stream, the way
+// newlib does on the board.
+//
+// With --sd-kbps the card is also slow: reads and writes of /sdcard files
+// take turns on one simulated bus, each costing SD_BUS_OP_US plus its bytes
+// at the given rate, first come first served. Every SD_BUS_STALL_BYTES
+// written the card also goes busy for SD_BUS_STALL_US, the way a real one
+// does when it erases and remaps. The host disk is fast enough that nothing
+// else would ever make a track wait for the card.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_vfs.h"
+#include "host.h"
+
+static const char *TAG = "HOST_VFS";
+
+#define SD_MOUNT_POINT      "/sdcard"
+#define SEED_SECONDS        4
+#define SEED_RATE           44100
+#define MAX_VFS             4
+#define SD_BUS_OP_US        1000    // command and FAT overhead per access
+#define SD_BUS_STALL_BYTES  (64 * 1024)
+#define SD_BUS_STALL_US     40000
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static char s_root[512];
+static bool s_root_is_temp;         // made by ensure_root_locked, not set_root
+static host_vfs_stats_t s_stats;
+
+typedef struct {
+    char prefix[ESP_VFS_PATH_MAX + 1];
+    esp_vfs_t vfs;
+} registered_vfs_t;
+
+static registered_vfs_t s_vfs[MAX_VFS];
+static int s_vfs_count;
+
+static uint32_t s_sd_kbps;
+static int64_t s_bus_free_us;       // when the last access queued finishes
+static uint64_t s_bus_written;
+
+typedef struct {
+    const esp_vfs_t *vfs;
+    int fd;
+} vfs_cookie_t;
+
+static void put_le(uint8_t *p, uint32_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+// 16 bit stereo sine, loud enough to hear the mix in the tap file
+static bool write_tone(const char *path, double hz) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return false;
+    }
+    uint32_t frames = SEED_SECONDS * SEED_RATE;
+    uint32_t data_bytes = frames * 4;
+    uint8_t h[44];
+    memcpy(h, "RIFF", 4);
+    put_le(h + 4, 36 + data_bytes, 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_le(h + 16, 16, 4);
+    put_le(h + 20, 1, 2);
+    put_le(h + 22, 2, 2);
+    put_le(h + 24, SEED_RATE, 4);
+    put_le(h + 28, SEED_RATE * 4, 4);
+    put_le(h + 32, 4, 2);
+    put_le(h + 34, 16, 2);
+    memcpy(h + 36, "data", 4);
+    put_le(h + 40, data_bytes, 4);
+    fwrite(h, 1, sizeof(h), f);
+    for (uint32_t i = 0; i < frames; i++) {
+        // A whole number of cycles per file so the loop point is clean
+        double cycles = round(hz * SEED_SECONDS);
+        int16_t s = (int16_t)(8000 * sin(2 * M_PI * cycles * i / frames));
+        int16_t frame[2] = { s, s };
+        fwrite(frame, sizeof(frame), 1, f);
+    }
+    return fclose(f) == 0;
+}
+
+static void seed_card(void) {
+    static const double tones[] = { 220, 330, 440 };
+    char path[600];
+    for (int i = 0; i < 3; i++) {
+        snprintf(path, sizeof(path), "%s/track%d.wav", s_root, i + 1);
+        if (!write_tone(path, tones[i])) {
+            ESP_LOGE(TAG, "Could not write %s: %s", path, strerror(errno));
+        }
+    }
+}
+
+static void ensure_root_locked(void) {
+    if (s_root[0]) {
+        return;
+    }
+    snprintf(s_root, sizeof(s_root), "/tmp/loudframe_sd.XXXXXX");
+    if (mkdtemp(s_root) == NULL) {
+        ESP_LOGE(TAG, "mkdtemp: %s", strerror(errno));
+        snprintf(s_root, sizeof(s_root), ".");
+        return;
+    }
+    s_root_is_temp = true;
+    seed_card();
+    ESP_LOGI(TAG, "SD card is %s", s_root);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    if (remove(path) != 0) {
+        ESP_LOGW(TAG, "Could not remove %s: %s", path, strerror(errno));
+    }
+    return 0;
+}
+
+void host_vfs_finish(void) {
+    pthread_mutex_lock(&s_lock);
+    if (s_root_is_temp) {
+        // Depth first, so each directory is empty by the time it is reached
+        nftw(s_root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        s_root_is_temp = false;
+    }
+    pthread_mutex_unlock(&s_lock);
+}
+
+void host_vfs_set_root(const char *dir) {
+    pthread_mutex_lock(&s_lock);
+    snprintf(s_root, sizeof(s_root), "%s", dir);
+    s_root_is_temp = false;
+    pthread_mutex_unlock(&s_lock);
+}
+
+const char *host_vfs_get_root(void) {
+    pthread_mutex_lock(&s_lock);
+    ensure_root_locked();
+    pthread_mutex_unlock(&s_lock);
+    return s_root;
+}
+
+void host_vfs_set_bus_kbps(uint32_t kbps) {
+    pthread_mutex_lock(&s_lock);
+    s_sd_kbps = kbps;
+    pthread_mutex_unlock(&s_lock);
+}
+
+// Queues an access of bytes on the bus and sleeps until it is done. The bus
+// is only booked under the lock, so waiting doesn't block anyone else's
+// booking and works on the virtual clock.
+static void bus_access(size_t bytes, bool write) {
+    pthread_mutex_lock(&s_lock);
+    int64_t now = host_time_us();
+    int64_t start = s_bus_free_us > now ? s_bus_free_us : now;
+    int64_t cost = SD_BUS_OP_US + (int64_t)bytes * 1000 / s_sd_kbps;
+    if (write) {
+        uint64_t before = s_bus_written;
+        s_bus_written += bytes;
+        cost += (int64_t)(s_bus_written / SD_BUS_STALL_BYTES - before / SD_BUS_STALL_BYTES) * SD_BUS_STALL_US;
+    }
+    s_bus_free_us = start + cost;
+    s_stats.bus_ops++;
+    s_stats.bus_busy_us += cost;
+    s_stats.bus_wait_us += start - now;
+    pthread_mutex_unlock(&s_lock);
+    host_sleep_until(start + cost);
+}
+
+void host_vfs_get_stats(host_vfs_stats_t *stats) {
+    pthread_mutex_lock(&s_lock);
+    *stats = s_stats;
+    pthread_mutex_unlock(&s_lock);
+}
+
+// Paths outside the mount point go to the host unchanged
+static const char *map_path(const char *path, char *buf, size_t len) {
+    size_t n = strlen(SD_MOUNT_POINT);
+    if (strncmp(path, SD_MOUNT_POINT, n) != 0 || (path[n] != '/' && path[n] != '\0')) {
+        return path;
+    }
+    snprintf(buf, len, "%s%s", host_vfs_get_root(), path + n);
+    return buf;
+}
+
+esp_err_t esp_vfs_register(const char *base_path, const esp_vfs_t *vfs, void *ctx) {
+    if (strlen(base_path) > ESP_VFS_PATH_MAX || base_path[0] != '/') {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_lock);
+    esp_err_t err = ESP_ERR_NO_MEM;
+    if (s_vfs_count < MAX_VFS) {
+        registered_vfs_t *r = &s_vfs[s_vfs_count++];
+        snprintf(r->prefix, sizeof(r->prefix), "%s", base_path);
+        r->vfs = *vfs;
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&s_lock);
+    return err;
+}
+
+// The registered file system for path, with *rest pointing past its prefix
+static const esp_vfs_t *find_vfs(const char *path, const char **rest) {
+    const esp_vfs_t *found = NULL;
+    pthread_mutex_lock(&s_lock);
+    for (int i = 0; i < s_vfs_count && !found; i++) {
+        size_t n = strlen(s_vfs[i].prefix);
+        if (strncmp(path, s_vfs[i].prefix, n) == 0 && (path[n] == '/' || path[n] == '\0')) {
+            found = &s_vfs[i].vfs;
+            *rest = path + n;
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+    return found;
+}
+
+static ssize_t cookie_read(void *cookie, char *buf, size_t size) {
+    vfs_cookie_t *c = cookie;
+    return c->vfs->read ? c->vfs->read(c->fd, buf, size) : -1;
+}
+
+static ssize_t cookie_write(void *cookie, const char *buf, size_t size) {
+    vfs_cookie_t *c = cookie;
+    return c->vfs->write ? c->vfs->write(c->fd, buf, size) : -1;
+}
+
+static int cookie_seek(void *cookie, off64_t *offset, int whence) {
+    vfs_cookie_t *c = cookie;
+    if (!c->vfs->lseek) {
+        errno = ESPIPE;
+        return -1;
+    }
+    off_t pos = c->vfs->lseek(c->fd, (off_t)*offset, whence);
+    if (pos < 0) {
+        return -1;
+    }
+    *offset = pos;
+    return 0;
+}
+
+static int cookie_close(void *cookie) {
+    vfs_cookie_t *c = cookie;
+    int rc = c->vfs->close ? c->vfs->close(c->fd) : 0;
+    free(c);
+    return rc;
+}
+
+static ssize_t bus_read(void *cookie, char *buf, size_t size) {
+    bus_access(size, false);
+    return fread(buf, 1, size, cookie);
+}
+
+static ssize_t bus_write(void *cookie, const char *buf, size_t size) {
+    bus_access(size, true);
+    size_t n = fwrite(buf, 1, size, cookie);
+    return n > 0 || size == 0 ? (ssize_t)n : -1;
+}
+
+static int bus_seek(void *cookie, off64_t *offset, int whence) {
+    if (fseeko(cookie, *offset, whence) != 0) {
+        return -1;
+    }
+    *offset = ftello(cookie);
+    return 0;
+}
+
+static int bus_close(void *cookie) {
+    return fclose(cookie);
+}
+
+// A host file whose reads and writes go over the simulated bus. The host
+// stream is unbuffered, so each transfer of the outer one is one access.
+static FILE *bus_fopen(const char *path, const char *mode) {
+    FILE *file = fopen(path, mode);
+    if (!file) {
+        return NULL;
+    }
+    setvbuf(file, NULL, _IONBF, 0);
+    cookie_io_functions_t io = {
+        .read = bus_read,
+        .write = bus_write,
+        .seek = bus_seek,
+        .close = bus_close,
+    };
+    FILE *f = fopencookie(file, mode, io);
+    if (!f) {
+        fclose(file);
+    }
+    return f;
+}
+
+static FILE *vfs_fopen(const esp_vfs_t *vfs, const char *path, const char *mode) {
+    int flags = O_RDONLY;
+    if (strchr(mode, 'w') || strchr(mode, 'a')) {
+        flags = (strchr(mode, '+') ? O_RDWR : O_WRONLY) | O_CREAT | (strchr(mode, 'w') ? O_TRUNC : O_APPEND);
+    } else if (strchr(mode, '+')) {
+        flags = O_RDWR;
+    }
+    if (!vfs->open) {
+        errno = ENOSYS;
+        return NULL;
+    }
+    int fd = vfs->open(path, flags, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    vfs_cookie_t *c = malloc(sizeof(*c));
+    *c = (vfs_cookie_t){ .vfs = vfs, .fd = fd };
+    cookie_io_functions_t io = {
+        .read = cookie_read,
+        .write = cookie_write,
+        .seek = cookie_seek,
+        .close = cookie_close,
+    };
+    FILE *f = fopencookie(c, mode, io);
+    if (!f) {
+        cookie_close(c);
+    }
+    return f;
+}
+
+FILE *host_fopen(const char *path, const char *mode) {
+    char buf[1024];
+    const char *rest;
+    const esp_vfs_t *vfs = find_vfs(path, &rest);
+    FILE *f;
+    if (vfs) {
+        f = vfs_fopen(vfs, rest, mode);
+    } else {
+        const char *mapped = map_path(path, buf, sizeof(buf));
+        pthread_mutex_lock(&s_lock);
+        bool on_bus = s_sd_kbps > 0 && mapped == buf;
+        pthread_mutex_unlock(&s_lock);
+        f = on_bus ? bus_fopen(mapped, mode) : fopen(mapped, mode);
+    }
+    if (f) {
+        pthread_mutex_lock(&s_lock);
+        s_stats.opens++;
+        s_stats.open_files++;
+        if (s_stats.open_files > s_stats.max_open_files) {
+            s_stats.max_open_files = s_stats.open_files;
+        }
+        pthread_mutex_unlock(&s_lock);
+    }
+    return f;
+}
+
+int host_fclose(FILE *f) {
+    pthread_mutex_lock(&s_lock);
+    s_stats.open_files--;
+    pthread_mutex_unlock(&s_lock);
+    return fclose(f);
+}
+
+int host_stat(const char *path, struct stat *st) {
+    char buf[1024];
+    const char *rest;
+    const esp_vfs_t *vfs = find_vfs(path, &rest);
+    if (vfs) {
+        if (!vfs->stat) {
+            errno = ENOSYS;
+            return -1;
+        }
+        return vfs->stat(rest, st);
+    }
+    return stat(map_path(path, buf, sizeof(buf)), st);
+}
+
+DIR *host_opendir(const char *path) {
+    char buf[1024];
+    DIR *dir = opendir(map_path(path, buf, sizeof(buf)));
+    if (dir) {
+        pthread_mutex_lock(&s_lock);
+        s_stats.open_dirs++;
+        pthread_mutex_unlock(&s_lock);
+    }
+    return dir;
+}
+
+int host_closedir(DIR *dir) {
+    pthread_mutex_lock(&s_lock);
+    s_stats.open_dirs--;
+    pthread_mutex_unlock(&s_lock);
+    return closedir(dir);
+}
+
+int host_remove(const char *path) {
+    char buf[1024];
+    const char *rest;
+    const esp_vfs_t *vfs = find_vfs(path, &rest);
+    if (vfs) {
+        if (!vfs->unlink) {
+            errno = EROFS;
+            return -1;
+        }
+        return vfs->unlink(rest);
+    }
+    int rc = remove(map_path(path, buf, sizeof(buf)));
+    if (rc == 0) {
+        pthread_mutex_lock(&s_lock);
+        s_stats.removes++;
+        pthread_mutex_unlock(&s_lock);
+    }
+    return rc;
+}
+
+int host_unlink(const char *path) {
+    return host_remove(path);
+}
+
+int host_rename(const char *from, const char *to) {
+    char from_buf[1024], to_buf[1024];
+    return rename(map_path(from, from_buf, sizeof(from_buf)), map_path(to, to_buf, sizeof(to_buf)));
+}
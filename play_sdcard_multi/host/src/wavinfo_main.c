@@ -0,0 +1,91 @@
+// loudframe_wavinfo: prints what the firmware's WAV parser (main/wav_header.c)
+// makes of a file
+//
+//   loudframe_wavinfo [--native] file.wav ...
+//
+// One key=value line per field, a blank line between files. With --native
+// the exit status is 1 unless every file is 44100 Hz 16 bit stereo PCM with
+// its data on a 512 byte boundary, which is what asset_conditioner.py writes.
+// 2 if a file can't be parsed at all.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "wav_header.h"
+
+static int wavinfo(const char *path, bool native) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 2;
+    }
+    wav_header_info_t info;
+    esp_err_t err = wav_header_parse(f, &info);
+    fclose(f);
+    if (err != ESP_OK) {
+        fprintf(stderr, "%s: %s\n", path,
+                err == ESP_ERR_INVALID_ARG     ? "not a RIFF WAVE file" :
+                err == ESP_ERR_NOT_SUPPORTED   ? "fmt block_align doesn't match its channels and bits" :
+                                                 "truncated, or no fmt before data");
+        return 2;
+    }
+
+    printf("file=%s\n", path);
+    printf("format=%u\n", info.format);
+    printf("channels=%u\n", info.channels);
+    printf("sample_rate=%u\n", info.sample_rate);
+    printf("bits_per_sample=%u\n", info.bits_per_sample);
+    printf("block_align=%u\n", info.block_align);
+    printf("data_offset=%u\n", info.data_offset);
+    printf("data_size=%u\n", info.data_size);
+    if (info.has_loop) {
+        printf("loop_start=%u\n", info.loop_start);
+        printf("loop_end=%u\n", info.loop_end);
+    }
+    if (info.has_loudness) {
+        printf("loudness_lufs=%.2f\n", info.loudness / 100.0);
+        if (info.true_peak != WAV_LOUDNESS_UNSET) {
+            printf("true_peak_dbtp=%.2f\n", info.true_peak / 100.0);
+        }
+    }
+
+    bool is_native = wav_header_is_native(&info);
+    bool aligned = info.data_offset % WAV_DATA_ALIGN == 0;
+    printf("native=%s\n", is_native ? "yes" : "no");
+    printf("aligned=%s\n", aligned ? "yes" : "no");
+
+    if (native && !(is_native && aligned)) {
+        fprintf(stderr, "%s: not native (%u Hz, %u bit, %u ch, format %u, data at %u)\n",
+                path, info.sample_rate, info.bits_per_sample, info.channels,
+                info.format, info.data_offset);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    bool native = false;
+    int first = 1;
+
+    if (first < argc && strcmp(argv[first], "--native") == 0) {
+        native = true;
+        first++;
+    }
+    if (first >= argc) {
+        fprintf(stderr, "usage: %s [--native] file.wav ...\n", argv[0]);
+        return 2;
+    }
+
+    int rc = 0;
+    for (int i = first; i < argc; i++) {
+        if (i > first) {
+            printf("\n");
+        }
+        int r = wavinfo(argv[i], native);
+        if (r > rc) {
+            rc = r;
+        }
+    }
+    return rc;
+}
@@ -0,0 +1,647 @@
+/* Upload-time audio analysis.
+
+   The upload handler feeds every chunk it writes to the SD card through
+   here, so loudness and loop edges are known the moment the upload ends,
+   without reading the file back while tracks are playing from the same card.
+
+   The WAV chunks are walked as the bytes arrive. Samples then go through:
+   - the BS.1770-4 K-weighting filter, into 100 ms sub-blocks and from those
+     into overlapping 400 ms blocks. Gating needs every block, so the blocks
+     are kept as a histogram of 0.1 LU bins with the energy summed per bin,
+     which makes the relative gate exact to within the one bin it falls in.
+   - a 4x oversampling FIR for the true peak (BS.1770 Annex 2)
+   - per channel sums for the DC offset
+   - a rising zero crossing detector on the mid channel, keeping the first
+     few crossings and the last few, as loop edge candidates
+
+   Results go to a small JSON sidecar next to the file. play_sdcard.c reads
+   it when a track starts and folds the normalisation gain into the track's
+   downmix gain, so it costs nothing while playing.
+
+   Author: Brian Bulkowski brian@bulkowski.org
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "cJSON.h"
+#include "heap_tracker.h"
+#include "sd_arbiter.h"
+#include "audio_analysis.h"
+
+static const char *TAG = "AUDIO_ANALYSIS";
+
+#define WAVE_FORMAT_PCM         1
+#define WAVE_FORMAT_FLOAT       3
+#define WAVE_FORMAT_EXTENSIBLE  0xfffe
+
+// Loudness histogram, -70 LUFS (the absolute gate) up
+#define HIST_MIN_LUFS           -70.0f
+#define HIST_BIN_LU             0.1f
+#define HIST_BINS               800
+
+// True peak interpolator, 4 phases of 12 taps
+#define TP_PHASES               4
+#define TP_TAPS                 12
+
+// What silence reports, JSON has no infinity
+#define FLOOR_DB                -120.0f
+
+#define SIDECAR_VERSION         1
+
+typedef enum {
+    ST_RIFF,
+    ST_CHUNK_HEADER,
+    ST_CHUNK_BODY,
+    ST_DATA,
+    ST_DONE,
+    ST_UNSUPPORTED,
+} parse_state_t;
+
+typedef struct {
+    float b0, b1, b2, a1, a2;
+} biquad_t;
+
+struct audio_analysis_s {
+    // chunk walk
+    parse_state_t state;
+    uint8_t hdr[12];
+    uint32_t hdr_have;
+    uint8_t fmt[40];
+    uint32_t fmt_have;
+    uint32_t fmt_want;              // bytes of this chunk still to go into fmt
+    uint32_t skip;                  // bytes of this chunk still to skip
+    bool in_fmt;
+    bool have_fmt;
+    uint32_t data_left;
+
+    // format
+    uint16_t format;
+    uint16_t channels;
+    uint16_t width;                 // bytes a sample
+    uint16_t block_align;
+    uint32_t sample_rate;
+    uint8_t frame[16];              // a frame split over two feeds
+    uint32_t frame_have;
+
+    // K-weighting, two biquads, state per channel
+    biquad_t shelf, highpass;
+    float z[2][4];
+    uint32_t sub_len;               // frames in a 100 ms sub-block
+    uint32_t sub_have;
+    double sub_energy;
+    double subs[4];                 // the last four sub-blocks
+    uint32_t n_subs;
+    uint32_t hist_count[HIST_BINS];
+    double hist_energy[HIST_BINS];
+
+    // peaks
+    float tp_coef[TP_PHASES][TP_TAPS];
+    float tp_hist[2][2 * TP_TAPS];  // doubled so a window never wraps
+    uint32_t tp_pos;
+    float true_peak;
+    float sample_peak;
+
+    double dc_sum[2];
+
+    // loop edges
+    float prev_mid;
+    uint32_t edge_frames;
+    uint32_t end_ring[AUDIO_ANALYSIS_MAX_EDGES];
+    uint32_t n_end;                 // crossings seen, the ring holds the last few
+
+    uint32_t frames;
+    audio_analysis_result_t result;
+};
+
+static uint32_t le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t le16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+// BS.1770 pre-filter (high shelf) and RLB high pass, for any sample rate.
+// At 48 kHz these are the coefficients tabulated in the standard.
+static void k_weighting_init(audio_analysis_t *a) {
+    double fs = a->sample_rate;
+
+    double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+    double k = tan(M_PI * f0 / fs);
+    double vh = pow(10.0, gain / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    a->shelf.b0 = (vh + vb * k / q + k * k) / a0;
+    a->shelf.b1 = 2.0 * (k * k - vh) / a0;
+    a->shelf.b2 = (vh - vb * k / q + k * k) / a0;
+    a->shelf.a1 = 2.0 * (k * k - 1.0) / a0;
+    a->shelf.a2 = (1.0 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan(M_PI * f0 / fs);
+    a0 = 1.0 + k / q + k * k;
+    a->highpass.b0 = 1.0f;
+    a->highpass.b1 = -2.0f;
+    a->highpass.b2 = 1.0f;
+    a->highpass.a1 = 2.0 * (k * k - 1.0) / a0;
+    a->highpass.a2 = (1.0 - k / q + k * k) / a0;
+}
+
+// Transposed direct form II, z holds the two state words
+static inline float biquad(const biquad_t *f, float *z, float x) {
+    float y = f->b0 * x + z[0];
+    z[0] = f->b1 * x - f->a1 * y + z[1];
+    z[1] = f->b2 * x - f->a2 * y;
+    return y;
+}
+
+// Windowed sinc, cut off at the input's Nyquist, each phase scaled to unity gain
+static void true_peak_init(audio_analysis_t *a) {
+    const int n = TP_PHASES * TP_TAPS;
+    const double center = (n - 1) / 2.0;
+    for (int p = 0; p < TP_PHASES; p++) {
+        double sum = 0;
+        for (int k = 0; k < TP_TAPS; k++) {
+            int i = k * TP_PHASES + p;
+            double t = (i - center) / TP_PHASES;
+            double sinc = t == 0 ? 1.0 : sin(M_PI * t) / (M_PI * t);
+            double w = 0.42 - 0.5 * cos(2 * M_PI * (i + 0.5) / n) + 0.08 * cos(4 * M_PI * (i + 0.5) / n);
+            a->tp_coef[p][k] = sinc * w;
+            sum += a->tp_coef[p][k];
+        }
+        for (int k = 0; k < TP_TAPS; k++) {
+            a->tp_coef[p][k] /= sum;
+        }
+    }
+}
+
+static bool format_init(audio_analysis_t *a) {
+    const uint8_t *f = a->fmt;
+    if (a->fmt_have < 16) {
+        return false;
+    }
+    a->format = le16(f);
+    a->channels = le16(f + 2);
+    a->sample_rate = le32(f + 4);
+    a->block_align = le16(f + 12);
+    if (a->format == WAVE_FORMAT_EXTENSIBLE && a->fmt_have >= 26) {
+        a->format = le16(f + 24);
+    }
+    if (a->channels < 1 || a->channels > 2 || a->sample_rate < 8000 || a->sample_rate > 192000) {
+        return false;
+    }
+    a->width = a->block_align / a->channels;
+    if (a->block_align != a->width * a->channels || a->block_align > sizeof(a->frame)) {
+        return false;
+    }
+    if (!(a->format == WAVE_FORMAT_PCM && a->width >= 1 && a->width <= 4) &&
+        !(a->format == WAVE_FORMAT_FLOAT && a->width == 4)) {
+        return false;
+    }
+
+    k_weighting_init(a);
+    a->sub_len = (a->sample_rate + 5) / 10;
+    a->edge_frames = a->sample_rate * AUDIO_ANALYSIS_EDGE_MS / 1000;
+    return true;
+}
+
+static float sample_to_float(const audio_analysis_t *a, const uint8_t *p) {
+    switch (a->width) {
+        case 1:
+            return (p[0] - 128) / 128.0f;
+        case 2:
+            return (int16_t)le16(p) / 32768.0f;
+        case 3:
+            return (int32_t)((p[0] << 8) | (p[1] << 16) | ((uint32_t)p[2] << 24)) / 2147483648.0f;
+        default:
+            if (a->format == WAVE_FORMAT_FLOAT) {
+                float v;
+                memcpy(&v, p, sizeof(v));
+                return isfinite(v) ? v : 0.0f;
+            }
+            return (int32_t)le32(p) / 2147483648.0f;
+    }
+}
+
+static void block_done(audio_analysis_t *a) {
+    a->subs[a->n_subs % 4] = a->sub_energy;
+    a->n_subs++;
+    a->sub_energy = 0;
+    a->sub_have = 0;
+    if (a->n_subs < 4) {
+        return;
+    }
+
+    // 400 ms block, 75 % overlap
+    double z = (a->subs[0] + a->subs[1] + a->subs[2] + a->subs[3]) / (4.0 * a->sub_len);
+    if (z <= 0) {
+        return;
+    }
+    float l = -0.691f + 10.0f * log10f((float)z);
+    if (l <= HIST_MIN_LUFS) {
+        return;
+    }
+    int bin = (int)((l - HIST_MIN_LUFS) / HIST_BIN_LU);
+    if (bin >= HIST_BINS) {
+        bin = HIST_BINS - 1;
+    }
+    a->hist_count[bin]++;
+    a->hist_energy[bin] += z;
+}
+
+static void frame_analyse(audio_analysis_t *a, const uint8_t *p) {
+    float x[2];
+    x[0] = sample_to_float(a, p);
+    x[1] = a->channels == 2 ? sample_to_float(a, p + a->width) : x[0];
+
+    // a mono file plays on both channels, so it is measured as two
+    double energy = 0;
+    uint32_t pos = a->tp_pos;
+    for (int c = 0; c < 2; c++) {
+        float v = x[c];
+        float mag = fabsf(v);
+        if (mag > a->sample_peak) {
+            a->sample_peak = mag;
+        }
+        a->dc_sum[c] += v;
+
+        float k = biquad(&a->highpass, &a->z[c][2], biquad(&a->shelf, &a->z[c][0], v));
+        energy += (double)k * k;
+
+        float *h = a->tp_hist[c];
+        h[pos] = v;
+        h[pos + TP_TAPS] = v;
+        const float *w = &h[pos + 1];       // oldest first
+        for (int ph = 0; ph < TP_PHASES; ph++) {
+            float y = 0;
+            for (int t = 0; t < TP_TAPS; t++) {
+                y += a->tp_coef[ph][t] * w[TP_TAPS - 1 - t];
+            }
+            y = fabsf(y);
+            if (y > a->true_peak) {
+                a->true_peak = y;
+            }
+        }
+    }
+    a->tp_pos = (pos + 1) % TP_TAPS;
+
+    a->sub_energy += energy;
+    if (++a->sub_have == a->sub_len) {
+        block_done(a);
+    }
+
+    float mid = x[0] + x[1];
+    if (a->prev_mid < 0 && mid >= 0 && a->frames > 0) {
+        audio_analysis_result_t *r = &a->result;
+        if (a->frames < a->edge_frames && r->n_start_edges < AUDIO_ANALYSIS_MAX_EDGES) {
+            r->start_edges[r->n_start_edges++] = a->frames;
+        }
+        a->end_ring[a->n_end % AUDIO_ANALYSIS_MAX_EDGES] = a->frames;
+        a->n_end++;
+    }
+    a->prev_mid = mid;
+    a->frames++;
+}
+
+static size_t data_feed(audio_analysis_t *a, const uint8_t *buf, size_t len) {
+    size_t used = len < a->data_left ? len : a->data_left;
+    size_t i = 0;
+
+    // finish a frame split over the last feed
+    while (a->frame_have > 0 && i < used) {
+        a->frame[a->frame_have++] = buf[i++];
+        if (a->frame_have == a->block_align) {
+            frame_analyse(a, a->frame);
+            a->frame_have = 0;
+        }
+    }
+    for (; i + a->block_align <= used; i += a->block_align) {
+        frame_analyse(a, buf + i);
+    }
+    while (i < used) {
+        a->frame[a->frame_have++] = buf[i++];
+    }
+    a->data_left -= used;
+    return used;
+}
+
+audio_analysis_t *audio_analysis_create(void) {
+    audio_analysis_t *a = heap_tracker_calloc(1, sizeof(*a), MALLOC_CAP_SPIRAM);
+    if (!a) {
+        ESP_LOGW(TAG, "No memory for the analyser (%d bytes)", (int)sizeof(*a));
+        return NULL;
+    }
+    a->state = ST_RIFF;
+    true_peak_init(a);
+    return a;
+}
+
+void audio_analysis_feed(audio_analysis_t *a, const uint8_t *buf, size_t len) {
+    while (len > 0) {
+        size_t n;
+        switch (a->state) {
+            case ST_RIFF:
+            case ST_CHUNK_HEADER: {
+                uint32_t want = a->state == ST_RIFF ? 12 : 8;
+                n = want - a->hdr_have;
+                if (n > len) {
+                    n = len;
+                }
+                memcpy(a->hdr + a->hdr_have, buf, n);
+                a->hdr_have += n;
+                if (a->hdr_have < want) {
+                    break;
+                }
+                a->hdr_have = 0;
+                if (a->state == ST_RIFF) {
+                    bool wav = memcmp(a->hdr, "RIFF", 4) == 0 && memcmp(a->hdr + 8, "WAVE", 4) == 0;
+                    a->state = wav ? ST_CHUNK_HEADER : ST_UNSUPPORTED;
+                    break;
+                }
+                uint32_t size = le32(a->hdr + 4);
+                if (memcmp(a->hdr, "data", 4) == 0) {
+                    if (!a->have_fmt) {
+                        a->state = ST_UNSUPPORTED;
+                        break;
+                    }
+                    // 0 is what some streaming writers leave, take it as "to the end"
+                    a->data_left = size ? size : UINT32_MAX;
+                    a->state = ST_DATA;
+                    break;
+                }
+                a->in_fmt = memcmp(a->hdr, "fmt ", 4) == 0 && !a->have_fmt;
+                a->fmt_want = a->in_fmt ? (size < sizeof(a->fmt) ? size : sizeof(a->fmt)) : 0;
+                a->skip = size - a->fmt_want + (size & 1);
+                a->state = ST_CHUNK_BODY;
+                break;
+            }
+
+            case ST_CHUNK_BODY:
+                if (a->fmt_want > 0) {
+                    n = a->fmt_want < len ? a->fmt_want : len;
+                    memcpy(a->fmt + a->fmt_have, buf, n);
+                    a->fmt_have += n;
+                    a->fmt_want -= n;
+                } else {
+                    n = a->skip < len ? a->skip : len;
+                    a->skip -= n;
+                }
+                if (a->fmt_want == 0 && a->skip == 0) {
+                    if (a->in_fmt) {
+                        a->have_fmt = format_init(a);
+                        if (!a->have_fmt) {
+                            a->state = ST_UNSUPPORTED;
+                            break;
+                        }
+                    }
+                    a->state = ST_CHUNK_HEADER;
+                }
+                break;
+
+            case ST_DATA:
+                n = data_feed(a, buf, len);
+                if (a->data_left == 0) {
+                    // trailing chunks (LIST, id3) aren't analysed
+                    a->state = ST_DONE;
+                    return;
+                }
+                break;
+
+            default:
+                return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+static float to_db(float v) {
+    return v > 0 ? fmaxf(20.0f * log10f(v), FLOOR_DB) : FLOOR_DB;
+}
+
+esp_err_t audio_analysis_finish(audio_analysis_t *a, audio_analysis_result_t *result) {
+    if (a->state != ST_DATA && a->state != ST_DONE) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (a->frames == 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    audio_analysis_result_t *r = &a->result;
+    r->sample_rate = a->sample_rate;
+    r->channels = a->channels;
+    r->frames = a->frames;
+
+    // Integrated loudness: the absolute gate is the histogram floor, the
+    // relative gate is 10 LU under the loudness of what passed it
+    uint32_t count = 0;
+    double energy = 0;
+    for (int i = 0; i < HIST_BINS; i++) {
+        count += a->hist_count[i];
+        energy += a->hist_energy[i];
+    }
+    if (count > 0) {
+        double relative = energy / count * 0.1;     // -10 LU
+        uint32_t gated_count = 0;
+        double gated_energy = 0;
+        for (int i = 0; i < HIST_BINS; i++) {
+            if (a->hist_count[i] && a->hist_energy[i] / a->hist_count[i] > relative) {
+                gated_count += a->hist_count[i];
+                gated_energy += a->hist_energy[i];
+            }
+        }
+        if (gated_count > 0) {
+            r->has_loudness = true;
+            r->integrated_lufs = -0.691f + 10.0f * log10f((float)(gated_energy / gated_count));
+        }
+    }
+
+    r->sample_peak_dbfs = to_db(a->sample_peak);
+    r->true_peak_dbtp = to_db(fmaxf(a->true_peak, a->sample_peak));
+    for (int c = 0; c < 2; c++) {
+        r->dc_offset[c] = (float)(a->dc_sum[c] / a->frames);
+    }
+
+    // the last crossings, those close enough to the end
+    uint32_t n = a->n_end < AUDIO_ANALYSIS_MAX_EDGES ? a->n_end : AUDIO_ANALYSIS_MAX_EDGES;
+    for (uint32_t i = a->n_end - n; i < a->n_end; i++) {
+        uint32_t frame = a->end_ring[i % AUDIO_ANALYSIS_MAX_EDGES];
+        if (frame + a->edge_frames >= a->frames) {
+            r->end_edges[r->n_end_edges++] = frame;
+        }
+    }
+
+    *result = *r;
+    return ESP_OK;
+}
+
+void audio_analysis_destroy(audio_analysis_t *a) {
+    free(a);
+}
+
+static void sidecar_path(const char *audio_path, char *out, size_t len) {
+    snprintf(out, len, "%s" AUDIO_ANALYSIS_SUFFIX, audio_path);
+}
+
+static cJSON *edges_to_json(const uint32_t *edges, int n) {
+    cJSON *arr = cJSON_CreateArray();
+    for (int i = 0; i < n; i++) {
+        cJSON_AddItemToArray(arr, cJSON_CreateNumber(edges[i]));
+    }
+    return arr;
+}
+
+static int edges_from_json(const cJSON *arr, uint32_t *edges) {
+    int n = 0;
+    const cJSON *item;
+    cJSON_ArrayForEach(item, arr) {
+        if (n < AUDIO_ANALYSIS_MAX_EDGES && cJSON_IsNumber(item)) {
+            edges[n++] = (uint32_t)item->valuedouble;
+        }
+    }
+    return n;
+}
+
+esp_err_t audio_analysis_save(const char *audio_path, const audio_analysis_result_t *r) {
+    char path[280];
+    sidecar_path(audio_path, path, sizeof(path));
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "version", SIDECAR_VERSION);
+    cJSON_AddNumberToObject(root, "sample_rate", r->sample_rate);
+    cJSON_AddNumberToObject(root, "channels", r->channels);
+    cJSON_AddNumberToObject(root, "frames", r->frames);
+    // left out when too short or too quiet to measure
+    if (r->has_loudness) {
+        cJSON_AddNumberToObject(root, "integrated_lufs", roundf(r->integrated_lufs * 100) / 100);
+    }
+    cJSON_AddNumberToObject(root, "true_peak_dbtp", roundf(r->true_peak_dbtp * 100) / 100);
+    cJSON_AddNumberToObject(root, "sample_peak_dbfs", roundf(r->sample_peak_dbfs * 100) / 100);
+    cJSON *dc = cJSON_CreateArray();
+    for (int c = 0; c < 2; c++) {
+        cJSON_AddItemToArray(dc, cJSON_CreateNumber(r->dc_offset[c]));
+    }
+    cJSON_AddItemToObject(root, "dc_offset", dc);
+    cJSON_AddItemToObject(root, "loop_start_candidates", edges_to_json(r->start_edges, r->n_start_edges));
+    cJSON_AddItemToObject(root, "loop_end_candidates", edges_to_json(r->end_edges, r->n_end_edges));
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (!json_str) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t ret = ESP_OK;
+    sd_arbiter_begin(SD_IO_METADATA);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        ESP_LOGW(TAG, "Failed to create %s", path);
+        ret = ESP_FAIL;
+    } else {
+        size_t len = strlen(json_str);
+        if (fwrite(json_str, 1, len, f) != len) {
+            ret = ESP_FAIL;
+        }
+        fclose(f);
+        if (ret != ESP_OK) {
+            remove(path);
+        }
+    }
+    sd_arbiter_end(SD_IO_METADATA);
+    free(json_str);
+    return ret;
+}
+
+esp_err_t audio_analysis_load(const char *audio_path, audio_analysis_result_t *r) {
+    char path[280];
+    sidecar_path(audio_path, path, sizeof(path));
+
+    struct stat st;
+    sd_arbiter_begin(SD_IO_METADATA);
+    if (stat(path, &st) != 0) {
+        sd_arbiter_end(SD_IO_METADATA);
+        return ESP_ERR_NOT_FOUND;
+    }
+    // a sidecar is a few hundred bytes, anything big isn't ours
+    if (st.st_size <= 0 || st.st_size > 4096) {
+        sd_arbiter_end(SD_IO_METADATA);
+        return ESP_FAIL;
+    }
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        sd_arbiter_end(SD_IO_METADATA);
+        return ESP_ERR_NOT_FOUND;
+    }
+    char *buf = heap_tracker_malloc(st.st_size + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!buf) {
+        fclose(f);
+        sd_arbiter_end(SD_IO_METADATA);
+        return ESP_ERR_NO_MEM;
+    }
+    size_t len = fread(buf, 1, st.st_size, f);
+    fclose(f);
+    sd_arbiter_end(SD_IO_METADATA);
+    buf[len] = '\0';
+    cJSON *root = cJSON_Parse(buf);
+    free(buf);
+    if (!root) {
+        ESP_LOGW(TAG, "Can't parse %s", path);
+        return ESP_FAIL;
+    }
+
+    memset(r, 0, sizeof(*r));
+    cJSON *item;
+    if (cJSON_IsNumber(item = cJSON_GetObjectItem(root, "sample_rate"))) r->sample_rate = item->valuedouble;
+    if (cJSON_IsNumber(item = cJSON_GetObjectItem(root, "channels"))) r->channels = item->valuedouble;
+    if (cJSON_IsNumber(item = cJSON_GetObjectItem(root, "frames"))) r->frames = item->valuedouble;
+    if (cJSON_IsNumber(item = cJSON_GetObjectItem(root, "integrated_lufs"))) {
+        r->has_loudness = true;
+        r->integrated_lufs = item->valuedouble;
+    }
+    r->true_peak_dbtp = FLOOR_DB;
+    if (cJSON_IsNumber(item = cJSON_GetObjectItem(root, "true_peak_dbtp"))) r->true_peak_dbtp = item->valuedouble;
+    r->sample_peak_dbfs = FLOOR_DB;
+    if (cJSON_IsNumber(item = cJSON_GetObjectItem(root, "sample_peak_dbfs"))) r->sample_peak_dbfs = item->valuedouble;
+    cJSON *dc = cJSON_GetObjectItem(root, "dc_offset");
+    for (int c = 0; c < 2 && cJSON_IsArray(dc); c++) {
+        if (cJSON_IsNumber(item = cJSON_GetArrayItem(dc, c))) r->dc_offset[c] = item->valuedouble;
+    }
+    r->n_start_edges = edges_from_json(cJSON_GetObjectItem(root, "loop_start_candidates"), r->start_edges);
+    r->n_end_edges = edges_from_json(cJSON_GetObjectItem(root, "loop_end_candidates"), r->end_edges);
+
+    cJSON_Delete(root);
+    return ESP_OK;
+}
+
+void audio_analysis_remove(const char *audio_path) {
+    char path[280];
+    sidecar_path(audio_path, path, sizeof(path));
+    sd_arbiter_begin(SD_IO_METADATA);
+    remove(path);
+    sd_arbiter_end(SD_IO_METADATA);
+}
+
+float audio_analysis_normalize_gain_db(const audio_analysis_result_t *r) {
+    if (!r->has_loudness) {
+        return 0.0f;
+    }
+    float gain = AUDIO_ANALYSIS_TARGET_LUFS - r->integrated_lufs;
+    float headroom = AUDIO_ANALYSIS_MAX_TP_DBTP - r->true_peak_dbtp;
+    if (gain > headroom) {
+        gain = headroom;
+    }
+    if (gain > AUDIO_ANALYSIS_MAX_GAIN_DB) {
+        gain = AUDIO_ANALYSIS_MAX_GAIN_DB;
+    }
+    if (gain < -AUDIO_ANALYSIS_MAX_GAIN_DB) {
+        gain = -AUDIO_ANALYSIS_MAX_GAIN_DB;
+    }
+    return gain;
+}
@@ -0,0 +1,95 @@
+#ifndef AUDIO_ANALYSIS_H
+#define AUDIO_ANALYSIS_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Sidecar written next to an analysed file: /sdcard/loop1.wav -> /sdcard/loop1.wav.json
+#define AUDIO_ANALYSIS_SUFFIX       ".json"
+
+// Loop edge candidates are rising zero crossings this close to either end
+#define AUDIO_ANALYSIS_EDGE_MS      50
+#define AUDIO_ANALYSIS_MAX_EDGES    4
+
+// Playback normalisation: files are brought to this loudness, as far as the
+// true peak ceiling and the gain limit allow
+#define AUDIO_ANALYSIS_TARGET_LUFS  -18.0f
+#define AUDIO_ANALYSIS_MAX_TP_DBTP  -1.0f
+#define AUDIO_ANALYSIS_MAX_GAIN_DB  12.0f
+
+typedef struct {
+    uint32_t sample_rate;
+    uint16_t channels;
+    uint32_t frames;
+
+    bool has_loudness;              // false if shorter than one 400 ms block, or silent
+    float integrated_lufs;          // BS.1770-4, gated
+    float true_peak_dbtp;           // 4x oversampled
+    float sample_peak_dbfs;
+    float dc_offset[2];             // mean, full scale 1.0
+
+    // frames of rising zero crossings (mid channel) within AUDIO_ANALYSIS_EDGE_MS
+    // of the start, and of the end, in order
+    uint8_t n_start_edges;
+    uint8_t n_end_edges;
+    uint32_t start_edges[AUDIO_ANALYSIS_MAX_EDGES];
+    uint32_t end_edges[AUDIO_ANALYSIS_MAX_EDGES];
+} audio_analysis_result_t;
+
+typedef struct audio_analysis_s audio_analysis_t;
+
+/**
+ * @brief Start analysing a file that will arrive in pieces
+ *
+ * Everything is measured in one pass over the bytes as they are written,
+ * so the file never has to be read back. Understands PCM WAV (8 to 32 bit,
+ * float, mono or stereo, any rate); anything else is ignored, and
+ * audio_analysis_finish() says so.
+ *
+ * @return the analyser, or NULL if out of memory
+ */
+audio_analysis_t *audio_analysis_create(void);
+
+/**
+ * @brief Feed the next bytes of the file, any length
+ */
+void audio_analysis_feed(audio_analysis_t *a, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Finish the pass and get the results
+ *
+ * @return ESP_OK, ESP_ERR_NOT_SUPPORTED if it wasn't a WAV the analyser
+ *         understands, ESP_ERR_INVALID_SIZE if it had no samples
+ */
+esp_err_t audio_analysis_finish(audio_analysis_t *a, audio_analysis_result_t *result);
+
+void audio_analysis_destroy(audio_analysis_t *a);
+
+/**
+ * @brief Write the sidecar for audio_path
+ */
+esp_err_t audio_analysis_save(const char *audio_path, const audio_analysis_result_t *result);
+
+/**
+ * @brief Read the sidecar for audio_path
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND if there is none, ESP_FAIL if it doesn't parse
+ */
+esp_err_t audio_analysis_load(const char *audio_path, audio_analysis_result_t *result);
+
+/**
+ * @brief Remove the sidecar for audio_path, if there is one
+ */
+void audio_analysis_remove(const char *audio_path);
+
+/**
+ * @brief Gain that brings the file to AUDIO_ANALYSIS_TARGET_LUFS
+ *
+ * Limited so the true peak stays under AUDIO_ANALYSIS_MAX_TP_DBTP, and to
+ * +-AUDIO_ANALYSIS_MAX_GAIN_DB. 0 if the loudness is unknown.
+ */
+float audio_analysis_normalize_gain_db(const audio_analysis_result_t *result);
+
+#endif /* AUDIO_ANALYSIS_H */
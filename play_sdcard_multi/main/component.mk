@@ -13,6 +13,19 @@ COMPONENT_SRCS := http_server.c \
                   play_sdcard.c \
                   play_sdcard_debug.c \
                   play_sdcard_passthrough.c \
+                  wav_header.c \
+                  audio_analysis.c \
+                  flash_store.c \
+                  shared_read.c \
+                  sd_arbiter.c \
+                  mp3_index.c \
+                  playhead.c \
+                  oneshot.c \
+                  osc_server.c \
+                  master_bus.c \
+                  convolver.c \
+                  spectrum.c \
+                  track_reader.c \
                   wifi_manager.c
 
 COMPONENT_ADD_INCLUDEDIRS := .
@@ -1,6 +1,8 @@
 #include "config_manager.h"
 #include "cJSON.h"
 #include "esp_log.h"
+#include "heap_tracker.h"
+#include "sd_arbiter.h"
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -76,8 +78,10 @@ esp_err_t config_save(const loop_manager_t *manager) {
     }
     
     // Write to file
+    sd_arbiter_begin(SD_IO_METADATA);
     FILE *f = fopen(CONFIG_FILE_PATH, "w");
     if (!f) {
+        sd_arbiter_end(SD_IO_METADATA);
         ESP_LOGE(TAG, "Failed to open config file for writing: %s", CONFIG_FILE_PATH);
         free(json_str);
         return ESP_FAIL;
@@ -88,6 +92,7 @@ esp_err_t config_save(const loop_manager_t *manager) {
     
     size_t written = fwrite(json_str, 1, json_len, f);
     int close_result = fclose(f);
+    sd_arbiter_end(SD_IO_METADATA);
     
     free(json_str);
     
@@ -103,12 +108,7 @@ esp_err_t config_save(const loop_manager_t *manager) {
     return ESP_OK;
 }
 
-esp_err_t config_load(loop_config_t *config) {
-    if (!config) {
-        ESP_LOGE(TAG, "Invalid config pointer");
-        return ESP_ERR_INVALID_ARG;
-    }
-    
+static esp_err_t config_load_file(loop_config_t *config) {
     // Check if file exists
     struct stat st;
     if (stat(CONFIG_FILE_PATH, &st) != 0) {
@@ -124,7 +124,7 @@ esp_err_t config_load(loop_config_t *config) {
     }
     
     // Allocate buffer for file content
-    char *buffer = heap_caps_malloc(st.st_size + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    char *buffer = heap_tracker_malloc(st.st_size + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
     if (!buffer) {
         fclose(f);
         ESP_LOGE(TAG, "Failed to allocate memory for config file");
@@ -153,6 +153,18 @@ esp_err_t config_load(loop_config_t *config) {
     return ret;
 }
 
+esp_err_t config_load(loop_config_t *config) {
+    if (!config) {
+        ESP_LOGE(TAG, "Invalid config pointer");
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    sd_arbiter_begin(SD_IO_METADATA);
+    esp_err_t ret = config_load_file(config);
+    sd_arbiter_end(SD_IO_METADATA);
+    return ret;
+}
+
 esp_err_t config_apply(const loop_config_t *config, QueueHandle_t audio_control_queue, loop_manager_t *loop_manager) {
     if (!config || !audio_control_queue || !loop_manager) {
         ESP_LOGE(TAG, "Invalid parameters");
@@ -231,11 +243,17 @@ esp_err_t config_apply(const loop_config_t *config, QueueHandle_t audio_control_
 
 bool config_exists(void) {
     struct stat st;
-    return (stat(CONFIG_FILE_PATH, &st) == 0);
+    sd_arbiter_begin(SD_IO_METADATA);
+    bool exists = (stat(CONFIG_FILE_PATH, &st) == 0);
+    sd_arbiter_end(SD_IO_METADATA);
+    return exists;
 }
 
 esp_err_t config_delete(void) {
-    if (unlink(CONFIG_FILE_PATH) == 0) {
+    sd_arbiter_begin(SD_IO_METADATA);
+    int ret = unlink(CONFIG_FILE_PATH);
+    sd_arbiter_end(SD_IO_METADATA);
+    if (ret == 0) {
         ESP_LOGI(TAG, "Configuration file deleted");
         return ESP_OK;
     } else {
@@ -244,7 +262,7 @@ esp_err_t config_delete(void) {
     }
 }
 
-esp_err_t config_backup(void) {
+static esp_err_t config_backup_file(void) {
     // Check if original file exists
     if (!config_exists()) {
         ESP_LOGW(TAG, "No configuration file to backup");
@@ -263,7 +281,7 @@ esp_err_t config_backup(void) {
         return ESP_FAIL;
     }
     
-    char *buffer = heap_caps_malloc(st.st_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    char *buffer = heap_tracker_malloc(st.st_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
     if (!buffer) {
         fclose(src);
         return ESP_ERR_NO_MEM;
@@ -298,7 +316,7 @@ esp_err_t config_backup(void) {
     return ESP_OK;
 }
 
-esp_err_t config_restore_backup(void) {
+static esp_err_t config_restore_file(void) {
     // Check if backup exists
     struct stat st;
     if (stat(CONFIG_BACKUP_PATH, &st) != 0) {
@@ -313,7 +331,7 @@ esp_err_t config_restore_backup(void) {
         return ESP_FAIL;
     }
     
-    char *buffer = heap_caps_malloc(st.st_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    char *buffer = heap_tracker_malloc(st.st_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
     if (!buffer) {
         fclose(src);
         return ESP_ERR_NO_MEM;
@@ -348,6 +366,20 @@ esp_err_t config_restore_backup(void) {
     return ESP_OK;
 }
 
+esp_err_t config_backup(void) {
+    sd_arbiter_begin(SD_IO_METADATA);
+    esp_err_t ret = config_backup_file();
+    sd_arbiter_end(SD_IO_METADATA);
+    return ret;
+}
+
+esp_err_t config_restore_backup(void) {
+    sd_arbiter_begin(SD_IO_METADATA);
+    esp_err_t ret = config_restore_file();
+    sd_arbiter_end(SD_IO_METADATA);
+    return ret;
+}
+
 esp_err_t config_to_json_string(const loop_manager_t *manager, char **json_str) {
     if (!manager || !json_str) {
         return ESP_ERR_INVALID_ARG;
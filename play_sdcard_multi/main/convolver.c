@@ -0,0 +1,418 @@
+/* Partitioned FFT convolution for speaker correction, see convolver.h
+
+   Overlap-save with N = 2B point transforms, B = CONVOLVER_BLOCK. Filter
+   piece p, taps pB to pB+B-1, is zero padded to N and transformed at load,
+   H[p]. Each block of B frames is transformed with the block before it,
+   X, and kept in a ring of the last P, the frequency domain delay line.
+   The output block is the last B points of the inverse transform of
+   sum over p of X[now - p] * H[p].
+
+   L and R go in as the real and imaginary parts of one signal; the filter
+   is real, so they come out the same way. The inverse transform is the
+   forward one on the conjugate, which the multiply-add produces, and 1/N
+   is folded into H.
+
+   The spectra are P * 4 KB each for H and the delay line, in PSRAM; the
+   work buffers are in internal RAM. s_lock is held for each block on the
+   bus, so a load builds its engine first and only swaps under it.
+
+   Author: Brian Bulkowski brian@bulkowski.org
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "heap_tracker.h"
+#include "sd_arbiter.h"
+#include "wav_header.h"
+#include "convolver.h"
+
+#if defined(ESP_PLATFORM) && __has_include("esp_dsp.h")
+#include "esp_dsp.h"
+#define CONVOLVER_ESP_DSP 1
+#else
+#define CONVOLVER_ESP_DSP 0
+#endif
+
+static const char *TAG = "CONVOLVER";
+
+#define B               CONVOLVER_BLOCK
+#define N               CONVOLVER_FFT_SIZE
+#define SPECTRUM_FLOATS (2 * N)
+
+struct convolver {
+    int taps;
+    int partitions;
+    float *h;                       // partitions spectra
+    float *fdl;                     // partitions spectra, newest at head
+    int head;
+    float *in;                      // 2B frames, complex: the last block then the one filling
+    float *work;                    // one spectrum
+    int16_t out[2 * B];             // the last block's output, played while the next fills
+    int pos;                        // frames into the block filling
+    uint32_t max_block_us;
+};
+
+// Twiddles e^(-2 pi i k / N) for k < N/2, and the bit reversed order
+static float s_twiddle[N];
+static uint16_t s_bitrev[N];
+static bool s_tables;
+static bool s_simd;
+
+static SemaphoreHandle_t s_lock;
+static convolver_t *s_active;
+static char s_path[256];
+static uint64_t s_busy_us;
+static uint32_t s_busy_frames;
+static uint32_t s_cpu_permille;
+
+static void fft_tables(void) {
+    if (s_tables) {
+        return;
+    }
+    int bits = 0;
+    while ((1 << bits) < N) {
+        bits++;
+    }
+    for (int k = 0; k < N / 2; k++) {
+        s_twiddle[2 * k] = cosf(2.0f * (float)M_PI * k / N);
+        s_twiddle[2 * k + 1] = -sinf(2.0f * (float)M_PI * k / N);
+    }
+    for (int i = 0; i < N; i++) {
+        int r = 0;
+        for (int b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        s_bitrev[i] = r;
+    }
+#if CONVOLVER_ESP_DSP
+    s_simd = dsps_fft2r_init_fc32(NULL, N) == ESP_OK;
+#endif
+    s_tables = true;
+}
+
+// In place, N complex points interleaved, natural order in and out
+static void fft(float *x) {
+#if CONVOLVER_ESP_DSP
+    if (s_simd) {
+        dsps_fft2r_fc32(x, N);
+        dsps_bit_rev_fc32(x, N);
+        return;
+    }
+#endif
+    for (int i = 0; i < N; i++) {
+        int j = s_bitrev[i];
+        if (j > i) {
+            float re = x[2 * i], im = x[2 * i + 1];
+            x[2 * i] = x[2 * j];
+            x[2 * i + 1] = x[2 * j + 1];
+            x[2 * j] = re;
+            x[2 * j + 1] = im;
+        }
+    }
+    for (int len = 2; len <= N; len <<= 1) {
+        int half = len / 2;
+        int step = N / len;
+        for (int i = 0; i < N; i += len) {
+            for (int k = 0; k < half; k++) {
+                float wr = s_twiddle[2 * k * step];
+                float wi = s_twiddle[2 * k * step + 1];
+                float *a = &x[2 * (i + k)];
+                float *b = &x[2 * (i + k + half)];
+                float tr = b[0] * wr - b[1] * wi;
+                float ti = b[0] * wi + b[1] * wr;
+                b[0] = a[0] - tr;
+                b[1] = a[1] - ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
+        }
+    }
+}
+
+static inline int16_t saturate(float v) {
+    if (v >= 32767.0f) {
+        return 32767;
+    }
+    if (v <= -32768.0f) {
+        return -32768;
+    }
+    return (int16_t)lrintf(v);
+}
+
+convolver_t *convolver_create(const float *taps, int n_taps) {
+    if (!taps || n_taps < 1 || n_taps > CONVOLVER_MAX_TAPS) {
+        return NULL;
+    }
+    fft_tables();
+    convolver_t *c = heap_tracker_calloc(1, sizeof(*c), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!c) {
+        return NULL;
+    }
+    c->taps = n_taps;
+    c->partitions = (n_taps + B - 1) / B;
+    size_t spectra = (size_t)c->partitions * SPECTRUM_FLOATS * sizeof(float);
+    c->h = heap_tracker_malloc(spectra, MALLOC_CAP_SPIRAM);
+    c->fdl = heap_tracker_calloc(1, spectra, MALLOC_CAP_SPIRAM);
+    c->in = heap_tracker_calloc(1, SPECTRUM_FLOATS * sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    c->work = heap_tracker_malloc(SPECTRUM_FLOATS * sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!c->h || !c->fdl || !c->in || !c->work) {
+        convolver_destroy(c);
+        return NULL;
+    }
+    for (int p = 0; p < c->partitions; p++) {
+        float *h = c->h + p * SPECTRUM_FLOATS;
+        memset(h, 0, SPECTRUM_FLOATS * sizeof(float));
+        for (int i = 0; i < B && p * B + i < n_taps; i++) {
+            h[2 * i] = taps[p * B + i] / N;
+        }
+        fft(h);
+    }
+    return c;
+}
+
+void convolver_destroy(convolver_t *c) {
+    if (!c) {
+        return;
+    }
+    free(c->h);
+    free(c->fdl);
+    free(c->in);
+    free(c->work);
+    free(c);
+}
+
+// The block in c->in is full: its output to c->out, and slide it down
+static void convolver_block(convolver_t *c) {
+    int64_t start = esp_timer_get_time();
+    c->head = (c->head + 1) % c->partitions;
+    float *x = c->fdl + c->head * SPECTRUM_FLOATS;
+    memcpy(x, c->in, SPECTRUM_FLOATS * sizeof(float));
+    fft(x);
+
+    // The conjugate of the sum, ready for the inverse
+    float *acc = c->work;
+    memset(acc, 0, SPECTRUM_FLOATS * sizeof(float));
+    for (int p = 0; p < c->partitions; p++) {
+        const float *xp = c->fdl + ((c->head - p + c->partitions) % c->partitions) * SPECTRUM_FLOATS;
+        const float *hp = c->h + p * SPECTRUM_FLOATS;
+        for (int k = 0; k < SPECTRUM_FLOATS; k += 2) {
+            acc[k] += xp[k] * hp[k] - xp[k + 1] * hp[k + 1];
+            acc[k + 1] -= xp[k] * hp[k + 1] + xp[k + 1] * hp[k];
+        }
+    }
+    fft(acc);
+
+    // The last B points are the good ones, conjugated back
+    for (int i = 0; i < B; i++) {
+        c->out[2 * i] = saturate(acc[2 * (B + i)]);
+        c->out[2 * i + 1] = saturate(-acc[2 * (B + i) + 1]);
+    }
+    memmove(c->in, c->in + 2 * B, 2 * B * sizeof(float));
+
+    uint32_t us = (uint32_t)(esp_timer_get_time() - start);
+    if (us > c->max_block_us) {
+        c->max_block_us = us;
+    }
+}
+
+void convolver_run(convolver_t *c, int16_t *pcm, uint32_t frames) {
+    while (frames > 0) {
+        uint32_t n = B - c->pos;
+        if (n > frames) {
+            n = frames;
+        }
+        float *in = c->in + 2 * (B + c->pos);
+        int16_t *out = c->out + 2 * c->pos;
+        for (uint32_t i = 0; i < 2 * n; i++) {
+            in[i] = pcm[i];
+            pcm[i] = out[i];
+        }
+        pcm += 2 * n;
+        frames -= n;
+        c->pos += n;
+        if (c->pos == B) {
+            convolver_block(c);
+            c->pos = 0;
+        }
+    }
+}
+
+// First channel of each frame, as float at full scale 1.0
+static bool read_taps(FILE *f, const wav_header_info_t *wav, float *taps, int n_taps) {
+    uint8_t frame[64];
+    if (wav->block_align > sizeof(frame)) {
+        return false;
+    }
+    for (int i = 0; i < n_taps; i++) {
+        if (fread(frame, wav->block_align, 1, f) != 1) {
+            return false;
+        }
+        if (wav->format == 3) {
+            memcpy(&taps[i], frame, sizeof(float));
+        } else if (wav->bits_per_sample == 16) {
+            taps[i] = (int16_t)(frame[0] | (frame[1] << 8)) / 32768.0f;
+        } else if (wav->bits_per_sample == 24) {
+            int32_t v = (int32_t)(((uint32_t)frame[0] << 8) | ((uint32_t)frame[1] << 16) | ((uint32_t)frame[2] << 24));
+            taps[i] = (v >> 8) / 8388608.0f;
+        } else {
+            int32_t v = (int32_t)(frame[0] | ((uint32_t)frame[1] << 8) | ((uint32_t)frame[2] << 16) |
+                                  ((uint32_t)frame[3] << 24));
+            taps[i] = v / 2147483648.0f;
+        }
+    }
+    return true;
+}
+
+esp_err_t convolver_load(const char *path) {
+    if (!path || strlen(path) >= sizeof(s_path)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    wav_header_info_t wav;
+    float *taps = NULL;
+    int n_taps = 0;
+    FILE *f;
+    sd_arbiter_begin(SD_IO_METADATA);
+    esp_err_t err = wav_header_open(path, &f, &wav);
+    if (err == ESP_ERR_INVALID_ARG) {
+        err = ESP_ERR_NOT_SUPPORTED;
+    }
+    if (f) {
+        bool pcm = wav.format == 1 &&
+                   (wav.bits_per_sample == 16 || wav.bits_per_sample == 24 || wav.bits_per_sample == 32);
+        bool flt = wav.format == 3 && wav.bits_per_sample == 32;
+        if (err == ESP_OK && ((!pcm && !flt) || wav.sample_rate != WAV_NATIVE_SAMPLE_RATE || wav.channels < 1)) {
+            err = ESP_ERR_NOT_SUPPORTED;
+        }
+        if (err == ESP_OK) {
+            n_taps = wav.data_size / wav.block_align;
+            if (n_taps < 1 || n_taps > CONVOLVER_MAX_TAPS) {
+                err = ESP_ERR_INVALID_SIZE;
+            }
+        }
+        if (err == ESP_OK) {
+            taps = heap_tracker_malloc(n_taps * sizeof(float), MALLOC_CAP_SPIRAM);
+            if (!taps) {
+                err = ESP_ERR_NO_MEM;
+            } else if (!read_taps(f, &wav, taps, n_taps)) {
+                err = ESP_ERR_INVALID_SIZE;
+            }
+        }
+        fclose(f);
+    }
+    sd_arbiter_end(SD_IO_METADATA);
+
+    convolver_t *c = NULL;
+    if (err == ESP_OK) {
+        c = convolver_create(taps, n_taps);
+        if (!c) {
+            err = ESP_ERR_NO_MEM;
+        }
+    }
+    free(taps);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Can't load %s: %s", path, esp_err_to_name(err));
+        return err;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    convolver_t *old = s_active;
+    s_active = c;
+    strcpy(s_path, path);
+    s_busy_us = 0;
+    s_busy_frames = 0;
+    s_cpu_permille = 0;
+    xSemaphoreGive(s_lock);
+    convolver_destroy(old);
+    ESP_LOGI(TAG, "Correcting with %s, %d taps in %d partitions", path, n_taps, c->partitions);
+    return ESP_OK;
+}
+
+void convolver_clear(void) {
+    if (!s_lock) {
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    convolver_t *old = s_active;
+    s_active = NULL;
+    s_path[0] = '\0';
+    xSemaphoreGive(s_lock);
+    convolver_destroy(old);
+    if (old) {
+        ESP_LOGI(TAG, "Speaker correction off");
+    }
+}
+
+void convolver_process(int16_t *pcm, uint32_t frames) {
+    if (!s_lock) {
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_active) {
+        int64_t start = esp_timer_get_time();
+        convolver_run(s_active, pcm, frames);
+        s_busy_us += esp_timer_get_time() - start;
+        s_busy_frames += frames;
+        if (s_busy_frames >= WAV_NATIVE_SAMPLE_RATE) {
+            uint64_t audio_us = (uint64_t)s_busy_frames * 1000000 / WAV_NATIVE_SAMPLE_RATE;
+            s_cpu_permille = (uint32_t)(s_busy_us * 1000 / audio_us);
+            s_busy_us = 0;
+            s_busy_frames = 0;
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
+
+esp_err_t convolver_init(void) {
+    if (s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    fft_tables();
+    ESP_LOGI(TAG, "%s FFT, %d frame partitions", s_simd ? "esp-dsp" : "Portable", B);
+
+    struct stat st;
+    sd_arbiter_begin(SD_IO_METADATA);
+    bool found = stat(CONVOLVER_DEFAULT_PATH, &st) == 0;
+    sd_arbiter_end(SD_IO_METADATA);
+    if (found) {
+        convolver_load(CONVOLVER_DEFAULT_PATH);
+    }
+    return ESP_OK;
+}
+
+void convolver_get_info(convolver_info_t *info) {
+    memset(info, 0, sizeof(*info));
+    info->simd = s_simd;
+    if (!s_lock) {
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_active) {
+        info->loaded = true;
+        strcpy(info->file_path, s_path);
+        info->taps = s_active->taps;
+        info->partitions = s_active->partitions;
+        info->latency_frames = B;
+        info->cpu_permille = s_cpu_permille;
+        info->max_block_us = s_active->max_block_us;
+    }
+    xSemaphoreGive(s_lock);
+}
+
+void convolver_fft(float *x) {
+    fft_tables();
+    fft(x);
+}
@@ -0,0 +1,93 @@
+#ifndef CONVOLVER_H
+#define CONVOLVER_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Speaker correction: the master bus convolved with a FIR from the SD card.
+//
+// The small speakers in the frames have resonances and phase trouble a few
+// biquads can't undo; a measured correction filter of a few hundred to
+// CONVOLVER_MAX_TAPS taps can. Done directly that is up to 2048 multiplies
+// per sample per channel, so it is done in the frequency domain, uniformly
+// partitioned overlap-save: the filter is cut into CONVOLVER_BLOCK tap
+// pieces, each transformed once at load, and every CONVOLVER_BLOCK frames
+// of input costs one FFT, one inverse FFT and a multiply-add of the
+// spectra per piece. It adds CONVOLVER_BLOCK frames of latency.
+//
+// Left and right are transformed together, as the real and imaginary parts
+// of one complex signal. That works because both get the same filter.
+//
+// On the board the FFT is esp-dsp's when the component is there (SIMD on
+// the S3, assembly on the ESP32), otherwise the plain C one here.
+
+#define CONVOLVER_BLOCK             256
+#define CONVOLVER_FFT_SIZE          (2 * CONVOLVER_BLOCK)      // complex points
+#define CONVOLVER_MAX_TAPS          2048
+#define CONVOLVER_DEFAULT_PATH      "/sdcard/correction.wav"
+
+typedef struct convolver convolver_t;
+
+typedef struct {
+    bool loaded;
+    char file_path[256];
+    int taps;
+    int partitions;
+    uint32_t latency_frames;
+    uint32_t cpu_permille;          // of one core, over the last second of audio
+    uint32_t max_block_us;          // longest single partition, since load
+    bool simd;                      // esp-dsp's FFT
+} convolver_info_t;
+
+/**
+ * @brief Make a convolver for taps, which are used as they are (1.0 is unity)
+ *
+ * @return NULL if n_taps is out of range or memory is short
+ */
+convolver_t *convolver_create(const float *taps, int n_taps);
+
+/**
+ * @brief Filter interleaved stereo in place, CONVOLVER_BLOCK frames late
+ */
+void convolver_run(convolver_t *c, int16_t *pcm, uint32_t frames);
+
+void convolver_destroy(convolver_t *c);
+
+/**
+ * @brief Set up the master bus stage and load CONVOLVER_DEFAULT_PATH if it is there
+ */
+esp_err_t convolver_init(void);
+
+/**
+ * @brief Use the FIR in a WAV file for the master bus, in place of any before
+ *
+ * The first channel is the filter. 16, 24 or 32 bit PCM or float, at the
+ * output rate. The sound jumps by CONVOLVER_BLOCK frames as it goes in.
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND, ESP_ERR_NOT_SUPPORTED for another
+ *         format or rate, ESP_ERR_INVALID_SIZE for more than
+ *         CONVOLVER_MAX_TAPS, ESP_ERR_NO_MEM
+ */
+esp_err_t convolver_load(const char *path);
+
+/**
+ * @brief Stop correcting
+ */
+void convolver_clear(void);
+
+/**
+ * @brief Master bus stage, called with each block I2S reads
+ */
+void convolver_process(int16_t *pcm, uint32_t frames);
+
+void convolver_get_info(convolver_info_t *info);
+
+/**
+ * @brief The engine's FFT, for the other master bus stages: in place,
+ *        CONVOLVER_FFT_SIZE complex points interleaved, natural order in
+ *        and out, unscaled
+ */
+void convolver_fft(float *x);
+
+#endif /* CONVOLVER_H */
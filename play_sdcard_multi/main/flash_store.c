@@ -0,0 +1,433 @@
+/* Read-only audio store in a flash partition, served as a VFS at /flash.
+
+   The image is memory-mapped once, just as far as it reaches, and a VFS
+   read is a memcpy out of the mapping. flash_store_find() hands out the
+   mapped pointer itself, which the one-shot slots play from. Nothing here
+   touches FATFS or the SD bus, so a track playing from flash doesn't queue
+   behind uploads or card hiccups.
+
+   Rewriting over HTTP unmaps the image, erases sectors as the bytes reach
+   them and writes the magic number last, once the CRC of what landed in
+   flash checks out.
+
+   Author: Brian Bulkowski brian@bulkowski.org
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_vfs.h"
+#include "flash_store.h"
+
+static const char *TAG = "FLASH_STORE";
+
+#define SECTOR_SIZE     4096
+
+typedef struct {
+    bool used;
+    const flash_store_entry_t *entry;
+    uint32_t pos;
+} open_file_t;
+
+static const esp_partition_t *s_part;
+static SemaphoreHandle_t s_lock;
+
+// the live image, NULL while there is none
+static const uint8_t *s_base;
+static esp_partition_mmap_handle_t s_map;
+static const flash_store_header_t *s_header;
+static const flash_store_entry_t *s_entries;
+
+static open_file_t s_open[FLASH_STORE_MAX_OPEN];
+static int s_open_count;        // VFS files and flash_store_find() pointers
+
+// rewrite in progress
+static bool s_writing;
+static size_t s_write_size;
+static size_t s_write_pos;
+static size_t s_erased_to;
+static uint32_t s_write_magic;
+
+// zlib's CRC-32, a nibble at a time: a 64 byte table and fast enough for a
+// few MB at boot
+static uint32_t crc32_update(uint32_t crc, const uint8_t *p, size_t len) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ table[crc & 15];
+        crc = (crc >> 4) ^ table[crc & 15];
+    }
+    return ~crc;
+}
+
+// Checks an image in memory. The magic is left to the caller, a rewrite
+// checks everything else before writing it.
+static esp_err_t image_check(const uint8_t *base, size_t avail) {
+    const flash_store_header_t *h = (const flash_store_header_t *)base;
+    if (h->version != FLASH_STORE_VERSION || h->count > FLASH_STORE_MAX_ENTRIES) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    size_t table_end = sizeof(*h) + (size_t)h->count * sizeof(flash_store_entry_t);
+    if (h->image_size < table_end || h->image_size > avail) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const flash_store_entry_t *e = (const flash_store_entry_t *)(base + sizeof(*h));
+    for (int i = 0; i < h->count; i++) {
+        if (e[i].name[0] == '\0' || memchr(e[i].name, '\0', FLASH_STORE_NAME_LEN) == NULL ||
+            e[i].offset < table_end || e[i].offset > h->image_size ||
+            e[i].size > h->image_size - e[i].offset) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    if (crc32_update(0, base + sizeof(*h), h->image_size - sizeof(*h)) != h->crc32) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    return ESP_OK;
+}
+
+static void image_unmap(void) {
+    if (s_base) {
+        esp_partition_munmap(s_map);
+    }
+    s_base = NULL;
+    s_header = NULL;
+    s_entries = NULL;
+}
+
+// Maps the header to learn the size, then the whole image. check_magic is
+// false only while a rewrite is being verified.
+static esp_err_t image_map(bool check_magic) {
+    const void *ptr;
+    esp_partition_mmap_handle_t map;
+
+    image_unmap();
+    esp_err_t err = esp_partition_mmap(s_part, 0, SECTOR_SIZE, ESP_PARTITION_MMAP_DATA, &ptr, &map);
+    if (err != ESP_OK) {
+        return err;
+    }
+    flash_store_header_t h = *(const flash_store_header_t *)ptr;
+    esp_partition_munmap(map);
+
+    if (check_magic && h.magic != FLASH_STORE_MAGIC) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (h.image_size < sizeof(h) || h.image_size > s_part->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    err = esp_partition_mmap(s_part, 0, h.image_size, ESP_PARTITION_MMAP_DATA, &ptr, &map);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = image_check(ptr, s_part->size);
+    if (err != ESP_OK) {
+        esp_partition_munmap(map);
+        return err;
+    }
+    s_base = ptr;
+    s_map = map;
+    s_header = (const flash_store_header_t *)s_base;
+    s_entries = (const flash_store_entry_t *)(s_base + sizeof(*s_header));
+    return ESP_OK;
+}
+
+static const flash_store_entry_t *entry_find(const char *name) {
+    size_t n = strlen(FLASH_STORE_MOUNT);
+    if (strncmp(name, FLASH_STORE_MOUNT, n) == 0 && name[n] == '/') {
+        name += n;
+    }
+    while (*name == '/') {
+        name++;
+    }
+    for (int i = 0; s_header && i < s_header->count; i++) {
+        if (strcmp(s_entries[i].name, name) == 0) {
+            return &s_entries[i];
+        }
+    }
+    return NULL;
+}
+
+// VFS. Paths arrive with the mount point stripped, "/loop1.wav".
+
+static int vfs_open(const char *path, int flags, int mode) {
+    if ((flags & O_ACCMODE) != O_RDONLY) {
+        errno = EROFS;
+        return -1;
+    }
+    int fd = -1;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    const flash_store_entry_t *e = s_writing ? NULL : entry_find(path);
+    if (!e) {
+        errno = ENOENT;
+    } else {
+        for (int i = 0; i < FLASH_STORE_MAX_OPEN; i++) {
+            if (!s_open[i].used) {
+                s_open[i] = (open_file_t){ .used = true, .entry = e, .pos = 0 };
+                s_open_count++;
+                fd = i;
+                break;
+            }
+        }
+        if (fd < 0) {
+            errno = EMFILE;
+        }
+    }
+    xSemaphoreGive(s_lock);
+    return fd;
+}
+
+static open_file_t *file_get(int fd) {
+    if (fd < 0 || fd >= FLASH_STORE_MAX_OPEN || !s_open[fd].used) {
+        errno = EBADF;
+        return NULL;
+    }
+    return &s_open[fd];
+}
+
+static ssize_t vfs_pread(int fd, void *dst, size_t size, off_t offset) {
+    open_file_t *f = file_get(fd);
+    if (!f) {
+        return -1;
+    }
+    if (offset < 0 || (uint32_t)offset >= f->entry->size) {
+        return 0;
+    }
+    size_t left = f->entry->size - (uint32_t)offset;
+    if (size > left) {
+        size = left;
+    }
+    memcpy(dst, s_base + f->entry->offset + offset, size);
+    return size;
+}
+
+static ssize_t vfs_read(int fd, void *dst, size_t size) {
+    ssize_t n = vfs_pread(fd, dst, size, file_get(fd) ? s_open[fd].pos : 0);
+    if (n > 0) {
+        s_open[fd].pos += n;
+    }
+    return n;
+}
+
+static off_t vfs_lseek(int fd, off_t offset, int whence) {
+    open_file_t *f = file_get(fd);
+    if (!f) {
+        return -1;
+    }
+    off_t pos;
+    switch (whence) {
+        case SEEK_SET: pos = offset; break;
+        case SEEK_CUR: pos = f->pos + offset; break;
+        case SEEK_END: pos = f->entry->size + offset; break;
+        default: errno = EINVAL; return -1;
+    }
+    if (pos < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    f->pos = pos;
+    return pos;
+}
+
+static int vfs_close(int fd) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    open_file_t *f = file_get(fd);
+    if (f) {
+        f->used = false;
+        s_open_count--;
+    }
+    xSemaphoreGive(s_lock);
+    return f ? 0 : -1;
+}
+
+static void stat_fill(const flash_store_entry_t *e, struct stat *st) {
+    memset(st, 0, sizeof(*st));
+    st->st_mode = S_IFREG | 0444;
+    st->st_size = e->size;
+}
+
+static int vfs_fstat(int fd, struct stat *st) {
+    open_file_t *f = file_get(fd);
+    if (!f) {
+        return -1;
+    }
+    stat_fill(f->entry, st);
+    return 0;
+}
+
+static int vfs_stat(const char *path, struct stat *st) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    const flash_store_entry_t *e = s_writing ? NULL : entry_find(path);
+    if (e) {
+        stat_fill(e, st);
+    }
+    xSemaphoreGive(s_lock);
+    if (!e) {
+        errno = ENOENT;
+        return -1;
+    }
+    return 0;
+}
+
+esp_err_t flash_store_init(void) {
+    s_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, FLASH_STORE_SUBTYPE, FLASH_STORE_PARTITION);
+    if (!s_part) {
+        ESP_LOGI(TAG, "No '%s' partition, flash store off", FLASH_STORE_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = image_map(true);
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "%d files, %lu of %lu bytes at 0x%lx", s_header->count,
+                 (unsigned long)s_header->image_size, (unsigned long)s_part->size,
+                 (unsigned long)s_part->address);
+    } else if (err == ESP_ERR_NOT_FOUND) {
+        ESP_LOGI(TAG, "Partition '%s' is empty", FLASH_STORE_PARTITION);
+    } else {
+        ESP_LOGW(TAG, "Partition '%s' holds no valid image: %s", FLASH_STORE_PARTITION, esp_err_to_name(err));
+    }
+
+    const esp_vfs_t vfs = {
+        .flags = ESP_VFS_FLAG_DEFAULT,
+        .open = vfs_open,
+        .read = vfs_read,
+        .pread = vfs_pread,
+        .lseek = vfs_lseek,
+        .close = vfs_close,
+        .fstat = vfs_fstat,
+        .stat = vfs_stat,
+    };
+    return esp_vfs_register(FLASH_STORE_MOUNT, &vfs, NULL);
+}
+
+bool flash_store_available(void) {
+    return s_header != NULL;
+}
+
+int flash_store_count(void) {
+    return s_header ? s_header->count : 0;
+}
+
+const flash_store_entry_t *flash_store_entry(int i) {
+    if (!s_header || i < 0 || i >= s_header->count) {
+        return NULL;
+    }
+    return &s_entries[i];
+}
+
+esp_err_t flash_store_find(const char *name, const void **data, size_t *size) {
+    if (!s_lock) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    const flash_store_entry_t *e = s_writing ? NULL : entry_find(name);
+    if (e) {
+        *data = s_base + e->offset;
+        *size = e->size;
+        s_open_count++;
+    }
+    xSemaphoreGive(s_lock);
+    return e ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+void flash_store_release(void) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_open_count--;
+    xSemaphoreGive(s_lock);
+}
+
+esp_err_t flash_store_write_begin(size_t size) {
+    if (!s_part) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (size < sizeof(flash_store_header_t) || size > s_part->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_open_count > 0 || s_writing) {
+        xSemaphoreGive(s_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_writing = true;
+    image_unmap();
+    xSemaphoreGive(s_lock);
+
+    s_write_size = size;
+    s_write_pos = 0;
+    s_erased_to = 0;
+    s_write_magic = 0xffffffff;
+    ESP_LOGI(TAG, "Rewriting, %lu bytes", (unsigned long)size);
+    return ESP_OK;
+}
+
+esp_err_t flash_store_write(const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    if (!s_writing || len > s_write_size - s_write_pos) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // erase ahead of the write, a sector at a time
+    while (s_erased_to < s_write_pos + len) {
+        esp_err_t err = esp_partition_erase_range(s_part, s_erased_to, SECTOR_SIZE);
+        if (err != ESP_OK) {
+            return err;
+        }
+        s_erased_to += SECTOR_SIZE;
+    }
+
+    // hold the magic back, it goes in last
+    while (len > 0 && s_write_pos < sizeof(s_write_magic)) {
+        ((uint8_t *)&s_write_magic)[s_write_pos++] = *p++;
+        len--;
+    }
+    if (len == 0) {
+        return ESP_OK;
+    }
+    esp_err_t err = esp_partition_write(s_part, s_write_pos, p, len);
+    if (err == ESP_OK) {
+        s_write_pos += len;
+    }
+    return err;
+}
+
+esp_err_t flash_store_write_end(bool commit) {
+    if (!s_writing) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = ESP_ERR_INVALID_SIZE;
+    if (commit && s_write_pos == s_write_size && s_write_magic == FLASH_STORE_MAGIC) {
+        // check what is actually in flash, then make it live
+        err = image_map(false);
+        if (err == ESP_OK) {
+            image_unmap();
+            err = esp_partition_write(s_part, 0, &s_write_magic, sizeof(s_write_magic));
+        }
+        if (err == ESP_OK) {
+            err = image_map(true);
+        }
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_writing = false;
+    xSemaphoreGive(s_lock);
+
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "New image, %d files", s_header->count);
+    } else if (commit) {
+        ESP_LOGW(TAG, "Rewrite failed: %s, store is empty", esp_err_to_name(err));
+    }
+    return err;
+}
@@ -0,0 +1,115 @@
+#ifndef FLASH_STORE_H
+#define FLASH_STORE_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Optional read-only audio store in SPI flash, for installations that only
+// need a few short loops and would rather not depend on the SD card.
+//
+// It lives in a data partition (partitions_audio.csv) written either with
+// device-manager/flash_pack.py and esptool, or over HTTP (POST /api/flash).
+// The files are served at FLASH_STORE_MOUNT, so a track plays
+// "/flash/loop1.wav" through the same reader as the card (track_reader.c;
+// fatfs_stream wouldn't open it, having no "/sdcard" in it), just without
+// FATFS or the SD bus: reads are copies out of memory-mapped flash.
+
+#define FLASH_STORE_MOUNT           "/flash"
+#define FLASH_STORE_PARTITION       "audio"
+#define FLASH_STORE_SUBTYPE         0x40        // data partition, in the custom range
+
+// Image layout, all little endian: header, entry table, then the files,
+// each at a 4 byte aligned offset from the start of the image.
+#define FLASH_STORE_MAGIC           0x3141464c  // "LFA1"
+#define FLASH_STORE_VERSION         1
+#define FLASH_STORE_NAME_LEN        56          // with the NUL, "/flash/" + name fits MAX_FILE_PATH_LEN
+#define FLASH_STORE_MAX_ENTRIES     64
+#define FLASH_STORE_MAX_OPEN        8
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t image_size;        // header included
+    uint32_t crc32;             // of everything after the header, zlib's CRC-32
+} flash_store_header_t;
+
+typedef struct {
+    char name[FLASH_STORE_NAME_LEN];
+    uint32_t offset;            // from the start of the image
+    uint32_t size;
+} flash_store_entry_t;
+
+/**
+ * @brief Map the audio partition and serve it at FLASH_STORE_MOUNT
+ *
+ * A partition that holds no valid image is still registered, empty, so an
+ * image can be written over HTTP without a reboot.
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND if the partition table has no audio
+ *         partition (the store is then off), or the mapping's error
+ */
+esp_err_t flash_store_init(void);
+
+/**
+ * @brief True if the partition holds a valid image
+ */
+bool flash_store_available(void);
+
+/**
+ * @brief Number of files in the image, 0 if there is none
+ */
+int flash_store_count(void);
+
+/**
+ * @brief The i-th file's entry, or NULL
+ */
+const flash_store_entry_t *flash_store_entry(int i);
+
+/**
+ * @brief Find a file and point straight into mapped flash, no copies
+ *
+ * The pointer holds the image as an open file does: flash_store_write_begin()
+ * refuses until it is given back with flash_store_release(). The one-shot
+ * slots play /flash files this way.
+ *
+ * @param name File name, with or without the FLASH_STORE_MOUNT prefix
+ * @return ESP_OK, ESP_ERR_NOT_FOUND
+ */
+esp_err_t flash_store_find(const char *name, const void **data, size_t *size);
+
+/**
+ * @brief Give back a pointer from flash_store_find()
+ */
+void flash_store_release(void);
+
+/**
+ * @brief Start writing a new image of size bytes
+ *
+ * The old image is gone from here on. Sectors are erased as the writes reach
+ * them, so no single call blocks for the whole erase.
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND without a partition, ESP_ERR_INVALID_SIZE
+ *         if it doesn't fit, ESP_ERR_INVALID_STATE while files are open
+ */
+esp_err_t flash_store_write_begin(size_t size);
+
+/**
+ * @brief Write the next bytes of the image
+ */
+esp_err_t flash_store_write(const void *buf, size_t len);
+
+/**
+ * @brief Finish writing, check the image and make it live
+ *
+ * The magic number is written last, after the CRC checked out, so a
+ * partial or corrupt image is never served.
+ *
+ * @param commit false to abandon the write, which leaves the store empty
+ * @return ESP_OK, ESP_ERR_INVALID_CRC or ESP_ERR_INVALID_SIZE if the image is bad
+ */
+esp_err_t flash_store_write_end(bool commit);
+
+#endif /* FLASH_STORE_H */
@@ -0,0 +1,536 @@
+/* Glitch flight recorder.
+
+   A low priority task on core 0 samples the fill level of every ringbuffer in
+   the audio path, SD reader progress and heap state into a rolling history.
+   When the I2S writer starves or a mixer input runs dry, the history leading
+   up to the glitch, a short tail after it, per task CPU deltas and recent
+   control events are frozen into one of a few slots which can be pulled over
+   HTTP later.
+
+   Everything lives in SPIRAM; the audio tasks are never blocked by the
+   recorder, it only reads buffer counters. The I2S writer reports its own
+   starvation, see flight_recorder_note_i2s_starved(), since a gap shorter
+   than two samples falls between them.
+*/
+
+#include <stdatomic.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "audio_element.h"
+#include "ringbuf.h"
+#include "flight_recorder.h"
+#include "metrics.h"
+#include "heap_tracker.h"
+
+static const char *TAG = "FLIGHT_REC";
+
+// Consecutive empty samples before a track's mixer input counts as dry
+#define FLIGHT_RECORDER_TRIGGER_SAMPLES  2
+
+// Tracks are not checked for this long after they (re)start
+#define FLIGHT_RECORDER_START_GRACE_MS   500
+
+// heap_caps_get_largest_free_block() walks the heap, don't do it every sample
+#define FLIGHT_RECORDER_HEAP_WALK_EVERY  5
+
+typedef struct {
+    audio_stream_t *stream;
+    loop_manager_t *manager;
+
+    // Rolling history, s_rec->history_head is the next write position
+    flight_recorder_sample_t history[FLIGHT_RECORDER_HISTORY_LEN];
+    int history_head;
+    int history_count;
+
+    // Slots are swapped with the staging buffer on commit, never copied
+    flight_recorder_slot_t *slots[FLIGHT_RECORDER_SLOTS];
+    flight_recorder_slot_t *staging;
+    int next_slot;
+    bool capturing;
+    bool commit_pending;
+    int post_remaining;
+    int64_t holdoff_until_us;
+
+    // Two task snapshots so a capture always has a reasonably long window
+    TaskStatus_t task_base[2][FLIGHT_RECORDER_MAX_TASKS];
+    UBaseType_t task_base_count[2];
+    uint32_t task_base_total[2];
+    int64_t task_base_time_us[2];
+    int task_base_cur;
+
+    // SD reader progress per track
+    int64_t reader_last_pos[MAX_TRACKS];
+    int64_t reader_progress_us[MAX_TRACKS];
+    int starved_count[MAX_TRACKS + 1];   // last entry is the i2s input
+
+    uint32_t trigger_count;
+    uint32_t capture_count;
+} flight_recorder_t;
+
+static flight_recorder_t *s_rec = NULL;
+static SemaphoreHandle_t s_slot_mutex = NULL;
+
+// Events and external trigger requests come from other tasks
+static portMUX_TYPE s_event_lock = portMUX_INITIALIZER_UNLOCKED;
+static flight_recorder_event_t s_events[FLIGHT_RECORDER_MAX_EVENTS];
+static int s_event_head = 0;
+static int s_event_count = 0;
+static int64_t s_track_grace_until_us[MAX_TRACKS];
+static flight_recorder_trigger_t s_requested_trigger = FR_TRIGGER_NONE;
+static int s_requested_track = -1;
+// Set by the I2S read callback, taken by the next sample
+static atomic_bool s_i2s_starved;
+
+const char *flight_recorder_trigger_name(flight_recorder_trigger_t trigger) {
+    switch (trigger) {
+        case FR_TRIGGER_I2S_STARVED: return "i2s_starved";
+        case FR_TRIGGER_TRACK_DRY:   return "track_dry";
+        case FR_TRIGGER_MANUAL:      return "manual";
+        default:                     return "none";
+    }
+}
+
+const char *flight_recorder_event_name(flight_recorder_event_type_t type) {
+    switch (type) {
+        case FR_EVENT_TRACK_START: return "track_start";
+        case FR_EVENT_TRACK_STOP:  return "track_stop";
+        case FR_EVENT_TRACK_LOOP:  return "track_loop";
+        case FR_EVENT_SET_VOLUME:  return "set_volume";
+        case FR_EVENT_FILE_UPLOAD: return "file_upload";
+        case FR_EVENT_FILE_DELETE: return "file_delete";
+        case FR_EVENT_CONFIG_SAVE: return "config_save";
+        case FR_EVENT_TRACK_SEEK:  return "track_seek";
+        default:                   return "none";
+    }
+}
+
+void flight_recorder_note_event(flight_recorder_event_type_t type, int track) {
+    int64_t now = esp_timer_get_time();
+
+    taskENTER_CRITICAL(&s_event_lock);
+    flight_recorder_event_t *ev = &s_events[s_event_head];
+    ev->time_us = now;
+    ev->type = (uint8_t)type;
+    ev->track = (int8_t)track;
+    s_event_head = (s_event_head + 1) % FLIGHT_RECORDER_MAX_EVENTS;
+    if (s_event_count < FLIGHT_RECORDER_MAX_EVENTS) {
+        s_event_count++;
+    }
+    // A track that was just (re)started has empty buffers, that's not a glitch
+    if ((type == FR_EVENT_TRACK_START || type == FR_EVENT_TRACK_LOOP || type == FR_EVENT_TRACK_SEEK) &&
+        track >= 0 && track < MAX_TRACKS) {
+        s_track_grace_until_us[track] = now + FLIGHT_RECORDER_START_GRACE_MS * 1000LL;
+    }
+    taskEXIT_CRITICAL(&s_event_lock);
+}
+
+void flight_recorder_note_i2s_starved(void) {
+    atomic_store_explicit(&s_i2s_starved, true, memory_order_relaxed);
+}
+
+void flight_recorder_trigger(flight_recorder_trigger_t trigger, int track) {
+    taskENTER_CRITICAL(&s_event_lock);
+    s_requested_trigger = trigger;
+    s_requested_track = track;
+    taskEXIT_CRITICAL(&s_event_lock);
+}
+
+static void snapshot_tasks(TaskStatus_t *tasks, UBaseType_t *count, uint32_t *total) {
+    *count = uxTaskGetSystemState(tasks, FLIGHT_RECORDER_MAX_TASKS, total);
+    if (*count == 0) {
+        ESP_LOGW(TAG, "More than %d tasks, task snapshot skipped", FLIGHT_RECORDER_MAX_TASKS);
+    }
+}
+
+/**
+ * @brief Fill the slot's task table with run time deltas against an older snapshot
+ */
+static void capture_tasks(flight_recorder_slot_t *slot, int64_t now) {
+    static TaskStatus_t now_tasks[FLIGHT_RECORDER_MAX_TASKS];
+    UBaseType_t now_count;
+    uint32_t now_total;
+
+    snapshot_tasks(now_tasks, &now_count, &now_total);
+
+    // Prefer the previous baseline if the current one is too fresh to say much
+    int base = s_rec->task_base_cur;
+    if (now - s_rec->task_base_time_us[base] < FLIGHT_RECORDER_TASK_WINDOW_MS * 500LL &&
+        s_rec->task_base_count[base ^ 1] > 0) {
+        base ^= 1;
+    }
+    const TaskStatus_t *base_tasks = s_rec->task_base[base];
+    UBaseType_t base_count = s_rec->task_base_count[base];
+
+    slot->task_window_us = (uint32_t)(now - s_rec->task_base_time_us[base]);
+    slot->total_runtime_delta = now_total - s_rec->task_base_total[base];
+    slot->n_tasks = 0;
+
+    for (UBaseType_t i = 0; i < now_count && slot->n_tasks < FLIGHT_RECORDER_MAX_TASKS; i++) {
+        const TaskStatus_t *t = &now_tasks[i];
+        uint32_t before = 0;
+        for (UBaseType_t j = 0; j < base_count; j++) {
+            if (base_tasks[j].xHandle == t->xHandle) {
+                before = base_tasks[j].ulRunTimeCounter;
+                break;
+            }
+        }
+
+        flight_recorder_task_t *out = &slot->tasks[slot->n_tasks++];
+        strlcpy(out->name, t->pcTaskName, sizeof(out->name));
+        out->runtime_delta = t->ulRunTimeCounter - before;
+        out->stack_hwm = t->usStackHighWaterMark;
+        out->priority = (uint8_t)t->uxCurrentPriority;
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+        out->core = (t->xCoreID == tskNO_AFFINITY) ? -1 : (int8_t)t->xCoreID;
+#else
+        out->core = -1;
+#endif
+    }
+}
+
+static void capture_events(flight_recorder_slot_t *slot) {
+    taskENTER_CRITICAL(&s_event_lock);
+    int start = (s_event_head - s_event_count + FLIGHT_RECORDER_MAX_EVENTS) % FLIGHT_RECORDER_MAX_EVENTS;
+    for (int i = 0; i < s_event_count; i++) {
+        slot->events[i] = s_events[(start + i) % FLIGHT_RECORDER_MAX_EVENTS];
+    }
+    slot->n_events = s_event_count;
+    taskEXIT_CRITICAL(&s_event_lock);
+}
+
+/**
+ * @brief Begin a capture: copy the history into the staging slot
+ */
+static void start_capture(flight_recorder_trigger_t trigger, int track, int64_t now) {
+    flight_recorder_slot_t *slot = s_rec->staging;
+
+    slot->valid = true;
+    slot->seq = ++s_rec->capture_count;
+    slot->trigger = trigger;
+    slot->trigger_track = track;
+    slot->trigger_time_us = now;
+
+    int start = (s_rec->history_head - s_rec->history_count + FLIGHT_RECORDER_HISTORY_LEN) % FLIGHT_RECORDER_HISTORY_LEN;
+    for (int i = 0; i < s_rec->history_count; i++) {
+        slot->samples[i] = s_rec->history[(start + i) % FLIGHT_RECORDER_HISTORY_LEN];
+    }
+    slot->n_samples = s_rec->history_count;
+    slot->trigger_sample = s_rec->history_count - 1;
+
+    capture_tasks(slot, now);
+    capture_events(slot);
+
+    s_rec->capturing = true;
+    s_rec->post_remaining = FLIGHT_RECORDER_POST_SAMPLES;
+    s_rec->holdoff_until_us = now + FLIGHT_RECORDER_HOLDOFF_MS * 1000LL;
+
+    ESP_LOGW(TAG, "Glitch #%lu: %s (track %d), capturing", (unsigned long)slot->seq,
+             flight_recorder_trigger_name(trigger), track);
+}
+
+/**
+ * @brief Swap the finished staging buffer into the slot ring
+ *
+ * If an HTTP reader holds the slots the commit is retried on the next sample.
+ */
+static void try_commit(void) {
+    if (xSemaphoreTake(s_slot_mutex, 0) != pdTRUE) {
+        return;
+    }
+    flight_recorder_slot_t *old = s_rec->slots[s_rec->next_slot];
+    s_rec->slots[s_rec->next_slot] = s_rec->staging;
+    s_rec->staging = old;
+    s_rec->staging->valid = false;
+    s_rec->next_slot = (s_rec->next_slot + 1) % FLIGHT_RECORDER_SLOTS;
+    s_rec->commit_pending = false;
+    xSemaphoreGive(s_slot_mutex);
+
+    ESP_LOGI(TAG, "Capture committed");
+}
+
+static uint16_t rb_fill(ringbuf_handle_t rb) {
+    if (rb == NULL) {
+        return 0;
+    }
+    int filled = rb_bytes_filled(rb);
+    return (filled < 0) ? 0 : (uint16_t)filled;
+}
+
+static void observe_fill(int buffer, ringbuf_handle_t rb, uint16_t filled) {
+    int size = rb ? rb_get_size(rb) : 0;
+    if (size > 0) {
+        metrics_buffer_fill(buffer, (uint32_t)filled * 100 / size);
+    }
+}
+
+/**
+ * @brief Take one sample of the audio path
+ *
+ * @return flight_recorder_trigger_t The glitch detected in this sample, if any
+ */
+static flight_recorder_trigger_t take_sample(flight_recorder_sample_t *s, int64_t now, uint32_t tick, int *trigger_track) {
+    audio_stream_t *stream = s_rec->stream;
+    loop_manager_t *manager = s_rec->manager;
+    flight_recorder_trigger_t trigger = FR_TRIGGER_NONE;
+    int64_t grace[MAX_TRACKS];
+
+    taskENTER_CRITICAL(&s_event_lock);
+    memcpy(grace, s_track_grace_until_us, sizeof(grace));
+    taskEXIT_CRITICAL(&s_event_lock);
+
+    memset(s, 0, sizeof(*s));
+    s->time_us = now;
+
+    bool any_playing = false;
+    for (int i = 0; i < MAX_TRACKS; i++) {
+        audio_track_t *track = &stream->tracks[i];
+        bool playing = manager->loops[i].is_playing;
+        if (playing) {
+            s->playing_mask |= (1 << i);
+            any_playing = true;
+        }
+
+        // audio_control_start_debug_v2() gives each track its own ringbuffer
+        // into downmix, which the decoder writes through playhead.c;
+        // raw_write_e is linked but has no output of its own
+        s->mixer_fill[i] = rb_fill(track->mixer_rb);
+        ringbuf_handle_t reader_rb = audio_element_get_output_ringbuf(track->fatfs_e);
+        s->reader_fill[i] = rb_fill(reader_rb);
+
+        // SD stall: the reader had room in its output buffer but its file
+        // position did not move
+        audio_element_state_t fatfs_state = audio_element_get_state(track->fatfs_e);
+        audio_element_info_t info;
+        audio_element_getinfo(track->fatfs_e, &info);
+        if (fatfs_state != AEL_STATE_RUNNING || info.byte_pos != s_rec->reader_last_pos[i] ||
+            (reader_rb && rb_bytes_available(reader_rb) == 0)) {
+            s_rec->reader_last_pos[i] = info.byte_pos;
+            s_rec->reader_progress_us[i] = now;
+        }
+        int64_t stall_ms = (now - s_rec->reader_progress_us[i]) / 1000;
+        s->sd_stall_ms[i] = stall_ms > UINT16_MAX ? UINT16_MAX : (uint16_t)stall_ms;
+
+        // Mixer input dry: only meaningful while the track pipeline is running
+        bool running = playing && fatfs_state == AEL_STATE_RUNNING &&
+                       audio_element_get_state(track->decode_e) == AEL_STATE_RUNNING &&
+                       now >= grace[i];
+        if (running) {
+            observe_fill(i, track->mixer_rb, s->mixer_fill[i]);
+        }
+        if (running && s->mixer_fill[i] == 0) {
+            if (++s_rec->starved_count[i] == FLIGHT_RECORDER_TRIGGER_SAMPLES) {
+                metrics_underrun(i);
+                if (trigger == FR_TRIGGER_NONE) {
+                    trigger = FR_TRIGGER_TRACK_DRY;
+                    *trigger_track = i;
+                }
+            }
+        } else {
+            s_rec->starved_count[i] = 0;
+        }
+    }
+
+    ringbuf_handle_t i2s_rb = stream->output_rb;
+    s->i2s_fill = rb_fill(i2s_rb);
+    bool i2s_running = audio_element_get_state(stream->i2s_e) == AEL_STATE_RUNNING;
+    if (any_playing && i2s_running) {
+        observe_fill(METRICS_BUFFER_I2S, i2s_rb, s->i2s_fill);
+    }
+    bool i2s_starved = atomic_exchange_explicit(&s_i2s_starved, false, memory_order_relaxed);
+    if (any_playing && i2s_running && i2s_starved) {
+        // I2S starvation wins over a dry track, it's the audible one. One
+        // underrun until a sample goes by without it.
+        if (++s_rec->starved_count[MAX_TRACKS] == 1) {
+            metrics_underrun(METRICS_BUFFER_I2S);
+            trigger = FR_TRIGGER_I2S_STARVED;
+            *trigger_track = -1;
+        }
+    } else {
+        s_rec->starved_count[MAX_TRACKS] = 0;
+    }
+
+    s->dma_free = heap_caps_get_free_size(MALLOC_CAP_DMA);
+    s->internal_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    s->spiram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    if (tick % FLIGHT_RECORDER_HEAP_WALK_EVERY == 0 || s_rec->history_count == 0) {
+        s->dma_largest = heap_caps_get_largest_free_block(MALLOC_CAP_DMA);
+    } else {
+        int prev = (s_rec->history_head - 1 + FLIGHT_RECORDER_HISTORY_LEN) % FLIGHT_RECORDER_HISTORY_LEN;
+        s->dma_largest = s_rec->history[prev].dma_largest;
+    }
+
+    return trigger;
+}
+
+static void flight_recorder_task(void *pvParameters) {
+    TickType_t last_wake = xTaskGetTickCount();
+    uint32_t tick = 0;
+
+    ESP_LOGI(TAG, "Flight recorder running, %d ms sample, %d ms history",
+             FLIGHT_RECORDER_SAMPLE_MS, FLIGHT_RECORDER_HISTORY_MS);
+
+    while (1) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(FLIGHT_RECORDER_SAMPLE_MS));
+        int64_t now = esp_timer_get_time();
+        tick++;
+
+        // Refresh the task runtime baseline
+        int cur = s_rec->task_base_cur;
+        if (now - s_rec->task_base_time_us[cur] >= FLIGHT_RECORDER_TASK_WINDOW_MS * 1000LL) {
+            cur ^= 1;
+            snapshot_tasks(s_rec->task_base[cur], &s_rec->task_base_count[cur], &s_rec->task_base_total[cur]);
+            s_rec->task_base_time_us[cur] = now;
+            s_rec->task_base_cur = cur;
+        }
+
+        int trigger_track = -1;
+        flight_recorder_sample_t *sample = &s_rec->history[s_rec->history_head];
+        flight_recorder_trigger_t trigger = take_sample(sample, now, tick, &trigger_track);
+        s_rec->history_head = (s_rec->history_head + 1) % FLIGHT_RECORDER_HISTORY_LEN;
+        if (s_rec->history_count < FLIGHT_RECORDER_HISTORY_LEN) {
+            s_rec->history_count++;
+        }
+
+        taskENTER_CRITICAL(&s_event_lock);
+        if (trigger == FR_TRIGGER_NONE && s_requested_trigger != FR_TRIGGER_NONE) {
+            trigger = s_requested_trigger;
+            trigger_track = s_requested_track;
+        }
+        s_requested_trigger = FR_TRIGGER_NONE;
+        taskEXIT_CRITICAL(&s_event_lock);
+
+        if (trigger != FR_TRIGGER_NONE) {
+            s_rec->trigger_count++;
+        }
+
+        if (s_rec->capturing) {
+            flight_recorder_slot_t *slot = s_rec->staging;
+            slot->samples[slot->n_samples++] = *sample;
+            if (--s_rec->post_remaining == 0) {
+                s_rec->capturing = false;
+                s_rec->commit_pending = true;
+            }
+        } else if (s_rec->commit_pending) {
+            // Wait until the previous capture is out of the staging buffer
+        } else if (trigger != FR_TRIGGER_NONE && now >= s_rec->holdoff_until_us) {
+            start_capture(trigger, trigger_track, now);
+        }
+
+        if (s_rec->commit_pending) {
+            try_commit();
+        }
+    }
+}
+
+esp_err_t flight_recorder_init(audio_stream_t *stream, loop_manager_t *manager) {
+    esp_err_t ret = ESP_OK;
+
+    if (s_rec != NULL) {
+        return ESP_OK;
+    }
+    if (stream == NULL || manager == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    s_slot_mutex = xSemaphoreCreateMutex();
+    if (s_slot_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    s_rec = heap_tracker_calloc(1, sizeof(flight_recorder_t), MALLOC_CAP_SPIRAM);
+    if (s_rec == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate recorder state");
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+    s_rec->stream = stream;
+    s_rec->manager = manager;
+
+    for (int i = 0; i < FLIGHT_RECORDER_SLOTS; i++) {
+        s_rec->slots[i] = heap_tracker_calloc(1, sizeof(flight_recorder_slot_t), MALLOC_CAP_SPIRAM);
+        if (s_rec->slots[i] == NULL) {
+            ret = ESP_ERR_NO_MEM;
+            goto cleanup;
+        }
+    }
+    s_rec->staging = heap_tracker_calloc(1, sizeof(flight_recorder_slot_t), MALLOC_CAP_SPIRAM);
+    if (s_rec->staging == NULL) {
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+
+    ESP_LOGI(TAG, "Recorder memory: %u bytes SPIRAM",
+             (unsigned)(sizeof(flight_recorder_t) + (FLIGHT_RECORDER_SLOTS + 1) * sizeof(flight_recorder_slot_t)));
+
+    // Core 0, above httpd so HTTP load doesn't hide in gaps in the trace
+    if (xTaskCreatePinnedToCore(flight_recorder_task, "flight_rec", 3072, NULL, 6, NULL, 0) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create flight recorder task");
+        ret = ESP_FAIL;
+        goto cleanup;
+    }
+    return ESP_OK;
+
+cleanup:
+    if (s_rec) {
+        for (int i = 0; i < FLIGHT_RECORDER_SLOTS; i++) {
+            free(s_rec->slots[i]);
+        }
+        free(s_rec->staging);
+        free(s_rec);
+        s_rec = NULL;
+    }
+    vSemaphoreDelete(s_slot_mutex);
+    s_slot_mutex = NULL;
+    return ret;
+}
+
+const flight_recorder_slot_t *flight_recorder_slot_acquire(int index) {
+    if (s_rec == NULL || index < 0 || index >= FLIGHT_RECORDER_SLOTS) {
+        return NULL;
+    }
+    xSemaphoreTake(s_slot_mutex, portMAX_DELAY);
+    return s_rec->slots[index];
+}
+
+void flight_recorder_slot_release(void) {
+    xSemaphoreGive(s_slot_mutex);
+}
+
+esp_err_t flight_recorder_slot_copy(int index, flight_recorder_slot_t *out) {
+    if (index < 0 || index >= FLIGHT_RECORDER_SLOTS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_rec == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_slot_mutex, portMAX_DELAY);
+    const flight_recorder_slot_t *slot = s_rec->slots[index];
+    bool valid = slot->valid;
+    if (valid) {
+        memcpy(out, slot, sizeof(*out));
+    }
+    xSemaphoreGive(s_slot_mutex);
+    return valid ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+void flight_recorder_clear(void) {
+    if (s_rec == NULL) {
+        return;
+    }
+    xSemaphoreTake(s_slot_mutex, portMAX_DELAY);
+    for (int i = 0; i < FLIGHT_RECORDER_SLOTS; i++) {
+        s_rec->slots[i]->valid = false;
+    }
+    s_rec->next_slot = 0;
+    xSemaphoreGive(s_slot_mutex);
+}
+
+void flight_recorder_get_counts(uint32_t *triggers, uint32_t *captures) {
+    *triggers = s_rec ? s_rec->trigger_count : 0;
+    *captures = s_rec ? s_rec->capture_count : 0;
+}
@@ -0,0 +1,189 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "play_sdcard.h"
+#include "http_server.h"
+
+// Sampling period of the recorder task
+#define FLIGHT_RECORDER_SAMPLE_MS      20
+
+// How much history is frozen into a slot when a glitch is detected
+#define FLIGHT_RECORDER_HISTORY_MS     5000
+#define FLIGHT_RECORDER_HISTORY_LEN    (FLIGHT_RECORDER_HISTORY_MS / FLIGHT_RECORDER_SAMPLE_MS)
+
+// Samples kept after the trigger so the recovery is visible too
+#define FLIGHT_RECORDER_POST_SAMPLES   25
+
+// Number of captured glitches kept; the oldest is overwritten
+#define FLIGHT_RECORDER_SLOTS          4
+
+// Task runtime snapshot size and the window the deltas are taken over
+#define FLIGHT_RECORDER_MAX_TASKS      32
+#define FLIGHT_RECORDER_TASK_WINDOW_MS 1000
+
+// Audio control events remembered alongside the samples
+#define FLIGHT_RECORDER_MAX_EVENTS     32
+
+// Ignore further triggers for this long after a capture starts, a single
+// glitch tends to starve every stage downstream of it
+#define FLIGHT_RECORDER_HOLDOFF_MS     2000
+
+typedef enum {
+    FR_TRIGGER_NONE = 0,
+    FR_TRIGGER_I2S_STARVED,     // downmix -> i2s ringbuffer empty while playing
+    FR_TRIGGER_TRACK_DRY,       // a playing track's mixer input ringbuffer empty
+    FR_TRIGGER_MANUAL,          // requested over HTTP
+} flight_recorder_trigger_t;
+
+typedef enum {
+    FR_EVENT_NONE = 0,
+    FR_EVENT_TRACK_START,
+    FR_EVENT_TRACK_STOP,
+    FR_EVENT_TRACK_LOOP,
+    FR_EVENT_SET_VOLUME,
+    FR_EVENT_FILE_UPLOAD,
+    FR_EVENT_FILE_DELETE,
+    FR_EVENT_CONFIG_SAVE,
+    FR_EVENT_TRACK_SEEK,
+} flight_recorder_event_type_t;
+
+// One sample of the audio path, taken every FLIGHT_RECORDER_SAMPLE_MS
+typedef struct {
+    int64_t  time_us;
+    uint16_t mixer_fill[MAX_TRACKS];    // track -> downmix ringbuffer bytes
+    uint16_t reader_fill[MAX_TRACKS];   // fatfs -> decoder ringbuffer bytes
+    uint16_t sd_stall_ms[MAX_TRACKS];   // time the SD reader made no progress while it had room
+    uint16_t i2s_fill;                  // downmix -> i2s ringbuffer bytes
+    uint8_t  playing_mask;              // bit per track, from the loop manager
+    uint32_t dma_free;
+    uint32_t dma_largest;
+    uint32_t internal_free;
+    uint32_t spiram_free;
+} flight_recorder_sample_t;
+
+typedef struct {
+    char     name[configMAX_TASK_NAME_LEN];
+    uint32_t runtime_delta;             // run time counter ticks over the window
+    uint32_t stack_hwm;                 // bytes of stack never used
+    uint8_t  priority;
+    int8_t   core;                      // -1 when not pinned
+} flight_recorder_task_t;
+
+typedef struct {
+    int64_t time_us;
+    uint8_t type;                       // flight_recorder_event_type_t
+    int8_t  track;
+} flight_recorder_event_t;
+
+typedef struct {
+    bool     valid;
+    uint32_t seq;                       // global capture number
+    flight_recorder_trigger_t trigger;
+    int      trigger_track;             // -1 when not track specific
+    int64_t  trigger_time_us;
+
+    uint32_t task_window_us;
+    uint32_t total_runtime_delta;
+    int      n_tasks;
+    flight_recorder_task_t tasks[FLIGHT_RECORDER_MAX_TASKS];
+
+    int      n_events;
+    flight_recorder_event_t events[FLIGHT_RECORDER_MAX_EVENTS];
+
+    int      n_samples;                 // chronological, oldest first
+    int      trigger_sample;            // index of the sample that fired
+    flight_recorder_sample_t samples[FLIGHT_RECORDER_HISTORY_LEN + FLIGHT_RECORDER_POST_SAMPLES];
+} flight_recorder_slot_t;
+
+/**
+ * @brief Start the flight recorder sampling task
+ *
+ * @param stream The audio stream whose buffers are watched
+ * @param manager Loop manager, used to tell which tracks should be playing
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t flight_recorder_init(audio_stream_t *stream, loop_manager_t *manager);
+
+/**
+ * @brief Note that the I2S writer had to wait for audio, from its read callback
+ *
+ * Only sets a flag, so it is cheap enough for the audio path. The next
+ * sample counts an I2S underrun and triggers if a track is playing, however
+ * short the gap was.
+ */
+void flight_recorder_note_i2s_starved(void);
+
+/**
+ * @brief Request a capture, as if a glitch had been detected
+ *
+ * @param trigger Reason recorded in the slot
+ * @param track Track the trigger relates to, or -1
+ */
+void flight_recorder_trigger(flight_recorder_trigger_t trigger, int track);
+
+/**
+ * @brief Note an audio control event so captures show what the system was doing
+ *
+ * Safe to call from any task.
+ *
+ * @param type Event type
+ * @param track Track the event relates to, or -1
+ */
+void flight_recorder_note_event(flight_recorder_event_type_t type, int track);
+
+/**
+ * @brief Lock a slot for reading. Must be paired with flight_recorder_slot_release()
+ *
+ * While a slot is held the recorder defers committing new captures.
+ *
+ * @param index Slot index, 0 .. FLIGHT_RECORDER_SLOTS-1
+ * @return const flight_recorder_slot_t* The slot, or NULL if index is invalid or
+ *         the recorder is not running
+ */
+const flight_recorder_slot_t *flight_recorder_slot_acquire(int index);
+
+/**
+ * @brief Release a slot obtained with flight_recorder_slot_acquire()
+ */
+void flight_recorder_slot_release(void);
+
+/**
+ * @brief Copy a slot out, holding the slots only for the copy
+ *
+ * For readers that take their time with it, such as a chunked HTTP send.
+ *
+ * @param index Slot index, 0 .. FLIGHT_RECORDER_SLOTS-1
+ * @param out Where to copy it
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for a bad index, ESP_ERR_INVALID_STATE if
+ *         the recorder is not running, ESP_ERR_NOT_FOUND if the slot is empty
+ */
+esp_err_t flight_recorder_slot_copy(int index, flight_recorder_slot_t *out);
+
+/**
+ * @brief Discard all captured slots
+ */
+void flight_recorder_clear(void);
+
+/**
+ * @brief Counters for the summary endpoint
+ *
+ * @param triggers Glitches detected, including ones inside the hold-off window
+ * @param captures Captures committed to a slot
+ */
+void flight_recorder_get_counts(uint32_t *triggers, uint32_t *captures);
+
+/**
+ * @brief Short name for a trigger, used in JSON output
+ */
+const char *flight_recorder_trigger_name(flight_recorder_trigger_t trigger);
+
+/**
+ * @brief Short name for an event type, used in JSON output
+ */
+const char *flight_recorder_event_name(flight_recorder_event_type_t type);
+
+#endif // FLIGHT_RECORDER_H
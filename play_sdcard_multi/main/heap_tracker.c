@@ -0,0 +1,244 @@
+/* Heap capability and fragmentation tracker.
+
+   A low priority task samples free size and largest free block of the DMA,
+   internal and SPIRAM heaps into a ring covering several hours, so slow
+   fragmentation shows up as a trend rather than a single log line. The
+   allocation wrappers record requests per call site and keep the last few
+   failures together with the heap state at the time.
+
+   The DMA alert fires when the largest DMA capable block drops below what
+   the audio path needs to restart a track (see ESP32_DMA_MEMORY_ANALYSIS.md).
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "heap_tracker.h"
+
+static const char *TAG = "HEAP_TRACKER";
+
+static const uint32_t s_heap_caps[HEAP_TRACKER_NUM_HEAPS] = {
+    [HEAP_TRACKER_DMA]      = MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL,
+    [HEAP_TRACKER_INTERNAL] = MALLOC_CAP_INTERNAL,
+    [HEAP_TRACKER_SPIRAM]   = MALLOC_CAP_SPIRAM,
+};
+
+static heap_tracker_sample_t *s_history = NULL;
+static int s_history_head = 0;              // next write position
+static int s_history_count = 0;
+static SemaphoreHandle_t s_history_mutex = NULL;
+
+// Call sites and failures are updated from whichever task allocates
+static portMUX_TYPE s_site_lock = portMUX_INITIALIZER_UNLOCKED;
+static heap_tracker_site_t s_sites[HEAP_TRACKER_MAX_SITES];
+static int s_site_count = 0;
+static heap_tracker_failure_t s_failures[HEAP_TRACKER_MAX_FAILURES];
+static int s_failure_head = 0;
+static int s_failure_count = 0;
+
+static bool s_alert_active = false;
+static uint32_t s_alert_count = 0;
+static uint32_t s_min_dma_largest = UINT32_MAX;
+
+const char *heap_tracker_heap_name(heap_tracker_heap_t heap) {
+    switch (heap) {
+        case HEAP_TRACKER_DMA:      return "dma";
+        case HEAP_TRACKER_INTERNAL: return "internal";
+        case HEAP_TRACKER_SPIRAM:   return "spiram";
+        default:                    return "unknown";
+    }
+}
+
+static void record_alloc(size_t size, uint32_t caps, const char *file, int line, bool ok) {
+    // Heap state for a failure is read outside the lock, it walks the heap
+    uint32_t free_now = 0, largest_now = 0;
+    if (!ok) {
+        free_now = heap_caps_get_free_size(caps);
+        largest_now = heap_caps_get_largest_free_block(caps);
+    }
+
+    // Sites match on the pointer: file is always a __FILE__ literal, and a
+    // strcmp here would run with interrupts masked on every allocation
+    taskENTER_CRITICAL(&s_site_lock);
+    heap_tracker_site_t *site = NULL;
+    for (int i = 0; i < s_site_count; i++) {
+        if (s_sites[i].line == line && s_sites[i].file == file) {
+            site = &s_sites[i];
+            break;
+        }
+    }
+    if (site == NULL && s_site_count < HEAP_TRACKER_MAX_SITES) {
+        site = &s_sites[s_site_count++];
+        site->file = file;
+        site->line = line;
+        site->caps = caps;
+    }
+    // Once the table is full new sites go unrecorded, failures are still kept
+    if (site) {
+        site->count++;
+        site->total_bytes += size;
+        if (size > site->largest) {
+            site->largest = size;
+        }
+        if (!ok) {
+            site->failures++;
+        }
+    }
+    if (!ok) {
+        heap_tracker_failure_t *f = &s_failures[s_failure_head];
+        f->uptime_s = (uint32_t)(esp_timer_get_time() / 1000000);
+        f->file = file;
+        f->line = line;
+        f->size = size;
+        f->caps = caps;
+        f->free_at_failure = free_now;
+        f->largest_at_failure = largest_now;
+        s_failure_head = (s_failure_head + 1) % HEAP_TRACKER_MAX_FAILURES;
+        if (s_failure_count < HEAP_TRACKER_MAX_FAILURES) {
+            s_failure_count++;
+        }
+    }
+    taskEXIT_CRITICAL(&s_site_lock);
+
+    if (!ok) {
+        ESP_LOGE(TAG, "Allocation of %u bytes (caps 0x%lx) failed at %s:%d, free %lu largest %lu",
+                 (unsigned)size, (unsigned long)caps, file, line,
+                 (unsigned long)free_now, (unsigned long)largest_now);
+    }
+}
+
+void *heap_tracker_malloc_at(size_t size, uint32_t caps, const char *file, int line) {
+    void *ptr = heap_caps_malloc(size, caps);
+    record_alloc(size, caps, file, line, ptr != NULL);
+    return ptr;
+}
+
+void *heap_tracker_calloc_at(size_t n, size_t size, uint32_t caps, const char *file, int line) {
+    void *ptr = heap_caps_calloc(n, size, caps);
+    record_alloc(n * size, caps, file, line, ptr != NULL);
+    return ptr;
+}
+
+static void take_sample(void) {
+    heap_tracker_sample_t sample;
+    sample.uptime_s = (uint32_t)(esp_timer_get_time() / 1000000);
+    for (int h = 0; h < HEAP_TRACKER_NUM_HEAPS; h++) {
+        multi_heap_info_t info;
+        heap_caps_get_info(&info, s_heap_caps[h]);
+        sample.free[h] = info.total_free_bytes;
+        sample.largest[h] = info.largest_free_block;
+    }
+
+    uint32_t dma_largest = sample.largest[HEAP_TRACKER_DMA];
+    if (dma_largest < s_min_dma_largest) {
+        s_min_dma_largest = dma_largest;
+    }
+    if (dma_largest < HEAP_TRACKER_DMA_NEED_BYTES && !s_alert_active) {
+        s_alert_active = true;
+        s_alert_count++;
+        ESP_LOGW(TAG, "DMA largest free block %lu bytes, audio path needs %d (free %lu, fragmented)",
+                 (unsigned long)dma_largest, HEAP_TRACKER_DMA_NEED_BYTES,
+                 (unsigned long)sample.free[HEAP_TRACKER_DMA]);
+    } else if (dma_largest >= HEAP_TRACKER_DMA_NEED_BYTES && s_alert_active) {
+        s_alert_active = false;
+        ESP_LOGI(TAG, "DMA largest free block recovered to %lu bytes", (unsigned long)dma_largest);
+    }
+
+    xSemaphoreTake(s_history_mutex, portMAX_DELAY);
+    s_history[s_history_head] = sample;
+    s_history_head = (s_history_head + 1) % HEAP_TRACKER_HISTORY_LEN;
+    if (s_history_count < HEAP_TRACKER_HISTORY_LEN) {
+        s_history_count++;
+    }
+    xSemaphoreGive(s_history_mutex);
+}
+
+static void heap_tracker_task(void *pvParameters) {
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1) {
+        take_sample();
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(HEAP_TRACKER_PERIOD_S * 1000));
+    }
+}
+
+esp_err_t heap_tracker_init(void) {
+    if (s_history != NULL) {
+        return ESP_OK;
+    }
+
+    s_history_mutex = xSemaphoreCreateMutex();
+    if (s_history_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_history = heap_caps_calloc(HEAP_TRACKER_HISTORY_LEN, sizeof(heap_tracker_sample_t), MALLOC_CAP_SPIRAM);
+    if (s_history == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate heap history");
+        vSemaphoreDelete(s_history_mutex);
+        s_history_mutex = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreatePinnedToCore(heap_tracker_task, "heap_track", 2560, NULL, 3, NULL, 0) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create heap tracker task");
+        free(s_history);
+        s_history = NULL;
+        vSemaphoreDelete(s_history_mutex);
+        s_history_mutex = NULL;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+int heap_tracker_get_samples(heap_tracker_sample_t *out, int max) {
+    if (s_history == NULL) {
+        return 0;
+    }
+    xSemaphoreTake(s_history_mutex, portMAX_DELAY);
+    int n = (s_history_count < max) ? s_history_count : max;
+    int start = (s_history_head - n + HEAP_TRACKER_HISTORY_LEN) % HEAP_TRACKER_HISTORY_LEN;
+    for (int i = 0; i < n; i++) {
+        out[i] = s_history[(start + i) % HEAP_TRACKER_HISTORY_LEN];
+    }
+    xSemaphoreGive(s_history_mutex);
+    return n;
+}
+
+int heap_tracker_get_sites(heap_tracker_site_t *out, int max) {
+    taskENTER_CRITICAL(&s_site_lock);
+    int n = (s_site_count < max) ? s_site_count : max;
+    memcpy(out, s_sites, n * sizeof(heap_tracker_site_t));
+    taskEXIT_CRITICAL(&s_site_lock);
+
+    // Insertion sort, largest single allocation first
+    for (int i = 1; i < n; i++) {
+        heap_tracker_site_t tmp = out[i];
+        int j = i - 1;
+        while (j >= 0 && out[j].largest < tmp.largest) {
+            out[j + 1] = out[j];
+            j--;
+        }
+        out[j + 1] = tmp;
+    }
+    return n;
+}
+
+int heap_tracker_get_failures(heap_tracker_failure_t *out, int max) {
+    taskENTER_CRITICAL(&s_site_lock);
+    int n = (s_failure_count < max) ? s_failure_count : max;
+    int start = (s_failure_head - n + HEAP_TRACKER_MAX_FAILURES) % HEAP_TRACKER_MAX_FAILURES;
+    for (int i = 0; i < n; i++) {
+        out[i] = s_failures[(start + i) % HEAP_TRACKER_MAX_FAILURES];
+    }
+    taskEXIT_CRITICAL(&s_site_lock);
+    return n;
+}
+
+void heap_tracker_get_alert(bool *active, uint32_t *count, uint32_t *min_dma_largest) {
+    *active = s_alert_active;
+    *count = s_alert_count;
+    *min_dma_largest = (s_min_dma_largest == UINT32_MAX) ? 0 : s_min_dma_largest;
+}
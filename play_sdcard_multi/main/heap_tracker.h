@@ -0,0 +1,115 @@
+#ifndef HEAP_TRACKER_H
+#define HEAP_TRACKER_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Sample period and history length: 15s x 1440 = 6 hours
+#define HEAP_TRACKER_PERIOD_S          15
+#define HEAP_TRACKER_HISTORY_LEN       1440
+
+// Call sites remembered by the allocation wrapper, and recent failures
+#define HEAP_TRACKER_MAX_SITES         32
+#define HEAP_TRACKER_MAX_FAILURES      8
+
+// Largest DMA block the audio path needs to (re)start a track: the SDMMC
+// bounce buffer used when fatfs reads into PSRAM plus the I2S descriptors.
+// Below this a track restart or a directory scan can fail outright.
+#define HEAP_TRACKER_DMA_NEED_BYTES    4096
+
+// Heaps sampled, in this order
+typedef enum {
+    HEAP_TRACKER_DMA = 0,
+    HEAP_TRACKER_INTERNAL,
+    HEAP_TRACKER_SPIRAM,
+    HEAP_TRACKER_NUM_HEAPS
+} heap_tracker_heap_t;
+
+typedef struct {
+    uint32_t uptime_s;
+    uint32_t free[HEAP_TRACKER_NUM_HEAPS];
+    uint32_t largest[HEAP_TRACKER_NUM_HEAPS];
+} heap_tracker_sample_t;
+
+typedef struct {
+    const char *file;
+    int line;
+    uint32_t caps;
+    uint32_t count;
+    uint32_t failures;
+    uint32_t largest;               // largest single request from this site
+    uint64_t total_bytes;           // sum of all requests
+} heap_tracker_site_t;
+
+typedef struct {
+    uint32_t uptime_s;
+    const char *file;
+    int line;
+    uint32_t size;
+    uint32_t caps;
+    uint32_t free_at_failure;       // free bytes with the requested caps
+    uint32_t largest_at_failure;
+} heap_tracker_failure_t;
+
+/**
+ * @brief Allocation wrappers that record the call site
+ *
+ * Drop-in replacements for heap_caps_malloc / heap_caps_calloc. Memory is
+ * released with free() as usual. Sites are told apart by the file pointer,
+ * so callers of the _at forms pass a string literal.
+ */
+#define heap_tracker_malloc(size, caps) \
+    heap_tracker_malloc_at((size), (caps), __FILE__, __LINE__)
+#define heap_tracker_calloc(n, size, caps) \
+    heap_tracker_calloc_at((n), (size), (caps), __FILE__, __LINE__)
+
+void *heap_tracker_malloc_at(size_t size, uint32_t caps, const char *file, int line);
+void *heap_tracker_calloc_at(size_t n, size_t size, uint32_t caps, const char *file, int line);
+
+/**
+ * @brief Start the heap sampling task
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t heap_tracker_init(void);
+
+/**
+ * @brief Copy samples out of the history, oldest first
+ *
+ * @param out Output array
+ * @param max Size of the output array; the most recent max samples are returned
+ * @return int Number of samples written
+ */
+int heap_tracker_get_samples(heap_tracker_sample_t *out, int max);
+
+/**
+ * @brief Copy the call site table, largest single allocation first
+ *
+ * @return int Number of sites written
+ */
+int heap_tracker_get_sites(heap_tracker_site_t *out, int max);
+
+/**
+ * @brief Copy recent allocation failures, oldest first
+ *
+ * @return int Number of failures written
+ */
+int heap_tracker_get_failures(heap_tracker_failure_t *out, int max);
+
+/**
+ * @brief DMA low-block alert state
+ *
+ * @param active True while the DMA largest block is below HEAP_TRACKER_DMA_NEED_BYTES
+ * @param count Number of times the alert has been raised since boot
+ * @param min_dma_largest Lowest DMA largest block seen since boot
+ */
+void heap_tracker_get_alert(bool *active, uint32_t *count, uint32_t *min_dma_largest);
+
+/**
+ * @brief Short name of a heap, used in JSON and metrics output
+ */
+const char *heap_tracker_heap_name(heap_tracker_heap_t heap);
+
+#endif // HEAP_TRACKER_H
@@ -1,3 +1,4 @@
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -13,10 +14,26 @@
 #include "esp_wifi.h"
 #include "config_manager.h"
 #include "unit_status_manager.h"
+#include "flight_recorder.h"
+#include "metrics.h"
+#include "task_profiler.h"
 #include <sys/stat.h>
 #include "esp_system.h"
 #include "esp_timer.h"
 #include "esp_heap_caps.h"
+#include "heap_tracker.h"
+#include "log_buffer.h"
+#include "audio_analysis.h"
+#include "flash_store.h"
+#include "sd_arbiter.h"
+#include "playhead.h"
+#include "mp3_index.h"
+#include "shared_read.h"
+#include "oneshot.h"
+#include "convolver.h"
+#include "spectrum.h"
+#include "wav_header.h"
+#include "osc_server.h"
 
 static const char *TAG = "HTTP_SERVER";
 
@@ -54,6 +71,17 @@ static esp_err_t loop_file_handler(httpd_req_t *req);
 static esp_err_t loop_start_handler(httpd_req_t *req);
 static esp_err_t loop_stop_handler(httpd_req_t *req);
 static esp_err_t loop_volume_handler(httpd_req_t *req);
+static esp_err_t loop_seek_handler(httpd_req_t *req);
+// One-shot handlers
+static esp_err_t oneshot_get_handler(httpd_req_t *req);
+static esp_err_t oneshot_load_handler(httpd_req_t *req);
+static esp_err_t oneshot_unload_handler(httpd_req_t *req);
+static esp_err_t oneshot_trigger_handler(httpd_req_t *req);
+static esp_err_t oneshot_stop_handler(httpd_req_t *req);
+static esp_err_t correction_get_handler(httpd_req_t *req);
+static esp_err_t correction_load_handler(httpd_req_t *req);
+static esp_err_t correction_clear_handler(httpd_req_t *req);
+static esp_err_t spectrum_get_handler(httpd_req_t *req);
 static esp_err_t global_volume_handler(httpd_req_t *req);
 static esp_err_t root_get_handler(httpd_req_t *req);
 static esp_err_t api_docs_handler(httpd_req_t *req);
@@ -73,7 +101,52 @@ static esp_err_t id_get_handler(httpd_req_t *req);
 static esp_err_t id_set_handler(httpd_req_t *req);
 static esp_err_t file_upload_handler(httpd_req_t *req);
 static esp_err_t file_delete_handler(httpd_req_t *req);
+static esp_err_t flash_write_handler(httpd_req_t *req);
 static esp_err_t system_reboot_handler(httpd_req_t *req);
+// Flight recorder handlers
+static esp_err_t recorder_summary_handler(httpd_req_t *req);
+static esp_err_t recorder_slot_handler(httpd_req_t *req);
+static esp_err_t recorder_trigger_handler(httpd_req_t *req);
+static esp_err_t recorder_clear_handler(httpd_req_t *req);
+static esp_err_t metrics_get_handler(httpd_req_t *req);
+static esp_err_t perf_tasks_handler(httpd_req_t *req);
+static esp_err_t perf_heap_handler(httpd_req_t *req);
+static esp_err_t logs_get_handler(httpd_req_t *req);
+static esp_err_t logs_level_handler(httpd_req_t *req);
+
+// Every handler is registered through a trampoline so request counts and
+// latency show up in /metrics
+typedef struct {
+    esp_err_t (*handler)(httpd_req_t *req);
+    metrics_http_endpoint_t *metrics;
+} timed_handler_t;
+
+static timed_handler_t s_timed_handlers[METRICS_MAX_HTTP_ENDPOINTS];
+static int s_timed_handler_count = 0;
+
+static esp_err_t timed_handler_trampoline(httpd_req_t *req) {
+    timed_handler_t *th = (timed_handler_t *)req->user_ctx;
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = th->handler(req);
+    uint32_t elapsed_ms = (uint32_t)((esp_timer_get_time() - start + 500) / 1000);
+    metrics_http_observe(th->metrics, elapsed_ms, ret == ESP_OK);
+    return ret;
+}
+
+static esp_err_t register_timed_handler(httpd_handle_t server, const httpd_uri_t *uri) {
+    if (s_timed_handler_count >= METRICS_MAX_HTTP_ENDPOINTS) {
+        ESP_LOGW(TAG, "No timing slot for %s, registering untimed", uri->uri);
+        return httpd_register_uri_handler(server, uri);
+    }
+    timed_handler_t *th = &s_timed_handlers[s_timed_handler_count++];
+    th->handler = uri->handler;
+    th->metrics = metrics_http_endpoint_add(uri->uri, uri->method);
+
+    httpd_uri_t wrapped = *uri;
+    wrapped.handler = timed_handler_trampoline;
+    wrapped.user_ctx = th;
+    return httpd_register_uri_handler(server, &wrapped);
+}
 
 /**
  * @brief Send JSON response (uses SPIRAM via cJSON hooks)
@@ -101,7 +174,7 @@ static esp_err_t send_json_response(httpd_req_t *req, cJSON *json) {
  * @brief Parse JSON from request body
  */
 static cJSON* parse_json_request(httpd_req_t *req) {
-    char *buf = heap_caps_malloc(req->content_len + 1, MALLOC_CAP_SPIRAM);
+    char *buf = heap_tracker_malloc(req->content_len + 1, MALLOC_CAP_SPIRAM);
     if (!buf) {
         ESP_LOGE(TAG, "Failed to allocate memory for request buffer");
         return NULL;
@@ -159,12 +232,17 @@ static esp_err_t files_get_handler(httpd_req_t *req) {
             
             // Get file size
             struct stat file_stat;
-            if (stat(full_path, &file_stat) == 0) {
+            sd_arbiter_begin(SD_IO_METADATA);
+            int stat_ret = stat(full_path, &file_stat);
+            sd_arbiter_end(SD_IO_METADATA);
+            if (stat_ret == 0) {
                 cJSON_AddNumberToObject(file_obj, "size", file_stat.st_size);
             } else {
                 cJSON_AddNumberToObject(file_obj, "size", 0);
             }
             
+            cJSON_AddStringToObject(file_obj, "storage", "sdcard");
+            
             cJSON_AddItemToArray(files_array, file_obj);
         }
         
@@ -175,6 +253,24 @@ static esp_err_t files_get_handler(httpd_req_t *req) {
         free(music_files);
     }
     
+    // Files in the flash store play by path, they have no index
+    for (int i = 0; i < flash_store_count(); i++) {
+        const flash_store_entry_t *entry = flash_store_entry(i);
+        enum FILETYPE_ENUM filetype;
+        if (music_determine_filetype(entry->name, &filetype) != ESP_OK) {
+            continue;
+        }
+        cJSON *file_obj = cJSON_CreateObject();
+        cJSON_AddStringToObject(file_obj, "name", entry->name);
+        cJSON_AddStringToObject(file_obj, "type", (filetype == FILETYPE_MP3) ? "mp3" : "wav");
+        char full_path[MAX_FILE_PATH_LEN];
+        snprintf(full_path, sizeof(full_path), FLASH_STORE_MOUNT "/%s", entry->name);
+        cJSON_AddStringToObject(file_obj, "path", full_path);
+        cJSON_AddNumberToObject(file_obj, "size", entry->size);
+        cJSON_AddStringToObject(file_obj, "storage", "flash");
+        cJSON_AddItemToArray(files_array, file_obj);
+    }
+    
     cJSON_AddItemToObject(response, "files", files_array);
     cJSON_AddNumberToObject(response, "count", cJSON_GetArraySize(files_array));
     
@@ -184,12 +280,7 @@ static esp_err_t files_get_handler(httpd_req_t *req) {
     return send_ret;
 }
 
-/**
- * @brief GET /api/loops - List currently playing loops
- */
-static esp_err_t loops_get_handler(httpd_req_t *req) {
-    ESP_LOGI(TAG, "GET /api/loops");
-    
+cJSON *http_server_loops_json(void) {
     cJSON *response = cJSON_CreateObject();
     cJSON *loops_array = cJSON_CreateArray();
     
@@ -206,6 +297,17 @@ static esp_err_t loops_get_handler(httpd_req_t *req) {
             cJSON_AddNumberToObject(loop_obj, "volume", g_loop_manager->loops[i].volume_percent);
             cJSON_AddBoolToObject(loop_obj, "playing", g_loop_manager->loops[i].is_playing);
             
+            // Where in the file the track is, as heard
+            playhead_t ph;
+            if (g_loop_manager->loops[i].is_playing && playhead_get(i, &ph) == ESP_OK) {
+                cJSON *ph_obj = cJSON_CreateObject();
+                cJSON_AddNumberToObject(ph_obj, "sample", (double)ph.sample);
+                cJSON_AddNumberToObject(ph_obj, "sample_rate", ph.sample_rate);
+                cJSON_AddNumberToObject(ph_obj, "ms", (double)(ph.sample * 1000 / ph.sample_rate));
+                cJSON_AddNumberToObject(ph_obj, "latency_ms", ph.latency * 1000 / ph.sample_rate);
+                cJSON_AddItemToObject(loop_obj, "playhead", ph_obj);
+            }
+            
             cJSON_AddItemToArray(loops_array, loop_obj);
         }
     }
@@ -224,7 +326,16 @@ static esp_err_t loops_get_handler(httpd_req_t *req) {
     cJSON_AddNumberToObject(response, "active_count", active_count);
     cJSON_AddNumberToObject(response, "max_tracks", MAX_TRACKS);
     cJSON_AddNumberToObject(response, "global_volume", g_loop_manager ? g_loop_manager->global_volume_percent : 75);
+    return response;
+}
+
+/**
+ * @brief GET /api/loops - List currently playing loops
+ */
+static esp_err_t loops_get_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "GET /api/loops");
     
+    cJSON *response = http_server_loops_json();
     esp_err_t ret = send_json_response(req, response);
     cJSON_Delete(response);
     
@@ -590,15 +701,528 @@ static esp_err_t loop_volume_handler(httpd_req_t *req) {
             cJSON_AddBoolToObject(response, "success", false);
             cJSON_AddStringToObject(response, "error", "Failed to send command to audio task");
         }
-    } else {
-        cJSON_AddBoolToObject(response, "success", false);
-        cJSON_AddStringToObject(response, "error", "Audio system not initialized");
+    } else {
+        cJSON_AddBoolToObject(response, "success", false);
+        cJSON_AddStringToObject(response, "error", "Audio system not initialized");
+    }
+    
+    esp_err_t ret = send_json_response(req, response);
+    cJSON_Delete(response);
+    cJSON_Delete(request);
+    
+    return ret;
+}
+
+/**
+ * @brief POST /api/loop/seek - Play a track's file from a sample
+ * Body: { "track": 0, "sample": 44100 }
+ */
+static esp_err_t loop_seek_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "POST /api/loop/seek");
+    
+    if (req->content_len == 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Empty request body");
+        return ESP_FAIL;
+    }
+    
+    cJSON *request = parse_json_request(req);
+    if (!request) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+        return ESP_FAIL;
+    }
+    
+    cJSON *response = cJSON_CreateObject();
+    const char *error = NULL;
+    
+    cJSON *track_json = cJSON_GetObjectItem(request, "track");
+    cJSON *sample_json = cJSON_GetObjectItem(request, "sample");
+    int track = cJSON_IsNumber(track_json) ? track_json->valueint : -1;
+    // Doubles are whole numbers up to 2^53, and the cast is undefined past uint64_t
+    double sample_d = cJSON_IsNumber(sample_json) ? sample_json->valuedouble : -1;
+    uint64_t sample = 0;
+    if (!cJSON_IsNumber(track_json)) {
+        error = "Missing or invalid track number";
+    } else if (track < 0 || track >= MAX_TRACKS) {
+        error = "Track index out of range";
+    } else if (!(sample_d >= 0 && sample_d < 9007199254740992.0)) {
+        error = "Missing or invalid sample";
+    } else if (!g_loop_manager || !g_loop_manager->audio_control_queue) {
+        error = "Audio system not initialized";
+    } else if (strlen(g_loop_manager->loops[track].file_path) == 0) {
+        error = "No file configured for this track. Use /api/loop/file first.";
+    }
+    
+    // Find where to read from here, so a bad sample is an answer rather than silence
+    audio_control_msg_t control_msg = { .type = AUDIO_ACTION_SEEK_TRACK };
+    track_seek_data_t *seek = &control_msg.data.seek_track;
+    uint32_t sample_rate = 0;
+    if (!error) {
+        sample = (uint64_t)sample_d;
+        seek->track_index = track;
+        strncpy(seek->file_path, g_loop_manager->loops[track].file_path, sizeof(seek->file_path) - 1);
+        char shared_path[256];
+        esp_err_t err = playhead_locate(seek->file_path, sample,
+                                        &seek->offset, &seek->sample, &sample_rate);
+        if (err == ESP_ERR_INVALID_SIZE) {
+            error = "Sample is past the end of the file";
+        } else if (err == ESP_ERR_NOT_SUPPORTED) {
+            error = "Can't seek in this kind of file";
+        } else if (err != ESP_OK) {
+            error = "Can't read the track's file";
+        } else if (!shared_read_path_at(seek->file_path, seek->offset, shared_path, sizeof(shared_path))) {
+            error = "Only files on the SD card can be played from a sample";
+        }
+    }
+    
+    if (!error && xQueueSend(g_loop_manager->audio_control_queue, &control_msg, pdMS_TO_TICKS(100)) != pdPASS) {
+        error = "Failed to send command to audio task";
+    }
+    
+    if (error) {
+        cJSON_AddBoolToObject(response, "success", false);
+        cJSON_AddStringToObject(response, "error", error);
+    } else {
+        cJSON_AddBoolToObject(response, "success", true);
+        cJSON_AddNumberToObject(response, "track", track);
+        cJSON_AddStringToObject(response, "file", seek->file_path);
+        cJSON_AddNumberToObject(response, "requested_sample", (double)sample);
+        cJSON_AddNumberToObject(response, "sample", (double)seek->sample);
+        cJSON_AddNumberToObject(response, "sample_rate", sample_rate);
+        cJSON_AddNumberToObject(response, "offset", seek->offset);
+    }
+    
+    esp_err_t ret = send_json_response(req, response);
+    cJSON_Delete(response);
+    cJSON_Delete(request);
+    
+    return ret;
+}
+
+/**
+ * @brief GET /api/oneshot - Slots, voices and trigger latency
+ */
+static esp_err_t oneshot_get_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "GET /api/oneshot");
+    
+    cJSON *response = cJSON_CreateObject();
+    
+    cJSON *slots = cJSON_CreateArray();
+    for (int i = 0; i < ONESHOT_SLOTS; i++) {
+        oneshot_slot_info_t info;
+        if (oneshot_get_slot(i, &info) != ESP_OK || !info.loaded) {
+            continue;
+        }
+        cJSON *slot = cJSON_CreateObject();
+        cJSON_AddNumberToObject(slot, "slot", i);
+        cJSON_AddStringToObject(slot, "file", info.file_path);
+        cJSON_AddNumberToObject(slot, "channels", info.channels);
+        cJSON_AddNumberToObject(slot, "frames", info.frames);
+        cJSON_AddNumberToObject(slot, "ms", (uint64_t)info.frames * 1000 / WAV_NATIVE_SAMPLE_RATE);
+        cJSON_AddNumberToObject(slot, "attack_ms", info.attack_frames * 1000 / WAV_NATIVE_SAMPLE_RATE);
+        cJSON_AddItemToArray(slots, slot);
+    }
+    cJSON_AddItemToObject(response, "slots", slots);
+    
+    cJSON *voices = cJSON_CreateArray();
+    for (int i = 0; i < ONESHOT_VOICES; i++) {
+        oneshot_voice_info_t info;
+        if (oneshot_get_voice(i, &info) != ESP_OK) {
+            continue;
+        }
+        cJSON *voice = cJSON_CreateObject();
+        cJSON_AddNumberToObject(voice, "voice", i);
+        cJSON_AddBoolToObject(voice, "active", info.active);
+        if (info.active) {
+            cJSON_AddNumberToObject(voice, "slot", info.slot);
+            cJSON_AddNumberToObject(voice, "ms", (uint64_t)info.frame * 1000 / WAV_NATIVE_SAMPLE_RATE);
+            cJSON_AddNumberToObject(voice, "gain_db", info.gain_db);
+        }
+        cJSON_AddItemToArray(voices, voice);
+    }
+    cJSON_AddItemToObject(response, "voices", voices);
+    
+    // Trigger to mixed is measured; from there to the DAC is the DMA, estimated
+    oneshot_stats_t stats;
+    oneshot_get_stats(&stats);
+    uint32_t output_ms = oneshot_output_latency_frames() * 1000 / WAV_NATIVE_SAMPLE_RATE;
+    cJSON *latency = cJSON_CreateObject();
+    cJSON_AddNumberToObject(latency, "count", stats.latency_count);
+    cJSON_AddNumberToObject(latency, "last_us", stats.latency_last_us);
+    cJSON_AddNumberToObject(latency, "max_us", stats.latency_max_us);
+    cJSON_AddNumberToObject(latency, "mean_us",
+                            stats.latency_count ? (double)(stats.latency_sum_us / stats.latency_count) : 0);
+    cJSON_AddNumberToObject(latency, "block_us", (uint64_t)stats.block_frames * 1000000 / WAV_NATIVE_SAMPLE_RATE);
+    cJSON_AddNumberToObject(latency, "output_ms", output_ms);
+    cJSON_AddItemToObject(response, "latency", latency);
+    
+    osc_server_stats_t osc;
+    osc_server_get_stats(&osc);
+    cJSON *counts = cJSON_CreateObject();
+    cJSON_AddNumberToObject(counts, "triggers", stats.triggers);
+    cJSON_AddNumberToObject(counts, "steals", stats.steals);
+    cJSON_AddNumberToObject(counts, "late_blocks", stats.late_blocks);
+    cJSON_AddNumberToObject(counts, "osc_packets", osc.packets);
+    cJSON_AddNumberToObject(counts, "osc_dropped", osc.dropped);
+    cJSON_AddItemToObject(response, "counts", counts);
+    
+    esp_err_t ret = send_json_response(req, response);
+    cJSON_Delete(response);
+    
+    return ret;
+}
+
+// Slot number from a one-shot request, or an error
+static const char *oneshot_slot_arg(cJSON *request, int *slot) {
+    cJSON *slot_json = cJSON_GetObjectItem(request, "slot");
+    if (!cJSON_IsNumber(slot_json)) {
+        return "Missing or invalid slot number";
+    }
+    *slot = slot_json->valueint;
+    if (*slot < 0 || *slot >= ONESHOT_SLOTS) {
+        return "Slot index out of range";
+    }
+    return NULL;
+}
+
+/**
+ * @brief POST /api/oneshot/load - Load a WAV file into a slot
+ * Body: { "slot": 0, "filename": "door.wav" }  // OR "file_path": "/sdcard/door.wav"
+ */
+static esp_err_t oneshot_load_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "POST /api/oneshot/load");
+    
+    if (req->content_len == 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Empty request body");
+        return ESP_FAIL;
+    }
+    
+    cJSON *request = parse_json_request(req);
+    if (!request) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+        return ESP_FAIL;
+    }
+    
+    cJSON *response = cJSON_CreateObject();
+    int slot = -1;
+    const char *error = oneshot_slot_arg(request, &slot);
+    
+    char file_path[256] = {0};
+    cJSON *file_path_json = cJSON_GetObjectItem(request, "file_path");
+    cJSON *filename_json = cJSON_GetObjectItem(request, "filename");
+    if (!error && cJSON_IsString(file_path_json)) {
+        strncpy(file_path, file_path_json->valuestring, sizeof(file_path) - 1);
+    } else if (!error && cJSON_IsString(filename_json)) {
+        if (strchr(filename_json->valuestring, '/') != NULL || strchr(filename_json->valuestring, '\\') != NULL) {
+            error = "Invalid filename - path separators not allowed";
+        } else {
+            snprintf(file_path, sizeof(file_path), "/sdcard/%s", filename_json->valuestring);
+        }
+    } else if (!error) {
+        error = "No valid file specified";
+    }
+    
+    if (!error) {
+        esp_err_t err = oneshot_load(slot, file_path);
+        if (err == ESP_ERR_NOT_FOUND) {
+            error = "File not found";
+        } else if (err == ESP_ERR_NOT_SUPPORTED) {
+            error = "One-shots must be 16 bit PCM WAV at 44100 Hz, mono or stereo";
+        } else if (err == ESP_ERR_NO_MEM) {
+            error = "Not enough memory for the sample";
+        } else if (err != ESP_OK) {
+            error = "Can't read the file";
+        }
+    }
+    
+    if (error) {
+        cJSON_AddBoolToObject(response, "success", false);
+        cJSON_AddStringToObject(response, "error", error);
+    } else {
+        oneshot_slot_info_t info;
+        oneshot_get_slot(slot, &info);
+        cJSON_AddBoolToObject(response, "success", true);
+        cJSON_AddNumberToObject(response, "slot", slot);
+        cJSON_AddStringToObject(response, "file", file_path);
+        cJSON_AddNumberToObject(response, "frames", info.frames);
+        cJSON_AddNumberToObject(response, "attack_ms", info.attack_frames * 1000 / WAV_NATIVE_SAMPLE_RATE);
+    }
+    
+    esp_err_t ret = send_json_response(req, response);
+    cJSON_Delete(response);
+    cJSON_Delete(request);
+    
+    return ret;
+}
+
+/**
+ * @brief POST /api/oneshot/unload - Empty a slot
+ * Body: { "slot": 0 }
+ */
+static esp_err_t oneshot_unload_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "POST /api/oneshot/unload");
+    
+    if (req->content_len == 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Empty request body");
+        return ESP_FAIL;
+    }
+    
+    cJSON *request = parse_json_request(req);
+    if (!request) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+        return ESP_FAIL;
+    }
+    
+    cJSON *response = cJSON_CreateObject();
+    int slot = -1;
+    const char *error = oneshot_slot_arg(request, &slot);
+    if (!error && oneshot_unload(slot) != ESP_OK) {
+        error = "One-shots not initialized";
+    }
+    
+    if (error) {
+        cJSON_AddBoolToObject(response, "success", false);
+        cJSON_AddStringToObject(response, "error", error);
+    } else {
+        cJSON_AddBoolToObject(response, "success", true);
+        cJSON_AddNumberToObject(response, "slot", slot);
+    }
+    
+    esp_err_t ret = send_json_response(req, response);
+    cJSON_Delete(response);
+    cJSON_Delete(request);
+    
+    return ret;
+}
+
+/**
+ * @brief POST /api/oneshot/trigger - Play a slot now
+ * Body: { "slot": 0, "gain_db": -6 }  // gain_db optional, default 0
+ */
+static esp_err_t oneshot_trigger_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "POST /api/oneshot/trigger");
+    
+    if (req->content_len == 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Empty request body");
+        return ESP_FAIL;
+    }
+    
+    cJSON *request = parse_json_request(req);
+    if (!request) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+        return ESP_FAIL;
+    }
+    
+    cJSON *response = cJSON_CreateObject();
+    int slot = -1;
+    int voice = -1;
+    const char *error = oneshot_slot_arg(request, &slot);
+    cJSON *gain_json = cJSON_GetObjectItem(request, "gain_db");
+    float gain_db = cJSON_IsNumber(gain_json) ? (float)gain_json->valuedouble : 0.0f;
+    if (!error && gain_json && !cJSON_IsNumber(gain_json)) {
+        error = "Invalid gain_db";
+    }
+    if (!error && oneshot_trigger(slot, gain_db, &voice) != ESP_OK) {
+        error = "Nothing loaded in this slot";
+    }
+    
+    if (error) {
+        cJSON_AddBoolToObject(response, "success", false);
+        cJSON_AddStringToObject(response, "error", error);
+    } else {
+        cJSON_AddBoolToObject(response, "success", true);
+        cJSON_AddNumberToObject(response, "slot", slot);
+        cJSON_AddNumberToObject(response, "voice", voice);
+    }
+    
+    esp_err_t ret = send_json_response(req, response);
+    cJSON_Delete(response);
+    cJSON_Delete(request);
+    
+    return ret;
+}
+
+/**
+ * @brief POST /api/oneshot/stop - Fade out every one-shot voice
+ */
+static esp_err_t oneshot_stop_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "POST /api/oneshot/stop");
+    
+    oneshot_stop_all();
+    
+    cJSON *response = cJSON_CreateObject();
+    cJSON_AddBoolToObject(response, "success", true);
+    esp_err_t ret = send_json_response(req, response);
+    cJSON_Delete(response);
+    
+    return ret;
+}
+
+// The correction filter's state, into obj
+static void add_correction_info(cJSON *obj) {
+    convolver_info_t info;
+    convolver_get_info(&info);
+    cJSON_AddBoolToObject(obj, "loaded", info.loaded);
+    if (info.loaded) {
+        cJSON_AddStringToObject(obj, "file", info.file_path);
+        cJSON_AddNumberToObject(obj, "taps", info.taps);
+        cJSON_AddNumberToObject(obj, "partitions", info.partitions);
+        cJSON_AddNumberToObject(obj, "latency_us", (uint64_t)info.latency_frames * 1000000 / WAV_NATIVE_SAMPLE_RATE);
+        cJSON_AddNumberToObject(obj, "cpu_permille", info.cpu_permille);
+        cJSON_AddNumberToObject(obj, "max_block_us", info.max_block_us);
+    }
+    cJSON_AddStringToObject(obj, "fft", info.simd ? "esp-dsp" : "portable");
+}
+
+/**
+ * @brief GET /api/correction - The speaker correction filter and what it costs
+ */
+static esp_err_t correction_get_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "GET /api/correction");
+    
+    cJSON *response = cJSON_CreateObject();
+    add_correction_info(response);
+    
+    esp_err_t ret = send_json_response(req, response);
+    cJSON_Delete(response);
+    
+    return ret;
+}
+
+/**
+ * @brief POST /api/correction/load - Correct the output with a FIR from a WAV file
+ * Body: { "filename": "correction.wav" }  // OR "file_path": "/sdcard/correction.wav"
+ */
+static esp_err_t correction_load_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "POST /api/correction/load");
+    
+    if (req->content_len == 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Empty request body");
+        return ESP_FAIL;
+    }
+    
+    cJSON *request = parse_json_request(req);
+    if (!request) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+        return ESP_FAIL;
+    }
+    
+    cJSON *response = cJSON_CreateObject();
+    const char *error = NULL;
+    
+    char file_path[256] = {0};
+    cJSON *file_path_json = cJSON_GetObjectItem(request, "file_path");
+    cJSON *filename_json = cJSON_GetObjectItem(request, "filename");
+    if (cJSON_IsString(file_path_json)) {
+        strncpy(file_path, file_path_json->valuestring, sizeof(file_path) - 1);
+    } else if (cJSON_IsString(filename_json)) {
+        if (strchr(filename_json->valuestring, '/') != NULL || strchr(filename_json->valuestring, '\\') != NULL) {
+            error = "Invalid filename - path separators not allowed";
+        } else {
+            snprintf(file_path, sizeof(file_path), "/sdcard/%s", filename_json->valuestring);
+        }
+    } else {
+        error = "No valid file specified";
+    }
+    
+    if (!error) {
+        esp_err_t err = convolver_load(file_path);
+        if (err == ESP_ERR_NOT_FOUND) {
+            error = "File not found";
+        } else if (err == ESP_ERR_NOT_SUPPORTED) {
+            error = "Filters must be PCM or float WAV at 44100 Hz";
+        } else if (err == ESP_ERR_INVALID_SIZE) {
+            error = "Filters must have 1 to 2048 taps";
+        } else if (err == ESP_ERR_NO_MEM) {
+            error = "Not enough memory for the filter";
+        } else if (err != ESP_OK) {
+            error = "Can't read the file";
+        }
+    }
+    
+    if (error) {
+        cJSON_AddBoolToObject(response, "success", false);
+        cJSON_AddStringToObject(response, "error", error);
+    } else {
+        cJSON_AddBoolToObject(response, "success", true);
+        add_correction_info(response);
+    }
+    
+    esp_err_t ret = send_json_response(req, response);
+    cJSON_Delete(response);
+    cJSON_Delete(request);
+    
+    return ret;
+}
+
+/**
+ * @brief POST /api/correction/clear - Stop correcting, until the next load or boot
+ */
+static esp_err_t correction_clear_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "POST /api/correction/clear");
+    
+    convolver_clear();
+    
+    cJSON *response = cJSON_CreateObject();
+    cJSON_AddBoolToObject(response, "success", true);
+    esp_err_t ret = send_json_response(req, response);
+    cJSON_Delete(response);
+    
+    return ret;
+}
+
+// To a tenth of a dB, which is as far as it means anything and keeps the numbers short
+static double spectrum_db(float db) {
+    return round(db * 10.0) / 10.0;
+}
+
+/**
+ * @brief GET /api/spectrum - The output's spectrum, 256 bins and 1/3 octaves
+ *
+ * Polling keeps the analyser running; it stops SPECTRUM_IDLE_MS after the
+ * last request. The first request after that gets "ready": false.
+ */
+static esp_err_t spectrum_get_handler(httpd_req_t *req) {
+    ESP_LOGD(TAG, "GET /api/spectrum");
+
+    spectrum_t *spectrum = heap_tracker_malloc(sizeof(spectrum_t), MALLOC_CAP_SPIRAM);
+    if (!spectrum) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to allocate buffer");
+        return ESP_FAIL;
+    }
+    uint32_t age_ms = 0;
+    esp_err_t err = spectrum_get(spectrum, &age_ms);
+    if (err != ESP_OK && err != ESP_ERR_NOT_FOUND) {
+        free(spectrum);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Spectrum analyser not available");
+        return ESP_FAIL;
+    }
+
+    cJSON *response = cJSON_CreateObject();
+    cJSON_AddBoolToObject(response, "ready", err == ESP_OK);
+    cJSON_AddNumberToObject(response, "update_ms", SPECTRUM_UPDATE_MS);
+    if (err == ESP_OK) {
+        cJSON_AddNumberToObject(response, "age_ms", age_ms);
+        cJSON_AddNumberToObject(response, "blocks", spectrum->blocks);
+        cJSON_AddNumberToObject(response, "bin_hz", round(spectrum_bin_hz(1) * 100.0) / 100.0);
+        cJSON *bins = cJSON_CreateArray();
+        for (int k = 0; k < SPECTRUM_BINS; k++) {
+            cJSON_AddItemToArray(bins, cJSON_CreateNumber(spectrum_db(spectrum->bins_db[k])));
+        }
+        cJSON_AddItemToObject(response, "bins_dbfs", bins);
+        cJSON *bands = cJSON_CreateArray();
+        for (int b = 0; b < SPECTRUM_BANDS; b++) {
+            cJSON *band = cJSON_CreateObject();
+            cJSON_AddNumberToObject(band, "hz", spectrum_band_hz(b));
+            cJSON_AddNumberToObject(band, "dbfs", spectrum_db(spectrum->bands_db[b]));
+            cJSON_AddItemToArray(bands, band);
+        }
+        cJSON_AddItemToObject(response, "bands", bands);
     }
-    
+    free(spectrum);
+
     esp_err_t ret = send_json_response(req, response);
     cJSON_Delete(response);
-    cJSON_Delete(request);
-    
+
     return ret;
 }
 
@@ -988,6 +1612,7 @@ static esp_err_t config_save_handler(httpd_req_t *req) {
     
     // Save current configuration
     esp_err_t ret = config_save(g_loop_manager);
+    flight_recorder_note_event(FR_EVENT_CONFIG_SAVE, -1);
     
     if (ret == ESP_OK) {
         cJSON_AddBoolToObject(response, "success", true);
@@ -1212,7 +1837,7 @@ static esp_err_t file_upload_handler(httpd_req_t *req) {
     
     // Buffer for reading chunks - keep small to avoid memory issues
     #define UPLOAD_CHUNK_SIZE 4096
-    char *chunk_buf = heap_caps_malloc(UPLOAD_CHUNK_SIZE, MALLOC_CAP_SPIRAM);
+    char *chunk_buf = heap_tracker_malloc(UPLOAD_CHUNK_SIZE, MALLOC_CAP_SPIRAM);
     if (!chunk_buf) {
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to allocate buffer");
         return ESP_FAIL;
@@ -1270,7 +1895,9 @@ static esp_err_t file_upload_handler(httpd_req_t *req) {
     ESP_LOGI(TAG, "Uploading file: %s (size: %d bytes)", filepath, req->content_len);
     
     // Open file for writing
+    sd_arbiter_begin(SD_IO_METADATA);
     FILE *file = fopen(filepath, "wb");
+    sd_arbiter_end(SD_IO_METADATA);
     if (!file) {
         ESP_LOGE(TAG, "Failed to open file for writing: %s", filepath);
         free(chunk_buf);
@@ -1278,6 +1905,15 @@ static esp_err_t file_upload_handler(httpd_req_t *req) {
         return ESP_FAIL;
     }
     
+    // Analysed on the way to the card, so nothing reads the file back later.
+    // Without memory for it the upload still goes ahead, just unanalysed.
+    audio_analysis_t *analysis = audio_analysis_create();
+    
+    // Likewise the frame index an MP3 is sought through
+    enum FILETYPE_ENUM filetype = FILETYPE_UNKNOWN;
+    music_determine_filetype(filename, &filetype);
+    mp3_index_t *frame_index = filetype == FILETYPE_MP3 ? mp3_index_create() : NULL;
+    
     // Read and write data in chunks
     size_t total_received = 0;
     size_t remaining = req->content_len;
@@ -1297,24 +1933,42 @@ static esp_err_t file_upload_handler(httpd_req_t *req) {
                 continue;
             }
             ESP_LOGE(TAG, "Upload failed: error receiving data");
+            sd_arbiter_begin(SD_IO_METADATA);
             fclose(file);
             remove(filepath);  // Clean up partial file
+            sd_arbiter_end(SD_IO_METADATA);
             free(chunk_buf);
+            audio_analysis_destroy(analysis);
+            mp3_index_destroy(frame_index);
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Upload failed");
             return ESP_FAIL;
         }
         
-        // Write chunk to file
+        // Write chunk to file, when the tracks can spare the card. While
+        // this waits the client is held off by TCP flow control.
+        sd_arbiter_begin(SD_IO_BULK);
         size_t written = fwrite(chunk_buf, 1, received, file);
+        sd_arbiter_end(SD_IO_BULK);
         if (written != received) {
             ESP_LOGE(TAG, "Failed to write to file: wrote %d of %d bytes", written, received);
+            sd_arbiter_begin(SD_IO_METADATA);
             fclose(file);
             remove(filepath);  // Clean up partial file
+            sd_arbiter_end(SD_IO_METADATA);
             free(chunk_buf);
+            audio_analysis_destroy(analysis);
+            mp3_index_destroy(frame_index);
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file");
             return ESP_FAIL;
         }
         
+        if (analysis) {
+            audio_analysis_feed(analysis, (const uint8_t *)chunk_buf, received);
+        }
+        if (frame_index) {
+            mp3_index_feed(frame_index, (const uint8_t *)chunk_buf, received);
+        }
+        
         total_received += received;
         remaining -= received;
         
@@ -1330,12 +1984,54 @@ static esp_err_t file_upload_handler(httpd_req_t *req) {
         }
     }
     
-    // Close file
+    // Close file, flushing whatever stdio still holds
+    sd_arbiter_begin(SD_IO_BULK);
     fclose(file);
+    sd_arbiter_end(SD_IO_BULK);
     free(chunk_buf);
+    flight_recorder_note_event(FR_EVENT_FILE_UPLOAD, -1);
     
     ESP_LOGI(TAG, "File uploaded successfully: %s (%d bytes)", filename, total_received);
     
+    // Save the analysis next to the file. A sidecar left by an earlier
+    // upload under the same name describes different audio, so it goes
+    // either way.
+    audio_analysis_result_t analysis_result;
+    esp_err_t analysis_ret = ESP_ERR_NO_MEM;
+    if (analysis) {
+        analysis_ret = audio_analysis_finish(analysis, &analysis_result);
+        audio_analysis_destroy(analysis);
+    }
+    if (analysis_ret == ESP_OK) {
+        analysis_ret = audio_analysis_save(filepath, &analysis_result);
+    }
+    if (analysis_ret != ESP_OK) {
+        audio_analysis_remove(filepath);
+        ESP_LOGI(TAG, "No analysis for %s: %s", filename, esp_err_to_name(analysis_ret));
+    } else if (analysis_result.has_loudness) {
+        ESP_LOGI(TAG, "Analysed %s: %.1f LUFS, %.1f dBTP, normalize %+.1f dB", filename,
+                 analysis_result.integrated_lufs, analysis_result.true_peak_dbtp,
+                 audio_analysis_normalize_gain_db(&analysis_result));
+    }
+    
+    // Same for the frame index
+    uint32_t mp3_frames = 0;
+    esp_err_t index_ret = filetype == FILETYPE_MP3 ? ESP_ERR_NO_MEM : ESP_ERR_NOT_SUPPORTED;
+    if (frame_index) {
+        uint32_t sample_rate, samples_per_frame;
+        mp3_index_info(frame_index, &mp3_frames, &sample_rate, &samples_per_frame);
+        index_ret = mp3_index_save(filepath, frame_index);
+        mp3_index_destroy(frame_index);
+    }
+    if (index_ret != ESP_OK) {
+        mp3_index_remove(filepath);
+        if (filetype == FILETYPE_MP3) {
+            ESP_LOGW(TAG, "No frame index for %s: %s", filename, esp_err_to_name(index_ret));
+        }
+    } else {
+        ESP_LOGI(TAG, "Indexed %s: %lu frames", filename, (unsigned long)mp3_frames);
+    }
+    
     // Send success response
     cJSON *response = cJSON_CreateObject();
     cJSON_AddBoolToObject(response, "success", true);
@@ -1343,6 +2039,21 @@ static esp_err_t file_upload_handler(httpd_req_t *req) {
     cJSON_AddStringToObject(response, "path", filepath);
     cJSON_AddNumberToObject(response, "size", total_received);
     cJSON_AddStringToObject(response, "message", "File uploaded successfully");
+    if (analysis_ret == ESP_OK) {
+        cJSON *analysis_obj = cJSON_CreateObject();
+        if (analysis_result.has_loudness) {
+            cJSON_AddNumberToObject(analysis_obj, "integrated_lufs", analysis_result.integrated_lufs);
+            cJSON_AddNumberToObject(analysis_obj, "normalize_gain_db",
+                                    audio_analysis_normalize_gain_db(&analysis_result));
+        }
+        cJSON_AddNumberToObject(analysis_obj, "true_peak_dbtp", analysis_result.true_peak_dbtp);
+        cJSON_AddNumberToObject(analysis_obj, "dc_offset_left", analysis_result.dc_offset[0]);
+        cJSON_AddNumberToObject(analysis_obj, "dc_offset_right", analysis_result.dc_offset[1]);
+        cJSON_AddItemToObject(response, "analysis", analysis_obj);
+    }
+    if (index_ret == ESP_OK) {
+        cJSON_AddNumberToObject(response, "mp3_frames", mp3_frames);
+    }
     
     esp_err_t ret = send_json_response(req, response);
     cJSON_Delete(response);
@@ -1399,7 +2110,10 @@ static esp_err_t file_delete_handler(httpd_req_t *req) {
     
     // Check if file exists
     struct stat file_stat;
-    if (stat(filepath, &file_stat) != 0) {
+    sd_arbiter_begin(SD_IO_METADATA);
+    int stat_ret = stat(filepath, &file_stat);
+    sd_arbiter_end(SD_IO_METADATA);
+    if (stat_ret != 0) {
         cJSON_AddBoolToObject(response, "success", false);
         cJSON_AddStringToObject(response, "error", "File not found");
         send_json_response(req, response);
@@ -1419,8 +2133,14 @@ static esp_err_t file_delete_handler(httpd_req_t *req) {
     }
     
     // Delete the file
-    if (remove(filepath) == 0) {
+    sd_arbiter_begin(SD_IO_METADATA);
+    int remove_ret = remove(filepath);
+    sd_arbiter_end(SD_IO_METADATA);
+    if (remove_ret == 0) {
         ESP_LOGI(TAG, "File deleted successfully: %s", filename);
+        audio_analysis_remove(filepath);
+        mp3_index_remove(filepath);
+        flight_recorder_note_event(FR_EVENT_FILE_DELETE, -1);
         cJSON_AddBoolToObject(response, "success", true);
         cJSON_AddStringToObject(response, "filename", filename);
         cJSON_AddStringToObject(response, "message", "File deleted successfully");
@@ -1437,6 +2157,88 @@ static esp_err_t file_delete_handler(httpd_req_t *req) {
     return ret;
 }
 
+/**
+ * @brief POST /api/flash - Replace the audio image in the flash partition
+ * Body: the image from device-manager/flash_pack.py, as application/octet-stream
+ */
+static esp_err_t flash_write_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "POST /api/flash (%d bytes)", req->content_len);
+    
+    esp_err_t ret = flash_store_write_begin(req->content_len);
+    if (ret == ESP_ERR_NOT_FOUND) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No audio partition");
+        return ESP_FAIL;
+    }
+    if (ret == ESP_ERR_INVALID_SIZE) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Image does not fit the audio partition");
+        return ESP_FAIL;
+    }
+    if (ret == ESP_ERR_INVALID_STATE) {
+        // Tracks playing from /flash and one-shots loaded from it hold it open
+        cJSON *response = cJSON_CreateObject();
+        cJSON_AddBoolToObject(response, "success", false);
+        cJSON_AddStringToObject(response, "error", "Flash files in use, stop the loops playing from " FLASH_STORE_MOUNT " and unload its one-shots");
+        ret = send_json_response(req, response);
+        cJSON_Delete(response);
+        return ret;
+    }
+    if (ret != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to start flash write");
+        return ESP_FAIL;
+    }
+    
+    char *chunk_buf = heap_tracker_malloc(UPLOAD_CHUNK_SIZE, MALLOC_CAP_SPIRAM);
+    if (!chunk_buf) {
+        flash_store_write_end(false);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to allocate buffer");
+        return ESP_FAIL;
+    }
+    
+    size_t remaining = req->content_len;
+    while (remaining > 0) {
+        size_t to_read = (remaining < UPLOAD_CHUNK_SIZE) ? remaining : UPLOAD_CHUNK_SIZE;
+        int received = httpd_req_recv(req, chunk_buf, to_read);
+        if (received == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (received <= 0) {
+            ESP_LOGE(TAG, "Flash upload failed: error receiving data");
+            ret = ESP_FAIL;
+            break;
+        }
+        ret = flash_store_write(chunk_buf, received);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Flash write failed: %s", esp_err_to_name(ret));
+            break;
+        }
+        remaining -= received;
+    }
+    free(chunk_buf);
+    
+    if (ret != ESP_OK) {
+        flash_store_write_end(false);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Flash write failed");
+        return ESP_FAIL;
+    }
+    
+    ret = flash_store_write_end(true);
+    if (ret != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid flash image");
+        return ESP_FAIL;
+    }
+    flight_recorder_note_event(FR_EVENT_FILE_UPLOAD, -1);
+    
+    cJSON *response = cJSON_CreateObject();
+    cJSON_AddBoolToObject(response, "success", true);
+    cJSON_AddNumberToObject(response, "size", req->content_len);
+    cJSON_AddNumberToObject(response, "count", flash_store_count());
+    cJSON_AddStringToObject(response, "message", "Flash image written");
+    ret = send_json_response(req, response);
+    cJSON_Delete(response);
+    
+    return ret;
+}
+
 /**
  * @brief POST /api/system/reboot - Reboot the system
  * Body: { "delay_ms": 1000 } (optional, defaults to 1000ms)
@@ -1457,31 +2259,519 @@ static esp_err_t system_reboot_handler(httpd_req_t *req) {
                 if (delay_ms < 100) delay_ms = 100;
                 if (delay_ms > 10000) delay_ms = 10000;
             }
-            cJSON_Delete(request);
+            cJSON_Delete(request);
+        }
+    }
+    
+    // Send response before rebooting
+    cJSON *response = cJSON_CreateObject();
+    cJSON_AddBoolToObject(response, "success", true);
+    cJSON_AddStringToObject(response, "message", "System will reboot");
+    cJSON_AddNumberToObject(response, "delay_ms", delay_ms);
+    
+    esp_err_t ret = send_json_response(req, response);
+    cJSON_Delete(response);
+    
+    // Give time for response to be sent
+    vTaskDelay(pdMS_TO_TICKS(100));
+    
+    ESP_LOGI(TAG, "Rebooting system in %d ms...", delay_ms);
+    
+    // Delay before reboot
+    vTaskDelay(pdMS_TO_TICKS(delay_ms));
+    
+    // Write out anything still queued in the deferred log
+    log_buffer_flush();
+    
+    // Perform system restart
+    esp_restart();
+    
+    // This line will never be reached
+    return ret;
+}
+
+/**
+ * @brief GET /api/recorder - Flight recorder summary
+ */
+static esp_err_t recorder_summary_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "GET /api/recorder");
+
+    uint32_t triggers, captures;
+    flight_recorder_get_counts(&triggers, &captures);
+
+    cJSON *response = cJSON_CreateObject();
+    cJSON_AddBoolToObject(response, "success", true);
+    cJSON_AddNumberToObject(response, "sample_ms", FLIGHT_RECORDER_SAMPLE_MS);
+    cJSON_AddNumberToObject(response, "history_ms", FLIGHT_RECORDER_HISTORY_MS);
+    cJSON_AddNumberToObject(response, "triggers", triggers);
+    cJSON_AddNumberToObject(response, "captures", captures);
+
+    cJSON *slots = cJSON_CreateArray();
+    for (int i = 0; i < FLIGHT_RECORDER_SLOTS; i++) {
+        const flight_recorder_slot_t *slot = flight_recorder_slot_acquire(i);
+        if (slot == NULL) {
+            break;
+        }
+        if (slot->valid) {
+            cJSON *item = cJSON_CreateObject();
+            cJSON_AddNumberToObject(item, "slot", i);
+            cJSON_AddNumberToObject(item, "seq", slot->seq);
+            cJSON_AddStringToObject(item, "trigger", flight_recorder_trigger_name(slot->trigger));
+            cJSON_AddNumberToObject(item, "track", slot->trigger_track);
+            cJSON_AddNumberToObject(item, "uptime_ms", (double)(slot->trigger_time_us / 1000));
+            cJSON_AddNumberToObject(item, "samples", slot->n_samples);
+            cJSON_AddItemToArray(slots, item);
+        }
+        flight_recorder_slot_release();
+    }
+    cJSON_AddItemToObject(response, "slots", slots);
+
+    esp_err_t ret = send_json_response(req, response);
+    cJSON_Delete(response);
+    return ret;
+}
+
+/**
+ * @brief GET /api/recorder/slot?slot=N - Full dump of one capture
+ *
+ * A slot holds a few hundred samples, far too much for a cJSON tree, so the
+ * response is written in chunks from a copy of the slot. The copy lets the
+ * recorder commit its next capture while a slow client reads.
+ */
+static esp_err_t recorder_slot_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "GET /api/recorder/slot");
+
+    char query_str[32] = {0};
+    char param_buf[8] = {0};
+    int index = -1;
+    if (httpd_req_get_url_query_str(req, query_str, sizeof(query_str)) == ESP_OK &&
+        httpd_query_key_value(query_str, "slot", param_buf, sizeof(param_buf)) == ESP_OK) {
+        index = atoi(param_buf);
+    }
+    if (index < 0 || index >= FLIGHT_RECORDER_SLOTS) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid slot");
+        return ESP_FAIL;
+    }
+
+    flight_recorder_slot_t *slot = heap_tracker_malloc(sizeof(flight_recorder_slot_t), MALLOC_CAP_SPIRAM);
+    if (!slot) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to allocate buffer");
+        return ESP_FAIL;
+    }
+    if (flight_recorder_slot_copy(index, slot) != ESP_OK) {
+        free(slot);
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Slot is empty");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    char buf[256];
+    esp_err_t ret;
+    int64_t t0 = slot->trigger_time_us;
+
+    snprintf(buf, sizeof(buf),
+             "{\"success\":true,\"slot\":%d,\"seq\":%lu,\"trigger\":\"%s\",\"track\":%d,"
+             "\"uptime_ms\":%lld,\"sample_ms\":%d,\"trigger_sample\":%d,",
+             index, (unsigned long)slot->seq, flight_recorder_trigger_name(slot->trigger),
+             slot->trigger_track, (long long)(t0 / 1000), FLIGHT_RECORDER_SAMPLE_MS,
+             slot->trigger_sample);
+    ret = httpd_resp_sendstr_chunk(req, buf);
+
+    snprintf(buf, sizeof(buf), "\"tasks\":{\"window_us\":%lu,\"total\":%lu,\"list\":[",
+             (unsigned long)slot->task_window_us, (unsigned long)slot->total_runtime_delta);
+    if (ret == ESP_OK) ret = httpd_resp_sendstr_chunk(req, buf);
+    for (int i = 0; i < slot->n_tasks && ret == ESP_OK; i++) {
+        const flight_recorder_task_t *t = &slot->tasks[i];
+        // Total is wall time, so this is the share of the core the task runs on
+        float pct = slot->total_runtime_delta ?
+                    (100.0f * t->runtime_delta) / slot->total_runtime_delta : 0.0f;
+        snprintf(buf, sizeof(buf),
+                 "%s{\"name\":\"%s\",\"runtime\":%lu,\"cpu_percent\":%.1f,\"stack_free\":%lu,\"prio\":%u,\"core\":%d}",
+                 i ? "," : "", t->name, (unsigned long)t->runtime_delta, pct,
+                 (unsigned long)t->stack_hwm, t->priority, t->core);
+        ret = httpd_resp_sendstr_chunk(req, buf);
+    }
+
+    if (ret == ESP_OK) ret = httpd_resp_sendstr_chunk(req, "]},\"events\":[");
+    for (int i = 0; i < slot->n_events && ret == ESP_OK; i++) {
+        const flight_recorder_event_t *ev = &slot->events[i];
+        snprintf(buf, sizeof(buf), "%s{\"t_ms\":%lld,\"type\":\"%s\",\"track\":%d}",
+                 i ? "," : "", (long long)((ev->time_us - t0) / 1000),
+                 flight_recorder_event_name(ev->type), ev->track);
+        ret = httpd_resp_sendstr_chunk(req, buf);
+    }
+
+    // Samples as rows, t_ms is relative to the trigger
+    if (ret == ESP_OK) {
+        ret = httpd_resp_sendstr_chunk(req, "],\"columns\":[\"t_ms\",\"playing\",\"i2s_fill\"");
+    }
+    for (int i = 0; i < MAX_TRACKS && ret == ESP_OK; i++) {
+        snprintf(buf, sizeof(buf), ",\"mixer_fill_%d\",\"reader_fill_%d\",\"sd_stall_ms_%d\"", i, i, i);
+        ret = httpd_resp_sendstr_chunk(req, buf);
+    }
+    if (ret == ESP_OK) {
+        ret = httpd_resp_sendstr_chunk(req, ",\"dma_free\",\"dma_largest\",\"internal_free\",\"spiram_free\"],\"samples\":[");
+    }
+    for (int i = 0; i < slot->n_samples && ret == ESP_OK; i++) {
+        const flight_recorder_sample_t *s = &slot->samples[i];
+        int len = snprintf(buf, sizeof(buf), "%s[%lld,%u,%u", i ? "," : "",
+                           (long long)((s->time_us - t0) / 1000), s->playing_mask, s->i2s_fill);
+        for (int t = 0; t < MAX_TRACKS; t++) {
+            len += snprintf(buf + len, sizeof(buf) - len, ",%u,%u,%u",
+                            s->mixer_fill[t], s->reader_fill[t], s->sd_stall_ms[t]);
+        }
+        snprintf(buf + len, sizeof(buf) - len, ",%lu,%lu,%lu,%lu]",
+                 (unsigned long)s->dma_free, (unsigned long)s->dma_largest,
+                 (unsigned long)s->internal_free, (unsigned long)s->spiram_free);
+        ret = httpd_resp_sendstr_chunk(req, buf);
+    }
+    free(slot);
+
+    if (ret == ESP_OK) ret = httpd_resp_sendstr_chunk(req, "]}");
+    if (ret == ESP_OK) ret = httpd_resp_sendstr_chunk(req, NULL);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Recorder slot %d dump aborted: %s", index, esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+/**
+ * @brief POST /api/recorder/trigger - Capture the current history on demand
+ */
+static esp_err_t recorder_trigger_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "POST /api/recorder/trigger");
+
+    flight_recorder_trigger(FR_TRIGGER_MANUAL, -1);
+
+    cJSON *response = cJSON_CreateObject();
+    cJSON_AddBoolToObject(response, "success", true);
+    cJSON_AddStringToObject(response, "message", "Capture requested");
+
+    esp_err_t ret = send_json_response(req, response);
+    cJSON_Delete(response);
+    return ret;
+}
+
+/**
+ * @brief POST /api/recorder/clear - Discard all captures
+ */
+static esp_err_t recorder_clear_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "POST /api/recorder/clear");
+
+    flight_recorder_clear();
+
+    cJSON *response = cJSON_CreateObject();
+    cJSON_AddBoolToObject(response, "success", true);
+    cJSON_AddStringToObject(response, "message", "Recorder slots cleared");
+
+    esp_err_t ret = send_json_response(req, response);
+    cJSON_Delete(response);
+    return ret;
+}
+
+static const char *task_state_name(eTaskState state) {
+    switch (state) {
+        case eRunning:   return "running";
+        case eReady:     return "ready";
+        case eBlocked:   return "blocked";
+        case eSuspended: return "suspended";
+        case eDeleted:   return "deleted";
+        default:         return "invalid";
+    }
+}
+
+/**
+ * @brief GET /api/perf/tasks - Per task CPU and stack profile
+ */
+static esp_err_t perf_tasks_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "GET /api/perf/tasks");
+
+    task_profiler_entry_t *tasks = heap_tracker_malloc(TASK_PROFILER_MAX_TASKS * sizeof(task_profiler_entry_t),
+                                                    MALLOC_CAP_SPIRAM);
+    if (!tasks) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to allocate buffer");
+        return ESP_FAIL;
+    }
+    task_profiler_core_t cores[portNUM_PROCESSORS];
+    uint32_t window_ms = 0;
+    int count = task_profiler_get(tasks, TASK_PROFILER_MAX_TASKS, cores, &window_ms);
+
+    cJSON *response = cJSON_CreateObject();
+    if (count == 0) {
+        cJSON_AddBoolToObject(response, "success", false);
+        cJSON_AddStringToObject(response, "error", "Profiler has no data yet");
+        esp_err_t ret = send_json_response(req, response);
+        cJSON_Delete(response);
+        free(tasks);
+        return ret;
+    }
+
+    cJSON_AddBoolToObject(response, "success", true);
+    cJSON_AddNumberToObject(response, "period_ms", TASK_PROFILER_PERIOD_MS);
+    cJSON_AddNumberToObject(response, "window_ms", window_ms);
+
+    cJSON *cores_json = cJSON_CreateArray();
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        cJSON *core = cJSON_CreateObject();
+        cJSON_AddNumberToObject(core, "core", c);
+        cJSON_AddNumberToObject(core, "load_percent", cores[c].load_last);
+        cJSON_AddNumberToObject(core, "load_window_percent", cores[c].load_window);
+        cJSON_AddItemToArray(cores_json, core);
+    }
+    cJSON_AddItemToObject(response, "cores", cores_json);
+
+    int warnings = 0;
+    cJSON *tasks_json = cJSON_CreateArray();
+    for (int i = 0; i < count; i++) {
+        const task_profiler_entry_t *t = &tasks[i];
+        cJSON *task = cJSON_CreateObject();
+        cJSON_AddStringToObject(task, "name", t->name);
+        cJSON_AddNumberToObject(task, "core", t->core);
+        cJSON_AddNumberToObject(task, "priority", t->priority);
+        cJSON_AddStringToObject(task, "state", task_state_name(t->state));
+        cJSON_AddNumberToObject(task, "cpu_percent", t->cpu_last);
+        cJSON_AddNumberToObject(task, "cpu_window_percent", t->cpu_window);
+        cJSON_AddNumberToObject(task, "cpu_peak_percent", t->cpu_peak);
+        cJSON_AddNumberToObject(task, "stack_free", t->stack_hwm);
+        cJSON_AddBoolToObject(task, "audio_path", t->audio_path);
+
+        cJSON *flags = cJSON_CreateArray();
+        if (t->flags & TASK_PROFILER_FLAG_CORE_SATURATED) {
+            cJSON_AddItemToArray(flags, cJSON_CreateString("core_saturated"));
+        }
+        if (t->flags & TASK_PROFILER_FLAG_STACK_LOW) {
+            cJSON_AddItemToArray(flags, cJSON_CreateString("stack_low"));
+        }
+        if (t->flags) {
+            warnings++;
+        }
+        cJSON_AddItemToObject(task, "warnings", flags);
+        cJSON_AddItemToArray(tasks_json, task);
+    }
+    cJSON_AddItemToObject(response, "tasks", tasks_json);
+    cJSON_AddNumberToObject(response, "warnings", warnings);
+    free(tasks);
+
+    esp_err_t ret = send_json_response(req, response);
+    cJSON_Delete(response);
+    return ret;
+}
+
+/**
+ * @brief GET /api/perf/heap[?last=N] - Heap history, allocation sites and failures
+ *
+ * The history can hold thousands of samples, so this is written in chunks.
+ */
+static esp_err_t perf_heap_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "GET /api/perf/heap");
+
+    int last = HEAP_TRACKER_HISTORY_LEN;
+    char query_str[32] = {0};
+    char param_buf[8] = {0};
+    if (httpd_req_get_url_query_str(req, query_str, sizeof(query_str)) == ESP_OK &&
+        httpd_query_key_value(query_str, "last", param_buf, sizeof(param_buf)) == ESP_OK) {
+        last = atoi(param_buf);
+        if (last < 0) last = 0;
+        if (last > HEAP_TRACKER_HISTORY_LEN) last = HEAP_TRACKER_HISTORY_LEN;
+    }
+
+    heap_tracker_sample_t *samples = heap_tracker_malloc((last ? last : 1) * sizeof(heap_tracker_sample_t),
+                                                         MALLOC_CAP_SPIRAM);
+    heap_tracker_site_t *sites = heap_tracker_malloc(HEAP_TRACKER_MAX_SITES * sizeof(heap_tracker_site_t),
+                                                     MALLOC_CAP_SPIRAM);
+    if (!samples || !sites) {
+        free(samples);
+        free(sites);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to allocate buffer");
+        return ESP_FAIL;
+    }
+    heap_tracker_failure_t failures[HEAP_TRACKER_MAX_FAILURES];
+    int n_samples = heap_tracker_get_samples(samples, last);
+    int n_sites = heap_tracker_get_sites(sites, HEAP_TRACKER_MAX_SITES);
+    int n_failures = heap_tracker_get_failures(failures, HEAP_TRACKER_MAX_FAILURES);
+
+    bool alert_active;
+    uint32_t alert_count, min_dma_largest;
+    heap_tracker_get_alert(&alert_active, &alert_count, &min_dma_largest);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    char buf[256];
+    esp_err_t ret;
+    snprintf(buf, sizeof(buf),
+             "{\"success\":true,\"period_s\":%d,\"dma_need\":%d,\"dma_low\":%s,"
+             "\"dma_low_alerts\":%lu,\"dma_largest_min\":%lu,\"sites\":[",
+             HEAP_TRACKER_PERIOD_S, HEAP_TRACKER_DMA_NEED_BYTES, alert_active ? "true" : "false",
+             (unsigned long)alert_count, (unsigned long)min_dma_largest);
+    ret = httpd_resp_sendstr_chunk(req, buf);
+
+    for (int i = 0; i < n_sites && ret == ESP_OK; i++) {
+        const heap_tracker_site_t *site = &sites[i];
+        const char *file = strrchr(site->file, '/');
+        snprintf(buf, sizeof(buf),
+                 "%s{\"site\":\"%s:%d\",\"caps\":%lu,\"count\":%lu,\"failures\":%lu,"
+                 "\"largest\":%lu,\"total_bytes\":%llu}",
+                 i ? "," : "", file ? file + 1 : site->file, site->line, (unsigned long)site->caps,
+                 (unsigned long)site->count, (unsigned long)site->failures,
+                 (unsigned long)site->largest, (unsigned long long)site->total_bytes);
+        ret = httpd_resp_sendstr_chunk(req, buf);
+    }
+
+    if (ret == ESP_OK) ret = httpd_resp_sendstr_chunk(req, "],\"failures\":[");
+    for (int i = 0; i < n_failures && ret == ESP_OK; i++) {
+        const heap_tracker_failure_t *f = &failures[i];
+        const char *file = strrchr(f->file, '/');
+        snprintf(buf, sizeof(buf),
+                 "%s{\"uptime_s\":%lu,\"site\":\"%s:%d\",\"size\":%lu,\"caps\":%lu,"
+                 "\"free\":%lu,\"largest\":%lu}",
+                 i ? "," : "", (unsigned long)f->uptime_s, file ? file + 1 : f->file, f->line,
+                 (unsigned long)f->size, (unsigned long)f->caps,
+                 (unsigned long)f->free_at_failure, (unsigned long)f->largest_at_failure);
+        ret = httpd_resp_sendstr_chunk(req, buf);
+    }
+
+    if (ret == ESP_OK) {
+        ret = httpd_resp_sendstr_chunk(req, "],\"columns\":[\"uptime_s\"");
+    }
+    for (int h = 0; h < HEAP_TRACKER_NUM_HEAPS && ret == ESP_OK; h++) {
+        snprintf(buf, sizeof(buf), ",\"%s_free\",\"%s_largest\"",
+                 heap_tracker_heap_name(h), heap_tracker_heap_name(h));
+        ret = httpd_resp_sendstr_chunk(req, buf);
+    }
+    if (ret == ESP_OK) ret = httpd_resp_sendstr_chunk(req, "],\"samples\":[");
+    for (int i = 0; i < n_samples && ret == ESP_OK; i++) {
+        const heap_tracker_sample_t *s = &samples[i];
+        int len = snprintf(buf, sizeof(buf), "%s[%lu", i ? "," : "", (unsigned long)s->uptime_s);
+        for (int h = 0; h < HEAP_TRACKER_NUM_HEAPS; h++) {
+            len += snprintf(buf + len, sizeof(buf) - len, ",%lu,%lu",
+                            (unsigned long)s->free[h], (unsigned long)s->largest[h]);
+        }
+        snprintf(buf + len, sizeof(buf) - len, "]");
+        ret = httpd_resp_sendstr_chunk(req, buf);
+    }
+    free(samples);
+    free(sites);
+
+    if (ret == ESP_OK) ret = httpd_resp_sendstr_chunk(req, "]}");
+    if (ret == ESP_OK) ret = httpd_resp_sendstr_chunk(req, NULL);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Heap history dump aborted: %s", esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+static esp_err_t metrics_emit_chunk(void *ctx, const char *buf, size_t len) {
+    return httpd_resp_send_chunk((httpd_req_t *)ctx, buf, len);
+}
+
+/**
+ * @brief GET /metrics - Prometheus text format metrics
+ */
+static esp_err_t metrics_get_handler(httpd_req_t *req) {
+    // Scraped every few seconds, keep it out of the normal log
+    ESP_LOGD(TAG, "GET /metrics");
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    esp_err_t ret = metrics_render(metrics_emit_chunk, req);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Metrics render aborted: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/**
+ * @brief GET /api/logs - Recent log text, polled with a position cursor
+ */
+static esp_err_t logs_get_handler(httpd_req_t *req) {
+    // Polled continuously by followers, keep it out of the log it serves
+    ESP_LOGD(TAG, "GET /api/logs");
+
+    uint32_t since = 0;
+    char query_str[32] = {0};
+    char param_buf[12] = {0};
+    if (httpd_req_get_url_query_str(req, query_str, sizeof(query_str)) == ESP_OK &&
+        httpd_query_key_value(query_str, "since", param_buf, sizeof(param_buf)) == ESP_OK) {
+        since = strtoul(param_buf, NULL, 10);
+    }
+
+    char *text = heap_tracker_malloc(LOG_BUFFER_TEXT_BYTES, MALLOC_CAP_SPIRAM);
+    if (!text) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to allocate buffer");
+        return ESP_FAIL;
+    }
+    uint32_t next = since;
+    size_t len = log_buffer_read(since, text, LOG_BUFFER_TEXT_BYTES, &next);
+
+    log_buffer_stats_t stats;
+    log_buffer_get_stats(&stats);
+    char next_str[12];
+    char lost_str[12];
+    snprintf(next_str, sizeof(next_str), "%lu", (unsigned long)next);
+    snprintf(lost_str, sizeof(lost_str), "%lu", (unsigned long)(stats.dropped + stats.rate_limited));
+
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Access-Control-Expose-Headers", "X-Log-Next, X-Log-Lost");
+    httpd_resp_set_hdr(req, "X-Log-Next", next_str);
+    httpd_resp_set_hdr(req, "X-Log-Lost", lost_str);
+    esp_err_t ret = httpd_resp_send(req, text, len);
+    free(text);
+    return ret;
+}
+
+/**
+ * @brief POST /api/logs/level - Change the runtime log level of a tag
+ */
+static esp_err_t logs_level_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "POST /api/logs/level");
+
+    static const struct {
+        const char *name;
+        esp_log_level_t level;
+    } levels[] = {
+        {"none", ESP_LOG_NONE}, {"error", ESP_LOG_ERROR}, {"warn", ESP_LOG_WARN},
+        {"info", ESP_LOG_INFO}, {"debug", ESP_LOG_DEBUG}, {"verbose", ESP_LOG_VERBOSE},
+    };
+
+    cJSON *request = parse_json_request(req);
+    if (!request) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+        return ESP_FAIL;
+    }
+
+    cJSON *response = cJSON_CreateObject();
+    cJSON *tag_json = cJSON_GetObjectItem(request, "tag");
+    cJSON *level_json = cJSON_GetObjectItem(request, "level");
+    const char *tag = cJSON_IsString(tag_json) ? tag_json->valuestring : "*";
+    int found = -1;
+    if (cJSON_IsString(level_json)) {
+        for (int i = 0; i < (int)(sizeof(levels) / sizeof(levels[0])); i++) {
+            if (strcmp(level_json->valuestring, levels[i].name) == 0) {
+                found = i;
+                break;
+            }
         }
     }
-    
-    // Send response before rebooting
-    cJSON *response = cJSON_CreateObject();
-    cJSON_AddBoolToObject(response, "success", true);
-    cJSON_AddStringToObject(response, "message", "System will reboot");
-    cJSON_AddNumberToObject(response, "delay_ms", delay_ms);
-    
+
+    if (found < 0 || strlen(tag) == 0) {
+        cJSON_AddBoolToObject(response, "success", false);
+        cJSON_AddStringToObject(response, "error", "Missing or invalid tag or level");
+    } else {
+        // Levels above CONFIG_LOG_MAXIMUM_LEVEL are compiled out and stay silent
+        esp_log_level_set(tag, levels[found].level);
+        ESP_LOGI(TAG, "Log level of %s set to %s", tag, levels[found].name);
+        cJSON_AddBoolToObject(response, "success", true);
+        cJSON_AddStringToObject(response, "tag", tag);
+        cJSON_AddStringToObject(response, "level", levels[found].name);
+    }
+
     esp_err_t ret = send_json_response(req, response);
     cJSON_Delete(response);
-    
-    // Give time for response to be sent
-    vTaskDelay(pdMS_TO_TICKS(100));
-    
-    ESP_LOGI(TAG, "Rebooting system in %d ms...", delay_ms);
-    
-    // Delay before reboot
-    vTaskDelay(pdMS_TO_TICKS(delay_ms));
-    
-    // Perform system restart
-    esp_restart();
-    
-    // This line will never be reached
+    cJSON_Delete(request);
     return ret;
 }
 
@@ -1620,7 +2910,8 @@ static esp_err_t api_docs_handler(httpd_req_t *req) {
         "      \"track\": 0,\n"
         "      \"file\": \"/sdcard/track1.wav\",\n"
         "      \"volume\": 100,\n"
-        "      \"playing\": true\n"
+        "      \"playing\": true,\n"
+        "      \"playhead\": { \"sample\": 88200, \"sample_rate\": 44100, \"ms\": 2000, \"latency_ms\": 66 }\n"
         "    }\n"
         "  ],\n"
         "  \"active_count\": 1,\n"
@@ -1664,6 +2955,18 @@ static esp_err_t api_docs_handler(httpd_req_t *req) {
         "}</pre>"
         "</div>"
         
+        "<div class='endpoint'>"
+        "<span class='method method-post'>POST</span>"
+        "<span class='path'>/api/loop/seek</span>"
+        "<p class='description'>Play a track's file from a sample, exact for WAV, from the frame holding it for MP3</p>"
+        "<pre>"
+        "Request:\n"
+        "{\n"
+        "  \"track\": 0,\n"
+        "  \"sample\": 44100\n"
+        "}</pre>"
+        "</div>"
+        
         "<div class='endpoint'>"
         "<span class='method method-post'>POST</span>"
         "<span class='path'>/api/global/volume</span>"
@@ -1676,6 +2979,121 @@ static esp_err_t api_docs_handler(httpd_req_t *req) {
         "</div>"
         "</div>"
         
+        "<div class='card'>"
+        "<h2>One-Shot Endpoints</h2>"
+        
+        "<div class='endpoint'>"
+        "<span class='method method-get'>GET</span>"
+        "<span class='path'>/api/oneshot</span>"
+        "<p class='description'>Loaded slots, voices, and trigger to sound latency</p>"
+        "<pre>"
+        "Response:\n"
+        "{\n"
+        "  \"slots\": [ { \"slot\": 0, \"file\": \"/sdcard/door.wav\", \"channels\": 2, \"frames\": 88200, \"ms\": 2000, \"attack_ms\": 250 } ],\n"
+        "  \"voices\": [ { \"voice\": 0, \"active\": true, \"slot\": 0, \"ms\": 420, \"gain_db\": 0 } ],\n"
+        "  \"latency\": { \"count\": 12, \"last_us\": 8120, \"max_us\": 19710, \"mean_us\": 10240, \"block_us\": 20408, \"output_ms\": 20 },\n"
+        "  \"counts\": { \"triggers\": 12, \"steals\": 1, \"late_blocks\": 0, \"osc_packets\": 4, \"osc_dropped\": 0 }\n"
+        "}</pre>"
+        "</div>"
+        
+        "<div class='endpoint'>"
+        "<span class='method method-post'>POST</span>"
+        "<span class='path'>/api/oneshot/load</span>"
+        "<p class='description'>Load a 16 bit 44.1 kHz WAV into a slot, the first 250 ms into RAM</p>"
+        "<pre>"
+        "Request:\n"
+        "{\n"
+        "  \"slot\": 0,\n"
+        "  \"filename\": \"door.wav\"  // OR \"file_path\": \"/sdcard/door.wav\"\n"
+        "}</pre>"
+        "</div>"
+        
+        "<div class='endpoint'>"
+        "<span class='method method-post'>POST</span>"
+        "<span class='path'>/api/oneshot/unload</span>"
+        "<p class='description'>Empty a slot</p>"
+        "<pre>"
+        "Request:\n"
+        "{\n"
+        "  \"slot\": 0\n"
+        "}</pre>"
+        "</div>"
+        
+        "<div class='endpoint'>"
+        "<span class='method method-post'>POST</span>"
+        "<span class='path'>/api/oneshot/trigger</span>"
+        "<p class='description'>Play a slot now, over the loops. Also OSC /oneshot/trigger on UDP port 9000</p>"
+        "<pre>"
+        "Request:\n"
+        "{\n"
+        "  \"slot\": 0,\n"
+        "  \"gain_db\": -6  // optional\n"
+        "}</pre>"
+        "</div>"
+        
+        "<div class='endpoint'>"
+        "<span class='method method-post'>POST</span>"
+        "<span class='path'>/api/oneshot/stop</span>"
+        "<p class='description'>Fade out every one-shot voice</p>"
+        "</div>"
+        "</div>"
+        
+        "<div class='card'>"
+        "<h2>Speaker Correction and Spectrum Endpoints</h2>"
+        
+        "<div class='endpoint'>"
+        "<span class='method method-get'>GET</span>"
+        "<span class='path'>/api/correction</span>"
+        "<p class='description'>The correction filter on the output, and its CPU cost in thousandths of a core</p>"
+        "<pre>"
+        "Response:\n"
+        "{\n"
+        "  \"loaded\": true,\n"
+        "  \"file\": \"/sdcard/correction.wav\",\n"
+        "  \"taps\": 1024,\n"
+        "  \"partitions\": 4,\n"
+        "  \"latency_us\": 5804,\n"
+        "  \"cpu_permille\": 61,\n"
+        "  \"max_block_us\": 1630,\n"
+        "  \"fft\": \"esp-dsp\"\n"
+        "}</pre>"
+        "</div>"
+        
+        "<div class='endpoint'>"
+        "<span class='method method-post'>POST</span>"
+        "<span class='path'>/api/correction/load</span>"
+        "<p class='description'>Correct the output with the FIR in a 44.1 kHz WAV, up to 2048 taps. /sdcard/correction.wav loads at boot</p>"
+        "<pre>"
+        "Request:\n"
+        "{\n"
+        "  \"filename\": \"correction.wav\"  // OR \"file_path\": \"/sdcard/correction.wav\"\n"
+        "}</pre>"
+        "</div>"
+        
+        "<div class='endpoint'>"
+        "<span class='method method-post'>POST</span>"
+        "<span class='path'>/api/correction/clear</span>"
+        "<p class='description'>Play without correction until the next load or boot</p>"
+        "</div>"
+        
+        "<div class='endpoint'>"
+        "<span class='method method-get'>GET</span>"
+        "<span class='path'>/api/spectrum</span>"
+        "<p class='description'>The output's spectrum, 4 times a second: 256 bins of 86 Hz and 1/3 octaves from 250 Hz, in dBFS. Runs while polled; the first poll after 5 s without one gets ready: false</p>"
+        "<pre>"
+        "Response:\n"
+        "{\n"
+        "  \"ready\": true,\n"
+        "  \"update_ms\": 250,\n"
+        "  \"age_ms\": 112,\n"
+        "  \"blocks\": 8,\n"
+        "  \"bin_hz\": 86.13,\n"
+        "  \"bins_dbfs\": [-71.2, -48.5, -40.3, ...],\n"
+        "  \"bands\": [{\"hz\": 250, \"dbfs\": -38.6}, ...]\n"
+        "}</pre>"
+        "</div>"
+        "</div>"
+        
         "<div class='card'>"
         "<h2>System Status Endpoints</h2>"
         
@@ -1820,6 +3238,23 @@ static esp_err_t api_docs_handler(httpd_req_t *req) {
         "  \"message\": \"File deleted successfully\"\n"
         "}</pre>"
         "</div>"
+        
+        "<div class='endpoint'>"
+        "<span class='method method-post'>POST</span>"
+        "<span class='path'>/api/flash</span>"
+        "<p class='description'>Replace the loops in the flash audio partition with an image from flash_pack.py. "
+        "Stop loops playing from /flash first.</p>"
+        "<pre>"
+        "curl -X POST \"http://&lt;device-ip&gt;/api/flash\" \\\n"
+        "     -H \"Content-Type: application/octet-stream\" \\\n"
+        "     --data-binary @audio.bin\n"
+        "\n"
+        "Response:\n"
+        "{\n"
+        "  \"success\": true,\n"
+        "  \"count\": 2\n"
+        "}</pre>"
+        "</div>"
         "</div>"
         
         "</div>"
@@ -2556,7 +3991,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = HTTP_SERVER_PORT;
     config.stack_size = 8192;
-    config.max_uri_handlers = 27;  // Increased to handle all handlers including reboot endpoint
+    config.max_uri_handlers = 48;  // Increased to handle all handlers including diagnostics endpoints
     config.recv_wait_timeout = 10;
     config.send_wait_timeout = 10;
     
@@ -2576,7 +4011,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = root_get_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &root_uri);
+    ret = register_timed_handler(server, &root_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /: %s", esp_err_to_name(ret));
     }
@@ -2587,7 +4022,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = settings_get_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &settings_uri);
+    ret = register_timed_handler(server, &settings_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /settings: %s", esp_err_to_name(ret));
     }
@@ -2598,7 +4033,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = favicon_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &favicon_uri);
+    ret = register_timed_handler(server, &favicon_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /favicon.ico: %s", esp_err_to_name(ret));
     }
@@ -2609,7 +4044,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = api_docs_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &api_docs_uri);
+    ret = register_timed_handler(server, &api_docs_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api-docs: %s", esp_err_to_name(ret));
     }
@@ -2620,7 +4055,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = files_get_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &files_uri);
+    ret = register_timed_handler(server, &files_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/files: %s", esp_err_to_name(ret));
     }
@@ -2631,7 +4066,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = loops_get_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &loops_uri);
+    ret = register_timed_handler(server, &loops_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/loops: %s", esp_err_to_name(ret));
     }
@@ -2642,7 +4077,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = loop_file_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &file_uri);
+    ret = register_timed_handler(server, &file_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/loop/file: %s", esp_err_to_name(ret));
     }
@@ -2653,7 +4088,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = loop_start_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &start_uri);
+    ret = register_timed_handler(server, &start_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/loop/start: %s", esp_err_to_name(ret));
     }
@@ -2664,7 +4099,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = loop_stop_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &stop_uri);
+    ret = register_timed_handler(server, &stop_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/loop/stop: %s", esp_err_to_name(ret));
     }
@@ -2675,18 +4110,128 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = loop_volume_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &volume_uri);
+    ret = register_timed_handler(server, &volume_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/loop/volume: %s", esp_err_to_name(ret));
     }
     
+    httpd_uri_t seek_uri = {
+        .uri = "/api/loop/seek",
+        .method = HTTP_POST,
+        .handler = loop_seek_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &seek_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/loop/seek: %s", esp_err_to_name(ret));
+    }
+
+    httpd_uri_t oneshot_uri = {
+        .uri = "/api/oneshot",
+        .method = HTTP_GET,
+        .handler = oneshot_get_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &oneshot_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/oneshot: %s", esp_err_to_name(ret));
+    }
+
+    httpd_uri_t oneshot_load_uri = {
+        .uri = "/api/oneshot/load",
+        .method = HTTP_POST,
+        .handler = oneshot_load_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &oneshot_load_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/oneshot/load: %s", esp_err_to_name(ret));
+    }
+
+    httpd_uri_t oneshot_unload_uri = {
+        .uri = "/api/oneshot/unload",
+        .method = HTTP_POST,
+        .handler = oneshot_unload_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &oneshot_unload_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/oneshot/unload: %s", esp_err_to_name(ret));
+    }
+
+    httpd_uri_t oneshot_trigger_uri = {
+        .uri = "/api/oneshot/trigger",
+        .method = HTTP_POST,
+        .handler = oneshot_trigger_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &oneshot_trigger_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/oneshot/trigger: %s", esp_err_to_name(ret));
+    }
+
+    httpd_uri_t oneshot_stop_uri = {
+        .uri = "/api/oneshot/stop",
+        .method = HTTP_POST,
+        .handler = oneshot_stop_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &oneshot_stop_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/oneshot/stop: %s", esp_err_to_name(ret));
+    }
+
+    httpd_uri_t correction_get_uri = {
+        .uri = "/api/correction",
+        .method = HTTP_GET,
+        .handler = correction_get_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &correction_get_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/correction: %s", esp_err_to_name(ret));
+    }
+
+    httpd_uri_t correction_load_uri = {
+        .uri = "/api/correction/load",
+        .method = HTTP_POST,
+        .handler = correction_load_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &correction_load_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/correction/load: %s", esp_err_to_name(ret));
+    }
+
+    httpd_uri_t correction_clear_uri = {
+        .uri = "/api/correction/clear",
+        .method = HTTP_POST,
+        .handler = correction_clear_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &correction_clear_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/correction/clear: %s", esp_err_to_name(ret));
+    }
+
+    httpd_uri_t spectrum_get_uri = {
+        .uri = "/api/spectrum",
+        .method = HTTP_GET,
+        .handler = spectrum_get_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &spectrum_get_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/spectrum: %s", esp_err_to_name(ret));
+    }
+    
     httpd_uri_t global_volume_uri = {
         .uri = "/api/global/volume",
         .method = HTTP_POST,
         .handler = global_volume_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &global_volume_uri);
+    ret = register_timed_handler(server, &global_volume_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/global/volume: %s", esp_err_to_name(ret));
     }
@@ -2698,7 +4243,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = wifi_status_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &wifi_status_uri);
+    ret = register_timed_handler(server, &wifi_status_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/wifi/status: %s", esp_err_to_name(ret));
     }
@@ -2709,7 +4254,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = wifi_networks_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &wifi_networks_uri);
+    ret = register_timed_handler(server, &wifi_networks_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/wifi/networks: %s", esp_err_to_name(ret));
     }
@@ -2720,7 +4265,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = wifi_add_network_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &wifi_add_uri);
+    ret = register_timed_handler(server, &wifi_add_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/wifi/add: %s", esp_err_to_name(ret));
     }
@@ -2731,7 +4276,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = wifi_remove_network_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &wifi_remove_uri);
+    ret = register_timed_handler(server, &wifi_remove_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/wifi/remove: %s", esp_err_to_name(ret));
     }
@@ -2743,7 +4288,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = config_status_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &config_status_uri);
+    ret = register_timed_handler(server, &config_status_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/config/status: %s", esp_err_to_name(ret));
     }
@@ -2754,7 +4299,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = config_save_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &config_save_uri);
+    ret = register_timed_handler(server, &config_save_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/config/save: %s", esp_err_to_name(ret));
     }
@@ -2765,7 +4310,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = config_load_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &config_load_uri);
+    ret = register_timed_handler(server, &config_load_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/config/load: %s", esp_err_to_name(ret));
     }
@@ -2776,7 +4321,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = config_delete_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &config_delete_uri);
+    ret = register_timed_handler(server, &config_delete_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/config/delete: %s", esp_err_to_name(ret));
     }
@@ -2788,7 +4333,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = unit_status_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &unit_status_uri);
+    ret = register_timed_handler(server, &unit_status_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/status: %s", esp_err_to_name(ret));
     }
@@ -2799,7 +4344,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = id_get_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &id_get_uri);
+    ret = register_timed_handler(server, &id_get_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for GET /api/id: %s", esp_err_to_name(ret));
     }
@@ -2810,7 +4355,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = id_set_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &id_set_uri);
+    ret = register_timed_handler(server, &id_set_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for POST /api/id: %s", esp_err_to_name(ret));
     }
@@ -2821,7 +4366,7 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = file_upload_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &upload_uri);
+    ret = register_timed_handler(server, &upload_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/upload: %s", esp_err_to_name(ret));
     }
@@ -2832,11 +4377,22 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = file_delete_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &file_delete_uri);
+    ret = register_timed_handler(server, &file_delete_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/file/delete: %s", esp_err_to_name(ret));
     }
     
+    httpd_uri_t flash_write_uri = {
+        .uri = "/api/flash",
+        .method = HTTP_POST,
+        .handler = flash_write_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &flash_write_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/flash: %s", esp_err_to_name(ret));
+    }
+    
     // Register system reboot endpoint
     httpd_uri_t system_reboot_uri = {
         .uri = "/api/system/reboot",
@@ -2844,11 +4400,113 @@ esp_err_t http_server_init(audio_stream_t *audio_stream, QueueHandle_t audio_con
         .handler = system_reboot_handler,
         .user_ctx = NULL
     };
-    ret = httpd_register_uri_handler(server, &system_reboot_uri);
+    ret = register_timed_handler(server, &system_reboot_uri);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register handler for /api/system/reboot: %s", esp_err_to_name(ret));
     }
     
+    // Register flight recorder endpoints
+    httpd_uri_t recorder_summary_uri = {
+        .uri = "/api/recorder",
+        .method = HTTP_GET,
+        .handler = recorder_summary_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &recorder_summary_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/recorder: %s", esp_err_to_name(ret));
+    }
+    
+    httpd_uri_t recorder_slot_uri = {
+        .uri = "/api/recorder/slot",
+        .method = HTTP_GET,
+        .handler = recorder_slot_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &recorder_slot_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/recorder/slot: %s", esp_err_to_name(ret));
+    }
+    
+    httpd_uri_t recorder_trigger_uri = {
+        .uri = "/api/recorder/trigger",
+        .method = HTTP_POST,
+        .handler = recorder_trigger_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &recorder_trigger_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/recorder/trigger: %s", esp_err_to_name(ret));
+    }
+    
+    httpd_uri_t recorder_clear_uri = {
+        .uri = "/api/recorder/clear",
+        .method = HTTP_POST,
+        .handler = recorder_clear_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &recorder_clear_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/recorder/clear: %s", esp_err_to_name(ret));
+    }
+    
+    // Register Prometheus metrics endpoint
+    httpd_uri_t metrics_uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_get_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &metrics_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /metrics: %s", esp_err_to_name(ret));
+    }
+    
+    httpd_uri_t perf_tasks_uri = {
+        .uri = "/api/perf/tasks",
+        .method = HTTP_GET,
+        .handler = perf_tasks_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &perf_tasks_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/perf/tasks: %s", esp_err_to_name(ret));
+    }
+    
+    httpd_uri_t perf_heap_uri = {
+        .uri = "/api/perf/heap",
+        .method = HTTP_GET,
+        .handler = perf_heap_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &perf_heap_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/perf/heap: %s", esp_err_to_name(ret));
+    }
+    
+    // Deferred log stream
+    httpd_uri_t logs_uri = {
+        .uri = "/api/logs",
+        .method = HTTP_GET,
+        .handler = logs_get_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &logs_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/logs: %s", esp_err_to_name(ret));
+    }
+    
+    httpd_uri_t logs_level_uri = {
+        .uri = "/api/logs/level",
+        .method = HTTP_POST,
+        .handler = logs_level_handler,
+        .user_ctx = NULL
+    };
+    ret = register_timed_handler(server, &logs_level_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler for /api/logs/level: %s", esp_err_to_name(ret));
+    }
+    
     // Initialize unit status manager
     unit_status_init();
     
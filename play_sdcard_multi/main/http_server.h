@@ -3,6 +3,7 @@
 
 #include "esp_err.h"
 #include "play_sdcard.h"
+#include "cJSON.h"
 
 // HTTP Server configuration
 #define HTTP_SERVER_PORT 80
@@ -19,6 +20,7 @@ typedef struct {
     char file_path[MAX_FILE_PATH_LEN];
     int volume_percent;  // 0-100%
     int track_index;
+    float normalize_gain_db;  // from the file's upload analysis, added to the volume
 } loop_status_t;
 
 // Global loop manager structure
@@ -61,4 +63,11 @@ esp_err_t http_server_get_loop_status(loop_manager_t *manager);
  */
 esp_err_t http_server_set_loop_manager(loop_manager_t *manager);
 
+/**
+ * @brief Build the GET /api/loops document from the loop manager
+ * 
+ * @return The document, for the caller to cJSON_Delete()
+ */
+cJSON *http_server_loops_json(void);
+
 #endif // HTTP_SERVER_H
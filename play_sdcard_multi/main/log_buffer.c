@@ -0,0 +1,659 @@
+/* Deferred, rate limited logging.
+
+   esp_log formats and writes to the UART from the calling task, and at
+   115200 baud a few lines can block an audio or control task for
+   milliseconds. The hook installed here only copies the format pointer and
+   the raw arguments into a lock-free multi-producer ring in PSRAM. A low
+   priority task formats the records later and writes them to the console
+   and to a text ring served by GET /api/logs.
+
+   Formats are kept by pointer, which is fine for ESP_LOGx since they are
+   literals in flash; a format built at run time would be read after it is
+   gone, see log_buffer_init(). %s arguments are copied into the record, no
+   more of each than its precision asks for. Only loads
+   and stores touch the PSRAM ring; the compare-and-swap is on an internal
+   RAM index since the ESP32 can't do atomic read-modify-write on PSRAM.
+*/
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "heap_tracker.h"
+#include "log_buffer.h"
+
+static const char *TAG = "LOG_BUFFER";
+
+typedef enum {
+    ARG_NONE = 0,                   // unsupported conversion, stop here
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_SIZE,
+    ARG_DOUBLE,
+    ARG_PTR,
+    ARG_STR,
+} arg_kind_t;
+
+typedef struct {
+    atomic_uint seq;                // slot sequence, see ring_push / drain
+    const char *fmt;
+    uint8_t n_args;
+    bool truncated;
+    uint16_t str_used;
+    uint64_t args[LOG_BUFFER_MAX_ARGS];
+    char strings[LOG_BUFFER_STR_BYTES];     // last byte is always 0
+} log_record_t;
+
+typedef struct {
+    uint32_t hash;
+    char tag[16];
+    int32_t tokens;                 // thousandths of a line
+    int64_t last_us;
+    uint32_t suppressed;            // since last reported
+} tag_limit_t;
+
+static log_record_t *s_ring = NULL;
+static atomic_uint s_enqueue_pos;
+static atomic_uint s_dequeue_pos;
+static SemaphoreHandle_t s_drain_mutex = NULL;
+static vprintf_like_t s_console = NULL;
+
+static atomic_uint s_queued;
+static atomic_uint s_dropped;
+static atomic_uint s_rate_limited;
+static atomic_uint s_truncated;
+static atomic_uint s_high_water;
+static uint32_t s_dropped_reported = 0;
+
+static portMUX_TYPE s_tag_lock = portMUX_INITIALIZER_UNLOCKED;
+static tag_limit_t s_tags[LOG_BUFFER_MAX_TAGS];
+static int s_tag_count = 0;
+
+static char *s_text = NULL;
+static uint32_t s_text_written = 0;         // bytes appended since boot
+static SemaphoreHandle_t s_text_mutex = NULL;
+
+// Precision of a spec that has none, and of one given by a '*' argument
+#define PREC_NONE   (-1)
+#define PREC_STAR   (-2)
+
+/* Parses one conversion spec, p points just past the '%'. Returns the end
+   of the spec; *stars is the number of '*' width/precision arguments, and
+   *precision the precision, PREC_STAR for the last of those. Both the
+   capture and the formatting side walk the format with this so they always
+   agree on the argument list. */
+static const char *parse_spec(const char *p, arg_kind_t *kind, int *stars, int *precision) {
+    *stars = 0;
+    *precision = PREC_NONE;
+    while (*p && strchr("-+ #0", *p)) p++;
+    if (*p == '*') {
+        (*stars)++;
+        p++;
+    } else {
+        while (*p >= '0' && *p <= '9') p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            (*stars)++;
+            *precision = PREC_STAR;
+            p++;
+        } else {
+            *precision = 0;
+            while (*p >= '0' && *p <= '9') {
+                *precision = *precision * 10 + (*p++ - '0');
+            }
+        }
+    }
+
+    int longs = 0;
+    bool size = false;
+    bool long_double = false;
+    for (;;) {
+        if (*p == 'h') {
+            p++;
+        } else if (*p == 'l') {
+            longs++;
+            p++;
+        } else if (*p == 'j') {
+            longs = 2;              // intmax_t is long long on newlib
+            p++;
+        } else if (*p == 'z' || *p == 't') {
+            size = true;
+            p++;
+        } else if (*p == 'L') {
+            long_double = true;
+            p++;
+        } else {
+            break;
+        }
+    }
+
+    switch (*p) {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+            *kind = size ? ARG_SIZE : (longs >= 2 ? ARG_LLONG : (longs == 1 ? ARG_LONG : ARG_INT));
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            *kind = long_double ? ARG_NONE : ARG_DOUBLE;
+            break;
+        case 'p': case 'n':
+            *kind = ARG_PTR;
+            break;
+        case 's':
+            *kind = ARG_STR;
+            break;
+        default:
+            *kind = ARG_NONE;
+            return p;
+    }
+    return p + 1;
+}
+
+/* Copies the arguments of one log call. The esp_log prefix is
+   "<color>I (%lu) %s: ", so the first %s is the tag. */
+static void capture(log_record_t *rec, const char *fmt, va_list ap, const char **tag) {
+    rec->fmt = fmt;
+    rec->n_args = 0;
+    rec->truncated = false;
+    rec->str_used = 0;
+    *tag = NULL;
+
+    const char *p = fmt;
+    while (*p) {
+        if (*p++ != '%') {
+            continue;
+        }
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+        arg_kind_t kind;
+        int stars, precision;
+        p = parse_spec(p, &kind, &stars, &precision);
+        if (kind == ARG_NONE) {
+            break;
+        }
+        if (rec->n_args + stars + 1 > LOG_BUFFER_MAX_ARGS) {
+            rec->truncated = true;
+            break;
+        }
+        for (int i = 0; i < stars; i++) {
+            rec->args[rec->n_args++] = (uint64_t)(int64_t)va_arg(ap, int);
+        }
+        if (precision == PREC_STAR) {
+            // A negative one counts as none
+            precision = (int)(int64_t)rec->args[rec->n_args - 1];
+        }
+
+        uint64_t v = 0;
+        switch (kind) {
+            case ARG_INT:
+                v = (uint64_t)(int64_t)va_arg(ap, int);
+                break;
+            case ARG_LONG:
+                v = (uint64_t)(int64_t)va_arg(ap, long);
+                break;
+            case ARG_LLONG:
+                v = (uint64_t)va_arg(ap, long long);
+                break;
+            case ARG_SIZE:
+                v = (uint64_t)va_arg(ap, size_t);
+                break;
+            case ARG_DOUBLE: {
+                double d = va_arg(ap, double);
+                memcpy(&v, &d, sizeof(v));
+                break;
+            }
+            case ARG_PTR:
+                v = (uintptr_t)va_arg(ap, void *);
+                break;
+            case ARG_STR: {
+                const char *s = va_arg(ap, const char *);
+                if (s == NULL) {
+                    s = "(null)";
+                }
+                size_t room = (rec->str_used < LOG_BUFFER_STR_BYTES - 1) ?
+                              LOG_BUFFER_STR_BYTES - 1 - rec->str_used : 0;
+                if (room == 0) {
+                    v = LOG_BUFFER_STR_BYTES - 1;
+                    rec->truncated = true;
+                    break;
+                }
+                // %.Ns may be given a buffer without a terminator, never
+                // look past N
+                bool bounded = precision >= 0 && (size_t)precision <= room;
+                size_t len = strnlen(s, bounded ? (size_t)precision : room);
+                if (!bounded && len == room && s[len] != '\0') {
+                    rec->truncated = true;
+                }
+                memcpy(rec->strings + rec->str_used, s, len);
+                rec->strings[rec->str_used + len] = '\0';
+                v = rec->str_used;
+                if (*tag == NULL) {
+                    *tag = rec->strings + rec->str_used;
+                }
+                rec->str_used += len + 1;
+                break;
+            }
+            default:
+                break;
+        }
+        rec->args[rec->n_args++] = v;
+    }
+}
+
+// Level letter of an esp_log format, after the optional color sequence
+static char format_level(const char *fmt) {
+    if (fmt[0] == '\033') {
+        const char *m = strchr(fmt, 'm');
+        if (m) {
+            fmt = m + 1;
+        }
+    }
+    return fmt[0];
+}
+
+static size_t format_record(const log_record_t *rec, char *out, size_t max) {
+    size_t len = 0;
+    int arg = 0;
+    const char *p = rec->fmt;
+
+    while (*p && len < max - 1) {
+        if (*p != '%') {
+            out[len++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[len++] = '%';
+            p += 2;
+            continue;
+        }
+        arg_kind_t kind;
+        int stars, precision;
+        const char *end = parse_spec(p + 1, &kind, &stars, &precision);
+        if (kind == ARG_NONE || arg + stars + 1 > rec->n_args) {
+            break;
+        }
+
+        // Rebuild the spec with any '*' replaced by the captured value. A
+        // negative precision is none, so its '.' goes too.
+        char spec[32];
+        size_t sl = 0;
+        for (const char *q = p; q < end && sl < sizeof(spec) - 12; q++) {
+            if (*q == '*') {
+                int star = (int)(int64_t)rec->args[arg++];
+                if (q[-1] == '.' && star < 0) {
+                    sl--;
+                } else {
+                    sl += snprintf(spec + sl, sizeof(spec) - sl, "%d", star);
+                }
+            } else {
+                spec[sl++] = *q;
+            }
+        }
+        spec[sl] = '\0';
+
+        uint64_t v = rec->args[arg++];
+        size_t room = max - len;
+        int n = 0;
+        switch (kind) {
+            case ARG_INT:
+                n = snprintf(out + len, room, spec, (int)v);
+                break;
+            case ARG_LONG:
+                n = snprintf(out + len, room, spec, (long)v);
+                break;
+            case ARG_LLONG:
+                n = snprintf(out + len, room, spec, (long long)v);
+                break;
+            case ARG_SIZE:
+                n = snprintf(out + len, room, spec, (size_t)v);
+                break;
+            case ARG_DOUBLE: {
+                double d;
+                memcpy(&d, &v, sizeof(d));
+                n = snprintf(out + len, room, spec, d);
+                break;
+            }
+            case ARG_PTR:
+                if (end[-1] != 'n') {
+                    n = snprintf(out + len, room, spec, (void *)(uintptr_t)v);
+                }
+                break;
+            case ARG_STR:
+                n = snprintf(out + len, room, spec, rec->strings + v);
+                break;
+            default:
+                break;
+        }
+        if (n > 0) {
+            len += ((size_t)n < room) ? (size_t)n : room - 1;
+        }
+        p = end;
+    }
+
+    if (*p || rec->truncated) {
+        static const char tail[] = " ..." LOG_RESET_COLOR "\n";
+        if (len > max - sizeof(tail)) {
+            len = max - sizeof(tail);
+        }
+        memcpy(out + len, tail, sizeof(tail) - 1);
+        len += sizeof(tail) - 1;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+static uint32_t tag_hash(const char *tag) {
+    uint32_t h = 2166136261u;
+    while (*tag) {
+        h = (h ^ (uint8_t)*tag++) * 16777619u;
+    }
+    return h;
+}
+
+static bool rate_allow(const char *tag, char level) {
+    if (level == 'E') {
+        return true;
+    }
+    uint32_t hash = tag_hash(tag);
+    int64_t now = esp_timer_get_time();
+    bool allow = true;
+
+    taskENTER_CRITICAL(&s_tag_lock);
+    tag_limit_t *t = NULL;
+    for (int i = 0; i < s_tag_count; i++) {
+        if (s_tags[i].hash == hash) {
+            t = &s_tags[i];
+            break;
+        }
+    }
+    // Once the table is full further tags are not limited
+    if (t == NULL && s_tag_count < LOG_BUFFER_MAX_TAGS) {
+        t = &s_tags[s_tag_count++];
+        t->hash = hash;
+        strlcpy(t->tag, tag, sizeof(t->tag));
+        t->tokens = LOG_BUFFER_TAG_BURST * 1000;
+        t->last_us = now;
+        t->suppressed = 0;
+    }
+    if (t) {
+        int64_t tokens = t->tokens + (now - t->last_us) * LOG_BUFFER_TAG_RATE / 1000;
+        t->last_us = now;
+        if (tokens > LOG_BUFFER_TAG_BURST * 1000) {
+            tokens = LOG_BUFFER_TAG_BURST * 1000;
+        }
+        if (tokens >= 1000) {
+            tokens -= 1000;
+        } else {
+            t->suppressed++;
+            allow = false;
+        }
+        t->tokens = (int32_t)tokens;
+    }
+    taskEXIT_CRITICAL(&s_tag_lock);
+    return allow;
+}
+
+/* Bounded MPMC queue after Vyukov, used here with a single consumer. A
+   slot is free for position pos when seq == pos and holds a record when
+   seq == pos + 1. */
+static bool ring_push(const log_record_t *rec) {
+    unsigned pos = atomic_load_explicit(&s_enqueue_pos, memory_order_relaxed);
+    log_record_t *slot;
+    for (;;) {
+        slot = &s_ring[pos & (LOG_BUFFER_SLOTS - 1)];
+        unsigned seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int diff = (int)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&s_enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&s_enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    // Only the used part of the string area is copied
+    memcpy((char *)slot + offsetof(log_record_t, fmt), (const char *)rec + offsetof(log_record_t, fmt),
+           offsetof(log_record_t, strings) - offsetof(log_record_t, fmt) + rec->str_used);
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    unsigned waiting = pos + 1 - atomic_load_explicit(&s_dequeue_pos, memory_order_relaxed);
+    unsigned high = atomic_load_explicit(&s_high_water, memory_order_relaxed);
+    while (waiting > high &&
+           !atomic_compare_exchange_weak_explicit(&s_high_water, &high, waiting,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+    return true;
+}
+
+static int log_buffer_vprintf(const char *fmt, va_list ap) {
+    log_record_t rec;
+    const char *tag;
+    capture(&rec, fmt, ap, &tag);
+
+    if (tag && !rate_allow(tag, format_level(fmt))) {
+        atomic_fetch_add_explicit(&s_rate_limited, 1, memory_order_relaxed);
+        return 0;
+    }
+    if (!ring_push(&rec)) {
+        atomic_fetch_add_explicit(&s_dropped, 1, memory_order_relaxed);
+        return 0;
+    }
+    if (rec.truncated) {
+        atomic_fetch_add_explicit(&s_truncated, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&s_queued, 1, memory_order_relaxed);
+    return 0;
+}
+
+static int console_printf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = s_console(fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+// Appends to the HTTP text ring with ANSI color sequences stripped
+static void text_append(const char *line, size_t len) {
+    xSemaphoreTake(s_text_mutex, portMAX_DELAY);
+    for (size_t i = 0; i < len; i++) {
+        if (line[i] == '\033' && i + 1 < len && line[i + 1] == '[') {
+            while (i < len && line[i] != 'm') i++;
+            continue;
+        }
+        s_text[s_text_written % LOG_BUFFER_TEXT_BYTES] = line[i];
+        s_text_written++;
+    }
+    xSemaphoreGive(s_text_mutex);
+}
+
+static void emit(const char *line, size_t len) {
+    console_printf("%s", line);
+    text_append(line, len);
+}
+
+static void emit_notice(char *line, const char *fmt, ...) {
+    int len = snprintf(line, LOG_BUFFER_LINE_MAX, "W (%lu) %s: ", (unsigned long)esp_log_timestamp(), TAG);
+    va_list ap;
+    va_start(ap, fmt);
+    len += vsnprintf(line + len, LOG_BUFFER_LINE_MAX - len, fmt, ap);
+    va_end(ap);
+    if (len >= LOG_BUFFER_LINE_MAX) {
+        len = LOG_BUFFER_LINE_MAX - 1;
+    }
+    emit(line, len);
+}
+
+// Reports lines lost since the last call
+static void report_losses(char *line) {
+    for (int i = 0; i < LOG_BUFFER_MAX_TAGS; i++) {
+        char tag[16];
+        uint32_t suppressed = 0;
+        taskENTER_CRITICAL(&s_tag_lock);
+        if (i < s_tag_count && s_tags[i].suppressed) {
+            suppressed = s_tags[i].suppressed;
+            s_tags[i].suppressed = 0;
+            memcpy(tag, s_tags[i].tag, sizeof(tag));
+        }
+        taskEXIT_CRITICAL(&s_tag_lock);
+        if (suppressed) {
+            emit_notice(line, "%lu lines from %s suppressed by rate limit\n", (unsigned long)suppressed, tag);
+        }
+    }
+
+    uint32_t dropped = atomic_load_explicit(&s_dropped, memory_order_relaxed);
+    if (dropped != s_dropped_reported) {
+        emit_notice(line, "%lu lines dropped, ring full\n", (unsigned long)(dropped - s_dropped_reported));
+        s_dropped_reported = dropped;
+    }
+}
+
+static void drain(void) {
+    char line[LOG_BUFFER_LINE_MAX];
+
+    xSemaphoreTake(s_drain_mutex, portMAX_DELAY);
+    unsigned pos = atomic_load_explicit(&s_dequeue_pos, memory_order_relaxed);
+    for (;;) {
+        log_record_t *slot = &s_ring[pos & (LOG_BUFFER_SLOTS - 1)];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1) {
+            break;
+        }
+        size_t len = format_record(slot, line, sizeof(line));
+        atomic_store_explicit(&slot->seq, pos + LOG_BUFFER_SLOTS, memory_order_release);
+        pos++;
+        atomic_store_explicit(&s_dequeue_pos, pos, memory_order_relaxed);
+        emit(line, len);
+    }
+    xSemaphoreGive(s_drain_mutex);
+}
+
+static void log_drain_task(void *pvParameters) {
+    char line[LOG_BUFFER_LINE_MAX];
+    int64_t last_report = esp_timer_get_time();
+    while (1) {
+        drain();
+        int64_t now = esp_timer_get_time();
+        if (now - last_report >= 1000000) {
+            report_losses(line);
+            last_report = now;
+        }
+        vTaskDelay(pdMS_TO_TICKS(LOG_BUFFER_DRAIN_MS));
+    }
+}
+
+esp_err_t log_buffer_init(void) {
+    esp_err_t ret = ESP_OK;
+    if (s_ring != NULL) {
+        return ESP_OK;
+    }
+
+    s_drain_mutex = xSemaphoreCreateMutex();
+    s_text_mutex = xSemaphoreCreateMutex();
+    s_ring = heap_tracker_calloc(LOG_BUFFER_SLOTS, sizeof(log_record_t), MALLOC_CAP_SPIRAM);
+    s_text = heap_tracker_malloc(LOG_BUFFER_TEXT_BYTES, MALLOC_CAP_SPIRAM);
+    if (!s_drain_mutex || !s_text_mutex || !s_ring || !s_text) {
+        ESP_LOGE(TAG, "Failed to allocate log buffer");
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+    for (unsigned i = 0; i < LOG_BUFFER_SLOTS; i++) {
+        atomic_init(&s_ring[i].seq, i);
+    }
+
+    // Just above idle, it only has to keep up on average
+    if (xTaskCreatePinnedToCore(log_drain_task, "log_drain", 3072, NULL, 1, NULL, 0) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create log drain task");
+        ret = ESP_FAIL;
+        goto cleanup;
+    }
+
+    s_console = esp_log_set_vprintf(log_buffer_vprintf);
+    ESP_LOGI(TAG, "Deferred logging enabled, %d records, %d lines/s per tag",
+             LOG_BUFFER_SLOTS, LOG_BUFFER_TAG_RATE);
+    return ESP_OK;
+
+cleanup:
+    free(s_ring);
+    s_ring = NULL;
+    free(s_text);
+    s_text = NULL;
+    if (s_drain_mutex) {
+        vSemaphoreDelete(s_drain_mutex);
+        s_drain_mutex = NULL;
+    }
+    if (s_text_mutex) {
+        vSemaphoreDelete(s_text_mutex);
+        s_text_mutex = NULL;
+    }
+    return ret;
+}
+
+void log_buffer_flush(void) {
+    if (s_ring == NULL) {
+        return;
+    }
+    drain();
+}
+
+size_t log_buffer_read(uint32_t since, char *out, size_t max, uint32_t *next) {
+    if (s_text == NULL || max == 0) {
+        *next = since;
+        return 0;
+    }
+
+    xSemaphoreTake(s_text_mutex, portMAX_DELAY);
+    uint32_t written = s_text_written;
+    uint32_t oldest = (written > LOG_BUFFER_TEXT_BYTES) ? written - LOG_BUFFER_TEXT_BYTES : 0;
+
+    // A position from before a reboot or one that has been overwritten
+    // restarts at the oldest whole line
+    if (since < oldest || since > written) {
+        since = oldest;
+        if (oldest > 0) {
+            while (since < written && s_text[since % LOG_BUFFER_TEXT_BYTES] != '\n') since++;
+            if (since < written) since++;
+        }
+    }
+
+    size_t n = written - since;
+    if (n > max) {
+        n = max;
+    }
+    for (size_t i = 0; i < n; i++) {
+        out[i] = s_text[(since + i) % LOG_BUFFER_TEXT_BYTES];
+    }
+    xSemaphoreGive(s_text_mutex);
+
+    // Keep lines whole when the caller's buffer is the limit
+    if (n == max) {
+        size_t whole = n;
+        while (whole > 0 && out[whole - 1] != '\n') whole--;
+        if (whole > 0) {
+            n = whole;
+        }
+    }
+    *next = since + n;
+    return n;
+}
+
+void log_buffer_get_stats(log_buffer_stats_t *stats) {
+    stats->queued = atomic_load_explicit(&s_queued, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&s_dropped, memory_order_relaxed);
+    stats->rate_limited = atomic_load_explicit(&s_rate_limited, memory_order_relaxed);
+    stats->truncated = atomic_load_explicit(&s_truncated, memory_order_relaxed);
+    stats->high_water = atomic_load_explicit(&s_high_water, memory_order_relaxed);
+}
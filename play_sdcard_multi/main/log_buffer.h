@@ -0,0 +1,77 @@
+#ifndef LOG_BUFFER_H
+#define LOG_BUFFER_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Records queued between the logging call and the drain task. Each record
+// holds the format pointer and the raw arguments, formatting happens later.
+#define LOG_BUFFER_SLOTS            256     // power of two
+#define LOG_BUFFER_MAX_ARGS         12
+#define LOG_BUFFER_STR_BYTES        128     // copies of %s arguments per record
+
+// Formatted text kept for GET /api/logs
+#define LOG_BUFFER_TEXT_BYTES       (16 * 1024)
+
+#define LOG_BUFFER_DRAIN_MS         50
+#define LOG_BUFFER_LINE_MAX         256
+
+// Per tag token bucket: sustained lines per second and burst size. Errors
+// are never rate limited.
+#define LOG_BUFFER_TAG_RATE         10
+#define LOG_BUFFER_TAG_BURST        20
+#define LOG_BUFFER_MAX_TAGS         32
+
+typedef struct {
+    uint32_t queued;                // records accepted into the ring
+    uint32_t dropped;               // ring full
+    uint32_t rate_limited;          // suppressed by the per tag limit
+    uint32_t truncated;             // too many or too long arguments
+    uint32_t high_water;            // most records waiting at once
+} log_buffer_stats_t;
+
+/**
+ * @brief Route ESP_LOGx output through the deferred log ring
+ *
+ * Installs an esp_log vprintf hook that captures the format pointer and
+ * arguments into a PSRAM ring without formatting them, and starts a low
+ * priority task that formats the records and writes them to the console.
+ * Call as early as possible; messages logged before this go out directly.
+ *
+ * The format is formatted after the call returns, so it must be a literal,
+ * as ESP_LOGx's are. Text built at run time goes in as a %s argument, which
+ * is copied: ESP_LOGI(TAG, "%s", line), never esp_log_write(level, TAG, line).
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t log_buffer_init(void);
+
+/**
+ * @brief Format and write everything queued so far from the calling task
+ *
+ * For use right before a deliberate restart.
+ */
+void log_buffer_flush(void);
+
+/**
+ * @brief Copy formatted log text starting at a stream position
+ *
+ * Positions count bytes written since boot. Text older than the retained
+ * window is skipped, starting at the next whole line.
+ *
+ * @param since Position returned by a previous call, 0 for everything retained
+ * @param out Output buffer
+ * @param max Size of the output buffer
+ * @param next Position to pass to the next call
+ * @return size_t Number of bytes written to out
+ */
+size_t log_buffer_read(uint32_t since, char *out, size_t max, uint32_t *next);
+
+/**
+ * @brief Current counters
+ */
+void log_buffer_get_stats(log_buffer_stats_t *stats);
+
+#endif // LOG_BUFFER_H
@@ -0,0 +1,64 @@
+/* The stages between downmix and I2S, see master_bus.h
+
+   Author: Brian Bulkowski brian@bulkowski.org
+*/
+
+#include "esp_log.h"
+#include "audio_element.h"
+#include "ringbuf.h"
+#include "convolver.h"
+#include "flight_recorder.h"
+#include "oneshot.h"
+#include "spectrum.h"
+#include "wav_header.h"
+#include "master_bus.h"
+
+static const char *TAG = "MASTER_BUS";
+
+#define FRAME_BYTES     (WAV_NATIVE_CHANNELS * WAV_NATIVE_BITS / 8)
+
+static ringbuf_handle_t s_rb;
+
+static audio_element_err_t i2s_read(audio_element_handle_t el, char *buf, int len, TickType_t ticks_to_wait,
+                                    void *ctx) {
+    // Less than a read waiting means the DAC is being fed late; the
+    // recorder's samples of the fill level would miss a short gap
+    if (rb_bytes_filled(s_rb) < len) {
+        flight_recorder_note_i2s_starved();
+    }
+    int n = rb_read(s_rb, buf, len, ticks_to_wait);
+    if (n < len) {
+        flight_recorder_note_i2s_starved();
+    }
+    if (n <= 0) {
+        // The ringbuffer's errors are the element's
+        return (audio_element_err_t)n;
+    }
+    // Whole frames come out of downmix
+    int16_t *pcm = (int16_t *)buf;
+    uint32_t frames = n / FRAME_BYTES;
+    oneshot_mix(pcm, frames);
+    convolver_process(pcm, frames);
+    spectrum_tap(pcm, frames);
+    return (audio_element_err_t)n;
+}
+
+esp_err_t master_bus_init(audio_stream_t *stream) {
+    if (!stream->output_rb) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_rb) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (oneshot_init() != ESP_OK) {
+        ESP_LOGW(TAG, "One-shot voices failed to start");
+    }
+    if (convolver_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Speaker correction failed to start");
+    }
+    if (spectrum_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Spectrum analyser failed to start");
+    }
+    s_rb = stream->output_rb;
+    return audio_element_set_read_cb(stream->i2s_e, i2s_read, NULL);
+}
@@ -0,0 +1,24 @@
+#ifndef MASTER_BUS_H
+#define MASTER_BUS_H
+
+#include "esp_err.h"
+#include "play_sdcard.h"
+
+// The last stop before the DAC. I2S reads downmix's output through a
+// callback here rather than from its ringbuffer, stream->output_rb, and
+// each block goes through, in order:
+//   oneshot_mix()          one-shot voices on top of the loops
+//   convolver_process()    speaker correction, when a filter is loaded
+//   spectrum_tap()         a copy for the analyser, when someone is asking
+// so the one-shots are corrected with everything else, and the analyser
+// sees what the DAC gets.
+
+/**
+ * @brief Start the stages and put them between downmix and I2S
+ *
+ * Call before the output pipeline runs. A stage that fails to start is
+ * skipped, the bus still runs.
+ */
+esp_err_t master_bus_init(audio_stream_t *stream);
+
+#endif /* MASTER_BUS_H */
@@ -0,0 +1,370 @@
+/* Prometheus text format metrics.
+
+   Counters and histograms are plain atomics updated with relaxed ordering,
+   so the audio and recorder tasks can bump them without locks. Scraping is
+   done from the HTTP server task and renders through a fixed stack buffer;
+   nothing here allocates.
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_wifi.h"
+#include "esp_http_server.h"
+#include "metrics.h"
+#include "task_profiler.h"
+#include "heap_tracker.h"
+#include "log_buffer.h"
+#include "shared_read.h"
+#include "sd_arbiter.h"
+
+static const char *TAG = "METRICS";
+
+#define METRICS_RENDER_BUF     512
+
+static const uint32_t s_fill_bounds[] = {0, 10, 25, 50, 75, 90, 100};
+static const uint32_t s_sd_latency_bounds[] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000};
+static const uint32_t s_http_latency_bounds[] = {1, 5, 10, 25, 50, 100, 250, 500, 1000, 5000, 30000};
+
+#define HIST_INIT(b) { .bounds = (b), .n_bounds = sizeof(b) / sizeof((b)[0]) }
+
+static atomic_uint_fast32_t s_underruns[METRICS_NUM_BUFFERS];
+static metrics_histogram_t s_fill[METRICS_NUM_BUFFERS] = {
+    [0 ... METRICS_NUM_BUFFERS - 1] = HIST_INIT(s_fill_bounds)
+};
+static metrics_histogram_t s_sd_latency = HIST_INIT(s_sd_latency_bounds);
+
+static atomic_uint_fast32_t s_wifi_connects;
+static atomic_uint_fast32_t s_wifi_disconnects;
+
+static metrics_http_endpoint_t s_http[METRICS_MAX_HTTP_ENDPOINTS];
+static atomic_int s_http_count;
+
+static void hist_observe(metrics_histogram_t *h, uint32_t v) {
+    int i = 0;
+    while (i < h->n_bounds && v > h->bounds[i]) {
+        i++;
+    }
+    atomic_fetch_add_explicit(&h->buckets[i], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, v, memory_order_relaxed);
+}
+
+void metrics_underrun(int buffer) {
+    if (buffer >= 0 && buffer < METRICS_NUM_BUFFERS) {
+        atomic_fetch_add_explicit(&s_underruns[buffer], 1, memory_order_relaxed);
+    }
+}
+
+void metrics_buffer_fill(int buffer, uint32_t percent) {
+    if (buffer >= 0 && buffer < METRICS_NUM_BUFFERS) {
+        hist_observe(&s_fill[buffer], percent);
+    }
+}
+
+void metrics_sd_read_latency(uint32_t ms) {
+    hist_observe(&s_sd_latency, ms);
+}
+
+void metrics_wifi_connected(void) {
+    atomic_fetch_add_explicit(&s_wifi_connects, 1, memory_order_relaxed);
+}
+
+void metrics_wifi_disconnected(void) {
+    atomic_fetch_add_explicit(&s_wifi_disconnects, 1, memory_order_relaxed);
+}
+
+metrics_http_endpoint_t *metrics_http_endpoint_add(const char *uri, int method) {
+    int idx = atomic_fetch_add(&s_http_count, 1);
+    if (idx >= METRICS_MAX_HTTP_ENDPOINTS) {
+        atomic_store(&s_http_count, METRICS_MAX_HTTP_ENDPOINTS);
+        ESP_LOGW(TAG, "HTTP endpoint table full, %s not timed", uri);
+        return NULL;
+    }
+    metrics_http_endpoint_t *ep = &s_http[idx];
+    ep->uri = uri;
+    ep->method = method;
+    ep->latency_ms.bounds = s_http_latency_bounds;
+    ep->latency_ms.n_bounds = sizeof(s_http_latency_bounds) / sizeof(s_http_latency_bounds[0]);
+    return ep;
+}
+
+void metrics_http_observe(metrics_http_endpoint_t *endpoint, uint32_t ms, bool ok) {
+    if (endpoint == NULL) {
+        return;
+    }
+    atomic_fetch_add_explicit(ok ? &endpoint->ok : &endpoint->errors, 1, memory_order_relaxed);
+    hist_observe(&endpoint->latency_ms, ms);
+}
+
+// Fixed buffer writer, flushed to the sink whenever the next line might not fit
+typedef struct {
+    char buf[METRICS_RENDER_BUF];
+    size_t len;
+    metrics_emit_fn_t emit;
+    void *ctx;
+    esp_err_t err;
+} metrics_writer_t;
+
+static void mw_flush(metrics_writer_t *w) {
+    if (w->err == ESP_OK && w->len > 0) {
+        w->err = w->emit(w->ctx, w->buf, w->len);
+    }
+    w->len = 0;
+}
+
+static void mw_printf(metrics_writer_t *w, const char *fmt, ...) {
+    if (w->err != ESP_OK) {
+        return;
+    }
+    for (int attempt = 0; attempt < 2; attempt++) {
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(w->buf + w->len, sizeof(w->buf) - w->len, fmt, args);
+        va_end(args);
+        if (n >= 0 && (size_t)n < sizeof(w->buf) - w->len) {
+            w->len += n;
+            return;
+        }
+        // Didn't fit, flush and retry once into an empty buffer
+        mw_flush(w);
+    }
+    ESP_LOGW(TAG, "Metrics line too long, dropped");
+}
+
+static void mw_header(metrics_writer_t *w, const char *name, const char *type, const char *help) {
+    mw_printf(w, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void mw_histogram(metrics_writer_t *w, const char *name, const char *labels, metrics_histogram_t *h) {
+    uint32_t cumulative = 0;
+    const char *sep = labels[0] ? "," : "";
+    for (int i = 0; i < h->n_bounds; i++) {
+        cumulative += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        mw_printf(w, "%s_bucket{%s%sle=\"%lu\"} %lu\n", name, labels, sep,
+                  (unsigned long)h->bounds[i], (unsigned long)cumulative);
+    }
+    cumulative += atomic_load_explicit(&h->buckets[h->n_bounds], memory_order_relaxed);
+    mw_printf(w, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, sep, (unsigned long)cumulative);
+    mw_printf(w, "%s_sum{%s} %lu\n", name, labels,
+              (unsigned long)atomic_load_explicit(&h->sum, memory_order_relaxed));
+    mw_printf(w, "%s_count{%s} %lu\n", name, labels,
+              (unsigned long)atomic_load_explicit(&h->count, memory_order_relaxed));
+}
+
+static const char *buffer_label(int buffer, char *out, size_t len) {
+    if (buffer == METRICS_BUFFER_I2S) {
+        return "i2s";
+    }
+    snprintf(out, len, "track%d", buffer);
+    return out;
+}
+
+static const char *method_name(int method) {
+    switch (method) {
+        case HTTP_GET:    return "GET";
+        case HTTP_POST:   return "POST";
+        case HTTP_PUT:    return "PUT";
+        case HTTP_DELETE: return "DELETE";
+        default:          return "OTHER";
+    }
+}
+
+static void render_audio(metrics_writer_t *w) {
+    char name[12];
+    char labels[48];
+
+    mw_header(w, "loudframe_underruns_total", "counter", "Times a buffer in the audio path ran empty while playing");
+    for (int i = 0; i < METRICS_NUM_BUFFERS; i++) {
+        mw_printf(w, "loudframe_underruns_total{buffer=\"%s\"} %lu\n", buffer_label(i, name, sizeof(name)),
+                  (unsigned long)atomic_load_explicit(&s_underruns[i], memory_order_relaxed));
+    }
+
+    mw_header(w, "loudframe_buffer_fill_percent", "histogram", "Sampled fill level of audio ringbuffers");
+    for (int i = 0; i < METRICS_NUM_BUFFERS; i++) {
+        snprintf(labels, sizeof(labels), "buffer=\"%s\"", buffer_label(i, name, sizeof(name)));
+        mw_histogram(w, "loudframe_buffer_fill_percent", labels, &s_fill[i]);
+    }
+
+    mw_header(w, "loudframe_sd_read_latency_ms", "histogram", "Time each track read from the card took, seek included");
+    mw_histogram(w, "loudframe_sd_read_latency_ms", "", &s_sd_latency);
+}
+
+static void render_tasks(metrics_writer_t *w) {
+    static task_profiler_entry_t tasks[TASK_PROFILER_MAX_TASKS];
+    task_profiler_core_t cores[portNUM_PROCESSORS];
+    int count = task_profiler_get(tasks, TASK_PROFILER_MAX_TASKS, cores, NULL);
+    if (count == 0) {
+        return;
+    }
+
+    mw_header(w, "loudframe_core_load_percent", "gauge", "Non-idle share of each core over the profiler window");
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        mw_printf(w, "loudframe_core_load_percent{core=\"%d\"} %.2f\n", c, cores[c].load_window);
+    }
+
+    mw_header(w, "loudframe_task_cpu_percent", "gauge", "Share of its core used by a task over the profiler window");
+    for (int i = 0; i < count; i++) {
+        mw_printf(w, "loudframe_task_cpu_percent{task=\"%s\",core=\"%d\"} %.2f\n",
+                  tasks[i].name, tasks[i].core, tasks[i].cpu_window);
+    }
+
+    mw_header(w, "loudframe_task_stack_free_bytes", "gauge", "Stack high water mark, bytes never used");
+    for (int i = 0; i < count; i++) {
+        mw_printf(w, "loudframe_task_stack_free_bytes{task=\"%s\"} %lu\n", tasks[i].name,
+                  (unsigned long)tasks[i].stack_hwm);
+    }
+}
+
+static void render_heap(metrics_writer_t *w) {
+    static const struct { const char *name; uint32_t caps; } heaps[] = {
+        {"dma", MALLOC_CAP_DMA},
+        {"internal", MALLOC_CAP_INTERNAL},
+        {"spiram", MALLOC_CAP_SPIRAM},
+    };
+    const int n = sizeof(heaps) / sizeof(heaps[0]);
+
+    mw_header(w, "loudframe_heap_free_bytes", "gauge", "Free heap by capability");
+    for (int i = 0; i < n; i++) {
+        mw_printf(w, "loudframe_heap_free_bytes{caps=\"%s\"} %u\n", heaps[i].name,
+                  (unsigned)heap_caps_get_free_size(heaps[i].caps));
+    }
+    mw_header(w, "loudframe_heap_largest_free_block_bytes", "gauge", "Largest allocatable block by capability");
+    for (int i = 0; i < n; i++) {
+        mw_printf(w, "loudframe_heap_largest_free_block_bytes{caps=\"%s\"} %u\n", heaps[i].name,
+                  (unsigned)heap_caps_get_largest_free_block(heaps[i].caps));
+    }
+    mw_header(w, "loudframe_heap_minimum_free_bytes", "gauge", "Lowest free heap since boot by capability");
+    for (int i = 0; i < n; i++) {
+        mw_printf(w, "loudframe_heap_minimum_free_bytes{caps=\"%s\"} %u\n", heaps[i].name,
+                  (unsigned)heap_caps_get_minimum_free_size(heaps[i].caps));
+    }
+
+    bool alert_active;
+    uint32_t alert_count, min_dma_largest;
+    heap_tracker_get_alert(&alert_active, &alert_count, &min_dma_largest);
+    mw_header(w, "loudframe_heap_dma_low_alerts_total", "counter", "Times the DMA largest block fell below the audio path's need");
+    mw_printf(w, "loudframe_heap_dma_low_alerts_total %lu\n", (unsigned long)alert_count);
+    mw_header(w, "loudframe_heap_dma_low", "gauge", "1 while the DMA largest block is below the audio path's need");
+    mw_printf(w, "loudframe_heap_dma_low %d\n", alert_active ? 1 : 0);
+}
+
+static void render_http(metrics_writer_t *w) {
+    int n = atomic_load(&s_http_count);
+    char labels[96];
+
+    mw_header(w, "loudframe_http_requests_total", "counter", "HTTP requests handled");
+    for (int i = 0; i < n; i++) {
+        metrics_http_endpoint_t *ep = &s_http[i];
+        mw_printf(w, "loudframe_http_requests_total{uri=\"%s\",method=\"%s\",result=\"ok\"} %lu\n",
+                  ep->uri, method_name(ep->method),
+                  (unsigned long)atomic_load_explicit(&ep->ok, memory_order_relaxed));
+        mw_printf(w, "loudframe_http_requests_total{uri=\"%s\",method=\"%s\",result=\"error\"} %lu\n",
+                  ep->uri, method_name(ep->method),
+                  (unsigned long)atomic_load_explicit(&ep->errors, memory_order_relaxed));
+    }
+
+    mw_header(w, "loudframe_http_request_duration_ms", "histogram", "HTTP handler latency");
+    for (int i = 0; i < n; i++) {
+        snprintf(labels, sizeof(labels), "uri=\"%s\",method=\"%s\"", s_http[i].uri, method_name(s_http[i].method));
+        mw_histogram(w, "loudframe_http_request_duration_ms", labels, &s_http[i].latency_ms);
+    }
+}
+
+static void render_wifi(metrics_writer_t *w) {
+    wifi_ap_record_t ap_info;
+    bool connected = (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK);
+
+    mw_header(w, "loudframe_wifi_connected", "gauge", "1 when associated with an access point");
+    mw_printf(w, "loudframe_wifi_connected %d\n", connected ? 1 : 0);
+    if (connected) {
+        mw_header(w, "loudframe_wifi_rssi_dbm", "gauge", "Signal strength of the current access point");
+        mw_printf(w, "loudframe_wifi_rssi_dbm %d\n", ap_info.rssi);
+    }
+    mw_header(w, "loudframe_wifi_connects_total", "counter", "Successful WiFi connections, including reconnects");
+    mw_printf(w, "loudframe_wifi_connects_total %lu\n",
+              (unsigned long)atomic_load_explicit(&s_wifi_connects, memory_order_relaxed));
+    mw_header(w, "loudframe_wifi_disconnects_total", "counter", "WiFi disconnect events");
+    mw_printf(w, "loudframe_wifi_disconnects_total %lu\n",
+              (unsigned long)atomic_load_explicit(&s_wifi_disconnects, memory_order_relaxed));
+}
+
+static void render_logs(metrics_writer_t *w) {
+    log_buffer_stats_t stats;
+    log_buffer_get_stats(&stats);
+
+    mw_header(w, "loudframe_log_lines_total", "counter", "Log lines by what happened to them");
+    mw_printf(w, "loudframe_log_lines_total{result=\"queued\"} %lu\n", (unsigned long)stats.queued);
+    mw_printf(w, "loudframe_log_lines_total{result=\"dropped\"} %lu\n", (unsigned long)stats.dropped);
+    mw_printf(w, "loudframe_log_lines_total{result=\"rate_limited\"} %lu\n", (unsigned long)stats.rate_limited);
+    mw_printf(w, "loudframe_log_lines_total{result=\"truncated\"} %lu\n", (unsigned long)stats.truncated);
+    mw_header(w, "loudframe_log_ring_high_water", "gauge", "Most log records waiting to be written at once");
+    mw_printf(w, "loudframe_log_ring_high_water %lu\n", (unsigned long)stats.high_water);
+}
+
+static void render_shared_read(metrics_writer_t *w) {
+    shared_read_stats_t stats;
+    shared_read_get_stats(&stats);
+
+    mw_header(w, "loudframe_track_read_bytes_total", "counter", "Bytes the tracks read, from the card and handed to the decoders");
+    mw_printf(w, "loudframe_track_read_bytes_total{source=\"card\"} %llu\n", (unsigned long long)stats.card_bytes);
+    mw_printf(w, "loudframe_track_read_bytes_total{source=\"served\"} %llu\n", (unsigned long long)stats.served_bytes);
+    mw_header(w, "loudframe_shared_read_blocks_total", "counter", "Shared cache block lookups");
+    mw_printf(w, "loudframe_shared_read_blocks_total{result=\"hit\"} %lu\n", (unsigned long)stats.hits);
+    mw_printf(w, "loudframe_shared_read_blocks_total{result=\"miss\"} %lu\n", (unsigned long)stats.misses);
+    mw_header(w, "loudframe_shared_read_files", "gauge", "Files the tracks have open, and how many are shared");
+    mw_printf(w, "loudframe_shared_read_files{state=\"open\"} %lu\n", (unsigned long)stats.open_files);
+    mw_printf(w, "loudframe_shared_read_files{state=\"shared\"} %lu\n", (unsigned long)stats.shared_files);
+    mw_header(w, "loudframe_shared_read_cache_bytes", "gauge", "PSRAM held by shared read caches");
+    mw_printf(w, "loudframe_shared_read_cache_bytes %lu\n", (unsigned long)stats.cache_bytes);
+}
+
+static void render_sd_arbiter(metrics_writer_t *w) {
+    sd_arbiter_stats_t stats;
+    sd_arbiter_get_stats(&stats);
+
+    mw_header(w, "loudframe_sd_io_ops_total", "counter", "SD card accesses by priority class");
+    for (int c = 0; c < SD_IO_CLASSES; c++) {
+        mw_printf(w, "loudframe_sd_io_ops_total{class=\"%s\"} %lu\n",
+                  sd_arbiter_class_name(c), (unsigned long)stats.ops[c]);
+    }
+    mw_header(w, "loudframe_sd_io_wait_ms_total", "counter", "Time spent waiting for the SD card by priority class");
+    for (int c = 0; c < SD_IO_CLASSES; c++) {
+        mw_printf(w, "loudframe_sd_io_wait_ms_total{class=\"%s\"} %llu\n",
+                  sd_arbiter_class_name(c), (unsigned long long)(stats.wait_us[c] / 1000));
+    }
+    mw_header(w, "loudframe_sd_bulk_waits_total", "counter", "Bulk writes held back for playback, and those that stopped waiting");
+    mw_printf(w, "loudframe_sd_bulk_waits_total{result=\"deferred\"} %lu\n", (unsigned long)stats.bulk_deferred);
+    mw_printf(w, "loudframe_sd_bulk_waits_total{result=\"forced\"} %lu\n", (unsigned long)stats.bulk_forced);
+    mw_header(w, "loudframe_sd_playback_headroom_percent", "gauge", "Lowest mixer buffer fill of the playing tracks");
+    mw_printf(w, "loudframe_sd_playback_headroom_percent %d\n", sd_arbiter_playback_headroom());
+}
+
+esp_err_t metrics_render(metrics_emit_fn_t emit, void *ctx) {
+    metrics_writer_t w = {
+        .len = 0,
+        .emit = emit,
+        .ctx = ctx,
+        .err = ESP_OK,
+    };
+
+    mw_header(&w, "loudframe_uptime_seconds", "gauge", "Time since boot");
+    mw_printf(&w, "loudframe_uptime_seconds %lld\n", (long long)(esp_timer_get_time() / 1000000));
+
+    render_audio(&w);
+    render_shared_read(&w);
+    render_sd_arbiter(&w);
+    render_tasks(&w);
+    render_heap(&w);
+    render_http(&w);
+    render_wifi(&w);
+    render_logs(&w);
+
+    mw_flush(&w);
+    return w.err;
+}
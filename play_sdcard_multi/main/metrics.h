@@ -0,0 +1,97 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "play_sdcard.h"
+
+// Buffers tracked for underruns and fill level: one per track plus the I2S input
+#define METRICS_BUFFER_I2S          MAX_TRACKS
+#define METRICS_NUM_BUFFERS         (MAX_TRACKS + 1)
+
+// Upper bound on endpoints timed by the HTTP server
+#define METRICS_MAX_HTTP_ENDPOINTS  48
+
+// Largest number of finite buckets a histogram may have
+#define METRICS_MAX_BUCKETS         12
+
+// Fixed bucket histogram. Buckets are stored non-cumulative, the
+// renderer accumulates them into Prometheus "le" buckets.
+typedef struct {
+    const uint32_t *bounds;             // upper bounds, ascending
+    uint8_t n_bounds;
+    atomic_uint_fast32_t buckets[METRICS_MAX_BUCKETS + 1];  // last one is +Inf
+    atomic_uint_fast32_t count;
+    atomic_uint_fast32_t sum;
+} metrics_histogram_t;
+
+typedef struct {
+    const char *uri;
+    int method;
+    atomic_uint_fast32_t ok;
+    atomic_uint_fast32_t errors;
+    metrics_histogram_t latency_ms;
+} metrics_http_endpoint_t;
+
+// Output sink for metrics_render(), called with chunks of text
+typedef esp_err_t (*metrics_emit_fn_t)(void *ctx, const char *buf, size_t len);
+
+/**
+ * @brief Record an underrun on a buffer
+ *
+ * @param buffer Track index, or METRICS_BUFFER_I2S
+ */
+void metrics_underrun(int buffer);
+
+/**
+ * @brief Record a fill level sample for a buffer
+ *
+ * @param buffer Track index, or METRICS_BUFFER_I2S
+ * @param percent Fill level 0-100
+ */
+void metrics_buffer_fill(int buffer, uint32_t percent);
+
+/**
+ * @brief Record how long a track's read from the card took
+ *
+ * Called by shared_read.c around each card access. Files are shared
+ * between tracks there, so the histogram is for the card, not per track.
+ */
+void metrics_sd_read_latency(uint32_t ms);
+
+/**
+ * @brief WiFi connection state changes, called from the WiFi event handler
+ */
+void metrics_wifi_connected(void);
+void metrics_wifi_disconnected(void);
+
+/**
+ * @brief Add an HTTP endpoint to the request metrics
+ *
+ * @param uri URI string, must stay valid (string literals are fine)
+ * @param method HTTP method
+ * @return metrics_http_endpoint_t* Endpoint counters, NULL if the table is full
+ */
+metrics_http_endpoint_t *metrics_http_endpoint_add(const char *uri, int method);
+
+/**
+ * @brief Record a completed HTTP request
+ */
+void metrics_http_observe(metrics_http_endpoint_t *endpoint, uint32_t ms, bool ok);
+
+/**
+ * @brief Render all metrics in Prometheus text format
+ *
+ * Uses a fixed stack buffer and static task tables, no heap allocation.
+ * Output is handed to emit() in chunks.
+ *
+ * @param emit Output sink
+ * @param ctx Passed to emit
+ * @return esp_err_t ESP_OK, or the first error returned by emit
+ */
+esp_err_t metrics_render(metrics_emit_fn_t emit, void *ctx);
+
+#endif // METRICS_H
@@ -0,0 +1,484 @@
+/* MP3 frame index: offsets of every MP3_INDEX_STRIDE-th frame.
+
+   The parser is fed the file in order, any chunk size, so the same code
+   indexes a file read back from the card and one arriving over HTTP. It
+   also walks from an entry to the exact frame: that is a copy of
+   the index state put at the entry's offset, told to stop at the frame.
+
+   The sidecar is the index as it is in memory behind a small header. It
+   counts as the file's when the size matches and it is no older than the
+   file; otherwise the file is indexed again and the sidecar rewritten.
+
+   Author: Brian Bulkowski brian@bulkowski.org
+*/
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "heap_tracker.h"
+#include "sd_arbiter.h"
+#include "mp3_index.h"
+
+static const char *TAG = "MP3_INDEX";
+
+// No frame this far past the last tag: not an MP3
+#define SYNC_LIMIT      (64 * 1024)
+#define ID3_HEADER_LEN  10
+#define PATH_LEN        128
+#define MAX_FRAME_LEN   1441        // Layer III, 320 kbps at 32 kHz or 160 kbps at 8 kHz, padded
+
+#define SIDECAR_MAGIC   "MP3X"
+#define SIDECAR_VERSION 1
+
+struct mp3_index_s {
+    // From the first frame; later frames must agree
+    uint8_t version;                // 3 MPEG 1, 2 MPEG 2, 0 MPEG 2.5
+    uint32_t sample_rate;
+    uint32_t samples_per_frame;
+
+    uint32_t frames;
+    uint32_t *offsets;              // frame i * MP3_INDEX_STRIDE starts at offsets[i]
+    uint32_t n_offsets;
+    uint32_t cap;
+    bool walking;                   // finding one frame, offsets not kept
+    bool no_mem;
+
+    // Parser
+    uint32_t fed;                   // file bytes seen
+    uint32_t next;                  // where the next header starts
+    uint32_t search_from;           // end of the last tag, while looking for the first frame
+    uint32_t stop_frame;
+    uint8_t hdr[ID3_HEADER_LEN];
+    uint8_t hdr_len;
+    bool synced;
+    bool done;
+};
+
+typedef struct {
+    uint8_t version;
+    uint32_t sample_rate;
+    uint32_t samples;
+    uint32_t len;
+} frame_t;
+
+typedef struct {
+    char magic[4];
+    uint8_t format;                 // SIDECAR_VERSION
+    uint8_t version;                // of MPEG, as in mp3_index_s
+    uint16_t stride;
+    uint32_t file_size;
+    uint32_t sample_rate;
+    uint32_t samples_per_frame;
+    uint32_t frames;
+    uint32_t n_offsets;             // followed by the offsets
+} sidecar_header_t;
+
+typedef struct {
+    char path[PATH_LEN];
+    uint32_t size;
+    time_t mtime;
+    uint32_t last_use;
+    mp3_index_t *idx;
+} cached_t;
+
+static _Atomic(SemaphoreHandle_t) s_lock;
+static cached_t s_cache[MP3_INDEX_CACHE];
+static uint32_t s_clock;
+
+static bool frame_parse(const uint8_t *h, frame_t *fr) {
+    static const uint16_t kbps_mpeg1[16] = { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 };
+    static const uint16_t kbps_mpeg2[16] = { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 };
+    static const uint32_t rates[4] = { 44100, 48000, 32000, 0 };
+
+    if (h[0] != 0xff || (h[1] & 0xe0) != 0xe0) {
+        return false;
+    }
+    int version = (h[1] >> 3) & 3;
+    int layer = (h[1] >> 1) & 3;        // 1 is Layer III
+    int kbps_index = h[2] >> 4;
+    int rate_index = (h[2] >> 2) & 3;
+    if (version == 1 || layer != 1 || kbps_index == 0 || kbps_index == 15 || rate_index == 3) {
+        return false;
+    }
+    fr->version = version;
+    fr->sample_rate = rates[rate_index] >> (version == 3 ? 0 : version == 2 ? 1 : 2);
+    fr->samples = version == 3 ? 1152 : 576;
+    uint32_t kbps = version == 3 ? kbps_mpeg1[kbps_index] : kbps_mpeg2[kbps_index];
+    fr->len = (version == 3 ? 144000 : 72000) * kbps / fr->sample_rate + ((h[2] >> 1) & 1);
+    return true;
+}
+
+static size_t header_needed(const mp3_index_t *idx) {
+    if (!idx->synced && idx->hdr_len >= 3 && memcmp(idx->hdr, "ID3", 3) == 0) {
+        return ID3_HEADER_LEN;
+    }
+    return 4;
+}
+
+static void offset_add(mp3_index_t *idx, uint32_t offset) {
+    if (idx->n_offsets == idx->cap) {
+        uint32_t cap = idx->cap ? idx->cap * 2 : 256;
+        uint32_t *grown = heap_caps_realloc(idx->offsets, cap * sizeof(*grown), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!grown) {
+            idx->no_mem = true;
+            idx->done = true;
+            return;
+        }
+        idx->offsets = grown;
+        idx->cap = cap;
+    }
+    idx->offsets[idx->n_offsets++] = offset;
+}
+
+// A whole header is in hdr, at next
+static void header_done(mp3_index_t *idx) {
+    if (header_needed(idx) == ID3_HEADER_LEN) {
+        const uint8_t *h = idx->hdr;
+        uint32_t size = (h[6] & 0x7f) << 21 | (h[7] & 0x7f) << 14 | (h[8] & 0x7f) << 7 | (h[9] & 0x7f);
+        idx->next += ID3_HEADER_LEN + size + ((h[5] & 0x10) ? ID3_HEADER_LEN : 0);
+        idx->search_from = idx->next;
+        idx->hdr_len = 0;
+        return;
+    }
+
+    frame_t fr;
+    bool ok = frame_parse(idx->hdr, &fr);
+    if (ok && idx->synced) {
+        ok = fr.version == idx->version && fr.sample_rate == idx->sample_rate;
+    }
+    if (ok) {
+        if (!idx->synced) {
+            idx->synced = true;
+            idx->version = fr.version;
+            idx->sample_rate = fr.sample_rate;
+            idx->samples_per_frame = fr.samples;
+        }
+        if (idx->frames == idx->stop_frame) {
+            idx->done = true;
+            return;
+        }
+        if (!idx->walking && idx->frames % MP3_INDEX_STRIDE == 0) {
+            offset_add(idx, idx->next);
+        }
+        idx->frames++;
+        idx->next += fr.len;
+        idx->hdr_len = 0;
+    } else if (!idx->synced) {
+        // Look for a sync word one byte on
+        memmove(idx->hdr, idx->hdr + 1, --idx->hdr_len);
+        idx->next++;
+        idx->done = idx->next - idx->search_from > SYNC_LIMIT;
+    } else {
+        idx->done = true;
+    }
+}
+
+mp3_index_t *mp3_index_create(void) {
+    mp3_index_t *idx = heap_tracker_calloc(1, sizeof(*idx), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (idx) {
+        idx->stop_frame = UINT32_MAX;
+    }
+    return idx;
+}
+
+void mp3_index_feed(mp3_index_t *idx, const uint8_t *buf, size_t len) {
+    uint32_t base = idx->fed;
+    idx->fed += len;
+    size_t i = 0;
+    while (!idx->done && i < len) {
+        uint32_t at = idx->next + idx->hdr_len;
+        if (base + i < at) {
+            if (at - (base + i) >= len - i) {
+                break;
+            }
+            i = at - base;
+        }
+        idx->hdr[idx->hdr_len++] = buf[i++];
+        if (idx->hdr_len == header_needed(idx)) {
+            header_done(idx);
+        }
+    }
+}
+
+bool mp3_index_done(const mp3_index_t *idx) {
+    return idx->done;
+}
+
+void mp3_index_info(const mp3_index_t *idx, uint32_t *frames, uint32_t *sample_rate, uint32_t *samples_per_frame) {
+    *frames = idx->frames;
+    *sample_rate = idx->sample_rate;
+    *samples_per_frame = idx->samples_per_frame;
+}
+
+void mp3_index_destroy(mp3_index_t *idx) {
+    if (idx) {
+        free(idx->offsets);
+        free(idx);
+    }
+}
+
+// Sidecar
+
+static void sidecar_path(const char *audio_path, char *out, size_t len) {
+    snprintf(out, len, "%s" MP3_INDEX_SUFFIX, audio_path);
+}
+
+static esp_err_t sidecar_write(const char *audio_path, const mp3_index_t *idx, uint32_t file_size) {
+    if (!idx->synced || idx->frames == 0 || idx->no_mem) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    char path[280];
+    sidecar_path(audio_path, path, sizeof(path));
+    sidecar_header_t h = {
+        .magic = SIDECAR_MAGIC,
+        .format = SIDECAR_VERSION,
+        .version = idx->version,
+        .stride = MP3_INDEX_STRIDE,
+        .file_size = file_size,
+        .sample_rate = idx->sample_rate,
+        .samples_per_frame = idx->samples_per_frame,
+        .frames = idx->frames,
+        .n_offsets = idx->n_offsets,
+    };
+
+    esp_err_t ret = ESP_OK;
+    sd_arbiter_begin(SD_IO_METADATA);
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        ESP_LOGW(TAG, "Failed to create %s", path);
+        ret = ESP_FAIL;
+    } else {
+        if (fwrite(&h, sizeof(h), 1, f) != 1 ||
+            fwrite(idx->offsets, sizeof(*idx->offsets), idx->n_offsets, f) != idx->n_offsets) {
+            ret = ESP_FAIL;
+        }
+        fclose(f);
+        if (ret != ESP_OK) {
+            remove(path);
+        }
+    }
+    sd_arbiter_end(SD_IO_METADATA);
+    return ret;
+}
+
+// Fills a fresh idx from the sidecar of the file described by audio_st
+static esp_err_t sidecar_load(const char *audio_path, const struct stat *audio_st, mp3_index_t *idx) {
+    char path[280];
+    sidecar_path(audio_path, path, sizeof(path));
+
+    struct stat st;
+    sidecar_header_t h;
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    sd_arbiter_begin(SD_IO_METADATA);
+    FILE *f = stat(path, &st) == 0 ? fopen(path, "rb") : NULL;
+    if (f) {
+        // Not ours, or left from an earlier file of the same name
+        err = ESP_ERR_INVALID_STATE;
+        if (fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, SIDECAR_MAGIC, sizeof(h.magic)) == 0 &&
+            h.format == SIDECAR_VERSION && h.stride == MP3_INDEX_STRIDE && h.frames > 0 &&
+            h.n_offsets == (h.frames + MP3_INDEX_STRIDE - 1) / MP3_INDEX_STRIDE &&
+            st.st_size == (off_t)(sizeof(h) + h.n_offsets * sizeof(uint32_t)) &&
+            h.file_size == (uint32_t)audio_st->st_size && st.st_mtime >= audio_st->st_mtime) {
+            uint32_t *offsets = heap_caps_malloc(h.n_offsets * sizeof(*offsets), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            if (!offsets) {
+                err = ESP_ERR_NO_MEM;
+            } else if (fread(offsets, sizeof(*offsets), h.n_offsets, f) != h.n_offsets) {
+                free(offsets);
+            } else {
+                err = ESP_OK;
+            }
+            if (err == ESP_OK) {
+                idx->version = h.version;
+                idx->sample_rate = h.sample_rate;
+                idx->samples_per_frame = h.samples_per_frame;
+                idx->frames = h.frames;
+                idx->offsets = offsets;
+                idx->n_offsets = idx->cap = h.n_offsets;
+                idx->fed = h.file_size;
+                idx->synced = true;
+                idx->done = true;
+            }
+        }
+        fclose(f);
+    }
+    sd_arbiter_end(SD_IO_METADATA);
+    return err;
+}
+
+esp_err_t mp3_index_save(const char *audio_path, const mp3_index_t *idx) {
+    return sidecar_write(audio_path, idx, idx->fed);
+}
+
+void mp3_index_remove(const char *audio_path) {
+    char path[280];
+    sidecar_path(audio_path, path, sizeof(path));
+    sd_arbiter_begin(SD_IO_METADATA);
+    remove(path);
+    sd_arbiter_end(SD_IO_METADATA);
+}
+
+// Locate
+
+static SemaphoreHandle_t lock_get(void) {
+    SemaphoreHandle_t lock = atomic_load(&s_lock);
+    if (lock == NULL) {
+        SemaphoreHandle_t created = xSemaphoreCreateMutex();
+        if (atomic_compare_exchange_strong(&s_lock, &lock, created)) {
+            lock = created;
+        } else {
+            vSemaphoreDelete(created);
+        }
+    }
+    return lock;
+}
+
+// The cached index for path, a fresh one if the file changed or wasn't cached
+static mp3_index_t *cache_get(const char *path, const struct stat *st) {
+    cached_t *slot = &s_cache[0];
+    for (int i = 0; i < MP3_INDEX_CACHE; i++) {
+        cached_t *c = &s_cache[i];
+        if (c->idx && strcmp(c->path, path) == 0) {
+            slot = c;
+            if (c->size == (uint32_t)st->st_size && c->mtime == st->st_mtime) {
+                c->last_use = ++s_clock;
+                return c->idx;
+            }
+            break;
+        }
+        if (!c->idx || (slot->idx && c->last_use < slot->last_use)) {
+            slot = c;
+        }
+    }
+    if (strlen(path) >= PATH_LEN) {
+        return NULL;
+    }
+    mp3_index_t *idx = mp3_index_create();
+    if (!idx) {
+        return NULL;
+    }
+    mp3_index_destroy(slot->idx);
+    strcpy(slot->path, path);
+    slot->size = st->st_size;
+    slot->mtime = st->st_mtime;
+    slot->last_use = ++s_clock;
+    slot->idx = idx;
+    return idx;
+}
+
+static size_t read_at(FILE *f, uint32_t pos, uint8_t *buf, size_t len) {
+    sd_arbiter_begin(SD_IO_METADATA);
+    size_t n = 0;
+    if (fseek(f, pos, SEEK_SET) == 0) {
+        n = fread(buf, 1, len, f);
+    }
+    sd_arbiter_end(SD_IO_METADATA);
+    return n;
+}
+
+static void feed_all(FILE *f, mp3_index_t *idx, uint8_t *buf) {
+    while (!idx->done) {
+        size_t n = read_at(f, idx->fed, buf, MP3_INDEX_READ_SIZE);
+        if (n == 0) {
+            idx->done = true;
+            break;
+        }
+        mp3_index_feed(idx, buf, n);
+    }
+}
+
+static esp_err_t locate_locked(const char *path, uint64_t sample, uint32_t *offset, uint64_t *start_sample,
+                               uint32_t *sample_rate, uint8_t *buf) {
+    struct stat st;
+    sd_arbiter_begin(SD_IO_METADATA);
+    FILE *f = stat(path, &st) == 0 ? fopen(path, "rb") : NULL;
+    sd_arbiter_end(SD_IO_METADATA);
+    if (!f) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    mp3_index_t *idx = cache_get(path, &st);
+    if (!idx) {
+        fclose(f);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // A fresh index: the sidecar's, or the whole file's and then a sidecar
+    if (idx->fed == 0 && sidecar_load(path, &st, idx) != ESP_OK) {
+        feed_all(f, idx, buf);
+        if (sidecar_write(path, idx, st.st_size) == ESP_OK) {
+            ESP_LOGI(TAG, "Indexed %s, %lu frames", path, (unsigned long)idx->frames);
+        }
+    }
+
+    esp_err_t err = ESP_OK;
+    uint64_t frame = 0;
+    if (!idx->synced) {
+        err = ESP_ERR_NOT_SUPPORTED;
+    } else {
+        frame = sample / idx->samples_per_frame;
+        if (frame >= idx->frames) {
+            err = idx->no_mem ? ESP_ERR_NO_MEM : ESP_ERR_INVALID_SIZE;
+        }
+    }
+
+    // One read from the entry to the next holds the frame
+    uint8_t *span = NULL;
+    uint32_t from = 0, to = 0;
+    if (err == ESP_OK) {
+        uint32_t entry = frame / MP3_INDEX_STRIDE;
+        from = idx->offsets[entry];
+        to = entry + 1 < idx->n_offsets ? idx->offsets[entry + 1] : (uint32_t)st.st_size;
+        if (to - from > MP3_INDEX_STRIDE * MAX_FRAME_LEN) {
+            to = from + MP3_INDEX_STRIDE * MAX_FRAME_LEN;
+        }
+        span = heap_tracker_malloc(to - from, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!span) {
+            err = ESP_ERR_NO_MEM;
+        }
+    }
+    if (err == ESP_OK) {
+        mp3_index_t walk = *idx;
+        walk.walking = true;
+        walk.frames = frame - frame % MP3_INDEX_STRIDE;
+        walk.next = walk.fed = from;
+        walk.hdr_len = 0;
+        walk.done = false;
+        walk.stop_frame = frame;
+        mp3_index_feed(&walk, span, read_at(f, from, span, to - from));
+        if (walk.frames == frame && walk.done && walk.hdr_len > 0) {
+            *offset = walk.next;
+            *start_sample = frame * idx->samples_per_frame;
+            *sample_rate = idx->sample_rate;
+        } else {
+            err = ESP_ERR_INVALID_SIZE;
+        }
+    }
+    free(span);
+
+    sd_arbiter_begin(SD_IO_METADATA);
+    fclose(f);
+    sd_arbiter_end(SD_IO_METADATA);
+    return err;
+}
+
+esp_err_t mp3_index_locate(const char *path, uint64_t sample, uint32_t *offset, uint64_t *start_sample,
+                           uint32_t *sample_rate) {
+    SemaphoreHandle_t lock = lock_get();
+    uint8_t *buf = heap_tracker_malloc(MP3_INDEX_READ_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!lock || !buf) {
+        free(buf);
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    esp_err_t err = locate_locked(path, sample, offset, start_sample, sample_rate, buf);
+    xSemaphoreGive(lock);
+    free(buf);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_SIZE) {
+        ESP_LOGW(TAG, "Can't find sample %llu in %s: %s", (unsigned long long)sample, path, esp_err_to_name(err));
+    }
+    return err;
+}
@@ -0,0 +1,88 @@
+#ifndef MP3_INDEX_H
+#define MP3_INDEX_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Where the frames of an MP3 start, so a track can start at a sample.
+//
+// An MP3 has no table of contents worth trusting: the only way to find
+// frame n is to walk the frame headers from the start. The index keeps the
+// offset of every MP3_INDEX_STRIDE-th frame; finding a frame is then one
+// lookup and a walk over fewer than MP3_INDEX_STRIDE headers.
+//
+// The index of a file uploaded over HTTP is built on the way to the card and
+// kept in a sidecar next to it, so a seek is a lookup in the sidecar and
+// one read of the frames between two entries. A file that got onto the
+// card some other way is indexed, and its sidecar written, on its first
+// seek.
+//
+// Only MPEG 1, 2 and 2.5 Layer III at a fixed bitrate per frame (CBR or
+// VBR, not free format) is understood. The walk starts after an ID3v2 tag
+// and stops at the first thing that isn't a frame, such as an ID3v1 tag.
+
+#define MP3_INDEX_STRIDE        16          // frames per entry
+#define MP3_INDEX_CACHE         4           // files whose index is kept in memory
+#define MP3_INDEX_READ_SIZE     4096
+
+// Sidecar written next to an indexed file: /sdcard/loop1.mp3 -> /sdcard/loop1.mp3.idx
+#define MP3_INDEX_SUFFIX        ".idx"
+
+typedef struct mp3_index_s mp3_index_t;
+
+/**
+ * @brief Start an index for bytes that will arrive in order from the start of the file
+ *
+ * @return the index, or NULL if out of memory
+ */
+mp3_index_t *mp3_index_create(void);
+
+/**
+ * @brief Feed the next bytes of the file, any length
+ */
+void mp3_index_feed(mp3_index_t *idx, const uint8_t *buf, size_t len);
+
+/**
+ * @brief True once the frames have ended, or the file turned out not to be an MP3
+ */
+bool mp3_index_done(const mp3_index_t *idx);
+
+/**
+ * @brief Frames indexed so far, and their format; 0 frames if none were found
+ */
+void mp3_index_info(const mp3_index_t *idx, uint32_t *frames, uint32_t *sample_rate, uint32_t *samples_per_frame);
+
+void mp3_index_destroy(mp3_index_t *idx);
+
+/**
+ * @brief Write the sidecar for audio_path, which idx was fed the whole of
+ *
+ * @return ESP_OK, ESP_ERR_NOT_SUPPORTED if no frames were found, ESP_FAIL
+ *         if it can't be written
+ */
+esp_err_t mp3_index_save(const char *audio_path, const mp3_index_t *idx);
+
+/**
+ * @brief Remove the sidecar for audio_path, if there is one
+ */
+void mp3_index_remove(const char *audio_path);
+
+/**
+ * @brief Find the frame holding a sample of an MP3 on the card
+ *
+ * Uses the sidecar, or indexes the file and writes one, and keeps the index
+ * for the next call. A sample past the end is refused rather than wrapped.
+ *
+ * @param sample Wanted sample (frame of audio, all channels)
+ * @param offset File offset of the frame holding it
+ * @param start_sample The first sample of that frame, where playback will really start
+ * @return ESP_OK, ESP_ERR_NOT_FOUND if the file can't be read,
+ *         ESP_ERR_NOT_SUPPORTED if it isn't an MP3 this understands,
+ *         ESP_ERR_INVALID_SIZE if sample is past the end
+ */
+esp_err_t mp3_index_locate(const char *path, uint64_t sample, uint32_t *offset, uint64_t *start_sample,
+                           uint32_t *sample_rate);
+
+#endif /* MP3_INDEX_H */
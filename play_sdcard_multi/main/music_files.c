@@ -30,6 +30,8 @@
 #include "board.h"
 
 #include "music_files.h"
+#include "heap_tracker.h"
+#include "sd_arbiter.h"
 
 // filesystem
 #include <stdio.h>
@@ -67,7 +69,10 @@ esp_err_t music_filename_validate( const char *filename, enum FILETYPE_ENUM *fil
 
     struct stat file_stat;
 
-    if (stat(filename, &file_stat) != 0) {
+    sd_arbiter_begin(SD_IO_METADATA);
+    int stat_ret = stat(filename, &file_stat);
+    sd_arbiter_end(SD_IO_METADATA);
+    if (stat_ret != 0) {
         ESP_LOGW(TAG, "[] File %s does not exist",filename);
         return(ESP_FAIL);
     }
@@ -98,8 +103,10 @@ int music_filename_get( char **file_o, enum FILETYPE_ENUM *filetype_o) {
     char *filename = NULL;
 
     // let's see if I can autodetect the file format of the test stream on the sd card
+    sd_arbiter_begin(SD_IO_METADATA);
     DIR *dir = opendir(PATH_PREFIX);
     if (!dir) {
+        sd_arbiter_end(SD_IO_METADATA);
         ESP_LOGI(TAG, "[E] can't open sd card for autodetect");
         return(-1);
     }
@@ -117,7 +124,7 @@ int music_filename_get( char **file_o, enum FILETYPE_ENUM *filetype_o) {
              (strncmp(ent->d_name + lenstr - sizeof(MP3_SUFFIX) + 1 , MP3_SUFFIX, sizeof(MP3_SUFFIX) -1) == 0 ) ) {
             ESP_LOGD(TAG, "[ MFG ] Found MP3: %s", ent->d_name);
             if (filename) free(filename);
-            filename = heap_caps_malloc(lenstr + sizeof(PATH_PREFIX) + 2, MALLOC_CAP_SPIRAM);
+            filename = heap_tracker_malloc(lenstr + sizeof(PATH_PREFIX) + 2, MALLOC_CAP_SPIRAM);
             // filename = malloc(lenstr + sizeof(PATH_PREFIX) + 2);
             sprintf(filename, "%s/%s", PATH_PREFIX, ent->d_name);
             *filetype_o = FILETYPE_MP3;
@@ -127,7 +134,7 @@ int music_filename_get( char **file_o, enum FILETYPE_ENUM *filetype_o) {
              (strncmp(ent->d_name + lenstr - sizeof(WAV_SUFFIX) + 1 , WAV_SUFFIX, sizeof(WAV_SUFFIX) -1) == 0 ) ) {
             ESP_LOGD(TAG, "[ MFG ] Found WAV: %s", ent->d_name);
             if (filename) free(filename);
-            filename = heap_caps_malloc(lenstr + sizeof(PATH_PREFIX) + 2, MALLOC_CAP_SPIRAM);
+            filename = heap_tracker_malloc(lenstr + sizeof(PATH_PREFIX) + 2, MALLOC_CAP_SPIRAM);
             // filename = malloc(lenstr + sizeof(PATH_PREFIX) + 2);
             sprintf(filename, "%s/%s", PATH_PREFIX, ent->d_name);
             *filetype_o = FILETYPE_WAV;
@@ -136,6 +143,7 @@ int music_filename_get( char **file_o, enum FILETYPE_ENUM *filetype_o) {
     }
     ESP_LOGD(TAG, "[ 1.1] that's all the SDcard");
     closedir(dir);
+    sd_arbiter_end(SD_IO_METADATA);
 
     *file_o = filename;
 
@@ -146,9 +154,14 @@ int music_filename_get( char **file_o, enum FILETYPE_ENUM *filetype_o) {
 // get an array of all the valid music filenames on the root of the SD card
 // 
 esp_err_t music_filenames_get(char ***file_array_o) {
+    // One arbiter section for both passes, so no upload creates a file
+    // between the count and the collection
+    sd_arbiter_begin(SD_IO_METADATA);
+
     // FIRST PASS: Count files
     DIR *dir = opendir(PATH_PREFIX);
     if (!dir) {
+        sd_arbiter_end(SD_IO_METADATA);
         ESP_LOGI(TAG, "[E] can't open sd card for autodetect");
         return(ESP_FAIL);
     }
@@ -169,13 +182,17 @@ esp_err_t music_filenames_get(char ***file_array_o) {
 
     // Allocate array for file names (add one for NULL terminator)
     n_files++; // let's put a null at the end
-    char **files = heap_caps_malloc(n_files * sizeof(void *), MALLOC_CAP_SPIRAM);
-    if (files == NULL) return(ESP_FAIL);
+    char **files = heap_tracker_malloc(n_files * sizeof(void *), MALLOC_CAP_SPIRAM);
+    if (files == NULL) {
+        sd_arbiter_end(SD_IO_METADATA);
+        return(ESP_FAIL);
+    }
     
     // SECOND PASS: Collect file names - REOPEN directory
     dir = opendir(PATH_PREFIX);
     if (!dir) {
         ESP_LOGE(TAG, "[E] can't reopen sd card for second pass");
+        sd_arbiter_end(SD_IO_METADATA);
         free(files);
         return(ESP_FAIL);
     }
@@ -186,10 +203,11 @@ esp_err_t music_filenames_get(char ***file_array_o) {
         if (ESP_OK == music_determine_filetype( ent->d_name, &filetype)) {
             // Use SPIRAM instead of strdup() to avoid internal RAM exhaustion
             size_t len = strlen(ent->d_name) + 1;
-            char *fn = heap_caps_malloc(len, MALLOC_CAP_SPIRAM);
+            char *fn = heap_tracker_malloc(len, MALLOC_CAP_SPIRAM);
             if (fn == NULL) {
                 ESP_LOGE(TAG, "Failed to allocate filename in SPIRAM");
                 closedir(dir);
+                sd_arbiter_end(SD_IO_METADATA);
                 // Free already allocated filenames
                 for (int i = 0; i < n_files; i++) {
                     free(files[i]);
@@ -205,6 +223,7 @@ esp_err_t music_filenames_get(char ***file_array_o) {
     files[n_files] = NULL;
 
     closedir(dir);
+    sd_arbiter_end(SD_IO_METADATA);
     
     *file_array_o = files;
 
@@ -0,0 +1,569 @@
+/* One-shot voices mixed in front of I2S, see oneshot.h
+
+   s_lock guards the slots and voices. The mixer holds it for one pass over
+   a block, trigger and load for a few field writes; nobody holds it over
+   SD access. The streamer reads outside it into a chunk the mixer can't
+   be reading (not yet counted in head), then publishes the chunk under
+   it only if the voice is still on the same start, its gen.
+
+   Author: Brian Bulkowski brian@bulkowski.org
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "convolver.h"
+#include "flash_store.h"
+#include "heap_tracker.h"
+#include "playhead.h"
+#include "sd_arbiter.h"
+#include "wav_header.h"
+#include "oneshot.h"
+
+static const char *TAG = "ONESHOT";
+
+typedef struct {
+    bool loaded;
+    char file_path[256];
+    uint16_t channels;
+    uint16_t block_align;
+    uint32_t data_offset;
+    uint32_t frames;
+    uint32_t attack_frames;
+    int16_t *attack;
+    bool mapped;                    // attack is the whole file in mapped flash, not ours to free
+} slot_t;
+
+typedef struct {
+    int16_t *pcm;                   // ONESHOT_CHUNK_BYTES
+    uint32_t frames;
+} chunk_t;
+
+typedef struct {
+    bool active;
+    int slot;
+    uint32_t gen;                   // bumped on every start and stop
+    uint32_t frame;                 // next one to mix
+    uint32_t frames;                // where it ends, short of the slot's if the card failed
+    float gain_db;
+    int32_t gain;                   // Q15
+    int64_t trigger_us;             // 0 once mixed
+    uint32_t started;               // trigger order, the lowest is stolen
+
+    // Streamed past the attack: the streamer fills head, the mixer takes tail
+    chunk_t chunks[ONESHOT_CHUNKS];
+    uint32_t head;
+    uint32_t tail;
+    uint32_t chunk_pos;             // frames taken from the tail chunk
+    uint32_t stream_frame;          // next one to read from the card
+
+    // What it was playing when taken, gain and ramp applied
+    int16_t fade[ONESHOT_STEAL_FADE_FRAMES * 2];
+    int fade_len;
+    int fade_pos;
+} voice_t;
+
+static SemaphoreHandle_t s_lock;
+static SemaphoreHandle_t s_wake;
+static slot_t s_slots[ONESHOT_SLOTS];
+static voice_t s_voices[ONESHOT_VOICES];
+static uint32_t s_started;
+static oneshot_stats_t s_stats;
+
+static int32_t gain_q15(float gain_db) {
+    // Written so NaN fails the first test and plays at the minimum
+    if (!(gain_db >= ONESHOT_GAIN_MIN_DB)) {
+        gain_db = ONESHOT_GAIN_MIN_DB;
+    } else if (gain_db > ONESHOT_GAIN_MAX_DB) {
+        gain_db = ONESHOT_GAIN_MAX_DB;
+    }
+    return (int32_t)(powf(10.0f, gain_db / 20.0f) * 32768.0f);
+}
+
+static inline int16_t saturate(int32_t v) {
+    return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : (int16_t)v;
+}
+
+// The voice's next frames in one piece, NULL when streaming is behind
+static const int16_t *voice_span(const voice_t *v, const slot_t *s, uint32_t *avail) {
+    if (v->frame < s->attack_frames) {
+        *avail = s->attack_frames - v->frame;
+        return s->attack + v->frame * s->channels;
+    }
+    if (v->head == v->tail) {
+        *avail = 0;
+        return NULL;
+    }
+    const chunk_t *c = &v->chunks[v->tail % ONESHOT_CHUNKS];
+    *avail = c->frames - v->chunk_pos;
+    return c->pcm + v->chunk_pos * s->channels;
+}
+
+// Spans end at the attack and at chunk ends, so n never crosses one
+static void voice_advance(voice_t *v, const slot_t *s, uint32_t n) {
+    bool streamed = v->frame >= s->attack_frames;
+    v->frame += n;
+    if (streamed) {
+        v->chunk_pos += n;
+        if (v->chunk_pos >= v->chunks[v->tail % ONESHOT_CHUNKS].frames) {
+            v->tail++;
+            v->chunk_pos = 0;
+            xSemaphoreGive(s_wake);
+        }
+    }
+}
+
+static void voice_end(voice_t *v) {
+    v->active = false;
+    v->gen++;
+}
+
+// Keep the next few frames of a voice that is being cut, to ramp it out
+static void voice_fade(voice_t *v) {
+    const slot_t *s = &s_slots[v->slot];
+    int n = 0;
+    while (n < ONESHOT_STEAL_FADE_FRAMES && v->frame < v->frames) {
+        uint32_t avail;
+        const int16_t *src = voice_span(v, s, &avail);
+        if (!src) {
+            break;
+        }
+        uint32_t take = avail;
+        if (take > (uint32_t)(ONESHOT_STEAL_FADE_FRAMES - n)) {
+            take = ONESHOT_STEAL_FADE_FRAMES - n;
+        }
+        if (take > v->frames - v->frame) {
+            take = v->frames - v->frame;
+        }
+        for (uint32_t i = 0; i < take; i++, n++) {
+            int32_t g = v->gain * (ONESHOT_STEAL_FADE_FRAMES - n) / ONESHOT_STEAL_FADE_FRAMES;
+            int16_t l = src[i * s->channels];
+            int16_t r = src[i * s->channels + s->channels - 1];
+            v->fade[n * 2] = saturate((l * g) >> 15);
+            v->fade[n * 2 + 1] = saturate((r * g) >> 15);
+        }
+        voice_advance(v, s, take);
+    }
+    v->fade_len = n;
+    v->fade_pos = 0;
+    voice_end(v);
+}
+
+static void mix_span(int16_t *out, const int16_t *src, uint32_t frames, int channels, int32_t gain) {
+    for (uint32_t i = 0; i < frames; i++) {
+        int32_t l = src[i * channels];
+        int32_t r = src[i * channels + channels - 1];
+        out[i * 2] = saturate(out[i * 2] + ((l * gain) >> 15));
+        out[i * 2 + 1] = saturate(out[i * 2 + 1] + ((r * gain) >> 15));
+    }
+}
+
+static void mix_voice(voice_t *v, int16_t *out, uint32_t frames, int64_t now) {
+    if (v->fade_pos < v->fade_len) {
+        uint32_t n = v->fade_len - v->fade_pos;
+        if (n > frames) {
+            n = frames;
+        }
+        for (uint32_t i = 0; i < n * 2; i++) {
+            out[i] = saturate(out[i] + v->fade[v->fade_pos * 2 + i]);
+        }
+        v->fade_pos += n;
+    }
+    if (!v->active) {
+        return;
+    }
+
+    const slot_t *s = &s_slots[v->slot];
+    uint32_t done = 0;
+    while (done < frames && v->frame < v->frames) {
+        uint32_t avail;
+        const int16_t *src = voice_span(v, s, &avail);
+        if (!src) {
+            // Picks up where it left off once the chunk arrives
+            s_stats.late_blocks++;
+            break;
+        }
+        uint32_t take = frames - done;
+        if (take > avail) {
+            take = avail;
+        }
+        if (take > v->frames - v->frame) {
+            take = v->frames - v->frame;
+        }
+        mix_span(out + done * 2, src, take, s->channels, v->gain);
+        voice_advance(v, s, take);
+        done += take;
+    }
+
+    if (v->trigger_us) {
+        uint32_t us = (uint32_t)(now - v->trigger_us);
+        v->trigger_us = 0;
+        s_stats.latency_count++;
+        s_stats.latency_last_us = us;
+        s_stats.latency_sum_us += us;
+        if (us > s_stats.latency_max_us) {
+            s_stats.latency_max_us = us;
+        }
+    }
+    if (v->frame >= v->frames) {
+        voice_end(v);
+    }
+}
+
+void oneshot_mix(int16_t *pcm, uint32_t frames) {
+    if (!s_lock) {
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int64_t now = esp_timer_get_time();
+    s_stats.block_frames = frames;
+    for (int i = 0; i < ONESHOT_VOICES; i++) {
+        mix_voice(&s_voices[i], pcm, frames, now);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+// Fill the voices' free chunks, one SD read at a time, most behind first
+static void oneshot_stream_task(void *arg) {
+    FILE *files[ONESHOT_VOICES] = {0};
+    uint32_t file_gen[ONESHOT_VOICES] = {0};
+
+    for (;;) {
+        xSemaphoreTake(s_wake, pdMS_TO_TICKS(ONESHOT_STREAM_POLL_MS));
+        for (;;) {
+            // The voice with the fewest chunks ready and room for one
+            int pick = -1;
+            uint32_t fewest = ONESHOT_CHUNKS;
+            slot_t slot;
+            uint32_t gen = 0, at = 0, frames = 0;
+            int16_t *pcm = NULL;
+            xSemaphoreTake(s_lock, portMAX_DELAY);
+            for (int i = 0; i < ONESHOT_VOICES; i++) {
+                voice_t *v = &s_voices[i];
+                uint32_t ready = v->head - v->tail;
+                if (v->active && v->stream_frame < v->frames && ready < fewest) {
+                    pick = i;
+                    fewest = ready;
+                }
+            }
+            if (pick >= 0) {
+                voice_t *v = &s_voices[pick];
+                slot = s_slots[v->slot];
+                gen = v->gen;
+                at = v->stream_frame;
+                frames = ONESHOT_CHUNK_BYTES / slot.block_align;
+                if (frames > v->frames - at) {
+                    frames = v->frames - at;
+                }
+                pcm = v->chunks[v->head % ONESHOT_CHUNKS].pcm;
+            }
+            xSemaphoreGive(s_lock);
+            if (pick < 0) {
+                break;
+            }
+
+            size_t got = 0;
+            sd_arbiter_begin(SD_IO_PLAYBACK);
+            if (files[pick] && file_gen[pick] != gen) {
+                fclose(files[pick]);
+                files[pick] = NULL;
+            }
+            if (!files[pick]) {
+                files[pick] = fopen(slot.file_path, "rb");
+                file_gen[pick] = gen;
+            }
+            if (files[pick] && fseek(files[pick], slot.data_offset + at * slot.block_align, SEEK_SET) == 0) {
+                got = fread(pcm, slot.block_align, frames, files[pick]);
+            }
+            sd_arbiter_end(SD_IO_PLAYBACK);
+
+            xSemaphoreTake(s_lock, portMAX_DELAY);
+            voice_t *v = &s_voices[pick];
+            if (v->gen == gen) {
+                if (got > 0) {
+                    v->chunks[v->head % ONESHOT_CHUNKS].frames = got;
+                    v->head++;
+                    v->stream_frame += got;
+                } else {
+                    // Play what's there and stop
+                    v->frames = v->stream_frame;
+                }
+            }
+            xSemaphoreGive(s_lock);
+            if (got == 0) {
+                ESP_LOGW(TAG, "Can't read %s at frame %lu", slot.file_path, (unsigned long)at);
+            }
+        }
+    }
+}
+
+esp_err_t oneshot_init(void) {
+    if (s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (int i = 0; i < ONESHOT_VOICES; i++) {
+        for (int c = 0; c < ONESHOT_CHUNKS; c++) {
+            s_voices[i].chunks[c].pcm = heap_tracker_malloc(ONESHOT_CHUNK_BYTES, MALLOC_CAP_SPIRAM);
+            if (!s_voices[i].chunks[c].pcm) {
+                ESP_LOGE(TAG, "Failed to allocate stream chunks");
+                return ESP_ERR_NO_MEM;
+            }
+        }
+    }
+    s_lock = xSemaphoreCreateMutex();
+    s_wake = xSemaphoreCreateBinary();
+    if (!s_lock || !s_wake) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Core 1 with the track readers, under the decoders
+    if (xTaskCreatePinnedToCore(oneshot_stream_task, "oneshot_stream", 3072, NULL, 10, NULL, 1) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create stream task");
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "%d voices, %d slots, %d ms of each in RAM", ONESHOT_VOICES, ONESHOT_SLOTS, ONESHOT_ATTACK_MS);
+    return ESP_OK;
+}
+
+static void slot_release(const slot_t *s) {
+    if (s->mapped) {
+        flash_store_release();
+    } else {
+        free(s->attack);
+    }
+}
+
+// A file in the flash store is already in memory: play all of it from
+// there, with nothing to copy or stream
+static bool slot_map(slot_t *s, const char *path) {
+    const void *data;
+    size_t size;
+    if (flash_store_find(path, &data, &size) != ESP_OK) {
+        return false;
+    }
+    uintptr_t pcm = (uintptr_t)data + s->data_offset;
+    if ((uint64_t)s->data_offset + (uint64_t)s->frames * s->block_align > size || pcm % sizeof(int16_t)) {
+        flash_store_release();
+        return false;
+    }
+    s->attack = (int16_t *)pcm;
+    s->attack_frames = s->frames;
+    s->mapped = true;
+    return true;
+}
+
+esp_err_t oneshot_load(int slot, const char *path) {
+    if (slot < 0 || slot >= ONESHOT_SLOTS || !path || strlen(path) >= sizeof(s_slots[0].file_path)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    slot_t loaded = { .loaded = true };
+    wav_header_info_t wav;
+    FILE *f;
+    sd_arbiter_begin(SD_IO_METADATA);
+    esp_err_t err = wav_header_open(path, &f, &wav);
+    if (err == ESP_ERR_INVALID_ARG) {
+        err = ESP_ERR_NOT_SUPPORTED;
+    }
+    if (f) {
+        if (err == ESP_OK && (wav.format != 1 || wav.bits_per_sample != WAV_NATIVE_BITS ||
+                              wav.sample_rate != WAV_NATIVE_SAMPLE_RATE || wav.channels < 1 ||
+                              wav.channels > 2)) {
+            err = ESP_ERR_NOT_SUPPORTED;
+        }
+        if (err == ESP_OK) {
+            loaded.channels = wav.channels;
+            loaded.block_align = wav.block_align;
+            loaded.data_offset = wav.data_offset;
+            loaded.frames = wav.data_size / wav.block_align;
+            loaded.attack_frames = WAV_NATIVE_SAMPLE_RATE * ONESHOT_ATTACK_MS / 1000;
+            if (loaded.attack_frames > loaded.frames) {
+                loaded.attack_frames = loaded.frames;
+            }
+            if (loaded.frames == 0) {
+                err = ESP_ERR_INVALID_SIZE;
+            }
+        }
+        if (err == ESP_OK && !slot_map(&loaded, path)) {
+            loaded.attack = heap_tracker_malloc(loaded.attack_frames * loaded.block_align, MALLOC_CAP_SPIRAM);
+            if (!loaded.attack) {
+                err = ESP_ERR_NO_MEM;
+            } else if (fread(loaded.attack, loaded.block_align, loaded.attack_frames, f) != loaded.attack_frames) {
+                err = ESP_ERR_INVALID_SIZE;
+            }
+        }
+        fclose(f);
+    }
+    sd_arbiter_end(SD_IO_METADATA);
+    if (err != ESP_OK) {
+        slot_release(&loaded);
+        return err;
+    }
+    strcpy(loaded.file_path, path);
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < ONESHOT_VOICES; i++) {
+        if (s_voices[i].active && s_voices[i].slot == slot) {
+            voice_fade(&s_voices[i]);
+        }
+    }
+    // The fades were taken from the old attack, copied out above
+    slot_t old = s_slots[slot];
+    s_slots[slot] = loaded;
+    xSemaphoreGive(s_lock);
+    slot_release(&old);
+
+    ESP_LOGI(TAG, "Slot %d: %s, %lu frames, %lu in %s", slot, path, (unsigned long)loaded.frames,
+             (unsigned long)loaded.attack_frames, loaded.mapped ? "mapped flash" : "RAM");
+    return ESP_OK;
+}
+
+esp_err_t oneshot_unload(int slot) {
+    if (slot < 0 || slot >= ONESHOT_SLOTS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < ONESHOT_VOICES; i++) {
+        if (s_voices[i].active && s_voices[i].slot == slot) {
+            voice_fade(&s_voices[i]);
+        }
+    }
+    slot_t old = s_slots[slot];
+    memset(&s_slots[slot], 0, sizeof(s_slots[slot]));
+    xSemaphoreGive(s_lock);
+    slot_release(&old);
+    return ESP_OK;
+}
+
+esp_err_t oneshot_trigger(int slot, float gain_db, int *voice_o) {
+    int64_t now = esp_timer_get_time();
+    if (slot < 0 || slot >= ONESHOT_SLOTS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    const slot_t *s = &s_slots[slot];
+    if (!s->loaded) {
+        xSemaphoreGive(s_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // A free voice, or the one that started first
+    int pick = 0;
+    for (int i = 0; i < ONESHOT_VOICES; i++) {
+        if (!s_voices[i].active) {
+            pick = i;
+            break;
+        }
+        if (s_voices[i].started < s_voices[pick].started) {
+            pick = i;
+        }
+    }
+    voice_t *v = &s_voices[pick];
+    if (v->active) {
+        voice_fade(v);
+        s_stats.steals++;
+    }
+    v->active = true;
+    v->slot = slot;
+    v->gen++;
+    v->frame = 0;
+    v->frames = s->frames;
+    v->gain_db = gain_db;
+    v->gain = gain_q15(gain_db);
+    v->trigger_us = now;
+    v->started = ++s_started;
+    v->head = 0;
+    v->tail = 0;
+    v->chunk_pos = 0;
+    v->stream_frame = s->attack_frames;
+    s_stats.triggers++;
+    bool streams = s->frames > s->attack_frames;
+    xSemaphoreGive(s_lock);
+
+    if (streams) {
+        xSemaphoreGive(s_wake);
+    }
+    if (voice_o) {
+        *voice_o = pick;
+    }
+    return ESP_OK;
+}
+
+void oneshot_stop_all(void) {
+    if (!s_lock) {
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < ONESHOT_VOICES; i++) {
+        if (s_voices[i].active) {
+            voice_fade(&s_voices[i]);
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
+
+esp_err_t oneshot_get_slot(int slot, oneshot_slot_info_t *info) {
+    if (slot < 0 || slot >= ONESHOT_SLOTS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    const slot_t *s = &s_slots[slot];
+    info->loaded = s->loaded;
+    strcpy(info->file_path, s->file_path);
+    info->channels = s->channels;
+    info->frames = s->frames;
+    info->attack_frames = s->attack_frames;
+    xSemaphoreGive(s_lock);
+    return ESP_OK;
+}
+
+esp_err_t oneshot_get_voice(int voice, oneshot_voice_info_t *info) {
+    if (voice < 0 || voice >= ONESHOT_VOICES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    const voice_t *v = &s_voices[voice];
+    info->active = v->active;
+    info->slot = v->active ? v->slot : -1;
+    info->frame = v->frame;
+    info->gain_db = v->gain_db;
+    xSemaphoreGive(s_lock);
+    return ESP_OK;
+}
+
+void oneshot_get_stats(oneshot_stats_t *stats) {
+    if (!s_lock) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *stats = s_stats;
+    xSemaphoreGive(s_lock);
+}
+
+uint32_t oneshot_output_latency_frames(void) {
+    // The correction filter is after the mix
+    convolver_info_t correction;
+    convolver_get_info(&correction);
+    return PLAYHEAD_DMA_FRAMES + correction.latency_frames;
+}
@@ -0,0 +1,121 @@
+#ifndef ONESHOT_H
+#define ONESHOT_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// One-shot sounds fired on demand, mixed over the loops.
+//
+// A track takes a stop, reset, set_uri and run to start, and then the
+// decoder's start-up before its first sample reaches downmix. A one-shot
+// doesn't go through a pipeline at all: samples are loaded into slots ahead
+// of time, with the first ONESHOT_ATTACK_MS of each kept in RAM, and a
+// trigger hands a slot to a voice. The voices are mixed into the master
+// bus as I2S reads it, after downmix and its buffer, so the first samples
+// go out with the next block I2S takes. The rest of the
+// sample is streamed from SD by a low priority task into a few chunks per
+// voice while the attack plays. A /flash sample is already in memory: the
+// slot points at the whole of it in the mapped partition, and nothing is
+// copied or streamed.
+//
+// There are ONESHOT_VOICES voices. A trigger with none free takes the one
+// that has played longest, which fades out over ONESHOT_STEAL_FADE_FRAMES
+// rather than click.
+//
+// Slots take PCM WAV at the output rate, 16 bit, mono or stereo.
+
+#define ONESHOT_SLOTS               8
+#define ONESHOT_VOICES              4
+#define ONESHOT_ATTACK_MS           250         // of each slot held in RAM
+#define ONESHOT_CHUNK_BYTES         4096        // streamed per SD read
+#define ONESHOT_CHUNKS              4           // per voice
+#define ONESHOT_STEAL_FADE_FRAMES   64
+#define ONESHOT_STREAM_POLL_MS      20
+#define ONESHOT_GAIN_MIN_DB         -60.0f
+#define ONESHOT_GAIN_MAX_DB         6.0f
+
+typedef struct {
+    bool loaded;
+    char file_path[256];
+    uint16_t channels;
+    uint32_t frames;                // in the whole sample
+    uint32_t attack_frames;         // of those held in RAM, all of them from /flash
+} oneshot_slot_info_t;
+
+typedef struct {
+    bool active;
+    int slot;
+    uint32_t frame;                 // mixed so far
+    float gain_db;
+} oneshot_voice_info_t;
+
+typedef struct {
+    uint32_t triggers;
+    uint32_t steals;
+    uint32_t late_blocks;           // blocks a voice had nothing streamed in time to play
+    uint32_t latency_count;         // triggers measured below
+    uint32_t latency_last_us;       // trigger to first mixed
+    uint32_t latency_max_us;
+    uint64_t latency_sum_us;
+    uint32_t block_frames;          // the last block I2S read
+} oneshot_stats_t;
+
+/**
+ * @brief Allocate the voices and start the streaming task
+ */
+esp_err_t oneshot_init(void);
+
+/**
+ * @brief Master bus stage: the voices on top of interleaved stereo, in place
+ *
+ * Does nothing before oneshot_init().
+ */
+void oneshot_mix(int16_t *pcm, uint32_t frames);
+
+/**
+ * @brief Load a file into a slot, replacing what was there
+ *
+ * Voices playing the slot are stopped. Reads the header and the attack
+ * from the card, so it takes a few tens of ms.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for a bad slot, ESP_ERR_NOT_FOUND,
+ *         ESP_ERR_NOT_SUPPORTED if the file isn't PCM WAV at the output
+ *         rate, ESP_ERR_NO_MEM
+ */
+esp_err_t oneshot_load(int slot, const char *path);
+
+/**
+ * @brief Empty a slot, stopping its voices
+ */
+esp_err_t oneshot_unload(int slot);
+
+/**
+ * @brief Play a slot from its start
+ *
+ * Only takes a lock the mixer holds for one block at most, so it can be
+ * called from a sensor or network task.
+ *
+ * @param gain_db Clamped to ONESHOT_GAIN_MIN_DB..ONESHOT_GAIN_MAX_DB, NaN is the minimum
+ * @param voice_o The voice it got, may be NULL
+ * @return ESP_OK, ESP_ERR_INVALID_ARG, ESP_ERR_INVALID_STATE if the slot
+ *         is empty or the engine isn't running
+ */
+esp_err_t oneshot_trigger(int slot, float gain_db, int *voice_o);
+
+/**
+ * @brief Fade out every voice
+ */
+void oneshot_stop_all(void);
+
+esp_err_t oneshot_get_slot(int slot, oneshot_slot_info_t *info);
+esp_err_t oneshot_get_voice(int voice, oneshot_voice_info_t *info);
+void oneshot_get_stats(oneshot_stats_t *stats);
+
+/**
+ * @brief Samples from the mix to the DAC, estimated: the DMA queued ahead of a mixed block,
+ *        and the correction filter's delay when one is loaded
+ */
+uint32_t oneshot_output_latency_frames(void);
+
+#endif /* ONESHOT_H */
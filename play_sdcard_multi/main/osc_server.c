@@ -0,0 +1,181 @@
+/* OSC listener for the one-shot voices, see osc_server.h
+
+   OSC 1.0: a message is its address and a type tag string, each NUL
+   terminated and padded to 4 bytes, then big endian arguments. A bundle
+   is "#bundle", an 8 byte time tag, and size prefixed elements; the time
+   tag is ignored, everything plays on arrival.
+
+   Author: Brian Bulkowski brian@bulkowski.org
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "oneshot.h"
+#include "osc_server.h"
+
+static const char *TAG = "OSC";
+
+#define OSC_MAX_DEPTH   4       // bundles in bundles
+
+static atomic_uint s_packets;
+static atomic_uint s_triggers;
+static atomic_uint s_dropped;
+
+static uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Length of the padded string at p, 0 if it runs off the end
+static int osc_string(const uint8_t *p, int len) {
+    const uint8_t *nul = memchr(p, 0, len);
+    if (!nul) {
+        return 0;
+    }
+    int n = (nul - p + 4) & ~3;
+    return n <= len ? n : 0;
+}
+
+static bool osc_message(const uint8_t *p, int len) {
+    int addr_len = osc_string(p, len);
+    if (addr_len == 0) {
+        return false;
+    }
+    const char *addr = (const char *)p;
+    const char *tags = ",";
+    int pos = addr_len;
+    // Type tags are optional in old senders
+    if (pos < len && p[pos] == ',') {
+        int tags_len = osc_string(p + pos, len - pos);
+        if (tags_len == 0) {
+            return false;
+        }
+        tags = (const char *)p + pos;
+        pos += tags_len;
+    }
+
+    // Numbers only, which is all that's understood
+    float args[2];
+    int n_args = 0;
+    for (const char *t = tags + 1; *t; t++) {
+        if ((*t != 'i' && *t != 'f') || pos + 4 > len || n_args == 2) {
+            return false;
+        }
+        uint32_t v = get_be32(p + pos);
+        if (*t == 'i') {
+            args[n_args++] = (float)(int32_t)v;
+        } else {
+            float f;
+            memcpy(&f, &v, sizeof(f));
+            if (!isfinite(f)) {
+                return false;
+            }
+            args[n_args++] = f;
+        }
+        pos += 4;
+    }
+
+    if (strcmp(addr, "/oneshot/trigger") == 0 && n_args >= 1) {
+        // In range before the cast, which is undefined for a float past int
+        if (!(args[0] >= 0 && args[0] < ONESHOT_SLOTS)) {
+            ESP_LOGW(TAG, "Trigger slot %g out of range", args[0]);
+            return false;
+        }
+        esp_err_t err = oneshot_trigger((int)args[0], n_args > 1 ? args[1] : 0.0f, NULL);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Trigger slot %d: %s", (int)args[0], esp_err_to_name(err));
+            return false;
+        }
+        atomic_fetch_add(&s_triggers, 1);
+        return true;
+    }
+    if (strcmp(addr, "/oneshot/stop") == 0) {
+        oneshot_stop_all();
+        return true;
+    }
+    return false;
+}
+
+static bool osc_packet(const uint8_t *p, int len, int depth) {
+    if (len < 8 || (len & 3)) {
+        return false;
+    }
+    if (memcmp(p, "#bundle", 8) != 0) {
+        return osc_message(p, len);
+    }
+    if (depth >= OSC_MAX_DEPTH || len < 16) {
+        return false;
+    }
+    bool ok = true;
+    for (int pos = 16; pos < len;) {
+        if (pos + 4 > len) {
+            return false;
+        }
+        uint32_t size = get_be32(p + pos);
+        pos += 4;
+        if (size > (uint32_t)(len - pos)) {
+            return false;
+        }
+        ok &= osc_packet(p + pos, size, depth + 1);
+        pos += size;
+    }
+    return ok;
+}
+
+static void osc_server_task(void *arg) {
+    int sock = (int)(intptr_t)arg;
+    uint8_t packet[OSC_SERVER_MAX_PACKET];
+    for (;;) {
+        int len = recv(sock, packet, sizeof(packet), 0);
+        if (len < 0) {
+            ESP_LOGE(TAG, "recv failed, errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            continue;
+        }
+        atomic_fetch_add(&s_packets, 1);
+        if (!osc_packet(packet, len, 0)) {
+            atomic_fetch_add(&s_dropped, 1);
+        }
+    }
+}
+
+esp_err_t osc_server_init(void) {
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Failed to create socket, errno %d", errno);
+        return ESP_FAIL;
+    }
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(OSC_SERVER_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        ESP_LOGE(TAG, "Failed to bind UDP port %d, errno %d", OSC_SERVER_PORT, errno);
+        close(sock);
+        return ESP_FAIL;
+    }
+
+    // Core 0 with the network, above httpd: a trigger shouldn't wait on a page
+    if (xTaskCreatePinnedToCore(osc_server_task, "osc_server", 3072, (void *)(intptr_t)sock, 6, NULL, 0) !=
+        pdPASS) {
+        ESP_LOGE(TAG, "Failed to create OSC task");
+        close(sock);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Listening for OSC on UDP port %d", OSC_SERVER_PORT);
+    return ESP_OK;
+}
+
+void osc_server_get_stats(osc_server_stats_t *stats) {
+    stats->packets = atomic_load(&s_packets);
+    stats->triggers = atomic_load(&s_triggers);
+    stats->dropped = atomic_load(&s_dropped);
+}
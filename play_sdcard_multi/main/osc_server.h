@@ -0,0 +1,32 @@
+#ifndef OSC_SERVER_H
+#define OSC_SERVER_H
+
+#include "esp_err.h"
+#include <stdint.h>
+
+// Open Sound Control over UDP, for show controllers and sensors on the
+// network. HTTP takes a TCP connection and a JSON parse per trigger; a
+// datagram here goes straight to oneshot_trigger().
+//
+// Messages, bundles may hold any of them:
+//   /oneshot/trigger  i slot [f|i gain_db]
+//   /oneshot/stop
+// Anything else is counted and dropped.
+
+#define OSC_SERVER_PORT         9000
+#define OSC_SERVER_MAX_PACKET   512
+
+typedef struct {
+    uint32_t packets;
+    uint32_t triggers;
+    uint32_t dropped;               // malformed or not ours
+} osc_server_stats_t;
+
+/**
+ * @brief Listen for OSC on OSC_SERVER_PORT
+ */
+esp_err_t osc_server_init(void);
+
+void osc_server_get_stats(osc_server_stats_t *stats);
+
+#endif /* OSC_SERVER_H */
@@ -58,8 +58,19 @@
 #include "wifi_manager.h"
 #include "http_server.h"
 #include "config_manager.h"
+#include "flash_store.h"
+#include "shared_read.h"
+#include "track_reader.h"
+#include "sd_arbiter.h"
+#include "playhead.h"
+#include "flight_recorder.h"
+#include "osc_server.h"
+#include "task_profiler.h"
 #include <math.h>  // For log10f
 #include "esp_heap_caps.h"
+#include "heap_tracker.h"
+#include "log_buffer.h"
+#include "audio_analysis.h"
 
 static const char *TAG = "PLAY_SDCARD";
 
@@ -181,6 +192,7 @@ esp_err_t audio_stream_init(audio_stream_t **stream_o) {
     // Link downmix to I2S
     const char *link_tag[2] = {"downmix", "i2s"};
     audio_pipeline_link(stream->pipeline, link_tag, 2);
+    stream->output_rb = audio_element_get_output_ringbuf(stream->downmix_e);
 
     // Initialize source info for downmix
     esp_downmix_input_info_t source_info[MAX_TRACKS];
@@ -205,11 +217,10 @@ esp_err_t audio_stream_init(audio_stream_t **stream_o) {
             return ESP_FAIL;
         }
         
-        // Create fatfs reader
-        fatfs_stream_cfg_t fatfs_cfg = FATFS_STREAM_CFG_DEFAULT();
-        fatfs_cfg.type = AUDIO_STREAM_READER;
-        fatfs_cfg.task_core = 1;  // Run on APP CPU (core 1) to avoid WiFi conflicts
-        stream->tracks[i].fatfs_e = fatfs_stream_init(&fatfs_cfg);
+        // Create the file reader; fatfs_stream would skip the /shared and /flash VFS
+        track_reader_cfg_t reader_cfg = TRACK_READER_CFG_DEFAULT();
+        reader_cfg.task_core = 1;  // Run on APP CPU (core 1) to avoid WiFi conflicts
+        stream->tracks[i].fatfs_e = track_reader_init(&reader_cfg);
         
 #if 0
         // Create decoder with auto-detection for multiple formats
@@ -260,6 +271,15 @@ void audio_control_start(audio_stream_t *stream) {
     debug_downmix_element(stream);
 }
 
+// Convert volume percent to dB gain
+// 100% = 0dB, 50% = -6dB, 25% = -12dB, 0% = -60dB
+static float volume_to_gain_db(int volume) {
+    if (volume <= 0) {
+        return -60.0f;  // Effectively mute
+    }
+    return 20.0f * log10f(volume / 100.0f);
+}
+
 void audio_control_set_gain(audio_stream_t *stream, int track_index, float gain_db) {
     if (track_index < 0 || track_index >= MAX_TRACKS) {
         ESP_LOGE(TAG, "Invalid track index: %d", track_index);
@@ -370,7 +390,7 @@ void audio_control_task(void *pvParameters)
     audio_stream_init_with_passthrough(&stream);
     
     // Initialize loop tracking state
-    loop_manager_t *loop_manager = heap_caps_calloc(1, sizeof(loop_manager_t), MALLOC_CAP_SPIRAM);
+    loop_manager_t *loop_manager = heap_tracker_calloc(1, sizeof(loop_manager_t), MALLOC_CAP_SPIRAM);
     if (!loop_manager) {
         ESP_LOGE(TAG, "Failed to allocate loop manager");
         return;
@@ -381,9 +401,15 @@ void audio_control_task(void *pvParameters)
     for (int i = 0; i < MAX_TRACKS; i++) {
         loop_manager->loops[i].is_playing = false;
         loop_manager->loops[i].volume_percent = 100;  // Default to 100% (0dB)
+        loop_manager->loops[i].normalize_gain_db = 0.0f;
         loop_manager->loops[i].track_index = i;
     }
 
+    // Uploads wait for the tracks' buffers from here on
+    if (sd_arbiter_init(stream, loop_manager) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to start SD arbiter");
+    }
+
     ESP_LOGI(TAG, "audio_control: Initialize HTTP server");
     // Initialize HTTP server for remote control
     esp_err_t http_ret = http_server_init(stream, control_queue);
@@ -395,6 +421,21 @@ void audio_control_task(void *pvParameters)
     } else {
         ESP_LOGW(TAG, "Failed to initialize HTTP server: %s", esp_err_to_name(http_ret));
     }
+
+    // One-shot triggers from show controllers
+    if (osc_server_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to start OSC server");
+    }
+
+    // Background per task CPU and stack profile, served at /api/perf/tasks
+    if (task_profiler_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to start task profiler");
+    }
+
+    // Start the glitch flight recorder, captures are served over HTTP
+    if (flight_recorder_init(stream, loop_manager) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to start flight recorder");
+    }
     
     ESP_LOGI(TAG, "audio_control: Load configuration (from file or default)");
     
@@ -481,8 +522,22 @@ void audio_control_task(void *pvParameters)
                         audio_pipeline_reset_ringbuffer(stream->tracks[track].pipeline);
                         audio_pipeline_reset_elements(stream->tracks[track].pipeline);
                         
-                        // Set new file path
-                        audio_element_set_uri(stream->tracks[track].fatfs_e, msg.data.start_track.file_path);
+                        // Set new file path, read through the shared cache in case another track plays it too
+                        char shared_path[256];
+                        audio_element_set_uri(stream->tracks[track].fatfs_e,
+                            shared_read_path(msg.data.start_track.file_path, shared_path, sizeof(shared_path)));
+                        playhead_start(track, 0);
+                        
+                        // Loudness normalisation from the upload analysis, if the file has one
+                        audio_analysis_result_t analysis;
+                        float normalize_db = 0.0f;
+                        if (audio_analysis_load(msg.data.start_track.file_path, &analysis) == ESP_OK) {
+                            normalize_db = audio_analysis_normalize_gain_db(&analysis);
+                            ESP_LOGI(TAG, "Track %d normalize %+.1f dB", track, normalize_db);
+                        }
+                        loop_manager->loops[track].normalize_gain_db = normalize_db;
+                        audio_control_set_gain(stream, track,
+                            volume_to_gain_db(loop_manager->loops[track].volume_percent) + normalize_db);
                         
                         // Start the track
                         audio_pipeline_run(stream->tracks[track].pipeline);
@@ -491,6 +546,8 @@ void audio_control_task(void *pvParameters)
                         // Log memory after starting track
                         log_memory_info("After starting track");
                         
+                        flight_recorder_note_event(FR_EVENT_TRACK_START, track);
+                        
                         // Update loop manager state
                         loop_manager->loops[track].is_playing = true;
                         strncpy(loop_manager->loops[track].file_path, msg.data.start_track.file_path, 
@@ -499,6 +556,40 @@ void audio_control_task(void *pvParameters)
                     break;
                 }
 
+                case AUDIO_ACTION_SEEK_TRACK: {
+                    int track = msg.data.seek_track.track_index;
+                    ESP_LOGI(TAG, "Processing SEEK_TRACK action for track %d to sample %llu", track,
+                             (unsigned long long)msg.data.seek_track.sample);
+                    if (track >= 0 && track < MAX_TRACKS) {
+                        audio_pipeline_stop(stream->tracks[track].pipeline);
+                        audio_pipeline_wait_for_stop(stream->tracks[track].pipeline);
+                        audio_pipeline_reset_ringbuffer(stream->tracks[track].pipeline);
+                        audio_pipeline_reset_elements(stream->tracks[track].pipeline);
+                        
+                        // Same file and gain, read from the offset; loops go back to the start
+                        char shared_path[256];
+                        uint64_t sample = msg.data.seek_track.sample;
+                        const char *uri = shared_read_path_at(msg.data.seek_track.file_path,
+                            msg.data.seek_track.offset, shared_path, sizeof(shared_path));
+                        if (!uri) {
+                            ESP_LOGW(TAG, "Track %d can't seek in %s, playing from the start", track,
+                                     msg.data.seek_track.file_path);
+                            uri = shared_read_path(msg.data.seek_track.file_path, shared_path, sizeof(shared_path));
+                            sample = 0;
+                        }
+                        audio_element_set_uri(stream->tracks[track].fatfs_e, uri);
+                        playhead_start(track, sample);
+                        
+                        audio_pipeline_run(stream->tracks[track].pipeline);
+                        flight_recorder_note_event(FR_EVENT_TRACK_SEEK, track);
+                        
+                        loop_manager->loops[track].is_playing = true;
+                        strncpy(loop_manager->loops[track].file_path, msg.data.seek_track.file_path,
+                                sizeof(loop_manager->loops[track].file_path) - 1);
+                    }
+                    break;
+                }
+
                 case AUDIO_ACTION_STOP_TRACK: {
                     ESP_LOGI(TAG, "Processing STOP_TRACK action for track %d", msg.data.stop_track.track_index);
                     int track = msg.data.stop_track.track_index;
@@ -507,6 +598,7 @@ void audio_control_task(void *pvParameters)
                         audio_pipeline_wait_for_stop(stream->tracks[track].pipeline);
                         audio_pipeline_terminate(stream->tracks[track].pipeline);
                         ESP_LOGI(TAG, "Stopped track %d", track);
+                        flight_recorder_note_event(FR_EVENT_TRACK_STOP, track);
                         
                         // Update loop manager state - only change playing state, preserve file path
                         loop_manager->loops[track].is_playing = false;
@@ -516,26 +608,21 @@ void audio_control_task(void *pvParameters)
                 }
 
                 case AUDIO_ACTION_SET_VOLUME: {
-                    ESP_LOGI(TAG, "Processing SET_VOLUME action for track %d: %d%%", 
-                             msg.data.set_volume.track_index, msg.data.set_volume.volume_percent);
                     int track = msg.data.set_volume.track_index;
                     if (track >= 0 && track < MAX_TRACKS) {
                         int volume = msg.data.set_volume.volume_percent;
                         if (volume < 0) volume = 0;
                         if (volume > 100) volume = 100;
                         
-                        // Convert volume percent to dB gain
-                        // 100% = 0dB, 50% = -6dB, 25% = -12dB, 0% = -60dB
-                        float gain_db;
-                        if (volume == 0) {
-                            gain_db = -60.0f;  // Effectively mute
-                        } else {
-                            gain_db = 20.0f * log10f(volume / 100.0f);
-                        }
+                        float gain_db = volume_to_gain_db(volume);
+                        float normalize_db = loop_manager->loops[track].normalize_gain_db;
                         
-                        float gain[2] = {0.0f, gain_db};
+                        float gain[2] = {0.0f, gain_db + normalize_db};
                         downmix_set_gain_info(stream->downmix_e, gain, track);
-                        ESP_LOGI(TAG, "Set track %d volume to %d%% (%.1f dB)", track, volume, gain_db);
+                        ESP_LOGI(TAG, "Set track %d volume to %d%% (%.1f dB, normalize %+.1f dB)",
+                                 track, volume, gain_db, normalize_db);
+                        
+                        flight_recorder_note_event(FR_EVENT_SET_VOLUME, track);
                         
                         // Update loop manager state
                         loop_manager->loops[track].volume_percent = volume;
@@ -615,12 +702,12 @@ void audio_control_task(void *pvParameters)
                 // Detect when track has finished playing
                 if (at_end && !track_finished[i]) {
                     track_finished[i] = true;
-                    ESP_LOGI(TAG, "Track %d reached end of file, marking for restart", i);
+                    ESP_LOGD(TAG, "Track %d reached end of file, marking for restart", i);
                 }
                 
                 // Restart track if it's finished and pipeline is no longer running
                 if (track_finished[i] && (fatfs_state != AEL_STATE_RUNNING || decode_state != AEL_STATE_RUNNING)) {
-                    ESP_LOGI(TAG, "Track %d finished and stopped, restarting for loop", i);
+                    ESP_LOGD(TAG, "Track %d finished and stopped, restarting for loop", i);
                     
                     // Stop the pipeline completely
                     audio_pipeline_stop(stream->tracks[i].pipeline);
@@ -634,10 +721,14 @@ void audio_control_task(void *pvParameters)
                     const char *current_file = loop_manager->loops[i].file_path;
                     // Only restart if there's actually a file configured
                     if (strlen(current_file) > 0) {
-                        audio_element_set_uri(stream->tracks[i].fatfs_e, current_file);
+                        char shared_path[256];
+                        audio_element_set_uri(stream->tracks[i].fatfs_e,
+                            shared_read_path(current_file, shared_path, sizeof(shared_path)));
                         
                         // Restart pipeline
+                        playhead_loop(i);
                         audio_pipeline_run(stream->tracks[i].pipeline);
+                        flight_recorder_note_event(FR_EVENT_TRACK_LOOP, i);
                         
                         track_finished[i] = false;  // Reset the flag
                         ESP_LOGI(TAG, "Track %d restarted with file: %s", i, current_file);
@@ -699,12 +790,12 @@ void audio_control_task(void *pvParameters)
                             if ((int)evt_msg.data == AEL_STATUS_STATE_FINISHED ||
                                 (int)evt_msg.data == AEL_STATUS_INPUT_DONE) {
                                 should_restart = true;
-                                ESP_LOGI(TAG, "Track %d element reported finish (status=%d)", i, (int)evt_msg.data);
+                                ESP_LOGD(TAG, "Track %d element reported finish (status=%d)", i, (int)evt_msg.data);
                             }
                         }
                         
                         if (should_restart) {
-                            ESP_LOGI(TAG, "Track %d finished, restarting for loop", i);
+                            ESP_LOGD(TAG, "Track %d finished, restarting for loop", i);
                             
                             // Stop the pipeline first
                             audio_pipeline_stop(stream->tracks[i].pipeline);
@@ -714,8 +805,15 @@ void audio_control_task(void *pvParameters)
                             audio_pipeline_reset_ringbuffer(stream->tracks[i].pipeline);
                             audio_pipeline_reset_elements(stream->tracks[i].pipeline);
                             
+                            // From the start of the file, even if this pass began at a seek
+                            char shared_path[256];
+                            audio_element_set_uri(stream->tracks[i].fatfs_e,
+                                shared_read_path(loop_manager->loops[i].file_path, shared_path, sizeof(shared_path)));
+                            
                             // Restart the pipeline
+                            playhead_loop(i);
                             audio_pipeline_run(stream->tracks[i].pipeline);
+                            flight_recorder_note_event(FR_EVENT_TRACK_LOOP, i);
                             
                             ESP_LOGI(TAG, "Track %d restarted", i);
                             break;
@@ -750,6 +848,17 @@ void app_main(void)
     // wifis a little chatty too
     esp_log_level_set("wifi", ESP_LOG_WARN);
 
+    // From here on log lines are formatted and written by a low priority
+    // task instead of the caller, see log_buffer.c
+    if (log_buffer_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Deferred logging unavailable, logging directly");
+    }
+
+    // Start heap history early so the trend covers boot and WiFi bring-up
+    if (heap_tracker_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to start heap tracker");
+    }
+
 
     ESP_LOGI(TAG, "[ 0 ] Create control queue and start audio control task");
     // Create a queue to handle audio control messages
@@ -856,6 +965,13 @@ void app_main(void)
     // Initialize SD Card
     audio_board_sdcard_init(set, SD_MODE_1_LINE);
 
+    // Loops in the flash partition, if the partition table has one (partitions_audio.csv)
+    flash_store_init();
+    // Tracks read the card through here, so two playing one file share the reads
+    if (shared_read_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Shared reads unavailable");
+    }
+
     ESP_LOGI(TAG, "[ 3 ] Initialize buttons");
     audio_board_key_init(set);
 
@@ -894,7 +1010,7 @@ void app_main(void)
     audio_event_iface_set_listener(esp_periph_set_get_event_iface(set), periph_evt);
 
     // Start the audio control task - allocate params on heap so it persists
-    audio_control_parameters_t *params = heap_caps_malloc(sizeof(audio_control_parameters_t), MALLOC_CAP_DEFAULT);
+    audio_control_parameters_t *params = heap_tracker_malloc(sizeof(audio_control_parameters_t), MALLOC_CAP_DEFAULT);
     if (!params) {
         ESP_LOGE(TAG, "Failed to allocate memory for audio control parameters");
         vQueueDelete(audio_control_queue);
@@ -46,9 +46,10 @@
 
 typedef struct {
     audio_pipeline_handle_t pipeline;
-    audio_element_handle_t fatfs_e;
+    audio_element_handle_t fatfs_e;      // file reader, track_reader.c
     audio_element_handle_t decode_e;
     audio_element_handle_t raw_write_e;  // Raw stream passthrough element
+    ringbuf_handle_t mixer_rb;           // what downmix reads, the decoder writes it through playhead.c
 } audio_track_t;
 
 typedef struct 
@@ -56,6 +57,7 @@ typedef struct
     audio_pipeline_handle_t pipeline; // "output" pipeline has downmix and I2S in it
     audio_element_handle_t downmix_e;
     audio_element_handle_t i2s_e;
+    ringbuf_handle_t output_rb;       // downmix to I2S, which reads it through master_bus.c
     audio_track_t tracks[MAX_TRACKS];
 } audio_stream_t;
 
@@ -67,7 +69,8 @@ typedef enum {
     AUDIO_ACTION_START_TRACK,  // Start a specific track with file
     AUDIO_ACTION_STOP_TRACK,   // Stop a specific track
     AUDIO_ACTION_SET_VOLUME,   // Set volume for a track (0-100%)
-    AUDIO_ACTION_SET_GLOBAL_VOLUME // Set global/master volume (0-100%)
+    AUDIO_ACTION_SET_GLOBAL_VOLUME, // Set global/master volume (0-100%)
+    AUDIO_ACTION_SEEK_TRACK    // Start a track's file part way in
     // Add other audio control actions as needed
 } audio_action_type_t;
 
@@ -77,6 +80,13 @@ typedef struct {
     char file_path[256];
 } track_start_data_t;
 
+typedef struct {
+    int track_index;
+    char file_path[256];
+    uint32_t offset;        // byte of the file to read from, see playhead_locate()
+    uint64_t sample;        // the sample that is
+} track_seek_data_t;
+
 typedef struct {
     int track_index;
 } track_stop_data_t;
@@ -94,6 +104,7 @@ typedef struct {
     audio_action_type_t type;
     union {
         track_start_data_t start_track;
+        track_seek_data_t seek_track;
         track_stop_data_t stop_track;
         track_volume_data_t set_volume;
         global_volume_data_t set_global_volume;
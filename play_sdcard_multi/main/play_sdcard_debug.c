@@ -45,13 +45,20 @@
 #include <sys/stat.h>
 
 #include "play_sdcard.h"
+#include "playhead.h"
+#include "master_bus.h"
+#include "sd_arbiter.h"
+#include "wav_header.h"
 
 static const char *TAG = "PLAY_SDCARD_DEBUG";
 
 // Function to check if file exists and get its size
 esp_err_t check_file_exists(const char *path) {
     struct stat file_stat;
-    if (stat(path, &file_stat) == -1) {
+    sd_arbiter_begin(SD_IO_METADATA);
+    int ret = stat(path, &file_stat);
+    sd_arbiter_end(SD_IO_METADATA);
+    if (ret == -1) {
     ESP_LOGD(TAG, "File does not exist: %s", path);
         return ESP_FAIL;
     }
@@ -61,57 +68,40 @@ esp_err_t check_file_exists(const char *path) {
 
 // Function to read and validate WAV header
 esp_err_t validate_wav_header(const char *path) {
+    sd_arbiter_begin(SD_IO_METADATA);
     FILE *file = fopen(path, "rb");
     if (!file) {
+        sd_arbiter_end(SD_IO_METADATA);
     ESP_LOGD(TAG, "Failed to open file: %s", path);
         return ESP_FAIL;
     }
-    
-    // WAV header structure
-    struct {
-        char riff[4];      // "RIFF"
-        uint32_t size;     // File size - 8
-        char wave[4];      // "WAVE"
-        char fmt[4];       // "fmt "
-        uint32_t fmt_size; // Format chunk size
-        uint16_t format;   // Audio format (1 = PCM)
-        uint16_t channels; // Number of channels
-        uint32_t sample_rate; // Sample rate
-        uint32_t byte_rate;   // Byte rate
-        uint16_t block_align; // Block align
-        uint16_t bits_per_sample; // Bits per sample
-    } wav_header;
-    
-    size_t read = fread(&wav_header, 1, 36, file);
+
+    wav_header_info_t info;
+    esp_err_t err = wav_header_parse(file, &info);
     fclose(file);
-    
-    if (read < 36) {
-    ESP_LOGD(TAG, "File too small to be a valid WAV: %s", path);
-        return ESP_FAIL;
-    }
-    
-    // Check RIFF header
-    if (strncmp(wav_header.riff, "RIFF", 4) != 0) {
-    ESP_LOGD(TAG, "Invalid RIFF header in %s: %.4s", path, wav_header.riff);
+    sd_arbiter_end(SD_IO_METADATA);
+
+    if (err != ESP_OK) {
+    ESP_LOGD(TAG, "Invalid WAV file %s: %s", path, esp_err_to_name(err));
         return ESP_FAIL;
     }
-    
-    // Check WAVE format
-    if (strncmp(wav_header.wave, "WAVE", 4) != 0) {
-    ESP_LOGD(TAG, "Invalid WAVE format in %s: %.4s", path, wav_header.wave);
-        return ESP_FAIL;
+
+    ESP_LOGD(TAG, "WAV file %s: format=%d, channels=%d, sample_rate=%lu, bits=%d, data at %lu",
+             path, info.format, info.channels,
+             (unsigned long)info.sample_rate, info.bits_per_sample,
+             (unsigned long)info.data_offset);
+
+    // Plays either way, but costs a conversion or split sector reads.
+    // device-manager/asset_conditioner.py writes files that are neither.
+    if (!wav_header_is_native(&info)) {
+        ESP_LOGW(TAG, "%s is not %d Hz %d bit stereo PCM, it will be converted while playing",
+                 path, WAV_NATIVE_SAMPLE_RATE, WAV_NATIVE_BITS);
     }
-    
-    // Check fmt chunk
-    if (strncmp(wav_header.fmt, "fmt ", 4) != 0) {
-    ESP_LOGD(TAG, "Invalid fmt chunk in %s: %.4s", path, wav_header.fmt);
-        return ESP_FAIL;
+    if (info.data_offset % WAV_DATA_ALIGN) {
+        ESP_LOGW(TAG, "%s: data starts at %lu, not on a %d byte sector",
+                 path, (unsigned long)info.data_offset, WAV_DATA_ALIGN);
     }
-    
-    ESP_LOGD(TAG, "WAV file %s: format=%d, channels=%d, sample_rate=%lu, bits=%d", 
-             path, wav_header.format, wav_header.channels, 
-             (unsigned long)wav_header.sample_rate, wav_header.bits_per_sample);
-    
+
     return ESP_OK;
 }
 
@@ -215,8 +205,11 @@ void audio_control_start_debug_v2(audio_stream_t *stream) {
             continue;
         }
         
-        // Set it as the decoder's output
-        audio_element_set_output_ringbuf(stream->tracks[i].decode_e, rb);
+        // The decoder writes it through the playhead's sample counter
+        stream->tracks[i].mixer_rb = rb;
+        if (playhead_attach(stream, i) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to attach playhead for track %d", i);
+        }
         
         // Connect it to downmix input
         downmix_set_input_rb(stream->downmix_e, rb, i);
@@ -229,6 +222,11 @@ void audio_control_start_debug_v2(audio_stream_t *stream) {
     // They will be started via START_TRACK messages after URIs are configured
     ESP_LOGI(TAG, "Track pipelines will be started later via START_TRACK messages");
     
+    // One-shots and speaker correction happen as I2S reads, set up before it runs
+    if (master_bus_init(stream) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to set up the master bus, I2S reads downmix directly");
+    }
+
     // Start ONLY the output pipeline (downmix + I2S)
     ESP_LOGD(TAG, "Starting output pipeline (downmix + I2S)");
     err = audio_pipeline_run(stream->pipeline);
@@ -259,7 +257,7 @@ void audio_control_start_debug_v2(audio_stream_t *stream) {
             }
             
             // Check decoder output ringbuffer
-            rb = audio_element_get_output_ringbuf(stream->tracks[i].decode_e);
+            rb = stream->tracks[i].mixer_rb;
             if (rb) {
                 ESP_LOGD(TAG, "  Track %d decoder output: %d bytes filled", 
                          i, rb_bytes_filled(rb));
@@ -286,7 +284,7 @@ void debug_downmix_element(audio_stream_t *stream) {
     // Check downmix inputs via decoder outputs (since we can't directly get downmix inputs)
     ESP_LOGD(TAG, "Checking downmix inputs via decoder outputs:");
     for (int i = 0; i < MAX_TRACKS; i++) {
-        ringbuf_handle_t rb = audio_element_get_output_ringbuf(stream->tracks[i].decode_e);
+        ringbuf_handle_t rb = stream->tracks[i].mixer_rb;
         if (rb) {
             ESP_LOGD(TAG, "  Track %d decoder output (downmix input %d): size=%d, filled=%d",
                      i, i, rb_get_size(rb), rb_bytes_filled(rb));
@@ -304,8 +302,8 @@ void debug_downmix_element(audio_stream_t *stream) {
         ESP_LOGE(TAG, "Downmix output: ringbuf is NULL!");
     }
     
-    // Check I2S input (should be same as downmix output)
-    ringbuf_handle_t i2s_rb = audio_element_get_input_ringbuf(stream->i2s_e);
+    // Check I2S input (should be same as downmix output, read through master_bus.c)
+    ringbuf_handle_t i2s_rb = stream->output_rb;
     if (i2s_rb) {
         ESP_LOGD(TAG, "I2S input: ringbuf exists, size=%d, filled=%d",
                  rb_get_size(i2s_rb), rb_bytes_filled(i2s_rb));
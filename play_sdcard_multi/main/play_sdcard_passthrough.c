@@ -1,18 +1,20 @@
 /* Alternative approach using passthrough elements */
 #include "play_sdcard.h"
 #include "raw_stream.h"
+#include "track_reader.h"
 #include "filter_resample.h"
 #include "esp_decoder.h"
 #include "mp3_decoder.h"
 #include "wav_decoder.h"
 #include "esp_heap_caps.h"
+#include "heap_tracker.h"
 #include "esp_log.h"
 
 static const char *TAG = "PLAY_SDCARD_PASSTHROUGH";
 
 // Custom allocation functions for MP3 decoder to use PSRAM
 static void* mp3_malloc_psram(size_t size) {
-    void* ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    void* ptr = heap_tracker_malloc(size, MALLOC_CAP_SPIRAM);
     if (ptr) {
         ESP_LOGI(TAG, "MP3: Allocated %d bytes in PSRAM at %p", size, ptr);
     } else {
@@ -99,6 +101,7 @@ esp_err_t audio_stream_init_with_passthrough(audio_stream_t **stream_o) {
     // Link downmix to I2S
     const char *link_tag[2] = {"downmix", "i2s"};
     audio_pipeline_link(stream->pipeline, link_tag, 2);
+    stream->output_rb = audio_element_get_output_ringbuf(stream->downmix_e);
 
     // Initialize source info for downmix
     esp_downmix_input_info_t source_info[MAX_TRACKS];
@@ -122,15 +125,15 @@ esp_err_t audio_stream_init_with_passthrough(audio_stream_t **stream_o) {
             return ESP_FAIL;
         }
         
-        // Create fatfs reader - Pin to Core 1 (APP CPU)
-        fatfs_stream_cfg_t fatfs_cfg = FATFS_STREAM_CFG_DEFAULT();
-        fatfs_cfg.type = AUDIO_STREAM_READER;
-        fatfs_cfg.task_core = 1;  // Pin to Core 1 (APP CPU)
-        fatfs_cfg.task_prio = 19; // Lower than decoder but still high
-        fatfs_cfg.task_stack = 3584;  // Increased to 3.5KB to prevent stack overflow
-        fatfs_cfg.buf_sz = 2048;  // Keep buffer at 2KB (must be internal for DMA)
-        fatfs_cfg.out_rb_size = 2048;  // Reduce output ringbuffer to save memory
-        stream->tracks[i].fatfs_e = fatfs_stream_init(&fatfs_cfg);
+        // Create file reader - Pin to Core 1 (APP CPU)
+        // Not fatfs_stream: it opens from "/sdcard" on, skipping the /shared and /flash VFS
+        track_reader_cfg_t reader_cfg = TRACK_READER_CFG_DEFAULT();
+        reader_cfg.task_core = 1;  // Pin to Core 1 (APP CPU)
+        reader_cfg.task_prio = 19; // Lower than decoder but still high
+        reader_cfg.task_stack = 3584;  // Increased to 3.5KB to prevent stack overflow
+        reader_cfg.buf_sz = 2048;  // Keep buffer at 2KB (must be internal for DMA)
+        reader_cfg.out_rb_size = 2048;  // Reduce output ringbuffer to save memory
+        stream->tracks[i].fatfs_e = track_reader_init(&reader_cfg);
         
         // Log memory before creating decoder
         log_memory_info("Before decoder creation");
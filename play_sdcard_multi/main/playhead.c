@@ -0,0 +1,191 @@
+/* Sample counting between the decoders and downmix, see playhead.h
+
+   The decoder's write into the mixer buffer and the count are done under
+   the track's lock, and so is the reading of count and buffer fill, so
+   the two always agree. The decoder mostly waits in that write for room,
+   so a reader can wait as long as downmix takes to free a decoder chunk,
+   a few ms; it gives up after PLAYHEAD_LOCK_MS.
+
+   Author: Brian Bulkowski brian@bulkowski.org
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "audio_element.h"
+#include "ringbuf.h"
+#include "convolver.h"
+#include "mp3_index.h"
+#include "sd_arbiter.h"
+#include "wav_header.h"
+#include "playhead.h"
+
+static const char *TAG = "PLAYHEAD";
+
+typedef struct {
+    uint64_t at;                    // bytes written when the pass began
+    uint64_t sample;                // its first sample in the file
+} pass_t;
+
+typedef struct {
+    audio_stream_t *stream;
+    audio_track_t *track;
+    SemaphoreHandle_t lock;
+    uint64_t written;               // into the mixer buffer since the last start
+    pass_t passes[PLAYHEAD_PASSES]; // ring, newest at last_pass
+    int last_pass;
+    int n_passes;
+} track_playhead_t;
+
+static track_playhead_t s_tracks[MAX_TRACKS];
+
+static audio_element_err_t mixer_write(audio_element_handle_t el, char *buf, int len, TickType_t ticks_to_wait,
+                                       void *ctx) {
+    track_playhead_t *t = ctx;
+    xSemaphoreTake(t->lock, portMAX_DELAY);
+    int n = rb_write(t->track->mixer_rb, buf, len, ticks_to_wait);
+    if (n > 0) {
+        t->written += n;
+    }
+    xSemaphoreGive(t->lock);
+    // The ringbuffer's errors are the element's
+    return (audio_element_err_t)n;
+}
+
+esp_err_t playhead_attach(audio_stream_t *stream, int track) {
+    if (track < 0 || track >= MAX_TRACKS || !stream->tracks[track].mixer_rb) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    track_playhead_t *t = &s_tracks[track];
+    if (!t->lock) {
+        t->lock = xSemaphoreCreateMutex();
+        if (!t->lock) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    t->stream = stream;
+    t->track = &stream->tracks[track];
+    return audio_element_set_write_cb(t->track->decode_e, mixer_write, t);
+}
+
+static void pass_add(track_playhead_t *t, uint64_t sample) {
+    t->last_pass = (t->last_pass + 1) % PLAYHEAD_PASSES;
+    t->passes[t->last_pass] = (pass_t){ .at = t->written, .sample = sample };
+    if (t->n_passes < PLAYHEAD_PASSES) {
+        t->n_passes++;
+    }
+}
+
+void playhead_start(int track, uint64_t sample) {
+    track_playhead_t *t = &s_tracks[track];
+    if (!t->lock) {
+        return;
+    }
+    xSemaphoreTake(t->lock, portMAX_DELAY);
+    rb_reset(t->track->mixer_rb);
+    t->written = 0;
+    t->n_passes = 0;
+    pass_add(t, sample);
+    xSemaphoreGive(t->lock);
+}
+
+void playhead_loop(int track) {
+    track_playhead_t *t = &s_tracks[track];
+    if (!t->lock) {
+        return;
+    }
+    xSemaphoreTake(t->lock, portMAX_DELAY);
+    pass_add(t, 0);
+    xSemaphoreGive(t->lock);
+}
+
+esp_err_t playhead_get(int track, playhead_t *ph) {
+    if (track < 0 || track >= MAX_TRACKS || !s_tracks[track].lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    track_playhead_t *t = &s_tracks[track];
+    if (xSemaphoreTake(t->lock, pdMS_TO_TICKS(PLAYHEAD_LOCK_MS)) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    int filled = rb_bytes_filled(t->track->mixer_rb);
+    uint64_t mixed = t->written - (filled > 0 ? (uint64_t)filled : 0);
+    int n_passes = t->n_passes;
+    pass_t passes[PLAYHEAD_PASSES];
+    for (int i = 0; i < n_passes; i++) {
+        passes[i] = t->passes[(t->last_pass - i + PLAYHEAD_PASSES) % PLAYHEAD_PASSES];
+    }
+    xSemaphoreGive(t->lock);
+    if (n_passes == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    audio_element_info_t info;
+    audio_element_getinfo(t->track->decode_e, &info);
+    int frame_bytes = info.channels * info.bits / 8;
+    if (frame_bytes <= 0 || info.sample_rates <= 0) {
+        frame_bytes = WAV_NATIVE_CHANNELS * WAV_NATIVE_BITS / 8;
+        info.sample_rates = WAV_NATIVE_SAMPLE_RATE;
+    }
+
+    // Downstream of downmix everything is at the output format, the correction filter included
+    int out_filled = rb_bytes_filled(t->stream->output_rb);
+    convolver_info_t correction;
+    convolver_get_info(&correction);
+    uint64_t latency = (out_filled > 0 ? out_filled : 0) / (WAV_NATIVE_CHANNELS * WAV_NATIVE_BITS / 8) +
+                       correction.latency_frames + PLAYHEAD_DMA_FRAMES;
+    latency = latency * info.sample_rates / WAV_NATIVE_SAMPLE_RATE;
+
+    // Newest pass first; before the oldest one known, say its start
+    uint64_t heard = mixed > latency * frame_bytes ? mixed - latency * frame_bytes : 0;
+    const pass_t *pass = &passes[n_passes - 1];
+    for (int i = 0; i < n_passes; i++) {
+        if (passes[i].at <= heard) {
+            pass = &passes[i];
+            break;
+        }
+    }
+    uint64_t into = heard > pass->at ? heard - pass->at : 0;
+
+    ph->sample = pass->sample + into / frame_bytes;
+    ph->sample_rate = info.sample_rates;
+    ph->mixed = mixed / frame_bytes;
+    ph->latency = latency;
+    return ESP_OK;
+}
+
+static esp_err_t wav_locate(const wav_header_info_t *wav, uint64_t sample, uint32_t *offset) {
+    if (sample >= wav->data_size / wav->block_align) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *offset = wav->data_offset + (uint32_t)sample * wav->block_align;
+    return ESP_OK;
+}
+
+esp_err_t playhead_locate(const char *path, uint64_t sample, uint32_t *offset, uint64_t *start_sample,
+                          uint32_t *sample_rate) {
+    wav_header_info_t wav;
+    FILE *f;
+    sd_arbiter_begin(SD_IO_METADATA);
+    esp_err_t err = wav_header_open(path, &f, &wav);
+    if (f) {
+        fclose(f);
+    }
+    sd_arbiter_end(SD_IO_METADATA);
+
+    if (err == ESP_OK) {
+        err = wav_locate(&wav, sample, offset);
+        *start_sample = sample;
+        *sample_rate = wav.sample_rate;
+    }
+    // Not RIFF: see if it's an MP3
+    if (err == ESP_ERR_INVALID_ARG) {
+        err = mp3_index_locate(path, sample, offset, start_sample, sample_rate);
+    }
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "%s sample %llu starts at byte %lu", path, (unsigned long long)*start_sample,
+                 (unsigned long)*offset);
+    }
+    return err;
+}
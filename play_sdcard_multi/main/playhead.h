@@ -0,0 +1,76 @@
+#ifndef PLAYHEAD_H
+#define PLAYHEAD_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "play_sdcard.h"
+
+// Which sample of its file each track is playing, as heard.
+//
+// The decoders write to their mixer buffer through a callback here, which
+// counts the bytes. What downmix has taken is that count less what is still
+// in the buffer; what is audible is that, less what sits between downmix
+// and the DAC. Each pass through the file (a start, a seek, every loop) is
+// noted with the count it begins at, so the count maps back to a sample of
+// the file across loops, and the tail of one pass still playing while the
+// next is decoded is reported as the tail.
+//
+// The file reader's byte_pos, the only position there was before, is
+// ahead of this by everything buffered on the way.
+
+#define PLAYHEAD_PASSES         4           // passes remembered per track
+#define PLAYHEAD_DMA_FRAMES     (3 * 300)   // ADF I2S default DMA, 3 x 300 frames, full while playing
+#define PLAYHEAD_LOCK_MS        100
+
+typedef struct {
+    uint64_t sample;                // audible sample of the file
+    uint32_t sample_rate;
+    uint64_t mixed;                 // samples downmix took since the last start or seek
+    uint32_t latency;               // samples from downmix to the DAC, estimated
+} playhead_t;
+
+/**
+ * @brief Feed the track's decoder into mixer_rb through the counting callback
+ *
+ * Replaces audio_element_set_output_ringbuf() on the decoder. The pipeline
+ * then leaves mixer_rb alone: it is not reset on a loop, so the end of one
+ * pass plays out while the next starts, and playhead_start() resets it.
+ */
+esp_err_t playhead_attach(audio_stream_t *stream, int track);
+
+/**
+ * @brief The track is about to play its file from sample, with its pipeline stopped
+ *
+ * Whatever is still buffered for the mixer is dropped.
+ */
+void playhead_start(int track, uint64_t sample);
+
+/**
+ * @brief The track is about to play its file again from the start, after what is buffered
+ */
+void playhead_loop(int track);
+
+/**
+ * @brief Where the track is
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_STATE before the track started,
+ *         ESP_ERR_TIMEOUT if the decoder held the counter too long
+ */
+esp_err_t playhead_get(int track, playhead_t *ph);
+
+/**
+ * @brief Where a track playing path should start reading to start at sample
+ *
+ * A WAV starts at the block of the sample itself. An MP3 starts at the
+ * frame holding it, found through mp3_index.
+ *
+ * @param offset Byte of the file to start at, for shared_read_path_at()
+ * @param start_sample The sample playback will really start at
+ * @return ESP_OK, ESP_ERR_NOT_FOUND, ESP_ERR_INVALID_SIZE if sample is
+ *         past the end, ESP_ERR_NOT_SUPPORTED for other formats
+ */
+esp_err_t playhead_locate(const char *path, uint64_t sample, uint32_t *offset, uint64_t *start_sample,
+                          uint32_t *sample_rate);
+
+#endif /* PLAYHEAD_H */
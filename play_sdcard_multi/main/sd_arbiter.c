@@ -0,0 +1,156 @@
+/* SD card arbitration between the track readers and everything else.
+
+   The FATFS lock already serialises single calls, but it is first come
+   first served: an upload writing as fast as the network delivers gets the
+   card as often as the readers do, and a reader that waits behind enough
+   4 KB writes runs its track dry. Here bulk work waits its turn instead, a
+   chunk at a time, and only while the tracks have buffer to spare.
+
+   Playback only counts itself in and out, it never takes the bus mutex, so
+   nothing here can make a reader wait.
+
+   Author: Brian Bulkowski brian@bulkowski.org
+*/
+
+#include <stdatomic.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "audio_element.h"
+#include "ringbuf.h"
+#include "sd_arbiter.h"
+
+static const char *TAG = "SD_ARBITER";
+
+static _Atomic(SemaphoreHandle_t) s_bus;
+static atomic_int s_playback_active;
+static atomic_int s_metadata_waiting;
+
+static audio_stream_t *s_stream;
+static loop_manager_t *s_manager;
+
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static sd_arbiter_stats_t s_stats;
+
+// Created on first use: the card is in use before the audio task gets to init
+static SemaphoreHandle_t bus_get(void) {
+    SemaphoreHandle_t bus = atomic_load(&s_bus);
+    if (bus == NULL) {
+        SemaphoreHandle_t created = xSemaphoreCreateRecursiveMutex();
+        if (atomic_compare_exchange_strong(&s_bus, &bus, created)) {
+            bus = created;
+        } else {
+            vSemaphoreDelete(created);
+        }
+    }
+    return bus;
+}
+
+esp_err_t sd_arbiter_init(audio_stream_t *stream, loop_manager_t *manager) {
+    if (bus_get() == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_stream = stream;
+    s_manager = manager;
+    ESP_LOGI(TAG, "Bulk SD work waits for %d%% in every playing track's buffer", SD_ARBITER_BULK_MIN_FILL);
+    return ESP_OK;
+}
+
+int sd_arbiter_playback_headroom(void) {
+    if (!s_stream || !s_manager) {
+        return 100;
+    }
+    int lowest = 100;
+    for (int i = 0; i < MAX_TRACKS; i++) {
+        audio_track_t *track = &s_stream->tracks[i];
+        // A reader that failed to open its file will never fill the buffer
+        if (!s_manager->loops[i].is_playing ||
+            audio_element_get_state(track->decode_e) != AEL_STATE_RUNNING ||
+            audio_element_get_state(track->fatfs_e) == AEL_STATE_ERROR) {
+            continue;
+        }
+        ringbuf_handle_t rb = track->mixer_rb;
+        int size = rb ? rb_get_size(rb) : 0;
+        int filled = rb ? rb_bytes_filled(rb) : 0;
+        if (size > 0 && filled >= 0) {
+            int percent = filled * 100 / size;
+            if (percent < lowest) {
+                lowest = percent;
+            }
+        }
+    }
+    return lowest;
+}
+
+static bool bulk_may_run(void) {
+    return atomic_load(&s_playback_active) == 0 && atomic_load(&s_metadata_waiting) == 0 &&
+           sd_arbiter_playback_headroom() >= SD_ARBITER_BULK_MIN_FILL;
+}
+
+void sd_arbiter_begin(sd_io_class_t io_class) {
+    int64_t start = esp_timer_get_time();
+    bool deferred = false;
+    bool forced = false;
+
+    if (io_class == SD_IO_PLAYBACK) {
+        atomic_fetch_add(&s_playback_active, 1);
+    } else if (io_class == SD_IO_METADATA) {
+        atomic_fetch_add(&s_metadata_waiting, 1);
+        xSemaphoreTakeRecursive(bus_get(), portMAX_DELAY);
+        atomic_fetch_sub(&s_metadata_waiting, 1);
+    } else {
+        SemaphoreHandle_t bus = bus_get();
+        for (;;) {
+            xSemaphoreTakeRecursive(bus, portMAX_DELAY);
+            if (bulk_may_run()) {
+                break;
+            }
+            if (esp_timer_get_time() - start >= SD_ARBITER_BULK_MAX_WAIT_MS * 1000LL) {
+                forced = true;
+                break;
+            }
+            xSemaphoreGiveRecursive(bus);
+            deferred = true;
+            vTaskDelay(pdMS_TO_TICKS(SD_ARBITER_BULK_POLL_MS));
+        }
+    }
+
+    int64_t waited = esp_timer_get_time() - start;
+    taskENTER_CRITICAL(&s_stats_lock);
+    s_stats.ops[io_class]++;
+    s_stats.wait_us[io_class] += waited;
+    s_stats.bulk_deferred += deferred;
+    s_stats.bulk_forced += forced;
+    taskEXIT_CRITICAL(&s_stats_lock);
+
+    if (forced) {
+        ESP_LOGW(TAG, "Bulk SD write went ahead after %d ms, playback headroom %d%%",
+                 SD_ARBITER_BULK_MAX_WAIT_MS, sd_arbiter_playback_headroom());
+    }
+}
+
+void sd_arbiter_end(sd_io_class_t io_class) {
+    if (io_class == SD_IO_PLAYBACK) {
+        atomic_fetch_sub(&s_playback_active, 1);
+    } else {
+        xSemaphoreGiveRecursive(bus_get());
+    }
+}
+
+void sd_arbiter_get_stats(sd_arbiter_stats_t *stats) {
+    taskENTER_CRITICAL(&s_stats_lock);
+    *stats = s_stats;
+    taskEXIT_CRITICAL(&s_stats_lock);
+}
+
+const char *sd_arbiter_class_name(sd_io_class_t io_class) {
+    switch (io_class) {
+        case SD_IO_PLAYBACK: return "playback";
+        case SD_IO_METADATA: return "metadata";
+        case SD_IO_BULK:     return "bulk";
+        default:             return "unknown";
+    }
+}
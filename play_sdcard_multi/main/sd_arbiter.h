@@ -0,0 +1,72 @@
+#ifndef SD_ARBITER_H
+#define SD_ARBITER_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "play_sdcard.h"
+#include "http_server.h"
+
+// Who gets the SD card when the audio readers and the HTTP server both want it.
+//
+// Every SD access is bracketed by sd_arbiter_begin()/sd_arbiter_end() with
+// its class:
+// - SD_IO_PLAYBACK: the track readers (shared_read.c). Never waits here, the
+//   card is theirs whenever they ask.
+// - SD_IO_METADATA: listings, stats, deletes, small JSON files. Runs one at a
+//   time and ahead of any waiting bulk work, but doesn't wait on playback.
+// - SD_IO_BULK: upload data, one chunk per begin. Only goes ahead while no
+//   track reader is on the card, no metadata is waiting, and every playing
+//   track's mixer buffer is at least SD_ARBITER_BULK_MIN_FILL percent full.
+//   After SD_ARBITER_BULK_MAX_WAIT_MS it goes ahead anyway and is counted as
+//   forced, so a track that can't fill (stalled, or looping a tiny file)
+//   can't wedge an upload for good.
+
+#define SD_ARBITER_BULK_MIN_FILL        50      // percent
+#define SD_ARBITER_BULK_POLL_MS         10
+#define SD_ARBITER_BULK_MAX_WAIT_MS     2000
+
+typedef enum {
+    SD_IO_PLAYBACK = 0,
+    SD_IO_METADATA,
+    SD_IO_BULK,
+    SD_IO_CLASSES
+} sd_io_class_t;
+
+typedef struct {
+    uint32_t ops[SD_IO_CLASSES];
+    uint64_t wait_us[SD_IO_CLASSES];    // time spent in sd_arbiter_begin()
+    uint32_t bulk_deferred;             // bulk begins that had to wait
+    uint32_t bulk_forced;               // ... and gave up waiting
+} sd_arbiter_stats_t;
+
+/**
+ * @brief Watch the track buffers for bulk gating
+ *
+ * Until this is called bulk work is only held back by the other classes.
+ *
+ * @param stream The audio stream whose mixer inputs are watched
+ * @param manager Loop manager, used to tell which tracks are playing
+ */
+esp_err_t sd_arbiter_init(audio_stream_t *stream, loop_manager_t *manager);
+
+/**
+ * @brief Wait for the card as io_class, may nest within one task
+ */
+void sd_arbiter_begin(sd_io_class_t io_class);
+
+/**
+ * @brief Done with the card, pairs with sd_arbiter_begin()
+ */
+void sd_arbiter_end(sd_io_class_t io_class);
+
+/**
+ * @brief Lowest mixer buffer fill of the playing tracks, 100 if none play
+ */
+int sd_arbiter_playback_headroom(void);
+
+void sd_arbiter_get_stats(sd_arbiter_stats_t *stats);
+
+const char *sd_arbiter_class_name(sd_io_class_t io_class);
+
+#endif /* SD_ARBITER_H */
@@ -0,0 +1,531 @@
+/* Shared reads for tracks looping the same file, served as a VFS at /shared.
+
+   "/shared/sdcard/x.wav" is "/sdcard/x.wav" opened once however many tracks
+   play it. Each reader keeps its own position. With one reader the reads
+   pass straight to the card; from the second one on, a block cache sits in
+   between, so layering a bed on two tracks costs one stream of SD reads
+   instead of two. The cache goes again when the file is back to one reader.
+
+   A miss reads a whole SHARED_READ_BLOCK, under the file's lock: a reader
+   wanting the block another reader is loading waits for that read instead
+   of making its own.
+
+   A reader can also start part way into a file ("/shared/@<byte>/sdcard/x.wav",
+   see shared_read_path_at()). It then reads a view: for a WAV, a plain
+   header followed by the data from that byte, so the decoder starts there
+   as if the file began there; for anything else, the file from that byte.
+   The view only changes what the reader sees, the file and its cache are
+   shared with the other readers as usual.
+
+   Everything that touches the card here is SD_IO_PLAYBACK to the arbiter.
+
+   Author: Brian Bulkowski brian@bulkowski.org
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_vfs.h"
+#include "heap_tracker.h"
+#include "metrics.h"
+#include "sd_arbiter.h"
+#include "shared_read.h"
+#include "wav_header.h"
+
+static const char *TAG = "SHARED_READ";
+
+#define SD_PREFIX       "/sdcard/"
+#define VIEW_PREFIX     "/@"
+#define PATH_LEN        128
+
+typedef struct {
+    int32_t index;                  // block number in the file, -1 if empty
+    uint32_t len;                   // short at the end of the file
+    uint32_t last_use;
+} block_t;
+
+typedef struct {
+    char path[PATH_LEN];            // underlying path
+    int refs;                       // 0 when the slot is free
+    FILE *file;
+    long file_pos;                  // where file is, saves a seek per read
+    uint32_t size;
+    SemaphoreHandle_t lock;
+    uint8_t *cache;                 // NULL with a single reader
+    int n_blocks;
+    uint32_t clock;
+    block_t blocks[SHARED_READ_BLOCKS];
+} shared_file_t;
+
+typedef struct {
+    shared_file_t *file;            // NULL when the descriptor is free
+    uint32_t pos;                   // in the view
+
+    // The view: head, then the file from start to end
+    uint32_t start;
+    uint32_t end;
+    uint32_t head_len;
+    uint8_t head[WAV_HEADER_CANONICAL_LEN];
+} open_file_t;
+
+static SemaphoreHandle_t s_lock;
+static shared_file_t s_files[SHARED_READ_MAX_FILES];
+static open_file_t s_open[SHARED_READ_MAX_OPEN];
+static shared_read_stats_t s_stats;
+
+static void stats_add(uint32_t card, uint32_t served, uint32_t hits, uint32_t misses) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_stats.card_bytes += card;
+    s_stats.served_bytes += served;
+    s_stats.hits += hits;
+    s_stats.misses += misses;
+    xSemaphoreGive(s_lock);
+}
+
+// Positions the underlying file and reads, on the file's lock
+// Times the card access, its seek included, for the read latency histogram
+static size_t file_read(shared_file_t *f, uint32_t pos, void *dst, size_t len) {
+    sd_arbiter_begin(SD_IO_PLAYBACK);
+    int64_t start = esp_timer_get_time();
+    if (f->file_pos != (long)pos) {
+        if (fseek(f->file, pos, SEEK_SET) != 0) {
+            f->file_pos = -1;
+            sd_arbiter_end(SD_IO_PLAYBACK);
+            return 0;
+        }
+    }
+    size_t n = fread(dst, 1, len, f->file);
+    metrics_sd_read_latency((uint32_t)((esp_timer_get_time() - start) / 1000));
+    sd_arbiter_end(SD_IO_PLAYBACK);
+    f->file_pos = pos + n;
+    return n;
+}
+
+static void cache_start(shared_file_t *f) {
+    int needed = (f->size + SHARED_READ_BLOCK - 1) / SHARED_READ_BLOCK;
+    int n = needed < SHARED_READ_BLOCKS ? needed : SHARED_READ_BLOCKS;
+    if (n == 0) {
+        return;
+    }
+    uint8_t *cache = heap_tracker_malloc((size_t)n * SHARED_READ_BLOCK, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!cache) {
+        ESP_LOGW(TAG, "No memory to share %s, readers go to the card separately", f->path);
+        return;
+    }
+    xSemaphoreTake(f->lock, portMAX_DELAY);
+    for (int i = 0; i < n; i++) {
+        f->blocks[i] = (block_t){ .index = -1 };
+    }
+    f->n_blocks = n;
+    f->cache = cache;
+    xSemaphoreGive(f->lock);
+    s_stats.shared_files++;
+    s_stats.cache_bytes += n * SHARED_READ_BLOCK;
+    ESP_LOGI(TAG, "Sharing %s, %d KB cache%s", f->path, n * SHARED_READ_BLOCK / 1024,
+             n == needed ? ", whole file" : "");
+}
+
+static void cache_stop(shared_file_t *f) {
+    if (!f->cache) {
+        return;
+    }
+    xSemaphoreTake(f->lock, portMAX_DELAY);
+    uint8_t *cache = f->cache;
+    f->cache = NULL;
+    xSemaphoreGive(f->lock);
+    free(cache);
+    s_stats.shared_files--;
+    s_stats.cache_bytes -= f->n_blocks * SHARED_READ_BLOCK;
+    f->n_blocks = 0;
+}
+
+// The cached block holding index, loaded if need be. NULL on a read error.
+static block_t *block_get(shared_file_t *f, int32_t index, uint32_t *hits, uint32_t *misses, uint32_t *card) {
+    block_t *victim = &f->blocks[0];
+    for (int i = 0; i < f->n_blocks; i++) {
+        block_t *b = &f->blocks[i];
+        if (b->index == index) {
+            b->last_use = ++f->clock;
+            (*hits)++;
+            return b;
+        }
+        if (victim->index >= 0 && (b->index < 0 || b->last_use < victim->last_use)) {
+            victim = b;
+        }
+    }
+
+    uint8_t *data = f->cache + (victim - f->blocks) * SHARED_READ_BLOCK;
+    uint32_t want = f->size - (uint32_t)index * SHARED_READ_BLOCK;
+    if (want > SHARED_READ_BLOCK) {
+        want = SHARED_READ_BLOCK;
+    }
+    size_t n = file_read(f, (uint32_t)index * SHARED_READ_BLOCK, data, want);
+    (*misses)++;
+    *card += n;
+    if (n != want) {
+        victim->index = -1;
+        return NULL;
+    }
+    victim->index = index;
+    victim->len = n;
+    victim->last_use = ++f->clock;
+    return victim;
+}
+
+// VFS. Paths arrive with the mount point stripped, "/sdcard/x.wav".
+
+static open_file_t *file_get(int fd) {
+    if (fd < 0 || fd >= SHARED_READ_MAX_OPEN || !s_open[fd].file) {
+        errno = EBADF;
+        return NULL;
+    }
+    return &s_open[fd];
+}
+
+static shared_file_t *file_open_locked(const char *path) {
+    shared_file_t *free_slot = NULL;
+    for (int i = 0; i < SHARED_READ_MAX_FILES; i++) {
+        if (s_files[i].refs > 0 && strcmp(s_files[i].path, path) == 0) {
+            return &s_files[i];
+        }
+        if (s_files[i].refs == 0 && !free_slot) {
+            free_slot = &s_files[i];
+        }
+    }
+    if (!free_slot) {
+        errno = ENFILE;
+        return NULL;
+    }
+    if (strlen(path) >= PATH_LEN) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    sd_arbiter_begin(SD_IO_PLAYBACK);
+    FILE *file = fopen(path, "rb");
+    struct stat st;
+    if (file && stat(path, &st) != 0) {
+        fclose(file);
+        file = NULL;
+    }
+    sd_arbiter_end(SD_IO_PLAYBACK);
+    if (!file) {
+        return NULL;
+    }
+    shared_file_t *f = free_slot;
+    strcpy(f->path, path);
+    f->file = file;
+    f->file_pos = 0;
+    f->size = st.st_size;
+    f->cache = NULL;
+    f->n_blocks = 0;
+    s_stats.open_files++;
+    return f;
+}
+
+static uint32_t view_size(const open_file_t *o) {
+    return o->head_len + (o->end - o->start);
+}
+
+// Sets up the view of a reader starting at start. Reads the header, so not on s_lock.
+static void view_open(open_file_t *o, uint32_t start) {
+    shared_file_t *f = o->file;
+    o->end = f->size;
+    o->head_len = 0;
+    if (start > 0) {
+        wav_header_info_t info;
+        xSemaphoreTake(f->lock, portMAX_DELAY);
+        sd_arbiter_begin(SD_IO_PLAYBACK);
+        esp_err_t err = wav_header_parse(f->file, &info);
+        sd_arbiter_end(SD_IO_PLAYBACK);
+        f->file_pos = -1;
+        xSemaphoreGive(f->lock);
+        if (err == ESP_OK) {
+            o->end = info.data_offset + wav_header_data_size(&info, f->size);
+            if (start < info.data_offset) {
+                start = info.data_offset;
+            }
+            if (start > o->end) {
+                start = o->end;
+            }
+            o->head_len = wav_header_write(&info, o->end - start, o->head);
+        }
+    }
+    o->start = start < o->end ? start : o->end;
+}
+
+// Splits "/@<start>/sdcard/x.wav" into start and the file's path
+static const char *view_parse(const char *path, uint32_t *start) {
+    *start = 0;
+    if (strncmp(path, VIEW_PREFIX, strlen(VIEW_PREFIX)) != 0) {
+        return path;
+    }
+    char *rest;
+    unsigned long n = strtoul(path + strlen(VIEW_PREFIX), &rest, 10);
+    if (rest == path + strlen(VIEW_PREFIX) || *rest != '/' || n > UINT32_MAX) {
+        return NULL;
+    }
+    *start = n;
+    return rest;
+}
+
+static int vfs_open(const char *path, int flags, int mode) {
+    if ((flags & O_ACCMODE) != O_RDONLY) {
+        errno = EROFS;
+        return -1;
+    }
+    uint32_t start;
+    path = view_parse(path, &start);
+    if (!path) {
+        errno = ENOENT;
+        return -1;
+    }
+    int fd = -1;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < SHARED_READ_MAX_OPEN; i++) {
+        if (!s_open[i].file) {
+            fd = i;
+            break;
+        }
+    }
+    shared_file_t *f = NULL;
+    if (fd < 0) {
+        errno = EMFILE;
+    } else {
+        f = file_open_locked(path);
+    }
+    if (f) {
+        s_open[fd] = (open_file_t){ .file = f, .pos = 0 };
+        if (++f->refs == 2) {
+            cache_start(f);
+        }
+    } else {
+        fd = -1;
+    }
+    xSemaphoreGive(s_lock);
+    if (f) {
+        view_open(&s_open[fd], start);
+    }
+    return fd;
+}
+
+// Reads the file itself, through the cache if it has one
+static ssize_t file_pread(shared_file_t *f, void *dst, size_t size, uint32_t offset) {
+    uint32_t hits = 0, misses = 0, card = 0;
+    size_t done = 0;
+    bool error = false;
+
+    xSemaphoreTake(f->lock, portMAX_DELAY);
+    if (offset >= f->size) {
+        size = 0;
+    } else if (size > f->size - offset) {
+        size = f->size - offset;
+    }
+    if (!f->cache) {
+        done = file_read(f, offset, dst, size);
+        card = done;
+        error = done != size;
+    }
+    while (f->cache && done < size) {
+        uint32_t pos = offset + done;
+        block_t *b = block_get(f, pos / SHARED_READ_BLOCK, &hits, &misses, &card);
+        if (!b) {
+            error = true;
+            break;
+        }
+        uint32_t in_block = pos % SHARED_READ_BLOCK;
+        size_t n = b->len - in_block;
+        if (n > size - done) {
+            n = size - done;
+        }
+        memcpy((uint8_t *)dst + done, f->cache + (b - f->blocks) * SHARED_READ_BLOCK + in_block, n);
+        done += n;
+    }
+    xSemaphoreGive(f->lock);
+
+    stats_add(card, done, hits, misses);
+    if (error && done == 0) {
+        errno = EIO;
+        return -1;
+    }
+    return done;
+}
+
+static ssize_t vfs_pread(int fd, void *dst, size_t size, off_t offset) {
+    open_file_t *o = file_get(fd);
+    if (!o) {
+        return -1;
+    }
+    if (offset < 0 || (uint32_t)offset >= view_size(o)) {
+        return 0;
+    }
+    size_t done = 0;
+    if ((uint32_t)offset < o->head_len) {
+        done = o->head_len - offset;
+        if (done > size) {
+            done = size;
+        }
+        memcpy(dst, o->head + offset, done);
+    }
+    if (done < size) {
+        uint32_t pos = o->start + (offset + done - o->head_len);
+        size_t want = size - done;
+        if (want > o->end - pos) {
+            want = o->end - pos;
+        }
+        ssize_t n = file_pread(o->file, (uint8_t *)dst + done, want, pos);
+        if (n < 0) {
+            return done > 0 ? (ssize_t)done : -1;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static ssize_t vfs_read(int fd, void *dst, size_t size) {
+    open_file_t *o = file_get(fd);
+    if (!o) {
+        return -1;
+    }
+    ssize_t n = vfs_pread(fd, dst, size, o->pos);
+    if (n > 0) {
+        o->pos += n;
+    }
+    return n;
+}
+
+static off_t vfs_lseek(int fd, off_t offset, int whence) {
+    open_file_t *o = file_get(fd);
+    if (!o) {
+        return -1;
+    }
+    off_t pos;
+    switch (whence) {
+        case SEEK_SET: pos = offset; break;
+        case SEEK_CUR: pos = o->pos + offset; break;
+        case SEEK_END: pos = view_size(o) + offset; break;
+        default: errno = EINVAL; return -1;
+    }
+    if (pos < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    o->pos = pos;
+    return pos;
+}
+
+static int vfs_close(int fd) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    open_file_t *o = file_get(fd);
+    if (o) {
+        shared_file_t *f = o->file;
+        o->file = NULL;
+        f->refs--;
+        if (f->refs == 1) {
+            cache_stop(f);
+        } else if (f->refs == 0) {
+            cache_stop(f);
+            sd_arbiter_begin(SD_IO_PLAYBACK);
+            fclose(f->file);
+            sd_arbiter_end(SD_IO_PLAYBACK);
+            f->file = NULL;
+            s_stats.open_files--;
+        }
+    }
+    xSemaphoreGive(s_lock);
+    return o ? 0 : -1;
+}
+
+static int vfs_fstat(int fd, struct stat *st) {
+    open_file_t *o = file_get(fd);
+    if (!o) {
+        return -1;
+    }
+    memset(st, 0, sizeof(*st));
+    st->st_mode = S_IFREG | 0444;
+    st->st_size = view_size(o);
+    return 0;
+}
+
+static int vfs_stat(const char *path, struct stat *st) {
+    // A view's size depends on the file's header, so open it to find out
+    if (strncmp(path, VIEW_PREFIX, strlen(VIEW_PREFIX)) == 0) {
+        int fd = vfs_open(path, O_RDONLY, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        vfs_fstat(fd, st);
+        vfs_close(fd);
+        return 0;
+    }
+    sd_arbiter_begin(SD_IO_PLAYBACK);
+    int ret = stat(path, st);
+    sd_arbiter_end(SD_IO_PLAYBACK);
+    return ret;
+}
+
+esp_err_t shared_read_init(void) {
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < SHARED_READ_MAX_FILES; i++) {
+        s_files[i].lock = xSemaphoreCreateMutex();
+        if (!s_files[i].lock) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    const esp_vfs_t vfs = {
+        .flags = ESP_VFS_FLAG_DEFAULT,
+        .open = vfs_open,
+        .read = vfs_read,
+        .pread = vfs_pread,
+        .lseek = vfs_lseek,
+        .close = vfs_close,
+        .fstat = vfs_fstat,
+        .stat = vfs_stat,
+    };
+    return esp_vfs_register(SHARED_READ_MOUNT, &vfs, NULL);
+}
+
+const char *shared_read_path(const char *path, char *buf, size_t len) {
+    if (!s_lock || strncmp(path, SD_PREFIX, strlen(SD_PREFIX)) != 0) {
+        return path;
+    }
+    if ((size_t)snprintf(buf, len, SHARED_READ_MOUNT "%s", path) >= len) {
+        return path;
+    }
+    return buf;
+}
+
+const char *shared_read_path_at(const char *path, uint32_t start, char *buf, size_t len) {
+    if (start == 0) {
+        return shared_read_path(path, buf, len);
+    }
+    if (!s_lock || strncmp(path, SD_PREFIX, strlen(SD_PREFIX)) != 0) {
+        return NULL;
+    }
+    if ((size_t)snprintf(buf, len, SHARED_READ_MOUNT VIEW_PREFIX "%" PRIu32 "%s", start, path) >= len) {
+        return NULL;
+    }
+    return buf;
+}
+
+void shared_read_get_stats(shared_read_stats_t *stats) {
+    if (!s_lock) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *stats = s_stats;
+    xSemaphoreGive(s_lock);
+}
@@ -0,0 +1,65 @@
+#ifndef SHARED_READ_H
+#define SHARED_READ_H
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+#include "play_sdcard.h"
+
+// One read of the card for tracks playing the same file.
+//
+// Tracks open "/shared/sdcard/x.wav" instead of "/sdcard/x.wav" (see
+// shared_read_path()). Readers of the same file share one open file. While
+// there is only one, reads go straight through; once a second track opens
+// it, both read through a cache of SHARED_READ_BLOCK sized blocks in PSRAM,
+// least recently used out. A file that fits in SHARED_READ_BLOCKS blocks is
+// then read from the card once per loop whoever is playing it; a longer one
+// once as long as the tracks are less than the cache apart.
+
+#define SHARED_READ_MOUNT           "/shared"
+#define SHARED_READ_BLOCK           (16 * 1024)
+#define SHARED_READ_BLOCKS          16          // per shared file, 256 KB of PSRAM
+#define SHARED_READ_MAX_FILES       MAX_TRACKS
+#define SHARED_READ_MAX_OPEN        (2 * MAX_TRACKS)
+
+typedef struct {
+    uint64_t card_bytes;            // read from the underlying file system
+    uint64_t served_bytes;          // handed to readers
+    uint32_t hits;                  // block reads served from the cache
+    uint32_t misses;                // blocks read from the card
+    uint32_t open_files;            // distinct files open
+    uint32_t shared_files;          // of those, with more than one reader
+    uint32_t cache_bytes;           // PSRAM held by the caches
+} shared_read_stats_t;
+
+/**
+ * @brief Register the VFS at SHARED_READ_MOUNT
+ */
+esp_err_t shared_read_init(void);
+
+/**
+ * @brief The path a track should open for path
+ *
+ * SD card paths get the SHARED_READ_MOUNT prefix, anything else (the flash
+ * store is memory already) comes back unchanged.
+ *
+ * @param buf Room for the result, used only when the path changes
+ * @return path or buf
+ */
+const char *shared_read_path(const char *path, char *buf, size_t len);
+
+/**
+ * @brief The path a track should open to start start bytes into an SD card file
+ *
+ * A WAV file reads as a plain header followed by its data from start, which
+ * should be a block boundary; anything else reads from start, which should
+ * be where a frame begins. Position 0 of what the track reads is then
+ * start in the file. Loops go back to shared_read_path().
+ *
+ * @return buf, or NULL if path isn't on the card or doesn't fit
+ */
+const char *shared_read_path_at(const char *path, uint32_t start, char *buf, size_t len);
+
+void shared_read_get_stats(shared_read_stats_t *stats);
+
+#endif /* SHARED_READ_H */
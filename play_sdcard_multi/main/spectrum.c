@@ -0,0 +1,273 @@
+/* Spectrum analyser on the master bus, see spectrum.h
+
+   Left and right go into the FFT together, as the real and imaginary parts
+   of one signal, as in the convolver. With Z the transform of L + iR, the
+   two channels' power in bin k add up to (|Z[k]|^2 + |Z[N-k]|^2) / 2, so
+   one transform gives both without separating them.
+
+   The tap and the task hand s_capture back and forth with s_armed and
+   s_ready: the task clears s_fill and sets s_armed, the tap fills the block,
+   clears s_armed and gives s_ready. Only one side touches the block at a
+   time. s_lock covers the published spectrum and the wake up.
+
+   Author: Brian Bulkowski brian@bulkowski.org
+*/
+
+#include <math.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "heap_tracker.h"
+#include "wav_header.h"
+#include "spectrum.h"
+
+static const char *TAG = "SPECTRUM";
+
+#define N               SPECTRUM_FFT_SIZE
+// Power summed over a band counts a windowed sine 1.5 times, Hann's noise bandwidth in bins
+#define HANN_ENBW       1.5f
+
+struct spectrum_analyser {
+    float *window;                  // Hann, with 1/32768 folded in
+    float *power;                   // per bin, summed over the blocks so far
+    float *work;                    // one block, complex
+    uint32_t blocks;
+};
+
+// Nominal centres; the edges are a sixth of an octave either side of
+// 1000 * 2^(n/3), from n = -6
+static const uint16_t s_band_hz[SPECTRUM_BANDS] = {
+    250, 315, 400, 500, 630, 800, 1000, 1250, 1600, 2000,
+    2500, 3150, 4000, 5000, 6300, 8000, 10000, 12500, 16000, 20000,
+};
+static int8_t s_band_of_bin[SPECTRUM_BINS];
+static bool s_bands_mapped;
+
+static SemaphoreHandle_t s_lock;
+static SemaphoreHandle_t s_ready;
+static SemaphoreHandle_t s_wake;
+static TaskHandle_t s_task;
+static spectrum_analyser_t *s_analyser;
+static spectrum_t *s_latest;
+static int64_t s_latest_us;         // when it was finished, 0 for never
+static bool s_running;              // the task is analysing, not waiting on s_wake
+static TickType_t s_last_request;
+
+static int16_t *s_capture;
+static volatile uint32_t s_fill;
+static volatile bool s_armed;
+
+static void map_bands(void) {
+    if (s_bands_mapped) {
+        return;
+    }
+    for (int k = 0; k < SPECTRUM_BINS; k++) {
+        s_band_of_bin[k] = -1;
+        float hz = spectrum_bin_hz(k);
+        if (hz > 0) {
+            int band = (int)lrintf(3.0f * log2f(hz / 1000.0f)) + 6;
+            if (band >= 0 && band < SPECTRUM_BANDS) {
+                s_band_of_bin[k] = band;
+            }
+        }
+    }
+    s_bands_mapped = true;
+}
+
+uint32_t spectrum_band_hz(int band) {
+    return band >= 0 && band < SPECTRUM_BANDS ? s_band_hz[band] : 0;
+}
+
+float spectrum_bin_hz(int bin) {
+    return (float)bin * WAV_NATIVE_SAMPLE_RATE / N;
+}
+
+spectrum_analyser_t *spectrum_analyser_create(void) {
+    map_bands();
+    spectrum_analyser_t *a = heap_tracker_calloc(1, sizeof(*a), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!a) {
+        return NULL;
+    }
+    a->window = heap_tracker_malloc(N * sizeof(float), MALLOC_CAP_SPIRAM);
+    a->power = heap_tracker_calloc(SPECTRUM_BINS, sizeof(float), MALLOC_CAP_SPIRAM);
+    a->work = heap_tracker_malloc(2 * N * sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!a->window || !a->power || !a->work) {
+        spectrum_analyser_destroy(a);
+        return NULL;
+    }
+    for (int i = 0; i < N; i++) {
+        a->window[i] = 0.5f * (1.0f - cosf(2.0f * (float)M_PI * i / N)) / 32768.0f;
+    }
+    return a;
+}
+
+void spectrum_analyser_destroy(spectrum_analyser_t *a) {
+    if (!a) {
+        return;
+    }
+    free(a->window);
+    free(a->power);
+    free(a->work);
+    free(a);
+}
+
+void spectrum_analyser_add(spectrum_analyser_t *a, const int16_t *pcm) {
+    float *x = a->work;
+    for (int i = 0; i < N; i++) {
+        x[2 * i] = pcm[2 * i] * a->window[i];
+        x[2 * i + 1] = pcm[2 * i + 1] * a->window[i];
+    }
+    convolver_fft(x);
+    for (int k = 0; k < SPECTRUM_BINS; k++) {
+        int j = (N - k) & (N - 1);
+        a->power[k] += x[2 * k] * x[2 * k] + x[2 * k + 1] * x[2 * k + 1] +
+                       x[2 * j] * x[2 * j] + x[2 * j + 1] * x[2 * j + 1];
+    }
+    a->blocks++;
+}
+
+static float to_db(float power) {
+    // log10f(0) is -inf, which the floor catches
+    float db = 10.0f * log10f(power);
+    return db > SPECTRUM_FLOOR_DB ? db : SPECTRUM_FLOOR_DB;
+}
+
+bool spectrum_analyser_result(spectrum_analyser_t *a, spectrum_t *out) {
+    if (a->blocks == 0) {
+        return false;
+    }
+    // A full scale sine peaks at N/4 in its bin through the window; the sum
+    // above is four times the mean of the channels' power
+    float norm = 1.0f / (4.0f * (N / 4.0f) * (N / 4.0f) * a->blocks);
+    float bands[SPECTRUM_BANDS] = {0};
+    for (int k = 0; k < SPECTRUM_BINS; k++) {
+        float p = a->power[k] * norm;
+        out->bins_db[k] = to_db(p);
+        if (s_band_of_bin[k] >= 0) {
+            bands[s_band_of_bin[k]] += p;
+        }
+        a->power[k] = 0;
+    }
+    for (int b = 0; b < SPECTRUM_BANDS; b++) {
+        out->bands_db[b] = to_db(bands[b] / HANN_ENBW);
+    }
+    out->blocks = a->blocks;
+    a->blocks = 0;
+    return true;
+}
+
+void spectrum_tap(const int16_t *pcm, uint32_t frames) {
+    if (!s_armed) {
+        return;
+    }
+    uint32_t n = N - s_fill;
+    if (n > frames) {
+        n = frames;
+    }
+    memcpy(s_capture + 2 * s_fill, pcm, n * 2 * sizeof(int16_t));
+    s_fill += n;
+    if (s_fill == N) {
+        s_armed = false;
+        xSemaphoreGive(s_ready);
+    }
+}
+
+static void spectrum_task(void *arg) {
+    ESP_LOGI(TAG, "Analysing");
+    for (;;) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        bool idle = xTaskGetTickCount() - s_last_request > pdMS_TO_TICKS(SPECTRUM_IDLE_MS);
+        if (idle) {
+            s_running = false;
+        }
+        xSemaphoreGive(s_lock);
+        if (idle) {
+            ESP_LOGI(TAG, "No one asking, idle");
+            xSemaphoreTake(s_wake, portMAX_DELAY);
+            ESP_LOGI(TAG, "Analysing");
+            continue;
+        }
+
+        TickType_t wake = xTaskGetTickCount();
+        for (int b = 0; b < SPECTRUM_BLOCKS; b++) {
+            // A block finished after the last wait gave up
+            xSemaphoreTake(s_ready, 0);
+            s_fill = 0;
+            s_armed = true;
+            if (xSemaphoreTake(s_ready, pdMS_TO_TICKS(SPECTRUM_UPDATE_MS)) != pdTRUE) {
+                // The bus isn't running
+                s_armed = false;
+                break;
+            }
+            spectrum_analyser_add(s_analyser, s_capture);
+        }
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        if (spectrum_analyser_result(s_analyser, s_latest)) {
+            s_latest_us = esp_timer_get_time();
+        }
+        xSemaphoreGive(s_lock);
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(SPECTRUM_UPDATE_MS));
+    }
+}
+
+// With s_lock held
+static esp_err_t spectrum_start(void) {
+    s_analyser = spectrum_analyser_create();
+    s_latest = heap_tracker_calloc(1, sizeof(spectrum_t), MALLOC_CAP_SPIRAM);
+    s_capture = heap_tracker_malloc(N * 2 * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    s_running = true;
+    if (!s_analyser || !s_latest || !s_capture ||
+        xTaskCreatePinnedToCore(spectrum_task, "spectrum", 3072, NULL, 2, &s_task, 0) != pdPASS) {
+        spectrum_analyser_destroy(s_analyser);
+        free(s_latest);
+        free(s_capture);
+        s_analyser = NULL;
+        s_latest = NULL;
+        s_capture = NULL;
+        s_running = false;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t spectrum_get(spectrum_t *out, uint32_t *age_ms) {
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_last_request = xTaskGetTickCount();
+    if (!s_task) {
+        err = spectrum_start();
+    } else if (!s_running) {
+        s_running = true;
+        xSemaphoreGive(s_wake);
+    }
+    if (err == ESP_OK) {
+        int64_t age_us = esp_timer_get_time() - s_latest_us;
+        if (s_latest_us == 0 || age_us > 2 * SPECTRUM_UPDATE_MS * 1000LL) {
+            err = ESP_ERR_NOT_FOUND;
+        } else {
+            memcpy(out, s_latest, sizeof(*out));
+            *age_ms = (uint32_t)(age_us / 1000);
+        }
+    }
+    xSemaphoreGive(s_lock);
+    return err;
+}
+
+esp_err_t spectrum_init(void) {
+    if (s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_lock = xSemaphoreCreateMutex();
+    s_ready = xSemaphoreCreateBinary();
+    s_wake = xSemaphoreCreateBinary();
+    if (!s_lock || !s_ready || !s_wake) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,95 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "convolver.h"
+
+// Spectrum analyser on the master bus, for tuning correction filters and
+// hunting speaker buzz without a laptop and a measurement mic.
+//
+// The bus offers blocks to spectrum_tap() after speaker correction, so it
+// sees what goes to the DAC. The tap is lossy: it copies one block of
+// SPECTRUM_FFT_SIZE frames when the analyser asks for one and ignores the
+// rest, so the bus never waits on it. A low priority task windows each
+// block (Hann), transforms it with the convolver's FFT and averages
+// SPECTRUM_BLOCKS of them into a spectrum every SPECTRUM_UPDATE_MS.
+//
+// It only runs while someone is asking. Each spectrum_get() keeps it going
+// for SPECTRUM_IDLE_MS; after that the task sleeps and the tap is a single
+// flag test. Nothing is allocated until the first spectrum_get().
+//
+// Levels are dBFS per bin, the mean of the two channels' power, with a full
+// scale sine on both channels at 0 dBFS in its bin. Bins are 86 Hz apart,
+// so the 1/3 octave bands start at 250 Hz: below that a bin is wider than
+// a band.
+
+#define SPECTRUM_FFT_SIZE       CONVOLVER_FFT_SIZE              // frames a block
+#define SPECTRUM_BINS           (SPECTRUM_FFT_SIZE / 2)          // DC up to just below Nyquist
+#define SPECTRUM_BANDS          20                               // 1/3 octaves, 250 Hz to 20 kHz
+#define SPECTRUM_UPDATE_MS      250
+#define SPECTRUM_BLOCKS         8                                // averaged into each update
+#define SPECTRUM_IDLE_MS        5000
+#define SPECTRUM_FLOOR_DB       -120.0f
+
+typedef struct {
+    float bins_db[SPECTRUM_BINS];
+    float bands_db[SPECTRUM_BANDS];
+    uint32_t blocks;                // averaged into this one
+} spectrum_t;
+
+typedef struct spectrum_analyser spectrum_analyser_t;
+
+/**
+ * @brief Make an analyser
+ *
+ * @return NULL if memory is short
+ */
+spectrum_analyser_t *spectrum_analyser_create(void);
+
+/**
+ * @brief Add one block of SPECTRUM_FFT_SIZE interleaved stereo frames
+ */
+void spectrum_analyser_add(spectrum_analyser_t *a, const int16_t *pcm);
+
+/**
+ * @brief The average of the blocks added since the last call, and start over
+ *
+ * @return false if none were added
+ */
+bool spectrum_analyser_result(spectrum_analyser_t *a, spectrum_t *out);
+
+void spectrum_analyser_destroy(spectrum_analyser_t *a);
+
+/**
+ * @brief Centre of a band, the nominal 1/3 octave frequency in Hz
+ */
+uint32_t spectrum_band_hz(int band);
+
+/**
+ * @brief Centre of a bin in Hz
+ */
+float spectrum_bin_hz(int bin);
+
+/**
+ * @brief Set up the master bus stage. The analyser starts with the first spectrum_get()
+ */
+esp_err_t spectrum_init(void);
+
+/**
+ * @brief Master bus stage, called with each block I2S reads. Doesn't change it
+ */
+void spectrum_tap(const int16_t *pcm, uint32_t frames);
+
+/**
+ * @brief The latest spectrum, and keep the analyser running for SPECTRUM_IDLE_MS
+ *
+ * @param age_ms how long ago it was finished
+ * @return ESP_OK, ESP_ERR_NOT_FOUND while there is none newer than two
+ *         updates (just woken, or the bus isn't running), ESP_ERR_NO_MEM if
+ *         the analyser couldn't start, ESP_ERR_INVALID_STATE before init
+ */
+esp_err_t spectrum_get(spectrum_t *out, uint32_t *age_ms);
+
+#endif /* SPECTRUM_H */
@@ -0,0 +1,266 @@
+/* Continuous per task CPU and stack profiler.
+
+   Once a period the FreeRTOS run time counters are diffed into a small
+   rolling window per task. Core load is derived from the idle tasks. Audio
+   path tasks (the ADF element tasks, named after their pipeline tags) are
+   flagged when their core has no slack left or their stack is nearly
+   exhausted.
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "heap_tracker.h"
+#include "task_profiler.h"
+
+static const char *TAG = "TASK_PROF";
+
+typedef struct {
+    TaskHandle_t handle;
+    char name[configMAX_TASK_NAME_LEN];
+    int8_t core;
+    uint8_t priority;
+    eTaskState state;
+    uint32_t last_counter;
+    uint32_t deltas[TASK_PROFILER_WINDOW];
+    uint32_t stack_hwm;
+    bool audio_path;
+    bool is_idle;
+    bool seen;
+    uint8_t flags;
+} profiled_task_t;
+
+typedef struct {
+    profiled_task_t tasks[TASK_PROFILER_MAX_TASKS];
+    int n_tasks;
+    uint32_t elapsed[TASK_PROFILER_WINDOW];
+    int head;                       // slot written by the latest period
+    int filled;
+    uint32_t last_total;
+    TaskStatus_t scratch[TASK_PROFILER_MAX_TASKS];
+} task_profiler_t;
+
+static task_profiler_t *s_prof = NULL;
+static SemaphoreHandle_t s_prof_mutex = NULL;
+
+// ADF element tags used by play_sdcard_passthrough.c
+static bool is_audio_task(const char *name) {
+    return strncmp(name, "file_", 5) == 0 || strncmp(name, "dec_", 4) == 0 ||
+           strcmp(name, "downmix") == 0 || strcmp(name, "i2s") == 0;
+}
+
+static profiled_task_t *find_or_add(const TaskStatus_t *t) {
+    for (int i = 0; i < s_prof->n_tasks; i++) {
+        if (s_prof->tasks[i].handle == t->xHandle) {
+            return &s_prof->tasks[i];
+        }
+    }
+    if (s_prof->n_tasks >= TASK_PROFILER_MAX_TASKS) {
+        return NULL;
+    }
+    profiled_task_t *p = &s_prof->tasks[s_prof->n_tasks++];
+    memset(p, 0, sizeof(*p));
+    p->handle = t->xHandle;
+    p->last_counter = t->ulRunTimeCounter;
+    strlcpy(p->name, t->pcTaskName, sizeof(p->name));
+    p->audio_path = is_audio_task(p->name);
+    p->is_idle = strncmp(p->name, "IDLE", 4) == 0;
+    return p;
+}
+
+static float window_sum(const uint32_t *values) {
+    float sum = 0;
+    for (int i = 0; i < s_prof->filled; i++) {
+        sum += values[(s_prof->head - i + TASK_PROFILER_WINDOW) % TASK_PROFILER_WINDOW];
+    }
+    return sum;
+}
+
+static void compute_core_load(task_profiler_core_t *cores) {
+    uint32_t elapsed_last = s_prof->elapsed[s_prof->head];
+    float elapsed_window = window_sum(s_prof->elapsed);
+
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        cores[c].load_last = 0;
+        cores[c].load_window = 0;
+    }
+    for (int i = 0; i < s_prof->n_tasks; i++) {
+        profiled_task_t *p = &s_prof->tasks[i];
+        if (!p->is_idle || p->core < 0 || p->core >= portNUM_PROCESSORS) {
+            continue;
+        }
+        if (elapsed_last > 0) {
+            cores[p->core].load_last = 100.0f - 100.0f * p->deltas[s_prof->head] / elapsed_last;
+        }
+        if (elapsed_window > 0) {
+            cores[p->core].load_window = 100.0f - 100.0f * window_sum(p->deltas) / elapsed_window;
+        }
+    }
+}
+
+static void sample(void) {
+    uint32_t total;
+    UBaseType_t count = uxTaskGetSystemState(s_prof->scratch, TASK_PROFILER_MAX_TASKS, &total);
+    if (count == 0) {
+        ESP_LOGW(TAG, "More than %d tasks, profile skipped", TASK_PROFILER_MAX_TASKS);
+        return;
+    }
+
+    xSemaphoreTake(s_prof_mutex, portMAX_DELAY);
+
+    bool first = (s_prof->last_total == 0);
+    s_prof->head = (s_prof->head + 1) % TASK_PROFILER_WINDOW;
+    s_prof->elapsed[s_prof->head] = total - s_prof->last_total;
+    s_prof->last_total = total;
+    if (!first && s_prof->filled < TASK_PROFILER_WINDOW) {
+        s_prof->filled++;
+    }
+
+    for (int i = 0; i < s_prof->n_tasks; i++) {
+        s_prof->tasks[i].seen = false;
+    }
+    for (UBaseType_t i = 0; i < count; i++) {
+        const TaskStatus_t *t = &s_prof->scratch[i];
+        profiled_task_t *p = find_or_add(t);
+        if (p == NULL) {
+            continue;
+        }
+        p->seen = true;
+        p->deltas[s_prof->head] = t->ulRunTimeCounter - p->last_counter;
+        p->last_counter = t->ulRunTimeCounter;
+        p->stack_hwm = t->usStackHighWaterMark;
+        p->priority = (uint8_t)t->uxCurrentPriority;
+        p->state = t->eCurrentState;
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+        p->core = (t->xCoreID == tskNO_AFFINITY) ? -1 : (int8_t)t->xCoreID;
+#else
+        p->core = -1;
+#endif
+    }
+
+    // Drop deleted tasks, the ADF element tasks come and go with the pipelines
+    for (int i = 0; i < s_prof->n_tasks; ) {
+        if (!s_prof->tasks[i].seen) {
+            s_prof->tasks[i] = s_prof->tasks[--s_prof->n_tasks];
+        } else {
+            i++;
+        }
+    }
+
+    task_profiler_core_t cores[portNUM_PROCESSORS];
+    compute_core_load(cores);
+
+    for (int i = 0; i < s_prof->n_tasks && s_prof->filled > 0; i++) {
+        profiled_task_t *p = &s_prof->tasks[i];
+        if (!p->audio_path) {
+            continue;
+        }
+        uint8_t flags = 0;
+        if (p->core >= 0 && cores[p->core].load_last >= TASK_PROFILER_CORE_BUSY_PCT) {
+            flags |= TASK_PROFILER_FLAG_CORE_SATURATED;
+        }
+        if (p->stack_hwm < TASK_PROFILER_STACK_LOW_BYTES) {
+            flags |= TASK_PROFILER_FLAG_STACK_LOW;
+        }
+        // Only log transitions, the endpoint has the current state
+        uint8_t raised = flags & ~p->flags;
+        if (raised & TASK_PROFILER_FLAG_CORE_SATURATED) {
+            ESP_LOGW(TAG, "%s: core %d at %.0f%%, audio task at risk of starvation",
+                     p->name, p->core, cores[p->core].load_last);
+        }
+        if (raised & TASK_PROFILER_FLAG_STACK_LOW) {
+            ESP_LOGW(TAG, "%s: only %lu bytes of stack never used", p->name, (unsigned long)p->stack_hwm);
+        }
+        p->flags = flags;
+    }
+
+    xSemaphoreGive(s_prof_mutex);
+}
+
+static void task_profiler_task(void *pvParameters) {
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1) {
+        sample();
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(TASK_PROFILER_PERIOD_MS));
+    }
+}
+
+esp_err_t task_profiler_init(void) {
+    if (s_prof != NULL) {
+        return ESP_OK;
+    }
+
+    s_prof_mutex = xSemaphoreCreateMutex();
+    if (s_prof_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_prof = heap_tracker_calloc(1, sizeof(task_profiler_t), MALLOC_CAP_SPIRAM);
+    if (s_prof == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate profiler state");
+        vSemaphoreDelete(s_prof_mutex);
+        s_prof_mutex = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreatePinnedToCore(task_profiler_task, "task_prof", 3072, NULL, 4, NULL, 0) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create profiler task");
+        free(s_prof);
+        s_prof = NULL;
+        vSemaphoreDelete(s_prof_mutex);
+        s_prof_mutex = NULL;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+int task_profiler_get(task_profiler_entry_t *tasks, int max_tasks,
+                      task_profiler_core_t *cores, uint32_t *window_ms) {
+    if (s_prof == NULL) {
+        return 0;
+    }
+
+    xSemaphoreTake(s_prof_mutex, portMAX_DELAY);
+
+    int n = 0;
+    if (s_prof->filled > 0) {
+        uint32_t elapsed_last = s_prof->elapsed[s_prof->head];
+        float elapsed_window = window_sum(s_prof->elapsed);
+
+        for (int i = 0; i < s_prof->n_tasks && n < max_tasks; i++) {
+            const profiled_task_t *p = &s_prof->tasks[i];
+            task_profiler_entry_t *e = &tasks[n++];
+            strlcpy(e->name, p->name, sizeof(e->name));
+            e->core = p->core;
+            e->priority = p->priority;
+            e->state = p->state;
+            e->cpu_last = elapsed_last ? 100.0f * p->deltas[s_prof->head] / elapsed_last : 0;
+            e->cpu_window = elapsed_window > 0 ? 100.0f * window_sum(p->deltas) / elapsed_window : 0;
+            e->cpu_peak = 0;
+            for (int k = 0; k < s_prof->filled; k++) {
+                int slot = (s_prof->head - k + TASK_PROFILER_WINDOW) % TASK_PROFILER_WINDOW;
+                if (s_prof->elapsed[slot] > 0) {
+                    float pct = 100.0f * p->deltas[slot] / s_prof->elapsed[slot];
+                    if (pct > e->cpu_peak) {
+                        e->cpu_peak = pct;
+                    }
+                }
+            }
+            e->stack_hwm = p->stack_hwm;
+            e->audio_path = p->audio_path;
+            e->flags = p->flags;
+        }
+        if (cores) {
+            compute_core_load(cores);
+        }
+        if (window_ms) {
+            // Run time counter is in microseconds
+            *window_ms = (uint32_t)(elapsed_window / 1000);
+        }
+    }
+
+    xSemaphoreGive(s_prof_mutex);
+    return n;
+}
@@ -0,0 +1,63 @@
+#ifndef TASK_PROFILER_H
+#define TASK_PROFILER_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Sampling period and the number of periods in the rolling window
+#define TASK_PROFILER_PERIOD_MS         1000
+#define TASK_PROFILER_WINDOW            10
+
+#define TASK_PROFILER_MAX_TASKS         32
+
+// A core with less idle than this in the last period can't absorb a burst;
+// audio tasks pinned to it are flagged as at risk of starvation
+#define TASK_PROFILER_CORE_BUSY_PCT     90
+
+// Audio tasks with less stack headroom than this are flagged
+#define TASK_PROFILER_STACK_LOW_BYTES   512
+
+#define TASK_PROFILER_FLAG_CORE_SATURATED  (1 << 0)
+#define TASK_PROFILER_FLAG_STACK_LOW       (1 << 1)
+
+typedef struct {
+    char name[configMAX_TASK_NAME_LEN];
+    int8_t core;                    // -1 when not pinned
+    uint8_t priority;
+    eTaskState state;
+    float cpu_last;                 // percent of its core over the last period
+    float cpu_window;               // percent of its core over the window
+    float cpu_peak;                 // highest single period in the window
+    uint32_t stack_hwm;             // bytes of stack never used
+    bool audio_path;
+    uint8_t flags;                  // TASK_PROFILER_FLAG_*
+} task_profiler_entry_t;
+
+typedef struct {
+    float load_last;                // non-idle percent over the last period
+    float load_window;              // non-idle percent over the window
+} task_profiler_core_t;
+
+/**
+ * @brief Start the background task profiler
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t task_profiler_init(void);
+
+/**
+ * @brief Copy the current profile
+ *
+ * @param tasks Output array
+ * @param max_tasks Size of the output array
+ * @param cores Output array of portNUM_PROCESSORS entries, may be NULL
+ * @param window_ms Actual time covered by the window, may be NULL
+ * @return int Number of tasks written, 0 before the first full period
+ */
+int task_profiler_get(task_profiler_entry_t *tasks, int max_tasks,
+                      task_profiler_core_t *cores, uint32_t *window_ms);
+
+#endif // TASK_PROFILER_H
@@ -0,0 +1,123 @@
+/* File reader for the track pipelines, see track_reader.h
+
+   Laid out as the ADF's fatfs_stream reader: process moves one buffer from
+   the read callback to the output ringbuffer, and reaching the end of the
+   file finishes the element. The difference is only in open.
+
+   Author: Brian Bulkowski brian@bulkowski.org
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "heap_tracker.h"
+#include "track_reader.h"
+
+static const char *TAG = "TRACK_READER";
+
+typedef struct {
+    FILE *file;
+} track_reader_t;
+
+static esp_err_t reader_open(audio_element_handle_t self) {
+    track_reader_t *reader = audio_element_getdata(self);
+    const char *uri = audio_element_get_uri(self);
+    if (!uri) {
+        ESP_LOGE(TAG, "[%s] No URI set", audio_element_get_tag(self));
+        return ESP_FAIL;
+    }
+    if (reader->file) {
+        ESP_LOGW(TAG, "[%s] Already opened", audio_element_get_tag(self));
+        return ESP_OK;
+    }
+    reader->file = fopen(uri, "rb");
+    if (!reader->file) {
+        ESP_LOGE(TAG, "Failed to open %s: %s", uri, strerror(errno));
+        return ESP_FAIL;
+    }
+
+    audio_element_info_t info;
+    audio_element_getinfo(self, &info);
+    fseek(reader->file, 0, SEEK_END);
+    info.total_bytes = ftell(reader->file);
+    if (info.byte_pos > 0 && info.byte_pos < info.total_bytes) {
+        fseek(reader->file, info.byte_pos, SEEK_SET);
+    } else {
+        fseek(reader->file, 0, SEEK_SET);
+        info.byte_pos = 0;
+    }
+    audio_element_setinfo(self, &info);
+    ESP_LOGD(TAG, "Opened %s, %lld bytes from %lld", uri, (long long)info.total_bytes, (long long)info.byte_pos);
+    return ESP_OK;
+}
+
+static audio_element_err_t reader_read(audio_element_handle_t self, char *buffer, int len,
+                                       TickType_t ticks_to_wait, void *context) {
+    track_reader_t *reader = audio_element_getdata(self);
+    size_t n = fread(buffer, 1, len, reader->file);
+    if (n == 0) {
+        if (ferror(reader->file)) {
+            ESP_LOGE(TAG, "[%s] Read failed: %s", audio_element_get_tag(self), strerror(errno));
+            return AEL_IO_FAIL;
+        }
+        return AEL_IO_DONE;
+    }
+    audio_element_update_byte_pos(self, n);
+    return n;
+}
+
+static audio_element_err_t reader_process(audio_element_handle_t self, char *in_buffer, int in_len) {
+    int r_size = audio_element_input(self, in_buffer, in_len);
+    if (r_size <= 0) {
+        return r_size;
+    }
+    return audio_element_output(self, in_buffer, r_size);
+}
+
+static esp_err_t reader_close(audio_element_handle_t self) {
+    track_reader_t *reader = audio_element_getdata(self);
+    if (reader->file) {
+        fclose(reader->file);
+        reader->file = NULL;
+    }
+    if (audio_element_get_state(self) != AEL_STATE_PAUSED) {
+        audio_element_info_t info;
+        audio_element_getinfo(self, &info);
+        info.byte_pos = 0;
+        audio_element_setinfo(self, &info);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t reader_destroy(audio_element_handle_t self) {
+    free(audio_element_getdata(self));
+    return ESP_OK;
+}
+
+audio_element_handle_t track_reader_init(track_reader_cfg_t *config) {
+    track_reader_t *reader = heap_tracker_calloc(1, sizeof(*reader), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!reader) {
+        return NULL;
+    }
+    audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+    cfg.open = reader_open;
+    cfg.process = reader_process;
+    cfg.close = reader_close;
+    cfg.destroy = reader_destroy;
+    cfg.read = reader_read;
+    cfg.buffer_len = config->buf_sz;
+    cfg.out_rb_size = config->out_rb_size;
+    cfg.task_stack = config->task_stack;
+    cfg.task_core = config->task_core;
+    cfg.task_prio = config->task_prio;
+    cfg.tag = "file";
+    audio_element_handle_t el = audio_element_init(&cfg);
+    if (!el) {
+        free(reader);
+        return NULL;
+    }
+    audio_element_setdata(el, reader);
+    return el;
+}
@@ -0,0 +1,43 @@
+#ifndef TRACK_READER_H
+#define TRACK_READER_H
+
+#include "audio_element.h"
+
+// The file reader at the head of each track pipeline.
+//
+// The ADF's fatfs_stream opens only what follows "/sdcard" in its URI, so
+// "/shared/sdcard/x.wav" would read the card behind the shared cache's
+// back, "/shared/@N/sdcard/x.wav" would start at byte 0, and
+// "/flash/x.wav" wouldn't open at all. This reader fopen()s the URI as it
+// is, so each of those reaches its VFS. Otherwise it behaves as the fatfs
+// reader: it starts at byte_pos if that is set, keeps the position only
+// across a pause, and reports the file size in total_bytes.
+
+#define TRACK_READER_BUF_SIZE           (2048)
+#define TRACK_READER_TASK_STACK         (3072)
+#define TRACK_READER_TASK_CORE          (0)
+#define TRACK_READER_TASK_PRIO          (4)
+#define TRACK_READER_RINGBUFFER_SIZE    (8 * 1024)
+
+typedef struct {
+    int buf_sz;
+    int out_rb_size;
+    int task_stack;
+    int task_core;
+    int task_prio;
+} track_reader_cfg_t;
+
+#define TRACK_READER_CFG_DEFAULT() {                    \
+        .buf_sz = TRACK_READER_BUF_SIZE,                \
+        .out_rb_size = TRACK_READER_RINGBUFFER_SIZE,    \
+        .task_stack = TRACK_READER_TASK_STACK,          \
+        .task_core = TRACK_READER_TASK_CORE,            \
+        .task_prio = TRACK_READER_TASK_PRIO,            \
+    }
+
+/**
+ * @brief Create a reader element; set the file with audio_element_set_uri()
+ */
+audio_element_handle_t track_reader_init(track_reader_cfg_t *config);
+
+#endif /* TRACK_READER_H */
@@ -5,6 +5,7 @@
 #include "esp_netif.h"
 #include "esp_mac.h"
 #include "esp_timer.h"
+#include "sd_arbiter.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include <string.h>
@@ -146,8 +147,10 @@ esp_err_t unit_status_get_id(char *id, size_t max_len)
 
 esp_err_t unit_status_load_from_sd(void)
 {
+    sd_arbiter_begin(SD_IO_METADATA);
     FILE *file = fopen(UNIT_ID_FILE_PATH, "r");
     if (!file) {
+        sd_arbiter_end(SD_IO_METADATA);
         ESP_LOGW(TAG, "Unit ID file not found: %s", UNIT_ID_FILE_PATH);
         return ESP_ERR_NOT_FOUND;
     }
@@ -157,6 +160,7 @@ esp_err_t unit_status_load_from_sd(void)
     
     size_t read = fread(buffer, 1, sizeof(buffer) - 1, file);
     fclose(file);
+    sd_arbiter_end(SD_IO_METADATA);
 
     if (read == 0) {
         ESP_LOGW(TAG, "Unit ID file is empty");
@@ -186,19 +190,23 @@ esp_err_t unit_status_save_to_sd(void)
 {
     // Check if SD card is mounted
     struct stat st;
+    sd_arbiter_begin(SD_IO_METADATA);
     if (stat("/sdcard", &st) != 0) {
+        sd_arbiter_end(SD_IO_METADATA);
         ESP_LOGE(TAG, "SD card not mounted");
         return ESP_ERR_NOT_FOUND;
     }
 
     FILE *file = fopen(UNIT_ID_FILE_PATH, "w");
     if (!file) {
+        sd_arbiter_end(SD_IO_METADATA);
         ESP_LOGE(TAG, "Failed to open unit ID file for writing: %s", UNIT_ID_FILE_PATH);
         return ESP_FAIL;
     }
 
     size_t written = fwrite(g_id, 1, strlen(g_id), file);
     fclose(file);
+    sd_arbiter_end(SD_IO_METADATA);
 
     if (written != strlen(g_id)) {
         ESP_LOGE(TAG, "Failed to write complete unit ID to file");
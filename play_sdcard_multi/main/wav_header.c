@@ -0,0 +1,193 @@
+/* WAV chunk walker, shared by the firmware and the host's asset tools
+ * (loudframe_wavinfo), so an asset is checked with the parser the board uses.
+ *
+ * Author: Brian Bulkowski brian@bulkowski.org
+ */
+
+#include "wav_header.h"
+
+#include <string.h>
+#include <sys/stat.h>
+
+#define WAVE_FORMAT_EXTENSIBLE  0xfffe
+
+// bext: Description 256, Originator 32, OriginatorReference 32, OriginationDate 10,
+// OriginationTime 8, TimeReference 8, Version 2, UMID 64, then the loudness fields
+#define BEXT_VERSION_OFFSET     346
+#define BEXT_LOUDNESS_OFFSET    412
+#define BEXT_TRUE_PEAK_OFFSET   416
+
+static uint32_t le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t le16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+// Reads want bytes of a chunk of size bytes into buf, and seeks past the rest
+// and the pad byte
+static esp_err_t read_chunk(FILE *f, uint32_t size, uint8_t *buf, uint32_t want) {
+    if (want > size) {
+        want = size;
+    }
+    if (fread(buf, 1, want, f) != want) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    long rest = (long)(size - want) + (size & 1);
+    if (rest && fseek(f, rest, SEEK_CUR) != 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+// Readers step through the data a block_align at a time, so it has to be
+// there, and for PCM and float be a frame
+static bool fmt_consistent(const wav_header_info_t *info) {
+    if (info->channels == 0 || info->block_align == 0) {
+        return false;
+    }
+    if (info->format == 1 || info->format == 3) {
+        return info->bits_per_sample > 0 &&
+               info->block_align == info->channels * ((info->bits_per_sample + 7) / 8);
+    }
+    return true;
+}
+
+esp_err_t wav_header_parse(FILE *f, wav_header_info_t *info) {
+    uint8_t h[40];
+    bool have_fmt = false;
+
+    memset(info, 0, sizeof(*info));
+    info->loudness = WAV_LOUDNESS_UNSET;
+    info->true_peak = WAV_LOUDNESS_UNSET;
+
+    if (fseek(f, 0, SEEK_SET) != 0 || fread(h, 1, 12, f) != 12) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (memcmp(h, "RIFF", 4) != 0 || memcmp(h + 8, "WAVE", 4) != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (;;) {
+        long at = ftell(f);
+        if (fread(h, 1, 8, f) != 8) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        uint32_t size = le32(h + 4);
+
+        if (memcmp(h, "data", 4) == 0) {
+            if (!have_fmt) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            if (!fmt_consistent(info)) {
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+            info->data_offset = (uint32_t)at + 8;
+            info->data_size = size;
+            return ESP_OK;
+        }
+
+        esp_err_t err;
+        if (memcmp(h, "fmt ", 4) == 0 && size >= 16) {
+            if ((err = read_chunk(f, size, h, 40)) != ESP_OK) {
+                return err;
+            }
+            info->format = le16(h);
+            info->channels = le16(h + 2);
+            info->sample_rate = le32(h + 4);
+            info->block_align = le16(h + 12);
+            info->bits_per_sample = le16(h + 14);
+            if (info->format == WAVE_FORMAT_EXTENSIBLE && size >= 40) {
+                // the subformat GUID starts with the plain format code
+                info->format = le16(h + 24);
+            }
+            have_fmt = true;
+        } else if (memcmp(h, "smpl", 4) == 0 && size >= 36) {
+            // 36 byte header, then 24 bytes a loop: id, type, start, end, ...
+            uint8_t s[36 + 24];
+            if ((err = read_chunk(f, size, s, sizeof(s))) != ESP_OK) {
+                return err;
+            }
+            if (size >= sizeof(s) && le32(s + 28) > 0) {
+                info->has_loop = true;
+                info->loop_start = le32(s + 36 + 8);
+                info->loop_end = le32(s + 36 + 12);
+            }
+        } else if (memcmp(h, "bext", 4) == 0 && size >= BEXT_TRUE_PEAK_OFFSET + 2) {
+            uint8_t b[BEXT_TRUE_PEAK_OFFSET + 2];
+            if ((err = read_chunk(f, size, b, sizeof(b))) != ESP_OK) {
+                return err;
+            }
+            if (le16(b + BEXT_VERSION_OFFSET) >= 2) {
+                info->loudness = (int16_t)le16(b + BEXT_LOUDNESS_OFFSET);
+                info->true_peak = (int16_t)le16(b + BEXT_TRUE_PEAK_OFFSET);
+                info->has_loudness = info->loudness != WAV_LOUDNESS_UNSET;
+            }
+        } else if (fseek(f, (long)size + (size & 1), SEEK_CUR) != 0) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+}
+
+uint32_t wav_header_data_size(const wav_header_info_t *info, off_t file_size) {
+    if (info->block_align == 0) {
+        return 0;
+    }
+    uint32_t size = info->data_size;
+    if (size == 0 || info->data_offset + (uint64_t)size > (uint64_t)file_size) {
+        size = file_size > info->data_offset ? (uint32_t)(file_size - info->data_offset) : 0;
+    }
+    return size - size % info->block_align;
+}
+
+esp_err_t wav_header_open(const char *path, FILE **f, wav_header_info_t *info) {
+    struct stat st;
+    *f = stat(path, &st) == 0 ? fopen(path, "rb") : NULL;
+    if (!*f) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = wav_header_parse(*f, info);
+    if (err != ESP_OK) {
+        fclose(*f);
+        *f = NULL;
+        return err;
+    }
+    info->data_size = wav_header_data_size(info, st.st_size);
+    return ESP_OK;
+}
+
+size_t wav_header_write(const wav_header_info_t *info, uint32_t data_size, uint8_t *buf) {
+    memcpy(buf, "RIFF", 4);
+    put32(buf + 4, WAV_HEADER_CANONICAL_LEN - 8 + data_size);
+    memcpy(buf + 8, "WAVEfmt ", 8);
+    put32(buf + 16, 16);
+    put16(buf + 20, info->format);
+    put16(buf + 22, info->channels);
+    put32(buf + 24, info->sample_rate);
+    put32(buf + 28, info->sample_rate * info->block_align);
+    put16(buf + 32, info->block_align);
+    put16(buf + 34, info->bits_per_sample);
+    memcpy(buf + 36, "data", 4);
+    put32(buf + 40, data_size);
+    return WAV_HEADER_CANONICAL_LEN;
+}
+
+bool wav_header_is_native(const wav_header_info_t *info) {
+    return info->format == 1 &&
+           info->sample_rate == WAV_NATIVE_SAMPLE_RATE &&
+           info->bits_per_sample == WAV_NATIVE_BITS &&
+           info->channels == WAV_NATIVE_CHANNELS;
+}
@@ -0,0 +1,93 @@
+#ifndef WAV_HEADER_H
+#define WAV_HEADER_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+// What the output pipeline runs at (play_sdcard.c). Files in any other
+// format are converted on the fly, or not played.
+#define WAV_NATIVE_SAMPLE_RATE  44100
+#define WAV_NATIVE_BITS         16
+#define WAV_NATIVE_CHANNELS     2
+
+// SD sector. A data chunk that starts on one is read without a split sector.
+#define WAV_DATA_ALIGN          512
+
+// RIFF, a 16 byte fmt and the data chunk header, see wav_header_write()
+#define WAV_HEADER_CANONICAL_LEN 44
+
+// bext loudness fields that were left out hold this
+#define WAV_LOUDNESS_UNSET      0x7fff
+
+typedef struct {
+    uint16_t format;            // 1 PCM, 3 float, 0xfffe extensible (its subformat here)
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint16_t bits_per_sample;
+    uint16_t block_align;
+    uint32_t data_offset;       // of the first sample
+    uint32_t data_size;
+
+    // smpl, the first loop. In frames, end inclusive.
+    bool has_loop;
+    uint32_t loop_start;
+    uint32_t loop_end;
+
+    // bext version 2 loudness, in hundredths (LUFS, dBTP), or WAV_LOUDNESS_UNSET
+    bool has_loudness;
+    int16_t loudness;
+    int16_t true_peak;
+} wav_header_info_t;
+
+/**
+ * @brief Walk a WAV file's chunks up to the start of the data
+ *
+ * Reads RIFF/WAVE, fmt, and on the way smpl and bext; everything else (LIST,
+ * JUNK, fact, ...) is skipped. Leaves the file position at the first sample.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG if it isn't a RIFF WAVE file,
+ *         ESP_ERR_INVALID_SIZE if it ends before the data chunk or has no fmt,
+ *         ESP_ERR_NOT_SUPPORTED if the fmt has no channels or block_align, or
+ *         for PCM and float a block_align other than channels * bytes per sample
+ */
+esp_err_t wav_header_parse(FILE *f, wav_header_info_t *info);
+
+/**
+ * @brief The bytes of samples a file of file_size bytes really holds, in whole frames
+ *
+ * Some writers leave the data size at 0, or too big; then it is everything
+ * from data_offset to the end of the file.
+ *
+ * @return 0 if there is no data, or the fmt has no block_align
+ */
+uint32_t wav_header_data_size(const wav_header_info_t *info, off_t file_size);
+
+/**
+ * @brief Open and parse a WAV file, data_size set by wav_header_data_size()
+ *
+ * @param f The file at its first sample on ESP_OK, NULL otherwise
+ * @return ESP_ERR_NOT_FOUND if it can't be opened, otherwise as wav_header_parse()
+ */
+esp_err_t wav_header_open(const char *path, FILE **f, wav_header_info_t *info);
+
+/**
+ * @brief Write the plainest header for info's format, followed by data_size bytes of data
+ *
+ * Only the format fields of info are used; an extensible file comes out as
+ * its plain format code.
+ *
+ * @param buf Room for WAV_HEADER_CANONICAL_LEN bytes
+ * @return WAV_HEADER_CANONICAL_LEN
+ */
+size_t wav_header_write(const wav_header_info_t *info, uint32_t data_size, uint8_t *buf);
+
+/**
+ * @brief True if the file plays without conversion: native rate, bits and channels, PCM
+ */
+bool wav_header_is_native(const wav_header_info_t *info);
+
+#endif /* WAV_HEADER_H */
@@ -1,4 +1,5 @@
 #include "wifi_manager.h"
+#include "metrics.h"
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
@@ -10,6 +11,7 @@
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
 #include "freertos/semphr.h"
+#include "heap_tracker.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -68,6 +70,7 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
         wifi_event_sta_disconnected_t* event = (wifi_event_sta_disconnected_t*) event_data;
         ESP_LOGI(TAG, "Disconnected from AP. Reason: %d", event->reason);
+        metrics_wifi_disconnected();
         
         xSemaphoreTake(s_wifi_mutex, portMAX_DELAY);
         
@@ -113,6 +116,7 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG, "Got IP address: " IPSTR, IP2STR(&event->ip_info.ip));
+        metrics_wifi_connected();
         
         xSemaphoreTake(s_wifi_mutex, portMAX_DELAY);
         ESP_LOGI(TAG, "Connected to SSID: %s", s_connected_ssid);
@@ -372,7 +376,7 @@ static void wifi_manager_background_task(void *pvParameters)
                             free(s_scan_results);
                         }
                         
-                        s_scan_results = heap_caps_malloc(ap_count * sizeof(wifi_ap_record_t), MALLOC_CAP_SPIRAM);
+                        s_scan_results = heap_tracker_malloc(ap_count * sizeof(wifi_ap_record_t), MALLOC_CAP_SPIRAM);
                         if (s_scan_results) {
                             s_scan_count = ap_count;
                             esp_wifi_scan_get_ap_records(&s_scan_count, s_scan_results);
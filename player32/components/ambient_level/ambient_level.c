@@ -0,0 +1,162 @@
+// ambient_level
+//
+// LOUDFRAME project. Room level and gain offset, see ambient_level.h.
+
+// Author: Brian Bulkowski <brian@bulkowski.org> (c) 2025
+
+#include <math.h>
+#include <complex.h>
+
+#include "ambient_level.h"
+
+// IEC 61672 A-weighting poles, Hz
+#define AW_F1   20.598997
+#define AW_F2   107.65265
+#define AW_F3   737.86223
+#define AW_F4   12194.217
+
+// Below this the playback is taken as silence, -90 dB
+#define PLAY_FLOOR              1e-9
+// The coupling is only learned when the mic and the playback are both above
+// this, -70 dB: a few LSB of mic read low, and would pull it down
+#define LEARN_FLOOR             1e-7
+// ...and when the playback is within this of its recent loudest. Playback is
+// counted as it goes to the DAC, tens of ms before the mic hears it, so a
+// window that only catches the start of a loud passage reads low, and would
+// pull it down too. The loudest decays at PEAK_DECAY.
+#define LEARN_SPAN_DB           6.0f
+#define PEAK_DECAY_DB_PER_S     0.25f
+// For the same reason a window where the playback jumped by this much from
+// the last one, the edge of a loud passage, isn't taken at all: the mic and
+// the playback count can disagree about which side of it they are on.
+#define EDGE_DB                 10.0f
+// The coupling estimate creeps up this fast, so a speaker or a mic that has
+// been moved is relearned. The next window loud with playback pulls it back.
+#define COUPLING_LEAK_DB_PER_S  0.02f
+// Floor for the room level, -120 dB
+#define ROOM_FLOOR              1e-12
+
+// One bilinear section of (s+pa)(s+pb) in the denominator, over s^2 for a
+// highpass or over 1 for a lowpass. Poles are prewarped so the corners land
+// where they should even near Nyquist.
+static void section(ambient_biquad_t *bq, double rate, double fa, double fb, bool highpass) {
+    double c = 2.0 * rate;
+    double pa = c * tan(M_PI * fa / rate);
+    double pb = c * tan(M_PI * fb / rate);
+    double a0 = c * c + (pa + pb) * c + pa * pb;
+    double a1 = 2.0 * pa * pb - 2.0 * c * c;
+    double a2 = c * c - (pa + pb) * c + pa * pb;
+    double b0 = highpass ? c * c : 1.0;
+    double b1 = highpass ? -2.0 * c * c : 2.0;
+    double b2 = b0;
+    bq->b0 = (float)(b0 / a0);
+    bq->b1 = (float)(b1 / a0);
+    bq->b2 = (float)(b2 / a0);
+    bq->a1 = (float)(a1 / a0);
+    bq->a2 = (float)(a2 / a0);
+    bq->z1 = bq->z2 = 0;
+}
+
+static double complex response(const ambient_biquad_t *bq, double complex z1) {
+    // z1 is z^-1
+    return (bq->b0 + bq->b1 * z1 + bq->b2 * z1 * z1) / (1.0 + bq->a1 * z1 + bq->a2 * z1 * z1);
+}
+
+void ambient_aweight_init(ambient_aweight_t *w, uint32_t rate) {
+    section(&w->stage[0], rate, AW_F1, AW_F1, true);
+    section(&w->stage[1], rate, AW_F2, AW_F3, true);
+    section(&w->stage[2], rate, AW_F4, AW_F4, false);
+
+    double complex z1 = cexp(-I * 2.0 * M_PI * 1000.0 / rate);
+    double g = cabs(response(&w->stage[0], z1) * response(&w->stage[1], z1) * response(&w->stage[2], z1));
+    w->stage[2].b0 /= g;
+    w->stage[2].b1 /= g;
+    w->stage[2].b2 /= g;
+}
+
+double ambient_aweight_power(ambient_aweight_t *w, const int16_t *pcm, size_t n) {
+    // Locals, so the state stays in registers across the block
+    ambient_biquad_t s0 = w->stage[0], s1 = w->stage[1], s2 = w->stage[2];
+    float sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        float x = pcm[i] * (1.0f / 32768.0f);
+        float y = s0.b0 * x + s0.z1;
+        s0.z1 = s0.b1 * x - s0.a1 * y + s0.z2;
+        s0.z2 = s0.b2 * x - s0.a2 * y;
+        x = y;
+        y = s1.b0 * x + s1.z1;
+        s1.z1 = s1.b1 * x - s1.a1 * y + s1.z2;
+        s1.z2 = s1.b2 * x - s1.a2 * y;
+        x = y;
+        y = s2.b0 * x + s2.z1;
+        s2.z1 = s2.b1 * x - s2.a1 * y + s2.z2;
+        s2.z2 = s2.b2 * x - s2.a2 * y;
+        sum += y * y;
+    }
+    w->stage[0] = s0;
+    w->stage[1] = s1;
+    w->stage[2] = s2;
+    return sum;
+}
+
+void ambient_level_init(ambient_level_t *a, const ambient_level_config_t *cfg) {
+    *a = (ambient_level_t){ .cfg = *cfg, .play_peak_db = -90.0f, .last_play_db = -90.0f };
+}
+
+bool ambient_level_window(ambient_level_t *a, double mic_power, double play_power, float output_db) {
+    const ambient_level_config_t *cfg = &a->cfg;
+    float window_s = cfg->window_ms / 1000.0f;
+    bool counted = true;
+    double room = mic_power;
+
+    a->windows++;
+    if (a->have_coupling) {
+        a->coupling_db += COUPLING_LEAK_DB_PER_S * window_s;
+    }
+    double play = play_power * pow(10.0, output_db / 10.0);
+    float play_db = play > PLAY_FLOOR ? (float)(10.0 * log10(play)) : -90.0f;
+    a->play_peak_db -= PEAK_DECAY_DB_PER_S * window_s;
+    if (play_db > a->play_peak_db) {
+        a->play_peak_db = play_db;
+    }
+    bool edge = fabsf(play_db - a->last_play_db) > EDGE_DB;
+    a->last_play_db = play_db;
+    if (edge) {
+        counted = false;
+    } else if (play > LEARN_FLOOR && mic_power > LEARN_FLOOR && play_db >= a->play_peak_db - LEARN_SPAN_DB) {
+        // Lowest mic over playback yet: the speaker's share at its largest
+        float ratio_db = (float)(10.0 * log10(mic_power / play));
+        if (!a->have_coupling || ratio_db < a->coupling_db) {
+            a->coupling_db = ratio_db;
+            a->have_coupling = true;
+        }
+    }
+    if (counted && play > PLAY_FLOOR && a->have_coupling) {
+        room = mic_power - play * pow(10.0, a->coupling_db / 10.0);
+        if (room < mic_power * (1.0 - cfg->gate_share)) {
+            counted = false;
+        }
+    }
+
+    if (!counted) {
+        a->gated++;
+    } else {
+        float room_db = (float)(10.0 * log10(room > ROOM_FLOOR ? room : ROOM_FLOOR));
+        if (!a->have_level) {
+            a->level_dbfs = room_db;
+            a->have_level = true;
+        } else {
+            float k = cfg->smooth_s > window_s ? window_s / cfg->smooth_s : 1.0f;
+            a->level_dbfs += (room_db - a->level_dbfs) * k;
+        }
+    }
+
+    if (a->have_level) {
+        float t = cfg->slope * (a->level_dbfs - cfg->quiet_dbfs);
+        a->target_db = t < cfg->min_offset_db ? cfg->min_offset_db : t > cfg->max_offset_db ? cfg->max_offset_db : t;
+    }
+    float step = cfg->slew_db_per_s * window_s;
+    float d = a->target_db - a->offset_db;
+    a->offset_db += d > step ? step : d < -step ? -step : d;
+    return counted;
+}
@@ -0,0 +1,119 @@
+// ambient_level
+//
+// LOUDFRAME project. How loud the room is, from a microphone that also hears
+// the frame's own speaker, and how much to turn the frame up or down for it.
+//
+// The microphone goes through an A-weighting filter (three biquads, so the
+// rumble of air handling and the mic's own low end count about as little as
+// they do to a listener) and is averaged over windows of a couple of
+// seconds. Each window's playback power, as sent to the DAC, weighted the
+// same way and scaled by the output gain, is compared with it: the lowest
+// mic to playback ratio seen is taken as the speaker to mic coupling, and
+// that much of the playback is subtracted. A window where the playback
+// explains most of what the mic heard tells nothing about the room, and is
+// skipped rather than guessed at, so the frame can't chase its own sound
+// up; so is one at the edge of a loud passage, where a few tens of ms of
+// timing between the two counts matter. The room level is smoothed over
+// tens of seconds and mapped to a gain offset, which moves at a bounded rate.
+//
+// Pure arithmetic, no I/O: main/ambient.c feeds it from the codec.
+
+// Author: Brian Bulkowski <brian@bulkowski.org> (c) 2025
+
+#ifndef __AMBIENT_LEVEL_H__
+#define __AMBIENT_LEVEL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    float b0, b1, b2, a1, a2;
+    float z1, z2;
+} ambient_biquad_t;
+
+typedef struct {
+    ambient_biquad_t stage[3];  /**< Two highpass sections and a lowpass, unity at 1 kHz */
+} ambient_aweight_t;
+
+typedef struct {
+    uint32_t window_ms;         /**< Averaging window, a couple of seconds */
+    float quiet_dbfs;           /**< Room level (A-weighted dBFS at the mic) that gets no offset */
+    float slope;                /**< dB of offset per dB the room is above quiet_dbfs */
+    float min_offset_db;        /**< Bounds on the offset, below and above the set volume */
+    float max_offset_db;
+    float slew_db_per_s;        /**< Fastest the offset moves */
+    float smooth_s;             /**< Time constant of the room level */
+    float gate_share;           /**< Skip a window when playback explains more than this share of it, 0 to 1 */
+} ambient_level_config_t;
+
+#define AMBIENT_LEVEL_CONFIG_DEFAULT() {    \
+    .window_ms = 2000,                      \
+    .quiet_dbfs = -60.0f,                   \
+    .slope = 0.5f,                          \
+    .min_offset_db = -3.0f,                 \
+    .max_offset_db = 9.0f,                  \
+    .slew_db_per_s = 0.25f,                 \
+    .smooth_s = 20.0f,                      \
+    .gate_share = 0.75f,                    \
+}
+
+typedef struct {
+    ambient_level_config_t cfg;
+    bool have_level;
+    bool have_coupling;
+    float level_dbfs;           /**< Smoothed room level, playback taken out */
+    float coupling_db;          /**< Mic power over effective playback power */
+    float play_peak_db;         /**< Recent loudest effective playback, which the coupling is learned near */
+    float last_play_db;         /**< The last window's, to spot the edges of loud passages */
+    float offset_db;            /**< Where the gain offset is, moving toward target_db */
+    float target_db;
+    uint32_t windows;
+    uint32_t gated;             /**< Windows skipped, as mostly playback or at a jump in it */
+} ambient_level_t;
+
+/**
+ * @brief      Design the A-weighting filter for a sample rate and clear its state
+ *
+ * @param[out] w       The filter
+ * @param[in]  rate    Samples per second, 32000 and up
+ */
+void ambient_aweight_init(ambient_aweight_t *w, uint32_t rate);
+
+/**
+ * @brief      Filter mono 16 bit samples and sum the squares of the result
+ *
+ * @param      w       The filter, its state carried from block to block
+ * @param[in]  pcm     Samples
+ * @param[in]  n       How many
+ *
+ * @return     The sum, with samples scaled to +-1
+ */
+double ambient_aweight_power(ambient_aweight_t *w, const int16_t *pcm, size_t n);
+
+/**
+ * @brief      Start an estimate. The offset starts at 0 dB.
+ */
+void ambient_level_init(ambient_level_t *a, const ambient_level_config_t *cfg);
+
+/**
+ * @brief      Take one window
+ *
+ * @param      a            The estimate
+ * @param[in]  mic_power    Mean square of the A-weighted mic, scaled to +-1
+ * @param[in]  play_power   Mean square of what was sent to the DAC, A-weighted, scaled to +-1
+ * @param[in]  output_db    Output gain over the window, its average if it moved
+ *
+ * @return     True if the window counted, false if it was gated out
+ */
+bool ambient_level_window(ambient_level_t *a, double mic_power, double play_power, float output_db);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AMBIENT_LEVEL_H__ */
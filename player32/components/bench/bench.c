@@ -0,0 +1,242 @@
+// bench
+//
+// LOUDFRAME project. Timing loop for the kernel benchmarks, see bench.h.
+// Nothing in here is specific to a kernel.
+
+// Author: Brian Bulkowski <brian@bulkowski.org> (c) 2025
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "bench.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#else
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+static const char *TAG = "BENCH";
+
+#ifdef ESP_PLATFORM
+const char *bench_input_dir = "/sdcard";
+#else
+const char *bench_input_dir = ".";
+#endif
+
+// On the host esp_timer is the simulator's virtual clock, which doesn't
+// move while code runs, so it can't time anything
+int64_t bench_now_ns(void) {
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time() * 1000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static uint64_t now_cycles(void) {
+#if defined(ESP_PLATFORM)
+    return esp_cpu_get_cycle_count();
+#elif defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+const char *bench_cycle_source(void) {
+#if defined(ESP_PLATFORM)
+    return "ccount";
+#elif defined(__x86_64__) || defined(__i386__)
+    return "tsc";
+#else
+    return NULL;
+#endif
+}
+
+// ccount is 32 bits and wraps every 18 s at 240 MHz; a repetition is far shorter
+static uint64_t cycles_since(uint64_t start) {
+#ifdef ESP_PLATFORM
+    return (uint32_t)((uint32_t)now_cycles() - (uint32_t)start);
+#else
+    return now_cycles() - start;
+#endif
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Lets the idle task run between repetitions so the task watchdog stays quiet
+static void between_reps(void) {
+#ifdef ESP_PLATFORM
+    vTaskDelay(1);
+#endif
+}
+
+esp_err_t bench_run(const bench_kernel_t *k, const bench_config_t *cfg, bench_result_t *result) {
+    void *ctx = NULL;
+    double *ns = NULL;
+    double *cycles = NULL;
+    esp_err_t ret = k->setup ? k->setup(k, &ctx) : ESP_OK;
+    if (ret != ESP_OK) {
+        // ESP_ERR_NOT_FOUND is a missing input file, the kernel has said which
+        if (ret != ESP_ERR_NOT_FOUND) {
+            ESP_LOGE(TAG, "%s: setup failed: %s", k->name, esp_err_to_name(ret));
+        }
+        if (k->teardown) {
+            k->teardown(ctx);
+        }
+        return ret;
+    }
+
+    uint32_t reps = cfg->reps ? cfg->reps : 1;
+    ns = malloc(reps * sizeof(double));
+    cycles = malloc(reps * sizeof(double));
+    if (ns == NULL || cycles == NULL) {
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+
+    // Grow the repetition until it is long enough to time, then scale it to
+    // min_rep_us. The last calibration run doubles as the warm-up.
+    int64_t min_ns = (int64_t)cfg->min_rep_us * 1000;
+    uint32_t ops = 1;
+    int64_t elapsed;
+    while (1) {
+        int64_t start = bench_now_ns();
+        k->run(ctx, ops);
+        elapsed = bench_now_ns() - start;
+        if (elapsed >= min_ns / 4 || ops >= UINT32_MAX / 8) {
+            break;
+        }
+        ops *= elapsed < min_ns / 64 ? 8 : 2;
+    }
+    double scaled = elapsed > 0 ? (double)ops * min_ns / elapsed : ops;
+    ops = scaled < 1 ? 1 : scaled > UINT32_MAX ? UINT32_MAX : (uint32_t)scaled;
+    between_reps();
+
+    for (uint32_t r = 0; r < reps; r++) {
+        uint64_t c0 = now_cycles();
+        int64_t t0 = bench_now_ns();
+        k->run(ctx, ops);
+        int64_t t1 = bench_now_ns();
+        ns[r] = (double)(t1 - t0) / ops;
+        cycles[r] = (double)cycles_since(c0) / ops;
+        between_reps();
+    }
+
+    memset(result, 0, sizeof(*result));
+    result->ops_per_rep = ops;
+    result->reps = reps;
+    double sum = 0;
+    for (uint32_t r = 0; r < reps; r++) {
+        sum += ns[r];
+    }
+    result->ns_mean = sum / reps;
+    double var = 0;
+    for (uint32_t r = 0; r < reps; r++) {
+        var += (ns[r] - result->ns_mean) * (ns[r] - result->ns_mean);
+    }
+    result->ns_stddev = reps > 1 ? sqrt(var / (reps - 1)) : 0;
+    qsort(ns, reps, sizeof(double), compare_double);
+    qsort(cycles, reps, sizeof(double), compare_double);
+    result->ns_min = ns[0];
+    result->ns_max = ns[reps - 1];
+    result->ns_median = reps % 2 ? ns[reps / 2] : (ns[reps / 2 - 1] + ns[reps / 2]) / 2;
+    if (bench_cycle_source()) {
+        result->cycles_median = reps % 2 ? cycles[reps / 2] : (cycles[reps / 2 - 1] + cycles[reps / 2]) / 2;
+    }
+    if (k->bytes_per_op && result->ns_median > 0) {
+        result->mb_per_s = k->bytes_per_op / result->ns_median * 1e9 / (1024 * 1024);
+    }
+    if (k->realtime_ns && result->ns_median > 0) {
+        result->realtime_x = k->realtime_ns(ctx) / result->ns_median;
+    }
+
+cleanup:
+    free(ns);
+    free(cycles);
+    if (k->teardown) {
+        k->teardown(ctx);
+    }
+    return ret;
+}
+
+void bench_result_write_json(FILE *out, const bench_kernel_t *k, const bench_result_t *r) {
+    fprintf(out, "{\"kernel\": \"%s\", \"op\": \"%s\", \"bytes_per_op\": %u, \"reps\": %u, \"ops_per_rep\": %u, "
+                 "\"ns_per_op\": {\"median\": %.2f, \"mean\": %.2f, \"stddev\": %.2f, \"min\": %.2f, \"max\": %.2f}, ",
+            k->name, k->op, (unsigned)k->bytes_per_op, (unsigned)r->reps, (unsigned)r->ops_per_rep,
+            r->ns_median, r->ns_mean, r->ns_stddev, r->ns_min, r->ns_max);
+    if (bench_cycle_source()) {
+        fprintf(out, "\"cycles_per_op\": %.1f, ", r->cycles_median);
+    } else {
+        fprintf(out, "\"cycles_per_op\": null, ");
+    }
+    fprintf(out, "\"mb_per_s\": %.1f, ", r->mb_per_s);
+    if (k->realtime_ns) {
+        fprintf(out, "\"realtime_x\": %.2f}", r->realtime_x);
+    } else {
+        fprintf(out, "\"realtime_x\": null}");
+    }
+}
+
+void bench_table_header(FILE *out) {
+    fprintf(out, "%-32s %-16s %12s %8s %12s %10s %8s\n", "kernel", "op", "ns/op", "rsd %", "cycles/op", "MB/s", "x rt");
+}
+
+void bench_result_write_row(FILE *out, const bench_kernel_t *k, const bench_result_t *r) {
+    double rsd = r->ns_mean > 0 ? 100 * r->ns_stddev / r->ns_mean : 0;
+    fprintf(out, "%-32s %-16s %12.1f %8.2f", k->name, k->op, r->ns_median, rsd);
+    if (bench_cycle_source()) {
+        fprintf(out, " %12.0f", r->cycles_median);
+    } else {
+        fprintf(out, " %12s", "-");
+    }
+    if (r->mb_per_s > 0) {
+        fprintf(out, " %10.1f", r->mb_per_s);
+    } else {
+        fprintf(out, " %10s", "-");
+    }
+    if (r->realtime_x > 0) {
+        fprintf(out, " %8.1f\n", r->realtime_x);
+    } else {
+        fprintf(out, " %8s\n", "-");
+    }
+}
+
+void bench_task(void *arg) {
+    bench_config_t cfg = BENCH_CONFIG_DEFAULT();
+    ESP_LOGI(TAG, "timing %s, %u repetitions of %u ms each", bench_cycle_source(),
+             (unsigned)cfg.reps, (unsigned)(cfg.min_rep_us / 1000));
+    for (int i = 0; bench_kernels[i]; i++) {
+        bench_result_t r;
+        if (bench_run(bench_kernels[i], &cfg, &r) == ESP_OK) {
+            bench_result_write_json(stdout, bench_kernels[i], &r);
+            printf("\n");
+        }
+    }
+    for (int s = 0; bench_stream_scenarios[s].name; s++) {
+        for (int i = 0; bench_stream_impls[i]; i++) {
+            bench_stream_result_t r;
+            if (bench_stream_run(bench_stream_impls[i], &bench_stream_scenarios[s], &r) == ESP_OK) {
+                bench_stream_write_json(stdout, bench_stream_impls[i], &bench_stream_scenarios[s], &r);
+                printf("\n");
+            }
+        }
+    }
+    ESP_LOGI(TAG, "done");
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,745 @@
+// bench_kernels
+//
+// LOUDFRAME project. The kernels the benchmark suite times. Each one does
+// what the engine does with the code under test, at the sizes the engine
+// uses, and is listed in bench_kernels[] at the bottom. To add a kernel,
+// write setup/run/teardown here and add it to the list.
+
+// Author: Brian Bulkowski <brian@bulkowski.org> (c) 2025
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "b_ringbuf.h"
+#include "ima_adpcm.h"
+#include "flac_dec.h"
+#include "ambient_level.h"
+#include "maxbotics.h"
+#include "bench.h"
+
+#if BENCH_HAVE_MP3
+#include "mp3dec.h"
+#endif
+
+static const char *TAG = "BENCH";
+
+// WAV_READER_RINGBUF_SIZE
+#define RINGBUF_SIZE    (64 * 1024)
+
+// Keeps the compiler from dropping stores nobody reads
+#define BENCH_CLOBBER() __asm__ volatile("" ::: "memory")
+
+//
+// memcpy, the floor for anything that moves bytes
+//
+
+typedef struct {
+    uint8_t *src;
+    uint8_t *dst;
+    size_t len;
+} copy_ctx_t;
+
+static esp_err_t copy_setup(const bench_kernel_t *k, void **ctx_r) {
+    copy_ctx_t *ctx = calloc(1, sizeof(*ctx));
+    if (ctx == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    ctx->len = k->param;
+    ctx->src = heap_caps_malloc(ctx->len, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ctx->dst = heap_caps_malloc(ctx->len, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    *ctx_r = ctx;
+    if (ctx->src == NULL || ctx->dst == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    memset(ctx->src, 0x5a, ctx->len);
+    return ESP_OK;
+}
+
+static void copy_run(void *arg, uint32_t ops) {
+    copy_ctx_t *ctx = arg;
+    for (uint32_t i = 0; i < ops; i++) {
+        memcpy(ctx->dst, ctx->src, ctx->len);
+        BENCH_CLOBBER();
+    }
+}
+
+static void copy_teardown(void *arg) {
+    copy_ctx_t *ctx = arg;
+    if (ctx) {
+        free(ctx->src);
+        free(ctx->dst);
+        free(ctx);
+    }
+}
+
+//
+// Ring buffers, one producer and one consumer on the same task so only the
+// buffer is timed: write param bytes, then read them back in two halves,
+// the way wav_reader writes 8 KB and es8388_player takes 4 KB.
+//
+
+typedef struct {
+    size_t len;
+    uint8_t *in;
+    uint8_t *out;
+    b_ringbuf_handle_t brb;
+    RingbufHandle_t rb;
+    uint8_t *rb_storage;
+    StaticRingbuffer_t *rb_struct;
+} rb_ctx_t;
+
+static esp_err_t rb_ctx_alloc(const bench_kernel_t *k, rb_ctx_t **ctx_r) {
+    rb_ctx_t *ctx = calloc(1, sizeof(*ctx));
+    *ctx_r = ctx;
+    if (ctx == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    ctx->len = k->param;
+    ctx->in = heap_caps_malloc(ctx->len, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ctx->out = heap_caps_malloc(ctx->len, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (ctx->in == NULL || ctx->out == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    memset(ctx->in, 0xa5, ctx->len);
+    return ESP_OK;
+}
+
+static void rb_teardown(void *arg) {
+    rb_ctx_t *ctx = arg;
+    if (ctx == NULL) {
+        return;
+    }
+    if (ctx->brb) {
+        brb_destroy(ctx->brb);
+    }
+    if (ctx->rb) {
+        vRingbufferDelete(ctx->rb);
+    }
+    free(ctx->rb_storage);
+    free(ctx->rb_struct);
+    free(ctx->in);
+    free(ctx->out);
+    free(ctx);
+}
+
+static esp_err_t brb_setup(const bench_kernel_t *k, void **ctx_r) {
+    rb_ctx_t *ctx;
+    esp_err_t ret = rb_ctx_alloc(k, &ctx);
+    *ctx_r = ctx;
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ctx->brb = brb_create(RINGBUF_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    return ctx->brb ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static void brb_run(void *arg, uint32_t ops) {
+    rb_ctx_t *ctx = arg;
+    for (uint32_t i = 0; i < ops; i++) {
+        size_t len = ctx->len;
+        if (brb_write(ctx->brb, ctx->in, &len, 0) != ESP_OK || len != ctx->len) {
+            ESP_LOGE(TAG, "brb_write: short write %u", (unsigned)len);
+            return;
+        }
+        for (int half = 0; half < 2; half++) {
+            len = ctx->len / 2;
+            brb_read(ctx->brb, ctx->out, &len, 0);
+        }
+    }
+}
+
+// Set up as wav_reader_init_ringbuf does
+static esp_err_t freertos_rb_setup(const bench_kernel_t *k, void **ctx_r) {
+    rb_ctx_t *ctx;
+    esp_err_t ret = rb_ctx_alloc(k, &ctx);
+    *ctx_r = ctx;
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ctx->rb_storage = heap_caps_malloc(RINGBUF_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    ctx->rb_struct = heap_caps_malloc(sizeof(StaticRingbuffer_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (ctx->rb_storage == NULL || ctx->rb_struct == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    ctx->rb = xRingbufferCreateStatic(RINGBUF_SIZE, RINGBUF_TYPE_BYTEBUF, ctx->rb_storage, ctx->rb_struct);
+    return ctx->rb ? ESP_OK : ESP_FAIL;
+}
+
+// Receive as es8388_player does, copying out what it would hand to I2S.
+// A piece ends at the wrap, so a half can take two receives.
+static void freertos_rb_run(void *arg, uint32_t ops) {
+    rb_ctx_t *ctx = arg;
+    for (uint32_t i = 0; i < ops; i++) {
+        if (xRingbufferSend(ctx->rb, ctx->in, ctx->len, 0) != pdTRUE) {
+            ESP_LOGE(TAG, "xRingbufferSend: no room");
+            return;
+        }
+        size_t left = ctx->len;
+        while (left) {
+            size_t got = 0;
+            uint8_t *data = xRingbufferReceiveUpTo(ctx->rb, &got, 0, ctx->len / 2);
+            if (data == NULL) {
+                ESP_LOGE(TAG, "xRingbufferReceiveUpTo: empty with %u bytes left", (unsigned)left);
+                return;
+            }
+            memcpy(ctx->out, data, got);
+            vRingbufferReturnItem(ctx->rb, data);
+            left -= got;
+        }
+    }
+}
+
+//
+// IMA ADPCM, one block decoded as wav_reader does. The blocks are encoded in
+// setup from a second of synthetic stereo: two tones and some noise, so the
+// step sizes move around as they do with music.
+//
+
+#define ADPCM_RATE      44100
+#define ADPCM_CHANNELS  2
+
+typedef struct {
+    uint8_t *blocks;
+    size_t n_blocks;
+    size_t block_len;
+    size_t frames;              /**< Per block */
+    size_t next;
+    int16_t *pcm;
+} adpcm_ctx_t;
+
+static void adpcm_teardown(void *arg) {
+    adpcm_ctx_t *ctx = arg;
+    if (ctx) {
+        free(ctx->blocks);
+        free(ctx->pcm);
+        free(ctx);
+    }
+}
+
+static esp_err_t adpcm_setup(const bench_kernel_t *k, void **ctx_r) {
+    adpcm_ctx_t *ctx = calloc(1, sizeof(*ctx));
+    *ctx_r = ctx;
+    if (ctx == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    ctx->block_len = k->param;
+    ctx->frames = ima_adpcm_block_frames(ctx->block_len, ADPCM_CHANNELS);
+    ctx->n_blocks = ADPCM_RATE / ctx->frames + 1;
+    ctx->blocks = heap_caps_malloc(ctx->n_blocks * ctx->block_len, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ctx->pcm = heap_caps_malloc(ctx->frames * ADPCM_CHANNELS * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (ctx->blocks == NULL || ctx->pcm == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint32_t seed = 1;
+    ima_adpcm_state_t state[ADPCM_CHANNELS] = { 0 };
+    for (size_t b = 0; b < ctx->n_blocks; b++) {
+        for (size_t f = 0; f < ctx->frames; f++) {
+            double t = (double)(b * ctx->frames + f) / ADPCM_RATE;
+            seed = seed * 1664525 + 1013904223;
+            int32_t noise = (int32_t)(seed >> 20) - 2048;
+            double a = 8000 * sin(2 * M_PI * 440 * t), c = 3000 * sin(2 * M_PI * 2700 * t);
+            ctx->pcm[f * 2] = (int16_t)(a + c + noise);
+            ctx->pcm[f * 2 + 1] = (int16_t)(a - c - noise);
+        }
+        if (ima_adpcm_encode_block(ctx->pcm, ADPCM_CHANNELS, state, ctx->blocks + b * ctx->block_len,
+                                   ctx->block_len) != ESP_OK) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    return ESP_OK;
+}
+
+static void adpcm_run(void *arg, uint32_t ops) {
+    adpcm_ctx_t *ctx = arg;
+    for (uint32_t i = 0; i < ops; i++) {
+        size_t frames;
+        ima_adpcm_decode_block(ctx->blocks + ctx->next * ctx->block_len, ctx->block_len, ADPCM_CHANNELS,
+                               ctx->pcm, &frames);
+        BENCH_CLOBBER();
+        if (++ctx->next == ctx->n_blocks) {
+            ctx->next = 0;
+        }
+    }
+}
+
+static double adpcm_realtime_ns(void *arg) {
+    adpcm_ctx_t *ctx = arg;
+    return (double)ctx->frames / ADPCM_RATE * 1e9;
+}
+
+//
+// FLAC, one frame through flac_dec the way flac_reader does it: the frame
+// and the work buffers in PSRAM, the PCM out 4 KB at a time to internal RAM.
+// Frames come from a copy of bench.flac in memory instead of the card,
+// looping at its end.
+//
+
+#define FLAC_PCM_FRAMES     1024            // ES8388_PLAYER_WRITE_SIZE / 4
+
+typedef struct {
+    flac_dec_handle_t decoder;
+    flac_streaminfo_t info;
+    uint8_t *file;
+    size_t file_len;
+    size_t first;               /**< Offset of the first frame */
+    size_t pos;
+    int16_t *pcm;
+    uint64_t frames;            /**< Decoded, for the average block */
+    uint64_t blocks;
+} flac_ctx_t;
+
+static void flac_teardown(void *arg) {
+    flac_ctx_t *ctx = arg;
+    if (ctx == NULL) {
+        return;
+    }
+    flac_dec_destroy(ctx->decoder);
+    free(ctx->file);
+    free(ctx->pcm);
+    free(ctx);
+}
+
+static esp_err_t flac_setup(const bench_kernel_t *k, void **ctx_r) {
+    esp_err_t ret = ESP_OK;
+    char path[128];
+    snprintf(path, sizeof(path), "%s/bench.flac", bench_input_dir);
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        ESP_LOGW(TAG, "%s: no %s", k->name, path);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    flac_ctx_t *ctx = calloc(1, sizeof(*ctx));
+    *ctx_r = ctx;
+    if (ctx == NULL) {
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    ctx->file_len = len > (long)k->param ? k->param : (size_t)len;
+    ctx->file = heap_caps_malloc(ctx->file_len, MALLOC_CAP_SPIRAM);
+    if (ctx->file == NULL) {
+        ctx->file = malloc(ctx->file_len);
+    }
+    ctx->pcm = heap_caps_malloc(FLAC_PCM_FRAMES * 2 * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (ctx->file == NULL || ctx->pcm == NULL) {
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+    if (fread(ctx->file, 1, ctx->file_len, f) != ctx->file_len) {
+        ret = ESP_FAIL;
+        goto cleanup;
+    }
+
+    // "fLaC", STREAMINFO first, then whatever other metadata blocks
+    bool last = false;
+    size_t p = 4;
+    ret = ESP_ERR_INVALID_ARG;
+    if (ctx->file_len < 8 + FLAC_STREAMINFO_LEN || memcmp(ctx->file, "fLaC", 4) != 0 ||
+        (ctx->file[p] & 0x7f) != 0 || flac_streaminfo_parse(ctx->file + p + 4, &ctx->info) != ESP_OK) {
+        ESP_LOGE(TAG, "%s: %s isn't a FLAC file this decoder plays", k->name, path);
+        goto cleanup;
+    }
+    while (!last && p + 4 <= ctx->file_len) {
+        last = ctx->file[p] & 0x80;
+        p += 4 + ((ctx->file[p + 1] << 16) | (ctx->file[p + 2] << 8) | ctx->file[p + 3]);
+    }
+    ctx->first = ctx->pos = p;
+    ctx->decoder = flac_dec_create(&ctx->info, MALLOC_CAP_SPIRAM);
+    if (ctx->decoder == NULL) {
+        ctx->decoder = flac_dec_create(&ctx->info, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (ctx->decoder == NULL) {
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+    size_t consumed, frames;
+    if (ctx->first >= ctx->file_len ||
+        flac_dec_frame(ctx->decoder, ctx->file + ctx->first, ctx->file_len - ctx->first, &consumed, &frames) != ESP_OK) {
+        ESP_LOGE(TAG, "%s: %s doesn't decode", k->name, path);
+        goto cleanup;
+    }
+    ret = ESP_OK;
+    ESP_LOGI(TAG, "%s: %s, %u Hz, %u channels, %u bits, blocks of %u", k->name, path,
+             (unsigned)ctx->info.sample_rate, ctx->info.channels, ctx->info.bits_per_sample, ctx->info.max_block);
+
+cleanup:
+    fclose(f);
+    return ret;
+}
+
+static void flac_run(void *arg, uint32_t ops) {
+    flac_ctx_t *ctx = arg;
+    for (uint32_t i = 0; i < ops; i++) {
+        size_t consumed, frames;
+        esp_err_t err = flac_dec_frame(ctx->decoder, ctx->file + ctx->pos, ctx->file_len - ctx->pos, &consumed, &frames);
+        if (err != ESP_OK) {
+            // the end of the file, or of as much as was loaded
+            ctx->pos = ctx->first;
+            err = flac_dec_frame(ctx->decoder, ctx->file + ctx->pos, ctx->file_len - ctx->pos, &consumed, &frames);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "flac: %s", esp_err_to_name(err));
+                return;
+            }
+        }
+        ctx->pos += consumed;
+        for (size_t first = 0; first < frames; first += FLAC_PCM_FRAMES) {
+            size_t n = frames - first < FLAC_PCM_FRAMES ? frames - first : FLAC_PCM_FRAMES;
+            flac_dec_read_pcm16(ctx->decoder, first, n, ctx->pcm);
+            BENCH_CLOBBER();
+        }
+        ctx->frames += frames;
+        ctx->blocks++;
+    }
+}
+
+static double flac_realtime_ns(void *arg) {
+    flac_ctx_t *ctx = arg;
+    if (ctx->blocks == 0) {
+        return 0;
+    }
+    return (double)ctx->frames / ctx->blocks / ctx->info.sample_rate * 1e9;
+}
+
+//
+// The ambient level's A-weighting, over one block of mic as the ambient task
+// reads it. The player pays about the same again for its playback, per frame.
+// The block is noise with a hum, roughly what a mic in a gallery hears.
+//
+
+#define AMBIENT_RATE    44100
+
+typedef struct {
+    ambient_aweight_t weight;
+    int16_t *pcm;
+    size_t n;
+    double sink;
+} ambient_ctx_t;
+
+static void ambient_teardown(void *arg) {
+    ambient_ctx_t *ctx = arg;
+    if (ctx) {
+        free(ctx->pcm);
+        free(ctx);
+    }
+}
+
+static esp_err_t ambient_setup(const bench_kernel_t *k, void **ctx_r) {
+    ambient_ctx_t *ctx = calloc(1, sizeof(*ctx));
+    *ctx_r = ctx;
+    if (ctx == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    ctx->n = k->param;
+    ctx->pcm = heap_caps_malloc(ctx->n * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (ctx->pcm == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    uint32_t seed = 1;
+    for (size_t i = 0; i < ctx->n; i++) {
+        seed = seed * 1664525 + 1013904223;
+        int32_t noise = (int32_t)(seed >> 22) - 512;
+        ctx->pcm[i] = (int16_t)(noise + 300 * sin(2 * M_PI * 60 * i / AMBIENT_RATE));
+    }
+    ambient_aweight_init(&ctx->weight, AMBIENT_RATE);
+    return ESP_OK;
+}
+
+static void ambient_run(void *arg, uint32_t ops) {
+    ambient_ctx_t *ctx = arg;
+    for (uint32_t i = 0; i < ops; i++) {
+        ctx->sink += ambient_aweight_power(&ctx->weight, ctx->pcm, ctx->n);
+        BENCH_CLOBBER();
+    }
+}
+
+static double ambient_realtime_ns(void *arg) {
+    ambient_ctx_t *ctx = arg;
+    return (double)ctx->n / AMBIENT_RATE * 1e9;
+}
+
+//
+// The proximity filter, maxbotix_get_median's work once it has the samples:
+// the newest param of them copied out of the ring, sorted, and the middle
+// averaged. proximity_task asks for 32 with pct 0.6. The ring is distances
+// in mm around a person at 1.2 m, with a miss now and then.
+//
+
+typedef struct {
+    uint16_t ring[MAXBOTIX_SAMPLE_BUFFER_SIZE];
+    uint16_t sel[MAXBOTIX_SAMPLE_BUFFER_SIZE];
+    int16_t count;
+    uint32_t next;
+    float sink;
+} median_ctx_t;
+
+static esp_err_t median_setup(const bench_kernel_t *k, void **ctx_r) {
+    median_ctx_t *ctx = calloc(1, sizeof(*ctx));
+    *ctx_r = ctx;
+    if (ctx == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    ctx->count = k->param;
+    uint32_t seed = 1;
+    for (int i = 0; i < MAXBOTIX_SAMPLE_BUFFER_SIZE; i++) {
+        seed = seed * 1664525 + 1013904223;
+        ctx->ring[i] = (seed >> 24) < 16 ? 5000 : 1200 + (int)(seed >> 26) - 32;
+    }
+    return ESP_OK;
+}
+
+static void median_run(void *arg, uint32_t ops) {
+    median_ctx_t *ctx = arg;
+    for (uint32_t i = 0; i < ops; i++) {
+        // A new sample arrives between calls, so each window is different
+        ctx->next = (ctx->next + 1) % MAXBOTIX_SAMPLE_BUFFER_SIZE;
+        for (int j = 0; j < ctx->count; j++) {
+            int idx = (int)ctx->next - j - 1;
+            if (idx < 0) {
+                idx += MAXBOTIX_SAMPLE_BUFFER_SIZE;
+            }
+            ctx->sel[j] = ctx->ring[idx];
+        }
+        ctx->sink += maxbotix_trimmed_mean(ctx->sel, ctx->count, 0.6f);
+        BENCH_CLOBBER();
+    }
+}
+
+static void median_teardown(void *arg) {
+    free(arg);
+}
+
+#if BENCH_HAVE_MP3
+//
+// MP3, one frame through libhelix-mp3 the way mp3_reader does it: from an
+// 8 KB bitstream window in internal RAM, refilled when it runs low. The
+// window is refilled from a copy of bench.mp3 in memory (PSRAM on the board)
+// instead of the card, looping at its end.
+//
+
+#define MP3_WINDOW          (8 * 1024)      // MP3_READER_IN_SIZE
+#define MP3_REFILL_BELOW    (2 * 1441)
+
+typedef struct {
+    HMP3Decoder decoder;
+    uint8_t *file;
+    size_t file_len;
+    size_t file_pos;
+    uint8_t *in;
+    uint8_t *in_ptr;
+    int in_left;
+    int16_t *pcm;
+    MP3FrameInfo info;          /**< Of the first frame */
+} mp3_ctx_t;
+
+static void mp3_refill(mp3_ctx_t *ctx) {
+    if (ctx->in_left > 0 && ctx->in_ptr != ctx->in) {
+        memmove(ctx->in, ctx->in_ptr, ctx->in_left);
+    }
+    ctx->in_ptr = ctx->in;
+    while (ctx->in_left < MP3_WINDOW) {
+        if (ctx->file_pos == ctx->file_len) {
+            ctx->file_pos = 0;
+        }
+        size_t n = ctx->file_len - ctx->file_pos;
+        if (n > (size_t)(MP3_WINDOW - ctx->in_left)) {
+            n = MP3_WINDOW - ctx->in_left;
+        }
+        memcpy(ctx->in + ctx->in_left, ctx->file + ctx->file_pos, n);
+        ctx->in_left += n;
+        ctx->file_pos += n;
+    }
+}
+
+// One frame decoded, skipping whatever doesn't decode. False after too many
+// failures in a row, which means the file isn't MP3.
+static bool mp3_decode_one(mp3_ctx_t *ctx) {
+    for (int tries = 0; tries < 64; tries++) {
+        if (ctx->in_left < MP3_REFILL_BELOW) {
+            mp3_refill(ctx);
+        }
+        int sync = MP3FindSyncWord(ctx->in_ptr, ctx->in_left);
+        if (sync < 0) {
+            ctx->in_ptr += ctx->in_left;
+            ctx->in_left = 0;
+            continue;
+        }
+        ctx->in_ptr += sync;
+        ctx->in_left -= sync;
+        uint8_t *frame = ctx->in_ptr;
+        int ret = MP3Decode(ctx->decoder, &ctx->in_ptr, &ctx->in_left, ctx->pcm, 0);
+        if (ret == ERR_MP3_NONE) {
+            return true;
+        }
+        if (ret == ERR_MP3_INDATA_UNDERFLOW && ctx->in_left < MP3_WINDOW) {
+            mp3_refill(ctx);
+        } else if (ctx->in_ptr == frame) {
+            ctx->in_ptr++;
+            ctx->in_left--;
+        }
+    }
+    return false;
+}
+
+static void mp3_teardown(void *arg) {
+    mp3_ctx_t *ctx = arg;
+    if (ctx == NULL) {
+        return;
+    }
+    if (ctx->decoder) {
+        MP3FreeDecoder(ctx->decoder);
+    }
+    free(ctx->file);
+    free(ctx->in);
+    free(ctx->pcm);
+    free(ctx);
+}
+
+static esp_err_t mp3_setup(const bench_kernel_t *k, void **ctx_r) {
+    esp_err_t ret = ESP_OK;
+    char path[128];
+    snprintf(path, sizeof(path), "%s/bench.mp3", bench_input_dir);
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        ESP_LOGW(TAG, "%s: no %s", k->name, path);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    mp3_ctx_t *ctx = calloc(1, sizeof(*ctx));
+    *ctx_r = ctx;
+    if (ctx == NULL) {
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    ctx->file_len = len > (long)k->param ? k->param : (size_t)len;
+    ctx->file = heap_caps_malloc(ctx->file_len, MALLOC_CAP_SPIRAM);
+    if (ctx->file == NULL) {
+        ctx->file = malloc(ctx->file_len);
+    }
+    ctx->in = heap_caps_malloc(MP3_WINDOW, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+    ctx->pcm = heap_caps_malloc(MAX_NCHAN * MAX_NGRAN * MAX_NSAMP * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ctx->decoder = MP3InitDecoder();
+    if (ctx->file == NULL || ctx->in == NULL || ctx->pcm == NULL || ctx->decoder == NULL) {
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+    if (fread(ctx->file, 1, ctx->file_len, f) != ctx->file_len) {
+        ret = ESP_FAIL;
+        goto cleanup;
+    }
+    ctx->in_ptr = ctx->in;
+    if (!mp3_decode_one(ctx)) {
+        ESP_LOGE(TAG, "%s: %s doesn't decode", k->name, path);
+        ret = ESP_ERR_INVALID_ARG;
+        goto cleanup;
+    }
+    MP3GetLastFrameInfo(ctx->decoder, &ctx->info);
+    ESP_LOGI(TAG, "%s: %s, %d Hz, %d channels, %d kbps", k->name, path,
+             ctx->info.samprate, ctx->info.nChans, ctx->info.bitrate / 1000);
+
+cleanup:
+    fclose(f);
+    return ret;
+}
+
+static void mp3_run(void *arg, uint32_t ops) {
+    mp3_ctx_t *ctx = arg;
+    for (uint32_t i = 0; i < ops; i++) {
+        if (!mp3_decode_one(ctx)) {
+            ESP_LOGE(TAG, "mp3: lost sync");
+            return;
+        }
+        BENCH_CLOBBER();
+    }
+}
+
+static double mp3_realtime_ns(void *arg) {
+    mp3_ctx_t *ctx = arg;
+    return (double)ctx->info.outputSamps / ctx->info.nChans / ctx->info.samprate * 1e9;
+}
+#endif
+
+static const bench_kernel_t k_memcpy_4k = {
+    .name = "memcpy/4k", .op = "4 KB copy", .bytes_per_op = 4096, .param = 4096,
+    .setup = copy_setup, .run = copy_run, .teardown = copy_teardown,
+};
+
+static const bench_kernel_t k_brb_8k = {
+    .name = "b_ringbuf/w8k_r4k", .op = "8 KB in and out", .bytes_per_op = 8192, .param = 8192,
+    .setup = brb_setup, .run = brb_run, .teardown = rb_teardown,
+};
+
+static const bench_kernel_t k_brb_256 = {
+    .name = "b_ringbuf/w256_r128", .op = "256 B in and out", .bytes_per_op = 256, .param = 256,
+    .setup = brb_setup, .run = brb_run, .teardown = rb_teardown,
+};
+
+static const bench_kernel_t k_freertos_rb_8k = {
+    .name = "freertos_ringbuf/w8k_r4k", .op = "8 KB in and out", .bytes_per_op = 8192, .param = 8192,
+    .setup = freertos_rb_setup, .run = freertos_rb_run, .teardown = rb_teardown,
+};
+
+static const bench_kernel_t k_freertos_rb_256 = {
+    .name = "freertos_ringbuf/w256_r128", .op = "256 B in and out", .bytes_per_op = 256, .param = 256,
+    .setup = freertos_rb_setup, .run = freertos_rb_run, .teardown = rb_teardown,
+};
+
+// bytes_per_op is what comes off the card
+static const bench_kernel_t k_adpcm_2k = {
+    .name = "ima_adpcm/block_2k", .op = "2041 frames", .bytes_per_op = 2048, .param = 2048,
+    .setup = adpcm_setup, .run = adpcm_run, .teardown = adpcm_teardown, .realtime_ns = adpcm_realtime_ns,
+};
+
+// param caps how much of bench.flac is loaded
+static const bench_kernel_t k_flac_frame = {
+    .name = "flac/frame", .op = "decode 1 frame", .bytes_per_op = 0, .param = 2 * 1024 * 1024,
+    .setup = flac_setup, .run = flac_run, .teardown = flac_teardown, .realtime_ns = flac_realtime_ns,
+};
+
+// param is the block, AMBIENT_READ_FRAMES
+static const bench_kernel_t k_ambient_block = {
+    .name = "ambient/aweight_960", .op = "960 mic frames", .bytes_per_op = 960 * 2, .param = 960,
+    .setup = ambient_setup, .run = ambient_run, .teardown = ambient_teardown, .realtime_ns = ambient_realtime_ns,
+};
+
+// param is proximity_task's max_count
+static const bench_kernel_t k_median_32 = {
+    .name = "maxbotix/median_32", .op = "filter 32 samples", .bytes_per_op = 0, .param = 32,
+    .setup = median_setup, .run = median_run, .teardown = median_teardown,
+};
+
+#if BENCH_HAVE_MP3
+// param caps how much of the file is loaded
+static const bench_kernel_t k_mp3_frame = {
+    .name = "mp3/frame", .op = "decode 1 frame", .bytes_per_op = 0, .param = 1024 * 1024,
+    .setup = mp3_setup, .run = mp3_run, .teardown = mp3_teardown, .realtime_ns = mp3_realtime_ns,
+};
+#endif
+
+const bench_kernel_t *const bench_kernels[] = {
+    &k_memcpy_4k,
+    &k_brb_8k,
+    &k_brb_256,
+    &k_freertos_rb_8k,
+    &k_freertos_rb_256,
+    &k_adpcm_2k,
+    &k_flac_frame,
+    &k_ambient_block,
+    &k_median_32,
+#if BENCH_HAVE_MP3
+    &k_mp3_frame,
+#endif
+    NULL,
+};
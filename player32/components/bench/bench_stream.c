@@ -0,0 +1,389 @@
+// bench_stream
+//
+// LOUDFRAME project. Ring buffer shoot-out. A producer task writes fixed
+// size blocks into the buffer under test and a consumer task reads them
+// out, each optionally paced, with the priorities and sizes wav_reader and
+// es8388_player use. Reports throughput, how long each side was blocked in
+// the buffer, and the CPU both tasks spent per byte.
+
+// Author: Brian Bulkowski <brian@bulkowski.org> (c) 2025
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/ringbuf.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "b_ringbuf.h"
+#include "bench.h"
+
+#ifndef ESP_PLATFORM
+#include <time.h>
+#endif
+
+static const char *TAG = "BENCH_STREAM";
+
+#define PRODUCER_PRIO       (configMAX_PRIORITIES - 2)     // wav_reader
+#define CONSUMER_PRIO       (configMAX_PRIORITIES - 4)     // es8388_player
+#define STREAM_TASK_STACK   (1024 * 4)
+#define TICK_US             (1000000 / configTICK_RATE_HZ)
+
+// How long a reader waits before checking whether the writer has finished,
+// for buffers without an end-of-stream flag
+#define DRAIN_POLL_TICKS    pdMS_TO_TICKS(50)
+
+//
+// The buffers under test, behind one interface
+//
+
+typedef struct {
+    b_ringbuf_handle_t brb;
+    RingbufHandle_t rb;
+    uint8_t *rb_storage;
+    StaticRingbuffer_t *rb_struct;
+    volatile bool done;
+} stream_rb_t;
+
+static esp_err_t brb_open(stream_rb_t *s, size_t size) {
+    s->brb = brb_create(size, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    return s->brb ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static bool brb_put(stream_rb_t *s, const uint8_t *buf, size_t len) {
+    size_t n = len;
+    return brb_write(s->brb, (uint8_t *)buf, &n, portMAX_DELAY) == ESP_OK && n == len;
+}
+
+// Blocks until len bytes are there, or fewer once the writer is done
+static size_t brb_get(stream_rb_t *s, uint8_t *buf, size_t len) {
+    size_t n = len;
+    if (brb_read(s->brb, buf, &n, portMAX_DELAY) != ESP_OK) {
+        return 0;
+    }
+    return n;
+}
+
+static void brb_finish(stream_rb_t *s) {
+    brb_done_write(s->brb);
+}
+
+static void brb_close(stream_rb_t *s) {
+    if (s->brb) {
+        brb_destroy(s->brb);
+    }
+}
+
+// Created the way wav_reader_init_ringbuf does
+static esp_err_t freertos_open(stream_rb_t *s, size_t size) {
+    s->rb_storage = heap_caps_malloc(size, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    s->rb_struct = heap_caps_malloc(sizeof(StaticRingbuffer_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (s->rb_storage == NULL || s->rb_struct == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    s->rb = xRingbufferCreateStatic(size, RINGBUF_TYPE_BYTEBUF, s->rb_storage, s->rb_struct);
+    return s->rb ? ESP_OK : ESP_FAIL;
+}
+
+static bool freertos_put(stream_rb_t *s, const uint8_t *buf, size_t len) {
+    return xRingbufferSend(s->rb, buf, len, portMAX_DELAY) == pdTRUE;
+}
+
+// Receives as es8388_player does. A piece ends at the wrap, so this loops.
+static size_t freertos_get(stream_rb_t *s, uint8_t *buf, size_t len) {
+    size_t total = 0;
+    while (total < len) {
+        size_t got = 0;
+        // Empty after the writer finished means empty for good
+        bool was_done = s->done;
+        uint8_t *data = xRingbufferReceiveUpTo(s->rb, &got, DRAIN_POLL_TICKS, len - total);
+        if (data == NULL) {
+            if (was_done) {
+                break;
+            }
+            continue;
+        }
+        memcpy(buf + total, data, got);
+        vRingbufferReturnItem(s->rb, data);
+        total += got;
+    }
+    return total;
+}
+
+static void freertos_finish(stream_rb_t *s) {
+    s->done = true;
+}
+
+static void freertos_close(stream_rb_t *s) {
+    if (s->rb) {
+        vRingbufferDelete(s->rb);
+    }
+    free(s->rb_storage);
+    free(s->rb_struct);
+}
+
+typedef struct {
+    const char *name;
+    esp_err_t (*open)(stream_rb_t *s, size_t size);
+    bool (*put)(stream_rb_t *s, const uint8_t *buf, size_t len);
+    size_t (*get)(stream_rb_t *s, uint8_t *buf, size_t len);
+    void (*finish)(stream_rb_t *s);
+    void (*close)(stream_rb_t *s);
+} stream_impl_t;
+
+static const stream_impl_t s_impls[] = {
+    { "b_ringbuf", brb_open, brb_put, brb_get, brb_finish, brb_close },
+    { "freertos_ringbuf", freertos_open, freertos_put, freertos_get, freertos_finish, freertos_close },
+};
+
+const char *const bench_stream_impls[] = { "b_ringbuf", "freertos_ringbuf", NULL };
+
+//
+// Producer and consumer
+//
+
+typedef struct {
+    const stream_impl_t *impl;
+    const bench_stream_scenario_t *sc;
+    stream_rb_t rb;
+    SemaphoreHandle_t finished;
+    int64_t start_us;
+    int64_t start_ns;
+    bench_stream_side_t producer;
+    bench_stream_side_t consumer;
+    int64_t consumer_end_us;
+    int64_t consumer_end_ns;
+} stream_run_t;
+
+// CPU time of the calling task. On the board that is the FreeRTOS run
+// time counter (esp_timer microseconds), which only moves at a context
+// switch; over a whole run that is close enough.
+static int64_t task_cpu_ns(void) {
+#ifdef ESP_PLATFORM
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    return (int64_t)ulTaskGetRunTimeCounter(NULL) * 1000;
+#else
+    return -1;
+#endif
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// Sleeps to an absolute time in the tick's resolution, so periods that
+// aren't whole ticks still average out right
+static void pace_until(int64_t at_us) {
+    int64_t wait = at_us - esp_timer_get_time();
+    if (wait >= TICK_US) {
+        vTaskDelay(wait / TICK_US);
+    }
+}
+
+static void note_block(bench_stream_side_t *side, int64_t us) {
+    side->calls++;
+    side->blocked_us += us;
+    if (us > side->blocked_max_us) {
+        side->blocked_max_us = us;
+    }
+}
+
+static void producer_task(void *arg) {
+    stream_run_t *run = arg;
+    const bench_stream_scenario_t *sc = run->sc;
+    uint8_t *buf = heap_caps_malloc(sc->write_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    int64_t cpu0 = task_cpu_ns();
+    int64_t next = run->start_us;
+    if (buf) {
+        memset(buf, 0x3c, sc->write_size);
+        while (run->producer.bytes < sc->total_bytes) {
+            if (sc->write_period_us) {
+                next += sc->write_period_us;
+                pace_until(next);
+            }
+            int64_t t0 = esp_timer_get_time();
+            if (!run->impl->put(&run->rb, buf, sc->write_size)) {
+                ESP_LOGE(TAG, "%s: write failed", run->impl->name);
+                break;
+            }
+            note_block(&run->producer, esp_timer_get_time() - t0);
+            run->producer.bytes += sc->write_size;
+        }
+    }
+    run->impl->finish(&run->rb);
+    run->producer.cpu_ns = task_cpu_ns() - cpu0;
+    free(buf);
+    xSemaphoreGive(run->finished);
+    vTaskDelete(NULL);
+}
+
+static void consumer_task(void *arg) {
+    stream_run_t *run = arg;
+    const bench_stream_scenario_t *sc = run->sc;
+    uint8_t *buf = heap_caps_malloc(sc->read_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    int64_t cpu0 = task_cpu_ns();
+    int64_t next = run->start_us;
+    while (buf) {
+        if (sc->read_period_us) {
+            next += sc->read_period_us;
+            pace_until(next);
+        }
+        int64_t t0 = esp_timer_get_time();
+        size_t got = run->impl->get(&run->rb, buf, sc->read_size);
+        if (got == 0) {
+            break;
+        }
+        note_block(&run->consumer, esp_timer_get_time() - t0);
+        run->consumer.bytes += got;
+        if (got < sc->read_size) {
+            run->consumer.short_reads++;
+        }
+    }
+    run->consumer_end_us = esp_timer_get_time();
+    run->consumer_end_ns = bench_now_ns();
+    run->consumer.cpu_ns = task_cpu_ns() - cpu0;
+    free(buf);
+    xSemaphoreGive(run->finished);
+    vTaskDelete(NULL);
+}
+
+esp_err_t bench_stream_run(const char *impl_name, const bench_stream_scenario_t *sc, bench_stream_result_t *result) {
+    const stream_impl_t *impl = NULL;
+    for (size_t i = 0; i < sizeof(s_impls) / sizeof(s_impls[0]); i++) {
+        if (strcmp(s_impls[i].name, impl_name) == 0) {
+            impl = &s_impls[i];
+        }
+    }
+    if (impl == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_err_t ret = ESP_OK;
+    stream_run_t *run = calloc(1, sizeof(*run));
+    if (run == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    run->impl = impl;
+    run->sc = sc;
+    run->finished = xSemaphoreCreateCounting(2, 0);
+    if (run->finished == NULL) {
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+    ret = impl->open(&run->rb, sc->rb_size);
+    if (ret != ESP_OK) {
+        goto cleanup;
+    }
+
+    run->start_us = esp_timer_get_time();
+    run->start_ns = bench_now_ns();
+    // Consumer first, so it is already waiting when the first write lands
+    if (xTaskCreatePinnedToCore(consumer_task, "bench_consumer", STREAM_TASK_STACK, run, CONSUMER_PRIO, NULL, 1) != pdPASS) {
+        ESP_LOGE(TAG, "can't create the consumer task");
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+    if (xTaskCreatePinnedToCore(producer_task, "bench_producer", STREAM_TASK_STACK, run, PRODUCER_PRIO, NULL, 1) != pdPASS) {
+        ESP_LOGE(TAG, "can't create the producer task");
+        impl->finish(&run->rb);
+        xSemaphoreTake(run->finished, portMAX_DELAY);
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+    xSemaphoreTake(run->finished, portMAX_DELAY);
+    xSemaphoreTake(run->finished, portMAX_DELAY);
+
+    memset(result, 0, sizeof(*result));
+    result->producer = run->producer;
+    result->consumer = run->consumer;
+    result->seconds = (run->consumer_end_us - run->start_us) / 1e6;
+    result->real_seconds = (run->consumer_end_ns - run->start_ns) / 1e9;
+    if (run->producer.cpu_ns >= 0 && run->consumer.cpu_ns >= 0 && run->consumer.bytes) {
+        result->cpu_ns_per_byte = (double)(run->producer.cpu_ns + run->consumer.cpu_ns) / run->consumer.bytes;
+    } else {
+        result->cpu_ns_per_byte = -1;
+    }
+
+cleanup:
+    impl->close(&run->rb);
+    if (run->finished) {
+        vSemaphoreDelete(run->finished);
+    }
+    free(run);
+    return ret;
+}
+
+// The project's access patterns: 8 KB writes from the reader, 4 KB reads
+// from the player, into the 64 KB buffer wav_reader uses. 4 KB of 16 bit
+// stereo is 23.2 ms at 44.1 kHz.
+const bench_stream_scenario_t bench_stream_scenarios[] = {
+    {
+        .name = "flat_out", .rb_size = 64 * 1024, .write_size = 8192, .read_size = 4096,
+        .total_bytes = 256 * 1024 * 1024,
+    },
+    {
+        // The card reads 8 KB in 3 ms, so the reader runs ahead and waits on a full buffer
+        .name = "playback", .rb_size = 64 * 1024, .write_size = 8192, .read_size = 4096,
+        .write_period_us = 3000, .read_period_us = 23220, .total_bytes = 2 * 1024 * 1024,
+    },
+    {
+        // The card can't keep up, so the player waits on an empty buffer
+        .name = "starved", .rb_size = 64 * 1024, .write_size = 8192, .read_size = 4096,
+        .write_period_us = 50000, .read_period_us = 23220, .total_bytes = 1024 * 1024,
+    },
+    { 0 },
+};
+
+void bench_stream_write_json(FILE *out, const char *impl, const bench_stream_scenario_t *sc,
+                             const bench_stream_result_t *r) {
+    const bench_stream_side_t *side[2] = { &r->producer, &r->consumer };
+    const char *names[2] = { "producer", "consumer" };
+    fprintf(out, "{\"scenario\": \"%s\", \"impl\": \"%s\", \"write_size\": %u, \"read_size\": %u, "
+                 "\"write_period_us\": %u, \"read_period_us\": %u, \"bytes\": %llu, \"seconds\": %.3f, "
+                 "\"real_seconds\": %.3f, \"mb_per_s\": %.2f, ",
+            sc->name, impl, (unsigned)sc->write_size, (unsigned)sc->read_size,
+            (unsigned)sc->write_period_us, (unsigned)sc->read_period_us,
+            (unsigned long long)r->consumer.bytes, r->seconds, r->real_seconds, bench_stream_mb_per_s(sc, r));
+    if (r->cpu_ns_per_byte >= 0) {
+        fprintf(out, "\"cpu_ns_per_byte\": %.3f", r->cpu_ns_per_byte);
+    } else {
+        fprintf(out, "\"cpu_ns_per_byte\": null");
+    }
+    for (int i = 0; i < 2; i++) {
+        const bench_stream_side_t *s = side[i];
+        fprintf(out, ", \"%s\": {\"calls\": %u, \"blocked_mean_us\": %.1f, \"blocked_max_us\": %lld, "
+                     "\"short_reads\": %u}",
+                names[i], (unsigned)s->calls, s->calls ? (double)s->blocked_us / s->calls : 0.0,
+                (long long)s->blocked_max_us, (unsigned)s->short_reads);
+    }
+    fprintf(out, "}");
+}
+
+double bench_stream_mb_per_s(const bench_stream_scenario_t *sc, const bench_stream_result_t *r) {
+    // Unpaced runs take no virtual time on the host, so they are measured in real time
+    bool paced = sc->write_period_us || sc->read_period_us;
+    double s = paced ? r->seconds : r->real_seconds;
+    return s > 0 ? r->consumer.bytes / s / (1024 * 1024) : 0;
+}
+
+void bench_stream_table_header(FILE *out) {
+    fprintf(out, "%-10s %-18s %9s %10s %10s %10s %10s %9s\n", "scenario", "buffer", "MB/s",
+            "wr mean us", "wr max us", "rd mean us", "rd max us", "cpu ns/B");
+}
+
+void bench_stream_write_row(FILE *out, const char *impl, const bench_stream_scenario_t *sc,
+                            const bench_stream_result_t *r) {
+    const bench_stream_side_t *p = &r->producer, *c = &r->consumer;
+    fprintf(out, "%-10s %-18s %9.2f %10.1f %10lld %10.1f %10lld", sc->name, impl, bench_stream_mb_per_s(sc, r),
+            p->calls ? (double)p->blocked_us / p->calls : 0.0, (long long)p->blocked_max_us,
+            c->calls ? (double)c->blocked_us / c->calls : 0.0, (long long)c->blocked_max_us);
+    if (r->cpu_ns_per_byte >= 0) {
+        fprintf(out, " %9.3f\n", r->cpu_ns_per_byte);
+    } else {
+        fprintf(out, " %9s\n", "-");
+    }
+}
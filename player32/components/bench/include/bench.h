@@ -0,0 +1,203 @@
+// bench
+//
+// LOUDFRAME project. Micro-benchmarks for the engine's kernels. The same
+// code runs on the board (bench_task) and on Linux (player32_bench in
+// host/). Each kernel is timed in repetitions long enough to swamp the
+// timer, and the spread across repetitions is reported with the median,
+// so a change can be told apart from noise.
+
+// Author: Brian Bulkowski <brian@bulkowski.org> (c) 2025
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct bench_kernel bench_kernel_t;
+
+struct bench_kernel {
+    const char *name;
+    const char *op;             /**< What one operation is, for the report */
+    size_t bytes_per_op;        /**< Bytes moved or produced per operation, 0 if that means nothing */
+    size_t param;               /**< Handed to setup, so one kernel can be listed at several sizes */
+
+    /**
+     * @brief  Allocate and prime whatever run needs. Not timed.
+     */
+    esp_err_t (*setup)(const bench_kernel_t *k, void **ctx);
+
+    /**
+     * @brief  Do `ops` operations. This is the timed part.
+     */
+    void (*run)(void *ctx, uint32_t ops);
+
+    /**
+     * @brief  Free what setup allocated.
+     */
+    void (*teardown)(void *ctx);
+
+    /**
+     * @brief  Audio one operation produces, in ns, for kernels that have to keep up with
+     *         playback. NULL for the others. Called after setup.
+     */
+    double (*realtime_ns)(void *ctx);
+};
+
+typedef struct {
+    uint32_t reps;              /**< Timed repetitions */
+    uint32_t min_rep_us;        /**< Each repetition runs at least this long */
+} bench_config_t;
+
+#define BENCH_CONFIG_DEFAULT() { .reps = 15, .min_rep_us = 20000 }
+
+typedef struct {
+    uint32_t ops_per_rep;
+    uint32_t reps;
+    double ns_median;           /**< Per operation, over the repetitions */
+    double ns_mean;
+    double ns_stddev;
+    double ns_min;
+    double ns_max;
+    double cycles_median;       /**< Per operation, 0 when there is no cycle counter */
+    double mb_per_s;            /**< From the median, 0 when bytes_per_op is 0 */
+    double realtime_x;          /**< Times faster than playback from the median, so how many streams
+                                     one core could run; 0 when the kernel has no realtime_ns */
+} bench_result_t;
+
+/**
+ * @brief      All kernels known to the suite, NULL terminated
+ */
+extern const bench_kernel_t *const bench_kernels[];
+
+/**
+ * @brief      Directory kernels load their input files from, "/sdcard" on the board.
+ *             A kernel whose file isn't there fails setup with ESP_ERR_NOT_FOUND.
+ */
+extern const char *bench_input_dir;
+
+/**
+ * @brief      Time one kernel
+ *
+ * @param[in]  k       The kernel
+ * @param[in]  cfg     Repetitions and their length
+ * @param[out] result  Per operation figures
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_NO_MEM or whatever else the kernel's setup returned
+ */
+esp_err_t bench_run(const bench_kernel_t *k, const bench_config_t *cfg, bench_result_t *result);
+
+/**
+ * @brief      Name of the cycle counter behind cycles_median
+ *
+ * @return     "ccount" on the board, "tsc" on x86 hosts, NULL when there is none
+ */
+const char *bench_cycle_source(void);
+
+/**
+ * @brief      Write a result as one JSON object, without a trailing newline
+ */
+void bench_result_write_json(FILE *out, const bench_kernel_t *k, const bench_result_t *result);
+
+/**
+ * @brief      Write a result as a table row, see bench_table_header
+ */
+void bench_result_write_row(FILE *out, const bench_kernel_t *k, const bench_result_t *result);
+
+void bench_table_header(FILE *out);
+
+/**
+ * @brief      Real time in nanoseconds, also on the host where esp_timer is virtual
+ */
+int64_t bench_now_ns(void);
+
+//
+// Ring buffer shoot-out (bench_stream.c): a producer and a consumer task
+// moving data through one of the buffers the engine could use
+//
+
+typedef struct {
+    const char *name;
+    size_t rb_size;
+    size_t write_size;
+    size_t read_size;
+    uint32_t write_period_us;   /**< One write per period, 0 for as fast as the buffer allows */
+    uint32_t read_period_us;    /**< One read per period, 0 for as fast as the buffer allows */
+    uint64_t total_bytes;       /**< Written by the producer, then it finishes */
+} bench_stream_scenario_t;
+
+typedef struct {
+    uint64_t bytes;
+    uint32_t calls;
+    uint32_t short_reads;       /**< Reads that came back with less than read_size */
+    int64_t blocked_us;         /**< Total time inside the buffer's calls */
+    int64_t blocked_max_us;     /**< Longest single call */
+    int64_t cpu_ns;             /**< Task CPU time over the run, -1 where unknown */
+} bench_stream_side_t;
+
+typedef struct {
+    bench_stream_side_t producer;
+    bench_stream_side_t consumer;
+    double seconds;             /**< esp_timer time, virtual on the host */
+    double real_seconds;
+    double cpu_ns_per_byte;     /**< Both tasks, -1 where unknown */
+} bench_stream_result_t;
+
+/**
+ * @brief      Scenarios with the project's access patterns, terminated by one without a name
+ */
+extern const bench_stream_scenario_t bench_stream_scenarios[];
+
+/**
+ * @brief      Names of the buffers bench_stream_run can drive, NULL terminated
+ */
+extern const char *const bench_stream_impls[];
+
+/**
+ * @brief      Run one scenario through one buffer. Creates the producer and
+ *             consumer tasks on core 1 and waits for both to end.
+ *
+ * @param[in]  impl    One of bench_stream_impls
+ * @param[in]  sc      The scenario
+ * @param[out] result  What both sides saw
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_NOT_FOUND for an unknown buffer
+ *     - ESP_ERR_NO_MEM
+ */
+esp_err_t bench_stream_run(const char *impl, const bench_stream_scenario_t *sc, bench_stream_result_t *result);
+
+/**
+ * @brief      Throughput, in real time for unpaced scenarios since those take no virtual time on the host
+ */
+double bench_stream_mb_per_s(const bench_stream_scenario_t *sc, const bench_stream_result_t *result);
+
+void bench_stream_write_json(FILE *out, const char *impl, const bench_stream_scenario_t *sc,
+                             const bench_stream_result_t *result);
+void bench_stream_write_row(FILE *out, const char *impl, const bench_stream_scenario_t *sc,
+                            const bench_stream_result_t *result);
+void bench_stream_table_header(FILE *out);
+
+/**
+ * @brief      Board entry point: runs every kernel and stream scenario and prints one JSON line each
+ *
+ * @param[in]  arg   Unused
+ */
+void bench_task(void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BENCH_H__ */
@@ -24,8 +24,10 @@
 
 #include <string.h>
 #include <inttypes.h>
+#include <math.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_timer.h"
 #include "esp_log.h"
 #include "esp_check.h" // For ESP_RETURN_ON_ERROR macro
@@ -39,10 +41,15 @@
 
 static const char *TAG = "ES8388_DRIVER";
 
+// the volume and the ambient offset are set from different tasks; this
+// covers g_user_volume and the rest of the volume state, and the volume
+// register writes, so they can't interleave. Created by es8388_init.
+static SemaphoreHandle_t g_volume_lock = NULL;
+
 
 // static i2c_bus_handle_t i2c_handle; - new interface uses the i2c_port
 i2s_chan_handle_t g_i2s_tx_handle = NULL;
-// i2s_chan_handle_t g_i2s_rx_handle = NULL;
+i2s_chan_handle_t g_i2s_rx_handle = NULL;     // only with the ADC on, see es8388_init
 
 // pins and such
 #define ES8388_I2C_NUM  (I2C_NUM_0)
@@ -281,12 +288,15 @@ esp_err_t es8388_stop(es_module_t mode)
 /**
  * @brief Initialize I2S peripheral for ES8388 communication
  *
- * CONFIGURED FOR OUTPUT ONLY, comment in the RX structure for receiving from mics
+ * Output, and input from the mics when rx is set. The input is mono, the left channel only,
+ * which halves its DMA memory: 6 x 240 frames is 2880 bytes.
  * 
+ * @param rx also make the RX channel
+ *
  * @return esp_err_t ESP_OK on success, error code otherwise.
  */
 
-static esp_err_t es_i2s_init(void) {
+static esp_err_t es_i2s_init(bool rx) {
     //esp_err_t ret = ESP_OK;
 
     ESP_LOGI(TAG, "Initializing I2S for ES8388...");
@@ -303,10 +313,9 @@ static esp_err_t es_i2s_init(void) {
 
     ESP_LOGI(TAG, "Allocating I2S channels...");
     // Allocate TX channel
-    ESP_RETURN_ON_ERROR(i2s_new_channel(&chan_cfg, &g_i2s_tx_handle, NULL), TAG, "Failed to create TX channel");
-    // Allocate RX channel
-    // BB: skip because this is for mic, not using yet
-    // ESP_RETURN_ON_ERROR(i2s_new_channel(&chan_cfg, NULL, &g_i2s_rx_handle), TAG, "Failed to create RX channel");
+    // Allocate RX channel too, full duplex on the same port so it shares the clocks
+    ESP_RETURN_ON_ERROR(i2s_new_channel(&chan_cfg, &g_i2s_tx_handle, rx ? &g_i2s_rx_handle : NULL), TAG,
+        "Failed to create TX/RX channels");
 
 
     // 2. Configure I2S Standard Mode (Specific to standard I2S protocol)
@@ -334,7 +343,7 @@ static esp_err_t es_i2s_init(void) {
             .bclk = ES8388_I2S_BCK,
             .ws = ES8388_I2S_WS,
             .dout = ES8388_I2S_DATA_OUT,
-            .din = -1, // Use -1 if RX is not used - or DATA_IN if you want the mic
+            .din = rx ? ES8388_I2S_DATA_IN : -1, // Use -1 if RX is not used - or DATA_IN if you want the mic
 
             .invert_flags = {
                 .mclk_inv = false,
@@ -353,10 +362,16 @@ static esp_err_t es_i2s_init(void) {
     // Initialize TX channel in standard mode
     ESP_RETURN_ON_ERROR(i2s_channel_init_std_mode(g_i2s_tx_handle, &std_cfg), TAG, "Failed to init TX channel");
 
-    ESP_LOGI(TAG, "Initializing standard mode for RX channel...");
-    // Initialize RX channel in standard mode
-    // Note: We re-use std_cfg, but GPIO dout/din are handled internally based on tx/rx handle
-    // ESP_RETURN_ON_ERROR(i2s_channel_init_std_mode(g_i2s_rx_handle, &std_cfg), TAG, "Failed to init RX channel");
+    if (rx) {
+        ESP_LOGI(TAG, "Initializing standard mode for RX channel...");
+        // Initialize RX channel in standard mode
+        // Note: We re-use std_cfg, but GPIO dout/din are handled internally based on tx/rx handle
+        // Mono, left slot: one mic is plenty for a level, and half the DMA
+        i2s_std_config_t rx_cfg = std_cfg;
+        rx_cfg.slot_cfg.slot_mode = I2S_SLOT_MODE_MONO;
+        rx_cfg.slot_cfg.slot_mask = I2S_STD_SLOT_LEFT;
+        ESP_RETURN_ON_ERROR(i2s_channel_init_std_mode(g_i2s_rx_handle, &rx_cfg), TAG, "Failed to init RX channel");
+    }
 
 
     // 3. Enable I2S Channels (Start clocks)
@@ -364,7 +379,9 @@ static esp_err_t es_i2s_init(void) {
     // Must enable TX before RX if using shared MCLK/BCLK/WS pins with internal loopback (not typical for external codec)
     // Or if driving MCLK from TX channel (common setup)
     ESP_RETURN_ON_ERROR(i2s_channel_enable(g_i2s_tx_handle), TAG, "Failed to enable TX channel");
-    // ESP_RETURN_ON_ERROR(i2s_channel_enable(g_i2s_rx_handle), TAG, "Failed to enable RX channel");
+    if (rx) {
+        ESP_RETURN_ON_ERROR(i2s_channel_enable(g_i2s_rx_handle), TAG, "Failed to enable RX channel");
+    }
 
 //    ESP_LOGI(TAG, "ES8388 INIT COMPLETE.");
 //    es8388_dump_all();
@@ -396,6 +413,13 @@ esp_err_t es8388_init(es_codec_config_t *cfg)
 
     headphone_detect_init();
 
+    if (g_volume_lock == NULL) {
+        g_volume_lock = xSemaphoreCreateMutex();
+        if (g_volume_lock == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
     ESP_LOGI(TAG, "es8388_init: cfg->dac_output %0x, cfg->adc_input %0x", cfg->dac_output, cfg->adc_input);
 
     res = es_i2c_init(); // ESP32 in master mode
@@ -458,7 +482,7 @@ esp_err_t es8388_init(es_codec_config_t *cfg)
     /* enable es8388 PA */
     es8388_pa_power(true);
 
-    es_i2s_init();
+    es_i2s_init(cfg->codec_mode == ES_CODEC_MODE_BOTH || cfg->codec_mode == ES_CODEC_MODE_ENCODE);
 
     // This call into ADF probably needs to be replaced by some other default volume call
     // codec_dac_volume_config_t vol_cfg = ES8388_DAC_VOL_CFG_DEFAULT();
@@ -528,6 +552,12 @@ esp_err_t es8388_config_fmt(es_module_t mode, es_i2s_fmt_t fmt)
 //    };
    
 static int g_user_volume = -1;
+// what es8388_set_volume was last asked for, 0-100, so an offset change can redo it
+static int g_requested_volume = -1;
+// es8388_set_volume_offset, in register steps
+static int g_offset_steps = 0;
+// the output register as last written, 0x1E from es8388_init
+static int g_output_reg = 0x1E;
 
 // TODO:
 // there are two outputs of my card (and most ES8388) which are tied to Headphones and Speakers,
@@ -536,7 +566,8 @@ static int g_user_volume = -1;
 // consider the "scale" (especially scale before distortion) of each one indepntalyt
 // because the output electronics might be different.
 
-esp_err_t es8388_set_volume(int volume)
+// with g_volume_lock held
+static esp_err_t set_volume_locked(int volume)
 {
     // Original
 //    esp_err_t res = ESP_OK;
@@ -557,17 +588,22 @@ esp_err_t es8388_set_volume(int volume)
 
     esp_err_t res = ESP_OK; 
     if (volume < 0) volume = 0; else if (volume > 100) volume = 100; 
+    g_requested_volume = volume;
     // volume = volume_table[volume]; 
     volume = volume / 3; // just happens to map 0-100 to 0-33
+    // the ambient offset rides on top, in the same 1.5 dB steps
+    int reg = volume + g_offset_steps;
+    if (reg < 0) reg = 0; else if (reg > 33) reg = 33;
     res = es_write_reg(ES8388_LDACVOL, 0); // LDACVOL  0..-96db  in 0.5steps (0=loud, 192=silent)
     res |= es_write_reg(ES8388_RDACVOL, 0); // RDACVOL 0..-96db  in 0.5steps (0=loud, 192=silent)
-    res |= es_write_reg(ES8388_DACCONTROL24, volume);  // LOUT1 volume 0..33 dB
-    res |= es_write_reg(ES8388_DACCONTROL25, volume);  // ROUT1 volume 0..33 dB
-    res |= es_write_reg(ES8388_DACCONTROL26, volume);  // LOUT2 volume 0..33 dB
-    res |= es_write_reg(ES8388_DACCONTROL27, volume);  // ROUT2 volume 0..33 dB
+    res |= es_write_reg(ES8388_DACCONTROL24, reg);  // LOUT1 volume 0..33 dB
+    res |= es_write_reg(ES8388_DACCONTROL25, reg);  // ROUT1 volume 0..33 dB
+    res |= es_write_reg(ES8388_DACCONTROL26, reg);  // LOUT2 volume 0..33 dB
+    res |= es_write_reg(ES8388_DACCONTROL27, reg);  // ROUT2 volume 0..33 dB
     //ESP_LOGI(TAG, "Set volume:%.2d", volume);
 
     g_user_volume = volume;
+    g_output_reg = reg;
 
     // there is difference of opinion about which volume system to use for this kind of volume
     // control. There are these settings as well. The advice I have is to set these to reasonable
@@ -591,6 +627,42 @@ esp_err_t es8388_set_volume(int volume)
 
 }
 
+esp_err_t es8388_set_volume(int volume)
+{
+    if (g_volume_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(g_volume_lock, portMAX_DELAY);
+    esp_err_t res = set_volume_locked(volume);
+    xSemaphoreGive(g_volume_lock);
+    return res;
+}
+
+esp_err_t es8388_set_volume_offset(float db)
+{
+    if (g_volume_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    int steps = (int)lrintf(db / ES8388_OUT_STEP_DB);
+    esp_err_t res = ESP_OK;
+    xSemaphoreTake(g_volume_lock, portMAX_DELAY);
+    // nothing to redo before the first volume
+    if (steps != g_offset_steps) {
+        g_offset_steps = steps;
+        if (g_requested_volume >= 0) {
+            res = set_volume_locked(g_requested_volume);
+        }
+    }
+    xSemaphoreGive(g_volume_lock);
+    return res;
+}
+
+// Datasheet: LOUT1VOL and friends are -45 dB at 0, 0 dB at 0x1E, 1.5 dB a step
+float es8388_get_output_db(void)
+{
+    return (g_output_reg - 0x1E) * ES8388_OUT_STEP_DB;
+}
+
 esp_err_t es8388_get_volume(int *volume)
 {
     esp_err_t res = ESP_OK;
@@ -842,3 +914,22 @@ esp_err_t es8388_write(const void *buffer, size_t bytes_to_write, size_t *bytes_
 
 }
 
+
+/*
+* Reader, for the mics. Mono, see es_i2s_init.
+*
+* Unlike the writer this hands back what it has at the timeout: a level meter
+* would rather have a short block than wait.
+*/
+esp_err_t es8388_read(void *buffer, size_t bytes_to_read, size_t *bytes_read, TickType_t ticks_to_wait) {
+
+    *bytes_read = 0;
+    if (g_i2s_rx_handle == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t ret = i2s_channel_read(g_i2s_rx_handle, buffer, bytes_to_read, bytes_read, ticks_to_wait);
+    if (ret != ESP_OK && ret != ESP_ERR_TIMEOUT) {
+        ESP_LOGW(TAG, "i2s_channel_read: returned failure code returning error %d", ret);
+    }
+    return ret;
+}
@@ -184,11 +184,14 @@ esp_err_t es8388_stop(es_module_t mode);
 /**
  * @brief  Set voice volume
  *
+ * Safe to call from any task, as is es8388_set_volume_offset.
+ *
  * @param volume:  voice volume (0~100)
  *
  * @return
  *     - ESP_OK
  *     - ESP_FAIL
+ *     - ESP_ERR_INVALID_STATE before es8388_init
  */
 esp_err_t es8388_set_volume(int volume);
 
@@ -321,6 +324,49 @@ esp_err_t es8388_pa_power(bool enable);
  */
 esp_err_t es8388_write(const void *buffer, size_t bytes_to_write, size_t *bytes_written);
 
+/**
+ * @brief Read microphone samples, 16 bit mono (the left ADC channel).
+ *
+ * The RX channel only exists when es8388_init had codec_mode ES_CODEC_MODE_BOTH or
+ * ES_CODEC_MODE_ENCODE. Its DMA runs all the time, and overwrites what isn't read.
+ *
+ * @param buffer where to put the samples
+ * @param bytes_to_read size of the buffer
+ * @param bytes_read (out) returns the number of bytes read
+ * @param ticks_to_wait how long to wait for them
+ *
+ * @return
+ *     - ESP_ERR_INVALID_STATE if there is no RX channel
+ *     - ESP_ERR_TIMEOUT
+ *     - ESP_OK
+ */
+esp_err_t es8388_read(void *buffer, size_t bytes_to_read, size_t *bytes_read, TickType_t ticks_to_wait);
+
+// The analog output stage (LOUT1VOL and friends) moves in steps of this
+#define ES8388_OUT_STEP_DB  1.5f
+
+/**
+ * @brief Offset every es8388_set_volume from now on by this many dB, and the current volume too.
+ *
+ * Rounded to ES8388_OUT_STEP_DB, and the output register still stops at its ends.
+ * Only writes the codec when the rounded step changes.
+ *
+ * @param db offset, 0 for none
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_FAIL
+ *     - ESP_ERR_INVALID_STATE before es8388_init
+ */
+esp_err_t es8388_set_volume_offset(float db);
+
+/**
+ * @brief Gain of the analog output stage as last written, offset included
+ *
+ * @return dB, 0 at register 0x1E
+ */
+float es8388_get_output_db(void);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,554 @@
+// flac_dec
+//
+// LOUDFRAME project. FLAC frames, see flac_dec.h. Written from the format
+// specification (RFC 9639): fixed and LPC subframes, rice coded residuals,
+// the three stereo decorrelations. Samples are kept in int32, so streams are
+// limited to 24 bits, which leaves room for the side channel's extra bit.
+
+// Author: Brian Bulkowski <brian@bulkowski.org> (c) 2025
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+
+#include "flac_dec.h"
+
+#define FLAC_MAX_BPS            24
+#define FLAC_MAX_LPC_ORDER      32
+#define FLAC_MAX_FIXED_ORDER    4
+#define FLAC_MAX_HEADER_LEN     16
+
+enum {
+    FLAC_CH_INDEPENDENT = 0,
+    FLAC_CH_LEFT_SIDE = 8,
+    FLAC_CH_SIDE_RIGHT = 9,
+    FLAC_CH_MID_SIDE = 10,
+};
+
+typedef struct {
+    uint32_t block_size;
+    uint32_t channels;
+    uint32_t assignment;        /**< FLAC_CH_*, or FLAC_CH_INDEPENDENT */
+    uint32_t bps;               /**< 0 for STREAMINFO's */
+    size_t len;                 /**< Header bytes, CRC-8 included */
+} flac_frame_header_t;
+
+struct flac_dec {
+    flac_streaminfo_t info;
+    int32_t *ch[FLAC_MAX_CHANNELS];     /**< max_block samples each */
+    uint32_t frames;                    /**< In the last decoded block */
+    uint32_t bps;                       /**< Of the last decoded block */
+    uint32_t channels;
+};
+
+// CRC-8, polynomial x^8 + x^2 + x + 1, over the frame header
+static const uint8_t crc8_table[256] = {
+    0x00, 0x07, 0x0e, 0x09, 0x1c, 0x1b, 0x12, 0x15, 0x38, 0x3f, 0x36, 0x31, 0x24, 0x23, 0x2a, 0x2d,
+    0x70, 0x77, 0x7e, 0x79, 0x6c, 0x6b, 0x62, 0x65, 0x48, 0x4f, 0x46, 0x41, 0x54, 0x53, 0x5a, 0x5d,
+    0xe0, 0xe7, 0xee, 0xe9, 0xfc, 0xfb, 0xf2, 0xf5, 0xd8, 0xdf, 0xd6, 0xd1, 0xc4, 0xc3, 0xca, 0xcd,
+    0x90, 0x97, 0x9e, 0x99, 0x8c, 0x8b, 0x82, 0x85, 0xa8, 0xaf, 0xa6, 0xa1, 0xb4, 0xb3, 0xba, 0xbd,
+    0xc7, 0xc0, 0xc9, 0xce, 0xdb, 0xdc, 0xd5, 0xd2, 0xff, 0xf8, 0xf1, 0xf6, 0xe3, 0xe4, 0xed, 0xea,
+    0xb7, 0xb0, 0xb9, 0xbe, 0xab, 0xac, 0xa5, 0xa2, 0x8f, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9d, 0x9a,
+    0x27, 0x20, 0x29, 0x2e, 0x3b, 0x3c, 0x35, 0x32, 0x1f, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0d, 0x0a,
+    0x57, 0x50, 0x59, 0x5e, 0x4b, 0x4c, 0x45, 0x42, 0x6f, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7d, 0x7a,
+    0x89, 0x8e, 0x87, 0x80, 0x95, 0x92, 0x9b, 0x9c, 0xb1, 0xb6, 0xbf, 0xb8, 0xad, 0xaa, 0xa3, 0xa4,
+    0xf9, 0xfe, 0xf7, 0xf0, 0xe5, 0xe2, 0xeb, 0xec, 0xc1, 0xc6, 0xcf, 0xc8, 0xdd, 0xda, 0xd3, 0xd4,
+    0x69, 0x6e, 0x67, 0x60, 0x75, 0x72, 0x7b, 0x7c, 0x51, 0x56, 0x5f, 0x58, 0x4d, 0x4a, 0x43, 0x44,
+    0x19, 0x1e, 0x17, 0x10, 0x05, 0x02, 0x0b, 0x0c, 0x21, 0x26, 0x2f, 0x28, 0x3d, 0x3a, 0x33, 0x34,
+    0x4e, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5c, 0x5b, 0x76, 0x71, 0x78, 0x7f, 0x6a, 0x6d, 0x64, 0x63,
+    0x3e, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2c, 0x2b, 0x06, 0x01, 0x08, 0x0f, 0x1a, 0x1d, 0x14, 0x13,
+    0xae, 0xa9, 0xa0, 0xa7, 0xb2, 0xb5, 0xbc, 0xbb, 0x96, 0x91, 0x98, 0x9f, 0x8a, 0x8d, 0x84, 0x83,
+    0xde, 0xd9, 0xd0, 0xd7, 0xc2, 0xc5, 0xcc, 0xcb, 0xe6, 0xe1, 0xe8, 0xef, 0xfa, 0xfd, 0xf4, 0xf3,
+};
+
+// CRC-16, polynomial x^16 + x^15 + x^2 + 1, over the whole frame
+static const uint16_t crc16_table[256] = {
+    0x0000, 0x8005, 0x800f, 0x000a, 0x801b, 0x001e, 0x0014, 0x8011, 0x8033, 0x0036, 0x003c, 0x8039, 0x0028, 0x802d, 0x8027, 0x0022,
+    0x8063, 0x0066, 0x006c, 0x8069, 0x0078, 0x807d, 0x8077, 0x0072, 0x0050, 0x8055, 0x805f, 0x005a, 0x804b, 0x004e, 0x0044, 0x8041,
+    0x80c3, 0x00c6, 0x00cc, 0x80c9, 0x00d8, 0x80dd, 0x80d7, 0x00d2, 0x00f0, 0x80f5, 0x80ff, 0x00fa, 0x80eb, 0x00ee, 0x00e4, 0x80e1,
+    0x00a0, 0x80a5, 0x80af, 0x00aa, 0x80bb, 0x00be, 0x00b4, 0x80b1, 0x8093, 0x0096, 0x009c, 0x8099, 0x0088, 0x808d, 0x8087, 0x0082,
+    0x8183, 0x0186, 0x018c, 0x8189, 0x0198, 0x819d, 0x8197, 0x0192, 0x01b0, 0x81b5, 0x81bf, 0x01ba, 0x81ab, 0x01ae, 0x01a4, 0x81a1,
+    0x01e0, 0x81e5, 0x81ef, 0x01ea, 0x81fb, 0x01fe, 0x01f4, 0x81f1, 0x81d3, 0x01d6, 0x01dc, 0x81d9, 0x01c8, 0x81cd, 0x81c7, 0x01c2,
+    0x0140, 0x8145, 0x814f, 0x014a, 0x815b, 0x015e, 0x0154, 0x8151, 0x8173, 0x0176, 0x017c, 0x8179, 0x0168, 0x816d, 0x8167, 0x0162,
+    0x8123, 0x0126, 0x012c, 0x8129, 0x0138, 0x813d, 0x8137, 0x0132, 0x0110, 0x8115, 0x811f, 0x011a, 0x810b, 0x010e, 0x0104, 0x8101,
+    0x8303, 0x0306, 0x030c, 0x8309, 0x0318, 0x831d, 0x8317, 0x0312, 0x0330, 0x8335, 0x833f, 0x033a, 0x832b, 0x032e, 0x0324, 0x8321,
+    0x0360, 0x8365, 0x836f, 0x036a, 0x837b, 0x037e, 0x0374, 0x8371, 0x8353, 0x0356, 0x035c, 0x8359, 0x0348, 0x834d, 0x8347, 0x0342,
+    0x03c0, 0x83c5, 0x83cf, 0x03ca, 0x83db, 0x03de, 0x03d4, 0x83d1, 0x83f3, 0x03f6, 0x03fc, 0x83f9, 0x03e8, 0x83ed, 0x83e7, 0x03e2,
+    0x83a3, 0x03a6, 0x03ac, 0x83a9, 0x03b8, 0x83bd, 0x83b7, 0x03b2, 0x0390, 0x8395, 0x839f, 0x039a, 0x838b, 0x038e, 0x0384, 0x8381,
+    0x0280, 0x8285, 0x828f, 0x028a, 0x829b, 0x029e, 0x0294, 0x8291, 0x82b3, 0x02b6, 0x02bc, 0x82b9, 0x02a8, 0x82ad, 0x82a7, 0x02a2,
+    0x82e3, 0x02e6, 0x02ec, 0x82e9, 0x02f8, 0x82fd, 0x82f7, 0x02f2, 0x02d0, 0x82d5, 0x82df, 0x02da, 0x82cb, 0x02ce, 0x02c4, 0x82c1,
+    0x8243, 0x0246, 0x024c, 0x8249, 0x0258, 0x825d, 0x8257, 0x0252, 0x0270, 0x8275, 0x827f, 0x027a, 0x826b, 0x026e, 0x0264, 0x8261,
+    0x0220, 0x8225, 0x822f, 0x022a, 0x823b, 0x023e, 0x0234, 0x8231, 0x8213, 0x0216, 0x021c, 0x8219, 0x0208, 0x820d, 0x8207, 0x0202,
+};
+
+static uint8_t crc8(const uint8_t *p, size_t len) {
+    uint8_t crc = 0;
+    while (len--) crc = crc8_table[crc ^ *p++];
+    return crc;
+}
+
+static uint16_t crc16(const uint8_t *p, size_t len) {
+    uint16_t crc = 0;
+    while (len--) crc = (uint16_t)(crc << 8) ^ crc16_table[(crc >> 8) ^ *p++];
+    return crc;
+}
+
+//
+// Bit reader. The cache holds 25 to 32 unread bits, left aligned, the rest
+// zero. Past the end of the buffer it reads zeros and counts on, and the
+// frame is checked for an overrun once at the end, which keeps the test out
+// of the residual loop.
+//
+
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;                 /**< Next byte into the cache */
+    uint32_t cache;
+    int bits;
+} flac_bits_t;
+
+static inline void br_refill(flac_bits_t *br) {
+    while (br->bits <= 24) {
+        uint32_t b = br->pos < br->len ? br->buf[br->pos] : 0;
+        br->pos++;
+        br->cache |= b << (24 - br->bits);
+        br->bits += 8;
+    }
+}
+
+static void br_init(flac_bits_t *br, const uint8_t *buf, size_t len) {
+    br->buf = buf;
+    br->len = len;
+    br->pos = 0;
+    br->cache = 0;
+    br->bits = 0;
+    br_refill(br);
+}
+
+// Bits read so far
+static inline size_t br_tell(const flac_bits_t *br) {
+    return br->pos * 8 - br->bits;
+}
+
+static inline bool br_overrun(const flac_bits_t *br) {
+    return br_tell(br) > br->len * 8;
+}
+
+// n up to 24
+static inline uint32_t br_read(flac_bits_t *br, int n) {
+    if (n == 0) return 0;
+    uint32_t v = br->cache >> (32 - n);
+    br->cache <<= n;
+    br->bits -= n;
+    br_refill(br);
+    return v;
+}
+
+// n up to 32
+static inline uint32_t br_read_long(flac_bits_t *br, int n) {
+    if (n <= 24) return br_read(br, n);
+    uint32_t hi = br_read(br, n - 16);
+    return (hi << 16) | br_read(br, 16);
+}
+
+static inline int32_t br_read_signed(flac_bits_t *br, int n) {
+    if (n == 0) return 0;
+    uint32_t v = br_read_long(br, n);
+    return (int32_t)(v << (32 - n)) >> (32 - n);
+}
+
+// Zeros up to the next one, which is consumed too
+static inline uint32_t br_unary(flac_bits_t *br) {
+    uint32_t q = 0;
+    while (br->cache == 0) {
+        q += br->bits;
+        br->bits = 0;
+        br_refill(br);
+        if (br->pos > br->len + 4) {
+            return q;
+        }
+    }
+    int z = __builtin_clz(br->cache);
+    q += z;
+    br->cache <<= z;
+    br->cache <<= 1;
+    br->bits -= z + 1;
+    br_refill(br);
+    return q;
+}
+
+//
+// Stream and frame headers
+//
+
+esp_err_t flac_streaminfo_parse(const uint8_t *b, flac_streaminfo_t *info) {
+    info->min_block = (b[0] << 8) | b[1];
+    info->max_block = (b[2] << 8) | b[3];
+    info->min_frame = (b[4] << 16) | (b[5] << 8) | b[6];
+    info->max_frame = (b[7] << 16) | (b[8] << 8) | b[9];
+    info->sample_rate = (b[10] << 12) | (b[11] << 4) | (b[12] >> 4);
+    info->channels = ((b[12] >> 1) & 0x07) + 1;
+    info->bits_per_sample = (((b[12] & 0x01) << 4) | (b[13] >> 4)) + 1;
+    info->total_frames = ((uint64_t)(b[13] & 0x0f) << 32) |
+        ((uint32_t)b[14] << 24) | (b[15] << 16) | (b[16] << 8) | b[17];
+
+    if (info->max_block < 16 || info->min_block > info->max_block || info->sample_rate == 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (info->channels > FLAC_MAX_CHANNELS || info->bits_per_sample > FLAC_MAX_BPS) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    return ESP_OK;
+}
+
+size_t flac_frame_bound(const flac_streaminfo_t *info) {
+    if (info->max_frame) {
+        return info->max_frame;
+    }
+    // Every channel verbatim, the side channel a bit wider, plus headers
+    return (size_t)info->max_block * info->channels * (info->bits_per_sample + 1) / 8
+        + FLAC_MAX_HEADER_LEN + info->channels * 8 + 2;
+}
+
+/**
+ * @brief Parse and check a frame header.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_SIZE if len ends inside it, ESP_ERR_INVALID_CRC if it isn't one.
+ */
+static esp_err_t flac_frame_header(const uint8_t *b, size_t len, flac_frame_header_t *h) {
+    static const uint8_t bps_codes[8] = { 0, 8, 12, 0xff, 16, 20, 24, 0xff };
+
+    if (len < 6) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (b[0] != 0xff || (b[1] & 0xfe) != 0xf8) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    uint32_t bs_code = b[2] >> 4, sr_code = b[2] & 0x0f;
+    uint32_t ch_code = b[3] >> 4, bps_code = (b[3] >> 1) & 0x07;
+    if (bs_code == 0 || sr_code == 15 || ch_code > FLAC_CH_MID_SIDE ||
+        bps_codes[bps_code] == 0xff || (b[3] & 0x01)) {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    // The frame or sample number, UTF-8 style. Only its length matters here.
+    size_t p = 4;
+    uint8_t lead = b[p++];
+    int extra = 0;
+    if (lead & 0x80) {
+        while (extra < 7 && (lead & (0x40 >> extra))) extra++;
+        if (extra == 0 || extra > 6) {
+            return ESP_ERR_INVALID_CRC;
+        }
+    }
+    size_t need = p + extra + 1;
+    need += bs_code == 6 ? 1 : bs_code == 7 ? 2 : 0;
+    need += sr_code == 12 ? 1 : (sr_code == 13 || sr_code == 14) ? 2 : 0;
+    if (len < need) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (int i = 0; i < extra; i++) {
+        if ((b[p++] & 0xc0) != 0x80) {
+            return ESP_ERR_INVALID_CRC;
+        }
+    }
+
+    if (bs_code == 1) {
+        h->block_size = 192;
+    } else if (bs_code <= 5) {
+        h->block_size = 576 << (bs_code - 2);
+    } else if (bs_code == 6) {
+        h->block_size = b[p++] + 1;
+    } else if (bs_code == 7) {
+        h->block_size = ((b[p] << 8) | b[p + 1]) + 1;
+        p += 2;
+    } else {
+        h->block_size = 256 << (bs_code - 8);
+    }
+    if (sr_code == 12) {
+        p += 1;
+    } else if (sr_code == 13 || sr_code == 14) {
+        p += 2;
+    }
+
+    if (crc8(b, p) != b[p]) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    h->len = p + 1;
+    h->assignment = ch_code < FLAC_CH_LEFT_SIDE ? FLAC_CH_INDEPENDENT : ch_code;
+    h->channels = ch_code < FLAC_CH_LEFT_SIDE ? ch_code + 1 : 2;
+    h->bps = bps_codes[bps_code];
+    return ESP_OK;
+}
+
+int flac_dec_find_sync(const uint8_t *buf, size_t len) {
+    flac_frame_header_t h;
+    for (size_t i = 0; i + 1 < len; i++) {
+        if (buf[i] != 0xff || (buf[i + 1] & 0xfe) != 0xf8) {
+            continue;
+        }
+        if (flac_frame_header(buf + i, len - i, &h) == ESP_OK) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+//
+// Subframes
+//
+
+static esp_err_t flac_residual(flac_bits_t *br, int32_t *out, uint32_t block_size, uint32_t order) {
+    uint32_t method = br_read(br, 2);
+    if (method > 1) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    int param_bits = method == 0 ? 4 : 5;
+    uint32_t escape = (1u << param_bits) - 1;
+    uint32_t porder = br_read(br, 4);
+    uint32_t psize = block_size >> porder;
+    if ((psize << porder) != block_size || psize < order) {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    uint32_t i = order;
+    for (uint32_t part = 0; part < (1u << porder); part++) {
+        uint32_t end = (part + 1) * psize;
+        uint32_t k = br_read(br, param_bits);
+        if (k == escape) {
+            int n = br_read(br, 5);
+            for (; i < end; i++) {
+                out[i] = br_read_signed(br, n);
+            }
+        } else {
+            for (; i < end; i++) {
+                uint32_t u = (br_unary(br) << k) | br_read_long(br, k);
+                out[i] = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+            }
+        }
+        if (br_overrun(br)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    return ESP_OK;
+}
+
+// The predictors run in uint32 so that a damaged frame wraps instead of
+// overflowing; its CRC throws it out afterwards
+static void flac_fixed_restore(int32_t *s, uint32_t n, uint32_t order) {
+    uint32_t *u = (uint32_t *)s;
+    switch (order) {
+    case 1:
+        for (uint32_t i = 1; i < n; i++) u[i] += u[i - 1];
+        break;
+    case 2:
+        for (uint32_t i = 2; i < n; i++) u[i] += 2 * u[i - 1] - u[i - 2];
+        break;
+    case 3:
+        for (uint32_t i = 3; i < n; i++) u[i] += 3 * (u[i - 1] - u[i - 2]) + u[i - 3];
+        break;
+    case 4:
+        for (uint32_t i = 4; i < n; i++) u[i] += 4 * (u[i - 1] + u[i - 3]) - 6 * u[i - 2] - u[i - 4];
+        break;
+    default:
+        break;
+    }
+}
+
+// The sum fits 32 bits when bps + precision + log2(order) does, which is
+// what encoders aim for at 16 bits; otherwise accumulate in 64
+static void flac_lpc_restore(int32_t *s, uint32_t n, const int32_t *coef, uint32_t order, int shift, bool wide) {
+    if (!wide) {
+        for (uint32_t i = order; i < n; i++) {
+            uint32_t sum = 0;
+            const int32_t *h = s + i;
+            for (uint32_t j = 0; j < order; j++) sum += (uint32_t)coef[j] * (uint32_t)h[-1 - (int)j];
+            s[i] = (int32_t)((uint32_t)s[i] + (uint32_t)((int32_t)sum >> shift));
+        }
+    } else {
+        for (uint32_t i = order; i < n; i++) {
+            int64_t sum = 0;
+            const int32_t *h = s + i;
+            for (uint32_t j = 0; j < order; j++) sum += (int64_t)coef[j] * h[-1 - (int)j];
+            s[i] = (int32_t)((uint32_t)s[i] + (uint32_t)(sum >> shift));
+        }
+    }
+}
+
+static int ilog2_ceil(uint32_t v) {
+    int l = 0;
+    while ((1u << l) < v) l++;
+    return l;
+}
+
+static esp_err_t flac_subframe(flac_bits_t *br, int32_t *s, uint32_t block_size, uint32_t bps) {
+    if (br_read(br, 1) != 0) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    uint32_t type = br_read(br, 6);
+    uint32_t wasted = 0;
+    if (br_read(br, 1)) {
+        wasted = br_unary(br) + 1;
+        if (wasted >= bps) {
+            return ESP_ERR_INVALID_CRC;
+        }
+        bps -= wasted;
+    }
+
+    esp_err_t err = ESP_OK;
+    if (type == 0) {
+        int32_t v = br_read_signed(br, bps);
+        for (uint32_t i = 0; i < block_size; i++) s[i] = v;
+    } else if (type == 1) {
+        for (uint32_t i = 0; i < block_size; i++) s[i] = br_read_signed(br, bps);
+    } else if (type >= 8 && type <= 8 + FLAC_MAX_FIXED_ORDER) {
+        uint32_t order = type - 8;
+        if (order > block_size) {
+            return ESP_ERR_INVALID_CRC;
+        }
+        for (uint32_t i = 0; i < order; i++) s[i] = br_read_signed(br, bps);
+        err = flac_residual(br, s, block_size, order);
+        if (err == ESP_OK) {
+            flac_fixed_restore(s, block_size, order);
+        }
+    } else if (type >= 32) {
+        uint32_t order = type - 31;
+        if (order > block_size) {
+            return ESP_ERR_INVALID_CRC;
+        }
+        for (uint32_t i = 0; i < order; i++) s[i] = br_read_signed(br, bps);
+        uint32_t precision = br_read(br, 4) + 1;
+        int shift = br_read_signed(br, 5);
+        if (precision == 16 || shift < 0) {
+            return ESP_ERR_INVALID_CRC;
+        }
+        int32_t coef[FLAC_MAX_LPC_ORDER];
+        for (uint32_t i = 0; i < order; i++) coef[i] = br_read_signed(br, precision);
+        err = flac_residual(br, s, block_size, order);
+        if (err == ESP_OK) {
+            bool wide = bps + precision + ilog2_ceil(order) > 32;
+            flac_lpc_restore(s, block_size, coef, order, shift, wide);
+        }
+    } else {
+        return ESP_ERR_INVALID_CRC;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (br_overrun(br)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (wasted) {
+        for (uint32_t i = 0; i < block_size; i++) s[i] = (int32_t)((uint32_t)s[i] << wasted);
+    }
+    return ESP_OK;
+}
+
+//
+// Frames
+//
+
+flac_dec_handle_t flac_dec_create(const flac_streaminfo_t *info, uint32_t caps) {
+    struct flac_dec *dec = calloc(1, sizeof(struct flac_dec));
+    if (dec == NULL) {
+        return NULL;
+    }
+    dec->info = *info;
+    for (int c = 0; c < info->channels; c++) {
+        dec->ch[c] = heap_caps_malloc(info->max_block * sizeof(int32_t), caps);
+        if (dec->ch[c] == NULL) {
+            flac_dec_destroy(dec);
+            return NULL;
+        }
+    }
+    return dec;
+}
+
+void flac_dec_destroy(flac_dec_handle_t dec) {
+    if (dec == NULL) return;
+    for (int c = 0; c < FLAC_MAX_CHANNELS; c++) free(dec->ch[c]);
+    free(dec);
+}
+
+esp_err_t flac_dec_frame(flac_dec_handle_t dec, const uint8_t *buf, size_t len, size_t *consumed, size_t *frames) {
+    flac_frame_header_t h;
+    esp_err_t err = flac_frame_header(buf, len, &h);
+    if (err != ESP_OK) {
+        return err;
+    }
+    uint32_t bps = h.bps ? h.bps : dec->info.bits_per_sample;
+    if (h.block_size > dec->info.max_block || h.channels != dec->info.channels || bps > FLAC_MAX_BPS) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    flac_bits_t br;
+    br_init(&br, buf + h.len, len - h.len);
+    for (uint32_t c = 0; c < h.channels; c++) {
+        // the side channel carries one bit more
+        uint32_t side = (h.assignment == FLAC_CH_LEFT_SIDE && c == 1) ||
+                        (h.assignment == FLAC_CH_SIDE_RIGHT && c == 0) ||
+                        (h.assignment == FLAC_CH_MID_SIDE && c == 1);
+        err = flac_subframe(&br, dec->ch[c], h.block_size, bps + side);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    // Pad to the byte, then the CRC-16 of everything before it
+    size_t end = h.len + (br_tell(&br) + 7) / 8 + 2;
+    if (end > len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (crc16(buf, end - 2) != ((buf[end - 2] << 8) | buf[end - 1])) {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    int32_t *a = dec->ch[0], *b = dec->ch[1];
+    uint32_t n = h.block_size;
+    switch (h.assignment) {
+    case FLAC_CH_LEFT_SIDE:
+        for (uint32_t i = 0; i < n; i++) b[i] = (int32_t)((uint32_t)a[i] - (uint32_t)b[i]);
+        break;
+    case FLAC_CH_SIDE_RIGHT:
+        for (uint32_t i = 0; i < n; i++) a[i] = (int32_t)((uint32_t)a[i] + (uint32_t)b[i]);
+        break;
+    case FLAC_CH_MID_SIDE:
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t side = (uint32_t)b[i];
+            uint32_t mid = ((uint32_t)a[i] << 1) | (side & 1);
+            a[i] = (int32_t)(mid + side) >> 1;
+            b[i] = (int32_t)(mid - side) >> 1;
+        }
+        break;
+    default:
+        break;
+    }
+
+    dec->frames = n;
+    dec->bps = bps;
+    dec->channels = h.channels;
+    *consumed = end;
+    *frames = n;
+    return ESP_OK;
+}
+
+void flac_dec_read_pcm16(flac_dec_handle_t dec, size_t first, size_t n, int16_t *out) {
+    const int32_t *l = dec->ch[0] + first;
+    const int32_t *r = (dec->channels == 2 ? dec->ch[1] : dec->ch[0]) + first;
+    if (dec->bps >= 16) {
+        int shift = dec->bps - 16;
+        for (size_t i = 0; i < n; i++) {
+            *out++ = (int16_t)(l[i] >> shift);
+            *out++ = (int16_t)(r[i] >> shift);
+        }
+    } else {
+        int shift = 16 - dec->bps;
+        for (size_t i = 0; i < n; i++) {
+            *out++ = (int16_t)((uint32_t)l[i] << shift);
+            *out++ = (int16_t)((uint32_t)r[i] << shift);
+        }
+    }
+}
@@ -0,0 +1,106 @@
+// flac_dec
+//
+// LOUDFRAME project. A streaming FLAC decoder: one frame at a time, from a
+// buffer the caller fills, into work buffers sized once from STREAMINFO.
+// Nothing is allocated per frame. Mono and stereo, 8 to 24 bits, output as
+// interleaved 16 bit stereo for the es8388.
+
+// Author: Brian Bulkowski <brian@bulkowski.org> (c) 2025
+
+#ifndef __FLAC_DEC_H__
+#define __FLAC_DEC_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLAC_STREAMINFO_LEN     34
+#define FLAC_MAX_CHANNELS       2
+
+typedef struct {
+    uint16_t min_block;
+    uint16_t max_block;         /**< Frames in the largest block, sizes the work buffers */
+    uint32_t min_frame;
+    uint32_t max_frame;         /**< Bytes in the largest frame, 0 when the encoder didn't say */
+    uint32_t sample_rate;
+    uint8_t channels;
+    uint8_t bits_per_sample;
+    uint64_t total_frames;      /**< 0 when unknown */
+} flac_streaminfo_t;
+
+typedef struct flac_dec *flac_dec_handle_t;
+
+/**
+ * @brief      Parse the body of a STREAMINFO metadata block
+ *
+ * @param[in]  body   FLAC_STREAMINFO_LEN bytes
+ * @param[out] info   The stream's parameters
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_NOT_SUPPORTED for streams this decoder can't play
+ */
+esp_err_t flac_streaminfo_parse(const uint8_t *body, flac_streaminfo_t *info);
+
+/**
+ * @brief      Bytes a frame of this stream can take: max_frame, or the worst case when that is 0
+ */
+size_t flac_frame_bound(const flac_streaminfo_t *info);
+
+/**
+ * @brief      Create a decoder, with its work buffers (4 bytes per sample of the largest block) in caps memory
+ *
+ * @param[in]  info   From flac_streaminfo_parse
+ * @param[in]  caps   Memory capabilities for the work buffers, e.g. MALLOC_CAP_SPIRAM
+ *
+ * @return     The decoder, NULL when out of memory
+ */
+flac_dec_handle_t flac_dec_create(const flac_streaminfo_t *info, uint32_t caps);
+
+void flac_dec_destroy(flac_dec_handle_t dec);
+
+/**
+ * @brief      Find the next frame header: the sync code, with a header CRC that checks out
+ *
+ * @return     Its offset in buf, or -1 when there is none. A header cut off at the end isn't found.
+ */
+int flac_dec_find_sync(const uint8_t *buf, size_t len);
+
+/**
+ * @brief      Decode the frame at the start of buf
+ *
+ * @param[in]  dec        The decoder
+ * @param[in]  buf        Starts with a frame header
+ * @param[in]  len        Bytes available
+ * @param[out] consumed   The frame's length
+ * @param[out] frames     Frames decoded, to be fetched with flac_dec_read_pcm16
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_INVALID_SIZE when buf ends before the frame does
+ *     - ESP_ERR_INVALID_CRC for a damaged frame, resync from the next byte
+ *     - ESP_ERR_NOT_SUPPORTED when the frame doesn't match the stream (block too large, channels)
+ */
+esp_err_t flac_dec_frame(flac_dec_handle_t dec, const uint8_t *buf, size_t len, size_t *consumed, size_t *frames);
+
+/**
+ * @brief      Copy decoded frames out as interleaved 16 bit stereo, mono widened, deeper samples truncated
+ *
+ * @param[in]  dec     The decoder
+ * @param[in]  first   First frame of the last decoded block to copy
+ * @param[in]  n       Frames to copy
+ * @param[out] out     Room for 2 * n samples
+ */
+void flac_dec_read_pcm16(flac_dec_handle_t dec, size_t first, size_t n, int16_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FLAC_DEC_H__ */
@@ -0,0 +1,155 @@
+// ima_adpcm
+//
+// LOUDFRAME project. IMA ADPCM blocks, see ima_adpcm.h.
+
+// Author: Brian Bulkowski <brian@bulkowski.org> (c) 2025
+
+#include "ima_adpcm.h"
+
+static const int16_t step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t index_table[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+// The one step both directions share: the encoder has to track exactly
+// what the decoder will reconstruct
+static inline int16_t ima_step(ima_adpcm_state_t *s, unsigned nibble) {
+    int32_t step = step_table[s->index];
+    int32_t diff = step >> 3;
+    if (nibble & 4) diff += step;
+    if (nibble & 2) diff += step >> 1;
+    if (nibble & 1) diff += step >> 2;
+    int32_t p = (nibble & 8) ? s->predictor - diff : s->predictor + diff;
+    if (p > 32767) p = 32767;
+    else if (p < -32768) p = -32768;
+    s->predictor = p;
+    int32_t i = s->index + index_table[nibble];
+    s->index = i < 0 ? 0 : i > 88 ? 88 : i;
+    return (int16_t)p;
+}
+
+static inline unsigned ima_quantize(ima_adpcm_state_t *s, int32_t sample) {
+    int32_t step = step_table[s->index];
+    int32_t diff = sample - s->predictor;
+    unsigned nibble = 0;
+    if (diff < 0) {
+        nibble = 8;
+        diff = -diff;
+    }
+    if (diff >= step) {
+        nibble |= 4;
+        diff -= step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+        nibble |= 2;
+        diff -= step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+        nibble |= 1;
+    }
+    ima_step(s, nibble);
+    return nibble;
+}
+
+size_t ima_adpcm_block_frames(size_t block_len, int channels) {
+    if (channels < 1 || channels > IMA_ADPCM_MAX_CHANNELS) {
+        return 0;
+    }
+    size_t header = 4 * channels, group = 4 * channels;
+    if (block_len < header || (block_len - header) % group) {
+        return 0;
+    }
+    return 1 + (block_len - header) / group * 8;
+}
+
+esp_err_t ima_adpcm_decode_block(const uint8_t *block, size_t block_len, int channels, int16_t *pcm, size_t *frames_o) {
+    if (channels < 1 || channels > IMA_ADPCM_MAX_CHANNELS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t frames = ima_adpcm_block_frames(block_len, channels);
+    if (frames == 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    ima_adpcm_state_t state[IMA_ADPCM_MAX_CHANNELS];
+    for (int c = 0; c < channels; c++) {
+        const uint8_t *h = block + 4 * c;
+        state[c].predictor = (int16_t)(h[0] | (h[1] << 8));
+        state[c].index = h[2];
+        if (state[c].index > 88) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        pcm[c] = (int16_t)state[c].predictor;
+    }
+
+    // Each group is 4 bytes a channel, 8 samples of it
+    const uint8_t *in = block + 4 * channels;
+    int16_t *out = pcm + channels;
+    for (size_t f = 1; f < frames; f += 8) {
+        for (int c = 0; c < channels; c++) {
+            ima_adpcm_state_t *s = &state[c];
+            int16_t *o = out + c;
+            for (int b = 0; b < 4; b++) {
+                uint8_t byte = *in++;
+                o[0] = ima_step(s, byte & 0x0f);
+                o[channels] = ima_step(s, byte >> 4);
+                o += 2 * channels;
+            }
+        }
+        out += 8 * channels;
+    }
+
+    *frames_o = frames;
+    return ESP_OK;
+}
+
+esp_err_t ima_adpcm_encode_block(const int16_t *pcm, int channels, ima_adpcm_state_t *state,
+                                 uint8_t *block, size_t block_len) {
+    if (channels < 1 || channels > IMA_ADPCM_MAX_CHANNELS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t frames = ima_adpcm_block_frames(block_len, channels);
+    if (frames == 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // The header's sample is played as is, so the predictor restarts from it
+    for (int c = 0; c < channels; c++) {
+        uint8_t *h = block + 4 * c;
+        state[c].predictor = pcm[c];
+        h[0] = (uint16_t)pcm[c] & 0xff;
+        h[1] = (uint16_t)pcm[c] >> 8;
+        h[2] = (uint8_t)state[c].index;
+        h[3] = 0;
+    }
+
+    uint8_t *out = block + 4 * channels;
+    const int16_t *in = pcm + channels;
+    for (size_t f = 1; f < frames; f += 8) {
+        for (int c = 0; c < channels; c++) {
+            const int16_t *i = in + c;
+            for (int b = 0; b < 4; b++) {
+                unsigned lo = ima_quantize(&state[c], i[0]);
+                unsigned hi = ima_quantize(&state[c], i[channels]);
+                *out++ = (uint8_t)(lo | (hi << 4));
+                i += 2 * channels;
+            }
+        }
+        in += 8 * channels;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,77 @@
+// ima_adpcm
+//
+// LOUDFRAME project. IMA ADPCM as WAV files carry it (format 0x11, "DVI
+// ADPCM"): 4 bits a sample, a quarter of the card bandwidth of 16 bit PCM.
+// A block starts with a 4 byte header per channel (the first sample and the
+// step index), then the channels take turns, 4 bytes (8 samples) each,
+// low nibble first. Decoding is a table lookup and a few adds per sample.
+
+// Author: Brian Bulkowski <brian@bulkowski.org> (c) 2025
+
+#ifndef __IMA_ADPCM_H__
+#define __IMA_ADPCM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IMA_ADPCM_WAV_FORMAT    0x0011
+#define IMA_ADPCM_MAX_CHANNELS  2
+
+typedef struct {
+    int32_t predictor;          /**< Last sample, -32768 to 32767 */
+    int32_t index;              /**< Into the step table, 0 to 88 */
+} ima_adpcm_state_t;
+
+/**
+ * @brief      Frames (samples per channel) in a block of this size
+ *
+ * @param[in]  block_len   Bytes in the block. The last block of a file may be shorter than block_align.
+ * @param[in]  channels    1 or 2
+ *
+ * @return     The frame count, 0 when block_len isn't a header plus whole groups of 8 samples
+ */
+size_t ima_adpcm_block_frames(size_t block_len, int channels);
+
+/**
+ * @brief      Decode one block to interleaved 16 bit PCM
+ *
+ * @param[in]  block       The block
+ * @param[in]  block_len   Its length, see ima_adpcm_block_frames
+ * @param[in]  channels    1 or 2
+ * @param[out] pcm         Room for ima_adpcm_block_frames() * channels samples
+ * @param[out] frames_o    Frames written
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_INVALID_SIZE if block_len doesn't hold a whole block
+ *     - ESP_ERR_INVALID_ARG for a bad channel count or step index
+ */
+esp_err_t ima_adpcm_decode_block(const uint8_t *block, size_t block_len, int channels, int16_t *pcm, size_t *frames_o);
+
+/**
+ * @brief      Encode one block from interleaved 16 bit PCM. The encoder for the host transcoder.
+ *
+ * @param[in]     pcm         ima_adpcm_block_frames(block_len, channels) frames
+ * @param[in]     channels    1 or 2
+ * @param[in,out] state       Per channel, carried from block to block. Zero it before the first.
+ * @param[out]    block       block_len bytes
+ * @param[in]     block_len   A valid block length, see ima_adpcm_block_frames
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_INVALID_SIZE or ESP_ERR_INVALID_ARG as for decoding
+ */
+esp_err_t ima_adpcm_encode_block(const int16_t *pcm, int channels, ima_adpcm_state_t *state,
+                                 uint8_t *block, size_t block_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __IMA_ADPCM_H__ */
@@ -22,4 +22,7 @@
 void maxbotix_init(void);
 uint16_t maxbotix_get_latest(void);
 int32_t maxbotix_get_age(void);
-float maxbotix_get_median(float pct,int16_t min_count,int16_t max_count,int16_t *act_count);
\ No newline at end of file
+float maxbotix_get_median(float pct,int16_t min_count,int16_t max_count,int16_t *act_count);
+
+/* Sorts sel in place, then the mean without the top and bottom pct/2 */
+float maxbotix_trimmed_mean(uint16_t *sel, int16_t count, float pct);
\ No newline at end of file
@@ -149,7 +149,7 @@ static void maxbotix_event_handler(void *pvParameters)
                             xSemaphoreGive(sample_lock);
 
                             /* Talk about what we did */
-                            ESP_LOGI(TAG,"received sample value %" PRId32 ", inserting at index %" PRId16 ,temp,sample_next);
+                            ESP_LOGD(TAG,"received sample value %" PRId32 ", inserting at index %" PRId16 ,temp,sample_next);
                             ESP_LOGD(TAG,"receive time is %" PRIu32 ", last was %" PRIu32 ", delta %" PRIu32,now,last,delta_ms);
                         }
                         else
@@ -349,40 +349,6 @@ float maxbotix_get_median(float pct,int16_t min_count,int16_t max_count,int16_t
     ESP_LOGD(TAG,"Sample buffer from selecting back samples, %d samples",act_samp);
     //print_samples(my_samples_sel,act_samp);
 
-    /* Perform insertion sort on array */
-    for(int i = 1; i < act_samp;i++)
-    {
-        uint16_t key = my_samples_sel[i];
-        int j = i - 1;
-
-        /* Move elements of arr[0..i-1], that are
-         * greater than key, to one position ahead
-         * of their current position */
-        while (j >= 0 && my_samples_sel[j] > key)
-        {
-            my_samples_sel[j + 1] = my_samples_sel[j];
-            j = j - 1;
-        }
-        my_samples_sel[j + 1] = key;
-    }
-
-
-    ESP_LOGD(TAG,"Sample buffer from sorting samples");
-    //print_samples(my_samples_sel,act_samp);
-
-    /* Take the mean of the middle region, based on pct */
-    int32_t pct_samples = act_samp * pct;
-    ESP_LOGI(TAG,"Samples to be included in percentage filter: %"PRId32" (of %"PRIu16" total)",pct_samples,act_samp);
-    pct_samples = (pct_samples + 1) >> 1;
-    float mean = 0;
-    for(int i = pct_samples; i < (act_samp - pct_samples); i++)
-    {
-        mean += (float)my_samples_sel[i];
-    }
-    mean = mean / (float)(act_samp - pct_samples - pct_samples);
-
-    ESP_LOGI(TAG,"Actual mean calculated as %f",(double)mean);
-
-    return mean;
+    return maxbotix_trimmed_mean(my_samples_sel,act_samp,pct);
 
 }
\ No newline at end of file
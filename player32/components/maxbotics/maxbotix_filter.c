@@ -0,0 +1,49 @@
+/* Median filter for the Maxbotix samples, see maxbotix_get_median */
+
+// Split from maxbotics.c, which needs the UART, so the benchmarks can run
+// the same code on the host.
+
+#include <inttypes.h>
+#include "esp_log.h"
+
+#include "maxbotics.h"
+
+static const char *TAG = "maxFilter";
+
+float maxbotix_trimmed_mean(uint16_t *sel, int16_t count, float pct)
+{
+    /* Perform insertion sort on array */
+    for(int i = 1; i < count;i++)
+    {
+        uint16_t key = sel[i];
+        int j = i - 1;
+
+        /* Move elements of arr[0..i-1], that are
+         * greater than key, to one position ahead
+         * of their current position */
+        while (j >= 0 && sel[j] > key)
+        {
+            sel[j + 1] = sel[j];
+            j = j - 1;
+        }
+        sel[j + 1] = key;
+    }
+
+
+    ESP_LOGD(TAG,"Sample buffer from sorting samples");
+
+    /* Take the mean of the middle region, based on pct */
+    int32_t pct_samples = count * pct;
+    ESP_LOGD(TAG,"Samples to be included in percentage filter: %"PRId32" (of %d total)",pct_samples,(int)count);
+    pct_samples = (pct_samples + 1) >> 1;
+    float mean = 0;
+    for(int i = pct_samples; i < (count - pct_samples); i++)
+    {
+        mean += (float)sel[i];
+    }
+    mean = mean / (float)(count - pct_samples - pct_samples);
+
+    ESP_LOGD(TAG,"Actual mean calculated as %f",(double)mean);
+
+    return mean;
+}
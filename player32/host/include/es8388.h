@@ -0,0 +1,19 @@
+// es8388 stand-in: the DAC side is the virtual I2S sink in sim_i2s.c, the
+// ADC side the virtual mic there
+
+#ifndef SIM_ES8388_H
+#define SIM_ES8388_H
+
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#define ES8388_OUT_STEP_DB  1.5f
+
+esp_err_t es8388_write(const void *buffer, size_t bytes_to_write, size_t *bytes_written);
+esp_err_t es8388_read(void *buffer, size_t bytes_to_read, size_t *bytes_read, TickType_t ticks_to_wait);
+esp_err_t es8388_set_volume(int volume);
+esp_err_t es8388_set_volume_offset(float db);
+float es8388_get_output_db(void);
+
+#endif // SIM_ES8388_H
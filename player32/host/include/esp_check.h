@@ -0,0 +1,6 @@
+#ifndef SIM_ESP_CHECK_H
+#define SIM_ESP_CHECK_H
+
+#include "esp_err.h"
+
+#endif // SIM_ESP_CHECK_H
@@ -0,0 +1,6 @@
+#ifndef SIM_ESP_TASK_WDT_H
+#define SIM_ESP_TASK_WDT_H
+
+// No watchdog on the virtual clock
+
+#endif // SIM_ESP_TASK_WDT_H
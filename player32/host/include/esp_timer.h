@@ -0,0 +1,12 @@
+#ifndef SIM_ESP_TIMER_H
+#define SIM_ESP_TIMER_H
+
+#include <stdint.h>
+#include "sim.h"
+
+// Virtual time, see sim.h
+static inline int64_t esp_timer_get_time(void) {
+    return sim_now_us();
+}
+
+#endif // SIM_ESP_TIMER_H
@@ -0,0 +1,6 @@
+#ifndef SIM_QUEUE_H
+#define SIM_QUEUE_H
+
+#include "freertos/FreeRTOS.h"
+
+#endif // SIM_QUEUE_H
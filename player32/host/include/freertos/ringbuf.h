@@ -0,0 +1,32 @@
+// Byte buffer subset of the ESP-IDF ring buffer
+
+#ifndef SIM_RINGBUF_H
+#define SIM_RINGBUF_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef enum {
+    RINGBUF_TYPE_NOSPLIT = 0,
+    RINGBUF_TYPE_ALLOWSPLIT,
+    RINGBUF_TYPE_BYTEBUF,
+} RingbufferType_t;
+
+typedef struct sim_ringbuf *RingbufHandle_t;
+
+// Control block storage handed in by callers of xRingbufferCreateStatic;
+// the simulator keeps its own state and only uses the data storage
+typedef struct {
+    uint8_t opaque[64];
+} StaticRingbuffer_t;
+
+RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t type);
+RingbufHandle_t xRingbufferCreateStatic(size_t size, RingbufferType_t type,
+                                        uint8_t *storage, StaticRingbuffer_t *control);
+void vRingbufferDelete(RingbufHandle_t rb);
+BaseType_t xRingbufferSend(RingbufHandle_t rb, const void *data, size_t size, TickType_t ticks);
+void *xRingbufferReceive(RingbufHandle_t rb, size_t *size, TickType_t ticks);
+void *xRingbufferReceiveUpTo(RingbufHandle_t rb, size_t *size, TickType_t ticks, size_t max_size);
+void vRingbufferReturnItem(RingbufHandle_t rb, void *item);
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t rb);
+
+#endif // SIM_RINGBUF_H
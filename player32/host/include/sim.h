@@ -0,0 +1,135 @@
+// Host simulator for the player32 audio engine
+//
+// LOUDFRAME project. The engine sources (wav_reader, tone_reader,
+// es8388_player, b_ringbuf) build unchanged against the headers in this
+// directory. Tasks run as threads, but only one at a time and on a
+// virtual clock: time only moves when every task is blocked, so a run
+// with the same inputs and seed is exactly reproducible.
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Virtual clock and scheduler
+//
+
+// Current virtual time in microseconds
+int64_t sim_now_us(void);
+
+// Block the calling task until the given virtual time
+void sim_sleep_until(int64_t wake_us);
+
+// Run the tasks created so far until end_us of virtual time, or until
+// every task is blocked forever. Returns the virtual time reached.
+int64_t sim_run(int64_t end_us);
+
+// Stop the run from inside a task; the calling task does not return
+void sim_stop(void);
+
+// Print one line per task to the given stream
+void sim_dump_tasks(FILE *out);
+
+//
+// Virtual SD card. Reads are served from a host directory standing in for
+// /sdcard. Each read occupies the card for a latency drawn from the
+// configured distribution plus the transfer time, and reads queue behind
+// each other like on the real bus.
+//
+
+typedef enum {
+    SIM_DIST_FIXED,         // a
+    SIM_DIST_UNIFORM,       // a..b
+    SIM_DIST_NORMAL,        // mean a, stddev b
+    SIM_DIST_LOGNORMAL,     // median a, sigma b (of the underlying normal)
+} sim_dist_kind_t;
+
+typedef struct {
+    sim_dist_kind_t kind;
+    double a;
+    double b;
+} sim_dist_t;
+
+#define SIM_SD_MAX_STALLS   16
+
+typedef struct {
+    const char *root;           // host directory mapped to /sdcard
+    sim_dist_t latency;         // per read access latency, us
+    double mbps;                // transfer rate, megabytes per second
+    double spike_prob;          // chance per read of an extra spike
+    double spike_us;
+    int n_stalls;
+    struct {
+        int64_t at_us;          // card is unavailable from here...
+        int64_t len_us;         // ...for this long
+    } stalls[SIM_SD_MAX_STALLS];
+} sim_sd_config_t;
+
+typedef struct {
+    uint32_t reads;
+    uint64_t bytes;
+    uint32_t spikes;
+    double mean_us;
+    double p50_us;
+    double p99_us;
+    double max_us;
+} sim_sd_stats_t;
+
+void sim_sd_configure(const sim_sd_config_t *cfg);
+void sim_sd_get_stats(sim_sd_stats_t *stats);
+
+// Parses "fixed:US", "uniform:MIN:MAX", "normal:MEAN:SD" or
+// "lognormal:MEDIAN:SIGMA". Returns false on a malformed spec.
+bool sim_dist_parse(const char *spec, sim_dist_t *dist);
+
+// Deterministic random numbers shared by all stand-ins
+void sim_rand_seed(uint64_t seed);
+double sim_rand_uniform(void);
+double sim_dist_sample(const sim_dist_t *dist);
+
+//
+// Virtual I2S sink. Mirrors the es8388 TX channel (6 DMA descriptors of
+// 240 frames, 16 bit stereo) and consumes exactly sample_rate frames per
+// second of virtual time from the first write on. Whatever isn't there
+// when the DMA needs it is played as silence and counted as an underrun.
+//
+
+#define SIM_I2S_MAX_EVENTS  32
+
+typedef struct {
+    uint64_t frames_played;
+    uint64_t frames_silent;     // played as silence while starved
+    uint32_t underruns;         // transitions into starvation
+    uint32_t min_fill;          // lowest DMA fill seen after start, frames
+    uint32_t n_events;
+    struct {
+        int64_t at_us;
+        uint32_t frames;
+    } events[SIM_I2S_MAX_EVENTS];   // first underruns, for the report
+    uint64_t mic_frames_read;
+    uint64_t mic_frames_lost;   // overwritten in the RX DMA before es8388_read got to them
+} sim_i2s_stats_t;
+
+void sim_i2s_configure(uint32_t sample_rate, const char *tap_path);
+
+// Turns on the RX side for es8388_read. The mic hears the first channel of
+// wav_path (16 bit PCM, looped; NULL for silence) plus, unless echo_db is
+// -200 or less, what the DAC played, through the output gain and then
+// echo_db. Call after sim_i2s_configure. False if the file won't do.
+bool sim_i2s_mic_configure(const char *wav_path, double echo_db);
+void sim_i2s_finish(void);
+void sim_i2s_get_stats(sim_i2s_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIM_H
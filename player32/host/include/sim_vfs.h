@@ -0,0 +1,19 @@
+// Force-included into the engine sources so their file access goes to the
+// virtual SD card (sim_sd.c) instead of the host file system
+
+#ifndef SIM_VFS_H
+#define SIM_VFS_H
+
+#include <sys/types.h>
+
+int sim_sd_open(const char *path, int flags, ...);
+ssize_t sim_sd_read(int fd, void *buf, size_t len);
+off_t sim_sd_lseek(int fd, off_t offset, int whence);
+int sim_sd_close(int fd);
+
+#define open    sim_sd_open
+#define read    sim_sd_read
+#define lseek   sim_sd_lseek
+#define close   sim_sd_close
+
+#endif // SIM_VFS_H
@@ -0,0 +1,343 @@
+// player32_adpcm: 16 bit PCM WAV to IMA ADPCM WAV, and back
+//
+// Encodes with the same block code wav_reader decodes with, decodes the
+// result again and reports the round trip's signal to noise ratio and what
+// the file costs in card bandwidth against the PCM original. --decode turns
+// an ADPCM file back into PCM for listening.
+
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ima_adpcm.h"
+
+typedef struct {
+    uint16_t format;
+    uint16_t channels;
+    uint32_t rate;
+    uint16_t block_align;
+    uint16_t bits;
+    uint16_t samples_per_block;
+    uint8_t *data;
+    uint32_t data_len;
+} wav_t;
+
+static void usage(FILE *out) {
+    fprintf(out,
+        "usage: player32_adpcm [options] IN.wav OUT.wav\n"
+        "\n"
+        "Encodes 16 bit PCM IN.wav as IMA ADPCM, which wav_reader plays at a quarter of\n"
+        "the card bandwidth, and prints the round trip's SNR.\n"
+        "\n"
+        "  --block N             block size in bytes (default 1024 per channel)\n"
+        "  --decode              IN.wav is IMA ADPCM, write it back out as 16 bit PCM\n");
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+// The whole file in memory; wav->data points into the returned buffer
+static uint8_t *read_wav(const char *path, wav_t *wav) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "can't open %s\n", path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(len);
+    if (buf == NULL || fread(buf, 1, len, f) != (size_t)len) {
+        fprintf(stderr, "can't read %s\n", path);
+        fclose(f);
+        free(buf);
+        return NULL;
+    }
+    fclose(f);
+
+    memset(wav, 0, sizeof(*wav));
+    if (len < 12 || memcmp(buf, "RIFF", 4) != 0 || memcmp(buf + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "%s is not a WAV file\n", path);
+        free(buf);
+        return NULL;
+    }
+    bool fmt = false;
+    for (long off = 12; off + 8 <= len; ) {
+        uint32_t size = get32(buf + off + 4);
+        const uint8_t *body = buf + off + 8;
+        if (off + 8 + (long)size > len) {
+            size = len - off - 8;
+        }
+        if (memcmp(buf + off, "fmt ", 4) == 0 && size >= 16) {
+            wav->format = get16(body);
+            wav->channels = get16(body + 2);
+            wav->rate = get32(body + 4);
+            wav->block_align = get16(body + 12);
+            wav->bits = get16(body + 14);
+            if (size >= 20) {
+                wav->samples_per_block = get16(body + 18);
+            }
+            fmt = true;
+        } else if (memcmp(buf + off, "data", 4) == 0) {
+            wav->data = buf + off + 8;
+            wav->data_len = size;
+        }
+        off += 8 + size + (size & 1);
+    }
+    if (!fmt || wav->data == NULL) {
+        fprintf(stderr, "%s has no fmt or data chunk\n", path);
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+static bool write_header(FILE *f, const wav_t *wav, uint32_t frames) {
+    bool adpcm = wav->format == IMA_ADPCM_WAV_FORMAT;
+    uint32_t fmt_len = adpcm ? 20 : 16;
+    uint32_t fact_len = adpcm ? 12 : 0;
+    uint8_t h[12 + 8 + 20 + 12 + 8];
+    uint8_t *p = h;
+    memcpy(p, "RIFF", 4);
+    put32(p + 4, 4 + 8 + fmt_len + fact_len + 8 + wav->data_len + (wav->data_len & 1));
+    memcpy(p + 8, "WAVE", 4);
+    p += 12;
+    memcpy(p, "fmt ", 4);
+    put32(p + 4, fmt_len);
+    put16(p + 8, wav->format);
+    put16(p + 10, wav->channels);
+    put32(p + 12, wav->rate);
+    put32(p + 16, adpcm ? (uint32_t)((uint64_t)wav->rate * wav->block_align / wav->samples_per_block)
+                        : wav->rate * wav->block_align);
+    put16(p + 20, wav->block_align);
+    put16(p + 22, wav->bits);
+    if (adpcm) {
+        put16(p + 24, 2);
+        put16(p + 26, wav->samples_per_block);
+    }
+    p += 8 + fmt_len;
+    if (adpcm) {
+        // frame count: the last block is rounded up to 8 frames
+        memcpy(p, "fact", 4);
+        put32(p + 4, 4);
+        put32(p + 8, frames);
+        p += 12;
+    }
+    memcpy(p, "data", 4);
+    put32(p + 4, wav->data_len);
+    p += 8;
+    return fwrite(h, 1, p - h, f) == (size_t)(p - h);
+}
+
+static bool write_wav(const char *path, const wav_t *wav, uint32_t frames) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "can't write %s\n", path);
+        return false;
+    }
+    bool ok = write_header(f, wav, frames) && fwrite(wav->data, 1, wav->data_len, f) == wav->data_len;
+    if (ok && (wav->data_len & 1)) {
+        ok = fputc(0, f) != EOF;
+    }
+    if (fclose(f) != 0 || !ok) {
+        fprintf(stderr, "error writing %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Decodes every block of an ADPCM wav into pcm, returns the frame count
+static size_t decode_all(const wav_t *in, int16_t *pcm) {
+    size_t frames = 0;
+    for (uint32_t off = 0; off < in->data_len; off += in->block_align) {
+        size_t len = in->data_len - off < in->block_align ? in->data_len - off : in->block_align;
+        size_t n = 0;
+        if (ima_adpcm_decode_block(in->data + off, len, in->channels, pcm + frames * in->channels, &n) != ESP_OK) {
+            fprintf(stderr, "bad block at data offset %u, stopping\n", (unsigned)off);
+            break;
+        }
+        frames += n;
+    }
+    return frames;
+}
+
+static int decode(const char *in_path, const char *out_path) {
+    wav_t in;
+    uint8_t *file = read_wav(in_path, &in);
+    if (file == NULL) {
+        return 1;
+    }
+    if (in.format != IMA_ADPCM_WAV_FORMAT || in.channels < 1 || in.channels > IMA_ADPCM_MAX_CHANNELS) {
+        fprintf(stderr, "%s is not mono or stereo IMA ADPCM\n", in_path);
+        free(file);
+        return 1;
+    }
+    size_t max_frames = (size_t)(in.data_len / in.block_align + 1) * in.samples_per_block;
+    int16_t *pcm = malloc(max_frames * in.channels * sizeof(int16_t));
+    if (pcm == NULL) {
+        free(file);
+        return 1;
+    }
+    size_t frames = decode_all(&in, pcm);
+    wav_t out = {
+        .format = 1, .channels = in.channels, .rate = in.rate, .bits = 16,
+        .block_align = in.channels * 2,
+        .data = (uint8_t *)pcm, .data_len = frames * in.channels * 2,
+    };
+    bool ok = write_wav(out_path, &out, frames);
+    printf("%s: %zu frames, %.2f s\n", out_path, frames, (double)frames / in.rate);
+    free(pcm);
+    free(file);
+    return ok ? 0 : 1;
+}
+
+static int encode(const char *in_path, const char *out_path, unsigned block) {
+    int ret = 1;
+    int16_t *pad = NULL;
+    uint8_t *adpcm = NULL;
+    int16_t *check = NULL;
+    wav_t in;
+    uint8_t *file = read_wav(in_path, &in);
+    if (file == NULL) {
+        return 1;
+    }
+    if (in.format != 1 || in.bits != 16 || in.channels < 1 || in.channels > IMA_ADPCM_MAX_CHANNELS) {
+        fprintf(stderr, "%s is not mono or stereo 16 bit PCM\n", in_path);
+        goto cleanup;
+    }
+
+    int ch = in.channels;
+    if (block == 0) {
+        block = 1024 * ch;
+    }
+    size_t spb = ima_adpcm_block_frames(block, ch);
+    if (spb == 0 || block > 0xffff) {
+        fprintf(stderr, "--block %u: needs %d bytes of header plus a multiple of %d\n", block, 4 * ch, 4 * ch);
+        goto cleanup;
+    }
+
+    const int16_t *pcm = (const int16_t *)in.data;
+    size_t frames = in.data_len / (2 * ch);
+    size_t blocks = (frames + spb - 1) / spb;
+    adpcm = malloc(blocks * block);
+    pad = malloc(spb * ch * sizeof(int16_t));
+    check = malloc(blocks * spb * ch * sizeof(int16_t));
+    if (adpcm == NULL || pad == NULL || check == NULL) {
+        fprintf(stderr, "out of memory\n");
+        goto cleanup;
+    }
+
+    // The last block holds what is left, rounded up to whole groups of 8
+    // frames and padded by repeating the last frame
+    ima_adpcm_state_t state[IMA_ADPCM_MAX_CHANNELS] = { 0 };
+    size_t out_len = 0;
+    for (size_t f = 0; f < frames; f += spb) {
+        size_t n = frames - f < spb ? frames - f : spb;
+        size_t len = block;
+        const int16_t *src = pcm + f * ch;
+        if (n < spb) {
+            size_t groups = (n - 1 + 7) / 8;
+            len = 4 * ch + groups * 4 * ch;
+            size_t padded = ima_adpcm_block_frames(len, ch);
+            memcpy(pad, src, n * ch * sizeof(int16_t));
+            for (size_t i = n; i < padded; i++) {
+                memcpy(pad + i * ch, src + (n - 1) * ch, ch * sizeof(int16_t));
+            }
+            src = pad;
+        }
+        if (ima_adpcm_encode_block(src, ch, state, adpcm + out_len, len) != ESP_OK) {
+            fprintf(stderr, "encode failed at frame %zu\n", f);
+            goto cleanup;
+        }
+        out_len += len;
+    }
+
+    wav_t out = {
+        .format = IMA_ADPCM_WAV_FORMAT, .channels = ch, .rate = in.rate, .bits = 4,
+        .block_align = block, .samples_per_block = spb,
+        .data = adpcm, .data_len = out_len,
+    };
+    if (!write_wav(out_path, &out, frames)) {
+        goto cleanup;
+    }
+
+    // Round trip, the way the board will hear it
+    decode_all(&out, check);
+    double signal = 0, noise = 0;
+    for (size_t i = 0; i < frames * ch; i++) {
+        double d = (double)check[i] - pcm[i];
+        signal += (double)pcm[i] * pcm[i];
+        noise += d * d;
+    }
+    double pcm_rate = (double)in.rate * ch * 2;
+    double adpcm_rate = (double)in.rate * block / spb;
+    printf("in   %s: %u Hz, %d channel%s, %.2f s, %.0f bytes/s\n", in_path, (unsigned)in.rate, ch,
+           ch > 1 ? "s" : "", (double)frames / in.rate, pcm_rate);
+    printf("out  %s: %u byte blocks of %zu frames, %.0f bytes/s, %.2fx less\n", out_path, block, spb,
+           adpcm_rate, pcm_rate / adpcm_rate);
+    if (noise > 0) {
+        printf("snr  %.1f dB\n", 10 * log10(signal / noise));
+    } else {
+        printf("snr  lossless\n");
+    }
+    ret = 0;
+
+cleanup:
+    free(check);
+    free(pad);
+    free(adpcm);
+    free(file);
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    static const struct option longopts[] = {
+        { "block",    required_argument, 0, 'b' },
+        { "decode",   no_argument,       0, 'd' },
+        { "help",     no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+    unsigned block = 0;
+    bool decode_mode = false;
+    int c;
+    while ((c = getopt_long(argc, argv, "h", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'b':
+                block = strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                decode_mode = true;
+                break;
+            case 'h':
+                usage(stdout);
+                return 0;
+            default:
+                usage(stderr);
+                return 2;
+        }
+    }
+    if (optind != argc - 2) {
+        usage(stderr);
+        return 2;
+    }
+    return decode_mode ? decode(argv[optind], argv[optind + 1]) : encode(argv[optind], argv[optind + 1], block);
+}
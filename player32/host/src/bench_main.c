@@ -0,0 +1,258 @@
+// player32_bench: the kernel micro-benchmarks on the host
+//
+// Runs the kernels in components/bench (the list bench_task runs on the
+// board) on the calling thread, outside the virtual clock: nothing in them
+// blocks, and the stand-ins only serialise on a mutex. Prints a table and
+// optionally writes the results as JSON, for comparing two builds.
+//
+// --streams runs the ring buffer shoot-out instead. Its producer and
+// consumer block on each other, so they run as tasks on the virtual clock:
+// pacing and blocking are in virtual time, CPU is each thread's real CPU.
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "bench.h"
+#include "sim.h"
+
+typedef struct {
+    const char *filter[16];
+    int n_filter;
+    const char *json;
+    bench_config_t cfg;
+    int cpu;                    // -1 to leave the affinity alone
+    bool list;
+    bool streams;
+} bench_options_t;
+
+static void usage(FILE *out) {
+    fprintf(out,
+        "usage: player32_bench [options] [KERNEL...]\n"
+        "       player32_bench --streams [options] [SCENARIO/BUFFER...]\n"
+        "\n"
+        "Times every kernel whose name contains one of the KERNEL arguments (all without).\n"
+        "With --streams, runs the ring buffer shoot-out scenarios instead.\n"
+        "\n"
+        "  --reps N              timed repetitions per kernel (default 15)\n"
+        "  --min-ms N            length of one repetition (default 20)\n"
+        "  --cpu N               pin to this CPU, for steadier numbers (default 0, -1 for none)\n"
+        "  --json FILE           write the results as JSON\n"
+        "  --input DIR           where kernels find their input files, like bench.mp3 (default .)\n"
+        "  --streams             ring buffer shoot-out: producer and consumer tasks\n"
+        "  --list                list the kernels (or scenarios) and exit\n");
+}
+
+static bool parse_args(int argc, char **argv, bench_options_t *opt) {
+    static const struct option longopts[] = {
+        { "reps",     required_argument, 0, 'r' },
+        { "min-ms",   required_argument, 0, 'm' },
+        { "cpu",      required_argument, 0, 'c' },
+        { "json",     required_argument, 0, 'j' },
+        { "input",    required_argument, 0, 'i' },
+        { "list",     no_argument,       0, 'l' },
+        { "streams",  no_argument,       0, 's' },
+        { "help",     no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "h", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'r':
+                opt->cfg.reps = strtoul(optarg, NULL, 0);
+                if (opt->cfg.reps == 0) {
+                    fprintf(stderr, "bad repetition count: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'm':
+                opt->cfg.min_rep_us = (uint32_t)(atof(optarg) * 1000);
+                break;
+            case 'c':
+                opt->cpu = atoi(optarg);
+                break;
+            case 'j':
+                opt->json = optarg;
+                break;
+            case 'i':
+                bench_input_dir = optarg;
+                break;
+            case 'l':
+                opt->list = true;
+                break;
+            case 's':
+                opt->streams = true;
+                break;
+            case 'h':
+                usage(stdout);
+                exit(0);
+            default:
+                return false;
+        }
+    }
+    for (int i = optind; i < argc; i++) {
+        if (opt->n_filter == (int)(sizeof(opt->filter) / sizeof(opt->filter[0]))) {
+            fprintf(stderr, "too many kernel names\n");
+            return false;
+        }
+        opt->filter[opt->n_filter++] = argv[i];
+    }
+    return true;
+}
+
+static bool selected(const bench_options_t *opt, const char *name) {
+    if (opt->n_filter == 0) {
+        return true;
+    }
+    for (int i = 0; i < opt->n_filter; i++) {
+        if (strstr(name, opt->filter[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void write_json_head(FILE *json, const bench_options_t *opt) {
+    const char *source = bench_cycle_source();
+    fprintf(json, "{\n  \"cycle_source\": %s%s%s,\n  \"reps\": %u,\n  \"min_rep_ms\": %.1f,\n  \"%s\": [",
+            source ? "\"" : "", source ? source : "null", source ? "\"" : "",
+            (unsigned)opt->cfg.reps, opt->cfg.min_rep_us / 1000.0, opt->streams ? "streams" : "kernels");
+}
+
+static int run_kernels(const bench_options_t *opt, FILE *json) {
+    int failed = 0, n = 0;
+    bench_table_header(stdout);
+    for (int i = 0; bench_kernels[i]; i++) {
+        const bench_kernel_t *k = bench_kernels[i];
+        if (!selected(opt, k->name)) {
+            continue;
+        }
+        bench_result_t r;
+        esp_err_t err = bench_run(k, &opt->cfg, &r);
+        if (err == ESP_ERR_NOT_FOUND) {
+            printf("%-32s skipped, no input file in %s\n", k->name, bench_input_dir);
+            continue;
+        }
+        if (err != ESP_OK) {
+            printf("%-32s setup failed\n", k->name);
+            failed++;
+            continue;
+        }
+        bench_result_write_row(stdout, k, &r);
+        fflush(stdout);
+        if (json) {
+            fprintf(json, "%s\n    ", n ? "," : "");
+            bench_result_write_json(json, k, &r);
+        }
+        n++;
+    }
+    return failed;
+}
+
+//
+// Ring buffer shoot-out
+//
+
+typedef struct {
+    const bench_options_t *opt;
+    FILE *json;
+    int failed;
+} streams_run_t;
+
+static void streams_task(void *arg) {
+    streams_run_t *run = arg;
+    int n = 0;
+    bench_stream_table_header(stdout);
+    for (int s = 0; bench_stream_scenarios[s].name; s++) {
+        const bench_stream_scenario_t *sc = &bench_stream_scenarios[s];
+        for (int i = 0; bench_stream_impls[i]; i++) {
+            char name[64];
+            snprintf(name, sizeof(name), "%s/%s", sc->name, bench_stream_impls[i]);
+            if (!selected(run->opt, name)) {
+                continue;
+            }
+            bench_stream_result_t r;
+            if (bench_stream_run(bench_stream_impls[i], sc, &r) != ESP_OK) {
+                printf("%-29s failed\n", name);
+                run->failed++;
+                continue;
+            }
+            bench_stream_write_row(stdout, bench_stream_impls[i], sc, &r);
+            fflush(stdout);
+            if (run->json) {
+                fprintf(run->json, "%s\n    ", n ? "," : "");
+                bench_stream_write_json(run->json, bench_stream_impls[i], sc, &r);
+            }
+            n++;
+        }
+    }
+    sim_stop();
+}
+
+static int run_streams(const bench_options_t *opt, FILE *json) {
+    streams_run_t run = { .opt = opt, .json = json };
+    xTaskCreatePinnedToCore(streams_task, "bench_streams", 4096, &run, 1, NULL, 1);
+    sim_run(INT64_MAX);
+    return run.failed;
+}
+
+int main(int argc, char **argv) {
+    bench_options_t opt = {
+        .cfg = BENCH_CONFIG_DEFAULT(),
+        .cpu = 0,
+    };
+    if (!parse_args(argc, argv, &opt)) {
+        usage(stderr);
+        return 2;
+    }
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    if (opt.list) {
+        if (opt.streams) {
+            for (int s = 0; bench_stream_scenarios[s].name; s++) {
+                for (int i = 0; bench_stream_impls[i]; i++) {
+                    printf("%s/%s\n", bench_stream_scenarios[s].name, bench_stream_impls[i]);
+                }
+            }
+            return 0;
+        }
+        for (int i = 0; bench_kernels[i]; i++) {
+            printf("%-32s %s\n", bench_kernels[i]->name, bench_kernels[i]->op);
+        }
+        return 0;
+    }
+
+    if (opt.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(opt.cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            fprintf(stderr, "can't pin to CPU %d, running unpinned\n", opt.cpu);
+        }
+    }
+
+    FILE *json = NULL;
+    if (opt.json) {
+        json = fopen(opt.json, "w");
+        if (json == NULL) {
+            fprintf(stderr, "can't write %s\n", opt.json);
+            return 2;
+        }
+        write_json_head(json, &opt);
+    }
+
+    int failed = opt.streams ? run_streams(&opt, json) : run_kernels(&opt, json);
+
+    if (json) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+    return failed ? 1 : 0;
+}
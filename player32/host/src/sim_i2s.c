@@ -0,0 +1,420 @@
+// Virtual I2S sink standing in for the es8388 TX channel
+//
+// The DMA ring holds the same 6 x 240 frames as the real channel config in
+// components/es8388. Playback is clocked off virtual time: by time t,
+// exactly floor(t * rate) frames have left the DMA since the first write.
+// Frames that weren't there when due are played as silence (auto_clear on
+// the device) and counted. Writes block while the ring is full, freeing a
+// descriptor at a time like i2s_channel_write.
+//
+// The RX channel is a virtual mic on the same clock, mono, from the first
+// read on: a descriptor of 240 frames at a time becomes readable, and one
+// not read before six more have filled is lost. What it hears is a WAV file,
+// looped, plus optionally what the DAC played at that moment, scaled by the
+// output gain and a coupling, as the speaker would reach the mic.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "es8388.h"
+#include "sim.h"
+#include "sim_internal.h"
+
+static const char *TAG = "SIM_I2S";
+
+#define DMA_DESC_NUM        6
+#define DMA_FRAME_NUM       240
+#define DMA_FRAMES          (DMA_DESC_NUM * DMA_FRAME_NUM)
+#define FRAME_BYTES         4           // 16 bit stereo
+
+static uint32_t s_rate = 44100;
+static FILE *s_tap = NULL;
+
+static int16_t s_dma[DMA_FRAMES * 2];
+static uint32_t s_read = 0;             // frame index into s_dma
+static uint32_t s_fill = 0;             // frames queued
+static uint8_t s_partial[FRAME_BYTES];  // a write that ended mid frame
+static size_t s_partial_len = 0;
+
+static bool s_started = false;
+static int64_t s_start_us = 0;
+static uint64_t s_consumed = 0;         // frames the DMA has taken so far
+static bool s_starved = false;
+static sim_i2s_stats_t s_stats;
+
+// The output stage as es8388_set_volume leaves it, 0x1E (0 dB) from es8388_init
+static int s_requested_volume = -1;
+static int s_offset_steps = 0;
+static int s_output_reg = 0x1E;
+
+// What the DAC played, mono, for the mic's echo
+#define ECHO_HISTORY        8192
+static int16_t s_history[ECHO_HISTORY];
+static uint64_t s_history_n = 0;        // frames played, silence included
+
+static bool s_mic_on = false;
+static int16_t *s_mic = NULL;           // NULL for a silent room
+static uint32_t s_mic_len = 0;
+static float s_echo = 0;                // linear, 0 for none
+static bool s_mic_started = false;
+static int64_t s_mic_start_us = 0;
+static uint64_t s_mic_taken = 0;        // frames handed to es8388_read so far
+
+static uint64_t frames_due(int64_t now_us) {
+    return (uint64_t)(now_us - s_start_us) * s_rate / 1000000;
+}
+
+static int64_t time_of_frame(uint64_t frame) {
+    // First virtual microsecond at which frame has been consumed
+    return s_start_us + (int64_t)((frame * 1000000 + s_rate - 1) / s_rate);
+}
+
+static void tap_frames(const int16_t *frames, uint32_t n) {
+    if (s_tap) {
+        fwrite(frames, FRAME_BYTES, n, s_tap);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        s_history[s_history_n++ % ECHO_HISTORY] = (int16_t)(((int32_t)frames[2 * i] + frames[2 * i + 1]) >> 1);
+    }
+}
+
+// Advances playback to now, with sim_lock held
+static void consume(int64_t now_us) {
+    if (!s_started) {
+        return;
+    }
+    uint64_t due = frames_due(now_us);
+    uint64_t n = due - s_consumed;
+    if (n == 0) {
+        return;
+    }
+    s_consumed = due;
+
+    uint32_t from_dma = n < s_fill ? (uint32_t)n : s_fill;
+    uint32_t left = from_dma;
+    while (left) {
+        uint32_t chunk = DMA_FRAMES - s_read;
+        if (chunk > left) {
+            chunk = left;
+        }
+        tap_frames(&s_dma[s_read * 2], chunk);
+        s_read = (s_read + chunk) % DMA_FRAMES;
+        left -= chunk;
+    }
+    s_fill -= from_dma;
+    s_stats.frames_played += n;
+
+    uint64_t silent = n - from_dma;
+    if (silent) {
+        static const int16_t zeros[DMA_FRAME_NUM * 2];
+        for (uint64_t left_silent = silent; left_silent; ) {
+            uint32_t chunk = left_silent > DMA_FRAME_NUM ? DMA_FRAME_NUM : (uint32_t)left_silent;
+            tap_frames(zeros, chunk);
+            left_silent -= chunk;
+        }
+        s_stats.frames_silent += silent;
+        if (!s_starved) {
+            s_starved = true;
+            s_stats.underruns++;
+            if (s_stats.n_events < SIM_I2S_MAX_EVENTS) {
+                s_stats.events[s_stats.n_events].at_us = time_of_frame(due - silent);
+                s_stats.events[s_stats.n_events].frames = 0;
+                s_stats.n_events++;
+            }
+            ESP_LOGW(TAG, "underrun from %.3f ms", time_of_frame(due - silent) / 1000.0);
+        }
+        if (s_stats.n_events > 0 && s_stats.n_events <= SIM_I2S_MAX_EVENTS &&
+            s_stats.underruns == s_stats.n_events) {
+            s_stats.events[s_stats.n_events - 1].frames += (uint32_t)silent;
+        }
+    } else if (s_fill > 0) {
+        s_starved = false;
+    }
+    if (s_fill < s_stats.min_fill) {
+        s_stats.min_fill = s_fill;
+    }
+}
+
+void sim_i2s_configure(uint32_t sample_rate, const char *tap_path) {
+    s_rate = sample_rate;
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_stats.min_fill = DMA_FRAMES;
+    if (tap_path) {
+        s_tap = fopen(tap_path, "wb");
+        if (s_tap == NULL) {
+            ESP_LOGE(TAG, "can't open tap %s", tap_path);
+            return;
+        }
+        // Header is rewritten with the real sizes in sim_i2s_finish
+        uint8_t header[44] = {0};
+        fwrite(header, 1, sizeof(header), s_tap);
+    }
+}
+
+static void put_le(uint8_t *p, uint32_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+void sim_i2s_finish(void) {
+    pthread_mutex_lock(&sim_lock);
+    consume(sim_now_us());
+    pthread_mutex_unlock(&sim_lock);
+    if (s_tap == NULL) {
+        return;
+    }
+    uint32_t data_bytes = (uint32_t)(s_stats.frames_played * FRAME_BYTES);
+    uint8_t h[44];
+    memcpy(h, "RIFF", 4);
+    put_le(h + 4, 36 + data_bytes, 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_le(h + 16, 16, 4);
+    put_le(h + 20, 1, 2);                       // PCM
+    put_le(h + 22, 2, 2);
+    put_le(h + 24, s_rate, 4);
+    put_le(h + 28, s_rate * FRAME_BYTES, 4);
+    put_le(h + 32, FRAME_BYTES, 2);
+    put_le(h + 34, 16, 2);
+    memcpy(h + 36, "data", 4);
+    put_le(h + 40, data_bytes, 4);
+    fseek(s_tap, 0, SEEK_SET);
+    fwrite(h, 1, sizeof(h), s_tap);
+    fclose(s_tap);
+    s_tap = NULL;
+}
+
+void sim_i2s_get_stats(sim_i2s_stats_t *stats) {
+    pthread_mutex_lock(&sim_lock);
+    *stats = s_stats;
+    pthread_mutex_unlock(&sim_lock);
+}
+
+esp_err_t es8388_write(const void *buffer, size_t bytes_to_write, size_t *bytes_written) {
+    const uint8_t *src = buffer;
+    size_t done = 0;
+
+    pthread_mutex_lock(&sim_lock);
+    if (!s_started) {
+        s_started = true;
+        s_start_us = sim_now_us();
+    }
+
+    // Finish a frame split across calls first
+    while (s_partial_len > 0 && done < bytes_to_write) {
+        s_partial[s_partial_len++] = src[done++];
+        if (s_partial_len == FRAME_BYTES) {
+            consume(sim_now_us());
+            while (s_fill == DMA_FRAMES) {
+                sim_wait_locked(NULL, time_of_frame(s_consumed + DMA_FRAME_NUM));
+                consume(sim_now_us());
+            }
+            memcpy(&s_dma[((s_read + s_fill) % DMA_FRAMES) * 2], s_partial, FRAME_BYTES);
+            s_fill++;
+            s_partial_len = 0;
+        }
+    }
+
+    while (bytes_to_write - done >= FRAME_BYTES) {
+        consume(sim_now_us());
+        if (s_fill == DMA_FRAMES) {
+            // Full: wait for the DMA to finish the descriptor it is on
+            sim_wait_locked(NULL, time_of_frame(s_consumed + DMA_FRAME_NUM));
+            continue;
+        }
+        uint32_t frames = (uint32_t)((bytes_to_write - done) / FRAME_BYTES);
+        uint32_t space = DMA_FRAMES - s_fill;
+        if (frames > space) {
+            frames = space;
+        }
+        while (frames) {
+            uint32_t pos = (s_read + s_fill) % DMA_FRAMES;
+            uint32_t chunk = DMA_FRAMES - pos;
+            if (chunk > frames) {
+                chunk = frames;
+            }
+            memcpy(&s_dma[pos * 2], src + done, chunk * FRAME_BYTES);
+            s_fill += chunk;
+            done += chunk * FRAME_BYTES;
+            frames -= chunk;
+        }
+    }
+
+    size_t rest = bytes_to_write - done;
+    memcpy(s_partial + s_partial_len, src + done, rest);
+    s_partial_len += rest;
+    done += rest;
+    pthread_mutex_unlock(&sim_lock);
+
+    *bytes_written = done;
+    return ESP_OK;
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+bool sim_i2s_mic_configure(const char *wav_path, double echo_db) {
+    s_mic_on = true;
+    s_echo = echo_db > -200 ? (float)pow(10.0, echo_db / 20.0) : 0;
+    if (wav_path == NULL) {
+        return true;
+    }
+    FILE *f = fopen(wav_path, "rb");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "can't open mic file %s", wav_path);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = len > 12 ? malloc(len) : NULL;
+    if (buf == NULL || fread(buf, 1, len, f) != (size_t)len || memcmp(buf, "RIFF", 4) || memcmp(buf + 8, "WAVE", 4)) {
+        ESP_LOGE(TAG, "%s isn't a WAV file", wav_path);
+        free(buf);
+        fclose(f);
+        return false;
+    }
+    fclose(f);
+
+    uint16_t format = 0, channels = 0, bits = 0;
+    uint32_t rate = 0;
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    for (long off = 12; off + 8 <= len; ) {
+        uint32_t size = get32(buf + off + 4);
+        if (memcmp(buf + off, "fmt ", 4) == 0 && size >= 16 && off + 8 + 16 <= len) {
+            format = get16(buf + off + 8);
+            channels = get16(buf + off + 10);
+            rate = get32(buf + off + 12);
+            bits = get16(buf + off + 22);
+        } else if (memcmp(buf + off, "data", 4) == 0) {
+            data = buf + off + 8;
+            data_len = size < (uint32_t)(len - off - 8) ? size : (uint32_t)(len - off - 8);
+            break;
+        }
+        off += 8 + size + (size & 1);
+    }
+    if (format != 1 || bits != 16 || channels == 0 || data == NULL || data_len < 2u * channels) {
+        ESP_LOGE(TAG, "mic file %s has to be 16 bit PCM", wav_path);
+        free(buf);
+        return false;
+    }
+    if (rate != s_rate) {
+        ESP_LOGW(TAG, "mic file %s is %u Hz, heard at %u Hz", wav_path, rate, s_rate);
+    }
+    // The first channel, like the left slot on the board
+    s_mic_len = data_len / (2 * channels);
+    s_mic = malloc(s_mic_len * sizeof(int16_t));
+    if (s_mic == NULL) {
+        free(buf);
+        return false;
+    }
+    for (uint32_t i = 0; i < s_mic_len; i++) {
+        s_mic[i] = (int16_t)get16(data + 2 * channels * i);
+    }
+    free(buf);
+    return true;
+}
+
+static uint64_t mic_ready(int64_t now_us) {
+    uint64_t due = (uint64_t)(now_us - s_mic_start_us) * s_rate / 1000000;
+    return due / DMA_FRAME_NUM * DMA_FRAME_NUM;
+}
+
+static int64_t time_of_mic_frames(uint64_t frames) {
+    // First virtual microsecond at which the descriptor holding frames is done
+    uint64_t full = (frames + DMA_FRAME_NUM - 1) / DMA_FRAME_NUM * DMA_FRAME_NUM;
+    return s_mic_start_us + (int64_t)((full * 1000000 + s_rate - 1) / s_rate);
+}
+
+// The mic at frame m, with sim_lock held and playback consumed up to now
+static int16_t mic_frame(uint64_t m, float echo_gain) {
+    float v = s_mic ? s_mic[m % s_mic_len] : 0;
+    if (echo_gain > 0 && s_started) {
+        int64_t at = s_mic_start_us + (int64_t)(m * 1000000 / s_rate);
+        if (at >= s_start_us) {
+            uint64_t p = frames_due(at);
+            if (p < s_history_n && p + ECHO_HISTORY >= s_history_n) {
+                v += echo_gain * s_history[p % ECHO_HISTORY];
+            }
+        }
+    }
+    long r = lrintf(v);
+    return (int16_t)(r > 32767 ? 32767 : r < -32768 ? -32768 : r);
+}
+
+esp_err_t es8388_read(void *buffer, size_t bytes_to_read, size_t *bytes_read, TickType_t ticks_to_wait) {
+    *bytes_read = 0;
+    if (!s_mic_on) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    int16_t *out = buffer;
+    uint64_t want = bytes_to_read / sizeof(int16_t);
+
+    pthread_mutex_lock(&sim_lock);
+    if (!s_mic_started) {
+        s_mic_started = true;
+        s_mic_start_us = sim_now_us();
+    }
+    int64_t deadline = sim_deadline(ticks_to_wait);
+    // Like i2s_channel_read, waits for all of it or the timeout
+    while (mic_ready(sim_now_us()) < s_mic_taken + want) {
+        int64_t when = time_of_mic_frames(s_mic_taken + want);
+        if (deadline >= 0 && deadline < when) {
+            if (sim_now_us() < deadline) {
+                sim_wait_locked(NULL, deadline);
+            }
+            break;
+        }
+        sim_wait_locked(NULL, when);
+    }
+    uint64_t ready = mic_ready(sim_now_us());
+    if (ready - s_mic_taken > DMA_FRAMES) {
+        s_stats.mic_frames_lost += ready - DMA_FRAMES - s_mic_taken;
+        s_mic_taken = ready - DMA_FRAMES;
+    }
+    uint64_t n = ready - s_mic_taken < want ? ready - s_mic_taken : want;
+    consume(sim_now_us());
+    float echo_gain = s_echo * powf(10.0f, es8388_get_output_db() / 20.0f);
+    for (uint64_t i = 0; i < n; i++) {
+        out[i] = mic_frame(s_mic_taken + i, echo_gain);
+    }
+    s_mic_taken += n;
+    s_stats.mic_frames_read += n;
+    pthread_mutex_unlock(&sim_lock);
+
+    *bytes_read = n * sizeof(int16_t);
+    return n == want ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+// Same arithmetic as the driver, without the registers
+esp_err_t es8388_set_volume(int volume) {
+    ESP_LOGD(TAG, "volume %d", volume);
+    if (volume < 0) volume = 0; else if (volume > 100) volume = 100;
+    s_requested_volume = volume;
+    int reg = volume / 3 + s_offset_steps;
+    s_output_reg = reg < 0 ? 0 : reg > 33 ? 33 : reg;
+    return ESP_OK;
+}
+
+esp_err_t es8388_set_volume_offset(float db) {
+    int steps = (int)lrintf(db / ES8388_OUT_STEP_DB);
+    if (steps == s_offset_steps) {
+        return ESP_OK;
+    }
+    s_offset_steps = steps;
+    return s_requested_volume < 0 ? ESP_OK : es8388_set_volume(s_requested_volume);
+}
+
+float es8388_get_output_db(void) {
+    return (s_output_reg - 0x1E) * ES8388_OUT_STEP_DB;
+}
@@ -0,0 +1,29 @@
+// Shared between the simulator sources only
+
+#ifndef SIM_INTERNAL_H
+#define SIM_INTERNAL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+// Serialises the scheduler and every stand-in's state
+extern pthread_mutex_t sim_lock;
+
+typedef struct {
+    struct sim_task *head;
+} sim_waitq_t;
+
+// With sim_lock held: block the calling task on q (may be NULL for a plain
+// sleep) until woken or until deadline (-1 for none). Returns true if woken.
+bool sim_wait_locked(sim_waitq_t *q, int64_t deadline);
+
+// With sim_lock held: make the first (or every) waiter ready, switching to
+// it right away if it has a higher priority than the caller
+void sim_wake_locked(sim_waitq_t *q, bool all);
+
+// Absolute virtual deadline for a FreeRTOS timeout, -1 for portMAX_DELAY
+int64_t sim_deadline(TickType_t ticks);
+
+#endif // SIM_INTERNAL_H
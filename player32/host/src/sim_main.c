@@ -0,0 +1,370 @@
+// player32_sim: runs the player32 audio engine on the virtual clock
+//
+// Sets up the same tasks as app_main (reader above player, both pinned to
+// core 1 on the device), plays for the requested virtual duration and
+// reports what the virtual SD card and I2S sink saw. Exit status is 1 when
+// the run had more underruns than --max-underruns allows, so a scenario can
+// sit in a script as a regression check.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "es8388.h"
+#include "ima_adpcm.h"
+#include "player32.h"
+#include "sim.h"
+
+static const char *TAG = "player32_sim";
+
+typedef struct {
+    const char *file;
+    const char *out;
+    const char *json;
+    double duration_s;
+    uint64_t seed;
+    bool tone;
+    bool ambient;
+    const char *mic;
+    double mic_echo_db;         // -200 and below for no echo
+    long max_underruns;         // -1 for no limit
+    esp_log_level_t log_level;
+    sim_sd_config_t sd;
+} sim_options_t;
+
+static void usage(FILE *out) {
+    fprintf(out,
+        "usage: player32_sim [options] FILE.wav\n"
+        "\n"
+        "FILE.wav is opened as /sdcard/<name> under --sd-root, like on the board.\n"
+        "A .mp3 goes through the mp3_reader, in builds with libhelix-mp3, a .flac\n"
+        "through the flac_reader.\n"
+        "\n"
+        "  --sd-root DIR         host directory standing in for /sdcard (default: FILE's directory)\n"
+        "  --duration S          virtual seconds to play (default 60)\n"
+        "  --seed N              random seed for the SD model (default 1)\n"
+        "  --sd-latency DIST     per read latency in us: fixed:US, uniform:MIN:MAX,\n"
+        "                        normal:MEAN:SD, lognormal:MEDIAN:SIGMA (default lognormal:1500:0.4)\n"
+        "  --sd-mbps N           transfer rate in MB/s (default 10)\n"
+        "  --sd-spike P:US       with probability P a read takes US longer\n"
+        "  --sd-stall MS:US      card stalls for US starting at MS of virtual time (repeatable)\n"
+        "  --tone                feed the tone_reader instead of the wav_reader\n"
+        "  --ambient             run the ambient task, which sets a volume offset from the mic\n"
+        "  --mic FILE.wav        what the mic hears, first channel, looped (default silence)\n"
+        "  --mic-echo DB         the mic also hears the DAC, through the output gain, at DB\n"
+        "  --out FILE.wav        write everything the DAC played, silence included\n"
+        "  --json FILE           write the stats as JSON\n"
+        "  --max-underruns N     exit 1 if there were more than N underruns\n"
+        "  --log-level e|w|i|d   engine log level (default w)\n");
+}
+
+static bool parse_args(int argc, char **argv, sim_options_t *opt) {
+    static const struct option longopts[] = {
+        { "sd-root",       required_argument, 0, 'r' },
+        { "duration",      required_argument, 0, 't' },
+        { "seed",          required_argument, 0, 's' },
+        { "sd-latency",    required_argument, 0, 'l' },
+        { "sd-mbps",       required_argument, 0, 'm' },
+        { "sd-spike",      required_argument, 0, 'p' },
+        { "sd-stall",      required_argument, 0, 'S' },
+        { "tone",          no_argument,       0, 'T' },
+        { "ambient",       no_argument,       0, 'A' },
+        { "mic",           required_argument, 0, 'M' },
+        { "mic-echo",      required_argument, 0, 'E' },
+        { "out",           required_argument, 0, 'o' },
+        { "json",          required_argument, 0, 'j' },
+        { "max-underruns", required_argument, 0, 'u' },
+        { "log-level",     required_argument, 0, 'L' },
+        { "help",          no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "h", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'r':
+                opt->sd.root = optarg;
+                break;
+            case 't':
+                opt->duration_s = atof(optarg);
+                break;
+            case 's':
+                opt->seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'l':
+                if (!sim_dist_parse(optarg, &opt->sd.latency)) {
+                    fprintf(stderr, "bad latency distribution: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'm':
+                opt->sd.mbps = atof(optarg);
+                break;
+            case 'p':
+                if (sscanf(optarg, "%lf:%lf", &opt->sd.spike_prob, &opt->sd.spike_us) != 2) {
+                    fprintf(stderr, "bad spike, want P:US: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'S': {
+                double at_ms, len_us;
+                if (opt->sd.n_stalls >= SIM_SD_MAX_STALLS ||
+                    sscanf(optarg, "%lf:%lf", &at_ms, &len_us) != 2) {
+                    fprintf(stderr, "bad or too many stalls, want MS:US: %s\n", optarg);
+                    return false;
+                }
+                opt->sd.stalls[opt->sd.n_stalls].at_us = (int64_t)(at_ms * 1000);
+                opt->sd.stalls[opt->sd.n_stalls].len_us = (int64_t)len_us;
+                opt->sd.n_stalls++;
+                break;
+            }
+            case 'T':
+                opt->tone = true;
+                break;
+            case 'A':
+                opt->ambient = true;
+                break;
+            case 'M':
+                opt->mic = optarg;
+                break;
+            case 'E':
+                opt->mic_echo_db = atof(optarg);
+                break;
+            case 'o':
+                opt->out = optarg;
+                break;
+            case 'j':
+                opt->json = optarg;
+                break;
+            case 'u':
+                opt->max_underruns = strtol(optarg, NULL, 0);
+                break;
+            case 'L':
+                switch (optarg[0]) {
+                    case 'e': opt->log_level = ESP_LOG_ERROR; break;
+                    case 'w': opt->log_level = ESP_LOG_WARN; break;
+                    case 'i': opt->log_level = ESP_LOG_INFO; break;
+                    case 'd': opt->log_level = ESP_LOG_DEBUG; break;
+                    default:
+                        fprintf(stderr, "bad log level: %s\n", optarg);
+                        return false;
+                }
+                break;
+            case 'h':
+                usage(stdout);
+                exit(0);
+            default:
+                return false;
+        }
+    }
+    if (optind != argc - 1) {
+        return false;
+    }
+    opt->file = argv[optind];
+    return true;
+}
+
+// Same loop as es8388_player_task in player32.c, which drags in the board
+static void player_task(void *arg) {
+    wav_reader_state_t *wav_state = arg;
+    do {
+        play_es8388_wav(wav_state);
+    } while (1);
+}
+
+static void write_json(const char *path, const sim_options_t *opt, int64_t reached_us,
+                       const sim_sd_stats_t *sd, const sim_i2s_stats_t *i2s, const ambient_level_t *amb) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "can't write %s", path);
+        return;
+    }
+    fprintf(f, "{\n");
+    fprintf(f, "  \"file\": \"%s\",\n", opt->file);
+    fprintf(f, "  \"seed\": %llu,\n", (unsigned long long)opt->seed);
+    fprintf(f, "  \"virtual_ms\": %lld,\n", (long long)(reached_us / 1000));
+    fprintf(f, "  \"sd\": {\"reads\": %u, \"bytes\": %llu, \"spikes\": %u, "
+               "\"mean_us\": %.0f, \"p50_us\": %.0f, \"p99_us\": %.0f, \"max_us\": %.0f},\n",
+            sd->reads, (unsigned long long)sd->bytes, sd->spikes,
+            sd->mean_us, sd->p50_us, sd->p99_us, sd->max_us);
+    fprintf(f, "  \"i2s\": {\"frames_played\": %llu, \"frames_silent\": %llu, "
+               "\"underruns\": %u, \"min_fill\": %u},\n",
+            (unsigned long long)i2s->frames_played, (unsigned long long)i2s->frames_silent,
+            i2s->underruns, i2s->min_fill);
+    if (opt->ambient) {
+        fprintf(f, "  \"ambient\": {\"windows\": %u, \"gated\": %u, ", amb->windows, amb->gated);
+        if (amb->have_level) {
+            fprintf(f, "\"room_dbfs\": %.1f, ", amb->level_dbfs);
+        } else {
+            fprintf(f, "\"room_dbfs\": null, ");
+        }
+        if (amb->have_coupling) {
+            fprintf(f, "\"coupling_db\": %.1f, ", amb->coupling_db);
+        } else {
+            fprintf(f, "\"coupling_db\": null, ");
+        }
+        fprintf(f, "\"offset_db\": %.2f, \"mic_frames_lost\": %llu},\n",
+                amb->offset_db, (unsigned long long)i2s->mic_frames_lost);
+    }
+    fprintf(f, "  \"underruns\": [");
+    for (uint32_t i = 0; i < i2s->n_events; i++) {
+        fprintf(f, "%s{\"at_ms\": %.3f, \"frames\": %u}", i ? ", " : "",
+                i2s->events[i].at_us / 1000.0, i2s->events[i].frames);
+    }
+    fprintf(f, "]\n}\n");
+    fclose(f);
+}
+
+int main(int argc, char **argv) {
+    sim_options_t opt = {
+        .duration_s = 60,
+        .seed = 1,
+        .max_underruns = -1,
+        .mic_echo_db = -200,
+        .log_level = ESP_LOG_WARN,
+        .sd = {
+            .latency = { SIM_DIST_LOGNORMAL, 1500, 0.4 },
+            .mbps = 10,
+        },
+    };
+    if (!parse_args(argc, argv, &opt)) {
+        usage(stderr);
+        return 2;
+    }
+
+    // The file's directory is the card unless told otherwise
+    char root[512];
+    const char *name = strrchr(opt.file, '/');
+    if (opt.sd.root == NULL) {
+        if (name) {
+            snprintf(root, sizeof(root), "%.*s", (int)(name - opt.file), opt.file);
+        } else {
+            snprintf(root, sizeof(root), ".");
+        }
+        opt.sd.root = root;
+    }
+    name = name ? name + 1 : opt.file;
+    char sd_path[600];
+    snprintf(sd_path, sizeof(sd_path), "%s/%s", SD_MOUNT_POINT, name);
+
+    esp_log_level_set("*", opt.log_level);
+    sim_rand_seed(opt.seed);
+    sim_sd_configure(&opt.sd);
+
+    wav_reader_state_t *wav_state = calloc(1, sizeof(wav_reader_state_t));
+    if (wav_state == NULL) {
+        return 2;
+    }
+    wav_state->filepath = sd_path;
+
+    // Picked the way app_main does, from the name
+    const char *dot = strrchr(name, '.');
+    bool mp3 = dot && strcasecmp(dot, ".mp3") == 0;
+    bool flac = dot && strcasecmp(dot, ".flac") == 0;
+    const char *reader_name = opt.tone ? "tone_reader" : mp3 ? "mp3_reader" : flac ? "flac_reader" : "wav_reader";
+    TaskFunction_t reader_task = opt.tone ? tone_reader_task : wav_reader_task;
+    esp_err_t err;
+    if (opt.tone) {
+        err = tone_reader_init(wav_state);
+    } else if (flac) {
+        err = flac_reader_init(wav_state);
+        reader_task = flac_reader_task;
+    } else if (mp3) {
+#if PLAYER32_HAVE_MP3
+        err = mp3_reader_init(wav_state);
+        reader_task = mp3_reader_task;
+#else
+        fprintf(stderr, "built without libhelix-mp3, see PLAYER32_HELIX_DIR\n");
+        return 2;
+#endif
+    } else {
+        err = wav_reader_init(wav_state);
+    }
+    if (err != ESP_OK) {
+        fprintf(stderr, "could not open %s as a %s file\n", opt.file, mp3 ? "MP3" : flac ? "FLAC" : "WAV");
+        return 2;
+    }
+    // IMA ADPCM is decoded to 16 bit on the way into the ringbuf
+    uint16_t played_bits = wav_state->audio_format == IMA_ADPCM_WAV_FORMAT ? 16 : wav_state->bits_per_sample;
+    if (wav_state->num_channels != 2 || played_bits != 16) {
+        // The DAC is configured for 16 bit stereo and the engine doesn't convert
+        ESP_LOGW(TAG, "%s is %u channel %u bit, the board plays it as 16 bit stereo",
+            opt.file, wav_state->num_channels, wav_state->bits_per_sample);
+    }
+    sim_i2s_configure(wav_state->sample_rate, opt.out);
+    // app_main's starting volume, which the ambient offset rides on
+    es8388_set_volume(30);
+    if (opt.mic || opt.mic_echo_db > -200 || opt.ambient) {
+        if (!sim_i2s_mic_configure(opt.mic, opt.mic_echo_db)) {
+            return 2;
+        }
+    }
+    if (opt.ambient) {
+        ambient_level_config_t ambient_cfg = AMBIENT_LEVEL_CONFIG_DEFAULT();
+        if (ambient_init(&ambient_cfg) != ESP_OK) {
+            return 2;
+        }
+    }
+
+    xTaskCreatePinnedToCore(reader_task, reader_name, 1024 * 6, wav_state, configMAX_PRIORITIES - 2, NULL, 1);
+    xTaskCreatePinnedToCore(player_task, "es8388_player", 1024 * 6, wav_state, configMAX_PRIORITIES - 4, NULL, 1);
+
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    int64_t reached = sim_run(sim_now_us() + (int64_t)(opt.duration_s * 1e6));
+    sim_i2s_finish();
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    double wall_s = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+
+    sim_sd_stats_t sd;
+    sim_i2s_stats_t i2s;
+    sim_sd_get_stats(&sd);
+    sim_i2s_get_stats(&i2s);
+
+    printf("virtual time   %.3f s (%.2f s wall)\n", reached / 1e6, wall_s);
+    printf("sd reads       %u, %.1f MB, %u spikes\n", sd.reads, sd.bytes / 1e6, sd.spikes);
+    printf("sd latency     mean %.0f us, p50 %.0f us, p99 %.0f us, max %.0f us\n",
+        sd.mean_us, sd.p50_us, sd.p99_us, sd.max_us);
+    printf("i2s frames     %llu played, %llu silent\n",
+        (unsigned long long)i2s.frames_played, (unsigned long long)i2s.frames_silent);
+    printf("i2s underruns  %u (lowest DMA fill %u frames)\n", i2s.underruns, i2s.min_fill);
+    for (uint32_t i = 0; i < i2s.n_events; i++) {
+        printf("  underrun at %10.3f ms, %u frames silent\n", i2s.events[i].at_us / 1000.0, i2s.events[i].frames);
+    }
+    if (i2s.underruns > i2s.n_events) {
+        printf("  ... %u more\n", i2s.underruns - i2s.n_events);
+    }
+    ambient_level_t amb = { 0 };
+    if (opt.ambient) {
+        ambient_get(&amb);
+        printf("ambient        %u windows, %u gated as playback, %llu mic frames lost\n",
+            amb.windows, amb.gated, (unsigned long long)i2s.mic_frames_lost);
+        if (amb.have_level) {
+            printf("ambient level  room %.1f dB(A)FS, ", amb.level_dbfs);
+        } else {
+            printf("ambient level  room unknown, ");
+        }
+        if (amb.have_coupling) {
+            printf("coupling %.1f dB, ", amb.coupling_db);
+        } else {
+            printf("coupling unknown, ");
+        }
+        printf("offset %+.2f dB (output %+.1f dB)\n", amb.offset_db, es8388_get_output_db());
+    }
+
+    if (opt.json) {
+        write_json(opt.json, &opt, reached, &sd, &i2s, &amb);
+    }
+
+    // Tasks are parked on the virtual clock, exiting takes them down
+    if (opt.max_underruns >= 0 && i2s.underruns > (uint32_t)opt.max_underruns) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,141 @@
+// Byte buffer ring buffer with the blocking behaviour of the ESP-IDF one:
+// a send waits until the whole item fits, a receive hands out one
+// contiguous piece that stays allocated until it is returned.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+#include "esp_log.h"
+#include "sim_internal.h"
+
+static const char *TAG = "SIM_RINGBUF";
+
+struct sim_ringbuf {
+    uint8_t *buf;
+    size_t size;
+    bool owns_buf;
+    size_t read_pos;
+    size_t write_pos;
+    size_t used;                    // written and not yet returned
+    size_t unread;                  // written and not yet handed out
+    size_t outstanding;             // handed out and not yet returned
+    sim_waitq_t readers;
+    sim_waitq_t writers;
+};
+
+RingbufHandle_t xRingbufferCreateStatic(size_t size, RingbufferType_t type,
+                                        uint8_t *storage, StaticRingbuffer_t *control) {
+    (void)control;
+    if (type != RINGBUF_TYPE_BYTEBUF) {
+        ESP_LOGE(TAG, "only byte buffers are simulated");
+        return NULL;
+    }
+    struct sim_ringbuf *rb = calloc(1, sizeof(*rb));
+    if (rb == NULL) {
+        return NULL;
+    }
+    rb->buf = storage;
+    rb->size = size;
+    return rb;
+}
+
+RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t type) {
+    uint8_t *storage = malloc(size);
+    if (storage == NULL) {
+        return NULL;
+    }
+    RingbufHandle_t rb = xRingbufferCreateStatic(size, type, storage, NULL);
+    if (rb == NULL) {
+        free(storage);
+        return NULL;
+    }
+    rb->owns_buf = true;
+    return rb;
+}
+
+void vRingbufferDelete(RingbufHandle_t rb) {
+    if (rb == NULL) {
+        return;
+    }
+    if (rb->owns_buf) {
+        free(rb->buf);
+    }
+    free(rb);
+}
+
+BaseType_t xRingbufferSend(RingbufHandle_t rb, const void *data, size_t size, TickType_t ticks) {
+    if (size > rb->size) {
+        return pdFALSE;
+    }
+    pthread_mutex_lock(&sim_lock);
+    int64_t deadline = sim_deadline(ticks);
+    while (rb->size - rb->used < size) {
+        if (ticks == 0 || !sim_wait_locked(&rb->writers, deadline)) {
+            pthread_mutex_unlock(&sim_lock);
+            return pdFALSE;
+        }
+    }
+    const uint8_t *src = data;
+    size_t first = rb->size - rb->write_pos;
+    if (first > size) {
+        first = size;
+    }
+    memcpy(rb->buf + rb->write_pos, src, first);
+    memcpy(rb->buf, src + first, size - first);
+    rb->write_pos = (rb->write_pos + size) % rb->size;
+    rb->used += size;
+    rb->unread += size;
+    sim_wake_locked(&rb->readers, true);
+    pthread_mutex_unlock(&sim_lock);
+    return pdTRUE;
+}
+
+void *xRingbufferReceiveUpTo(RingbufHandle_t rb, size_t *size, TickType_t ticks, size_t max_size) {
+    pthread_mutex_lock(&sim_lock);
+    int64_t deadline = sim_deadline(ticks);
+    // One item out at a time, as with the IDF byte buffer
+    while (rb->unread == 0 || rb->outstanding > 0) {
+        if (ticks == 0 || !sim_wait_locked(&rb->readers, deadline)) {
+            pthread_mutex_unlock(&sim_lock);
+            *size = 0;
+            return NULL;
+        }
+    }
+    size_t n = rb->unread;
+    if (n > rb->size - rb->read_pos) {
+        n = rb->size - rb->read_pos;
+    }
+    if (n > max_size) {
+        n = max_size;
+    }
+    void *item = rb->buf + rb->read_pos;
+    rb->read_pos = (rb->read_pos + n) % rb->size;
+    rb->unread -= n;
+    rb->outstanding = n;
+    *size = n;
+    pthread_mutex_unlock(&sim_lock);
+    return item;
+}
+
+void *xRingbufferReceive(RingbufHandle_t rb, size_t *size, TickType_t ticks) {
+    return xRingbufferReceiveUpTo(rb, size, ticks, rb->size);
+}
+
+void vRingbufferReturnItem(RingbufHandle_t rb, void *item) {
+    (void)item;
+    pthread_mutex_lock(&sim_lock);
+    rb->used -= rb->outstanding;
+    rb->outstanding = 0;
+    sim_wake_locked(&rb->writers, true);
+    sim_wake_locked(&rb->readers, true);
+    pthread_mutex_unlock(&sim_lock);
+}
+
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t rb) {
+    pthread_mutex_lock(&sim_lock);
+    size_t free_size = rb->size - rb->used;
+    pthread_mutex_unlock(&sim_lock);
+    return free_size;
+}
@@ -0,0 +1,420 @@
+// Virtual time scheduler and the FreeRTOS task and semaphore stand-ins
+//
+// Every task is a thread, but only the task in s_current runs; the others
+// wait on their own condition variable. Scheduling points are the blocking
+// calls, so the engine code between them takes no virtual time. When no
+// task is ready the clock jumps to the earliest deadline. Ties go to the
+// higher priority, then to whichever became ready first, which makes every
+// run with the same inputs identical.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "sim.h"
+#include "sim_internal.h"
+
+static const char *TAG = "SIM";
+
+typedef enum {
+    TASK_READY,
+    TASK_RUNNING,
+    TASK_BLOCKED,
+    TASK_DONE,
+} task_state_t;
+
+struct sim_task {
+    pthread_t thread;
+    char name[configMAX_TASK_NAME_LEN];
+    UBaseType_t priority;
+    TaskFunction_t fn;
+    void *arg;
+    task_state_t state;
+    uint64_t ready_seq;
+    int64_t deadline;               // -1 when waiting without timeout
+    sim_waitq_t *waitq;
+    struct sim_task *wait_next;
+    bool woken;
+    pthread_cond_t cv;
+    struct sim_task *next;
+};
+
+struct sim_sem {
+    UBaseType_t count;
+    UBaseType_t max;
+    sim_waitq_t waiters;
+};
+
+pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_main_cv = PTHREAD_COND_INITIALIZER;
+static struct sim_task *s_tasks = NULL;
+static struct sim_task *s_current = NULL;
+static __thread struct sim_task *t_self = NULL;
+static int64_t s_now = 0;
+static int64_t s_end = 0;
+static uint64_t s_seq = 0;
+static bool s_running = false;
+static bool s_stopped = false;
+static int s_task_count = 0;
+
+int64_t sim_now_us(void) {
+    return s_now;
+}
+
+static void make_ready(struct sim_task *t) {
+    t->state = TASK_READY;
+    t->ready_seq = ++s_seq;
+}
+
+static struct sim_task *pick_ready(void) {
+    struct sim_task *best = NULL;
+    for (struct sim_task *t = s_tasks; t; t = t->next) {
+        if (t->state != TASK_READY) {
+            continue;
+        }
+        if (best == NULL || t->priority > best->priority ||
+            (t->priority == best->priority && t->ready_seq < best->ready_seq)) {
+            best = t;
+        }
+    }
+    return best;
+}
+
+static void waitq_remove(sim_waitq_t *q, struct sim_task *t) {
+    struct sim_task **pp = &q->head;
+    while (*pp) {
+        if (*pp == t) {
+            *pp = t->wait_next;
+            t->wait_next = NULL;
+            return;
+        }
+        pp = &(*pp)->wait_next;
+    }
+}
+
+static void stop_locked(void) {
+    s_stopped = true;
+    s_current = NULL;
+    pthread_cond_broadcast(&s_main_cv);
+}
+
+// Hands the CPU to the next task, advancing the clock if nobody is ready.
+// Called with sim_lock held by the task giving up the CPU (or by sim_run).
+static void dispatch(void) {
+    for (;;) {
+        struct sim_task *next = pick_ready();
+        if (next) {
+            next->state = TASK_RUNNING;
+            s_current = next;
+            pthread_cond_signal(&next->cv);
+            return;
+        }
+
+        int64_t earliest = -1;
+        for (struct sim_task *t = s_tasks; t; t = t->next) {
+            if (t->state == TASK_BLOCKED && t->deadline >= 0 &&
+                (earliest < 0 || t->deadline < earliest)) {
+                earliest = t->deadline;
+            }
+        }
+        if (earliest < 0) {
+            ESP_LOGW(TAG, "all tasks blocked forever at %lld us", (long long)s_now);
+            stop_locked();
+            return;
+        }
+        if (earliest > s_end) {
+            s_now = s_end;
+            stop_locked();
+            return;
+        }
+        s_now = earliest;
+        for (struct sim_task *t = s_tasks; t; t = t->next) {
+            if (t->state == TASK_BLOCKED && t->deadline >= 0 && t->deadline <= s_now) {
+                if (t->waitq) {
+                    waitq_remove(t->waitq, t);
+                    t->waitq = NULL;
+                }
+                t->woken = false;
+                make_ready(t);
+            }
+        }
+    }
+}
+
+// Gives up the CPU and waits until dispatched again
+static void switch_out(struct sim_task *self) {
+    dispatch();
+    while (s_current != self) {
+        pthread_cond_wait(&self->cv, &sim_lock);
+    }
+}
+
+bool sim_wait_locked(sim_waitq_t *q, int64_t deadline) {
+    struct sim_task *self = t_self;
+    if (self == NULL) {
+        // Setup code on the main thread before sim_run (wav_reader_init
+        // reads the header): nothing else can run, so just take the time
+        if (!s_running && deadline > s_now) {
+            s_now = deadline;
+        }
+        return false;
+    }
+    self->state = TASK_BLOCKED;
+    self->deadline = deadline;
+    self->woken = false;
+    self->waitq = q;
+    if (q) {
+        // FIFO, like FreeRTOS for waiters of the same priority
+        struct sim_task **pp = &q->head;
+        while (*pp) pp = &(*pp)->wait_next;
+        *pp = self;
+        self->wait_next = NULL;
+    }
+    switch_out(self);
+    return self->woken;
+}
+
+static void preempt_if_needed(void) {
+    struct sim_task *self = t_self;
+    if (self == NULL) {
+        return;
+    }
+    struct sim_task *next = pick_ready();
+    if (next && next->priority > self->priority) {
+        make_ready(self);
+        switch_out(self);
+    }
+}
+
+static int wake(sim_waitq_t *q, bool all) {
+    int n = 0;
+    while (q->head) {
+        struct sim_task *t = q->head;
+        q->head = t->wait_next;
+        t->wait_next = NULL;
+        t->waitq = NULL;
+        t->woken = true;
+        make_ready(t);
+        n++;
+        if (!all) {
+            break;
+        }
+    }
+    return n;
+}
+
+void sim_wake_locked(sim_waitq_t *q, bool all) {
+    if (wake(q, all)) {
+        preempt_if_needed();
+    }
+}
+
+int64_t sim_deadline(TickType_t ticks) {
+    if (ticks == portMAX_DELAY) {
+        return -1;
+    }
+    return s_now + (int64_t)ticks * (1000000 / configTICK_RATE_HZ);
+}
+
+void sim_sleep_until(int64_t wake_us) {
+    pthread_mutex_lock(&sim_lock);
+    if (wake_us > s_now) {
+        sim_wait_locked(NULL, wake_us);
+    }
+    pthread_mutex_unlock(&sim_lock);
+}
+
+static void *task_entry(void *p) {
+    struct sim_task *self = p;
+    t_self = self;
+    pthread_mutex_lock(&sim_lock);
+    while (s_current != self) {
+        pthread_cond_wait(&self->cv, &sim_lock);
+    }
+    pthread_mutex_unlock(&sim_lock);
+
+    self->fn(self->arg);
+
+    // Returning from a task function is a bug on FreeRTOS, here it just ends
+    ESP_LOGW(TAG, "task %s returned", self->name);
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *created, BaseType_t core) {
+    (void)stack_depth;
+    (void)core;
+
+    struct sim_task *t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        return pdFAIL;
+    }
+    snprintf(t->name, sizeof(t->name), "%s", name);
+    t->priority = priority;
+    t->fn = fn;
+    t->arg = arg;
+    t->deadline = -1;
+    pthread_cond_init(&t->cv, NULL);
+
+    pthread_mutex_lock(&sim_lock);
+    // Appended so the task list prints in creation order
+    struct sim_task **pp = &s_tasks;
+    while (*pp) pp = &(*pp)->next;
+    *pp = t;
+    s_task_count++;
+    make_ready(t);
+    if (pthread_create(&t->thread, NULL, task_entry, t) != 0) {
+        pthread_mutex_unlock(&sim_lock);
+        return pdFAIL;
+    }
+    pthread_detach(t->thread);
+    if (created) {
+        *created = t;
+    }
+    preempt_if_needed();
+    pthread_mutex_unlock(&sim_lock);
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    pthread_mutex_lock(&sim_lock);
+    struct sim_task *self = t_self;
+    if (task != NULL && task != self) {
+        // Deleting another task: it simply never runs again
+        if (task->waitq) {
+            waitq_remove(task->waitq, task);
+            task->waitq = NULL;
+        }
+        task->state = TASK_DONE;
+        s_task_count--;
+        pthread_mutex_unlock(&sim_lock);
+        return;
+    }
+    self->state = TASK_DONE;
+    s_task_count--;
+    dispatch();
+    pthread_mutex_unlock(&sim_lock);
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    pthread_mutex_lock(&sim_lock);
+    if (ticks == 0) {
+        make_ready(t_self);
+        switch_out(t_self);
+    } else {
+        sim_wait_locked(NULL, sim_deadline(ticks));
+    }
+    pthread_mutex_unlock(&sim_lock);
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t increment) {
+    *previous_wake += increment;
+    sim_sleep_until((int64_t)*previous_wake * (1000000 / configTICK_RATE_HZ));
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(s_now / (1000000 / configTICK_RATE_HZ));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return t_self;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void) {
+    return s_task_count;
+}
+
+void taskYIELD(void) {
+    vTaskDelay(0);
+}
+
+int64_t sim_run(int64_t end_us) {
+    pthread_mutex_lock(&sim_lock);
+    s_end = end_us;
+    s_running = true;
+    dispatch();
+    while (!s_stopped) {
+        pthread_cond_wait(&s_main_cv, &sim_lock);
+    }
+    int64_t reached = s_now;
+    pthread_mutex_unlock(&sim_lock);
+    return reached;
+}
+
+void sim_stop(void) {
+    pthread_mutex_lock(&sim_lock);
+    t_self->state = TASK_DONE;
+    stop_locked();
+    while (1) {
+        pthread_cond_wait(&t_self->cv, &sim_lock);
+    }
+}
+
+void sim_dump_tasks(FILE *out) {
+    static const char *state_names[] = {"ready", "running", "blocked", "done"};
+    for (struct sim_task *t = s_tasks; t; t = t->next) {
+        fprintf(out, "  %-16s prio %2u  %s\n", t->name, t->priority, state_names[t->state]);
+    }
+}
+
+//
+// Semaphores and mutexes. Mutexes have no priority inheritance.
+//
+
+static SemaphoreHandle_t sem_create(UBaseType_t max, UBaseType_t initial) {
+    struct sim_sem *sem = calloc(1, sizeof(*sem));
+    if (sem) {
+        sem->max = max;
+        sem->count = initial;
+    }
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return sem_create(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    return sem_create(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) {
+    return sem_create(max, initial);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    pthread_mutex_lock(&sim_lock);
+    int64_t deadline = sim_deadline(ticks);
+    while (sem->count == 0) {
+        if (ticks == 0 || t_self == NULL || !sim_wait_locked(&sem->waiters, deadline)) {
+            pthread_mutex_unlock(&sim_lock);
+            return pdFALSE;
+        }
+    }
+    sem->count--;
+    pthread_mutex_unlock(&sim_lock);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    pthread_mutex_lock(&sim_lock);
+    if (sem->count >= sem->max) {
+        pthread_mutex_unlock(&sim_lock);
+        return pdFALSE;
+    }
+    sem->count++;
+    sim_wake_locked(&sem->waiters, false);
+    pthread_mutex_unlock(&sim_lock);
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+    free(sem);
+}
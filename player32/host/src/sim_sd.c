@@ -0,0 +1,215 @@
+// Virtual SD card: host files behind a latency model on the virtual clock
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "sim.h"
+#include "sim_internal.h"
+
+static const char *TAG = "SIM_SD";
+
+#define SD_MOUNT_POINT  "/sdcard"
+
+static sim_sd_config_t s_cfg = {
+    .root = ".",
+    .latency = { SIM_DIST_FIXED, 1000.0, 0 },
+    .mbps = 10.0,
+};
+
+static int64_t s_busy_until = 0;    // the card serves one read at a time
+static uint32_t s_reads = 0;
+static uint64_t s_bytes = 0;
+static uint32_t s_spikes = 0;
+static double *s_latencies = NULL;  // per read, for percentiles
+static size_t s_latencies_cap = 0;
+
+static uint64_t s_rand_state = 0x9e3779b97f4a7c15ULL;
+
+void sim_rand_seed(uint64_t seed) {
+    s_rand_state = seed ? seed : 0x9e3779b97f4a7c15ULL;
+}
+
+// xorshift64*, plenty for jitter and reproducible everywhere
+double sim_rand_uniform(void) {
+    s_rand_state ^= s_rand_state >> 12;
+    s_rand_state ^= s_rand_state << 25;
+    s_rand_state ^= s_rand_state >> 27;
+    uint64_t r = s_rand_state * 0x2545f4914f6cdd1dULL;
+    return (double)(r >> 11) / (double)(1ULL << 53);
+}
+
+static double rand_normal(void) {
+    double u1 = sim_rand_uniform();
+    double u2 = sim_rand_uniform();
+    if (u1 < 1e-300) {
+        u1 = 1e-300;
+    }
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+double sim_dist_sample(const sim_dist_t *dist) {
+    double v;
+    switch (dist->kind) {
+        case SIM_DIST_UNIFORM:
+            v = dist->a + (dist->b - dist->a) * sim_rand_uniform();
+            break;
+        case SIM_DIST_NORMAL:
+            v = dist->a + dist->b * rand_normal();
+            break;
+        case SIM_DIST_LOGNORMAL:
+            v = dist->a * exp(dist->b * rand_normal());
+            break;
+        case SIM_DIST_FIXED:
+        default:
+            v = dist->a;
+            break;
+    }
+    return v < 0 ? 0 : v;
+}
+
+bool sim_dist_parse(const char *spec, sim_dist_t *dist) {
+    char kind[16];
+    double a = 0, b = 0;
+    int n = sscanf(spec, "%15[a-z]:%lf:%lf", kind, &a, &b);
+    if (n >= 2 && strcmp(kind, "fixed") == 0) {
+        *dist = (sim_dist_t){ SIM_DIST_FIXED, a, 0 };
+    } else if (n == 3 && strcmp(kind, "uniform") == 0 && b >= a) {
+        *dist = (sim_dist_t){ SIM_DIST_UNIFORM, a, b };
+    } else if (n == 3 && strcmp(kind, "normal") == 0) {
+        *dist = (sim_dist_t){ SIM_DIST_NORMAL, a, b };
+    } else if (n == 3 && strcmp(kind, "lognormal") == 0) {
+        *dist = (sim_dist_t){ SIM_DIST_LOGNORMAL, a, b };
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void sim_sd_configure(const sim_sd_config_t *cfg) {
+    s_cfg = *cfg;
+}
+
+static void record_latency(double us) {
+    if (s_reads >= s_latencies_cap) {
+        size_t cap = s_latencies_cap ? s_latencies_cap * 2 : 4096;
+        double *grown = realloc(s_latencies, cap * sizeof(double));
+        if (grown == NULL) {
+            return;
+        }
+        s_latencies = grown;
+        s_latencies_cap = cap;
+    }
+    s_latencies[s_reads] = us;
+}
+
+// Time the card needs for one read issued at start_us
+static int64_t read_latency(int64_t start_us, size_t len) {
+    double us = sim_dist_sample(&s_cfg.latency);
+    if (s_cfg.mbps > 0) {
+        us += (double)len / s_cfg.mbps;     // bytes / (MB/s) = us
+    }
+    if (s_cfg.spike_prob > 0 && sim_rand_uniform() < s_cfg.spike_prob) {
+        us += s_cfg.spike_us;
+        s_spikes++;
+    }
+    int64_t done = start_us + (int64_t)us;
+    // A stall holds every read that would still be in flight inside it
+    for (int i = 0; i < s_cfg.n_stalls; i++) {
+        int64_t from = s_cfg.stalls[i].at_us;
+        int64_t to = from + s_cfg.stalls[i].len_us;
+        if (done > from && start_us < to) {
+            done = to + (done - (start_us > from ? start_us : from));
+        }
+    }
+    return done - start_us;
+}
+
+int sim_sd_open(const char *path, int flags, ...) {
+    char host_path[512];
+    size_t mount_len = strlen(SD_MOUNT_POINT);
+    if (strncmp(path, SD_MOUNT_POINT, mount_len) == 0 && (path[mount_len] == '/' || path[mount_len] == 0)) {
+        snprintf(host_path, sizeof(host_path), "%s%s", s_cfg.root, path + mount_len);
+    } else {
+        snprintf(host_path, sizeof(host_path), "%s", path);
+    }
+
+    mode_t mode = 0;
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, int);
+        va_end(ap);
+    }
+    int fd = open(host_path, flags, mode);
+    if (fd < 0) {
+        ESP_LOGD(TAG, "open %s: %s", host_path, strerror(errno));
+    }
+    return fd;
+}
+
+ssize_t sim_sd_read(int fd, void *buf, size_t len) {
+    ssize_t n = read(fd, buf, len);
+    if (n < 0) {
+        return n;
+    }
+
+    pthread_mutex_lock(&sim_lock);
+    int64_t now = sim_now_us();
+    int64_t start = now > s_busy_until ? now : s_busy_until;
+    int64_t done = start + read_latency(start, (size_t)n);
+    s_busy_until = done;
+    record_latency((double)(done - now));
+    s_reads++;
+    s_bytes += (size_t)n;
+    if (done > now) {
+        sim_wait_locked(NULL, done);
+    }
+    pthread_mutex_unlock(&sim_lock);
+    return n;
+}
+
+off_t sim_sd_lseek(int fd, off_t offset, int whence) {
+    return lseek(fd, offset, whence);
+}
+
+int sim_sd_close(int fd) {
+    return close(fd);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+void sim_sd_get_stats(sim_sd_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->reads = s_reads;
+    stats->bytes = s_bytes;
+    stats->spikes = s_spikes;
+    size_t n = s_reads < s_latencies_cap ? s_reads : s_latencies_cap;
+    if (n == 0) {
+        return;
+    }
+    double *sorted = malloc(n * sizeof(double));
+    if (sorted == NULL) {
+        return;
+    }
+    memcpy(sorted, s_latencies, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), cmp_double);
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += sorted[i];
+    }
+    stats->mean_us = sum / n;
+    stats->p50_us = sorted[n / 2];
+    stats->p99_us = sorted[(n * 99) / 100];
+    stats->max_us = sorted[n - 1];
+    free(sorted);
+}
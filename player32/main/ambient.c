@@ -0,0 +1,171 @@
+// Ambient
+//
+// LOUDFRAME project. Turns the frame up a little in a loud room and down a
+// little in a quiet one, from the board's microphones. The arithmetic is in
+// components/ambient_level; this is the task that reads the mic, and the hook
+// that tells it what the frame itself is playing.
+//
+// The offset goes to the codec with es8388_set_volume_offset, so it rides on
+// top of whatever sets the volume (proximity_task), in the output stage's
+// 1.5 dB steps. Reading a block of 960 mono frames (22 ms) at a time, the task
+// wakes about 46 times a second.
+
+// Author: Brian Bulkowski <brian@bulkowski.org> (c) 2025
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "player32.h"
+#include "es8388.h"
+
+static const char *TAG = "ambient";
+
+#define AMBIENT_RATE            44100
+#define AMBIENT_READ_FRAMES     960
+// Playback is mixed to mono this many frames at a time, on the player's stack
+#define AMBIENT_PLAY_CHUNK      128
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool s_running = false;
+// Playback since the last window, A-weighted like the mic: the speaker's
+// share of what the mic hears then stays put as the music's spectrum moves
+// around. Only the player task touches s_play_weight.
+static ambient_aweight_t s_play_weight;
+static double s_play_sum = 0;
+static uint32_t s_play_n = 0;
+// A copy of the estimate for ambient_get
+static ambient_level_t s_published;
+
+void ambient_note_playback(const void *pcm, size_t bytes)
+{
+    if (!s_running) {
+        return;
+    }
+    const int16_t *s = pcm;
+    size_t frames = bytes / 4;
+    int16_t mono[AMBIENT_PLAY_CHUNK];
+    double sum = 0;
+    for (size_t f = 0; f < frames; ) {
+        size_t n = frames - f < AMBIENT_PLAY_CHUNK ? frames - f : AMBIENT_PLAY_CHUNK;
+        for (size_t i = 0; i < n; i++, f++) {
+            mono[i] = (int16_t)(((int32_t)s[2 * f] + s[2 * f + 1]) >> 1);
+        }
+        sum += ambient_aweight_power(&s_play_weight, mono, n);
+    }
+    taskENTER_CRITICAL(&s_mux);
+    s_play_sum += sum;
+    s_play_n += frames;
+    taskEXIT_CRITICAL(&s_mux);
+}
+
+static void ambient_task(void *arg)
+{
+    ambient_level_t level;
+    ambient_level_init(&level, (const ambient_level_config_t *)arg);
+    free(arg);
+
+    ambient_aweight_t weight;
+    ambient_aweight_init(&weight, AMBIENT_RATE);
+
+    int16_t *buf = heap_caps_malloc(AMBIENT_READ_FRAMES * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "no memory for the mic buffer, not running");
+        vTaskDelete(NULL);
+        return;
+    }
+
+    const uint32_t window_frames = (uint64_t)AMBIENT_RATE * level.cfg.window_ms / 1000;
+    double mic_sum = 0;
+    uint32_t mic_n = 0;
+    double gain_sum = 0;        // output power gain, per mic frame: the volume can move mid window
+    int applied = 0;            // offset steps last sent to the codec
+
+    // drop whatever the play hook counted before the first window starts
+    taskENTER_CRITICAL(&s_mux);
+    s_play_sum = 0;
+    s_play_n = 0;
+    taskEXIT_CRITICAL(&s_mux);
+
+    while (1) {
+        size_t got = 0;
+        esp_err_t ret = es8388_read(buf, AMBIENT_READ_FRAMES * sizeof(int16_t), &got, pdMS_TO_TICKS(200));
+        if (ret != ESP_OK && got == 0) {
+            ESP_LOGW(TAG, "mic read failed: %s", esp_err_to_name(ret));
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            continue;
+        }
+        size_t n = got / sizeof(int16_t);
+        mic_sum += ambient_aweight_power(&weight, buf, n);
+        mic_n += n;
+        gain_sum += powf(10.0f, es8388_get_output_db() / 10.0f) * n;
+        if (mic_n < window_frames) {
+            continue;
+        }
+
+        taskENTER_CRITICAL(&s_mux);
+        double play_sum = s_play_sum;
+        uint32_t play_n = s_play_n;
+        s_play_sum = 0;
+        s_play_n = 0;
+        taskEXIT_CRITICAL(&s_mux);
+
+        double mic_power = mic_sum / mic_n;
+        double play_power = play_n ? play_sum / play_n : 0;
+        float output_db = 10.0f * log10f(gain_sum / mic_n);
+        bool counted = ambient_level_window(&level, mic_power, play_power, output_db);
+        mic_sum = 0;
+        mic_n = 0;
+        gain_sum = 0;
+        ESP_LOGD(TAG, "window: mic %.1f dB, play %.1f dB at %.1f dB out, %s, room %.1f dB, offset %.2f dB",
+            10 * log10(mic_power + 1e-12), 10 * log10(play_power + 1e-12), output_db,
+            counted ? "counted" : "gated", level.level_dbfs, level.offset_db);
+
+        int steps = (int)lrintf(level.offset_db / ES8388_OUT_STEP_DB);
+        if (steps != applied) {
+            ESP_LOGI(TAG, "room %.1f dB(A)FS, offset %+.1f dB", level.level_dbfs, steps * ES8388_OUT_STEP_DB);
+            if (es8388_set_volume_offset(level.offset_db) == ESP_OK) {
+                applied = steps;
+            }
+        }
+
+        taskENTER_CRITICAL(&s_mux);
+        s_published = level;
+        taskEXIT_CRITICAL(&s_mux);
+    }
+}
+
+esp_err_t ambient_init(const ambient_level_config_t *cfg)
+{
+    if (cfg->window_ms < 100 || cfg->min_offset_db > cfg->max_offset_db) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // the task takes its own copy
+    ambient_level_config_t *copy = malloc(sizeof(*copy));
+    if (copy == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    *copy = *cfg;
+    ambient_level_init(&s_published, cfg);
+    ambient_aweight_init(&s_play_weight, AMBIENT_RATE);
+    s_running = true;
+    // below the player: a late window costs nothing
+    if (xTaskCreatePinnedToCore(ambient_task, "ambient", 1024 * 4, copy, configMAX_PRIORITIES - 6,
+                                NULL /*tskreturn*/, 1 /*core*/) != pdPASS) {
+        s_running = false;
+        free(copy);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void ambient_get(ambient_level_t *level)
+{
+    taskENTER_CRITICAL(&s_mux);
+    *level = s_published;
+    taskEXIT_CRITICAL(&s_mux);
+}
@@ -66,6 +66,8 @@ esp_err_t play_es8388_wav(wav_reader_state_t *wav_state) {
             if (bytes_read > 0) {
                 size_t total_written = 0;
                 uint8_t *write_ptr = data;
+                // so the ambient level can take the frame's own sound out of what the mics hear
+                ambient_note_playback(data, bytes_read);
                 while (total_written < bytes_read) {
                     // Write the received data to the ES8388
                     ret = es8388_write(write_ptr, bytes_read - total_written, &bytes_written);
@@ -0,0 +1,372 @@
+// flacReader
+//
+// LOUDFRAME project. Decodes a FLAC file from the sd card a frame at a time,
+// into the same ringbuf the wav_reader fills, so es8388_player plays it
+// unchanged. The decoder is components/flac_dec.
+
+// Author: Brian Bulkowski <brian@bulkowski.org> (c) 2025
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/ringbuf.h"
+#include "esp_heap_caps.h"
+
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "flac_dec.h"
+
+#include "player32.h"
+
+#define TAG "flacReader"
+
+// Decoded frames go to the ringbuf this many at a time, 4 KB of 16 bit
+// stereo, the size the player takes out
+#define FLAC_PCM_FRAMES (ES8388_PLAYER_WRITE_SIZE / 4)
+
+// Where the memory goes. A frame can be tens of KB (a 4608 sample block of
+// 24 bit stereo stored verbatim is 27 KB), and the decoder needs the whole
+// frame and 4 bytes a sample of work space, so both of those go to PSRAM when
+// there is some. They are bounded by STREAMINFO, not by the file. The card
+// reads land in a small internal DMA capable buffer first, because reads into
+// PSRAM glitch (see wav_read), and the ringbuf is fed from an internal 4 KB
+// chunk.
+typedef struct {
+    flac_dec_handle_t decoder;
+    flac_streaminfo_t info;
+    size_t frame_bound;         /**< Bytes the largest frame can take */
+    uint8_t *in;                /**< FLAC_READER_READ_SIZE, the target of the card reads */
+    uint8_t *win;               /**< frame_bound + FLAC_READER_READ_SIZE bytes of bitstream */
+    size_t win_size;
+    size_t win_start;           /**< Next byte to decode */
+    size_t win_len;             /**< Bytes read into the window */
+    bool eof;
+    int16_t *pcm;               /**< FLAC_PCM_FRAMES, stereo */
+    uint32_t frames;
+    uint32_t errors;            /**< Frames skipped as corrupt */
+} flac_reader_t;
+
+// PSRAM when there is some, internal otherwise
+static void *flac_malloc_big(size_t size) {
+    void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (p == NULL) {
+        p = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    return p;
+}
+
+// Move what is left to the front of the window and fill the rest from the file
+static esp_err_t flac_fill(wav_reader_state_t *state, flac_reader_t *flac) {
+    size_t left = flac->win_len - flac->win_start;
+    if (left > 0 && flac->win_start > 0) {
+        memmove(flac->win, flac->win + flac->win_start, left);
+    }
+    flac->win_start = 0;
+    flac->win_len = left;
+    while (!flac->eof && flac->win_len + FLAC_READER_READ_SIZE <= flac->win_size) {
+        ssize_t got = read(state->fd, flac->in, FLAC_READER_READ_SIZE);
+        if (got < 0) {
+            ESP_LOGE(TAG, "Error reading from file: %s", strerror(errno));
+            return ESP_FAIL;
+        }
+        if (got == 0) {
+            flac->eof = true;
+        }
+        memcpy(flac->win + flac->win_len, flac->in, got);
+        flac->win_len += got;
+    }
+    return ESP_OK;
+}
+
+static void flac_reader_free(wav_reader_state_t *state) {
+    flac_reader_t *flac = state->codec;
+    if (flac) {
+        flac_dec_destroy(flac->decoder);
+        free(flac->in);
+        free(flac->win);
+        free(flac->pcm);
+        free(flac);
+        state->codec = NULL;
+    }
+    if (state->fd >= 0)    close(state->fd);
+    state->fd = -1;
+    vRingbufferDelete(state->ringbuf);
+    state->ringbuf = NULL;
+    free(state->ringbuf_data_storage);
+    state->ringbuf_data_storage = NULL;
+    free(state->ringbuf_struct_storage);
+    state->ringbuf_struct_storage = NULL;
+}
+
+/**
+ * @brief Decode the file once, from the first frame to the end, into the ring buffer.
+ *
+ * A frame that fails its CRC is skipped and the next frame header found, so a
+ * damaged file plays with a gap rather than stopping.
+ *
+ * @return ESP_OK at the end of the file, ESP_FAIL on a read error.
+ */
+static esp_err_t flac_read(wav_reader_state_t *state) {
+    flac_reader_t *flac = state->codec;
+    esp_err_t err = ESP_OK;
+    size_t total_bytes_sent = 0;
+
+    // Reported at most once a second, as in wav_read
+    int64_t slow_report_time = esp_timer_get_time();
+    int slow_reads = 0, slow_sends = 0;
+    int64_t worst_read = 0, worst_send = 0, worst_decode = 0;
+
+    if (lseek(state->fd, state->data_offset, SEEK_SET) < 0) {
+        ESP_LOGE(TAG, "Failed to seek to data offset: %s", strerror(errno));
+        return ESP_FAIL;
+    }
+    flac->win_start = 0;
+    flac->win_len = 0;
+    flac->eof = false;
+    flac->frames = 0;
+    flac->errors = 0;
+
+    while (true) {
+
+        if (flac->win_len - flac->win_start < flac->frame_bound && !flac->eof) {
+            int64_t start_time = esp_timer_get_time();
+            if (flac_fill(state, flac) != ESP_OK) {
+                err = ESP_FAIL;
+                break;
+            }
+            int64_t delta = esp_timer_get_time() - start_time;
+            if (delta > (300 * 1000)) {
+                slow_reads++;
+                if (delta > worst_read) worst_read = delta;
+            }
+        }
+        size_t avail = flac->win_len - flac->win_start;
+        if (avail == 0) {
+            break;
+        }
+
+        size_t consumed, frames;
+        int64_t start_time = esp_timer_get_time();
+        esp_err_t ret = flac_dec_frame(flac->decoder, flac->win + flac->win_start, avail, &consumed, &frames);
+        int64_t delta = esp_timer_get_time() - start_time;
+        if (delta > worst_decode) worst_decode = delta;
+
+        if (ret == ESP_ERR_INVALID_SIZE && flac->eof) {
+            ESP_LOGW(TAG, "last frame truncated, %zu bytes dropped", avail);
+            break;
+        }
+        if (ret != ESP_OK) {
+            // Damaged, or larger than STREAMINFO said a frame could be
+            flac->errors++;
+            ESP_LOGD(TAG, "decode error %s, resyncing", esp_err_to_name(ret));
+            int sync = flac_dec_find_sync(flac->win + flac->win_start + 1, avail - 1);
+            if (sync >= 0) {
+                flac->win_start += 1 + sync;
+            } else if (flac->eof) {
+                break;
+            } else {
+                // keep what could be the start of a header (16 bytes at most) cut off by the window
+                flac->win_start = flac->win_len - (avail > 15 ? 15 : avail - 1);
+                if (flac_fill(state, flac) != ESP_OK) {
+                    err = ESP_FAIL;
+                    break;
+                }
+            }
+            continue;
+        }
+        flac->win_start += consumed;
+        flac->frames++;
+
+        for (size_t first = 0; first < frames; first += FLAC_PCM_FRAMES) {
+            size_t n = frames - first < FLAC_PCM_FRAMES ? frames - first : FLAC_PCM_FRAMES;
+            flac_dec_read_pcm16(flac->decoder, first, n, flac->pcm);
+
+            start_time = esp_timer_get_time();
+            BaseType_t result = xRingbufferSend(state->ringbuf, flac->pcm, n * 2 * sizeof(int16_t), portMAX_DELAY);
+            if (result != pdTRUE) {
+                ESP_LOGE(TAG, "Failed to send data to ring buffer - probable timeout? - continuing");
+            }
+            delta = esp_timer_get_time() - start_time;
+            if (delta > (100 * 1000)) {
+                slow_sends++;
+                if (delta > worst_send) worst_send = delta;
+            }
+            total_bytes_sent += n * 2 * sizeof(int16_t);
+        }
+
+        int64_t now = esp_timer_get_time();
+        if ((slow_reads || slow_sends) && now - slow_report_time > (1000 * 1000)) {
+            ESP_LOGW(TAG, "last %lld ms: %d slow reads (worst %lld us), %d slow ringbuf sends (worst %lld us), worst decode %lld us",
+                (now - slow_report_time) / 1000, slow_reads, worst_read, slow_sends, worst_send, worst_decode);
+            slow_report_time = now;
+            slow_reads = slow_sends = 0;
+            worst_read = worst_send = worst_decode = 0;
+        }
+    }
+
+    ESP_LOGI(TAG, "Finished decoding. %" PRIu32 " frames, %" PRIu32 " skipped, %zu bytes of PCM",
+        flac->frames, flac->errors, total_bytes_sent);
+    return err;
+}
+
+//
+// init, in the same shape as wav_reader_init
+//
+
+esp_err_t flac_reader_init(wav_reader_state_t *state) {
+
+    flac_reader_t *flac = NULL;
+    state->fd = -1;
+    state->ringbuf = NULL;
+    state->ringbuf_data_storage = NULL;
+    state->ringbuf_struct_storage = NULL;
+    state->codec = NULL;
+
+    if (wav_reader_init_ringbuf(state) != ESP_OK) {
+        goto err;
+    }
+
+    flac = heap_caps_calloc(1, sizeof(flac_reader_t), MALLOC_CAP_SPIRAM);
+    if (flac == NULL) {
+        flac = calloc(1, sizeof(flac_reader_t));
+    }
+    if (flac == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate reader state");
+        goto err;
+    }
+    state->codec = flac;
+
+    state->fd = open(state->filepath, O_RDONLY);
+    if (state->fd < 0) {
+        ESP_LOGE(TAG, "Failed to open file: %s (%s)", state->filepath, strerror(errno));
+        goto err;
+    }
+
+    // "fLaC", then metadata blocks, STREAMINFO first. The rest (seek table,
+    // tags, pictures) are skipped over.
+    uint8_t hdr[4];
+    if (read(state->fd, hdr, sizeof(hdr)) != sizeof(hdr) || memcmp(hdr, "fLaC", 4) != 0) {
+        ESP_LOGE(TAG, "Not a FLAC file: %s", state->filepath);
+        goto err;
+    }
+    bool have_info = false, last = false;
+    while (!last) {
+        if (read(state->fd, hdr, sizeof(hdr)) != sizeof(hdr)) {
+            ESP_LOGE(TAG, "File ends in the metadata");
+            goto err;
+        }
+        last = hdr[0] & 0x80;
+        uint32_t len = (hdr[1] << 16) | (hdr[2] << 8) | hdr[3];
+        if ((hdr[0] & 0x7f) == 0 && len == FLAC_STREAMINFO_LEN) {
+            uint8_t body[FLAC_STREAMINFO_LEN];
+            if (read(state->fd, body, sizeof(body)) != sizeof(body)) {
+                ESP_LOGE(TAG, "File ends in the metadata");
+                goto err;
+            }
+            if (flac_streaminfo_parse(body, &flac->info) != ESP_OK) {
+                ESP_LOGE(TAG, "Unsupported stream: %u channels, %u bits, blocks up to %u",
+                    (unsigned) flac->info.channels, (unsigned) flac->info.bits_per_sample, (unsigned) flac->info.max_block);
+                goto err;
+            }
+            have_info = true;
+        } else if (lseek(state->fd, len, SEEK_CUR) < 0) {
+            ESP_LOGE(TAG, "Failed to seek in file: %s", strerror(errno));
+            goto err;
+        }
+    }
+    if (!have_info) {
+        ESP_LOGE(TAG, "No STREAMINFO block");
+        goto err;
+    }
+    off_t start = lseek(state->fd, 0, SEEK_CUR);
+    off_t end = lseek(state->fd, 0, SEEK_END);
+    if (start < 0 || end < 0) {
+        ESP_LOGE(TAG, "Failed to seek in file: %s", strerror(errno));
+        goto err;
+    }
+
+    flac->frame_bound = flac_frame_bound(&flac->info);
+    flac->win_size = flac->frame_bound + FLAC_READER_READ_SIZE;
+    flac->in = heap_caps_malloc(FLAC_READER_READ_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+    flac->pcm = heap_caps_malloc(FLAC_PCM_FRAMES * 2 * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    flac->win = flac_malloc_big(flac->win_size);
+    if (flac->in == NULL || flac->pcm == NULL || flac->win == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate bitstream and pcm buffers");
+        goto err;
+    }
+    flac->decoder = flac_dec_create(&flac->info, MALLOC_CAP_SPIRAM);
+    if (flac->decoder == NULL) {
+        flac->decoder = flac_dec_create(&flac->info, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (flac->decoder == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate the decoder");
+        goto err;
+    }
+
+    state->audio_format = 1;
+    state->num_channels = 2;
+    state->sample_rate = flac->info.sample_rate;
+    state->bits_per_sample = 16;
+    state->block_align = state->num_channels * state->bits_per_sample / 8;
+    state->bytes_per_sec = state->sample_rate * state->block_align;
+    state->data_offset = start;
+    state->data_size = end - start;
+
+    ESP_LOGI(TAG, "read flac header, found the following: ");
+    ESP_LOGI(TAG, "channels in file: %u", (unsigned int) flac->info.channels);
+    ESP_LOGI(TAG, "bits_per_sample in file: %u", (unsigned int) flac->info.bits_per_sample);
+    ESP_LOGI(TAG, "sample_rate: %d", (int) state->sample_rate);
+    ESP_LOGI(TAG, "block size: %u to %u", (unsigned int) flac->info.min_block, (unsigned int) flac->info.max_block);
+    ESP_LOGI(TAG, "window: %zu bytes, decoder: %zu bytes",
+        flac->win_size, (size_t) flac->info.max_block * flac->info.channels * sizeof(int32_t));
+    ESP_LOGI(TAG, "data_size: %u", (unsigned int) state->data_size);
+    ESP_LOGI(TAG, "data_offset: %jd", (intmax_t)state->data_offset);
+    return ESP_OK;
+
+err:
+    ESP_LOGE(TAG, "flac_reader_init failed ");
+    flac_reader_free(state);
+    return ESP_FAIL;
+}
+
+void flac_reader_deinit(wav_reader_state_t *state) {
+
+    ESP_LOGI(TAG, "flac_reader deinit ");
+
+    flac_reader_free(state);
+    memset(state, 0xff, sizeof(wav_reader_state_t));
+    free(state);
+}
+
+/**
+ * @brief Task body: decodes the file into the ring buffer, over and over, like wav_reader_task.
+ *
+ * @param arg The wav_reader_state_t set up by flac_reader_init.
+ */
+void flac_reader_task(void* arg) {
+
+    wav_reader_state_t * state = (wav_reader_state_t *)arg;
+    esp_err_t err;
+
+    do {
+
+        ESP_LOGI(TAG, "task starting flac decode");
+        err = flac_read(state);
+        ESP_LOGI(TAG, "TASK ending flac decode");
+
+    } while(err == ESP_OK);
+
+    ESP_LOGE(TAG, "flac reader TASK:  exiting with error %d", err);
+    state->done = true;
+
+    vTaskDelete(NULL);
+}
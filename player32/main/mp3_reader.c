@@ -0,0 +1,371 @@
+// mp3Reader
+//
+// LOUDFRAME project. Decodes an MP3 file from the sd card a frame at a time,
+// into the same ringbuf the wav_reader fills, so es8388_player plays it
+// unchanged. The decoder is libhelix-mp3, which is fixed point throughout.
+
+// Author: Brian Bulkowski <brian@bulkowski.org> (c) 2025
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/ringbuf.h"
+#include "esp_heap_caps.h"
+
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "mp3dec.h"
+
+#include "player32.h"
+
+#define TAG "mp3Reader"
+
+// Refill the bitstream window when less than this is left. Two of the
+// largest frames, so a decode never runs short in the middle of the window,
+// and the reads stay around 6 KB.
+#define MP3_REFILL_BELOW (2 * 1441)
+
+// One decoded frame, stereo. Mono frames are widened into it in place.
+#define MP3_PCM_SAMPLES (MAX_NCHAN * MAX_NGRAN * MAX_NSAMP)
+
+// Where the memory goes. The per track bookkeeping is cold and goes to PSRAM
+// when there is some. The bitstream window and the PCM frame are touched on
+// every sample, so they stay in internal RAM; the window is also the target of
+// the card reads, and those glitch outside DMA capable memory (see wav_read).
+// Helix allocates its own state, about 25 KB, with plain malloc, which is
+// internal RAM with CONFIG_SPIRAM_USE_CAPS_ALLOC.
+typedef struct {
+    HMP3Decoder decoder;
+    uint8_t *in;                /**< MP3_READER_IN_SIZE bytes of bitstream */
+    uint8_t *in_ptr;            /**< Next byte to decode */
+    int in_left;                /**< Bytes from in_ptr to the end of what was read */
+    bool eof;
+    int16_t *pcm;               /**< MP3_PCM_SAMPLES */
+    uint32_t frames;
+    uint32_t errors;            /**< Frames skipped as corrupt */
+} mp3_reader_t;
+
+// Offset of the first byte after an ID3v2 tag, 0 without one
+static off_t mp3_skip_id3(int fd) {
+    uint8_t hdr[10];
+    if (lseek(fd, 0, SEEK_SET) < 0 || read(fd, hdr, sizeof(hdr)) != sizeof(hdr)) {
+        return 0;
+    }
+    if (memcmp(hdr, "ID3", 3) != 0) {
+        return 0;
+    }
+    // syncsafe: 7 bits a byte
+    off_t size = ((off_t)(hdr[6] & 0x7f) << 21) | ((hdr[7] & 0x7f) << 14) | ((hdr[8] & 0x7f) << 7) | (hdr[9] & 0x7f);
+    off_t footer = (hdr[5] & 0x10) ? 10 : 0;
+    ESP_LOGI(TAG, "skipping ID3v2 tag of %jd bytes", (intmax_t)(size + 10 + footer));
+    return size + 10 + footer;
+}
+
+// Move what is left to the front of the window and fill the rest from the file
+static esp_err_t mp3_fill(wav_reader_state_t *state, mp3_reader_t *mp3) {
+    if (mp3->in_left > 0 && mp3->in_ptr != mp3->in) {
+        memmove(mp3->in, mp3->in_ptr, mp3->in_left);
+    }
+    mp3->in_ptr = mp3->in;
+    while (!mp3->eof && mp3->in_left < MP3_READER_IN_SIZE) {
+        ssize_t got = read(state->fd, mp3->in + mp3->in_left, MP3_READER_IN_SIZE - mp3->in_left);
+        if (got < 0) {
+            ESP_LOGE(TAG, "Error reading from file: %s", strerror(errno));
+            return ESP_FAIL;
+        }
+        if (got == 0) {
+            mp3->eof = true;
+        }
+        mp3->in_left += got;
+    }
+    return ESP_OK;
+}
+
+static void mp3_reader_free(wav_reader_state_t *state) {
+    mp3_reader_t *mp3 = state->codec;
+    if (mp3) {
+        if (mp3->decoder) MP3FreeDecoder(mp3->decoder);
+        free(mp3->in);
+        free(mp3->pcm);
+        free(mp3);
+        state->codec = NULL;
+    }
+    if (state->fd >= 0)    close(state->fd);
+    state->fd = -1;
+    vRingbufferDelete(state->ringbuf);
+    state->ringbuf = NULL;
+    free(state->ringbuf_data_storage);
+    state->ringbuf_data_storage = NULL;
+    free(state->ringbuf_struct_storage);
+    state->ringbuf_struct_storage = NULL;
+}
+
+/**
+ * @brief Decode the file once, from the first frame to the end, into the ring buffer.
+ *
+ * Frames the decoder rejects are skipped a byte at a time until it finds the next
+ * sync word, so a damaged file plays with a gap rather than stopping.
+ *
+ * @return ESP_OK at the end of the file, ESP_FAIL on a read error.
+ */
+static esp_err_t mp3_read(wav_reader_state_t *state) {
+    mp3_reader_t *mp3 = state->codec;
+    esp_err_t err = ESP_OK;
+    size_t total_bytes_sent = 0;
+
+    // Reported at most once a second, as in wav_read
+    int64_t slow_report_time = esp_timer_get_time();
+    int slow_reads = 0, slow_sends = 0;
+    int64_t worst_read = 0, worst_send = 0, worst_decode = 0;
+
+    if (lseek(state->fd, state->data_offset, SEEK_SET) < 0) {
+        ESP_LOGE(TAG, "Failed to seek to data offset: %s", strerror(errno));
+        return ESP_FAIL;
+    }
+    mp3->in_ptr = mp3->in;
+    mp3->in_left = 0;
+    mp3->eof = false;
+    mp3->frames = 0;
+    mp3->errors = 0;
+
+    while (true) {
+
+        if (mp3->in_left < MP3_REFILL_BELOW && !mp3->eof) {
+            int64_t start_time = esp_timer_get_time();
+            if (mp3_fill(state, mp3) != ESP_OK) {
+                err = ESP_FAIL;
+                break;
+            }
+            int64_t delta = esp_timer_get_time() - start_time;
+            if (delta > (300 * 1000)) {
+                slow_reads++;
+                if (delta > worst_read) worst_read = delta;
+            }
+        }
+        if (mp3->in_left == 0) {
+            break;
+        }
+
+        int sync = MP3FindSyncWord(mp3->in_ptr, mp3->in_left);
+        if (sync < 0) {
+            // keep the last byte, it could be the first half of a sync word
+            mp3->in_ptr += mp3->in_left - 1;
+            mp3->in_left = 1;
+            if (mp3->eof) break;
+            continue;
+        }
+        mp3->in_ptr += sync;
+        mp3->in_left -= sync;
+
+        uint8_t *frame = mp3->in_ptr;
+        int64_t start_time = esp_timer_get_time();
+        int ret = MP3Decode(mp3->decoder, &mp3->in_ptr, &mp3->in_left, mp3->pcm, 0);
+        int64_t delta = esp_timer_get_time() - start_time;
+        if (delta > worst_decode) worst_decode = delta;
+
+        if (ret == ERR_MP3_INDATA_UNDERFLOW) {
+            if (mp3->eof) {
+                ESP_LOGW(TAG, "last frame truncated, %d bytes dropped", mp3->in_left);
+                break;
+            }
+            if (mp3->in_left < MP3_READER_IN_SIZE) {
+                // the frame runs past what was read
+                if (mp3_fill(state, mp3) != ESP_OK) {
+                    err = ESP_FAIL;
+                    break;
+                }
+                continue;
+            }
+            // a whole window and still short: not a real frame header
+        }
+        if (ret != ERR_MP3_NONE) {
+            // MAINDATA_UNDERFLOW is normal after a resync: the frame's bit
+            // reservoir was in frames that weren't decoded
+            if (ret != ERR_MP3_MAINDATA_UNDERFLOW) {
+                mp3->errors++;
+                ESP_LOGD(TAG, "decode error %d, resyncing", ret);
+            }
+            if (mp3->in_ptr == frame) {
+                mp3->in_ptr += 1;
+                mp3->in_left -= 1;
+            }
+            continue;
+        }
+
+        MP3FrameInfo info;
+        MP3GetLastFrameInfo(mp3->decoder, &info);
+        size_t samples = info.outputSamps;
+        if (info.nChans == 1) {
+            // the DAC is set up for stereo: widen in place, from the back
+            for (size_t i = samples; i-- > 0; ) {
+                mp3->pcm[2 * i] = mp3->pcm[2 * i + 1] = mp3->pcm[i];
+            }
+            samples *= 2;
+        }
+        mp3->frames++;
+
+        start_time = esp_timer_get_time();
+        BaseType_t result = xRingbufferSend(state->ringbuf, mp3->pcm, samples * sizeof(int16_t), portMAX_DELAY);
+        if (result != pdTRUE) {
+            ESP_LOGE(TAG, "Failed to send data to ring buffer - probable timeout? - continuing");
+        }
+        delta = esp_timer_get_time() - start_time;
+        if (delta > (100 * 1000)) {
+            slow_sends++;
+            if (delta > worst_send) worst_send = delta;
+        }
+        total_bytes_sent += samples * sizeof(int16_t);
+
+        int64_t now = esp_timer_get_time();
+        if ((slow_reads || slow_sends) && now - slow_report_time > (1000 * 1000)) {
+            ESP_LOGW(TAG, "last %lld ms: %d slow reads (worst %lld us), %d slow ringbuf sends (worst %lld us), worst decode %lld us",
+                (now - slow_report_time) / 1000, slow_reads, worst_read, slow_sends, worst_send, worst_decode);
+            slow_report_time = now;
+            slow_reads = slow_sends = 0;
+            worst_read = worst_send = worst_decode = 0;
+        }
+    }
+
+    ESP_LOGI(TAG, "Finished decoding. %" PRIu32 " frames, %" PRIu32 " skipped, %zu bytes of PCM",
+        mp3->frames, mp3->errors, total_bytes_sent);
+    return err;
+}
+
+//
+// init, in the same shape as wav_reader_init
+//
+
+esp_err_t mp3_reader_init(wav_reader_state_t *state) {
+
+    mp3_reader_t *mp3 = NULL;
+    state->fd = -1;
+    state->ringbuf = NULL;
+    state->ringbuf_data_storage = NULL;
+    state->ringbuf_struct_storage = NULL;
+    state->codec = NULL;
+
+    if (wav_reader_init_ringbuf(state) != ESP_OK) {
+        goto err;
+    }
+
+    mp3 = heap_caps_calloc(1, sizeof(mp3_reader_t), MALLOC_CAP_SPIRAM);
+    if (mp3 == NULL) {
+        mp3 = calloc(1, sizeof(mp3_reader_t));
+    }
+    if (mp3 == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate reader state");
+        goto err;
+    }
+    state->codec = mp3;
+
+    mp3->in = heap_caps_malloc(MP3_READER_IN_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+    mp3->pcm = heap_caps_malloc(MP3_PCM_SAMPLES * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (mp3->in == NULL || mp3->pcm == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate bitstream and pcm buffers");
+        goto err;
+    }
+    mp3->decoder = MP3InitDecoder();
+    if (mp3->decoder == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate the decoder");
+        goto err;
+    }
+
+    state->fd = open(state->filepath, O_RDONLY);
+    if (state->fd < 0) {
+        ESP_LOGE(TAG, "Failed to open file: %s (%s)", state->filepath, strerror(errno));
+        goto err;
+    }
+
+    // Find the first frame and take the stream's parameters from its header
+    off_t start = mp3_skip_id3(state->fd);
+    off_t end = lseek(state->fd, 0, SEEK_END);
+    if (end < 0 || lseek(state->fd, start, SEEK_SET) < 0) {
+        ESP_LOGE(TAG, "Failed to seek in file: %s", strerror(errno));
+        goto err;
+    }
+    mp3->in_ptr = mp3->in;
+    mp3->in_left = 0;
+    mp3->eof = false;
+    if (mp3_fill(state, mp3) != ESP_OK) {
+        goto err;
+    }
+    MP3FrameInfo info;
+    int sync = 0;
+    while (true) {
+        int found = MP3FindSyncWord(mp3->in + sync, mp3->in_left - sync);
+        if (found < 0) {
+            ESP_LOGE(TAG, "No MP3 frame in the first %d bytes", mp3->in_left);
+            goto err;
+        }
+        sync += found;
+        if (MP3GetNextFrameInfo(mp3->decoder, &info, mp3->in + sync) == ERR_MP3_NONE) {
+            break;
+        }
+        sync++;
+    }
+
+    state->audio_format = 1;
+    state->num_channels = 2;
+    state->sample_rate = info.samprate;
+    state->bits_per_sample = 16;
+    state->block_align = state->num_channels * state->bits_per_sample / 8;
+    state->bytes_per_sec = state->sample_rate * state->block_align;
+    state->data_offset = start + sync;
+    state->data_size = end - state->data_offset;
+
+    ESP_LOGI(TAG, "read mp3 header, found the following: ");
+    ESP_LOGI(TAG, "mpeg version: %d layer %d", info.version, info.layer);
+    ESP_LOGI(TAG, "bitrate: %d", info.bitrate);
+    ESP_LOGI(TAG, "channels in file: %d", info.nChans);
+    ESP_LOGI(TAG, "sample_rate: %d", (int) state->sample_rate);
+    ESP_LOGI(TAG, "data_size: %u", (unsigned int) state->data_size);
+    ESP_LOGI(TAG, "data_offset: %jd", (intmax_t)state->data_offset);
+    return ESP_OK;
+
+err:
+    ESP_LOGE(TAG, "mp3_reader_init failed ");
+    mp3_reader_free(state);
+    return ESP_FAIL;
+}
+
+void mp3_reader_deinit(wav_reader_state_t *state) {
+
+    ESP_LOGI(TAG, "mp3_reader deinit ");
+
+    mp3_reader_free(state);
+    memset(state, 0xff, sizeof(wav_reader_state_t));
+    free(state);
+}
+
+/**
+ * @brief Task body: decodes the file into the ring buffer, over and over, like wav_reader_task.
+ *
+ * @param arg The wav_reader_state_t set up by mp3_reader_init.
+ */
+void mp3_reader_task(void* arg) {
+
+    wav_reader_state_t * state = (wav_reader_state_t *)arg;
+    esp_err_t err;
+
+    do {
+
+        ESP_LOGI(TAG, "task starting mp3 decode");
+        err = mp3_read(state);
+        ESP_LOGI(TAG, "TASK ending mp3 decode");
+
+    } while(err == ESP_OK);
+
+    ESP_LOGE(TAG, "mp3 reader TASK:  exiting with error %d", err);
+    state->done = true;
+
+    vTaskDelete(NULL);
+}
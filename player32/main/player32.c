@@ -45,10 +45,15 @@
 // local
 #include "es8388.h"
 #include "maxbotics.h"
+#include "bench.h"
 #include "player32.h"
 
 static const char *TAG = "player32";
 
+// The room level from the mics sets an offset on the volume, see ambient.c.
+// It needs the ADC, so this changes the codec setup as well as starting the task.
+#define AMBIENT_ENABLE 0
+
 /* reminder about prioreitize
 // low is low, so 0 is idle
 // configMAX_PRIORITIES is the highest. 
@@ -331,9 +336,17 @@ void app_main(void)
     // codec mode ()
     // audio_hal_codec_i2s_iface (i2s_iface)
     es_codec_config_t cfg = {
+#if AMBIENT_ENABLE
+        .adc_input = ADC_INPUT_LINPUT1_RINPUT1, /*!< the board's mics */
+#else
         .adc_input = ADC_INPUT_DISABLE,       /*!< set adc channel es_adc_input */
+#endif
         .dac_output = (DAC_OUTPUT_LOUT_PWR | DAC_OUTPUT_ROUT_PWR | DAC_OUTPUT_LOUT1 | DAC_OUTPUT_ROUT1) ,     /*!< set dac channel es_dac_output */
+#if AMBIENT_ENABLE
+        .codec_mode = ES_CODEC_MODE_BOTH,       /*!< both makes the RX channel too */
+#else
         .codec_mode = ES_CODEC_MODE_DECODE,     /*!< select codec mode: adc, dac or both */
+#endif
         .i2s_iface = {
             .mode = ES_MODE_SLAVE,      /* es_iface_mode !< Audio interface operating mode: master or slave */
             .fmt = ES_I2S_NORMAL,           /* es_uis_fmt !< Audio interface format */
@@ -348,7 +361,7 @@ void app_main(void)
         ESP_LOGE(TAG, "ES8388 init failed: %d",(int) ret);
     }
 
-    ret = es8388_start(ES_MODULE_DAC);
+    ret = es8388_start(AMBIENT_ENABLE ? ES_MODULE_ADC_DAC : ES_MODULE_DAC);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "ES8388 start failed: %d",(int) ret);
     }
@@ -374,7 +387,7 @@ void app_main(void)
 #if 1
     // hardcode
     const char music_filename[] = "/sdcard/test-short.wav";
-    enum FILETYPE_ENUM music_filetype;
+    enum FILETYPE_ENUM music_filetype = FILETYPE_UNKNOWN;
     if (music_filename_validate_vfs(music_filename, &music_filetype) == ESP_OK) {
         ESP_LOGI(TAG, "Filename %s and Filetype %d detected", music_filename, (int) music_filetype);
     }
@@ -384,7 +397,7 @@ void app_main(void)
 #else
     // find one
     char *music_filename;
-    enum FILETYPE_ENUM music_filetype;
+    enum FILETYPE_ENUM music_filetype = FILETYPE_UNKNOWN;
     if (music_filename_get_vfs( &music_filename, &music_filetype) == ESP_OK) {
         ESP_LOGI(TAG, "Filename %s and Filetype %d detected", music_filename, (int) music_filetype);
     }
@@ -408,8 +421,21 @@ void app_main(void)
     }
     wav_state->filepath = &music_filename[0];
 
-     if (ESP_OK != wav_reader_init(wav_state)) {
-        ESP_LOGE(TAG, "Could not initialize wav reader ");
+    // mp3 and flac decode a frame at a time into the same ringbuf, the player can't tell
+    esp_err_t (*reader_init)(wav_reader_state_t *) = wav_reader_init;
+    TaskFunction_t reader_task = wav_reader_task;
+    const char *reader_name = "wav_reader";
+    if (music_filetype == FILETYPE_MP3) {
+        reader_init = mp3_reader_init;
+        reader_task = mp3_reader_task;
+        reader_name = "mp3_reader";
+    } else if (music_filetype == FILETYPE_FLAC) {
+        reader_init = flac_reader_init;
+        reader_task = flac_reader_task;
+        reader_name = "flac_reader";
+    }
+     if (ESP_OK != reader_init(wav_state)) {
+        ESP_LOGE(TAG, "Could not initialize %s ", reader_name);
      }
 
     // wav reader puts data in a ringbuf.
@@ -418,7 +444,8 @@ void app_main(void)
 
     // Read from the file
 #if 1
-    xTaskCreatePinnedToCore(wav_reader_task, "wav_reader", 1024 * 6 /*stksz*/,(void *) wav_state, configMAX_PRIORITIES - 2, 
+    xTaskCreatePinnedToCore(reader_task, reader_name,
+        1024 * 6 /*stksz*/,(void *) wav_state, configMAX_PRIORITIES - 2, 
         NULL /*tskreturn*/, 1 /*core*/);
 #else
     // Generate a tone, the same way - TEST CODE, but not yet debugged! TODO :-) 
@@ -451,6 +478,13 @@ void app_main(void)
                                 NULL/*tskreturn*/, 1 /*core*/);
 #endif
 
+#if 0
+    // kernel micro-benchmarks: one JSON line per kernel on the console, see components/bench.
+    // Best with the player tasks above off, or they are timed too.
+    xTaskCreatePinnedToCore(bench_task, "bench", 1024 * 6, NULL, configMAX_PRIORITIES - 6,
+                                NULL/*tskreturn*/, 1 /*core*/);
+#endif
+
 #if 0
     // little test code to make sure changing volume works, generally
     xTaskCreatePinnedToCore(volume_task, "volume_task", 1024 * 4, NULL, configMAX_PRIORITIES - 6, 
@@ -463,6 +497,16 @@ void app_main(void)
                                 NULL/*tskreturn*/, 1 /*core*/);
 #endif
 
+#if AMBIENT_ENABLE
+    // louder in a loud room, on top of whatever the proximity sensor sets. quiet_dbfs is
+    // at the mic, so it wants tuning to the board and the room: watch the "room" log lines.
+    ambient_level_config_t ambient_cfg = AMBIENT_LEVEL_CONFIG_DEFAULT();
+    ret = ambient_init(&ambient_cfg);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "ambient init failed: %d",(int) ret);
+    }
+#endif
+
     // UGLY TODO! Need to have something other than a hard block
     vTaskDelay(portMAX_DELAY);
     // and a print to remember what I'm doing stuffs
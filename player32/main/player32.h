@@ -6,10 +6,13 @@
 #include "freertos/ringbuf.h"
 #include "esp_log.h"
 
+#include "ambient_level.h"
+
 enum FILETYPE_ENUM {
     FILETYPE_UNKNOWN,
     FILETYPE_MP3,
-    FILETYPE_WAV
+    FILETYPE_WAV,
+    FILETYPE_FLAC
 };
 
 // size to read from file system
@@ -18,6 +21,11 @@ enum FILETYPE_ENUM {
 #define WAV_READER_RINGBUF_SIZE (64 * 1024) // Example size, adjust as needed
 // size to transmit to es8388 to ensure buffer size
 #define ES8388_PLAYER_WRITE_SIZE (4 * 1024)
+// mp3 bitstream window, read from the file system and decoded from in place.
+// Has to hold the largest frame (1441 bytes at 320 kbps, 32 kHz) with room to spare
+#define MP3_READER_IN_SIZE (8 * 1024)
+// flac reads from the file system, copied on into a window sized from STREAMINFO
+#define FLAC_READER_READ_SIZE (8 * 1024)
 
 void print_task_list();
 void print_task_stats();
@@ -34,6 +42,8 @@ typedef struct {
     StaticRingbuffer_t *ringbuf_struct_storage;
 
     bool done;
+
+    void *codec;                /**< reader private state, the decoder for mp3_reader and flac_reader */
     
     // wav parameters
     uint16_t audio_format;      /** 1 is PCM, 3 is float */
@@ -44,6 +54,7 @@ typedef struct {
     uint16_t block_align;       /**< Block alignment (channels * bits_per_sample / 8) */
     off_t data_offset;          /**< Offset to the beginning of the data chunk */
     uint32_t bytes_per_sec;       /**< Average bytes per second */
+    uint16_t samples_per_block; /**< IMA ADPCM only: frames in each block_align bytes */
 } wav_reader_state_t;
 
 
@@ -67,6 +78,18 @@ esp_err_t wav_reader_header_read(wav_reader_state_t *state);
 esp_err_t wav_reader_init(wav_reader_state_t *state );
 void wav_reader_deinit(wav_reader_state_t *state);
 void wav_reader_task(void* arg);
+esp_err_t wav_reader_init_ringbuf(wav_reader_state_t *state);
+
+// mp3_reader: decodes into the same ringbuf, as 16 bit stereo PCM, so the player
+// doesn't know the difference. Fills in the wav parameters from the first frame.
+esp_err_t mp3_reader_init(wav_reader_state_t *state);
+void mp3_reader_deinit(wav_reader_state_t *state);
+void mp3_reader_task(void* arg);
+
+// flac_reader: the same, for FLAC, 16 bit stereo PCM whatever the file is
+esp_err_t flac_reader_init(wav_reader_state_t *state);
+void flac_reader_deinit(wav_reader_state_t *state);
+void flac_reader_task(void* arg);
 
 // tone_reader
 
@@ -74,6 +97,12 @@ esp_err_t tone_reader_init(wav_reader_state_t *state );
 void tone_reader_deinit(wav_reader_state_t *state);
 void tone_reader_task(void* arg);
 
+// ambient: the room level from the mics, as an offset on the volume. ambient_note_playback
+// is for the player, with each block it sends the codec, and returns at once when ambient isn't running.
+esp_err_t ambient_init(const ambient_level_config_t *cfg);
+void ambient_note_playback(const void *pcm, size_t bytes);
+void ambient_get(ambient_level_t *level);
+
 // SDCARD pin config (taken from the board_defs file in esp-adf )
 #define FUNC_SDCARD_EN            (1)
 #define SDCARD_OPEN_FILE_NUM_MAX  5
@@ -47,6 +47,7 @@ static const char *TAG = "sdreader";
 
 static const char MP3_SUFFIX[] = ".mp3";
 static const char WAV_SUFFIX[] = ".wav";
+static const char FLAC_SUFFIX[] = ".flac";
 static const char PATH_PREFIX[] = "/sdcard";
 
 int music_filename_validate_vfs( const char *filename, enum FILETYPE_ENUM *filetype_o) {
@@ -78,6 +79,12 @@ int music_filename_validate_vfs( const char *filename, enum FILETYPE_ENUM *filet
         ESP_LOGI(TAG, "[ MFV ] Found WAV: %s", filename);
         *filetype_o = FILETYPE_WAV;
     }
+    // is it flac?
+    else if ((lenstr > sizeof(FLAC_SUFFIX)) &&
+         (strncmp(filename + lenstr - sizeof(FLAC_SUFFIX) + 1 , FLAC_SUFFIX, sizeof(FLAC_SUFFIX) -1) == 0 ) ) {
+        ESP_LOGI(TAG, "[ MFV ] Found FLAC: %s", filename);
+        *filetype_o = FILETYPE_FLAC;
+    }
     else {
         ESP_LOGW(TAG, "[] File %s is not a supported encoder extension", filename);
         return(-1);
@@ -133,6 +140,15 @@ int music_filename_get_vfs( char **file_o, enum FILETYPE_ENUM *filetype_o) {
             sprintf(filename, "%s/%s", PATH_PREFIX, ent->d_name);
             *filetype_o = FILETYPE_WAV;
         }
+        // is it flac?
+        else if ((lenstr > sizeof(FLAC_SUFFIX)) &&
+             (strncmp(ent->d_name + lenstr - sizeof(FLAC_SUFFIX) + 1 , FLAC_SUFFIX, sizeof(FLAC_SUFFIX) -1) == 0 ) ) {
+            ESP_LOGI(TAG, "[ MFG ] Found FLAC: %s", ent->d_name);
+            if (filename) free(filename);
+            filename = malloc(lenstr + sizeof(PATH_PREFIX) + 2);
+            sprintf(filename, "%s/%s", PATH_PREFIX, ent->d_name);
+            *filetype_o = FILETYPE_FLAC;
+        }
 
     }
     ESP_LOGI(TAG, "[ 1.1] that's all the SDcard");
@@ -26,6 +26,7 @@
 #include "esp_timer.h"
 #include "esp_log.h"
 
+#include "ima_adpcm.h"
 #include "player32.h"
 
 #define TAG "wavReader"
@@ -123,11 +124,12 @@ esp_err_t wav_reader_header_read(wav_reader_state_t *state) {
                 ESP_LOGE(TAG, "Failed to read sample_rate");
                 return ESP_FAIL;  
             }
-            if (lseek(fd, 6, SEEK_CUR) < 0) {
-                ESP_LOGE(TAG, "Failed to skip bytes per sec and block align %s", strerror(errno));
+            uint32_t file_bytes_per_sec;
+            uint16_t file_block_align;
+            if (read(fd, &file_bytes_per_sec, 4) != 4 || read(fd, &file_block_align, 2) != 2) {
+                ESP_LOGE(TAG, "Failed to read bytes per sec and block align %s", strerror(errno));
                 return ESP_FAIL;  
-
-            } // Skip bytes_per_sec and block_align
+            }
             
             if (read(fd, &state->bits_per_sample, 2) != 2) {
                 ESP_LOGE(TAG, "Failed to read bits_per_sample");
@@ -138,9 +140,30 @@ esp_err_t wav_reader_header_read(wav_reader_state_t *state) {
             state->bytes_per_sec = state->sample_rate * state->num_channels * state->bits_per_sample / 8;
             fmt_found = true;
 
+            uint32_t fmt_read = 16;
+            if (state->audio_format == IMA_ADPCM_WAV_FORMAT) {
+                // compressed: the block size is the file's, and the extension
+                // (cbSize, then samples per block) says how many frames it holds
+                uint16_t ext[2];
+                if (chunk_size < 20 || read(fd, ext, 4) != 4) {
+                    ESP_LOGE(TAG, "IMA ADPCM fmt chunk without samples per block");
+                    return ESP_FAIL;
+                }
+                fmt_read = 20;
+                state->block_align = file_block_align;
+                state->samples_per_block = ext[1];
+                state->bytes_per_sec = file_bytes_per_sec;
+                if (state->num_channels > IMA_ADPCM_MAX_CHANNELS || state->block_align > WAV_READER_READ_SIZE ||
+                    ima_adpcm_block_frames(state->block_align, state->num_channels) != state->samples_per_block) {
+                    ESP_LOGE(TAG, "Unsupported IMA ADPCM layout: %u channels, block %u bytes, %u samples",
+                        (unsigned) state->num_channels, (unsigned) state->block_align, (unsigned) state->samples_per_block);
+                    return ESP_FAIL;
+                }
+            }
+
             // Skip any remaining data in the fmt chunk if it's larger than the basic PCM info
-            if (chunk_size > 16) {
-                if (lseek(fd, chunk_size - 16, SEEK_CUR) < 0) {
+            if (chunk_size > fmt_read) {
+                if (lseek(fd, chunk_size - fmt_read, SEEK_CUR) < 0) {
                     ESP_LOGE(TAG, "Failed to seek past extra fmt chunk data: %s", strerror(errno));
                     return ESP_FAIL;
                 }
@@ -151,7 +174,12 @@ esp_err_t wav_reader_header_read(wav_reader_state_t *state) {
             data_found = true;
             break;  // Stop reading after the data chunk header
         } else {
-            ESP_LOGW(TAG, "Skipping unknown chunk: %4s (size: %" PRIu32 ")", chunk_id, chunk_size);
+            // fact comes with every compressed file, the length is in data's size anyway
+            if (strncmp(chunk_id, "fact", 4) == 0) {
+                ESP_LOGD(TAG, "Skipping fact chunk");
+            } else {
+                ESP_LOGW(TAG, "Skipping unknown chunk: %4s (size: %" PRIu32 ")", chunk_id, chunk_size);
+            }
             if (lseek(fd, (off_t)chunk_size, SEEK_CUR) < 0) {
                 ESP_LOGE(TAG, "Failed to seek past unknown chunk: %s", strerror(errno));
                 return ESP_FAIL;
@@ -173,6 +201,9 @@ esp_err_t wav_reader_header_read(wav_reader_state_t *state) {
     ESP_LOGI(TAG, "block_align: %d", (int)state->block_align);
     ESP_LOGI(TAG, "data_offset: %jd", (intmax_t)state->data_offset);
     ESP_LOGI(TAG, "bytes_per_sec: %u", (unsigned int) state->bytes_per_sec);
+    if (state->audio_format == IMA_ADPCM_WAV_FORMAT) {
+        ESP_LOGI(TAG, "IMA ADPCM, samples_per_block: %u", (unsigned int) state->samples_per_block);
+    }
 
     return ESP_OK;
 }
@@ -183,7 +214,7 @@ esp_err_t wav_reader_header_read(wav_reader_state_t *state) {
  *
  * @return ESP_OK on success, ESP_FAIL on failure.
  */
-static esp_err_t wav_reader_init_ringbuf( wav_reader_state_t *state ) {    
+esp_err_t wav_reader_init_ringbuf( wav_reader_state_t *state ) {    
 
     ESP_LOGI(TAG, "initalizing ringbuf");
 
@@ -227,11 +258,48 @@ static esp_err_t wav_reader_init_ringbuf( wav_reader_state_t *state ) {
  */
 
 
+/**
+ * @brief Decode the whole IMA ADPCM blocks at the front of buf and send the PCM to the ring buffer.
+ *
+ * A partial block at the end is moved to the front of buf for the next read to complete.
+ * At the end of the data the last block may be short, and is decoded as it is.
+ *
+ * @param len   Bytes in buf
+ * @param pcm   Room for one block's frames
+ * @param last  No more data follows
+ * @return The bytes of partial block left at the front of buf.
+ */
+static size_t wav_send_adpcm(wav_reader_state_t *state, uint8_t *buf, size_t len, int16_t *pcm, bool last) {
+    size_t off = 0;
+    while (len - off >= state->block_align || (last && off < len)) {
+        size_t block_len = len - off < state->block_align ? len - off : state->block_align;
+        size_t frames;
+        if (ima_adpcm_decode_block(buf + off, block_len, state->num_channels, pcm, &frames) == ESP_OK) {
+            if (xRingbufferSend(state->ringbuf, pcm, frames * state->num_channels * sizeof(int16_t), portMAX_DELAY) != pdTRUE) {
+                ESP_LOGE(TAG, "Failed to send data to ring buffer - probable timeout? - continuing");
+            }
+        } else {
+            ESP_LOGW(TAG, "bad IMA ADPCM block of %zu bytes, skipped", block_len);
+        }
+        off += block_len;
+    }
+    memmove(buf, buf + off, len - off);
+    return len - off;
+}
+
 static esp_err_t wav_read(wav_reader_state_t *state) {
     size_t bytes_read;
     size_t total_bytes_read = 0;
     esp_err_t err = ESP_OK;
 
+    // Slow reads, slow sends and a low ring buffer are counted and reported
+    // at most once a second. Logging each one from this loop puts UART time
+    // on top of the very stall being reported.
+    int64_t slow_report_time = esp_timer_get_time();
+    int slow_reads = 0, slow_sends = 0, low_fills = 0;
+    int64_t worst_read = 0, worst_send = 0;
+    size_t lowest_fill = WAV_READER_RINGBUF_SIZE;
+
     // Calculate initial offset within the first aligned block
     size_t current_read_size = WAV_READER_READ_SIZE - ( state->data_offset % WAV_READER_READ_SIZE );
 
@@ -239,13 +307,33 @@ static esp_err_t wav_read(wav_reader_state_t *state) {
 
     // note about memory pool. Starting with MALLOC_CAP_INTERNAL, as I think I have enough space,
     // if there's not enough space, switching to MALLOC_CAP_SPIRAM is probably a good idea
-    uint8_t* read_buffer = (uint8_t*)heap_caps_malloc(WAV_READER_READ_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA); // glitch free
+    // IMA ADPCM: a partial block is carried over in front of the next read, and each
+    // block is decoded into pcm on its way to the ringbuf. Reads stay aligned.
+    bool adpcm = (state->audio_format == IMA_ADPCM_WAV_FORMAT);
+    size_t carry = 0;
+    int16_t *pcm = NULL;
+    size_t read_buffer_size = WAV_READER_READ_SIZE + (adpcm ? state->block_align : 0);
+    // a read decodes to several times its size, and waiting for room to send it takes as much longer
+    int64_t slow_send_us = 100 * 1000;
+    if (adpcm) {
+        size_t pcm_block = state->samples_per_block * state->num_channels * sizeof(int16_t);
+        slow_send_us *= (pcm_block + state->block_align - 1) / state->block_align;
+    }
+    uint8_t* read_buffer = (uint8_t*)heap_caps_malloc(read_buffer_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA); // glitch free
     // uint8_t* read_buffer = (uint8_t*)heap_caps_malloc(WAV_READER_READ_SIZE, MALLOC_CAP_INTERNAL); // likely iram CAUSES GLITCHES
     // uint8_t* read_buffer = (uint8_t*)heap_caps_malloc(WAV_READER_READ_SIZE, MALLOC_CAP_SPIRAM); // AUSES GLITCHES
     if (!read_buffer) {
         ESP_LOGE(TAG, "Failed to allocate read buffer");
         return ESP_FAIL;
     }
+    if (adpcm) {
+        pcm = heap_caps_malloc(state->samples_per_block * state->num_channels * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (!pcm) {
+            ESP_LOGE(TAG, "Failed to allocate pcm buffer");
+            err = ESP_FAIL;
+            goto cleanup;
+        }
+    }
 
     // Seek to the beginning of the data
     if (lseek(state->fd, state->data_offset, SEEK_SET) < 0) {
@@ -270,7 +358,7 @@ static esp_err_t wav_read(wav_reader_state_t *state) {
 
         int64_t start_time = esp_timer_get_time();
 
-        bytes_read = read(state->fd, read_buffer, current_read_size);
+        bytes_read = read(state->fd, read_buffer + carry, current_read_size);
         if (bytes_read != current_read_size) {
             if (bytes_read == 0) {
                 ESP_LOGI(TAG, "End of file reached while reading audio data");
@@ -283,7 +371,8 @@ static esp_err_t wav_read(wav_reader_state_t *state) {
         }
         int64_t delta = esp_timer_get_time() - start_time;
         if (delta > (300 * 1000)) { // 1000 microseconds = 1 millisecond, adjust as needed
-            ESP_LOGW(TAG, "Read operation took longer than expected: %lld us %zu bytes read", delta, bytes_read);
+            slow_reads++;
+            if (delta > worst_read) worst_read = delta;
         }
 
         // ESP_LOGD(TAG, "read %zu bytes from file, writing to ringbuf %p", bytes_read, state->ringbuf);
@@ -296,23 +385,40 @@ static esp_err_t wav_read(wav_reader_state_t *state) {
 
         start_time = esp_timer_get_time();
 
-        BaseType_t result = xRingbufferSend(state->ringbuf, read_buffer, bytes_read, portMAX_DELAY);
-        if (result != pdTRUE) {
-            ESP_LOGE(TAG, "Failed to send data to ring buffer - probable timeout? - continuing");
-            // Handle ring buffer full condition, potentially by waiting or retrying
+        if (adpcm) {
+            carry = wav_send_adpcm(state, read_buffer, carry + bytes_read, pcm,
+                                   total_bytes_read + bytes_read >= state->data_size);
+        } else {
+            BaseType_t result = xRingbufferSend(state->ringbuf, read_buffer, bytes_read, portMAX_DELAY);
+            if (result != pdTRUE) {
+                ESP_LOGE(TAG, "Failed to send data to ring buffer - probable timeout? - continuing");
+                // Handle ring buffer full condition, potentially by waiting or retrying
+            }
         }
 
         // ok, if we are writing 4k, then we should have a combined speed of about 23ms. If the read time of the bytes
         // is about 4k, we should tot to about 18ms.
         delta = esp_timer_get_time() - start_time;
-        if (delta > (100 * 1000) ) { // 1000 microseconds = 1 millisecond, adjust as needed
-            ESP_LOGW(TAG, "RingBuffer Send operation took longer than expected: %lld us for %zu ", delta, bytes_read);
+        if (delta > slow_send_us) {
+            slow_sends++;
+            if (delta > worst_send) worst_send = delta;
         }
         // expect to get control when there's still a fair amount of data, check if we're underflowing
         // although it's true after the first write because we're still filling it!
         size_t ringBufFreeSz = xRingbufferGetCurFreeSize(state->ringbuf);
         if ( WAV_READER_RINGBUF_SIZE - ringBufFreeSz < 4096 ) {
-            ESP_LOGW(TAG, "RingBuffer full space smaller than expected after write: %zu bytes", WAV_READER_RINGBUF_SIZE - ringBufFreeSz);
+            low_fills++;
+            if (WAV_READER_RINGBUF_SIZE - ringBufFreeSz < lowest_fill) lowest_fill = WAV_READER_RINGBUF_SIZE - ringBufFreeSz;
+        }
+
+        int64_t now = esp_timer_get_time();
+        if ((slow_reads || slow_sends || low_fills) && now - slow_report_time > (1000 * 1000)) {
+            ESP_LOGW(TAG, "last %lld ms: %d slow reads (worst %lld us), %d slow ringbuf sends (worst %lld us), %d low fills (lowest %zu bytes)",
+                (now - slow_report_time) / 1000, slow_reads, worst_read, slow_sends, worst_send, low_fills, lowest_fill);
+            slow_report_time = now;
+            slow_reads = slow_sends = low_fills = 0;
+            worst_read = worst_send = 0;
+            lowest_fill = WAV_READER_RINGBUF_SIZE;
         }
 
         total_bytes_read += bytes_read;
@@ -322,6 +428,7 @@ static esp_err_t wav_read(wav_reader_state_t *state) {
     ESP_LOGI(TAG, "Finished reading audio data. Total bytes read: %zu", total_bytes_read);
 cleanup:
     free(read_buffer);
+    free(pcm);
     ESP_LOGI(TAG, "wav_reader: returning with error %d",err);
     return err;
 }